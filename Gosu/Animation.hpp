@@ -0,0 +1,83 @@
+//! \file Animation.hpp
+//! Interface of the Animation and Animator classes.
+
+#ifndef GOSU_ANIMATION_HPP
+#define GOSU_ANIMATION_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/Image.hpp>
+#include <Gosu/SpriteLayer.hpp>
+#include <Gosu/TR1.hpp>
+#include <memory>
+#include <vector>
+
+namespace Gosu
+{
+    //! A list of frames, usually from loadTiles, each shown for a number of
+    //! milliseconds. Copies share the frames, so passing animations around
+    //! by value is cheap.
+    class Animation
+    {
+        struct Data;
+        std::tr1::shared_ptr<const Data> data;
+        friend class Animator;
+
+    public:
+        //! Shows every frame for frameDuration milliseconds.
+        Animation(const std::vector<Image>& frames, unsigned frameDuration);
+        //! Shows frames[i] for durations[i] milliseconds.
+        Animation(const std::vector<Image>& frames,
+            const std::vector<unsigned>& durations);
+
+        unsigned frameCount() const;
+        const Image& frame(unsigned index) const;
+        //! Sum of the durations of all frames.
+        unsigned long duration() const;
+
+        //! Returns the index of the frame to show after the given number of
+        //! milliseconds. If the animation does not loop, it stays on its
+        //! last frame.
+        unsigned frameIndexAt(unsigned long time, bool looping = true) const;
+        const Image& frameAt(unsigned long time, bool looping = true) const;
+    };
+
+    //! Plays animations on the sprites of a SpriteLayer. All of them are
+    //! advanced together by update(), which only touches sprites whose
+    //! frame has changed, so that only their buckets are recorded again.
+    class Animator
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! The layer must live longer than the animator.
+        explicit Animator(SpriteLayer& layer);
+        ~Animator();
+
+        //! Starts playing an animation on a sprite, replacing the one it
+        //! played before. The sprite shows the first frame right away.
+        //! \param speed Factor for the passing of time, e.g. 2 to play
+        //! twice as fast.
+        void play(SpriteLayer::Handle sprite, const Animation& animation,
+            bool looping = true, double speed = 1);
+        //! Stops the animation of a sprite, leaving it on its current frame.
+        void stop(SpriteLayer::Handle sprite);
+        //! Returns false once a non-looping animation has reached its last
+        //! frame, or if none has been started.
+        bool playing(SpriteLayer::Handle sprite) const;
+        //! Number of sprites with an animation.
+        std::size_t size() const;
+
+        //! Pauses all animations, e.g. while the game is paused. Time that
+        //! passes while paused is not counted.
+        void setPaused(bool paused);
+        bool paused() const;
+
+        //! Advances all animations to the current time (see milliseconds),
+        //! and forgets about sprites that have been removed from the layer.
+        //! Usually called once in Window::update.
+        void update();
+    };
+}
+
+#endif
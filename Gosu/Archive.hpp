@@ -0,0 +1,71 @@
+//! \file Archive.hpp
+//! Many small files packed into a single one, to be loaded from with fewer
+//! system calls and seeks.
+
+#ifndef GOSU_ARCHIVE_HPP
+#define GOSU_ARCHIVE_HPP
+
+#include <Gosu/IO.hpp>
+#include <Gosu/TR1.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Gosu
+{
+    //! Read-only set of files stored in one archive file, which is opened
+    //! and mapped into memory only once. The index of an archive is sorted,
+    //! so finding an entry takes logarithmic time.
+    //! Entry names are relative paths, like "media/Star.png"; backslashes
+    //! are treated as slashes.
+    class Archive
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! Opens an archive that was written by createArchive. Throws an
+        //! exception if the file is not a valid archive.
+        explicit Archive(const std::wstring& filename);
+        ~Archive();
+
+        //! Returns the number of files in the archive.
+        std::size_t size() const;
+        //! Returns the name of the index-th file, in sorted order.
+        std::wstring name(std::size_t index) const;
+
+        //! Returns the file with the given name as a read-only resource
+        //! that is valid as long as the archive, or 0 if there is none.
+        const Resource* find(const std::wstring& name) const;
+        //! Like find, but throws an exception if there is no such file.
+        const Resource& entry(const std::wstring& name) const;
+        //! Convenience: Returns a reader at the start of the given file.
+        Reader reader(const std::wstring& name) const
+        {
+            return entry(name).frontReader();
+        }
+    };
+
+    //! Packs the given files into a new archive, or replaces an existing
+    //! one. The names are stored as given and read from the given
+    //! directory, which may be empty to use the working directory.
+    //! \param compress If true, files that get smaller are compressed, and
+    //! decompressed as they are read. Other files are stored as they are and
+    //! can still be read without copying them.
+    void createArchive(const std::wstring& filename,
+        const std::vector<std::wstring>& names,
+        const std::wstring& directory = L"", bool compress = false);
+
+    //! Makes the constructors of Image and Sample, Song and loadTiles that
+    //! take a filename look into the archive first: If it contains a file
+    //! with the given name, it is loaded from the archive instead of the
+    //! disk. Archives that are mounted later take precedence.
+    void mountArchive(const std::tr1::shared_ptr<const Archive>& archive);
+    //! Stops looking into an archive that has been mounted before.
+    void unmountArchive(const std::tr1::shared_ptr<const Archive>& archive);
+    //! Returns the file with the given name from the mounted archives,
+    //! or 0 if none of them contains it.
+    const Resource* findInMountedArchives(const std::wstring& name);
+}
+
+#endif
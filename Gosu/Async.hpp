@@ -1,50 +1,204 @@
-// Undocumented for the first few iterations. Interface may change rapidly.
-// This is mainly a proof of concept. Stability will be the highest on OS X.
+//! \file Async.hpp
+//! Loading of resources on background threads.
 
-#if 0
 #ifndef GOSU_ASYNC_HPP
 #define GOSU_ASYNC_HPP
 
 #include <Gosu/Fwd.hpp>
+#include <Gosu/Audio.hpp>
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/Font.hpp>
+#include <Gosu/Image.hpp>
 #include <Gosu/TR1.hpp>
-#include <thread>
+#include <cstddef>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace Gosu
 {
+    //! Runs jobs on a fixed number of worker threads. Each job can have a
+    //! completion callback, which is called on the main thread by deliver().
+    //! Every worker has a queue of its own and steals jobs from the others
+    //! when it runs out, so jobs can queue more jobs cheaply.
+    class AsyncPool
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        typedef std::tr1::function<void()> Job;
+        typedef std::tr1::function<void(std::size_t begin, std::size_t end)> RangeJob;
+
+        //! \param threads Number of worker threads. 0 picks one fewer than
+        //! there are CPU cores, but at least one.
+        explicit AsyncPool(unsigned threads = 0);
+        //! Jobs that have not started yet are discarded; running jobs are
+        //! waited for. Completion callbacks are not called anymore.
+        ~AsyncPool();
+
+        unsigned threads() const;
+        //! Number of jobs that have not been delivered yet.
+        unsigned pending() const;
+
+        //! Runs work on a worker thread, then done on the thread that calls
+        //! deliver(). Jobs must not touch OpenGL or any Gosu object that is
+        //! being used on the main thread. Jobs can enqueue more jobs; these
+        //! run on the same worker next, unless another one steals them.
+        void enqueue(const Job& work, const Job& done = Job());
+        //! Calls body(begin, end) for consecutive ranges that together cover
+        //! [0; count), on the workers and the calling thread at once, and
+        //! returns when all of them are done. Can be called from jobs, too.
+        //! If body throws, the first error is rethrown as std::runtime_error
+        //! once all ranges are done.
+        //! \param grain Length of each range, except maybe the last. 0 picks
+        //! a length that gives each thread a few ranges.
+        void parallelFor(std::size_t count, const RangeJob& body, std::size_t grain = 0);
+        //! Calls the completion callbacks of all jobs that have finished
+        //! since the last call. Should be called once per frame, e.g. from
+        //! Window::update(). If a job threw an exception, it is rethrown
+        //! as std::runtime_error after the other callbacks have run.
+        void deliver();
+        //! Blocks until all jobs are done, then delivers them.
+        void finish();
+    };
+
+    //! Returns the pool that Gosu uses for its own parallel work, and that
+    //! games can use instead of creating one of their own, so that there
+    //! are not more busy threads than cores. Created on first use. Like any
+    //! pool, its completion callbacks run in deliver(), which the game has
+    //! to call, e.g. from Window::update().
+    AsyncPool& sharedAsyncPool();
+    //! Sets the number of worker threads of the shared pool (see
+    //! AsyncPool::AsyncPool), e.g. to leave cores to other programs. Throws
+    //! std::logic_error if the pool has been created already.
+    void setSharedAsyncPoolThreads(unsigned threads);
+
+    //! A value that is produced by an AsyncPool job. Since values are only
+    //! set from AsyncPool::deliver(), AsyncResult does not need to be
+    //! synchronized. Copies refer to the same value.
     template<typename Result>
     class AsyncResult
     {
-        std::tr1::shared_ptr<std::tr1::try_mutex> mutex;
         std::tr1::shared_ptr<std::auto_ptr<Result> > result;
-        
+
     public:
-        AsyncResult(const std::tr1::shared_ptr<std::tr1::try_mutex>& mutex,
-                    const std::tr1::shared_ptr<std::auto_ptr<Result> >& result)
-        : mutex(mutex), result(result)
+        AsyncResult()
+        : result(new std::auto_ptr<Result>)
         {
         }
-        
+
         bool hasValue() const
         {
-            std::tr1::try_mutex::scoped_try_lock lock(*mutex);
-            return lock && result->get();
+            return result->get() != 0;
         }
-        
+
+        //! Returns the value and leaves this result empty.
         std::auto_ptr<Result> takeValue()
         {
-            std::tr1::try_mutex::scoped_lock lock(*mutex);
             return *result;
         }
+
+        void setValue(std::auto_ptr<Result> value)
+        {
+            *result = value;
+        }
     };
-    
-	// TODO: Will only work if the window doesn't die inbetween.
-	// TODO: More functions to come; or a general interface?
 
-	AsyncResult<Image>
-		asyncNewImage(Window& window, const std::wstring& filename);
+    //! Decodes an image file on a worker thread. The image is created from it
+    //! during AsyncPool::deliver(), so that no GL context is needed on the
+    //! worker.
+    AsyncResult<Image> asyncNewImage(AsyncPool& pool, Graphics& graphics,
+        const std::wstring& filename, bool tileable = false);
+
+    //! Loads many images at once: All files are decoded in parallel, then the
+    //! images are created on the calling thread, tallest first so that they
+    //! pack well onto textures. The result is in the same order as filenames.
+    //! \param threads See AsyncPool; 0 uses the shared pool.
+    std::vector<Image> loadImages(Graphics& graphics,
+        const std::vector<std::wstring>& filenames, bool tileable = false,
+        unsigned threads = 0);
+
+    //! Decodes an image file into a Bitmap on a worker thread.
+    AsyncResult<Bitmap> asyncLoadImageFile(AsyncPool& pool, const std::wstring& filename);
+
+    //! Saves a copy of the buffer with saveFileAtomically on a worker
+    //! thread, so that e.g. autosaves do not hold up the game, then calls
+    //! done from AsyncPool::deliver(). Saves to the same file should not
+    //! overlap, as they would race for the temporary file.
+    void asyncSaveFile(AsyncPool& pool, const Buffer& buffer, const std::wstring& filename,
+        const AsyncPool::Job& done = AsyncPool::Job());
+
+    //! Loads and decodes a sample on a worker thread.
+    AsyncResult<Sample> asyncNewSample(AsyncPool& pool, const std::wstring& filename);
+
+    //! Opens a song on a worker thread and preloads it (see Song::preload),
+    //! so that neither opening nor playing it makes the game wait.
+    AsyncResult<Song> asyncNewSong(AsyncPool& pool, const std::wstring& filename);
+
+    //! Renders text into a Bitmap on a worker thread (see createText).
+    //! Text rendering is not reentrant on every platform, so text jobs run
+    //! one after another, and no text should be drawn on the main thread
+    //! (e.g. with Font) while they are pending.
+    AsyncResult<Bitmap> asyncCreateText(AsyncPool& pool, const std::wstring& text,
+        const std::wstring& fontName, unsigned fontHeight);
+
+    //! Loads a list of assets that is declared up front, e.g. for a loading
+    //! screen. Files are read one after another on a background I/O thread,
+    //! from mounted archives or the disk (see Archive.hpp), and decoded by
+    //! worker threads. Only the final steps that need the main thread, like
+    //! uploading images to textures, happen in update(), and only as many
+    //! as fit into the upload budget, so that the frame rate stays smooth.
+    class AssetManifest
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! \param threads Number of decoding threads, see AsyncPool.
+        explicit AssetManifest(Graphics& graphics, unsigned threads = 0);
+        //! Assets that are still loading are discarded.
+        ~AssetManifest();
+
+        //! Adds assets to load. Must be called before start().
+        void addImage(const std::wstring& filename, bool tileable = false);
+        //! See loadTiles.
+        void addTiles(const std::wstring& filename, int tileWidth,
+            int tileHeight, bool tileable = false);
+        void addSample(const std::wstring& filename);
+        void addSong(const std::wstring& filename);
+        void addFont(const std::wstring& fontName, unsigned fontHeight);
+
+        //! Starts loading everything that has been added.
+        void start();
+        //! Should be called once per frame while loading, e.g. from
+        //! Window::update(). Rethrows errors of the background threads as
+        //! std::runtime_error.
+        void update();
+        //! Blocks until everything has been loaded.
+        void finish();
+
+        //! Milliseconds that update() may spend on creating images and other
+        //! objects on the main thread per call; at least one is created per
+        //! call either way. The default is 4.
+        unsigned uploadBudget() const;
+        void setUploadBudget(unsigned milliseconds);
+
+        //! Number of assets that have been added, and that are ready.
+        std::size_t total() const;
+        std::size_t loaded() const;
+        //! Between 0 and 1.
+        double progress() const;
+        bool done() const;
+
+        //! Return the loaded assets. Throw std::logic_error if an asset has
+        //! not been added or is not ready yet.
+        Image& image(const std::wstring& filename) const;
+        const std::vector<Image>& tiles(const std::wstring& filename) const;
+        Sample& sample(const std::wstring& filename) const;
+        Song& song(const std::wstring& filename) const;
+        Font& font(const std::wstring& fontName, unsigned fontHeight) const;
+    };
 }
 
 #endif
-#endif
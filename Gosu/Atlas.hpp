@@ -0,0 +1,71 @@
+//! \file Atlas.hpp
+//! Images that have been packed onto textures ahead of time, so that they
+//! are loaded with one upload per texture.
+
+#ifndef GOSU_ATLAS_HPP
+#define GOSU_ATLAS_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/Graphics.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace Gosu
+{
+    //! Set of named images loaded from an atlas file. All images of an
+    //! atlas share a few textures, which are uploaded as a whole, so loading
+    //! them neither packs nor uploads each image separately, and images that
+    //! are drawn together are likely to be drawn in the same batch.
+    //! Images are valid as long as the atlas.
+    class Atlas
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! Loads an atlas that was written by createAtlas. Like Image, it is
+        //! loaded from the mounted archives first (see Archive.hpp). Throws
+        //! an exception if the file is not a valid atlas.
+        //! \param formatFlags Either 0, or one of bfRGBA4444, bfRGB565 and
+        //! bfAlpha8 to keep all pages in that format.
+        Atlas(Graphics& graphics, const std::wstring& filename, unsigned formatFlags = 0);
+        ~Atlas();
+
+        //! Returns the number of images in the atlas.
+        std::size_t size() const;
+        //! Returns the name of the index-th image, in sorted order.
+        std::wstring name(std::size_t index) const;
+
+        //! Returns the image with the given name, or 0 if there is none.
+        const Image* find(const std::wstring& name) const;
+        //! Like find, but throws an exception if there is no such image.
+        const Image& image(const std::wstring& name) const;
+
+        //! Writes a macro (see Graphics::endRecording) to a file, so that
+        //! loadMacro can load it without drawing everything into it again.
+        //! The macro must only draw images of this atlas and untextured
+        //! shapes, which are referenced by the atlas page they are on, and
+        //! must not contain shaders or custom OpenGL code.
+        void saveMacro(const Image& macro, const std::wstring& filename) const;
+        //! Loads a macro that was saved with the same atlas file. Its
+        //! vertices are uploaded as they are stored, so this mostly costs
+        //! reading the file. Like the atlas itself, it is loaded from the
+        //! mounted archives first.
+        //! Most usually, the return value is passed to Image::Image().
+        std::auto_ptr<ImageData> loadMacro(const std::wstring& filename) const;
+    };
+
+    //! Packs the given image files onto pages of pageSize x pageSize pixels
+    //! and writes them into a new atlas file, or replaces an existing one.
+    //! The names are stored as given and read from the given directory,
+    //! which may be empty to use the working directory. The layout only
+    //! depends on the images, not on the order of names. Images are padded
+    //! like those created with bfSmooth.
+    //! \param pageSize Must not be larger than MAX_TEXTURE_SIZE.
+    void createAtlas(const std::wstring& filename,
+        const std::vector<std::wstring>& names,
+        const std::wstring& directory = L"", unsigned pageSize = MAX_TEXTURE_SIZE);
+}
+
+#endif
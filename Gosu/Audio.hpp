@@ -58,6 +58,34 @@ namespace Gosu
         void changeSpeed(double speed);
 	};
 
+    //! What Sample::play does when all channels are busy (see
+    //! Sample::setStealingPolicy). Sounds only ever take the channel of a
+    //! sound with the same or a lower priority.
+    enum StealingPolicy
+    {
+        //! The new sound is not played.
+        spNone,
+        //! Stops the sound that was started first.
+        spOldest,
+        //! Stops the sound with the lowest volume; the oldest of those.
+        spQuietest,
+        //! Stops the sound with the lowest priority; the oldest of those.
+        spLowestPriority
+    };
+    
+    //! What Sample::play does when a sample is already playing as often as
+    //! Sample::setMaxInstances allows.
+    enum InstanceLimitPolicy
+    {
+        //! Stops the instance of the sample that was started first.
+        ilStealOldest,
+        //! The new sound is not played.
+        ilIgnoreNew,
+        //! The newest instance becomes louder instead, as if both were
+        //! playing, and is returned.
+        ilMerge
+    };
+
     //! A sample is a short sound that is completely loaded in memory, can be
     //! played multiple times at once and offers very flexible playback
     //! parameters. Use samples for everything that's not music.
@@ -69,11 +97,21 @@ namespace Gosu
     public:
         //! Constructs a sample that can be played on the specified audio
         //! system and loads the sample from a file.
-        explicit Sample(const std::wstring& filename);
+        //! While loading, the sample needs its decoded size twice: once for
+        //! the decoded data, which is freed again right away, and once for
+        //! OpenAL's copy; plus the compressed file.
+        //! \param compressed If true and the file is in the Ogg Vorbis
+        //! format, it is kept compressed in memory and decoded while
+        //! playing. This takes much less memory and a little more CPU time;
+        //! it suits long sounds like ambient loops. Each playing instance
+        //! decodes into buffers of its own, which Song::update refills.
+        //! Other formats are always decoded in advance.
+        explicit Sample(const std::wstring& filename, bool compressed = false);
         
         //! Constructs a sample that can be played on the specified audio
         //! system and loads the sample data from a stream.
-        explicit Sample(Reader reader);
+        //! \param compressed See above.
+        explicit Sample(Reader reader, bool compressed = false);
         
         //! Plays the sample without panning.
         //! \param volume Can be anything from 0.0 (silence) to 1.0 (full
@@ -81,8 +119,10 @@ namespace Gosu
         //! \param speed Playback speed is only limited by the underlying audio library,
         //! and can accept very high or low values. Use 1.0 for
         //! normal playback speed.
+        //! \param priority Decides which sounds may be stopped to make room
+        //! for this one when all channels are busy (see StealingPolicy).
         SampleInstance play(double volume = 1, double speed = 1,
-            bool looping = false) const;
+            bool looping = false, int priority = 0) const;
 
         //! Plays the sample with panning. Even if pan is 0.0, the sample will
         //! not be as loud as if it were played by calling play() due to the
@@ -93,8 +133,84 @@ namespace Gosu
         //! \param speed Playback speed is only limited by by the underlying audio library,
         //! and can accept very high
         //! or low values. Use 1.0 for normal playback speed.
+        //! \param priority See play.
         SampleInstance playPan(double pan, double volume = 1, double speed = 1,
-            bool looping = false) const;
+            bool looping = false, int priority = 0) const;
+        
+        //! Bytes of memory that the sample keeps alive, i.e. OpenAL's copy
+        //! of the decoded data, or the file if it is kept compressed.
+        std::size_t memoryUsage() const;
+        
+        //! Limits how many instances of this sample can play at the same
+        //! time, e.g. so that many explosions at once do not take all
+        //! channels and turn into noise. Samples that are loaded from the
+        //! same file share this setting. 0, the default, means no limit.
+        void setMaxInstances(unsigned instances,
+            InstanceLimitPolicy policy = ilStealOldest);
+        unsigned maxInstances() const;
+        //! Plays of this sample that come within the given number of
+        //! milliseconds after the previous one are merged into it like with
+        //! ilMerge. The default is 0, which never merges.
+        void setMinRetriggerInterval(unsigned milliseconds);
+        unsigned minRetriggerInterval() const;
+        
+        //! Limits how many samples can play at the same time. Playing more
+        //! has no effect until one of them has finished. Channels are only
+        //! created when all existing ones are busy, so games that play a
+        //! few sounds at a time only use a few. The default is 254 (31 on
+        //! iOS); the driver may support fewer.
+        static void setMaxChannels(unsigned channels);
+        //! Returns how many channels have been created so far.
+        static unsigned allocatedChannels();
+        //! Returns how many samples are playing or paused. Finished samples
+        //! are only noticed by Song::update, which Window calls every tick.
+        static unsigned activeChannels();
+        //! Decides which sound to stop when a sample is played while all
+        //! channels are busy. The default is spNone.
+        static void setStealingPolicy(StealingPolicy policy);
+        //! If enabled, what happens to samples during a tick, such as
+        //! playing them or changing their volume, is held back and takes
+        //! effect all at once at the next Song::update, which Window calls
+        //! every tick. This saves work for the driver when many sounds start
+        //! together, and keeps them in sync. Sounds can start up to a tick
+        //! later. Drivers without AL_SOFT_deferred_updates may ignore it.
+        static void setBatching(bool batching);
+        //! Converts samples that are loaded afterwards to the rate that the
+        //! audio device mixes at, and/or to mono, so that OpenAL has less
+        //! work per playing voice. Only mono samples can be panned, so
+        //! games that use playPan with stereo files should convert them.
+        //! Compressed samples are not converted. Both are off by default.
+        static void setLoadConversion(bool toDeviceRate, bool toMono);
+        //! Keeps the decoded data of samples that are loaded from files in
+        //! the given directory, which must exist and end in a separator,
+        //! like userSettingsPrefix(). Later runs load it from there instead
+        //! of decoding the files again, until they change on disk.
+        //! Compressed samples are not cached. Empty by default, which
+        //! disables the cache.
+        static void setDecodedCacheDirectory(const std::wstring& directory);
+        //! Asks for the audio device to mix at the given rate in Hz, and the
+        //! given number of times per second. More updates per second let
+        //! sounds be heard sooner, at the cost of more work for the driver.
+        //! The source counts tell the driver how many mono and stereo sounds
+        //! to make room for. Zero leaves a value up to the driver, which is
+        //! what happens by default; on Linux, OpenAL Soft then often mixes
+        //! in periods of 40 ms or more. The device is opened when the first
+        //! sample or song is loaded, so this must be called before that, or
+        //! it throws std::logic_error. Drivers may not honor the values.
+        static void setDeviceConfiguration(unsigned frequency, unsigned refreshRate,
+            unsigned monoSources = 0, unsigned stereoSources = 0);
+        //! Returns the mixing rate that the device was opened with, or 0
+        //! if it has not been opened yet.
+        static unsigned deviceFrequency();
+        //! Returns how many times per second the device mixes, or 0 if it
+        //! has not been opened yet.
+        static unsigned deviceRefreshRate();
+        //! Returns how long it can take, in seconds, from playing a sample to
+        //! hearing it: one mixing period, plus the latency of the device
+        //! itself if the driver reports it (ALC_SOFT_device_clock). Games
+        //! can subtract this to keep sounds in time with the screen, e.g.
+        //! in rhythm games. Returns 0 if the device has not been opened yet.
+        static double deviceLatency();
 
         #ifndef SWIG
         GOSU_DEPRECATED Sample(Audio& audio, const std::wstring& filename);
@@ -133,6 +249,15 @@ namespace Gosu
         //! Starts or resumes playback of the song. This will stop all other
         //! songs and set the current song to this object.
         void play(bool looping = false);
+        //! Decodes the beginning of the song on the thread that streams
+        //! songs, so that play() only has to start the buffers that are
+        //! ready instead of decoding them. Meant for switching songs without
+        //! a hitch, e.g. a few ticks before a level ends. Does nothing if
+        //! the song is playing or paused. See also asyncNewSong, which
+        //! also opens the file in the background.
+        void preload();
+        //! Returns false while preload() has not finished yet.
+        bool preloaded() const;
         //! Pauses playback of the song. It is not considered being played.
         //! currentSong will stay the same.
         void pause();
@@ -149,8 +274,20 @@ namespace Gosu
         //! Changes the volume of the song.
         void changeVolume(double volume);
         
-        //! Called every tick by Window for management purposes.
+        //! Called every tick by Window for management purposes. This also
+        //! frees the channels of samples that have finished playing.
         static void update();
+        
+        //! Songs are decoded and streamed to OpenAL on a thread of their own,
+        //! in the given number of buffers of the given size in bytes. More
+        //! and larger buffers survive longer stalls of the system, but take
+        //! longer to fill when a song starts. Applies to songs that are
+        //! created afterwards. The default is 4 buffers of 32 KiB (16 KiB
+        //! on iOS); at least 2 are used.
+        static void setStreamBuffers(unsigned count, std::size_t size);
+        //! Returns how often a song ran out of data because its buffers
+        //! were not refilled in time.
+        static unsigned long underruns();
 
         #ifndef SWIG
         enum Type { stStream, stModule };
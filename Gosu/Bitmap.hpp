@@ -9,6 +9,7 @@
 #include <Gosu/GraphicsBase.hpp>
 #include <Gosu/Platform.hpp>
 #include <string>
+#include <utility>
 #include <vector>
 
 namespace Gosu
@@ -16,7 +17,8 @@ namespace Gosu
     //! Rectangular area of pixels, each represented by a Color value. Provides
     //! minimal drawing functionality and serves as a temporary holder for
     //! graphical resources which are usually turned into Images later.
-    //! Has (expensive) value semantics.
+    //! Has (expensive) value semantics, and can be moved cheaply with
+    //! swap, or with std::move on C++11 compilers.
     class Bitmap
     {
         unsigned w, h;
@@ -25,6 +27,24 @@ namespace Gosu
     public:
         Bitmap() : w(0), h(0) {}
         Bitmap(unsigned w, unsigned h, Color c = Color::NONE) : w(w), h(h), pixels(w * h, c) {}
+        
+        #if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1600)
+        Bitmap(const Bitmap& other) : w(other.w), h(other.h), pixels(other.pixels) {}
+        Bitmap& operator=(const Bitmap& other)
+        {
+            w = other.w, h = other.h, pixels = other.pixels;
+            return *this;
+        }
+        Bitmap(Bitmap&& other) : w(other.w), h(other.h), pixels(std::move(other.pixels))
+        {
+            other.w = other.h = 0;
+        }
+        Bitmap& operator=(Bitmap&& other)
+        {
+            swap(other);
+            return *this;
+        }
+        #endif
 
         unsigned width()  const { return w; }
         unsigned height() const { return h; }
@@ -86,6 +106,27 @@ namespace Gosu
         unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
         unsigned borderFlags);	
 
+    //! Filters for resample.
+    enum ResampleFilter
+    {
+        //! Averages all pixels that a new pixel covers. Best for scaling
+        //! down; scaling up keeps the pixels sharp.
+        rfBox,
+        //! Interpolates between the nearest pixels. Smooth when scaling up,
+        //! but skips pixels when scaling down to less than half the size.
+        rfBilinear
+    };
+    
+    //! Scales a portion of a bitmap to the given size and stores it in
+    //! dest, which may be the same as source. Transparent pixels do not
+    //! bleed into the result.
+    void resample(Bitmap& dest, const Bitmap& source,
+        unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
+        unsigned width, unsigned height, ResampleFilter filter = rfBox);
+    //! Scales a whole bitmap, see the other resample.
+    void resample(Bitmap& dest, const Bitmap& source,
+        unsigned width, unsigned height, ResampleFilter filter = rfBox);
+
     // Use loadImageFile/saveImageFile instead.
     GOSU_DEPRECATED Reader loadFromBMP(Bitmap& bmp, Reader reader);
     GOSU_DEPRECATED Writer saveToBMP(const Bitmap& bmp, Writer writer);
@@ -0,0 +1,76 @@
+//! \file Camera.hpp
+//! Interface of the Camera class.
+
+#ifndef GOSU_CAMERA_HPP
+#define GOSU_CAMERA_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/Graphics.hpp>
+#include <memory>
+
+namespace Gosu
+{
+    //! Looks at a point of a scrolling world, optionally zoomed and rotated,
+    //! and shows it in a viewport on the screen. The world can be drawn in
+    //! parallax layers that scroll slower or faster than the camera moves.
+    //! Each layer is drawn under a single transformation (see
+    //! Graphics::pushTransform). While it is active, TileLayer, large images
+    //! and Graphics::visibleArea only look at what the camera can see.
+    class Camera
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! Creates a camera that looks at (0; 0) and shows it in the middle
+        //! of the whole screen.
+        explicit Camera(Graphics& graphics);
+        ~Camera();
+
+        //! The point of the world that is shown in the middle of the
+        //! viewport.
+        double x() const;
+        double y() const;
+        void setPosition(double x, double y);
+
+        //! Values larger than 1 make the world appear larger.
+        double zoom() const;
+        void setZoom(double zoom);
+
+        //! Rotation of the world around the middle of the viewport, in
+        //! degrees.
+        double angle() const;
+        void setAngle(double angle);
+
+        //! The part of the screen the camera draws to, e.g. for split
+        //! screens. Layers are clipped to it unless it covers the whole
+        //! screen, which is the default.
+        void setViewport(double left, double top, double width, double height);
+
+        //! Returns the transformation that shows a layer with the given
+        //! parallax factor. Layers with a factor of 1 move along with the
+        //! camera, smaller factors make layers appear farther away, and 0
+        //! keeps a layer in place.
+        Transform transform(double parallax = 1) const;
+
+        //! Returns the bounding box of the part of a layer that the camera
+        //! can see, in the layer's coordinates.
+        void visibleRect(double& left, double& top, double& right, double& bottom,
+            double parallax = 1) const;
+
+        //! Converts between screen coordinates (e.g. the mouse position) and
+        //! the coordinates of a layer.
+        void toWorld(double screenX, double screenY, double& x, double& y,
+            double parallax = 1) const;
+        void toScreen(double x, double y, double& screenX, double& screenY,
+            double parallax = 1) const;
+
+        //! Makes everything that is drawn until the matching endLayer
+        //! appear in the given parallax layer. Can be nested with other
+        //! transformations, but not with other layers of the same camera.
+        void beginLayer(double parallax = 1);
+        void endLayer();
+    };
+}
+
+#endif
@@ -0,0 +1,64 @@
+//! \file CollisionMask.hpp
+//! Interface of the CollisionMask class.
+
+#ifndef GOSU_COLLISIONMASK_HPP
+#define GOSU_COLLISIONMASK_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/TR1.hpp>
+#include <string>
+#include <vector>
+
+namespace Gosu
+{
+    //! Which pixels of a bitmap are solid, packed into one bit per pixel,
+    //! for pixel-perfect collision tests. Masks are made from the same
+    //! bitmap as the image they belong to, usually right when it is loaded,
+    //! so that no pixels have to be read back from the graphics card.
+    class CollisionMask
+    {
+        unsigned w, h;
+        // Words per row, including one word of padding at the end, which
+        // lets overlaps() read two words at any offset inside a row.
+        unsigned stride;
+        std::vector<std::tr1::uint32_t> bits;
+
+        void build(const Bitmap& bitmap, unsigned srcX, unsigned srcY,
+            unsigned srcWidth, unsigned srcHeight, unsigned alphaThreshold);
+        // The 32 pixels of a row starting at x, which must be in the row.
+        std::tr1::uint32_t word(unsigned row, unsigned x) const;
+
+    public:
+        //! Creates an empty mask.
+        CollisionMask();
+        //! Pixels with at least the given alpha value count as solid.
+        explicit CollisionMask(const Bitmap& bitmap, unsigned alphaThreshold = 128);
+        CollisionMask(const Bitmap& bitmap, unsigned srcX, unsigned srcY,
+            unsigned srcWidth, unsigned srcHeight, unsigned alphaThreshold = 128);
+
+        unsigned width() const { return w; }
+        unsigned height() const { return h; }
+
+        //! Returns true if the pixel is solid. Pixels outside of the mask
+        //! never are.
+        bool solid(int x, int y) const;
+
+        //! Returns true if a solid pixel of this mask and one of other are
+        //! at the same place, other being offset by (offsetX; offsetY)
+        //! pixels from this one. Compares 32 pixels at once.
+        bool overlaps(const CollisionMask& other, int offsetX, int offsetY) const;
+
+        //! Returns a copy scaled by the given factors, for sprites that are
+        //! drawn scaled. Negative factors mirror the mask. Worth caching
+        //! if the factors rarely change.
+        CollisionMask scaled(double factorX, double factorY) const;
+    };
+
+    //! Splits a bitmap into masks the way loadTiles splits it into images.
+    std::vector<CollisionMask> loadCollisionMasks(const Bitmap& bitmap,
+        int tileWidth, int tileHeight, unsigned alphaThreshold = 128);
+    std::vector<CollisionMask> loadCollisionMasks(const std::wstring& filename,
+        int tileWidth, int tileHeight, unsigned alphaThreshold = 128);
+}
+
+#endif
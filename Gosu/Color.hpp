@@ -6,6 +6,7 @@
 
 #include <Gosu/Platform.hpp>
 #include <Gosu/TR1.hpp>
+#include <cstddef>
 
 namespace Gosu
 {
@@ -183,6 +184,28 @@ namespace Gosu
     //! Combines two colors as if their channels were mapped to the 0..1 range
     //! and then multiplied with each other.
     Color multiply(Color a, Color b);
+    
+    #ifndef SWIG
+    //! Converts count triples of hue, saturation and value (see
+    //! Color::fromHSV) to colors at once. Faster than fromAHSV for large
+    //! arrays, but can be one step lower in each channel.
+    void colorsFromHSV(Color* dest, const float* hsv, std::size_t count,
+        Color::Channel alpha = 255);
+    
+    //! Interpolates each color of a with the one of b at the same index. The
+    //! weight is rounded to 1/256. dest may be the same array as a or b.
+    void interpolate(Color* dest, const Color* a, const Color* b,
+        std::size_t count, double weight = 0.5);
+    
+    //! Multiplies each color of a with the one of b at the same index. dest
+    //! may be the same array as a or b.
+    void multiply(Color* dest, const Color* a, const Color* b, std::size_t count);
+    
+    //! Converts count colors given as four floats each, red, green, blue
+    //! and alpha from 0 to 1, e.g. from RMagick. Values outside of that
+    //! range are clamped.
+    void colorsFromFloats(Color* dest, const float* rgba, std::size_t count);
+    #endif
 
     namespace Colors
     {
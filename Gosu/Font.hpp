@@ -21,6 +21,7 @@ namespace Gosu
     {
         struct Impl;
         std::tr1::shared_ptr<Impl> pimpl;
+        friend class TextLayout;
 
     public:
         //! Constructs a font that can be drawn onto the graphics object.
@@ -29,8 +30,14 @@ namespace Gosu
         //! \param fontHeight Height of the font, in pixels.
         //! \param fontFlags Flags used to render individual characters of
         //!        the font.
+        //! \param distanceField If true, characters are stored as distance
+        //!        fields and drawn with a shader, so that they stay sharp at
+        //!        any scale. One such font can then replace several fonts of
+        //!        different heights. Falls back to normal characters if
+        //!        shaders are not supported (see Shader).
         Font(Graphics& graphics, const std::wstring& fontName,
-            unsigned fontHeight, unsigned fontFlags = ffBold);
+            unsigned fontHeight, unsigned fontFlags = ffBold,
+            bool distanceField = false);
         
         //! Returns the name of the font that was used to create it.
         std::wstring name() const;
@@ -41,6 +48,9 @@ namespace Gosu
         //! Returns the flags used to create the font characters.
         unsigned flags() const;
         
+        //! Returns true if the characters are distance fields.
+        bool distanceField() const;
+        
         //! Returns the width, in pixels, the given text would occupy if drawn.
         double textWidth(const std::wstring& text, double factorX = 1) const;
         
@@ -85,6 +95,28 @@ namespace Gosu
         //! Later versions might apply faux italics or faux bold to it (to be decided!).
         void setImage(wchar_t wc, const Gosu::Image& image);
         
+        //! Renders the given characters and creates their images right away,
+        //! so that the first frame that draws them does not have to. Useful
+        //! during loading screens. Formatting tags are not interpreted, and
+        //! characters that are ready already are skipped.
+        void preload(const std::wstring& characters) const;
+        //! Like preload, but with other flags than the font's own, as used
+        //! for text inside of formatting tags like <b>.
+        void preload(const std::wstring& characters, unsigned fontFlags) const;
+        //! Preloads all characters from first to last, inclusive.
+        void preload(wchar_t first, wchar_t last) const;
+        //! Renders the characters on a worker thread of the pool instead. The
+        //! images are created when the pool delivers the job, all at once.
+        //! As with asyncCreateText, no text should be drawn while the job is
+        //! pending.
+        void preload(AsyncPool& pool, const std::wstring& characters,
+            unsigned fontFlags) const;
+        
+        //! Bytes of video memory on the textures that the font caches its
+        //! characters on. Characters that are too large for these are
+        //! stored like other images and not included.
+        std::size_t memoryUsage() const;
+        
         #ifndef SWIG
         GOSU_DEPRECATED
         #endif
@@ -94,6 +126,37 @@ namespace Gosu
             double factorX = 1, double factorY = 1,
             Color c = Color::WHITE, AlphaMode mode = amDefault) const;
     };
+    
+    //! A line of text that has been prepared for drawing with a Font, for
+    //! text that is drawn in many frames but rarely changes, like a score.
+    //! Markup is parsed and characters are looked up only when the text or
+    //! the font has changed, so drawing it again only draws the images.
+    //! Copies share their state.
+    class TextLayout
+    {
+        struct Impl;
+        std::tr1::shared_ptr<Impl> pimpl;
+        
+    public:
+        //! \param text Formatted text without line-breaks, as for Font::draw.
+        TextLayout(const Font& font, const std::wstring& text = L"");
+        
+        const Font& font() const;
+        //! Lays the text out again for the given font.
+        void setFont(const Font& font);
+        
+        const std::wstring& text() const;
+        //! Does nothing if the text has not changed.
+        void setText(const std::wstring& text);
+        
+        //! Returns the width, in pixels, of the text, as Font::textWidth.
+        double width() const;
+        
+        //! Draws the text like Font::draw.
+        void draw(double x, double y, ZPos z,
+            double factorX = 1, double factorY = 1,
+            Color c = Color::WHITE, AlphaMode mode = amDefault) const;
+    };
 }
 
 #endif
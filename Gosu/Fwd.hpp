@@ -7,9 +7,13 @@
 //! The library's main namespace.
 namespace Gosu
 {
+    class Archive;
+    class Atlas;
+    class AsyncPool;
     class Audio;
     class Bitmap;
     class Buffer;
+    class BufferPool;
     class Button;
     class Color;
     class File;
@@ -21,8 +25,10 @@ namespace Gosu
     class Reader;
     class Resource;
     class Sample;
+    class Shader;
     class Song;
     class TextInput;
+    class TextLayout;
     class Timer;
     class Window;
     class Writer;
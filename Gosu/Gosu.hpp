@@ -10,6 +10,9 @@
 #ifndef GOSU_GOSU_HPP
 #define GOSU_GOSU_HPP
 
+#include <Gosu/Archive.hpp>
+#include <Gosu/Atlas.hpp>
+#include <Gosu/Async.hpp>
 #include <Gosu/Audio.hpp>
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/Color.hpp>
@@ -22,11 +25,23 @@
 #include <Gosu/Inspection.hpp>
 #include <Gosu/IO.hpp>
 #include <Gosu/Math.hpp>
+#include <Gosu/Particles.hpp>
 #include <Gosu/Platform.hpp>
+#include <Gosu/RenderTarget.hpp>
+#include <Gosu/ResourceCache.hpp>
+#include <Gosu/Shader.hpp>
 #include <Gosu/Sockets.hpp>
+#include <Gosu/SoundScape.hpp>
+#include <Gosu/SpatialHash.hpp>
 #include <Gosu/Text.hpp>
 #include <Gosu/TextInput.hpp>
+#include <Gosu/Animation.hpp>
+#include <Gosu/Camera.hpp>
+#include <Gosu/CollisionMask.hpp>
+#include <Gosu/SpriteLayer.hpp>
+#include <Gosu/TileLayer.hpp>
 #include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
 #include <Gosu/Utility.hpp>
 #include <Gosu/Version.hpp>
 #include <Gosu/Window.hpp>
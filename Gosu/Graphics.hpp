@@ -9,6 +9,8 @@
 #include <Gosu/GraphicsBase.hpp>
 #include <Gosu/TR1.hpp>
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace Gosu
 {
@@ -18,8 +20,8 @@ namespace Gosu
     //! Returns the height, in pixels, of the user's primary screen.
     unsigned screenHeight();
     
-    //! Returns the maximum size of an texture that will be allocated
-    //! internally by Gosu.
+    //! Returns the default size of the textures that Gosu packs images
+    //! onto, see Graphics::setAtlasSize.
     //! Useful when extending Gosu using OpenGL.
     unsigned const MAX_TEXTURE_SIZE = 1024;
     
@@ -29,6 +31,28 @@ namespace Gosu
     Transform scale(double factor);
     Transform scale(double factorX, double factorY, double fromX = 0, double fromY = 0);
     
+    //! One rectangle for Graphics::drawRects.
+    struct RectInstance
+    {
+        double x, y, width, height;
+        Color color;
+    };
+    
+    //! One circle for Graphics::drawCircles.
+    struct CircleInstance
+    {
+        //! Position of the circle's center.
+        double x, y;
+        double radius;
+        Color color;
+    };
+    
+    // Internal, see Graphics::setTextureBudget.
+    class TexChunk;
+    class LargeImageData;
+    class RenderTarget;
+    class Texture;
+    
     //! Serves as the target of all drawing and provides primitive drawing
     //! functionality.
     //! Usually created internally by Gosu::Window.
@@ -56,10 +80,12 @@ namespace Gosu
         void end();
         //! Flushes the Z queue to the screen and starts a new one.
         //! Useful for games that are *very* composite in nature (splitscreen).
+        //! Not available while rendering on a separate thread.
         void flush();
         
         //! Finishes all pending Gosu drawing operations and executes
         //! the following OpenGL code in a clean environment.
+        //! Not available while rendering on a separate thread.
         void beginGL();
         //! Resets Gosu into its default rendering state.
         void endGL();
@@ -69,7 +95,17 @@ namespace Gosu
         //! Gosu's rendering up to the Z level may not yet have been glFlush()ed.
         //! Note: You may not call any Gosu rendering functions from within the
         //! functor, and you must schedule it from within Window::draw's call tree.
-        void scheduleGL(const std::tr1::function<void()>& functor, ZPos z);
+        //! While rendering on a separate thread, the functor is called there.
+        //! Setting up the clean context and Gosu's state afterwards is
+        //! expensive when many small blocks are interleaved with images.
+        //! Code that only changes some of Gosu's state can pass the
+        //! GLStateFlags for it as modifiedState instead of gsAll; it then
+        //! runs in Gosu's current state (Gosu's transform, texture and
+        //! blending are still set up), only the given parts are set up again
+        //! afterwards, and it must restore any other OpenGL state itself.
+        //! With gsNone, nothing is done around the functor at all.
+        void scheduleGL(const std::tr1::function<void()>& functor, ZPos z,
+            unsigned modifiedState = gsAll);
         
         //! Enables clipping to a specified rectangle.
         void beginClipping(double x, double y, double width, double height);
@@ -82,6 +118,13 @@ namespace Gosu
         //! The width and height affect nothing about the recording process,
         //! the resulting macro will simply return these values when you ask
         //! it.
+        //! Code scheduled with scheduleGL while recording becomes part of the
+        //! macro. It runs each time the macro is drawn, in the order of its
+        //! z position among the recorded images, and with the transformation
+        //! that was current when it was scheduled.
+        //! The recorded images are split into chunks of neighbours, so that
+        //! with culling on, drawing a macro that is much larger than the
+        //! screen only costs as much as the part that can be seen.
         //! Most usually, the return value is passed to Image::Image().
         std::auto_ptr<Gosu::ImageData> endRecording(int width, int height);
         
@@ -89,6 +132,55 @@ namespace Gosu
         void pushTransform(const Transform& transform);
         //! Pops one transformation from the transformation stack.
         void popTransform();
+        
+        //! Draws everything until the matching popShader() with a shader.
+        //! Like transformations, shaders do not carry over into macros that
+        //! are being recorded, and macros keep the shaders they were
+        //! recorded with. Operations with different shaders are never
+        //! batched together.
+        void pushShader(const Shader& shader);
+        void popShader();
+        
+        //! Makes everything drawn on the calling thread go into a queue of
+        //! its own until endThreadQueue(), so that worker threads can cull
+        //! and draw independent parts of the scene at the same time. Thread
+        //! queues have their own transformation and clipping stacks and
+        //! start out like the screen at the time begin() was called. Ended
+        //! thread queues are merged into the frame by Z when it ends;
+        //! operations with the same Z are drawn after the ones drawn on the
+        //! main thread, in the order the thread queues were ended.
+        //! Images, quads, transformations, clipping and shaders can be used
+        //! in thread queues. Macros, render targets, custom OpenGL, streamed
+        //! images and images evicted by a texture budget cannot.
+        void beginThreadQueue();
+        //! Must be called on the same thread as beginThreadQueue(), before
+        //! the frame ends.
+        void endThreadQueue();
+        
+        //! Allows Gosu to reorder operations with the same Z value in the
+        //! range [fromZ, toZ] so that images sharing a texture, alpha mode,
+        //! clipping and transformation are drawn together. Only useful where
+        //! the drawing order within a layer does not matter, e.g. for
+        //! particles. Ranges persist across frames and can be combined.
+        void allowReordering(ZPos fromZ, ZPos toZ);
+        //! Restores the default behavior, in which images with the same Z
+        //! value are always drawn in the order they were submitted.
+        void disallowReordering();
+        //! Declares that images, quads etc. with the default alpha mode in
+        //! the range [fromZ, toZ] are opaque: Each of their pixels is drawn
+        //! either completely, if its alpha is at least 50%, or not at all.
+        //! Instead of being sorted by Z, they are then drawn first, roughly
+        //! front to back, and the depth buffer decides what is visible, so
+        //! that big layers of tiles neither cost time for sorting on the CPU
+        //! nor draw over each other's pixels on the GPU. Everything else is
+        //! sorted and drawn afterwards as usual. Frames with custom OpenGL
+        //! code, frames that are captured and render targets are drawn
+        //! without this, as is everything if there is no depth buffer, or
+        //! on iOS. Z values that are extremely close to each other may not
+        //! be told apart. Ranges persist across frames and can be combined.
+        void markOpaque(ZPos fromZ, ZPos toZ);
+        //! Restores the default behavior, in which everything is sorted.
+        void unmarkOpaque();
 
         //! Draws a line from one point to another (last pixel exclusive).
         //! Note: OpenGL lines are not reliable at all and may have a missing pixel at the start
@@ -108,12 +200,269 @@ namespace Gosu
             double x3, double y3, Color c3,
             double x4, double y4, Color c4,
             ZPos z, AlphaMode mode = amDefault);
+        
+        //! Draws many rectangles at once, which is much faster than calling
+        //! drawQuad for each of them. With a thickness of 0, the rectangles
+        //! are filled; otherwise only their outlines are drawn, inside of
+        //! them. Like everything else in this section, they are made of
+        //! quads and can end up in the same batches as drawQuad.
+        void drawRects(const RectInstance* rects, std::size_t count, double thickness,
+            ZPos z, AlphaMode mode = amDefault);
+        //! Draws many circles at once, filled or as outlines like drawRects.
+        //! Larger circles get more segments, so that none of them looks
+        //! edgy at the scale they are drawn at if not transformed.
+        void drawCircles(const CircleInstance* circles, std::size_t count, double thickness,
+            ZPos z, AlphaMode mode = amDefault);
+        //! Draws a line of the given thickness through count points, stored
+        //! as x and y values one after another. Corners are mitered, unless
+        //! they are so sharp that the miter would stick out too far. If
+        //! closed, the last point is connected to the first one.
+        void drawPolyline(const double* points, std::size_t count, double thickness,
+            Color c, ZPos z, AlphaMode mode = amDefault, bool closed = false);
 
         //! Turns a portion of a bitmap into something that can be drawn on
         //! this graphics object.
+        //! Can be called from any thread. On threads other than the one that
+        //! created this object, the pixels are only copied, and the image is
+        //! put onto a texture at the start of the next frame (see begin).
+        //! Until then, it is not ready() and drawing it does nothing.
         std::auto_ptr<ImageData> createImage(const Bitmap& src,
             unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
             unsigned borderFlags);
+        //! Turns a grid of columns x rows tiles of the same size, starting
+        //! at the top left corner of a bitmap, into images, row by row. Tiles are uploaded in groups that fill a texture each,
+        //! which is much faster than creating them one by one and keeps
+        //! neighboring tiles on the same texture.
+        std::vector<Image> createTiles(const Bitmap& src,
+            unsigned tileWidth, unsigned tileHeight, unsigned columns, unsigned rows,
+            unsigned borderFlags);
+        //! Creates an image from a DDS (DXT1/3/5) or KTX file. Its compressed
+        //! data is put onto a texture of its own as-is, which saves a lot of
+        //! video memory for large images. If the driver does not support the
+        //! format, DXT data is decompressed; other formats cause an exception.
+        std::auto_ptr<ImageData> createCompressedImage(Reader reader);
+        
+        //! Moves images off textures that are less than half full onto other
+        //! textures, and releases every texture that becomes empty this way.
+        //! This is slow, but keeps long-running applications that create and
+        //! destroy many images from running out of video memory. Best called
+        //! during loading screens or idle frames.
+        //! Note that the GLTexInfo of moved images changes.
+        //! Returns the number of textures that were released.
+        unsigned compactTextures();
+        //! Textures that no images live on anymore are released after a
+        //! couple of frames. This sets how many of them are kept around
+        //! anyway, to be reused by new images. The default is 1.
+        void setSpareTextures(unsigned spareTextures);
+        //! Images, quads etc. that lie completely outside of the screen (or
+        //! the current clipping rectangle) are discarded before they are
+        //! queued. This can be turned off for debugging. The default is on.
+        //! Drawing that is recorded into macros is never culled.
+        void setCulling(bool culling);
+        //! Returns false if a quad with the given corners would be culled,
+        //! so that drawing code can skip preparing it. Always true while
+        //! culling is off or a macro is being recorded.
+        bool isVisible(double x1, double y1, double x2, double y2,
+            double x3, double y3, double x4, double y4) const;
+        //! Returns the bounding box of what can be seen on the screen (or
+        //! inside the current clipping rectangle), in the coordinates used
+        //! for drawing under the current transformation. Returns false, and
+        //! leaves the arguments alone, if anything could be seen, i.e. while
+        //! culling is off, a macro is being recorded, or the transformation
+        //! is not affine.
+        bool visibleArea(double& left, double& top,
+            double& right, double& bottom) const;
+        //! Applies transformations (see pushTransform) to the vertices of
+        //! images, quads etc. on the CPU when they are drawn, instead of
+        //! letting OpenGL apply them. This costs a little time for each
+        //! vertex, but lets operations with different transformations be
+        //! drawn together, which pays off when cameras or UI layers split a
+        //! frame into many small batches. Macros are always transformed this
+        //! way while they are recorded. The default is off.
+        void setPretransforming(bool pretransforming);
+        //! Clips images on the CPU where that is possible: Images that lie
+        //! completely inside of the clipping rectangle ignore it, and
+        //! single-colored images that are not rotated are cut to it. Both
+        //! can then be drawn together with unclipped images, which helps
+        //! e.g. scrolling lists with many clipped rows. Everything else is
+        //! still clipped by OpenGL. Has no effect on iOS. The default is off.
+        void setGeometricClipping(bool geometricClipping);
+        //! Measures how long the GPU takes to render each frame, and the
+        //! custom OpenGL code in it, for rendererStatistics(). Comparing
+        //! this to the time spent on the CPU tells which one limits the
+        //! framerate. Requires OpenGL 3.3 or ARB_timer_query and has no
+        //! effect otherwise, on iOS, or while rendering on a separate thread.
+        //! The default is off.
+        void setGPUTiming(bool gpuTiming);
+        //! True while each frame is rendered on a separate thread, see
+        //! Window::setPipelinedRendering.
+        bool rendersOnThread() const;
+        //! Renders each frame at a lower resolution and stretches it over
+        //! the screen when frames take longer than the given number of
+        //! milliseconds, and back towards full resolution when they take
+        //! less. The time is that of the GPU if GPU timing is on, the time
+        //! between frames otherwise. The resolution never drops below
+        //! minScale of the screen's. Takes effect at the next begin(). 0,
+        //! the default, turns this off. Needs framebuffer objects and has
+        //! no effect on iOS or while rendering on a separate thread.
+        void setDynamicResolution(double milliseconds, double minScale = 0.5);
+        //! The fraction of the screen's resolution that the current frame
+        //! is rendered at; 1 unless setDynamicResolution is on.
+        double resolutionScale() const;
+        //! Keeps each frame in an offscreen texture and only redraws the
+        //! parts of it that have been marked with invalidate since the last
+        //! frame, for tools and editors in which little changes at once.
+        //! Everything drawn outside of that region is culled or scissored
+        //! away, but the screen is still updated as a whole, by copying the
+        //! texture to it. Drawing between beginHUD and endHUD is not
+        //! limited. Needs framebuffer objects and has no effect on iOS,
+        //! while dynamic resolution is on or while rendering on a separate
+        //! thread. Turning it on redraws everything once.
+        void setPartialRedraw(bool partialRedraw);
+        bool partialRedraw() const;
+        //! Marks a rectangle (in the same coordinates as clipping) to be
+        //! redrawn in the next frame. All rectangles of a frame are merged
+        //! into their bounding box. Without any, nothing is redrawn.
+        void invalidate(double x, double y, double width, double height);
+        //! Makes the next frame redraw everything, e.g. after a resize.
+        void invalidateAll();
+        //! Drawing between these two calls, e.g. text and interface
+        //! elements, is done at the screen's full resolution after the rest
+        //! of the frame has been stretched over the screen, see
+        //! setDynamicResolution. It is still sorted by its Z position, so
+        //! it should lie above everything else. Without dynamic resolution,
+        //! this makes no difference. Cannot be used in macros.
+        void beginHUD();
+        //! See beginHUD.
+        void endHUD();
+        //! Reads back the pixels on the screen, e.g. to compare a frame to a
+        //! reference image in automated tests. In a window, call this in
+        //! draw after flush(); in headless mode (see Window) the last frame
+        //! can also be read between frames. Not available on iOS or while
+        //! rendering on a separate thread.
+        Bitmap screenshot();
+        //! Saves the screen to an image file once the current frame has been
+        //! drawn, see saveImageFile. Unlike screenshot(), this does not
+        //! wait for the GPU: The pixels are read into a buffer and fetched
+        //! a frame or two later, and the file is encoded and written on a
+        //! worker thread. Can be called at any time during the frame. Not
+        //! available on iOS or while rendering on a separate thread.
+        void saveScreenshot(const std::wstring& filename);
+        //! Writes every frame from now on to a file, the same way as
+        //! saveScreenshot, until endVideoCapture(). Frames are stored as
+        //! raw RGBA pixels, top row first, without any header, e.g. for
+        //! "ffmpeg -f rawvideo -pix_fmt rgba -s WIDTHxHEIGHT -i FILE". The
+        //! file can also be a named pipe that an encoder reads from. If
+        //! writing falls behind by several frames, the game waits for it.
+        //! Errors while writing are thrown from end().
+        void beginVideoCapture(const std::wstring& filename);
+        //! Stops writing frames. Frames that are still pending are written.
+        void endVideoCapture();
+        //! Saves what is drawn in the current frame to a file when the frame
+        //! ends, as it is handed to OpenGL: sorted, with the render state of
+        //! every operation. benchmarks/replay.cpp renders such files over
+        //! and over, so that changes to the renderer can be timed with real
+        //! frames but without the game. Only the sizes of textures are
+        //! saved, not their pixels. Custom OpenGL code is not saved either.
+        void captureFrame(const std::wstring& filename);
+        //! Limits the video memory used by textures, in bytes. When more is
+        //! used at the end of a frame, the textures whose images have not
+        //! been drawn for the longest time are copied to main memory and
+        //! released, until the budget is met again. Images are uploaded
+        //! again when they are next drawn. Images that were not drawn in the
+        //! current frame are never evicted, and neither are images on
+        //! textures of their own (see BorderFlags). 0, the default, means no
+        //! limit. Has no effect on iOS.
+        void setTextureBudget(unsigned long bytes);
+        //! Stores images that are created from now on at this fraction of
+        //! their resolution, e.g. 0.5 on weak hardware. They keep their
+        //! width and height and are drawn at the same size, only from fewer
+        //! pixels, which saves video memory and upload time. Values of 1 or
+        //! more store images as they are, which is the default.
+        void setImageScale(double scale);
+        //! Scales images that are created from now on down, if needed, so
+        //! that neither their width nor their height exceeds this many
+        //! pixels when stored. Like with setImageScale, their size stays the
+        //! same. This keeps large images from being split across several
+        //! textures. 0, the default, means no limit.
+        void setMaxImageResolution(unsigned pixels);
+        //! Sets the size of the textures that images created from now on
+        //! are packed onto. Larger textures hold more images, so that fewer
+        //! texture changes break up batches, and split large images into
+        //! fewer parts, but each one takes size * size * 4 bytes of video
+        //! memory. Rounded down to a power of two of at least 256, and
+        //! limited to what the graphics card supports. The default is
+        //! MAX_TEXTURE_SIZE.
+        void setAtlasSize(unsigned size);
+        //! Returns the size of the textures that images are packed onto.
+        unsigned atlasSize() const;
+        //! Packs the textures that images created from now on are stored on
+        //! into OpenGL texture arrays of this many layers each, so that
+        //! images from different textures can be drawn in the same batch.
+        //! Each array takes all of its video memory right away. Needs
+        //! OpenGL 3.0; does nothing otherwise, or on iOS. Images on arrays
+        //! are drawn with a built-in shader, so they cannot be drawn with
+        //! a custom one, and their glTexInfo is of no use to OpenGL code.
+        //! Mipmapped images and square tileable ones, which get textures of
+        //! their own, are never put onto arrays. 0, the default, disables
+        //! texture arrays.
+        void setTextureArrays(unsigned layers);
+        //! Stores images on the graphics card with their colors multiplied
+        //! by their alpha, and blends them accordingly. This avoids dark
+        //! fringes around images that are drawn scaled or rotated, and
+        //! lets amAdd be drawn in the same batches as amDefault.
+        //! Images still take and return bitmaps with straight alpha;
+        //! compressed images are uploaded as stored, so their colors must
+        //! be premultiplied already. Fragment shaders receive premultiplied
+        //! colors. Must be set before any images or fonts are created;
+        //! throws std::logic_error otherwise. The default is off.
+        void setPremultipliedAlpha(bool premultiplied);
+        
+    private:
+        // Used by TexChunk to implement the texture budget, and by
+        // LargeImageData to release streamed parts.
+        friend class TexChunk;
+        friend class LargeImageData;
+        unsigned long frameNumber() const;
+        void restoreTexChunk(TexChunk& chunk);
+        
+        // The size at which createImage stores an image of the given size
+        // (see setImageScale); returns true if it is scaled. Large images
+        // are created from parts with createStoredImage, which does not
+        // scale them again.
+        bool storedSize(unsigned width, unsigned height,
+            unsigned& storedWidth, unsigned& storedHeight) const;
+        std::auto_ptr<ImageData> createStoredImage(const Bitmap& src,
+            unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
+            unsigned borderFlags);
+        
+        // Used by RenderTarget, which binds its framebuffer around
+        // endRenderTarget.
+        friend class RenderTarget;
+        std::auto_ptr<ImageData> createRenderTexture(unsigned width, unsigned height);
+        void beginRenderTarget(unsigned width, unsigned height);
+        void endRenderTarget(unsigned width, unsigned height, Color clearWithColor);
+        
+        // Used by Font and Atlas, which keep their images on textures of
+        // their own and fill them themselves. The block must have been
+        // allocated on the texture already.
+        friend class Font;
+        friend class Atlas;
+        std::auto_ptr<TexChunk> createTexChunk(std::tr1::shared_ptr<Texture> texture,
+            int x, int y, int width, int height, int padding);
+        // Used by Atlas::loadMacro. Pages are the textures that the macro
+        // was saved with.
+        std::auto_ptr<ImageData> loadMacro(Reader reader, std::size_t size,
+            const std::vector<std::tr1::shared_ptr<Texture> >& pages);
+        
+        // Used by Window::setPipelinedRendering. The callbacks are called on
+        // the render thread; makeCurrent has to set up a context that shares
+        // its objects with the current one.
+        friend class Window;
+        void startRenderThread(const std::tr1::function<void()>& makeCurrent,
+            const std::tr1::function<void()>& present,
+            const std::tr1::function<void()>& release);
+        void stopRenderThread();
     };
 }
 
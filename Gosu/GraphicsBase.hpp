@@ -46,7 +46,8 @@ namespace Gosu
         taJustify
     };
     
-    //! Flags that affect the tileability of an image.
+    //! Flags that affect the tileability of an image, how it looks when it
+    //! is drawn smaller than its original size, and how it is stored.
     enum BorderFlags
     {
         bfSmooth = 0,
@@ -54,9 +55,53 @@ namespace Gosu
         bfTileableTop = 2,
         bfTileableRight = 4,
         bfTileableBottom = 8,
-        bfTileable = bfTileableLeft | bfTileableTop | bfTileableRight | bfTileableBottom
+        bfTileable = bfTileableLeft | bfTileableTop | bfTileableRight | bfTileableBottom,
+        //! Keeps scaled-down versions of the image (down to 1/8) on the
+        //! graphics card, which avoids flickering when the image is drawn at
+        //! a fraction of its size. Uses a third more texture memory. Has
+        //! no effect on iOS.
+        bfMipmapped = 16,
+        //! Only affects images that are too large for a single texture and
+        //! are thus split into parts: Each part is only uploaded once it
+        //! becomes visible, and released again after it has not been visible
+        //! for a couple of seconds while the image is still being drawn. The
+        //! image keeps a copy of its pixels in main memory for this.
+        bfStreamed = 32,
+        //! Stores the image with four bits per channel, in half the texture
+        //! memory. Gradients show banding.
+        bfRGBA4444 = 64,
+        //! Stores the image without alpha, with five bits for red and blue
+        //! and six for green, in half the texture memory. For opaque images
+        //! such as backgrounds.
+        bfRGB565 = 128,
+        //! Stores only the image's alpha channel, in a quarter of the texture
+        //! memory. The image is drawn white, tinted by the color it is drawn
+        //! with. For masks and other single-colored images. Without OpenGL
+        //! 3.3 or ARB_texture_swizzle, shaders see the image as black.
+        bfAlpha8 = 192
     };        
     
+    //! The parts of Gosu's OpenGL state that code scheduled with
+    //! Graphics::scheduleGL may change, and that are set up again after it.
+    enum GLStateFlags
+    {
+        //! The code leaves all of OpenGL's state the way it found it.
+        gsNone = 0,
+        //! The bound texture, and whether texturing is enabled.
+        gsTexture = 1,
+        //! The modelview and projection matrices, and the matrix mode.
+        gsTransform = 2,
+        //! The scissor box, and whether the scissor test is enabled.
+        gsClipping = 4,
+        //! The blend function, and whether blending is enabled.
+        gsBlending = 8,
+        //! The shader program in use.
+        gsProgram = 16,
+        //! Anything at all. The code runs in a clean state, as between
+        //! Graphics::beginGL and endGL.
+        gsAll = 0xff
+    };
+    
     #ifndef SWIG
     // A not so useful optimization.
     GOSU_DEPRECATED const double zImmediate = -std::numeric_limits<double>::infinity();
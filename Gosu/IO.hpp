@@ -21,6 +21,10 @@ namespace Gosu
     const ByteOrder nativeByteOrder = boLittle, otherByteOrder = boBig;
 #endif
 
+    //! Reverses the bytes of each of count values of the given size in
+    //! place. Used by readArray and writeArray.
+    void swapByteOrder(void* values, std::size_t size, std::size_t count);
+
     //! Utility class that points to a specific position in a resource
     //! and offers an interface for sequential reading.
     class Reader
@@ -57,6 +61,11 @@ namespace Gosu
         }
 
         void read(void* destBuffer, std::size_t length);
+
+        //! Convenience: Returns a pointer to the next length bytes without
+        //! copying them, or 0 if the resource cannot offer one. Does not
+        //! advance the position.
+        const void* view(std::size_t length) const;
         
         //! Convenience function; equivalent to read(&t, sizeof t).
         template<typename T>
@@ -78,6 +87,16 @@ namespace Gosu
             readPod<T>(t, bo);
             return t;
         }
+        
+        //! Reads count values at once, which is much faster than calling
+        //! readPod for each of them.
+        template<typename T>
+        void readArray(T* dest, std::size_t count, ByteOrder bo = boDontCare)
+        {
+            read(dest, count * sizeof(T));
+            if (bo == otherByteOrder)
+                swapByteOrder(dest, sizeof(T), count);
+        }
     };
     
     //! Utility class that points to a specific position in a resource
@@ -131,6 +150,20 @@ namespace Gosu
             else
                 write(&t, sizeof t);
         }
+        
+        //! Writes count values at once, which is much faster than calling
+        //! writePod for each of them.
+        template<typename T>
+        void writeArray(const T* source, std::size_t count, ByteOrder bo = boDontCare)
+        {
+            if (bo == otherByteOrder)
+                writeSwapped(source, sizeof(T), count);
+            else
+                write(source, count * sizeof(T));
+        }
+        
+    private:
+        void writeSwapped(const void* source, std::size_t size, std::size_t count);
     };
 
     //! Base class for resources. A resource in Gosu is nothing more but a
@@ -176,6 +209,15 @@ namespace Gosu
 
         virtual void write(std::size_t offset, std::size_t length,
             const void* sourceBuffer) = 0;
+
+        //! Returns a pointer to the given range of the resource that can be
+        //! read from directly instead of copying it with read(), or 0 if
+        //! the resource does not keep it in memory. The pointer is valid
+        //! until the resource is written to, resized or destroyed.
+        virtual const void* view(std::size_t offset, std::size_t length) const
+        {
+            return 0;
+        }
     };
 
     //! Piece of memory with the Resource interface.
@@ -200,25 +242,60 @@ namespace Gosu
         }
 
         std::size_t size() const;
+        //! Grows the capacity geometrically, so that writing a buffer in many
+        //! small pieces takes linear time.
         void resize(std::size_t newSize);
 
+        //! Makes room for the given number of bytes without changing the
+        //! size, so that a Writer can fill the buffer up to this size
+        //! without allocating memory.
+        void reserve(std::size_t capacity);
+        std::size_t capacity() const;
+
         void read(std::size_t offset, std::size_t length,
             void* destBuffer) const;
 
         void write(std::size_t offset, std::size_t length,
             const void* sourceBuffer);
 
+        const void* view(std::size_t offset, std::size_t length) const;
+
         const void* data() const
         {
-            return &buf[0];
+            return buf.empty() ? 0 : &buf[0];
         }
 
         void* data()
         {
-            return &buf[0];
+            return buf.empty() ? 0 : &buf[0];
         }
     };
 
+    //! Keeps buffers that are no longer needed, so that they can be used
+    //! again along with the memory they had reserved. Meant for messages
+    //! that are built and sent every frame: Once the pool has enough
+    //! buffers, building and sending them does not allocate any memory.
+    class BufferPool
+    {
+        // Non-copyable
+        BufferPool(const BufferPool&);
+        BufferPool& operator=(const BufferPool&);
+
+        std::vector<Buffer*> buffers;
+
+    public:
+        BufferPool();
+        ~BufferPool();
+
+        //! Returns an empty buffer that has room for at least the given
+        //! number of bytes.
+        std::auto_ptr<Buffer> acquire(std::size_t capacity = 0);
+        //! Takes a buffer back to hand it out again. Its contents are lost.
+        void release(std::auto_ptr<Buffer> buffer);
+        //! Returns the number of buffers waiting to be acquired.
+        std::size_t available() const;
+    };
+
     enum FileMode
     {
         //! Opens an existing file for reading; throws an exception if the file
@@ -248,12 +325,55 @@ namespace Gosu
             void* destBuffer) const;
         void write(std::size_t offset, std::size_t length,
             const void* sourceBuffer);
+        //! Files opened with fmRead are mapped into memory where the
+        //! system allows it, so that they can offer views.
+        const void* view(std::size_t offset, std::size_t length) const;
+        //! Asks the system to start reading the given range of the file
+        //! into memory in the background, so that reading it later does
+        //! not have to wait for the disk. Meant for assets that will be
+        //! needed soon, e.g. those of the next level.
+        void prefetch(std::size_t offset = 0,
+            std::size_t length = static_cast<std::size_t>(-1)) const;
+    };
+
+    //! File that collects writes in memory and hands them to the system
+    //! in large pieces, e.g. for save games written with many small
+    //! writePod calls. Resizing only takes effect when the buffer is
+    //! flushed, so a Writer that keeps growing the file does not resize
+    //! it every time. Anything else, including reading, flushes first.
+    class BufferedFile : public Resource
+    {
+        File file;
+        std::vector<char> buffer;
+        // Where in the file the buffer starts, and how large it may grow.
+        std::size_t bufferOffset, capacity;
+        std::size_t logicalSize;
+
+    public:
+        explicit BufferedFile(const std::wstring& filename, FileMode mode = fmReplace,
+            std::size_t bufferSize = 65536);
+        //! Flushes, but ignores errors; call flush() first to see them.
+        ~BufferedFile();
+
+        std::size_t size() const;
+        void resize(std::size_t newSize);
+        void read(std::size_t offset, std::size_t length,
+            void* destBuffer) const;
+        void write(std::size_t offset, std::size_t length,
+            const void* sourceBuffer);
+        //! Writes what has been collected and gives the file its size.
+        void flush();
     };
 
     //! Loads a whole file into a buffer.
     void loadFile(Buffer& buffer, const std::wstring& filename);
     //! Creates or overwrites a file with the contents of a buffer.
     void saveFile(const Buffer& buffer, const std::wstring& filename);
+    //! Like saveFile, but writes to a temporary file next to the given one
+    //! and then puts it in its place, so that the file is never left
+    //! half-written, e.g. when the game crashes while saving. See also
+    //! asyncSaveFile in Async.hpp.
+    void saveFileAtomically(const Buffer& buffer, const std::wstring& filename);
 }
 
 #endif
@@ -7,6 +7,7 @@
 #include <Gosu/Fwd.hpp>
 #include <Gosu/Color.hpp>
 #include <Gosu/GraphicsBase.hpp>
+#include <Gosu/ImageData.hpp>
 #include <Gosu/TR1.hpp>
 #include <memory>
 #include <vector>
@@ -18,6 +19,8 @@ namespace Gosu
     {
         std::tr1::shared_ptr<ImageData> data;
 
+        explicit Image(const std::tr1::shared_ptr<ImageData>& data);
+
     public:
         //! Loads an image from a given filename that can be drawn onto
         //! graphics.
@@ -47,6 +50,28 @@ namespace Gosu
         
         //! Creates an Image from a user-supplied instance of the ImageData interface.
         explicit Image(std::auto_ptr<ImageData> data);
+        
+        //! Creates an image of the given text, drawn like createText in
+        //! Text.hpp does. If the text image cache is enabled (see
+        //! ResourceCache.hpp), the same image is returned for the same
+        //! arguments without rendering the text again.
+        static Image fromText(Graphics& graphics, const std::wstring& text,
+            const std::wstring& fontName, unsigned fontHeight,
+            unsigned fontFlags = 0);
+        //! Like the other fromText, but wraps the text into lines of the
+        //! given width.
+        static Image fromText(Graphics& graphics, const std::wstring& text,
+            const std::wstring& fontName, unsigned fontHeight,
+            int lineSpacing, unsigned width, TextAlign align,
+            unsigned fontFlags = 0);
+        
+        //! Keeps the decoded pixels of images that are loaded from files in
+        //! the given directory, which must exist and end in a separator,
+        //! like userSettingsPrefix(). Later runs read them from there
+        //! instead of decoding the files again, until they change on disk.
+        //! Images in archives and compressed images are not cached. Empty
+        //! by default, which disables the cache.
+        static void setDecodedCacheDirectory(const std::wstring& directory);
 
         unsigned width() const;
         unsigned height() const;
@@ -78,6 +103,36 @@ namespace Gosu
             Color c = Color::WHITE,
             AlphaMode mode = amDefault) const;
 
+        //! Draws many copies of this image, each scaled and rotated around
+        //! its center. Much faster than calling drawRot for each copy,
+        //! e.g. for bullets or particles.
+        void drawMany(const ImageInstance* instances, std::size_t count,
+            ZPos z, AlphaMode mode = amDefault) const;
+        void drawMany(const std::vector<ImageInstance>& instances,
+            ZPos z, AlphaMode mode = amDefault) const;
+        
+        //! Draws triangles textured with parts of this image, e.g. to bend
+        //! or ripple it, which is much faster than drawing it as a grid of
+        //! subimages. Each three indices pick the vertices of a triangle.
+        //! Throws for images that are too large for one texture; see
+        //! Graphics::storedSize and setMaxImageResolution.
+        void drawMesh(const MeshVertex* vertices, std::size_t vertexCount,
+            const unsigned* indices, std::size_t indexCount,
+            ZPos z, AlphaMode mode = amDefault) const;
+        void drawMesh(const std::vector<MeshVertex>& vertices,
+            const std::vector<unsigned>& indices, ZPos z, AlphaMode mode = amDefault) const;
+
+        //! Returns false while large images are still being uploaded in the
+        //! background. Drawing them before then may cause a short hitch.
+        bool ready() const;
+        
+        //! Returns an image of a rectangle of this one, clipped to it, that
+        //! is drawn from the same texture, so that it takes neither video
+        //! memory nor an upload of its own. Changes to the pixels of either
+        //! show up in both. Returns 0 if this image is not a part of a
+        //! single texture, e.g. if it is large or a macro.
+        std::auto_ptr<Image> subimage(int x, int y, int width, int height) const;
+        
         //! Provides access to the underlying image data object.
         ImageData& getData() const;
     };
@@ -7,6 +7,7 @@
 #include <Gosu/Color.hpp>
 #include <Gosu/GraphicsBase.hpp>
 #include <Gosu/Fwd.hpp>
+#include <cstddef>
 
 namespace Gosu
 {
@@ -19,6 +20,34 @@ namespace Gosu
         float left, right, top, bottom;
     };
 
+    //! One copy of an image for Image::drawMany.
+    struct ImageInstance
+    {
+        //! Position of the image's center.
+        double x, y;
+        double scale;
+        //! In degrees, clockwise, as in Image::drawRot.
+        double angle;
+        Color color;
+    };
+    
+    //! One vertex of a mesh for Image::drawMesh.
+    struct MeshVertex
+    {
+        double x, y;
+        //! Position on the image, from 0 at the left or top border to 1 at
+        //! the right or bottom border.
+        double u, v;
+        Color color;
+    };
+    
+    //! Computes the corners of count instances of an image with the given
+    //! size, as drawMany places them: four x and four y values per instance,
+    //! in the order top left, top right, bottom left, bottom right. Useful
+    //! for collision checks or custom rendering of many rotated sprites.
+    void instanceCorners(const ImageInstance* instances, std::size_t count,
+        double width, double height, double* xs, double* ys);
+
     //! The ImageData class is an abstract base class for drawable images.
     //! Instances of classes derived by ImageData are usually returned by
     //! Graphics::createImage and usually only used to implement drawing
@@ -53,6 +82,25 @@ namespace Gosu
         
         //! Experimental and undocumented for now.
         virtual void insert(const Bitmap& bitmap, int x, int y) = 0;
+        
+        //! Returns false while the image's pixels are still being transferred
+        //! to the graphics card. Drawing it before then is correct, but may
+        //! stall until the transfer is done.
+        virtual bool ready() const
+        {
+            return true;
+        }
+        
+        //! Draws many copies of the image at once, see Image::drawMany. The
+        //! default implementation calls draw for each of them.
+        virtual void drawMany(const ImageInstance* instances, std::size_t count,
+            ZPos z, AlphaMode mode) const;
+        
+        //! Draws a triangle mesh textured with the image, see
+        //! Image::drawMesh. The default implementation throws, since the
+        //! image may be spread over several textures.
+        virtual void drawMesh(const MeshVertex* vertices, std::size_t vertexCount,
+            const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const;
     };
 }
 
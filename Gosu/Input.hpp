@@ -29,6 +29,7 @@
 #include <Gosu/Platform.hpp>
 #include <Gosu/Fwd.hpp>
 #include <Gosu/TR1.hpp>
+#include <cstddef>
 #include <vector>
 
 namespace Gosu
@@ -116,6 +117,14 @@ namespace Gosu
         //! Returns true if a button is currently pressed.
         //! Updated every tick.
         bool down(Button btn) const;
+        //! Sets result[i] to down(buttons[i]) for count buttons. Saves a call
+        //! per button when many are checked at once, e.g. from Ruby.
+        void downMany(const Button* buttons, std::size_t count, bool* result) const;
+        //! Returns true if the button went down during the last update, even
+        //! if it has already been released again.
+        bool pressed(Button btn) const;
+        //! Returns true if the button went up during the last update.
+        bool released(Button btn) const;
         
         //! Returns the horizontal position of the mouse relative to the top
         //! left corner of the window given to Input's constructor.
@@ -147,6 +156,12 @@ namespace Gosu
         //! If you use the Window class, it will assign forward these to its own methods.
         std::tr1::function<void (Button)> onButtonDown, onButtonUp;
         
+        //! While onButtonDown or onButtonUp is being called, returns when the
+        //! button was pressed or released, in the time of Gosu::microseconds().
+        //! Based on the timestamps of the system's events where available,
+        //! otherwise on when Gosu received the event.
+        std::tr1::uint64_t eventTime() const;
+        
         //! Assignable events that are called by update. You can bind these to your own functions.
         //! If you use the Window class, it will assign forward these to its own methods.
         std::tr1::function<void (Touch)> onTouchBegan, onTouchMoved, onTouchEnded;
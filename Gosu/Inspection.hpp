@@ -4,11 +4,189 @@
 #ifndef GOSU_INSPECTION_HPP
 #define GOSU_INSPECTION_HPP
 
+#include <Gosu/Fwd.hpp>
+#include <Gosu/GraphicsBase.hpp>
+#include <Gosu/TR1.hpp>
+#include <vector>
+
 namespace Gosu
 {
     //! Returns the current framerate, as determined by an unspecified and possibly
     //! horrible algorithm.
     int fps();
+    
+    //! Parts of a frame that Window measures separately.
+    enum FramePhase
+    {
+        //! Window::update, including input handling. If update is called
+        //! more than once per frame, all calls are added up.
+        fpUpdate,
+        //! Window::draw, including the work that Graphics::end hands to
+        //! OpenGL.
+        fpDraw,
+        //! Swapping buffers, which may wait for the screen's refresh.
+        fpSwap,
+        //! Time from the end of the previous frame to the end of this one.
+        fpTotal
+    };
+    
+    //! Summary of how long one phase of recent frames took, in milliseconds.
+    struct FrameTimeStatistics
+    {
+        //! Number of frames the statistics are based on, which can be less
+        //! than requested on startup.
+        unsigned frames;
+        double minimum, average, p50, p95, p99, maximum;
+    };
+    
+    //! Returns statistics of the given phase over the most recent frames.
+    //! Up to 600 frames are remembered. Percentiles are better than the
+    //! framerate at revealing occasional hitches: a p99 of 33 ms at 60 fps
+    //! means that more than one frame per second is dropped.
+    FrameTimeStatistics frameTimeStatistics(FramePhase phase, unsigned frames = 120);
+    
+    //! Returns statistics of the time from recent button presses until the
+    //! end of the first frame that was drawn after they were handled. The
+    //! frames member holds the number of presses; up to 600 are remembered.
+    //! This estimates the input latency that players notice, minus what
+    //! the display and the input device add. With pipelined rendering (see
+    //! Window::setPipelinedRendering), frames are shown after they end, so
+    //! the estimate is too low by up to a frame.
+    FrameTimeStatistics inputLatencyStatistics(unsigned events = 120);
+    
+    //! How long the parts of one frame took on the CPU, in microseconds.
+    struct FrameReport
+    {
+        //! See FramePhase.
+        unsigned long update, draw, swap, total;
+        //! The part of draw that Graphics::end spent handing the frame to
+        //! OpenGL, or to the render thread.
+        unsigned long flush;
+    };
+    
+    //! Calls the given function on the main thread after every frame, e.g.
+    //! to log frame times or to attribute them to parts of a game while it
+    //! is played. Pass an empty function to stop.
+    void setFrameCallback(const std::tr1::function<void (const FrameReport&)>& callback);
+    
+    //! Draws a graph of the most recent frames, one bar per frame, with the
+    //! oldest frame on the left. Bars show the time spent updating (blue),
+    //! drawing (green), swapping buffers (gray) and waiting, and fill the
+    //! full height at 33 ms; a line marks 16.7 ms. Meant to be called at the
+    //! end of Window::draw, with a high Z value.
+    void drawFrameTimeGraph(Graphics& graphics, double x, double y,
+        double width, double height, ZPos z, unsigned frames = 120);
+    
+    //! Returns how many draw operations were skipped in the last frame
+    //! because they were not visible (see Graphics::setCulling).
+    unsigned culledDrawOps();
+    
+    //! Describes the work that the renderer did in one frame, including
+    //! recording macros and rendering into render targets.
+    struct RendererStatistics
+    {
+        //! Draw operations that were scheduled, including culled ones.
+        unsigned scheduledOps;
+        //! Draw operations that were skipped because they were not visible.
+        unsigned culledOps;
+        //! Time spent sorting draw operations by Z and render state, in
+        //! microseconds.
+        unsigned long sortTime;
+        //! Number of OpenGL draw calls, including those performed by macros.
+        unsigned batches;
+        //! Number of vertices passed to OpenGL in these draw calls.
+        unsigned long vertices;
+        //! Number of times that the texture, transformation, clipping
+        //! rectangle or alpha mode had to be changed between draw calls.
+        unsigned textureBinds, transformChanges, clipChanges, blendChanges;
+        //! Number of blocks of custom OpenGL code that were run.
+        unsigned glBlocks;
+        //! Draw operations that were drawn with a depth test instead of
+        //! being sorted (see Graphics::markOpaque).
+        unsigned opaqueOps;
+        //! Time between Graphics::begin and end on the CPU, in microseconds.
+        //! This includes Window::draw and handing everything to OpenGL.
+        unsigned long cpuTime;
+        //! Part of cpuTime that Graphics::end took, in microseconds.
+        unsigned long flushTime;
+        //! Time that the GPU needed for a frame and for its custom OpenGL
+        //! code, in microseconds. Since waiting for these would slow down
+        //! rendering, they belong to a frame that was rendered a few frames
+        //! earlier. Zero unless measured (see Graphics::setGPUTiming).
+        unsigned long gpuTime, glBlockGPUTime;
+    };
+    
+    //! Returns the statistics of the last frame, as finished by
+    //! Graphics::end. All counters are zero before the first frame.
+    RendererStatistics rendererStatistics();
+    
+    //! Describes how full one of the OpenGL textures is that Gosu packs images into.
+    struct TextureStatistics
+    {
+        //! Width and height of the texture, in pixels.
+        unsigned size;
+        //! True if the texture was created for a single image (see BorderFlags).
+        //! Images are only given their own texture if they are tileable, square
+        //! and have a power-of-two size of at least 64 pixels.
+        bool dedicated;
+        //! Number of images allocated on this texture.
+        unsigned blocks;
+        //! Area covered by images, including their padding, in pixels.
+        unsigned long usedArea;
+        //! Area that has been freed, or that had to be skipped while packing.
+        //! It can still be reused, but only for images that fit into the gaps.
+        unsigned long fragmentedArea;
+        //! Area that has never been used.
+        unsigned long freeArea;
+    };
+    
+    //! Returns the statistics of all textures that Gosu has currently allocated.
+    //! A new texture is created whenever an image fits on no existing texture.
+    std::vector<TextureStatistics> textureStatistics();
+    
+    //! Returns the video memory occupied by all of Gosu's textures, in bytes.
+    unsigned long textureMemory();
+    
+    //! Returns how often images have been moved to main memory to stay within
+    //! the texture budget (see Graphics::setTextureBudget).
+    unsigned long textureEvictions();
+    //! Returns how often evicted images have been uploaded again.
+    unsigned long textureReloads();
+    
+    //! Memory that Gosu's subsystems currently hold, in bytes.
+    struct MemoryStatistics
+    {
+        //! Video memory of the textures that images are packed onto.
+        unsigned long atlasTextures;
+        //! Video memory of textures that hold a single image (see
+        //! TextureStatistics::dedicated).
+        unsigned long dedicatedTextures;
+        //! Video memory of the textures that fonts cache characters on (see
+        //! Font::memoryUsage).
+        unsigned long fontGlyphs;
+        //! Pixels of the parts that images too large for a single texture
+        //! are split into. They are included in atlasTextures and
+        //! dedicatedTextures as well.
+        unsigned long largeImageParts;
+        //! Main memory that streamed images keep their pixels in, so that
+        //! parts can be recreated (see bfStreamed).
+        unsigned long streamedImages;
+        //! Decoded samples in OpenAL's buffers, samples that are kept
+        //! compressed, and the buffers that their voices decode into.
+        unsigned long samples;
+        //! Buffers that songs are streamed through.
+        unsigned long songs;
+        //! Vertices recorded by macros (see Graphics::record), counted
+        //! twice if they have also been uploaded into video memory.
+        unsigned long macros;
+        //! Incoming and outgoing data buffered by CommSockets.
+        unsigned long sockets;
+    };
+    
+    //! Returns how much memory each subsystem currently holds. Memory that
+    //! the operating system, OpenGL or OpenAL need on top of that is not
+    //! included.
+    MemoryStatistics memoryStatistics();
 }
 
 #endif
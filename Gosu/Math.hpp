@@ -4,6 +4,8 @@
 #ifndef GOSU_MATH_HPP
 #define GOSU_MATH_HPP
 
+#include <cstddef>
+
 namespace Gosu
 {
     //! Pi.
@@ -26,8 +28,20 @@ namespace Gosu
     }
     
     //! Returns a real value between min (inclusive) and max (exclusive).
-    //! Uses std::rand, so you should call std::srand before using it.
+    //! Each thread has a generator of its own (PCG32), which is seeded
+    //! differently for every thread and run unless seedRandom is called.
     double random(double min, double max);
+    //! Returns an integer between min (inclusive) and max (exclusive), or
+    //! min if max <= min.
+    int randomInt(int min, int max);
+    //! Seeds the calling thread's generator, so that it produces the same
+    //! sequence for the same seed again.
+    void seedRandom(unsigned long seed);
+    //! Fills values with count results of random(min, max), for less than
+    //! the cost of calling it count times.
+    void fillRandom(double* values, std::size_t count, double min, double max);
+    //! Fills values with count results of randomInt(min, max).
+    void fillRandom(int* values, std::size_t count, int min, int max);
     
     //! Translates between Gosu's angle system (where 0 is at the top)
     //! and radians (where 0 is at the right).
@@ -65,6 +79,9 @@ namespace Gosu
     //! specified by angle.
     //! \param angle Angle in degrees where 0.0 means upwards.
     double offsetY(double angle, double radius);
+    //! Sets x and y to offsetX(angle, radius) and offsetY(angle, radius),
+    //! for about the cost of one of them. Exact for multiples of 90 degrees.
+    void offsetXY(double angle, double radius, double& x, double& y);
     //! Returns the angle from point 1 to point 2 in degrees, where 0.0 means
     //! upwards. Returns def if both points are equal.
     double angle(double fromX, double fromY, double toX, double toY,
@@ -0,0 +1,78 @@
+//! \file Particles.hpp
+//! Interface of the ParticleEmitter class.
+
+#ifndef GOSU_PARTICLES_HPP
+#define GOSU_PARTICLES_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/Color.hpp>
+#include <Gosu/GraphicsBase.hpp>
+#include <memory>
+
+namespace Gosu
+{
+    //! Describes how a ParticleEmitter creates and moves its particles.
+    //! Ranges are sampled randomly for each new particle.
+    struct ParticleSettings
+    {
+        //! New particles per second.
+        double rate;
+        //! In seconds.
+        double minLifetime, maxLifetime;
+        //! Direction of new particles in degrees (0 is up, as in offsetX),
+        //! and by how much it can vary in either direction.
+        double direction, spread;
+        //! In pixels per second.
+        double minSpeed, maxSpeed;
+        //! In pixels per second per second, e.g. for gravity or wind.
+        double accelerationX, accelerationY;
+        //! Rotation speed in degrees per second. Particles start out rotated
+        //! towards the direction they are emitted in.
+        double minSpin, maxSpin;
+        //! Scale and color change linearly over a particle's lifetime.
+        double startScale, endScale;
+        Color startColor, endColor;
+        
+        //! Ten white particles per second that fly upward and fade out.
+        ParticleSettings();
+    };
+    
+    //! Simulates and draws many copies of one image, e.g. for smoke, sparks
+    //! or rain. All particles of an emitter are drawn with one call to
+    //! Image::drawMany.
+    class ParticleEmitter
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+        
+    public:
+        //! \param maxParticles Once this many particles are alive, no new ones
+        //! are emitted until old ones have died.
+        ParticleEmitter(const Image& image,
+            const ParticleSettings& settings = ParticleSettings(),
+            unsigned maxParticles = 1000);
+        ~ParticleEmitter();
+        
+        const ParticleSettings& settings() const;
+        //! Only affects particles that are emitted afterwards.
+        void setSettings(const ParticleSettings& settings);
+        
+        double x() const;
+        double y() const;
+        //! Sets where new particles appear.
+        void setPosition(double x, double y);
+        
+        //! Number of living particles.
+        unsigned particles() const;
+        
+        //! Emits a number of particles right away, e.g. for explosions.
+        void emit(unsigned count);
+        //! Advances the simulation, emitting new particles at the configured
+        //! rate. Usually called once per Window::update.
+        void update(double seconds);
+        //! Draws all particles, centered on their positions.
+        void draw(ZPos z, AlphaMode mode = amDefault) const;
+    };
+}
+
+#endif
@@ -0,0 +1,58 @@
+//! \file RenderTarget.hpp
+//! Interface of the RenderTarget class.
+
+#ifndef GOSU_RENDERTARGET_HPP
+#define GOSU_RENDERTARGET_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/Color.hpp>
+#include <Gosu/Image.hpp>
+#include <memory>
+
+namespace Gosu
+{
+    //! An image that can be drawn into, e.g. to put together UI panels or
+    //! minimaps. Everything drawn between begin() and end() is rendered onto
+    //! a texture right away, so that drawing the result costs no more than
+    //! drawing any other image, however much went into it. Macros (see
+    //! Graphics::beginRecording) instead draw everything they recorded
+    //! again each time.
+    //! Contents are only rendered again if the target is marked dirty.
+    class RenderTarget
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! Throws std::runtime_error if the graphics driver does not support
+        //! framebuffer objects.
+        RenderTarget(Graphics& graphics, unsigned width, unsigned height);
+        ~RenderTarget();
+
+        unsigned width() const;
+        unsigned height() const;
+
+        //! True until the contents have been rendered for the first time, and
+        //! again after markDirty().
+        bool dirty() const;
+        void markDirty();
+
+        //! Redirects all drawing on the graphics object into this target,
+        //! until end() is called. Coordinates are in pixels of the target,
+        //! with (0; 0) in its upper left corner. Render targets can be nested
+        //! and used while recording macros, but clipping is not available.
+        //! Custom OpenGL code runs with the target bound, in its coordinates.
+        void begin(Color clearWithColor = Color::NONE);
+        //! Renders everything drawn since begin() into the target and clears
+        //! the dirty flag. Translucent images drawn onto transparent parts of
+        //! the target end up more transparent than they would on the screen.
+        void end();
+
+        //! The contents of this target, to be drawn like any other image.
+        //! Copies of it keep showing the last contents even after the target
+        //! has been destroyed.
+        const Image& image() const;
+    };
+}
+
+#endif
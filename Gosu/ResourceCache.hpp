@@ -0,0 +1,42 @@
+//! \file ResourceCache.hpp
+//! Sharing of images and samples that are loaded from the same file.
+
+#ifndef GOSU_RESOURCECACHE_HPP
+#define GOSU_RESOURCECACHE_HPP
+
+#include <cstddef>
+
+namespace Gosu
+{
+    //! If enabled, constructors of Image and Sample that load a file share
+    //! the data of an image or sample that was loaded from the same
+    //! filename with the same arguments before, as long as it still exists.
+    //! Images are only shared between the same Graphics object. Filenames
+    //! are compared as given, and files are not loaded again when they
+    //! change on disk. Disabled by default.
+    void enableResourceCache(bool enabled);
+    
+    //! Makes Image::fromText keep the images it creates, so that the same
+    //! text with the same arguments is only rendered once. Unlike the
+    //! resource cache, images are kept while the program does not use
+    //! them, until they take more than the given number of bytes (four per
+    //! pixel); then the least recently used ones are dropped. 0, the
+    //! default, disables the cache and empties it.
+    void setTextImageCacheSize(std::size_t bytes);
+    
+    //! How often loading an image or sample since the program started
+    //! found its data in the cache (hits), or had to load the file while
+    //! the cache was enabled (misses). The same for Image::fromText and the
+    //! text image cache.
+    struct ResourceCacheStatistics
+    {
+        unsigned long imageHits, imageMisses, sampleHits, sampleMisses;
+        unsigned long textImageHits, textImageMisses;
+        //! Bytes taken by the images in the text image cache.
+        std::size_t textImageBytes;
+    };
+    
+    ResourceCacheStatistics resourceCacheStatistics();
+}
+
+#endif
@@ -0,0 +1,47 @@
+//! \file Shader.hpp
+//! Interface of the Shader class.
+
+#ifndef GOSU_SHADER_HPP
+#define GOSU_SHADER_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/TR1.hpp>
+#include <string>
+
+namespace Gosu
+{
+    // Internal, see Graphics::pushShader.
+    class ShaderProgram;
+
+    //! A GLSL program that replaces OpenGL's fixed-function processing for
+    //! everything drawn between Graphics::pushShader and popShader.
+    //! Requires OpenGL 2.0 and is not available on iOS.
+    //! Fragment shaders receive the vertex color in gl_Color and the texture
+    //! coordinates in gl_TexCoord[0]; the texture, if any, is bound to
+    //! texture unit 0. Copies of a Shader refer to the same program.
+    class Shader
+    {
+        std::tr1::shared_ptr<ShaderProgram> program;
+        friend class Graphics;
+
+    public:
+        //! Compiles and links a program. Throws std::runtime_error with the
+        //! driver's log if that fails, or if shaders are not supported.
+        //! \param vertexSource If empty, a default vertex shader is used
+        //! that applies Gosu's transformations and passes on the color and
+        //! texture coordinates.
+        explicit Shader(const std::string& fragmentSource,
+            const std::string& vertexSource = std::string());
+
+        //! Sets a uniform variable. Since drawing is only performed when the
+        //! frame ends, the last value set during a frame is used for
+        //! everything drawn with this shader in it. Unknown names are
+        //! ignored, because drivers remove uniforms that are never used.
+        void setUniform(const std::string& name, float value);
+        void setUniform(const std::string& name, float x, float y);
+        void setUniform(const std::string& name, float x, float y, float z, float w);
+        void setUniform(const std::string& name, int value);
+    };
+}
+
+#endif
@@ -1,12 +1,17 @@
 //! \file Sockets.hpp
-//! Interface of the three socket classes, MessageSocket, CommSocket and ListenerSocket.
+//! Interface of the three socket classes, MessageSocket, CommSocket and ListenerSocket,
+//! of SocketPoller and NetworkThread, which update many of them at once, and of
+//! MessageChannel, which packs messages on top of MessageSocket.
 
 #ifndef GOSU_SOCKETS_HPP
 #define GOSU_SOCKETS_HPP
 
+#include <Gosu/IO.hpp>
 #include <Gosu/TR1.hpp>
 #include <cstddef>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace Gosu
 {
@@ -20,13 +25,89 @@ namespace Gosu
     //! starting to listen.
     const SocketPort anyPort = 0;
     
+    class Socket;
+    
     //! Tries to convert a dotted IP4 string into an address suitable for
     //! socket functions. If the string supplied is not such a string, it
     //! tries to look up the host via DNS. If both methods fail, zero is
-    //! returned.
+    //! returned. Looking up a host can take seconds; see AddressResolver.
     SocketAddress stringToAddress(const std::string& s);
     //! Converts an address into a dotted IP4 string.
     std::string addressToString(SocketAddress address);
+    
+    //! Looks up hosts like stringToAddress on background threads, so that
+    //! the game does not wait for DNS. Addresses that have been found are
+    //! kept for a while, and looking up a host that is already being
+    //! looked up does not ask the DNS again.
+    class AddressResolver
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! Called with the host name and its address, or 0 if the host
+        //! could not be found.
+        typedef std::tr1::function<void (const std::string&, SocketAddress)> Callback;
+
+        //! \param threads Number of hosts that are looked up at once.
+        explicit AddressResolver(unsigned threads = 4);
+        //! Lookups that are still running are waited for, but their
+        //! callbacks are not called anymore.
+        ~AddressResolver();
+
+        //! Calls the callback from a later update(), even if the address
+        //! is known already.
+        void resolve(const std::string& host, const Callback& callback);
+        //! Returns true and sets address if the host has been looked up
+        //! successfully before and is still cached.
+        bool cached(const std::string& host, SocketAddress& address) const;
+        //! Number of hosts that are being looked up.
+        std::size_t pending() const;
+        //! Calls the callbacks of all lookups that have finished. Should be
+        //! called once per frame.
+        void update();
+
+        //! How long addresses are kept, in milliseconds. The default is
+        //! five minutes; 0 disables the cache.
+        unsigned cacheDuration() const;
+        void setCacheDuration(unsigned milliseconds);
+        void clearCache();
+    };
+
+    //! Counters kept by MessageSocket and CommSocket.
+    struct SocketStatistics
+    {
+        std::tr1::uint64_t bytesSent, bytesReceived;
+        //! Packets for MessageSockets; for CommSockets, calls to send() and
+        //! messages (or, in raw mode, pieces of data) passed to onReceive.
+        std::tr1::uint64_t packetsSent, packetsReceived;
+        //! Errors that were ignored, such as a full buffer or an
+        //! unreachable host. For MessageSockets, each one is a lost packet.
+        std::tr1::uint64_t sendErrors, receiveErrors;
+        //! The part of sendErrors caused by full buffers (ENOBUFS and
+        //! EWOULDBLOCK).
+        std::tr1::uint64_t sendsBlocked;
+        //! CommSocket only: Sends that the system only took a part of.
+        std::tr1::uint64_t partialSends;
+        //! CommSocket only: Bytes waiting to be sent or to be completed
+        //! into a message, and the most that have been waiting to be sent.
+        std::tr1::uint64_t outboxBytes, inboxBytes, outboxHighWater;
+    };
+
+    //! Returns the statistics of all sockets added up, including those
+    //! that no longer exist; outboxHighWater is the highest of any socket.
+    //! Only counts the sockets that exist for outboxBytes and inboxBytes.
+    //! Sockets that are busy on other threads may be off by a few calls.
+    SocketStatistics socketStatistics();
+
+    //! One message for MessageSocket::send to send as part of a batch.
+    struct OutgoingMessage
+    {
+        SocketAddress address;
+        SocketPort port;
+        const void* buffer;
+        std::size_t size;
+    };
 
     //! Wraps an UDP socket. Message sockets can send data to and receive
     //! data from arbitrary addresses. Also, message sockets send messages
@@ -37,6 +118,9 @@ namespace Gosu
         struct Impl;
         const std::auto_ptr<Impl> pimpl;
 
+        friend class SocketPoller;
+        const Socket& socket() const;
+
     public:
         //! Opens a message socket for listening at the specified port.
         //! Gosu::anyPort may be passed to have the message socket use
@@ -51,8 +135,10 @@ namespace Gosu
         //! Returns the maximum size, in bytes, of a packet that can be sent
         //! from this socket.
         std::size_t maxMessageSize() const;
+        SocketStatistics statistics() const;
 
-        //! Collects all the packets that were sent to this socket and
+        //! Sends the messages that are waiting because of coalescing, then
+        //! collects all the packets that were sent to this socket and
         //! calls onReceive for each of them.
         void update();
 
@@ -60,14 +146,155 @@ namespace Gosu
         //! by the address.
         void send(SocketAddress address, SocketPort port,
             const void* buffer, std::size_t size);
+        //! Convenience: Sends the contents of a buffer, e.g. one from a
+        //! BufferPool, which can be released right afterwards.
+        void send(SocketAddress address, SocketPort port, const Buffer& buffer)
+        {
+            send(address, port, buffer.data(), buffer.size());
+        }
+        //! Sends several messages at once. This takes fewer system calls
+        //! than sending them one by one where the system supports it.
+        void send(const OutgoingMessage* messages, std::size_t count);
         /*void broadcast(SocketPort port, const void* buffer,
             std::size_t size);*/
 
+        //! If enabled, messages to the same destination are collected and
+        //! packed into as few packets as possible, up to coalescingLimit()
+        //! bytes each, and only sent by flush() or update(). Both sides
+        //! have to enable coalescing, as the packets are split up into the
+        //! original messages again when received. Disabled by default.
+        void setCoalescing(bool enabled);
+        bool coalescing() const;
+        //! The largest packet that coalescing builds, in bytes. Messages
+        //! that do not fit in one are sent on their own. Defaults to 1200,
+        //! which fits into the MTU of most networks.
+        std::size_t coalescingLimit() const;
+        void setCoalescingLimit(std::size_t bytes);
+        //! Sends all messages that are waiting because of coalescing.
+        void flush();
+
         //! If assigned, will be called by update for every packet received.
         std::tr1::function<void (SocketAddress, SocketPort, const void*,
             std::size_t)> onReceive;
     };
     
+    //! Counters kept by MessageChannel, for one peer or all of them.
+    struct ChannelStatistics
+    {
+        //! Messages handed to send() and to onReceive, not counting
+        //! resends or duplicates.
+        std::tr1::uint64_t messagesSent, messagesReceived;
+        //! Packets and bytes on the wire, headers of the channel included.
+        std::tr1::uint64_t packetsSent, packetsReceived;
+        std::tr1::uint64_t bytesSent, bytesReceived;
+        //! Reliable messages that had to be sent again, and those that
+        //! arrived more than once.
+        std::tr1::uint64_t resends, duplicates;
+        //! Reliable messages that have not been acknowledged yet.
+        std::tr1::uint64_t unacknowledged;
+    };
+
+    //! Packs the small messages that games send into few packets. Messages
+    //! sent to the same peer are collected and sent together, in packets
+    //! of up to mtu() bytes, by flush(), which should be called once per
+    //! tick. Reliable messages are sent again until the peer acknowledges
+    //! them and are passed to onReceive in the order they were sent; other
+    //! messages can get lost or arrive out of order, like packets.
+    //! Both sides have to use a MessageChannel. The channel takes over the
+    //! socket's onReceive callback; the socket still has to be updated,
+    //! and it must not use coalescing.
+    class MessageChannel
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        explicit MessageChannel(MessageSocket& socket);
+        ~MessageChannel();
+
+        //! The largest packet that is built, in bytes. Messages that do not
+        //! fit in one are sent on their own. Defaults to 1200.
+        std::size_t mtu() const;
+        void setMtu(std::size_t bytes);
+        //! How long to wait for an acknowledgement, in milliseconds, before
+        //! a reliable message is sent again. Defaults to 200.
+        unsigned resendInterval() const;
+        void setResendInterval(unsigned milliseconds);
+
+        //! Queues a message for the next flush().
+        void send(SocketAddress address, SocketPort port,
+            const void* buffer, std::size_t size, bool reliable = false);
+        //! Sends the queued messages and acknowledgements, and resends the
+        //! reliable messages that have not been acknowledged in time.
+        void flush();
+        //! Drops everything that is known about a peer, including its
+        //! queued messages and statistics.
+        void forget(SocketAddress address, SocketPort port);
+
+        //! Returns the statistics of a single peer.
+        ChannelStatistics statistics(SocketAddress address, SocketPort port) const;
+        //! Returns the sum of the statistics of all peers.
+        ChannelStatistics statistics() const;
+
+        //! Called for every message received.
+        std::tr1::function<void (SocketAddress, SocketPort, const void*,
+            std::size_t)> onReceive;
+    };
+
+    //! Numbers the snapshots of one SnapshotEncoder peer; 0 means none.
+    typedef std::tr1::uint32_t SnapshotNumber;
+
+    //! Shrinks the snapshots of the game state that a server sends to its
+    //! clients every tick. Each snapshot is encoded against the newest one
+    //! that the client has acknowledged: The bytes that did not change XOR
+    //! to zero, and the result is compressed (see SnapshotDecoder for the
+    //! other side). The encoded snapshots are best sent as unreliable
+    //! messages through a MessageChannel or a coalescing MessageSocket,
+    //! since a lost one does not need to be sent again.
+    //! Snapshots work best if the state is laid out the same way every
+    //! tick, e.g. as an array of fixed-size records.
+    class SnapshotEncoder
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! Keeps the last history snapshots of each peer as possible
+        //! baselines. Clients that have not acknowledged any of them get
+        //! full snapshots again.
+        explicit SnapshotEncoder(unsigned history = 32);
+        ~SnapshotEncoder();
+
+        //! Replaces the contents of out by the encoded form of the state.
+        //! Returns the number of the new snapshot.
+        SnapshotNumber encode(SocketAddress address, SocketPort port,
+            const void* state, std::size_t size, std::vector<char>& out);
+        //! Call when a peer reports that a snapshot has arrived.
+        void acknowledge(SocketAddress address, SocketPort port, SnapshotNumber number);
+        //! Drops the snapshots kept for a peer.
+        void forget(SocketAddress address, SocketPort port);
+    };
+
+    //! Reconstructs the snapshots of a SnapshotEncoder from one peer.
+    class SnapshotDecoder
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! Should be the same as the encoder's history.
+        explicit SnapshotDecoder(unsigned history = 32);
+        ~SnapshotDecoder();
+
+        //! Reconstructs a snapshot into state and sets number to the
+        //! number that the encoder should be sent back as an acknowledgement.
+        //! Returns false, and leaves both alone, for snapshots that are
+        //! older than the last one decoded, are broken, or are based on one
+        //! that is not known anymore.
+        bool decode(const void* data, std::size_t size, std::vector<char>& state,
+            SnapshotNumber& number);
+    };
+
     //! Defines the way in which data is collected until the onReceive event
     //! is called for CommSockets.
     enum CommMode
@@ -77,8 +304,6 @@ namespace Gosu
         cmManaged
     };
     
-    class Socket;
-    
     //! Wraps a TCP socket that is used for one part of bi-directional
     //! communication.
     class CommSocket
@@ -86,9 +311,28 @@ namespace Gosu
         struct Impl;
         const std::auto_ptr<Impl> pimpl;
 
+        friend class SocketPoller;
+        const Socket& socket() const;
+        
+        // Returns true if the error disconnected the socket.
+        bool handleSendError();
+        // Returns true once a connection started by the asynchronous
+        // constructor has been established.
+        bool finishConnecting();
+
     public:
+        //! Connects to the given address, waiting until the connection has
+        //! been established or has failed.
         CommSocket(CommMode mode, SocketAddress targetAddress,
             SocketPort targetPort);
+        //! Starts connecting to the given address and returns right away.
+        //! connecting() is true until update() finds out how it went: It
+        //! calls onConnected once the connection has been established, or
+        //! onDisconnection if it has failed or has not been established
+        //! within the given number of milliseconds (0 leaves the timeout to
+        //! the system). Data sent in the meantime waits in the outbox.
+        CommSocket(CommMode mode, SocketAddress targetAddress,
+            SocketPort targetPort, unsigned connectTimeout);
         CommSocket(CommMode mode, Socket& socket);
         ~CommSocket();
 
@@ -98,20 +342,79 @@ namespace Gosu
         SocketPort remotePort() const;
         CommMode mode() const;
 
+        //! False while connecting().
         bool connected() const;
+        bool connecting() const;
         void disconnect();
         bool keepAlive() const;
         void setKeepAlive(bool value);
+        //! If enabled, small amounts of data are sent right away instead of
+        //! being held back to be sent together with what comes next
+        //! (disables Nagle's algorithm using TCP_NODELAY). Costs bandwidth,
+        //! but can save tens of milliseconds for small messages.
+        bool lowLatency() const;
+        void setLowLatency(bool value);
+        //! The size of the system's send buffer for this socket, in bytes.
+        std::size_t sendBufferSize() const;
+        void setSendBufferSize(std::size_t bytes);
 
         void update();
-        void send(const void* buffer, std::size_t size);
+        //! Tries to send the data right away if nothing else is waiting
+        //! to be sent; only what cannot be sent yet is copied.
+        //! Urgent data, such as player input, goes ahead of everything
+        //! that is waiting except for the rest of a message that has been
+        //! partly sent, and is not held back by the rate limit.
+        void send(const void* buffer, std::size_t size, bool urgent = false);
+        //! Convenience: Sends the contents of a buffer, e.g. one from a
+        //! BufferPool, which can be released right afterwards. The outbox
+        //! reuses its memory too, so this does not allocate once the
+        //! connection has been busy for a while.
+        void send(const Buffer& buffer, bool urgent = false)
+        {
+            send(buffer.data(), buffer.size(), urgent);
+        }
         void sendPendingData();
+        //! Hands as much of the pending data to the system as it takes
+        //! right now, instead of waiting for the next update().
+        void flush();
         std::size_t pendingBytes() const;
+        
+        //! Limits how many bytes per second are sent, e.g. so that a large
+        //! download does not fill the network for everyone else. Up to
+        //! burst bytes can be sent at once after the socket has been idle;
+        //! 0 stands for a tenth of a second's worth. Urgent data is never
+        //! held back, but counts towards the limit. The default is 0,
+        //! which means no limit.
+        std::size_t rateLimit() const;
+        void setRateLimit(std::size_t bytesPerSecond, std::size_t burst = 0);
+        
+        //! Limits how much update() receives, so that a peer that sends a
+        //! lot cannot hold up the game. The rest waits for the next call.
+        //! The default is 1 MiB; 0 means no limit.
+        std::size_t maxBytesPerUpdate() const;
+        void setMaxBytesPerUpdate(std::size_t bytes);
+        SocketStatistics statistics() const;
 
         std::tr1::function<void (const void*, std::size_t)> onReceive;
+        std::tr1::function<void ()> onConnected;
         std::tr1::function<void ()> onDisconnection;
     };
     
+    //! Counters kept by ListenerSocket.
+    struct ListenerStatistics
+    {
+        //! All connections accepted so far.
+        std::tr1::uint64_t accepted;
+        //! Connections accepted by the last update(), and how long that
+        //! took in microseconds, including the onConnection callbacks.
+        std::tr1::uint64_t acceptedLastUpdate, lastUpdateTime;
+        //! The most connections that a single update() has accepted.
+        std::tr1::uint64_t mostPerUpdate;
+        //! Updates that stopped at maxConnectionsPerUpdate(), so that more
+        //! connections may have been left waiting.
+        std::tr1::uint64_t limitReached;
+    };
+
     //! Wraps a TCP socket that waits on a specific port and can create
     //! CommSocket instances via its onConnection event.
     class ListenerSocket
@@ -119,6 +422,9 @@ namespace Gosu
         struct Impl;
         const std::auto_ptr<Impl> pimpl;
 
+        friend class SocketPoller;
+        const Socket& socket() const;
+
     public:
         ListenerSocket(SocketPort port);
         ~ListenerSocket();
@@ -126,12 +432,108 @@ namespace Gosu
         SocketAddress address() const;
         SocketPort port() const;
 
+        //! Accepts all connections that are waiting, up to
+        //! maxConnectionsPerUpdate().
         void update();
+        //! Limits how many connections update() accepts, so that a lot of
+        //! clients connecting at once cannot hold up the game. The rest
+        //! waits for the next call. The default is 64; 0 means no limit.
+        std::size_t maxConnectionsPerUpdate() const;
+        void setMaxConnectionsPerUpdate(std::size_t connections);
+        ListenerStatistics statistics() const;
 
         //! This signal is fired by update() whenever someone connects
         //! to the port which is currently listened on.
         std::tr1::function<void (Socket&)> onConnection;
     };
+    
+    //! Updates many sockets at once. Instead of calling update() on each of
+    //! them, which costs at least one system call per socket, add them to a
+    //! poller and call its update(): It asks the system which sockets
+    //! have something to receive (using epoll, kqueue or select) and only
+    //! updates those. Their callbacks are called as usual.
+    //! Sockets must be removed before they are destroyed. Removing or
+    //! adding sockets from within their callbacks is fine.
+    class SocketPoller
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        SocketPoller();
+        ~SocketPoller();
+
+        void add(MessageSocket& socket);
+        void add(CommSocket& socket);
+        void add(ListenerSocket& socket);
+        void remove(MessageSocket& socket);
+        void remove(CommSocket& socket);
+        void remove(ListenerSocket& socket);
+        //! Returns the number of sockets added to this poller.
+        std::size_t size() const;
+
+        //! Waits up to the given number of milliseconds for any of the
+        //! sockets to receive something, then updates those that did.
+        //! CommSockets with data waiting to be sent also send it, and
+        //! those that are still connecting are updated every time, so
+        //! that a connection may be reported up to timeout ms late.
+        //! Returns the number of sockets that were updated.
+        std::size_t update(unsigned timeout = 0);
+    };
+    
+    //! Runs sockets on a thread of its own, so that receiving does not
+    //! wait for the game's next frame. Everything that arrives is queued
+    //! with the time it arrived and handed to the callbacks by update(),
+    //! which is meant to be called once per frame. Sending is queued the
+    //! other way round. Sockets are created through the NetworkThread and
+    //! identified by connection ids; they cannot be accessed directly.
+    class NetworkThread
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        typedef unsigned Connection;
+
+        NetworkThread();
+        //! Stops the thread and closes all of its sockets.
+        ~NetworkThread();
+
+        //! Connects to the given address like CommSocket's constructor, so
+        //! this blocks until the connection has been established.
+        Connection connect(CommMode mode, SocketAddress address, SocketPort port);
+        //! Listens for connections like ListenerSocket. The connections
+        //! get ids of their own and are reported through onConnection.
+        Connection listen(CommMode mode, SocketPort port);
+        //! Opens a MessageSocket at the given port.
+        Connection openMessageSocket(SocketPort port);
+        //! Returns the local port of a connection created by listen() or
+        //! openMessageSocket(), or 0 for an unknown connection.
+        SocketPort localPort(Connection connection) const;
+
+        //! Sends over a connection created by connect() or onConnection.
+        void send(Connection connection, const void* buffer, std::size_t size);
+        //! Sends from a message socket opened by openMessageSocket().
+        void send(Connection connection, SocketAddress address, SocketPort port,
+            const void* buffer, std::size_t size);
+        void close(Connection connection);
+
+        //! Calls the callbacks for everything that has happened since the
+        //! last call. Rethrows errors that occurred on the network thread.
+        void update();
+
+        //! Called by update() for every message received. Address and port
+        //! are those of the sender. The last argument is when the message
+        //! arrived, in microseconds like Gosu::microseconds().
+        std::tr1::function<void (Connection, SocketAddress, SocketPort,
+            const void*, std::size_t, std::tr1::uint64_t)> onReceive;
+        //! Called by update() for every connection accepted by a listener,
+        //! with the listener's id and that of the new connection.
+        std::tr1::function<void (Connection, Connection)> onConnection;
+        //! Called by update() when a connection has been closed by the
+        //! other side or has failed. Its id becomes invalid.
+        std::tr1::function<void (Connection)> onDisconnection;
+    };
 }
 
 #endif
@@ -0,0 +1,59 @@
+//! \file SoundScape.hpp
+//! Interface of the SoundScape class.
+
+#ifndef GOSU_SOUNDSCAPE_HPP
+#define GOSU_SOUNDSCAPE_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <memory>
+
+namespace Gosu
+{
+    //! Plays samples at positions in a 2D world and adjusts their volume
+    //! and panning to where they are relative to a listener. Volume falls
+    //! off linearly with the distance, and sounds that would be too quiet
+    //! to hear do not take a channel.
+    class SoundScape
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+        
+    public:
+        //! \param range Distance from the listener at which sounds fade to
+        //! silence, and at which they are panned fully to one side.
+        //! \param threshold Sounds that would be played at a lower volume
+        //! than this, between 0 and 1, are not played.
+        explicit SoundScape(double range, double threshold = 0.02);
+        //! Sounds keep playing, like other samples; see stopAll.
+        ~SoundScape();
+        
+        double listenerX() const;
+        double listenerY() const;
+        void setListener(double x, double y);
+        
+        //! Plays a sample at the given point. Returns an id that can be
+        //! passed to move and stop; ids are not reused.
+        //! Sounds that cannot be heard are not played. If they are
+        //! looping, they are kept as virtual sounds, which start playing
+        //! once they can be heard.
+        unsigned play(const Sample& sample, double x, double y,
+            double volume = 1, double speed = 1, bool looping = false,
+            int priority = 0);
+        void move(unsigned sound, double x, double y);
+        void stop(unsigned sound);
+        void stopAll();
+        
+        //! Updates the volume and panning of all sounds after the listener
+        //! or the sounds have moved, usually once per Window::update.
+        //! Sounds that cannot be heard anymore are stopped; looping ones
+        //! become virtual and start anew once they can be heard again.
+        void update();
+        
+        //! Number of sounds that play on a channel.
+        unsigned audibleSounds() const;
+        //! Number of looping sounds that are too far away to be played.
+        unsigned virtualSounds() const;
+    };
+}
+
+#endif
@@ -0,0 +1,57 @@
+//! \file SpatialHash.hpp
+//! Interface of the SpatialHash class.
+
+#ifndef GOSU_SPATIALHASH_HPP
+#define GOSU_SPATIALHASH_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace Gosu
+{
+    //! Finds the objects near a point or inside an area without comparing
+    //! every pair of them, e.g. as the broad phase of collision checks.
+    //! Objects are axis-aligned boxes with ids of your choice. They are
+    //! sorted into the cells of a uniform grid that covers the whole plane,
+    //! and queries only look at the cells that they overlap.
+    //! Queries are not thread-safe, not even on a const SpatialHash.
+    class SpatialHash
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! \param cellSize Width and height of a grid cell. Works best at
+        //! about the size of a typical object.
+        explicit SpatialHash(double cellSize);
+        ~SpatialHash();
+
+        double cellSize() const;
+        //! Number of objects.
+        std::size_t size() const;
+        bool contains(unsigned id) const;
+        void clear();
+
+        //! Adds an object, or moves it if there already is one with that id.
+        void insert(unsigned id, double left, double top, double right, double bottom);
+        //! Same as insert. Cheap if the object stays in the same cells.
+        void update(unsigned id, double left, double top, double right, double bottom);
+        //! Does nothing if there is no object with that id.
+        void remove(unsigned id);
+
+        //! Appends the id of each object whose box overlaps the area, once
+        //! and in no particular order.
+        void queryRect(double left, double top, double right, double bottom,
+            std::vector<unsigned>& ids) const;
+        //! Appends the id of each object whose box overlaps the circle, once
+        //! and in no particular order.
+        void queryRadius(double x, double y, double radius,
+            std::vector<unsigned>& ids) const;
+        //! Appends the ids of every two objects whose boxes overlap, as
+        //! consecutive elements. Each pair is listed once.
+        void overlappingPairs(std::vector<unsigned>& ids) const;
+    };
+}
+
+#endif
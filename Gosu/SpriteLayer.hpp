@@ -0,0 +1,69 @@
+//! \file SpriteLayer.hpp
+//! Interface of the SpriteLayer class.
+
+#ifndef GOSU_SPRITELAYER_HPP
+#define GOSU_SPRITELAYER_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/Color.hpp>
+#include <Gosu/GraphicsBase.hpp>
+#include <Gosu/Image.hpp>
+#include <memory>
+
+namespace Gosu
+{
+    //! A set of sprites that are kept between frames instead of being drawn
+    //! one by one each frame. Sprites with the same z position are grouped
+    //! into buckets, each of which is recorded into a macro (see
+    //! Graphics::beginRecording) and drawn as a single operation. Changing
+    //! a sprite only re-records its own bucket, the next time the layer is
+    //! drawn. This pays off when most sprites stay where they are, e.g. for
+    //! scenery, items lying around or UI elements.
+    class SpriteLayer
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        //! Identifies a sprite in its layer. Handles of removed sprites are
+        //! never valid again, even though their slots are reused.
+        typedef unsigned long Handle;
+
+        //! \param bucketSize Sprites with the same z position are split
+        //! into buckets of at most this many sprites. Smaller buckets are
+        //! cheaper to re-record, but each costs one operation per draw.
+        explicit SpriteLayer(Graphics& graphics, unsigned bucketSize = 256);
+        ~SpriteLayer();
+
+        //! Adds a sprite that is drawn like Image::drawRot with a center of
+        //! (0.5; 0.5). The layer keeps a reference to the image.
+        Handle add(const Image& image, double x, double y, ZPos z,
+            double angle = 0, double factorX = 1, double factorY = 1,
+            Color c = Color::WHITE);
+        void remove(Handle handle);
+        void clear();
+        //! Returns false for handles of removed sprites.
+        bool contains(Handle handle) const;
+        //! Number of sprites in the layer.
+        std::size_t size() const;
+
+        void setImage(Handle handle, const Image& image);
+        void setPosition(Handle handle, double x, double y);
+        void setTransform(Handle handle, double angle,
+            double factorX = 1, double factorY = 1);
+        void setColor(Handle handle, Color c);
+        //! Moves the sprite into another bucket.
+        void setZ(Handle handle, ZPos z);
+
+        double x(Handle handle) const;
+        double y(Handle handle) const;
+        ZPos z(Handle handle) const;
+
+        //! Draws all sprites at their z positions, recording the buckets
+        //! that have changed since the last draw first. Must be called
+        //! during Window::draw.
+        void draw(AlphaMode mode = amDefault) const;
+    };
+}
+
+#endif
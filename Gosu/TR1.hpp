@@ -1,5 +1,5 @@
 //! \file TR1.hpp
-//! Includes all parts of C++03 (TR1) that are relevant for Gosu. It makes available the following members of the std::tr1 namespace: array, bind, function, shared_ptr, uint*_t and int*_t.
+//! Includes all parts of C++03 (TR1) that are relevant for Gosu. It makes available the following members of the std::tr1 namespace: array, bind, function, hash, shared_ptr, unordered_map, uint*_t and int*_t.
 
 #ifndef GOSU_TR1_HPP
 #define GOSU_TR1_HPP
@@ -9,6 +9,7 @@
 #if defined(_MSC_VER) || defined(_LIBCPP_MEMORY)
     #include <array>
     #include <functional>
+    #include <unordered_map>
     namespace std
     {
         namespace tr1
@@ -26,7 +27,10 @@
             using std::array;
             using std::bind;
             using std::function;
+            using std::hash;
             using std::shared_ptr;
+            using std::unordered_map;
+            using std::unordered_multimap;
             #endif
         }        
     }
@@ -34,6 +38,7 @@
     #include <tr1/array>
     #include <tr1/memory>
     #include <tr1/functional>
+    #include <tr1/unordered_map>
     #if defined(__GNUC__) && (__GNUC__ < 4 || __GNUC_MINOR__ < 2)
         #include <stdint.h>
         namespace std
@@ -47,6 +47,17 @@ namespace Gosu
         unsigned selectionStart() const;
         //! Sets the start of the selection as returned by selectionStart.
         void setSelectionStart(unsigned pos);
+
+        //! Returns the horizontal distance from the start of the text to the
+        //! caret, as drawn by font.draw(text(), ...). Measurements are kept
+        //! for one font at a time and updated incrementally as the text is
+        //! edited, so this is cheap to call every frame. Assumes that the
+        //! text contains no markup.
+        double caretX(const Font& font) const;
+        //! Like caretX, but for selectionStart().
+        double selectionStartX(const Font& font) const;
+        //! Like caretX, but for the end of the text.
+        double textWidth(const Font& font) const;
         
         // Platform-specific communication with Gosu::Input.
         #if defined(GOSU_IS_MAC)
@@ -0,0 +1,53 @@
+//! \file TileLayer.hpp
+//! Interface of the TileLayer class.
+
+#ifndef GOSU_TILELAYER_HPP
+#define GOSU_TILELAYER_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/GraphicsBase.hpp>
+#include <Gosu/Image.hpp>
+#include <memory>
+#include <vector>
+
+namespace Gosu
+{
+    //! A grid of tiles that rarely changes, e.g. one layer of a map. The
+    //! grid is split into chunks, each of which is recorded into a macro (see
+    //! Graphics::beginRecording) and then drawn as a single operation. This
+    //! is much faster than drawing every tile separately, particularly if
+    //! the tiles come from the same texture (see loadTiles).
+    class TileLayer
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+        
+    public:
+        //! Index of an empty cell.
+        static const int NO_TILE = -1;
+        
+        //! Creates an empty layer.
+        //! \param tiles The images to draw the map with, usually from
+        //! loadTiles. Cells are drawn using the size of the first one.
+        //! \param chunkSize Width and height of a chunk, in tiles. Only
+        //! visible chunks are drawn, and changing a tile re-records its chunk.
+        TileLayer(Graphics& graphics, const std::vector<Image>& tiles,
+            unsigned columns, unsigned rows, unsigned chunkSize = 16);
+        ~TileLayer();
+        
+        unsigned columns() const;
+        unsigned rows() const;
+        
+        //! Returns an index into the tiles passed to the constructor, or
+        //! NO_TILE.
+        int tile(unsigned column, unsigned row) const;
+        void setTile(unsigned column, unsigned row, int tile);
+        
+        //! Draws the layer so its upper left corner is at (x; y). Must be
+        //! called during Window::draw.
+        void draw(double x, double y, ZPos z, Color c = Color::WHITE,
+            AlphaMode mode = amDefault) const;
+    };
+}
+
+#endif
@@ -4,6 +4,8 @@
 #ifndef GOSU_TIMING_HPP
 #define GOSU_TIMING_HPP
 
+#include <Gosu/TR1.hpp>
+
 namespace Gosu
 {
     //! Freezes the current thread for at least the specified time.
@@ -11,6 +13,12 @@ namespace Gosu
 
     //! Incrementing, possibly wrapping millisecond timer.
     unsigned long milliseconds();
+
+    //! Monotonic microsecond timer with the best resolution available. It
+    //! does not wrap and is not affected by changes to the system time, so
+    //! it is suited for profiling and for timing frames. Starts at an
+    //! unspecified value.
+    std::tr1::uint64_t microseconds();
 }
 
 #endif
@@ -0,0 +1,93 @@
+//! \file Trace.hpp
+//! Recording of what Gosu and the game spend time on, for chrome://tracing.
+
+#ifndef GOSU_TRACE_HPP
+#define GOSU_TRACE_HPP
+
+#include <Gosu/TR1.hpp>
+#include <cstddef>
+#include <string>
+
+namespace Gosu
+{
+    //! Starts recording spans, forgetting those of earlier recordings.
+    //! Only the most recent ones are kept, so tracing can stay on while a
+    //! game is played and be saved right after a hitch.
+    //! \param capacity Number of spans to keep.
+    void startTracing(std::size_t capacity = 100000);
+    void stopTracing();
+    bool tracing();
+    //! Writes the recorded spans as Chrome trace_event JSON, which
+    //! chrome://tracing and Perfetto can open. Works while tracing too.
+    void saveTrace(const std::wstring& filename);
+
+    //! Records a span that has been measured by hand, e.g. in a script.
+    //! Times are in microseconds, see Gosu::microseconds.
+    void traceSpan(const std::string& name, std::tr1::uint64_t start,
+        std::tr1::uint64_t duration);
+
+    //! Records the time from its construction to its destruction as a span
+    //! on the current thread, if tracing is on. Use GOSU_TRACE instead.
+    class TraceScope
+    {
+        TraceScope(const TraceScope&);
+        TraceScope& operator=(const TraceScope&);
+
+        const char* name;
+        std::tr1::uint64_t start;
+
+    public:
+        //! \param name Must stay valid until the trace is saved, e.g. a
+        //! string literal.
+        explicit TraceScope(const char* name);
+        ~TraceScope();
+    };
+
+    //! Returns how long each phase of Gosu's startup took, such as creating
+    //! the window, the graphics and the audio device, as a plain text table
+    //! with one line per phase: its start in milliseconds after the first
+    //! phase began, its total duration and how often it ran. Phases are
+    //! always recorded, tracing or not, until the first frame has been
+    //! drawn, which ends the table with an "Until first frame" line.
+    //! If the GOSU_STARTUP_REPORT environment variable is set, the table is
+    //! also printed to stderr at that point, e.g. to watch startup times in
+    //! continuous integration along with GOSU_HEADLESS.
+    std::string startupReport();
+    //! Ends the startup phases. Called by Gosu after the first frame.
+    void finishStartup();
+
+    //! Like TraceScope, but also adds the time to a phase of the startup
+    //! report. Use GOSU_TRACE_STARTUP instead.
+    class StartupScope
+    {
+        StartupScope(const StartupScope&);
+        StartupScope& operator=(const StartupScope&);
+
+        TraceScope trace;
+        const char* name;
+        std::tr1::uint64_t start;
+
+    public:
+        explicit StartupScope(const char* name);
+        ~StartupScope();
+    };
+}
+
+//! Traces the rest of the enclosing block under the given name, which
+//! must be a string literal. Compiles to nothing if GOSU_NO_TRACING is
+//! defined.
+#ifdef GOSU_NO_TRACING
+#define GOSU_TRACE(name) ((void)0)
+#define GOSU_TRACE_STARTUP(name) ((void)0)
+#else
+#define GOSU_TRACE_JOIN2(a, b) a##b
+#define GOSU_TRACE_JOIN(a, b) GOSU_TRACE_JOIN2(a, b)
+#define GOSU_TRACE(name) \
+    Gosu::TraceScope GOSU_TRACE_JOIN(gosuTraceScope, __LINE__)(name)
+//! Traces the rest of the enclosing block as a phase of the startup
+//! report, see startupReport.
+#define GOSU_TRACE_STARTUP(name) \
+    Gosu::StartupScope GOSU_TRACE_JOIN(gosuStartupScope, __LINE__)(name)
+#endif
+
+#endif
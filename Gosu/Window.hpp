@@ -20,11 +20,37 @@
 
 namespace Gosu
 {
+    //! Whether swapping buffers waits for the screen's refresh, see
+    //! Window::setVSync.
+    enum VSyncMode
+    {
+        //! Vsync is on on Windows and OS X. On Linux, it is left to the
+        //! driver, except that a fixed timestep turns it on, since it draws
+        //! as often as it can.
+        vsDefault,
+        //! Frames are shown as soon as they are done, which can tear.
+        //! Meant for benchmarking.
+        vsOff,
+        vsOn,
+        //! Waits for the refresh unless the frame is late already, in which
+        //! case it is shown right away instead of waiting for the next one.
+        //! This tears a little where vsync would halve the frame rate. Falls
+        //! back to vsOn where the driver lacks swap_control_tear.
+        vsAdaptive
+    };
+
     //! Convenient all-in-one class that serves as the foundation of a standard
     //! Gosu application. Manages initialization of all of Gosu's core components
     //! and provides timing functionality.
     //! Note that you should really only use one instance of this class at the same time.
     //! This may or may not change later.
+    //! On Linux, windows are headless if the environment variable GOSU_HEADLESS
+    //! is set (to anything but 0): they render into an offscreen EGL pbuffer
+    //! and need no X server, e.g. to benchmark games on build machines. show()
+    //! then calls update() and draw() once per tick as fast as possible, and
+    //! waits for the GPU at the end of each frame. If GOSU_HEADLESS_FRAMES is
+    //! set too, show() returns after that many frames. Use
+    //! Graphics::screenshot to compare frames to reference images.
     class Window
     {
         struct Impl;
@@ -42,6 +68,81 @@ namespace Gosu
         void setCaption(const std::wstring& caption);
         
         double updateInterval() const;
+        
+        //! Makes show() keep the update interval more exactly: Instead of
+        //! sleeping in whole milliseconds, which lets frames arrive one or two
+        //! milliseconds late and causes judder, the window sleeps until
+        //! shortly before the next update is due and yields the CPU for the
+        //! rest of the time. This costs some CPU time. Either way, lateness
+        //! does not add up over time. The default is off. Has no effect on iOS.
+        void setPrecisePacing(bool precisePacing);
+        
+        //! Decouples update() from draw(): update() is called at a fixed
+        //! rate of once per updateInterval, however often the window is
+        //! drawn, while draw() is called as often as the screen's refresh
+        //! rate allows. Before each frame, update() is called as often as
+        //! needed to catch up with the time that has passed, but at most
+        //! five times, so that a game that cannot keep up slows down instead
+        //! of freezing. Use interpolation() to draw smooth movement between
+        //! updates. The default is off. Has no effect on iOS.
+        void setFixedTimestep(bool fixedTimestep);
+        //! With a fixed timestep, how far the time has advanced from the
+        //! last update towards the next one while draw() is called, between
+        //! 0 and 1. Objects can be drawn at previous + (current - previous)
+        //! * interpolation(). Always 0 otherwise.
+        double interpolation() const;
+        
+        //! Sets whether presenting frames waits for the screen's refresh.
+        //! Without a fixed timestep, update() keeps its pace either way; with
+        //! one, vsOff draws as many frames as the machine can. On OS X,
+        //! vsAdaptive is the same as vsOn. Has no effect on iOS. The default
+        //! is vsDefault.
+        void setVSync(VSyncMode mode);
+        //! Keeps the driver from queueing up more than the given number of
+        //! frames, from 1 to 3, after presenting them. Before each update,
+        //! the window waits until the GPU is done with the frame that many
+        //! frames ago. Drivers often queue two or three frames otherwise,
+        //! which adds as many frames between reading input and showing its
+        //! effect. Requires OpenGL 3.2 or ARB_sync, and has no effect
+        //! otherwise, on iOS, or with pipelined rendering, which only ever
+        //! has one frame in flight. The default is 0, which leaves this to
+        //! the driver.
+        void setMaxFramesInFlight(unsigned frames);
+        
+        //! Renders and presents each frame on a separate thread, while the
+        //! main thread already updates and draws the next one. This helps
+        //! games that spend a lot of time on both. Frames appear one frame
+        //! later, so this adds that much latency. While enabled, functors
+        //! passed to Graphics::scheduleGL are called on the render thread,
+        //! Graphics::beginGL and flush cannot be used, GPU timing is off,
+        //! rendererStatistics() reports the rendering work one frame late
+        //! and images recorded with Graphics::beginRecording must outlive
+        //! the frame after the one they were last drawn in.
+        //! Only available on Linux; has no effect elsewhere. The default is
+        //! off.
+        void setPipelinedRendering(bool pipelinedRendering);
+        
+        //! Lets the window wait without using the CPU after each update in
+        //! which needsRedraw() returned false, until an input event arrives,
+        //! wakeUp() is called or the time given to wakeUpAfter() has come.
+        //! Meant for tools and menus that do not change on their own. Songs
+        //! keep playing while the window waits. Only available on Linux; has
+        //! no effect elsewhere. The default is off.
+        void setIdleMode(bool idleMode);
+        //! Makes a waiting window run update() again. Can be called from any
+        //! thread.
+        void wakeUp();
+        //! Makes a waiting window run update() again after the given time at
+        //! the latest. Earlier wake-up times take precedence.
+        void wakeUpAfter(unsigned long milliseconds);
+        
+        //! Collects input once more right before draw(), and calls
+        //! buttonDown and buttonUp for what happened during update(), so
+        //! that the frame reflects it one update earlier. Input::eventTime
+        //! tells when each event happened. On OS X, only the mouse position
+        //! and gamepads are sampled again; has no effect on iOS. The default
+        //! is off.
+        void setLateInputSampling(bool lateInputSampling);
 
         //! Enters a modal loop where the Window is visible on screen and
         //! receives calls to draw, update etc.
@@ -0,0 +1,418 @@
+#include <Gosu/Archive.hpp>
+#include <Gosu/Utility.hpp>
+#include <GosuImpl/LZ4.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// An archive starts with a header and an index, followed by the data of
+// all files. All numbers are unsigned 32-bit little-endian integers.
+//   Header: "GosuPack", number of files, size of the name table
+//   Index:  one record per file, sorted by name: offset of the name in the
+//           name table, length of the name, offset of the data from the
+//           start of the archive, size of the data in the archive, size of
+//           the file, flags
+//   Name table: all names as UTF-8, without terminators
+// Files with the COMPRESSED flag are split into blocks of BLOCK_SIZE bytes
+// that are compressed separately (see LZ4.hpp), so that reading from the
+// middle of a file only decompresses one block. Their data starts with the
+// offsets of all blocks and of their end, relative to the data.
+
+namespace Gosu
+{
+    namespace
+    {
+        const char MAGIC[8] = { 'G', 'o', 's', 'u', 'P', 'a', 'c', 'k' };
+        enum { HEADER_SIZE = 16, RECORD_SIZE = 24, BLOCK_SIZE = 65536 };
+        enum Flags { COMPRESSED = 1 };
+
+        typedef std::tr1::uint32_t UInt32;
+
+        UInt32 get32(const char* bytes)
+        {
+            const unsigned char* u = reinterpret_cast<const unsigned char*>(bytes);
+            return u[0] | u[1] << 8 | u[2] << 16 | static_cast<UInt32>(u[3]) << 24;
+        }
+
+        // Like memcmp, names are compared as unsigned bytes, which is also
+        // how std::string sorts them when creating an archive.
+        int compareNames(const char* a, std::size_t aLength,
+            const char* b, std::size_t bLength)
+        {
+            int result = std::memcmp(a, b, std::min(aLength, bLength));
+            if (result != 0)
+                return result;
+            return aLength < bLength ? -1 : aLength > bLength;
+        }
+
+        std::string normalize(const std::wstring& name)
+        {
+            std::string result = wstringToUTF8(name);
+            std::replace(result.begin(), result.end(), '\\', '/');
+            return result;
+        }
+
+        class Entry;
+
+        // The last block that has been decompressed, shared by all files in
+        // an archive, so that reading a compressed file sequentially does
+        // not decompress any block twice.
+        struct BlockCache
+        {
+            Mutex mutex;
+            const Entry* entry;
+            std::size_t block;
+            std::vector<char> decompressed, compressed;
+
+            BlockCache()
+            : entry(0), block(0)
+            {
+            }
+        };
+
+        // One file in the archive, reading from the archive file.
+        class Entry : public Resource
+        {
+            const Resource* file;
+            BlockCache* cache;
+            std::size_t offset, storedSize, size_;
+            bool compressed;
+
+            // Only called with the cache locked.
+            const char* decompress(std::size_t block) const
+            {
+                if (cache->entry == this && cache->block == block)
+                    return &cache->decompressed[0];
+
+                char bounds[8];
+                file->read(offset + block * 4, sizeof bounds, bounds);
+                std::size_t begin = get32(bounds), end = get32(bounds + 4);
+                std::size_t tableSize = ((size_ + BLOCK_SIZE - 1) / BLOCK_SIZE + 1) * 4;
+                if (begin < tableSize || begin > end || end > storedSize)
+                    throw std::runtime_error("Broken file in archive");
+
+                const void* source = file->view(offset + begin, end - begin);
+                if (!source && end > begin)
+                {
+                    cache->compressed.resize(end - begin);
+                    file->read(offset + begin, end - begin, &cache->compressed[0]);
+                    source = &cache->compressed[0];
+                }
+                // Marked as empty first, in case decompression fails.
+                cache->entry = 0;
+                cache->decompressed.resize(BLOCK_SIZE);
+                LZ4::decompress(source, end - begin, &cache->decompressed[0],
+                    std::min<std::size_t>(BLOCK_SIZE, size_ - block * BLOCK_SIZE));
+                cache->entry = this;
+                cache->block = block;
+                return &cache->decompressed[0];
+            }
+
+        public:
+            const char* name;
+            std::size_t nameLength;
+
+            Entry()
+            : file(0), cache(0), offset(0), storedSize(0), size_(0),
+              compressed(false), name(0), nameLength(0)
+            {
+            }
+
+            void init(const Resource& archive, BlockCache& blockCache,
+                std::size_t dataOffset, std::size_t dataStoredSize,
+                std::size_t dataSize, bool isCompressed)
+            {
+                file = &archive;
+                cache = &blockCache;
+                offset = dataOffset;
+                storedSize = dataStoredSize;
+                size_ = dataSize;
+                compressed = isCompressed;
+            }
+
+            std::size_t size() const
+            {
+                return size_;
+            }
+
+            void resize(std::size_t)
+            {
+                throw std::logic_error("Cannot resize a file in an archive");
+            }
+
+            void read(std::size_t pos, std::size_t length, void* destBuffer) const
+            {
+                if (!compressed)
+                {
+                    file->read(offset + pos, length, destBuffer);
+                    return;
+                }
+
+                if (pos > size_ || length > size_ - pos)
+                    throw std::out_of_range("Cannot read past the end of a file in an archive");
+                char* dest = static_cast<char*>(destBuffer);
+                Lock lock(cache->mutex);
+                while (length > 0)
+                {
+                    std::size_t block = pos / BLOCK_SIZE, start = pos % BLOCK_SIZE;
+                    std::size_t chunk = std::min(length, BLOCK_SIZE - start);
+                    std::memcpy(dest, decompress(block) + start, chunk);
+                    dest += chunk;
+                    pos += chunk;
+                    length -= chunk;
+                }
+            }
+
+            void write(std::size_t, std::size_t, const void*)
+            {
+                throw std::logic_error("Cannot write to a file in an archive");
+            }
+
+            // Compressed files have no bytes to point to.
+            const void* view(std::size_t pos, std::size_t length) const
+            {
+                if (compressed || pos + length > size_)
+                    return 0;
+                return file->view(offset + pos, length);
+            }
+
+            int compare(const char* otherName, std::size_t otherLength) const
+            {
+                return compareNames(name, nameLength, otherName, otherLength);
+            }
+        };
+
+        // Not local statics, which might be constructed by two threads at
+        // once.
+        Mutex mountMutex;
+        std::vector<std::tr1::shared_ptr<const Archive> > mounted;
+    }
+}
+
+struct Gosu::Archive::Impl
+{
+    File file;
+    // The index is read from the mapped file where possible, and copied
+    // into this buffer otherwise.
+    Buffer indexCopy;
+    BlockCache cache;
+    Entry* entries;
+    std::size_t count;
+
+    explicit Impl(const std::wstring& filename)
+    : file(filename), entries(0), count(0)
+    {
+    }
+
+    ~Impl()
+    {
+        delete[] entries;
+    }
+
+    const Entry* find(const std::string& name) const
+    {
+        std::size_t first = 0, last = count;
+        while (first < last)
+        {
+            std::size_t middle = first + (last - first) / 2;
+            int order = entries[middle].compare(name.data(), name.size());
+            if (order == 0)
+                return &entries[middle];
+            if (order < 0)
+                first = middle + 1;
+            else
+                last = middle;
+        }
+        return 0;
+    }
+};
+
+Gosu::Archive::Archive(const std::wstring& filename)
+: pimpl(new Impl(filename))
+{
+    const std::string invalid = "Invalid archive " + wstringToUTF8(filename);
+    const File& file = pimpl->file;
+
+    char header[HEADER_SIZE];
+    if (file.size() < HEADER_SIZE)
+        throw std::runtime_error(invalid);
+    file.read(0, HEADER_SIZE, header);
+    if (!std::equal(MAGIC, MAGIC + sizeof MAGIC, header))
+        throw std::runtime_error(invalid);
+
+    std::size_t count = get32(header + 8), namesSize = get32(header + 12);
+    if (count > (file.size() - HEADER_SIZE) / RECORD_SIZE ||
+            namesSize > file.size() - HEADER_SIZE - count * RECORD_SIZE)
+        throw std::runtime_error(invalid);
+
+    std::size_t indexSize = count * RECORD_SIZE + namesSize;
+    const char* index = static_cast<const char*>(file.view(HEADER_SIZE, indexSize));
+    if (!index && indexSize > 0)
+    {
+        pimpl->indexCopy.resize(indexSize);
+        file.read(HEADER_SIZE, indexSize, pimpl->indexCopy.data());
+        index = static_cast<const char*>(pimpl->indexCopy.data());
+    }
+    const char* names = index + count * RECORD_SIZE;
+
+    pimpl->entries = new Entry[count];
+    pimpl->count = count;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const char* record = index + i * RECORD_SIZE;
+        std::size_t nameOffset = get32(record), nameLength = get32(record + 4);
+        std::size_t offset = get32(record + 8), storedSize = get32(record + 12);
+        std::size_t size = get32(record + 16), flags = get32(record + 20);
+        if (nameOffset > namesSize || nameLength > namesSize - nameOffset ||
+                offset > file.size() || storedSize > file.size() - offset ||
+                (!(flags & COMPRESSED) && storedSize != size))
+            throw std::runtime_error(invalid);
+
+        Entry& entry = pimpl->entries[i];
+        entry.init(file, pimpl->cache, offset, storedSize, size, (flags & COMPRESSED) != 0);
+        entry.name = names + nameOffset;
+        entry.nameLength = nameLength;
+
+        // Lookups rely on the order.
+        if (i > 0 && pimpl->entries[i - 1].compare(entry.name, entry.nameLength) >= 0)
+            throw std::runtime_error(invalid);
+    }
+}
+
+Gosu::Archive::~Archive()
+{
+}
+
+std::size_t Gosu::Archive::size() const
+{
+    return pimpl->count;
+}
+
+std::wstring Gosu::Archive::name(std::size_t index) const
+{
+    const Entry& entry = pimpl->entries[index];
+    return utf8ToWstring(std::string(entry.name, entry.nameLength));
+}
+
+const Gosu::Resource* Gosu::Archive::find(const std::wstring& name) const
+{
+    return pimpl->find(normalize(name));
+}
+
+const Gosu::Resource& Gosu::Archive::entry(const std::wstring& name) const
+{
+    const Resource* result = find(name);
+    if (!result)
+        throw std::runtime_error("Cannot find " + wstringToUTF8(name) + " in archive");
+    return *result;
+}
+
+void Gosu::createArchive(const std::wstring& filename,
+    const std::vector<std::wstring>& names, const std::wstring& directory,
+    bool compress)
+{
+    std::vector<std::string> sorted;
+    for (std::size_t i = 0; i < names.size(); ++i)
+        sorted.push_back(normalize(names[i]));
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+        throw std::invalid_argument("Duplicate file name in archive");
+
+    std::size_t namesSize = 0;
+    for (std::size_t i = 0; i < sorted.size(); ++i)
+        namesSize += sorted[i].size();
+
+    // The index is written last, once the sizes of the data are known.
+    File out(filename, fmReplace);
+    Writer writer = out.backWriter();
+    writer.write(MAGIC, sizeof MAGIC);
+    writer.writePod<UInt32>(sorted.size(), boLittle);
+    writer.writePod<UInt32>(namesSize, boLittle);
+    writer.setPosition(HEADER_SIZE + sorted.size() * RECORD_SIZE);
+    for (std::size_t i = 0; i < sorted.size(); ++i)
+        writer.write(sorted[i].data(), sorted[i].size());
+
+    std::wstring prefix = directory.empty() ? directory : directory + L"/";
+    Buffer buffer;
+    std::vector<char> packed;
+    std::vector<UInt32> blocks;
+    Writer index(out, HEADER_SIZE);
+    std::size_t nameOffset = 0;
+    for (std::size_t i = 0; i < sorted.size(); ++i)
+    {
+        File in(prefix + utf8ToWstring(sorted[i]));
+        std::size_t size = in.size();
+        const char* data = static_cast<const char*>(in.view(0, size));
+        if (!data && size > 0)
+        {
+            buffer.resize(size);
+            in.read(0, size, buffer.data());
+            data = static_cast<const char*>(buffer.data());
+        }
+
+        // Files that do not get smaller, like most images and sounds, are
+        // stored as they are, so that they can still be mapped.
+        UInt32 flags = 0;
+        std::size_t storedSize = size;
+        if (compress)
+        {
+            std::size_t count = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            packed.clear();
+            blocks.clear();
+            for (std::size_t block = 0; block < count; ++block)
+            {
+                blocks.push_back((count + 1) * 4 + packed.size());
+                LZ4::compress(data + block * BLOCK_SIZE,
+                    std::min<std::size_t>(BLOCK_SIZE, size - block * BLOCK_SIZE), packed);
+            }
+            blocks.push_back((count + 1) * 4 + packed.size());
+            if (blocks.back() < size)
+            {
+                flags = COMPRESSED;
+                storedSize = blocks.back();
+            }
+        }
+
+        std::size_t dataOffset = writer.position();
+        if (dataOffset + storedSize < dataOffset || dataOffset + storedSize > 0xffffffffu)
+            throw std::length_error("Archive too large");
+        if (flags & COMPRESSED)
+        {
+            for (std::size_t block = 0; block < blocks.size(); ++block)
+                writer.writePod(blocks[block], boLittle);
+            writer.write(&packed[0], packed.size());
+        }
+        else
+            writer.write(data, size);
+
+        index.writePod<UInt32>(nameOffset, boLittle);
+        index.writePod<UInt32>(sorted[i].size(), boLittle);
+        index.writePod<UInt32>(dataOffset, boLittle);
+        index.writePod<UInt32>(storedSize, boLittle);
+        index.writePod<UInt32>(size, boLittle);
+        index.writePod<UInt32>(flags, boLittle);
+        nameOffset += sorted[i].size();
+    }
+}
+
+void Gosu::mountArchive(const std::tr1::shared_ptr<const Archive>& archive)
+{
+    Lock lock(mountMutex);
+    mounted.push_back(archive);
+}
+
+void Gosu::unmountArchive(const std::tr1::shared_ptr<const Archive>& archive)
+{
+    Lock lock(mountMutex);
+    mounted.erase(std::remove(mounted.begin(), mounted.end(), archive), mounted.end());
+}
+
+const Gosu::Resource* Gosu::findInMountedArchives(const std::wstring& name)
+{
+    Lock lock(mountMutex);
+    for (std::size_t i = mounted.size(); i > 0; --i)
+        if (const Resource* entry = mounted[i - 1]->find(name))
+            return entry;
+    return 0;
+}
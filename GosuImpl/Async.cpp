@@ -1,38 +1,814 @@
 #include <Gosu/Async.hpp>
+#include <Gosu/Archive.hpp>
+#include <Gosu/Audio.hpp>
+#include <Gosu/Bitmap.hpp>
 #include <Gosu/Graphics.hpp>
 #include <Gosu/Image.hpp>
-#include <Gosu/TR1.hpp>
-#include <Gosu/Window.hpp>
+#include <Gosu/IO.hpp>
+#include <Gosu/Text.hpp>
+#include <Gosu/Timing.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/CompressedTexture.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
-using namespace std;
 using namespace std::tr1;
+using namespace std::tr1::placeholders;
 
 namespace Gosu
 {
     namespace
     {
-        void asyncNewImage_Impl(Window& window, std::wstring filename,
-                            Window::SharedContext context,
-                            shared_ptr<try_mutex> mutex,
-                            shared_ptr<std::auto_ptr<Image> > result)
+        // The pool and index of the worker that the current thread is, so
+        // that jobs can queue more jobs right where they run.
+        GOSU_THREAD_LOCAL const void* workerPool;
+        GOSU_THREAD_LOCAL unsigned workerIndex;
+
+        // Shared between the threads that work on one parallelFor call.
+        struct ParallelFor
+        {
+            AsyncPool::RangeJob body;
+            std::size_t count, grain, next, ranges, completed;
+            Mutex mutex;
+            Semaphore allDone;
+            std::string error;
+
+            // Runs ranges until none are left.
+            void work()
+            {
+                for (;;)
+                {
+                    std::size_t begin;
+                    {
+                        Lock lock(mutex);
+                        if (next >= count)
+                            return;
+                        begin = next;
+                        next = begin + std::min(grain, count - begin);
+                    }
+
+                    std::string failure;
+                    try
+                    {
+                        body(begin, std::min(begin + grain, count));
+                    }
+                    catch (const std::exception& e)
+                    {
+                        failure = e.what();
+                    }
+                    catch (...)
+                    {
+                        failure = "Unknown error in parallelFor";
+                    }
+
+                    Lock lock(mutex);
+                    if (!failure.empty() && error.empty())
+                        error = failure;
+                    if (++completed == ranges)
+                        allDone.post();
+                }
+            }
+        };
+    }
+}
+
+struct Gosu::AsyncPool::Impl
+{
+    struct Task
+    {
+        Job work, done;
+        // Whether deliver() has to hear about the task. parallelFor helpers
+        // are not delivered.
+        bool delivered;
+        bool failed;
+        std::string error;
+    };
+
+    // Each worker has a queue of its own, so that workers rarely contend
+    // for a lock. Tasks from other threads are spread over the queues in
+    // turn and run in order; tasks that a job queues go to the front of
+    // its worker's queue, since their data is likely still in the cache.
+    // A worker whose queue is empty steals from the back of the others.
+    struct Queue
+    {
+        Mutex mutex;
+        std::deque<Task> tasks;
+    };
+    std::vector<shared_ptr<Queue> > queues;
+
+    // One post per queued task; a worker that finds no task quits.
+    Semaphore tasksAvailable;
+
+    // Guards the members below.
+    Mutex mutex;
+    std::deque<Task> finished;
+    unsigned pending;
+    unsigned nextQueue;
+
+    std::vector<Thread*> workers;
+
+    void push(const Task& task)
+    {
+        if (workerPool == this)
+        {
+            Queue& own = *queues[workerIndex];
+            Lock lock(own.mutex);
+            own.tasks.push_front(task);
+        }
+        else
+        {
+            unsigned index;
+            {
+                Lock lock(mutex);
+                index = nextQueue++ % queues.size();
+            }
+            Queue& queue = *queues[index];
+            Lock lock(queue.mutex);
+            queue.tasks.push_back(task);
+        }
+        tasksAvailable.post();
+    }
+
+    bool take(unsigned index, Task& task)
+    {
+        for (unsigned i = 0; i < queues.size(); ++i)
+        {
+            Queue& queue = *queues[(index + i) % queues.size()];
+            Lock lock(queue.mutex);
+            if (queue.tasks.empty())
+                continue;
+            if (i == 0)
+            {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            else
+            {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void runWorker(unsigned index)
+    {
+        workerPool = this;
+        workerIndex = index;
+
+        for (;;)
+        {
+            tasksAvailable.wait();
+
+            // Every post stands for a task that no worker has taken yet.
+            Task task;
+            if (!take(index, task))
+                return;
+
+            task.failed = false;
+            try
+            {
+                task.work();
+            }
+            catch (const std::exception& e)
+            {
+                task.failed = true;
+                task.error = e.what();
+            }
+            catch (...)
+            {
+                task.failed = true;
+                task.error = "Unknown error in background job";
+            }
+
+            if (!task.delivered)
+                continue;
+            Lock lock(mutex);
+            finished.push_back(task);
+        }
+    }
+};
+
+Gosu::AsyncPool::AsyncPool(unsigned threads)
+: pimpl(new Impl)
+{
+    if (threads == 0)
+        threads = std::max(hardwareThreads(), 2u) - 1;
+
+    pimpl->pending = 0;
+    pimpl->nextQueue = 0;
+    for (unsigned i = 0; i < threads; ++i)
+        pimpl->queues.push_back(shared_ptr<Impl::Queue>(new Impl::Queue));
+    try
+    {
+        for (unsigned i = 0; i < threads; ++i)
+            pimpl->workers.push_back(new Thread(bind(&Impl::runWorker, pimpl.get(), i)));
+    }
+    catch (...)
+    {
+        for (unsigned i = 0; i < pimpl->workers.size(); ++i)
+            pimpl->tasksAvailable.post();
+        for (unsigned i = 0; i < pimpl->workers.size(); ++i)
+            delete pimpl->workers[i];
+        throw;
+    }
+}
+
+Gosu::AsyncPool::~AsyncPool()
+{
+    for (unsigned i = 0; i < pimpl->queues.size(); ++i)
+    {
+        Lock lock(pimpl->queues[i]->mutex);
+        pimpl->queues[i]->tasks.clear();
+    }
+    for (unsigned i = 0; i < pimpl->workers.size(); ++i)
+        pimpl->tasksAvailable.post();
+    // Joins the threads.
+    for (unsigned i = 0; i < pimpl->workers.size(); ++i)
+        delete pimpl->workers[i];
+}
+
+unsigned Gosu::AsyncPool::threads() const
+{
+    return pimpl->workers.size();
+}
+
+unsigned Gosu::AsyncPool::pending() const
+{
+    Lock lock(pimpl->mutex);
+    return pimpl->pending;
+}
+
+void Gosu::AsyncPool::enqueue(const Job& work, const Job& done)
+{
+    Impl::Task task;
+    task.work = work;
+    task.done = done;
+    task.delivered = true;
+    {
+        Lock lock(pimpl->mutex);
+        ++pimpl->pending;
+    }
+    pimpl->push(task);
+}
+
+void Gosu::AsyncPool::parallelFor(std::size_t count, const RangeJob& body, std::size_t grain)
+{
+    if (count == 0)
+        return;
+    unsigned threads = pimpl->workers.size() + 1;
+    if (grain == 0)
+        grain = std::max<std::size_t>(count / (threads * 4), 1);
+
+    shared_ptr<ParallelFor> state(new ParallelFor);
+    state->body = body;
+    state->count = count;
+    state->grain = grain;
+    state->next = state->completed = 0;
+    state->ranges = (count + grain - 1) / grain;
+
+    // Helpers that start after all ranges have been taken return at once.
+    Impl::Task helper;
+    helper.work = bind(&ParallelFor::work, state);
+    helper.delivered = false;
+    std::size_t helpers = std::min<std::size_t>(state->ranges - 1, pimpl->workers.size());
+    for (std::size_t i = 0; i < helpers; ++i)
+        pimpl->push(helper);
+
+    // Working along keeps this from waiting forever when it is called from
+    // a job while all workers are busy.
+    state->work();
+    state->allDone.wait();
+
+    if (!state->error.empty())
+        throw std::runtime_error(state->error);
+}
+
+void Gosu::AsyncPool::deliver()
+{
+    std::deque<Impl::Task> finished;
+    {
+        Lock lock(pimpl->mutex);
+        finished.swap(pimpl->finished);
+        pimpl->pending -= finished.size();
+    }
+
+    std::string error;
+    for (std::deque<Impl::Task>::iterator it = finished.begin(); it != finished.end(); ++it)
+    {
+        if (it->failed)
         {
-            try_mutex::scoped_lock lock(*mutex);
-            (*context)();
-            result->reset(new Image(window.graphics(), filename));
+            if (error.empty())
+                error = it->error;
         }
+        else if (it->done)
+            it->done();
     }
+
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
+
+void Gosu::AsyncPool::finish()
+{
+    while (pending() > 0)
+    {
+        deliver();
+        if (pending() > 0)
+            sleep(1);
+    }
+}
+
+namespace
+{
+    unsigned sharedPoolThreads = 0;
+    std::auto_ptr<Gosu::AsyncPool> sharedPool;
+
+    Gosu::Mutex& sharedPoolMutex()
+    {
+        static Gosu::Mutex mutex;
+        return mutex;
+    }
+}
+
+Gosu::AsyncPool& Gosu::sharedAsyncPool()
+{
+    Lock lock(sharedPoolMutex());
+    if (!sharedPool.get())
+        sharedPool.reset(new AsyncPool(sharedPoolThreads));
+    return *sharedPool;
+}
+
+void Gosu::setSharedAsyncPoolThreads(unsigned threads)
+{
+    Lock lock(sharedPoolMutex());
+    if (sharedPool.get())
+        throw std::logic_error("The shared AsyncPool has already been created");
+    sharedPoolThreads = threads;
+}
+
+Gosu::Mutex Gosu::textMutex;
+
+namespace Gosu
+{
+    namespace
+    {
+
+        void loadBitmapJob(shared_ptr<Bitmap> bitmap, const std::wstring& filename)
+        {
+            loadCachedImageFile(*bitmap, filename);
+        }
+
+        void decodeRangeJob(std::vector<Bitmap>* bitmaps,
+            const std::vector<std::wstring>* filenames, std::size_t begin, std::size_t end)
+        {
+            for (std::size_t i = begin; i < end; ++i)
+                loadCachedImageFile((*bitmaps)[i], (*filenames)[i]);
+        }
+
+        void createImageJob(AsyncResult<Image> result, Graphics* graphics,
+            shared_ptr<Bitmap> bitmap, bool tileable)
+        {
+            result.setValue(std::auto_ptr<Image>(new Image(*graphics, *bitmap, tileable)));
+        }
+
+        void createTextJob(shared_ptr<Bitmap> bitmap, const std::wstring& text,
+            const std::wstring& fontName, unsigned fontHeight)
+        {
+            Lock lock(textMutex);
+            *bitmap = createText(text, fontName, fontHeight);
+        }
+
+        void saveFileJob(shared_ptr<Buffer> buffer, const std::wstring& filename)
+        {
+            saveFileAtomically(*buffer, filename);
+        }
+
+        void loadSampleJob(shared_ptr<std::auto_ptr<Sample> > sample, const std::wstring& filename)
+        {
+            sample->reset(new Sample(filename));
+        }
+
+        void loadSongJob(shared_ptr<std::auto_ptr<Song> > song, const std::wstring& filename)
+        {
+            song->reset(new Song(filename));
+            (*song)->preload();
+        }
+
+        struct TallerBitmap
+        {
+            const std::vector<Bitmap>* bitmaps;
+            
+            bool operator()(std::size_t lhs, std::size_t rhs) const
+            {
+                return (*bitmaps)[lhs].height() > (*bitmaps)[rhs].height();
+            }
+        };
+
+        template<typename Result>
+        void deliverJob(AsyncResult<Result> result, shared_ptr<std::auto_ptr<Result> > value)
+        {
+            result.setValue(*value);
+        }
+
+        void deliverBitmapJob(AsyncResult<Bitmap> result, shared_ptr<Bitmap> bitmap)
+        {
+            std::auto_ptr<Bitmap> value(new Bitmap);
+            value->swap(*bitmap);
+            result.setValue(value);
+        }
+    }
+}
+
+Gosu::AsyncResult<Gosu::Image> Gosu::asyncNewImage(AsyncPool& pool, Graphics& graphics,
+    const std::wstring& filename, bool tileable)
+{
+    AsyncResult<Image> result;
+    shared_ptr<Bitmap> bitmap(new Bitmap);
+    pool.enqueue(bind(loadBitmapJob, bitmap, filename),
+        bind(createImageJob, result, &graphics, bitmap, tileable));
+    return result;
+}
+
+std::vector<Gosu::Image> Gosu::loadImages(Graphics& graphics,
+    const std::vector<std::wstring>& filenames, bool tileable, unsigned threads)
+{
+    std::vector<Bitmap> bitmaps(filenames.size());
+    {
+        std::auto_ptr<AsyncPool> ownPool;
+        if (threads != 0)
+            ownPool.reset(new AsyncPool(threads));
+        AsyncPool& pool = ownPool.get() ? *ownPool : sharedAsyncPool();
+        pool.parallelFor(filenames.size(), bind(decodeRangeJob, &bitmaps, &filenames, _1, _2), 1);
+    }
+    
+    std::vector<std::size_t> order(filenames.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    TallerBitmap taller = { &bitmaps };
+    std::stable_sort(order.begin(), order.end(), taller);
+    
+    std::vector<shared_ptr<Image> > images(filenames.size());
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        images[order[i]].reset(new Image(graphics, bitmaps[order[i]], tileable));
+        // Free memory as we go.
+        Bitmap().swap(bitmaps[order[i]]);
+    }
+    
+    std::vector<Image> result;
+    result.reserve(images.size());
+    for (std::size_t i = 0; i < images.size(); ++i)
+        result.push_back(*images[i]);
+    return result;
+}
+
+Gosu::AsyncResult<Gosu::Bitmap> Gosu::asyncLoadImageFile(AsyncPool& pool,
+    const std::wstring& filename)
+{
+    AsyncResult<Bitmap> result;
+    shared_ptr<Bitmap> bitmap(new Bitmap);
+    pool.enqueue(bind(loadBitmapJob, bitmap, filename),
+        bind(deliverBitmapJob, result, bitmap));
+    return result;
+}
+
+void Gosu::asyncSaveFile(AsyncPool& pool, const Buffer& buffer,
+    const std::wstring& filename, const AsyncPool::Job& done)
+{
+    pool.enqueue(bind(saveFileJob, shared_ptr<Buffer>(new Buffer(buffer)), filename), done);
+}
+
+Gosu::AsyncResult<Gosu::Sample> Gosu::asyncNewSample(AsyncPool& pool,
+    const std::wstring& filename)
+{
+    AsyncResult<Sample> result;
+    shared_ptr<std::auto_ptr<Sample> > sample(new std::auto_ptr<Sample>);
+    pool.enqueue(bind(loadSampleJob, sample, filename),
+        bind(deliverJob<Sample>, result, sample));
+    return result;
+}
+
+Gosu::AsyncResult<Gosu::Song> Gosu::asyncNewSong(AsyncPool& pool,
+    const std::wstring& filename)
+{
+    AsyncResult<Song> result;
+    shared_ptr<std::auto_ptr<Song> > song(new std::auto_ptr<Song>);
+    pool.enqueue(bind(loadSongJob, song, filename),
+        bind(deliverJob<Song>, result, song));
+    return result;
+}
+
+Gosu::AsyncResult<Gosu::Bitmap> Gosu::asyncCreateText(AsyncPool& pool,
+    const std::wstring& text, const std::wstring& fontName, unsigned fontHeight)
+{
+    AsyncResult<Bitmap> result;
+    shared_ptr<Bitmap> bitmap(new Bitmap);
+    pool.enqueue(bind(createTextJob, bitmap, text, fontName, fontHeight),
+        bind(deliverBitmapJob, result, bitmap));
+    return result;
+}
+
+namespace Gosu
+{
+    namespace
+    {
+        enum AssetKind { IMAGE, TILES, SAMPLE, SONG, FONT };
+
+        // Filled in by the I/O thread, then by a worker, then on the main
+        // thread; each step only starts once the previous one is done.
+        struct Asset
+        {
+            AssetKind kind;
+            std::wstring filename;
+            int tileWidth, tileHeight;
+            bool tileable;
+            unsigned fontHeight;
+
+            std::auto_ptr<Buffer> data;
+            Bitmap bitmap;
+            bool compressedTexture;
+            std::auto_ptr<Sample> sample;
+        };
+
+        void readAssetJob(shared_ptr<Asset> asset)
+        {
+            std::auto_ptr<File> file;
+            const Resource* source = findInMountedArchives(asset->filename);
+            if (!source)
+            {
+                file.reset(new File(asset->filename));
+                source = file.get();
+            }
+            asset->data.reset(new Buffer);
+            asset->data->resize(source->size());
+            source->read(0, asset->data->size(), asset->data->data());
+        }
+
+        void decodeAssetJob(shared_ptr<Asset> asset)
+        {
+            Reader reader = asset->data->frontReader();
+            switch (asset->kind)
+            {
+            case IMAGE:
+            case TILES:
+                // Tiles are cut from bitmaps, so they are always decoded.
+                asset->compressedTexture = asset->kind == IMAGE &&
+                    isCompressedTextureFile(reader);
+                if (!asset->compressedTexture)
+                {
+                    loadImageFile(asset->bitmap, reader);
+                    asset->data.reset();
+                }
+                break;
+            case SAMPLE:
+                asset->sample.reset(new Sample(reader));
+                asset->data.reset();
+                break;
+            default:
+                // Songs are opened on the main thread.
+                break;
+            }
+        }
+    }
+}
+
+struct Gosu::AssetManifest::Impl
+{
+    Graphics& graphics;
+    AsyncPool io, decoders;
+    std::vector<shared_ptr<Asset> > added;
+    std::deque<shared_ptr<Asset> > uploads;
+    std::size_t loaded;
+    unsigned uploadBudget;
+    bool started;
+
+    std::map<std::wstring, shared_ptr<Image> > images;
+    std::map<std::wstring, std::vector<Image> > tiles;
+    std::map<std::wstring, shared_ptr<Sample> > samples;
+    std::map<std::wstring, shared_ptr<Song> > songs;
+    std::map<std::pair<std::wstring, unsigned>, shared_ptr<Font> > fonts;
+
+    Impl(Graphics& graphics, unsigned threads)
+    : graphics(graphics), io(1), decoders(threads), loaded(0),
+      uploadBudget(4), started(false)
+    {
+    }
+
+    void add(AssetKind kind, const std::wstring& filename, int tileWidth = 0,
+        int tileHeight = 0, bool tileable = false, unsigned fontHeight = 0)
+    {
+        if (started)
+            throw std::logic_error("Cannot add assets to a manifest that has been started");
+        shared_ptr<Asset> asset(new Asset);
+        asset->kind = kind;
+        asset->filename = filename;
+        asset->tileWidth = tileWidth;
+        asset->tileHeight = tileHeight;
+        asset->tileable = tileable;
+        asset->fontHeight = fontHeight;
+        asset->compressedTexture = false;
+        added.push_back(asset);
+    }
+
+    // Called on the main thread by io.deliver().
+    void read(shared_ptr<Asset> asset)
+    {
+        decoders.enqueue(bind(decodeAssetJob, asset), bind(&Impl::decoded, this, asset));
+    }
+
+    // Called on the main thread by decoders.deliver().
+    void decoded(shared_ptr<Asset> asset)
+    {
+        uploads.push_back(asset);
+    }
+
+    void upload(Asset& asset)
+    {
+        switch (asset.kind)
+        {
+        case IMAGE:
+            if (asset.compressedTexture)
+                images[asset.filename].reset(new Image(
+                    graphics.createCompressedImage(asset.data->frontReader())));
+            else
+                images[asset.filename].reset(new Image(graphics, asset.bitmap, asset.tileable));
+            break;
+        case TILES:
+            tiles[asset.filename] = loadTiles(graphics, asset.bitmap,
+                asset.tileWidth, asset.tileHeight, asset.tileable);
+            break;
+        case SAMPLE:
+            samples[asset.filename].reset(asset.sample.release());
+            break;
+        case SONG:
+            songs[asset.filename].reset(new Song(asset.data->frontReader()));
+            break;
+        case FONT:
+            fonts[std::make_pair(asset.filename, asset.fontHeight)].reset(
+                new Font(graphics, asset.filename, asset.fontHeight));
+            break;
+        }
+        // Free memory as we go.
+        asset.data.reset();
+        Bitmap().swap(asset.bitmap);
+        ++loaded;
+    }
+
+    template<typename Map>
+    typename Map::mapped_type::element_type& find(const Map& map,
+        const typename Map::key_type& key) const
+    {
+        typename Map::const_iterator iter = map.find(key);
+        if (iter == map.end())
+            throw std::logic_error("Asset has not been loaded yet");
+        return *iter->second;
+    }
+};
+
+Gosu::AssetManifest::AssetManifest(Graphics& graphics, unsigned threads)
+: pimpl(new Impl(graphics, threads))
+{
+}
+
+Gosu::AssetManifest::~AssetManifest()
+{
+}
+
+void Gosu::AssetManifest::addImage(const std::wstring& filename, bool tileable)
+{
+    pimpl->add(IMAGE, filename, 0, 0, tileable);
+}
+
+void Gosu::AssetManifest::addTiles(const std::wstring& filename, int tileWidth,
+    int tileHeight, bool tileable)
+{
+    pimpl->add(TILES, filename, tileWidth, tileHeight, tileable);
+}
+
+void Gosu::AssetManifest::addSample(const std::wstring& filename)
+{
+    pimpl->add(SAMPLE, filename);
+}
+
+void Gosu::AssetManifest::addSong(const std::wstring& filename)
+{
+    pimpl->add(SONG, filename);
+}
+
+void Gosu::AssetManifest::addFont(const std::wstring& fontName, unsigned fontHeight)
+{
+    pimpl->add(FONT, fontName, 0, 0, false, fontHeight);
+}
+
+void Gosu::AssetManifest::start()
+{
+    if (pimpl->started)
+        return;
+    pimpl->started = true;
+    for (std::size_t i = 0; i < pimpl->added.size(); ++i)
+    {
+        shared_ptr<Asset> asset = pimpl->added[i];
+        // Fonts are not loaded from files that Gosu could read itself.
+        if (asset->kind == FONT)
+            pimpl->uploads.push_back(asset);
+        else
+            pimpl->io.enqueue(bind(readAssetJob, asset),
+                bind(&Impl::read, pimpl.get(), asset));
+    }
+}
+
+void Gosu::AssetManifest::update()
+{
+    pimpl->io.deliver();
+    pimpl->decoders.deliver();
+
+    std::tr1::uint64_t start = microseconds();
+    std::tr1::uint64_t budget = pimpl->uploadBudget * 1000ul;
+    bool first = true;
+    while (!pimpl->uploads.empty() && (first || microseconds() - start < budget))
+    {
+        // Taken out first, so that an asset that fails is not tried again.
+        shared_ptr<Asset> asset = pimpl->uploads.front();
+        pimpl->uploads.pop_front();
+        pimpl->upload(*asset);
+        first = false;
+    }
+}
+
+void Gosu::AssetManifest::finish()
+{
+    start();
+    while (!done())
+    {
+        update();
+        if (pimpl->uploads.empty() && !done())
+            sleep(1);
+    }
+}
+
+unsigned Gosu::AssetManifest::uploadBudget() const
+{
+    return pimpl->uploadBudget;
+}
+
+void Gosu::AssetManifest::setUploadBudget(unsigned milliseconds)
+{
+    pimpl->uploadBudget = milliseconds;
+}
+
+std::size_t Gosu::AssetManifest::total() const
+{
+    return pimpl->added.size();
+}
+
+std::size_t Gosu::AssetManifest::loaded() const
+{
+    return pimpl->loaded;
+}
+
+double Gosu::AssetManifest::progress() const
+{
+    return total() == 0 ? 1.0 : double(loaded()) / total();
+}
+
+bool Gosu::AssetManifest::done() const
+{
+    return loaded() == total();
+}
+
+Gosu::Image& Gosu::AssetManifest::image(const std::wstring& filename) const
+{
+    return pimpl->find(pimpl->images, filename);
+}
+
+const std::vector<Gosu::Image>& Gosu::AssetManifest::tiles(const std::wstring& filename) const
+{
+    std::map<std::wstring, std::vector<Image> >::const_iterator iter =
+        pimpl->tiles.find(filename);
+    if (iter == pimpl->tiles.end())
+        throw std::logic_error("Asset has not been loaded yet");
+    return iter->second;
+}
+
+Gosu::Sample& Gosu::AssetManifest::sample(const std::wstring& filename) const
+{
+    return pimpl->find(pimpl->samples, filename);
+}
+
+Gosu::Song& Gosu::AssetManifest::song(const std::wstring& filename) const
+{
+    return pimpl->find(pimpl->songs, filename);
 }
 
-Gosu::AsyncResult<Gosu::Image>
-    Gosu::asyncNewImage(Window& window, const std::wstring& filename)
+Gosu::Font& Gosu::AssetManifest::font(const std::wstring& fontName,
+    unsigned fontHeight) const
 {
-	shared_ptr<try_mutex> mutex(new try_mutex);
-	shared_ptr<auto_ptr<Image> > image(new std::auto_ptr<Image>);
-	thread thread(bind(asyncNewImage_Impl,
-						ref(window),
-                        filename,
-						window.createSharedContext(),
-						mutex,
-                        image));
-	return AsyncResult<Image>(mutex, image);
+    return pimpl->find(pimpl->fonts, std::make_pair(fontName, fontHeight));
 }
@@ -1,4 +1,7 @@
+#include <Gosu/Audio.hpp>
 #include <Gosu/Platform.hpp>
+#include <Gosu/TR1.hpp>
+#include <Gosu/Trace.hpp>
 #ifdef GOSU_IS_MAC
 #include <OpenAL/al.h>
 #include <OpenAL/alc.h>
@@ -10,6 +13,8 @@
 #include <cstdlib>
 #include <algorithm>
 #include <memory>
+#include <stdexcept>
+#include <vector>
 
 namespace Gosu
 {
@@ -27,9 +32,62 @@ namespace Gosu
 	#else
         enum { NUM_SOURCES = 255 };
 	#endif
-        static ALuint alSources[NUM_SOURCES];
+        // Sources are only generated when all existing ones are busy. The
+        // first one is reserved for songs.
+        static std::vector<ALuint> alSources;
         static ALuint currentToken;
-        static ALuint currentTokens[NUM_SOURCES];
+        static std::vector<ALuint> currentTokens;
+        static unsigned maxChannels;
+        // Channels that had no token, or had finished playing, at the last
+        // call to updateChannels, minus those reserved since.
+        static std::vector<int> freeChannels;
+        // What was given to reserveChannel, kept for stealing channels.
+        static std::vector<int> priorities;
+        static std::vector<double> volumes;
+        static StealingPolicy stealingPolicy;
+        
+        // AL_SOFT_deferred_updates, where the driver has it. Otherwise,
+        // suspending the context has the same purpose, but many drivers
+        // ignore it.
+        typedef void (AL_APIENTRY *UpdatesFunction)();
+        static UpdatesFunction deferUpdates, processUpdates;
+        static bool batching, batchOpen;
+        
+        // Context attributes that the device is opened with, 0 for those
+        // left to the driver.
+        static ALCint frequency, refreshRate, monoSources, stereoSources;
+        
+        // ALC_SOFT_device_clock, where the driver has it, tells how long it
+        // takes for mixed samples to be heard. Declared here since older
+        // headers lack it.
+        enum { ALC_DEVICE_LATENCY_SOFT = 0x1601 };
+        typedef void (ALC_APIENTRY *GetInteger64Function)(ALCdevice*, ALCenum, ALCsizei,
+            std::tr1::int64_t*);
+        
+        // Returns false if the driver cannot provide any more sources.
+        static bool addSource()
+        {
+            ALuint source;
+            alGetError();
+            alGenSources(1, &source);
+            if (alGetError() != AL_NO_ERROR)
+                return false;
+            alSources.push_back(source);
+            currentTokens.push_back(static_cast<ALuint>(NO_TOKEN));
+            priorities.push_back(0);
+            volumes.push_back(0);
+            if (alSources.size() > 1)
+                freeChannels.push_back(alSources.size() - 1);
+            return true;
+        }
+        
+        // Detaches all buffers from a stopped source, so that compressed
+        // samples can delete the ones they queued on it.
+        static void release(int channel)
+        {
+            alSourcei(alSources[channel], AL_BUFFER, 0);
+            currentTokens[channel] = static_cast<ALuint>(NO_TOKEN);
+        }
         
     public:
         enum { NO_TOKEN = -1, NO_SOURCE = -1, NO_FREE_CHANNEL = -1 };
@@ -39,41 +97,223 @@ namespace Gosu
             return alDevice;
         }
         
+        static void configureDevice(unsigned frequency, unsigned refreshRate,
+            unsigned monoSources, unsigned stereoSources)
+        {
+            if (alDevice)
+                throw std::logic_error("The audio device must be configured before it is opened");
+            ALChannelManagement::frequency = frequency;
+            ALChannelManagement::refreshRate = refreshRate;
+            ALChannelManagement::monoSources = monoSources;
+            ALChannelManagement::stereoSources = stereoSources;
+        }
+        
+        // What the device was opened with, which may differ from what was
+        // asked for. 0 while it is not open.
+        static unsigned deviceAttribute(ALCenum name)
+        {
+            ALCint value = 0;
+            if (alDevice)
+                alcGetIntegerv(alDevice, name, 1, &value);
+            return value > 0 ? value : 0;
+        }
+        
+        // Worst case from changing a source to hearing it: up to one mixing
+        // period, plus the device's own latency if the driver reports it.
+        static double latency()
+        {
+            ALCint refresh = deviceAttribute(ALC_REFRESH);
+            double result = refresh > 0 ? 1.0 / refresh : 0;
+            if (alDevice && alcIsExtensionPresent(alDevice, "ALC_SOFT_device_clock"))
+            {
+                GetInteger64Function getInteger64 = reinterpret_cast<GetInteger64Function>(
+                    alcGetProcAddress(alDevice, "alcGetInteger64vSOFT"));
+                std::tr1::int64_t nanoseconds = 0;
+                if (getInteger64)
+                    getInteger64(alDevice, ALC_DEVICE_LATENCY_SOFT, 1, &nanoseconds);
+                if (nanoseconds > 0)
+                    result += nanoseconds / 1e9;
+            }
+            return result;
+        }
+        
+        // Channels for samples, not counting the one for songs.
+        static void setMaxChannels(unsigned channels)
+        {
+            maxChannels = channels;
+        }
+        
+        static void setStealingPolicy(StealingPolicy policy)
+        {
+            stealingPolicy = policy;
+        }
+        
+        static void setBatching(bool enabled)
+        {
+            if (!enabled)
+                endBatch();
+            batching = enabled;
+        }
+        
+        // Holds back the changes made to sounds, until endBatch applies
+        // them all at once. Does nothing unless batching is enabled.
+        static void beginBatch()
+        {
+            if (!batching || batchOpen)
+                return;
+            if (deferUpdates)
+                deferUpdates();
+            else
+                alcSuspendContext(alContext);
+            batchOpen = true;
+        }
+        
+        static void endBatch()
+        {
+            if (!batchOpen)
+                return;
+            if (processUpdates)
+                processUpdates();
+            else
+                alcProcessContext(alContext);
+            batchOpen = false;
+        }
+        
+        static unsigned allocatedChannels()
+        {
+            return alSources.empty() ? 0 : alSources.size() - 1;
+        }
+        
+        // Channels that were busy at the last update, or reserved since.
+        static unsigned activeChannels()
+        {
+            unsigned active = 0;
+            for (std::size_t i = 1; i < currentTokens.size(); ++i)
+                if (currentTokens[i] != NO_TOKEN)
+                    ++active;
+            return active;
+        }
+        
         ALChannelManagement()
         {
+            GOSU_TRACE_STARTUP("OpenAL setup");
             // Open preferred device
             alDevice = alcOpenDevice(0);
-            alContext = alcCreateContext(alDevice, 0);
+            std::vector<ALCint> attributes;
+            ALCint names[4] = { ALC_FREQUENCY, ALC_REFRESH, ALC_MONO_SOURCES, ALC_STEREO_SOURCES };
+            ALCint values[4] = { frequency, refreshRate, monoSources, stereoSources };
+            for (int i = 0; i < 4; ++i)
+                if (values[i] > 0)
+                    attributes.push_back(names[i]), attributes.push_back(values[i]);
+            attributes.push_back(0);
+            alContext = alcCreateContext(alDevice, &attributes[0]);
             alcMakeContextCurrent(alContext);
-            alGenSources(NUM_SOURCES, alSources);
-            std::fill(currentTokens, currentTokens + NUM_SOURCES,
-                static_cast<ALuint>(NO_TOKEN));
+            #ifndef GOSU_IS_MAC
+            if (alIsExtensionPresent("AL_SOFT_deferred_updates"))
+            {
+                deferUpdates = reinterpret_cast<UpdatesFunction>(
+                    alGetProcAddress("alDeferUpdatesSOFT"));
+                processUpdates = reinterpret_cast<UpdatesFunction>(
+                    alGetProcAddress("alProcessUpdatesSOFT"));
+                if (!deferUpdates || !processUpdates)
+                    deferUpdates = processUpdates = 0;
+            }
+            #endif
+            addSource();
         }
         
         ~ALChannelManagement()
         {
-            alDeleteSources(NUM_SOURCES, alSources);
+            endBatch();
+            deferUpdates = processUpdates = 0;
+            if (!alSources.empty())
+                alDeleteSources(alSources.size(), &alSources[0]);
+            alSources.clear();
+            currentTokens.clear();
+            freeChannels.clear();
+            priorities.clear();
+            volumes.clear();
             alcMakeContextCurrent(0);
             alcDestroyContext(alContext);
             alcCloseDevice(alDevice);
+            alContext = 0;
+            alDevice = 0;
+        }
+        
+        // Finds the channels whose sounds have finished in one pass, so that
+        // reserving a channel does not have to ask the driver. Called once
+        // per tick by Song::update. Tokens of finished channels are
+        // invalidated, which is not noticeable since they cannot be resumed.
+        void updateChannels()
+        {
+            freeChannels.clear();
+            int usable = std::min<int>(alSources.size() - 1, maxChannels);
+            for (int i = usable; i >= 1; --i)
+            {
+                if (currentTokens[i] != NO_TOKEN)
+                {
+                    ALint state;
+                    alGetSourcei(alSources[i], AL_SOURCE_STATE, &state);
+                    if (state == AL_PLAYING || state == AL_PAUSED)
+                        continue;
+                    release(i);
+                }
+                freeChannels.push_back(i);
+            }
         }
         
-        std::pair<int, int> reserveChannel()
+        // Returns the busy channel that the policy would give up for a
+        // sound of the given priority, or NO_FREE_CHANNEL. Tokens grow with
+        // each reservation, so the smallest one belongs to the oldest sound.
+        int channelToSteal(int priority) const
         {
-            int i;
-            for (i = 1; i <= NUM_SOURCES; ++i)
+            int victim = NO_FREE_CHANNEL;
+            int usable = std::min<int>(alSources.size() - 1, maxChannels);
+            for (int i = 1; stealingPolicy != spNone && i <= usable; ++i)
             {
-                if (i == NUM_SOURCES)
+                if (currentTokens[i] == NO_TOKEN || priorities[i] > priority)
+                    continue;
+                if (victim == NO_FREE_CHANNEL)
+                    victim = i;
+                else if (stealingPolicy == spQuietest && volumes[i] != volumes[victim])
+                {
+                    if (volumes[i] < volumes[victim])
+                        victim = i;
+                }
+                else if (stealingPolicy == spLowestPriority && priorities[i] != priorities[victim])
+                {
+                    if (priorities[i] < priorities[victim])
+                        victim = i;
+                }
+                else if (currentTokens[i] < currentTokens[victim])
+                    victim = i;
+            }
+            return victim;
+        }
+        
+        std::pair<int, int> reserveChannel(int priority = 0, double volume = 1)
+        {
+            // New sources are only added when no channel was free at the last
+            // update. If none can be added, something may have finished since.
+            if (freeChannels.empty() && (alSources.size() > maxChannels || !addSource()))
+                updateChannels();
+            
+            if (freeChannels.empty())
+            {
+                int victim = channelToSteal(priority);
+                if (victim == NO_FREE_CHANNEL)
                     return std::make_pair<int, int>(NO_FREE_CHANNEL, NO_TOKEN);
-                if (currentTokens[i] == NO_TOKEN)
-                    break;
-                ALint state;
-                alGetSourcei(alSources[i], AL_SOURCE_STATE, &state);
-                if (state != AL_PLAYING && state != AL_PAUSED)
-                    break;
+                alSourceStop(alSources[victim]);
+                release(victim);
+                freeChannels.push_back(victim);
             }
+            
+            int i = freeChannels.back();
+            freeChannels.pop_back();
             ++currentToken;
             currentTokens[i] = currentToken;
+            priorities[i] = priority;
+            volumes[i] = volume;
             return std::make_pair<int, int>(i, currentToken);
         }
         
@@ -84,21 +324,65 @@ namespace Gosu
             return NO_SOURCE;
         }
         
+        // Stops the sound for good; its token becomes invalid right away.
+        void stopChannel(int channel, int token)
+        {
+            if (channel == NO_FREE_CHANNEL || currentTokens[channel] != token)
+                return;
+            alSourceStop(alSources[channel]);
+            release(channel);
+        }
+        
+        void setVolume(int channel, int token, double volume)
+        {
+            if (channel != NO_FREE_CHANNEL && currentTokens[channel] == token)
+                volumes[channel] = volume;
+        }
+        
+        // The volume that a sound was played at or last changed to.
+        double volume(int channel, int token) const
+        {
+            if (channel != NO_FREE_CHANNEL && currentTokens[channel] == token)
+                return volumes[channel];
+            return 0;
+        }
+        
         int sourceForSongs() const
         {
-            return alSources[0];
+            return alSources.empty() ? NO_SOURCE : alSources[0];
         }
     };
     ALCdevice* ALChannelManagement::alDevice = 0;
     ALCcontext* ALChannelManagement::alContext = 0;
-    ALuint ALChannelManagement::alSources[NUM_SOURCES];
+    std::vector<ALuint> ALChannelManagement::alSources;
     ALuint ALChannelManagement::currentToken = 0;
-    ALuint ALChannelManagement::currentTokens[NUM_SOURCES];
+    std::vector<ALuint> ALChannelManagement::currentTokens;
+    unsigned ALChannelManagement::maxChannels = NUM_SOURCES - 1;
+    std::vector<int> ALChannelManagement::freeChannels;
+    std::vector<int> ALChannelManagement::priorities;
+    std::vector<double> ALChannelManagement::volumes;
+    StealingPolicy ALChannelManagement::stealingPolicy = spNone;
+    ALChannelManagement::UpdatesFunction ALChannelManagement::deferUpdates = 0;
+    ALChannelManagement::UpdatesFunction ALChannelManagement::processUpdates = 0;
+    bool ALChannelManagement::batching = false;
+    bool ALChannelManagement::batchOpen = false;
+    ALCint ALChannelManagement::frequency = 0;
+    ALCint ALChannelManagement::refreshRate = 0;
+    ALCint ALChannelManagement::monoSources = 0;
+    ALCint ALChannelManagement::stereoSources = 0;
 
     std::auto_ptr<ALChannelManagement> alChannelManagement;
     
+    // Waits for the thread that streams songs to finish.
+    void stopSongStreaming();
+    
+    // Stops all voices of compressed samples and frees their buffers.
+    void stopCompressedSamples();
+    
     void releaseAllOpenALResources()
     {
+        stopSongStreaming();
+        stopCompressedSamples();
         alChannelManagement.reset();
     }
 }
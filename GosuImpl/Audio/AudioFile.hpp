@@ -1,7 +1,11 @@
 #ifndef GOSUIMPL_AUDIO_AUDIOFILE_HPP
 #define GOSUIMPL_AUDIO_AUDIOFILE_HPP
 
+#include <cstring>
+#include <memory>
+#include <stdexcept>
 #include <vector>
+#include <Gosu/IO.hpp>
 #include <Gosu/Platform.hpp>
 #ifdef GOSU_IS_MAC
 #include <OpenAL/al.h>
@@ -26,28 +30,108 @@ namespace Gosu
         virtual std::size_t readData(void* dest, std::size_t length) = 0;
         virtual void rewind() = 0;
         
+        // Size of all decoded data in bytes, if the decoder knows it in
+        // advance, or 0.
+        virtual std::size_t decodedSize() { return 0; }
+        
         const std::vector<char>& decodedData()
         {
-            static const unsigned INCREMENT = 512*1024;
+            static const std::size_t INCREMENT = 512*1024;
             
             if (!decodedData_.empty())
                 return decodedData_;
             
+            // With a known size, one read fills the whole buffer. Reading
+            // on in increments only happens if the decoder was wrong.
+            std::size_t chunk = decodedSize();
+            if (chunk == 0)
+                chunk = INCREMENT;
+            
             for (;;)
             {
-                decodedData_.resize(decodedData_.size() + INCREMENT);
-                int readBytes = readData(&decodedData_[decodedData_.size() - INCREMENT],
-                                    INCREMENT);
-                if (readBytes < INCREMENT)
+                std::size_t offset = decodedData_.size();
+                decodedData_.resize(offset + chunk);
+                std::size_t readBytes = readData(&decodedData_[offset], chunk);
+                if (readBytes < chunk)
                 {
-                    decodedData_.resize(decodedData_.size() - INCREMENT + readBytes);
+                    decodedData_.resize(offset + readBytes);
                     break;
                 }
+                chunk = INCREMENT;
             }
             
             return decodedData_;
         }
+        
+        // Frees what decodedData() returned, once it has been uploaded.
+        void releaseDecodedData()
+        {
+            std::vector<char>().swap(decodedData_);
+        }
+    };
+    
+    // Memory that belongs to someone else as a read-only resource, so that
+    // decoders can read a view of a mapped file or buffer in place.
+    class BorrowedMemory : public Resource
+    {
+        const char* data_;
+        std::size_t size_;
+        
+    public:
+        BorrowedMemory(const void* data, std::size_t size)
+        : data_(static_cast<const char*>(data)), size_(size)
+        {
+        }
+        
+        std::size_t size() const
+        {
+            return size_;
+        }
+        
+        void resize(std::size_t)
+        {
+            throw std::logic_error("Cannot resize borrowed memory");
+        }
+        
+        void read(std::size_t offset, std::size_t length, void* destBuffer) const
+        {
+            if (length)
+                std::memcpy(destBuffer, data_ + offset, length);
+        }
+        
+        void write(std::size_t, std::size_t, const void*)
+        {
+            throw std::logic_error("Cannot write to borrowed memory");
+        }
+        
+        const void* view(std::size_t offset, std::size_t length) const
+        {
+            if (length == 0 || offset + length > size_)
+                return 0;
+            return data_ + offset;
+        }
     };
+    
+    // The rest of the reader's resource, copied, for decoders that may
+    // outlive it.
+    inline Resource* copyRest(Reader reader)
+    {
+        std::auto_ptr<Buffer> buffer(new Buffer);
+        buffer->resize(reader.resource().size() - reader.position());
+        reader.read(buffer->data(), buffer->size());
+        return buffer.release();
+    }
+    
+    // The rest of the reader's resource, read in place if it offers a view
+    // and copied otherwise. Only for decoders that are done with it before
+    // the reader's resource goes away.
+    inline Resource* borrowRest(Reader reader)
+    {
+        std::size_t length = reader.resource().size() - reader.position();
+        if (const void* view = reader.view(length))
+            return new BorrowedMemory(view, length);
+        return copyRest(reader);
+    }
 }
 
 #endif
@@ -1,13 +1,21 @@
 #include <GosuImpl/Audio/ALChannelManagement.hpp>
+#include <GosuImpl/DecodedCache.hpp>
+#include <GosuImpl/MemoryStatistics.hpp>
 #include <GosuImpl/Audio/OggFile.hpp>
+#include <GosuImpl/ResourceCache.hpp>
+#include <GosuImpl/Threading.hpp>
 
+#include <Gosu/Archive.hpp>
 #include <Gosu/Audio.hpp>
 #include <Gosu/Math.hpp>
 #include <Gosu/IO.hpp>
 #include <Gosu/Utility.hpp>
 #include <Gosu/Platform.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
 
 #include <cassert>
+#include <cmath>
 #include <cstdlib>
 #include <algorithm>
 #include <memory>
@@ -53,6 +61,16 @@ namespace
     
     Song* curSong = 0;
     bool curSongLooping;
+    
+    #ifdef GOSU_IS_IPHONE
+    std::size_t streamBufferSize = 4096 * 4;
+    #else
+    std::size_t streamBufferSize = 4096 * 8;
+    #endif
+    unsigned streamBufferCount = 4;
+    unsigned long streamUnderruns = 0;
+    // Empty if samples are not cached on disk.
+    std::wstring decodedCacheDirectory;
 }
 
 // TODO: What is the NSAutoreleasePool good for?
@@ -60,14 +78,25 @@ namespace
 #include <GosuImpl/MacUtility.hpp>
     #define CONSTRUCTOR_COMMON \
         ObjRef<NSAutoreleasePool> pool([[NSAutoreleasePool alloc] init]); \
-        if (!alChannelManagement.get()) \
-            alChannelManagement.reset(new ALChannelManagement)
+        initOpenAL()
 #else
     #define CONSTRUCTOR_COMMON \
-        if (!alChannelManagement.get()) \
-            alChannelManagement.reset(new ALChannelManagement)
+        initOpenAL()
 #endif    
 
+namespace
+{
+    // Samples may be loaded on background threads (see Async.hpp).
+    Gosu::Mutex alInitMutex;
+    
+    void initOpenAL()
+    {
+        Gosu::Lock lock(alInitMutex);
+        if (!alChannelManagement.get())
+            alChannelManagement.reset(new ALChannelManagement);
+    }
+}
+
 Gosu::SampleInstance::SampleInstance(int handle, int extra)
 : handle(handle), extra(extra)
 {
@@ -114,10 +143,7 @@ void Gosu::SampleInstance::resume()
 
 void Gosu::SampleInstance::stop()
 {
-    ALuint source = alChannelManagement->sourceIfStillPlaying(handle, extra);
-    if (source == ALChannelManagement::NO_SOURCE)
-        return;
-    alSourceStop(source);
+    alChannelManagement->stopChannel(handle, extra);
 }
 
 void Gosu::SampleInstance::changeVolume(double volume)
@@ -126,6 +152,7 @@ void Gosu::SampleInstance::changeVolume(double volume)
     if (source == ALChannelManagement::NO_SOURCE)
         return;
     alSourcef(source, AL_GAIN, volume);
+    alChannelManagement->setVolume(handle, extra, volume);
 }
 
 void Gosu::SampleInstance::changePan(double pan)
@@ -145,86 +172,424 @@ void Gosu::SampleInstance::changeSpeed(double speed)
     alSourcef(source, AL_PITCH, speed);
 }
 
+namespace
+{
+    // Decodes the next piece of a file into an OpenAL buffer. Returns false
+    // at the end of the file.
+    bool streamToBuffer(AudioFile& file, std::vector<char>& audioData, ALuint buffer)
+    {
+        std::size_t readBytes = file.readData(&audioData[0], audioData.size());
+        if (readBytes > 0)
+            alBufferData(buffer, file.format(), &audioData[0], readBytes, file.sampleRate());
+        return readBytes > 0;
+    }
+    
+    bool convertToDeviceRate = false, convertToMono = false;
+    
+    // Mixes 16-bit audio down to mono and resamples it with linear
+    // interpolation, as configured by Sample::setLoadConversion, so that
+    // OpenAL does not have to do it for every voice that plays it.
+    // Returns false if there was nothing to do.
+    bool convert(ALenum& format, ALuint& sampleRate, const std::vector<char>& in,
+        std::vector<char>& out)
+    {
+        unsigned channels = format == AL_FORMAT_STEREO16 ? 2 : 1;
+        unsigned outChannels = convertToMono ? 1 : channels;
+        ALCint deviceRate = 0;
+        if (convertToDeviceRate)
+            alcGetIntegerv(ALChannelManagement::device(), ALC_FREQUENCY, 1, &deviceRate);
+        ALuint outRate = deviceRate > 0 ? deviceRate : sampleRate;
+        if (outChannels == channels && outRate == sampleRate)
+            return false;
+        
+        const short* samples = reinterpret_cast<const short*>(in.empty() ? 0 : &in[0]);
+        std::size_t frames = in.size() / (2 * channels);
+        std::size_t outFrames = static_cast<std::size_t>(
+            static_cast<double>(frames) * outRate / sampleRate);
+        out.resize(outFrames * outChannels * 2);
+        short* outSamples = reinterpret_cast<short*>(out.empty() ? 0 : &out[0]);
+        
+        double step = static_cast<double>(sampleRate) / outRate;
+        for (std::size_t i = 0; i < outFrames; ++i)
+        {
+            double position = i * step;
+            std::size_t frame = static_cast<std::size_t>(position);
+            std::size_t next = std::min(frame + 1, frames - 1);
+            double weight = position - frame;
+            double mono = 0;
+            for (unsigned c = 0; c < channels; ++c)
+            {
+                double value = samples[frame * channels + c] * (1 - weight) +
+                    samples[next * channels + c] * weight;
+                if (outChannels == channels)
+                    outSamples[i * channels + c] = static_cast<short>(value);
+                mono += value;
+            }
+            if (outChannels != channels)
+                outSamples[i] = static_cast<short>(mono / channels);
+        }
+        
+        format = outChannels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+        sampleRate = outRate;
+        return true;
+    }
+    
+    // Keeps the Ogg data of a compressed sample, shared by the sample and
+    // all of its voices.
+    std::tr1::shared_ptr<const Gosu::Resource> compressedCopy(Gosu::Reader reader)
+    {
+        std::auto_ptr<Gosu::Buffer> buffer(new Gosu::Buffer);
+        buffer->resize(reader.resource().size() - reader.position());
+        reader.read(buffer->data(), buffer->size());
+        return std::tr1::shared_ptr<const Gosu::Resource>(buffer);
+    }
+    
+    // One playing instance of a compressed sample. It decodes into a small
+    // ring of buffers like a song does, but on the main thread: Song::update
+    // refills the buffers of all voices once per tick.
+    class CompressedVoice
+    {
+        CompressedVoice(const CompressedVoice&);
+        CompressedVoice& operator=(const CompressedVoice&);
+        
+        // About 370 ms of 44.1 kHz stereo in all, so that a few late ticks
+        // do not starve the voice.
+        enum { BUFFER_COUNT = 4, BUFFER_SIZE = 4096 * 4 };
+        
+        OggFile file;
+        int channel, token;
+        bool looping;
+        ALuint buffers[BUFFER_COUNT];
+        MemoryCount memory;
+        
+        // Only one voice decodes at a time.
+        static std::vector<char>& audioData()
+        {
+            static std::vector<char> audioData(BUFFER_SIZE);
+            return audioData;
+        }
+        
+        bool fill(ALuint buffer)
+        {
+            if (streamToBuffer(file, audioData(), buffer))
+                return true;
+            if (!looping)
+                return false;
+            file.rewind();
+            return streamToBuffer(file, audioData(), buffer);
+        }
+        
+    public:
+        CompressedVoice(const std::tr1::shared_ptr<const Gosu::Resource>& data,
+            int channel, int token, bool looping)
+        : file(data), channel(channel), token(token), looping(looping),
+          memory(mcSamples, BUFFER_COUNT * BUFFER_SIZE)
+        {
+            alGenBuffers(BUFFER_COUNT, buffers);
+        }
+        
+        ~CompressedVoice()
+        {
+            if (alChannelManagement.get())
+                alDeleteBuffers(BUFFER_COUNT, buffers);
+        }
+        
+        // Queues the first buffers on the voice's source before it plays.
+        void start(ALuint source)
+        {
+            alSourcei(source, AL_BUFFER, 0);
+            int filled = 0;
+            while (filled < BUFFER_COUNT && fill(buffers[filled]))
+                ++filled;
+            if (filled > 0)
+                alSourceQueueBuffers(source, filled, buffers);
+        }
+        
+        void stop()
+        {
+            alChannelManagement->stopChannel(channel, token);
+        }
+        
+        // Returns false once the voice has finished or lost its channel.
+        // Either way, ALChannelManagement has detached its buffers.
+        bool update()
+        {
+            int source = alChannelManagement->sourceIfStillPlaying(channel, token);
+            if (source == ALChannelManagement::NO_SOURCE)
+                return false;
+            
+            ALuint buffer;
+            ALint processed;
+            alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+            for (int i = 0; i < processed; ++i)
+            {
+                alSourceUnqueueBuffers(source, 1, &buffer);
+                if (fill(buffer))
+                    alSourceQueueBuffers(source, 1, &buffer);
+            }
+            
+            ALint state, queued;
+            alGetSourcei(source, AL_SOURCE_STATE, &state);
+            alGetSourcei(source, AL_BUFFERS_QUEUED, &queued);
+            if (state == AL_STOPPED && queued > 0)
+                // Starved, but there is more to play.
+                alSourcePlay(source);
+            return true;
+        }
+    };
+    std::vector<std::tr1::shared_ptr<CompressedVoice> > compressedVoices;
+    
+    void updateCompressedVoices()
+    {
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < compressedVoices.size(); ++i)
+            if (compressedVoices[i]->update())
+                compressedVoices[kept++] = compressedVoices[i];
+        compressedVoices.resize(kept);
+    }
+}
+
+void Gosu::stopCompressedSamples()
+{
+    for (std::size_t i = 0; i < compressedVoices.size(); ++i)
+        compressedVoices[i]->stop();
+    compressedVoices.clear();
+}
+
 struct Gosu::Sample::SampleData
 {
-    ALuint buffer, source;
+    ALuint buffer;
+    // Only set for compressed samples, which have no buffer of their own.
+    std::tr1::shared_ptr<const Gosu::Resource> compressed;
+    MemoryCount memory;
+    
+    // See Sample::setMaxInstances and setMinRetriggerInterval.
+    unsigned maxInstances;
+    InstanceLimitPolicy limitPolicy;
+    unsigned minRetriggerInterval;
+    // Channels and tokens of the instances that may still be playing,
+    // oldest first. Only kept while there is a limit or an interval.
+    std::vector<std::pair<int, int> > instances;
+    unsigned long lastPlay;
 
-    SampleData(AudioFile& audioFile)
+    SampleData(const std::tr1::shared_ptr<const Gosu::Resource>& compressed)
+    : buffer(0), compressed(compressed), memory(mcSamples, compressed->size())
     {
-        alGenBuffers(1, &buffer);
-        alBufferData(buffer,
-                     audioFile.format(),
-                     &audioFile.decodedData().front(),
-                     audioFile.decodedData().size(),
-                     audioFile.sampleRate());
+        initLimits();
+        // Fails here rather than when playing if the data is broken.
+        OggFile check(compressed);
+    }
+
+    // Stores the decoded data in the cache, if one is given.
+    SampleData(AudioFile& audioFile, const DecodedCache* cache = 0)
+    : memory(mcSamples)
+    {
+        initLimits();
+        const std::vector<char>& decoded = audioFile.decodedData();
+        upload(audioFile.format(), audioFile.sampleRate(), decoded);
+        if (cache)
+            cache->store(audioFile.format(), audioFile.sampleRate(),
+                decoded.empty() ? 0 : &decoded[0], decoded.size());
+        // OpenAL has made its own copy.
+        audioFile.releaseDecodedData();
+    }
+    
+    SampleData(ALenum format, ALuint sampleRate, const std::vector<char>& decoded)
+    : memory(mcSamples)
+    {
+        initLimits();
+        upload(format, sampleRate, decoded);
     }
     
     ~SampleData()
     {
         // It's hard to free things in the right order in Ruby/Gosu.
         // Make sure buffer isn't deleted after the context/device are shut down.
-        if (!alChannelManagement.get())
+        if (!alChannelManagement.get() || !buffer)
             return;
             
         alDeleteBuffers(1, &buffer);
     }
+    
+    // Forgets instances that have been stopped or have finished.
+    void pruneInstances()
+    {
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < instances.size(); ++i)
+        {
+            ALuint source = alChannelManagement->sourceIfStillPlaying(
+                instances[i].first, instances[i].second);
+            if (source == ALChannelManagement::NO_SOURCE)
+                continue;
+            ALint state;
+            alGetSourcei(source, AL_SOURCE_STATE, &state);
+            if (state == AL_PLAYING || state == AL_PAUSED)
+                instances[kept++] = instances[i];
+        }
+        instances.resize(kept);
+    }
+    
+    // Makes the newest instance as loud as it and a new one would be
+    // together, and returns it instead of playing the new one. Their power
+    // adds up, not their amplitude, since they are not in phase.
+    Gosu::SampleInstance merge(double volume)
+    {
+        std::pair<int, int> newest = instances.back();
+        double old = alChannelManagement->volume(newest.first, newest.second);
+        Gosu::SampleInstance instance(newest.first, newest.second);
+        instance.changeVolume(std::min(std::sqrt(old * old + volume * volume), 1.0));
+        return instance;
+    }
 
 private:
     SampleData(const SampleData&);
     SampleData& operator=(const SampleData&);
+    
+    void initLimits()
+    {
+        maxInstances = 0;
+        limitPolicy = ilStealOldest;
+        minRetriggerInterval = 0;
+        lastPlay = 0;
+    }
+    
+    void upload(ALenum format, ALuint sampleRate, const std::vector<char>& decoded)
+    {
+        std::vector<char> converted;
+        const std::vector<char>& data =
+            convert(format, sampleRate, decoded, converted) ? converted : decoded;
+        alGenBuffers(1, &buffer);
+        alBufferData(buffer, format, data.empty() ? 0 : &data.front(),
+                     data.size(), sampleRate);
+        memory.set(data.size());
+    }
 };
 
-Gosu::Sample::Sample(const std::wstring& filename)
+Gosu::Sample::Sample(const std::wstring& filename, bool compressed)
 {
     CONSTRUCTOR_COMMON;
 
-    if (isOggFile(filename))
+    ResourceCache::Key key(filename, 0, compressed);
+    std::tr1::shared_ptr<void> cached = sampleCache().find(key);
+    if (cached)
     {
-        Gosu::Buffer buffer;
-        Gosu::loadFile(buffer, filename);
-        OggFile oggFile(buffer.frontReader());
-        data.reset(new SampleData(oggFile));
+        data = std::tr1::static_pointer_cast<SampleData>(cached);
+        return;
+    }
+    
+    if (const Resource* packed = findInMountedArchives(filename))
+    {
+        data = Sample(packed->frontReader(), compressed).data;
+        sampleCache().insert(key, data);
+        return;
+    }
+    
+    DecodedCache decodedCache(DecodedCache::SAMPLES,
+        compressed ? std::wstring() : decodedCacheDirectory, filename);
+    std::tr1::uint32_t format, sampleRate;
+    std::vector<char> decoded;
+    
+    if (decodedCache.load(format, sampleRate, decoded))
+        data.reset(new SampleData(format, sampleRate, decoded));
+    else if (isOggFile(filename) && compressed)
+    {
+        // A mapped file can be decoded from directly; there is no need to
+        // keep a second copy of it in memory.
+        std::tr1::shared_ptr<const Gosu::File> file(new Gosu::File(filename));
+        if (file->view(0, file->size()))
+            data.reset(new SampleData(file));
+        else
+            data.reset(new SampleData(compressedCopy(file->frontReader())));
+    }
+    else if (isOggFile(filename))
+    {
+        OggFile oggFile(filename);
+        data.reset(new SampleData(oggFile, &decodedCache));
     }
     else
     {
         WAVE_FILE audioFile(filename);
-        data.reset(new SampleData(audioFile));
+        data.reset(new SampleData(audioFile, &decodedCache));
     }
+    sampleCache().insert(key, data);
 }
 
-Gosu::Sample::Sample(Reader reader)
+Gosu::Sample::Sample(Reader reader, bool compressed)
 {
     CONSTRUCTOR_COMMON;
 
-    if (isOggFile(reader))
+    if (isOggFile(reader) && compressed)
+        data.reset(new SampleData(compressedCopy(reader)));
+    else if (isOggFile(reader))
     {
-        OggFile oggFile(reader);
+        // Decoded right away, so the data can be read in place.
+        OggFile oggFile(reader, true);
         data.reset(new SampleData(oggFile));
     }
     else
     {
-        WAVE_FILE audioFile(reader);
+        WAVE_FILE audioFile(reader, true);
         data.reset(new SampleData(audioFile));
     }
 }
 
 Gosu::SampleInstance Gosu::Sample::play(double volume, double speed,
-    bool looping) const
+    bool looping, int priority) const
 {
-    return playPan(0, volume, speed, looping);
+    return playPan(0, volume, speed, looping, priority);
 }
 
 Gosu::SampleInstance Gosu::Sample::playPan(double pan, double volume,
-    double speed, bool looping) const
+    double speed, bool looping, int priority) const
 {
-    std::pair<int, int> channelAndToken = alChannelManagement->reserveChannel();
+    bool limited = data->maxInstances != 0 || data->minRetriggerInterval != 0;
+    if (limited)
+    {
+        data->pruneInstances();
+        unsigned long now = milliseconds();
+        if (!data->instances.empty() && data->minRetriggerInterval != 0 &&
+                now - data->lastPlay < data->minRetriggerInterval)
+            return data->merge(volume);
+        if (data->maxInstances != 0 && data->instances.size() >= data->maxInstances)
+        {
+            switch (data->limitPolicy)
+            {
+            case ilStealOldest:
+                alChannelManagement->stopChannel(data->instances.front().first,
+                    data->instances.front().second);
+                data->instances.erase(data->instances.begin());
+                break;
+            case ilIgnoreNew:
+                return Gosu::SampleInstance(ALChannelManagement::NO_FREE_CHANNEL,
+                    ALChannelManagement::NO_TOKEN);
+            case ilMerge:
+                return data->merge(volume);
+            }
+        }
+        data->lastPlay = now;
+    }
+    
+    std::pair<int, int> channelAndToken =
+        alChannelManagement->reserveChannel(priority, volume);
     if (channelAndToken.first == ALChannelManagement::NO_FREE_CHANNEL)
         return Gosu::SampleInstance(channelAndToken.first, channelAndToken.second);
+    if (limited)
+        data->instances.push_back(channelAndToken);
         
     ALuint source = alChannelManagement->sourceIfStillPlaying(channelAndToken.first,
                                                                   channelAndToken.second);
     assert(source != ALChannelManagement::NO_SOURCE);
-    alSourcei(source, AL_BUFFER, data->buffer);
+    if (data->compressed)
+    {
+        std::tr1::shared_ptr<CompressedVoice> voice(new CompressedVoice(data->compressed,
+            channelAndToken.first, channelAndToken.second, looping));
+        voice->start(source);
+        compressedVoices.push_back(voice);
+        // The voice loops by rewinding its file.
+        looping = false;
+    }
+    else
+        alSourcei(source, AL_BUFFER, data->buffer);
     // TODO: This is not the old panning behavior!
     alSource3f(source, AL_POSITION, pan * 10, 0, 0);
     alSourcef(source, AL_GAIN, volume);
@@ -235,6 +600,95 @@ Gosu::SampleInstance Gosu::Sample::playPan(double pan, double volume,
     return Gosu::SampleInstance(channelAndToken.first, channelAndToken.second);
 }
 
+std::size_t Gosu::Sample::memoryUsage() const
+{
+    if (data->compressed)
+        return data->compressed->size();
+    
+    ALint size = 0;
+    alGetBufferi(data->buffer, AL_SIZE, &size);
+    return size;
+}
+
+void Gosu::Sample::setMaxInstances(unsigned instances, InstanceLimitPolicy policy)
+{
+    data->maxInstances = instances;
+    data->limitPolicy = policy;
+}
+
+unsigned Gosu::Sample::maxInstances() const
+{
+    return data->maxInstances;
+}
+
+void Gosu::Sample::setMinRetriggerInterval(unsigned milliseconds)
+{
+    data->minRetriggerInterval = milliseconds;
+}
+
+unsigned Gosu::Sample::minRetriggerInterval() const
+{
+    return data->minRetriggerInterval;
+}
+
+void Gosu::Sample::setMaxChannels(unsigned channels)
+{
+    ALChannelManagement::setMaxChannels(channels);
+}
+
+unsigned Gosu::Sample::allocatedChannels()
+{
+    return ALChannelManagement::allocatedChannels();
+}
+
+unsigned Gosu::Sample::activeChannels()
+{
+    return ALChannelManagement::activeChannels();
+}
+
+void Gosu::Sample::setStealingPolicy(StealingPolicy policy)
+{
+    ALChannelManagement::setStealingPolicy(policy);
+}
+
+void Gosu::Sample::setBatching(bool batching)
+{
+    ALChannelManagement::setBatching(batching);
+}
+
+void Gosu::Sample::setDeviceConfiguration(unsigned frequency, unsigned refreshRate,
+    unsigned monoSources, unsigned stereoSources)
+{
+    Gosu::Lock lock(alInitMutex);
+    ALChannelManagement::configureDevice(frequency, refreshRate, monoSources, stereoSources);
+}
+
+unsigned Gosu::Sample::deviceFrequency()
+{
+    return ALChannelManagement::deviceAttribute(ALC_FREQUENCY);
+}
+
+unsigned Gosu::Sample::deviceRefreshRate()
+{
+    return ALChannelManagement::deviceAttribute(ALC_REFRESH);
+}
+
+double Gosu::Sample::deviceLatency()
+{
+    return ALChannelManagement::latency();
+}
+
+void Gosu::Sample::setLoadConversion(bool toDeviceRate, bool toMono)
+{
+    convertToDeviceRate = toDeviceRate;
+    convertToMono = toMono;
+}
+
+void Gosu::Sample::setDecodedCacheDirectory(const std::wstring& directory)
+{
+    decodedCacheDirectory = directory;
+}
+
 class Gosu::Song::BaseData
 {
     BaseData(const BaseData&);
@@ -256,6 +710,8 @@ public:
     virtual void stop() = 0;
     
     virtual void update() = 0;
+    // Prepares what play() needs ahead of time, on the streaming thread.
+    virtual void prime() {}
     
     double volume() const
     {
@@ -328,7 +784,12 @@ public:
 class Gosu::Song::StreamData : public BaseData
 {
     std::auto_ptr<AudioFile> file;
-    ALuint buffers[2];
+    std::vector<ALuint> buffers;
+    std::vector<char> audioData;
+    MemoryCount memory;
+    // Buffers at the front that prime() has already filled from the start
+    // of the file.
+    std::size_t primed;
     
     void applyVolume()
     {
@@ -344,45 +805,54 @@ class Gosu::Song::StreamData : public BaseData
     
     bool streamToBuffer(ALuint buffer)
     {
-        #ifdef GOSU_IS_IPHONE
-        static const unsigned BUFFER_SIZE = 4096 * 4;
-        #else
-        static const unsigned BUFFER_SIZE = 4096 * 8;
-        #endif
-        char audioData[BUFFER_SIZE];
-        std::size_t readBytes = file->readData(audioData, BUFFER_SIZE);
-        if (readBytes > 0)
-            alBufferData(buffer, file->format(), audioData, readBytes, file->sampleRate());
-        return readBytes > 0;
+        return ::streamToBuffer(*file, audioData, buffer);
+    }
+    
+    void generateBuffers()
+    {
+        buffers.resize(std::max(streamBufferCount, 2u));
+        audioData.resize(streamBufferSize);
+        alGenBuffers(buffers.size(), &buffers[0]);
+        // OpenAL's buffers and the one that is decoded into.
+        memory.set((buffers.size() + 1) * audioData.size());
     }
     
 public:
     StreamData(const std::wstring& filename)
+    : memory(mcSongs), primed(0)
     {
-        if (isOggFile(filename))
+        // A song may outlive the archive it comes from, so OggFile and
+        // WAVE_FILE copy them.
+        if (const Resource* packed = findInMountedArchives(filename))
         {
-            Gosu::File sourceFile(filename);
-            file.reset(new OggFile(sourceFile.frontReader()));
+            Reader reader = packed->frontReader();
+            if (isOggFile(reader))
+                file.reset(new OggFile(reader));
+            else
+                file.reset(new WAVE_FILE(reader));
         }
+        else if (isOggFile(filename))
+            file.reset(new OggFile(filename));
         else
             file.reset(new WAVE_FILE(filename));
-        alGenBuffers(2, buffers);
+        generateBuffers();
     }
 
     StreamData(Reader reader)
+    : memory(mcSongs), primed(0)
     {
         if (isOggFile(reader))
             file.reset(new OggFile(reader));
         else
             file.reset(new WAVE_FILE(reader));
-        alGenBuffers(2, buffers);
+        generateBuffers();
     }
     
     ~StreamData()
     {
         if (alChannelManagement.get())
         {
-            alDeleteBuffers(2, buffers);
+            alDeleteBuffers(buffers.size(), &buffers[0]);
         }
     }
     
@@ -396,15 +866,23 @@ public:
             alSourcef(source, AL_PITCH, 1);
             alSourcei(source, AL_LOOPING, AL_FALSE); // need to implement this manually...
 
-            streamToBuffer(buffers[0]);
-            streamToBuffer(buffers[1]);
-            
-            // TODO: Not good for songs with less than two buffers full of data.
+            // Songs that are shorter than all buffers together only fill
+            // some of them.
+            std::size_t filled = primed;
+            primed = 0;
+            while (filled < buffers.size() && streamToBuffer(buffers[filled]))
+                ++filled;
             
-            alSourceQueueBuffers(source, 2, buffers);
+            alSourceQueueBuffers(source, filled, &buffers[0]);
             alSourcePlay(source);
         }
     }
+    
+    void prime()
+    {
+        while (primed < buffers.size() && streamToBuffer(buffers[primed]))
+            ++primed;
+    }
 
     void stop()
     {
@@ -429,6 +907,7 @@ public:
             //    alSourceUnqueueBuffers(source, 1, &buffer);
         }
         file->rewind();
+        primed = 0;
     }
     
     void pause()
@@ -477,6 +956,7 @@ public:
         if (active && state != AL_PLAYING && state != AL_PAUSED)
         {
             // We seemingly got starved.
+            ++streamUnderruns;
             alSourcePlay(source);
         }
         else if (!active)
@@ -495,6 +975,98 @@ public:
     }
 };
 
+namespace
+{
+    // Refills the buffers of the current song, so that it does not depend
+    // on how often the game calls Song::update. songMutex guards curSong
+    // and everything that the thread touches.
+    Gosu::Mutex songMutex;
+    std::tr1::function<void()> streamCurrentSong;
+    // Songs waiting for Song::preload, and what primes them.
+    typedef std::vector<std::pair<const Gosu::Song*, std::tr1::function<void()> > > Preloads;
+    Preloads preloads;
+    
+    // Must be called with songMutex locked.
+    Preloads::iterator findPreload(const Gosu::Song* song)
+    {
+        Preloads::iterator iter = preloads.begin();
+        while (iter != preloads.end() && iter->first != song)
+            ++iter;
+        return iter;
+    }
+    
+    void cancelPreload(const Gosu::Song* song)
+    {
+        Preloads::iterator iter = findPreload(song);
+        if (iter != preloads.end())
+            preloads.erase(iter);
+    }
+    
+    class StreamingThread
+    {
+        // Much less than a buffer takes to play.
+        static const unsigned INTERVAL = 10;
+        
+        bool quitting;
+        std::auto_ptr<Gosu::Thread> thread;
+        
+        void run()
+        {
+            while (true)
+            {
+                {
+                    Gosu::Lock lock(songMutex);
+                    if (quitting)
+                        break;
+                    if (curSong && alChannelManagement.get())
+                        streamCurrentSong();
+                    // The current song comes first; the next one can wait.
+                    if (!preloads.empty() && alChannelManagement.get())
+                    {
+                        preloads.front().second();
+                        preloads.erase(preloads.begin());
+                    }
+                }
+                Gosu::sleep(INTERVAL);
+            }
+        }
+        
+    public:
+        StreamingThread()
+        : quitting(false)
+        {
+        }
+        
+        ~StreamingThread()
+        {
+            stop();
+        }
+        
+        // Must be called with songMutex locked.
+        void start()
+        {
+            quitting = false;
+            if (!thread.get())
+                thread.reset(new Gosu::Thread(std::tr1::bind(&StreamingThread::run, this)));
+        }
+        
+        void stop()
+        {
+            {
+                Gosu::Lock lock(songMutex);
+                quitting = true;
+            }
+            thread.reset();
+        }
+    };
+    StreamingThread streamingThread;
+}
+
+void Gosu::stopSongStreaming()
+{
+    streamingThread.stop();
+}
+
 // TODO: Move into proper internal header
 namespace Gosu { bool isExtension(const wchar_t* str, const wchar_t* ext); }
 
@@ -523,22 +1095,30 @@ Gosu::Song::Song(Reader reader)
 Gosu::Song::~Song()
 {
     stop();
+    
+    Lock lock(songMutex);
+    cancelPreload(this);
 }
 
 Gosu::Song* Gosu::Song::currentSong()
 {
+    Lock lock(songMutex);
     return curSong;
 }
 
 void Gosu::Song::play(bool looping)
 {
-    if (paused())
+    Lock lock(songMutex);
+    // Whatever has been primed so far is used; play() decodes the rest.
+    cancelPreload(this);
+    
+    if (curSong == this && data->paused())
         data->resume();
     
     if (curSong && curSong != this)
     {
-        curSong->stop();
-        assert(curSong == 0);
+        curSong->data->stop();
+        curSong = 0;
     }
     
     if (curSong == 0)
@@ -546,21 +1126,41 @@ void Gosu::Song::play(bool looping)
     
     curSong = this;
     curSongLooping = looping;
+    streamCurrentSong = std::tr1::bind(&BaseData::update, data.get());
+    streamingThread.start();
+}
+
+void Gosu::Song::preload()
+{
+    Lock lock(songMutex);
+    if (curSong == this || findPreload(this) != preloads.end())
+        return;
+    preloads.push_back(std::make_pair(this, std::tr1::bind(&BaseData::prime, data.get())));
+    streamingThread.start();
+}
+
+bool Gosu::Song::preloaded() const
+{
+    Lock lock(songMutex);
+    return findPreload(this) == preloads.end();
 }
 
 void Gosu::Song::pause()
 {
+    Lock lock(songMutex);
     if (curSong == this)
         data->pause(); // may be redundant
 }
 
 bool Gosu::Song::paused() const
 {
+    Lock lock(songMutex);
     return curSong == this && data->paused();
 }
 
 void Gosu::Song::stop()
 {
+    Lock lock(songMutex);
     if (curSong == this)
     {
         data->stop();
@@ -570,6 +1170,7 @@ void Gosu::Song::stop()
 
 bool Gosu::Song::playing() const
 {
+    Lock lock(songMutex);
     return curSong == this && !data->paused();
 }
 
@@ -580,13 +1181,34 @@ double Gosu::Song::volume() const
 
 void Gosu::Song::changeVolume(double volume)
 {
+    Lock lock(songMutex);
     data->changeVolume(volume);
 }
 
 void Gosu::Song::update()
 {
-    if (currentSong())
-        currentSong()->data->update();
+    GOSU_TRACE("Song::update");
+    if (alChannelManagement.get())
+    {
+        // Everything that was changed during the tick starts sounding now.
+        ALChannelManagement::endBatch();
+        // Voices go first, so that starved ones are not taken for finished.
+        updateCompressedVoices();
+        alChannelManagement->updateChannels();
+        ALChannelManagement::beginBatch();
+    }
+}
+
+void Gosu::Song::setStreamBuffers(unsigned count, std::size_t size)
+{
+    streamBufferCount = count;
+    streamBufferSize = size;
+}
+
+unsigned long Gosu::Song::underruns()
+{
+    Lock lock(songMutex);
+    return streamUnderruns;
 }
 
 // Deprecated constructors.
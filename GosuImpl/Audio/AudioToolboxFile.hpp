@@ -19,7 +19,7 @@ namespace Gosu
 {
     class AudioToolboxFile : public AudioFile
     {
-        Gosu::Buffer buffer_;
+        std::auto_ptr<Gosu::Resource> resource_;
         AudioFileID fileID_;
         ExtAudioFileRef file_;
         SInt64 position_;
@@ -165,16 +165,17 @@ namespace Gosu
             init();
         }
         
-        AudioToolboxFile(Gosu::Reader reader)
+        // Copies the rest of the reader's resource, unless asked to read it
+        // in place because the caller is done decoding before it goes away.
+        AudioToolboxFile(Gosu::Reader reader, bool inPlace = false)
+        : resource_(inPlace ? borrowRest(reader) : copyRest(reader))
         {
-            buffer_.resize(reader.resource().size() - reader.position());
-            reader.read(buffer_.data(), buffer_.size());
             
             // TODO: For some reason, this fails on the iPhone with at least MP3 files.
             // If this turns into a serious problem, the plain AudioFile API could be
             // used which works for non-compressed formats at least.
             
-            void* clientData = &buffer_;
+            void* clientData = resource_.get();
             CHECK_OS(AudioFileOpenWithCallbacks(clientData, AudioFile_ReadProc, 0,
                                                 AudioFile_GetSizeProc, 0, 0, &fileID_));
             CHECK_OS(ExtAudioFileWrapAudioFileID(fileID_, false, &file_));
@@ -3,8 +3,11 @@
 
 #include <GosuImpl/Audio/AudioFile.hpp>
 #include <Gosu/IO.hpp>
+#include <Gosu/TR1.hpp>
 #include <vorbis/vorbisfile.h>
 #include <algorithm>
+#include <cstdio>
+#include <memory>
 #include <stdexcept>
 
 // Based on the Drama Sound Engine for D
@@ -13,7 +16,9 @@ namespace Gosu
 {
     class OggFile : public AudioFile
     {
-        Gosu::Buffer buffer_;
+        // A copy of the data, a view of it or the file itself, read from as
+        // needed.
+        std::tr1::shared_ptr<const Gosu::Resource> resource_;
         Gosu::Reader reader_;
         ALenum format_;
         ALenum sampleRate_;
@@ -24,19 +29,45 @@ namespace Gosu
         {
             OggFile* oggFile = static_cast<OggFile*>(datasource);
             size = std::min(size * nmemb,
-                oggFile->buffer_.size() - oggFile->reader_.position());
+                oggFile->resource_->size() - oggFile->reader_.position());
             oggFile->reader_.read(ptr, size);
             return size;
         }
         
+        static int seekCallback(void* datasource, ogg_int64_t offset, int whence)
+        {
+            OggFile* oggFile = static_cast<OggFile*>(datasource);
+            ogg_int64_t position;
+            switch (whence)
+            {
+            case SEEK_SET: position = offset; break;
+            case SEEK_CUR: position = oggFile->reader_.position() + offset; break;
+            case SEEK_END: position = oggFile->resource_->size() + offset; break;
+            default: return -1;
+            }
+            if (position < 0 || position > static_cast<ogg_int64_t>(oggFile->resource_->size()))
+                return -1;
+            oggFile->reader_.setPosition(static_cast<std::size_t>(position));
+            return 0;
+        }
+        
+        static long tellCallback(void* datasource)
+        {
+            return static_cast<OggFile*>(datasource)->reader_.position();
+        }
+        
         void setup()
         {
-            static const ov_callbacks cbs = { readCallback, 0, 0, 0 };
-            ov_open_callbacks(this, &file_, 0, 0, cbs);
+            static const ov_callbacks cbs = { readCallback, seekCallback, 0, tellCallback };
+            if (ov_open_callbacks(this, &file_, 0, 0, cbs) < 0)
+                throw std::runtime_error("invalid vorbis stream");
             
             vorbis_info* info = ov_info(&file_, -1); // -1 is current bitstream
             if (ov_streams(&file_) != 1)
+            {
+                ov_clear(&file_);
                 throw std::runtime_error("multi-stream vorbis files not supported");
+            }
             
             format_ = info->channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
             sampleRate_ = info->rate;
@@ -48,12 +79,29 @@ namespace Gosu
         }
         
     public:
-        OggFile(Gosu::Reader reader)
-        : reader_(buffer_.frontReader())
+        // The reader's resource may go away, so the rest of it is copied
+        // unless the caller is done decoding before that and asks to read
+        // it in place.
+        OggFile(Gosu::Reader reader, bool inPlace = false)
+        : resource_(inPlace ? borrowRest(reader) : copyRest(reader)),
+          reader_(resource_->frontReader())
+        {
+            setup();
+        }
+        
+        // Shares data that is kept compressed in memory, so that many files
+        // can decode it at the same time.
+        OggFile(const std::tr1::shared_ptr<const Gosu::Resource>& resource)
+        : resource_(resource), reader_(resource_->frontReader())
+        {
+            setup();
+        }
+        
+        // Reads from the file while decoding, which is mapped into memory
+        // where File supports it.
+        OggFile(const std::wstring& filename)
+        : resource_(new Gosu::File(filename)), reader_(resource_->frontReader())
         {
-            buffer_.resize(reader.resource().size() - reader.position());
-            reader.read(buffer_.data(), buffer_.size());
-            
             setup();
         }
         
@@ -72,6 +120,15 @@ namespace Gosu
             return sampleRate_;
         }
         
+        std::size_t decodedSize()
+        {
+            ogg_int64_t samples = ov_pcm_total(&file_, -1);
+            if (samples < 0)
+                return 0;
+            int channels = format_ == AL_FORMAT_MONO16 ? 1 : 2;
+            return static_cast<std::size_t>(samples) * channels * 2;
+        }
+        
         std::size_t readData(void* dest, std::size_t length)
         {
             static const unsigned OGG_ENDIANNESS =
@@ -103,9 +160,7 @@ namespace Gosu
         
         void rewind()
         {
-            teardown();
-            reader_ = buffer_.frontReader();
-            setup();
+            ov_raw_seek(&file_, 0);
         }
     };
 }
@@ -12,8 +12,10 @@ namespace Gosu
     {
         SNDFILE* file;
         SF_INFO info;
+        // What libsndfile reads from through the callbacks, if it does not
+        // open the file itself.
+        std::auto_ptr<Resource> resource;
         Reader reader;
-        Buffer buffer;
         
         // Cannot use /DELAYLOAD with libsndfile-1.dll because it was compiled
         // using arcane GNU tools of dark magic (or maybe it's the filename).
@@ -54,7 +56,7 @@ namespace Gosu
         
         static sf_count_t get_filelen(SndFile *self)
         {
-            return self->buffer.size();
+            return self->resource->size();
         }
         
         static sf_count_t seek(sf_count_t offset, int whence, SndFile *self)
@@ -63,14 +65,14 @@ namespace Gosu
             {
             case SEEK_SET: self->reader.setPosition(offset); break;
             case SEEK_CUR: self->reader.seek(offset); break;
-            case SEEK_END: self->reader.setPosition(self->buffer.size() - offset); break;
+            case SEEK_END: self->reader.setPosition(self->resource->size() - offset); break;
             };
             return 0;
         }
         
         static sf_count_t read(void *ptr, sf_count_t count, SndFile *self)
         {
-            sf_count_t avail = self->buffer.size() - self->reader.position();
+            sf_count_t avail = self->resource->size() - self->reader.position();
             count = std::min(avail, count);
             self->reader.read(ptr, count);
             return count;
@@ -93,23 +95,27 @@ namespace Gosu
         }
         
     public:
-        SndFile(Reader reader)
-        :   file(NULL), reader(buffer.frontReader())
+        // Copies the rest of the reader's resource, unless asked to read it
+        // in place because the caller is done decoding before it goes away.
+        SndFile(Reader source, bool inPlace = false)
+        :   file(NULL), resource(inPlace ? borrowRest(source) : copyRest(source)),
+            reader(resource->frontReader())
         {
             info.format = 0;
-            buffer.resize(reader.resource().size() - reader.position());
-            reader.read(buffer.data(), buffer.size());
             file = sf_open_virtual(ioInterface(), SFM_READ, &info, this);
             if (!file)
                 throw std::runtime_error(std::string(sf_strerror(NULL)));
         }
         
         SndFile(const std::wstring& filename)
-        :   file(NULL), reader(buffer.frontReader())
+        #ifdef GOSU_IS_WIN
+        :   file(NULL), resource(new File(filename)), reader(resource->frontReader())
+        #else
+        :   file(NULL), resource(new Buffer), reader(resource->frontReader())
+        #endif
         {
             info.format = 0;
             #ifdef GOSU_IS_WIN
-            loadFile(buffer, filename);
             file = sf_open_virtual(ioInterface(), SFM_READ, &info, this);
             #else
             file = sf_open(wstringToUTF8(filename).c_str(), SFM_READ, &info);
@@ -142,6 +148,13 @@ namespace Gosu
             return info.samplerate;
         }
         
+        std::size_t decodedSize()
+        {
+            if (info.frames <= 0)
+                return 0;
+            return static_cast<std::size_t>(info.frames) * info.channels * 2;
+        }
+        
         std::size_t readData(void* dest, std::size_t length)
         {
             int itemSize = 2 * info.channels;
@@ -0,0 +1,189 @@
+#include <Gosu/SoundScape.hpp>
+#include <Gosu/Audio.hpp>
+#include <Gosu/Math.hpp>
+#include <algorithm>
+#include <map>
+
+struct Gosu::SoundScape::Impl
+{
+    struct Sound
+    {
+        Sample sample;
+        double x, y, volume, speed;
+        bool looping;
+        int priority;
+        // Only meaningful unless the sound is virtual.
+        SampleInstance instance;
+        bool isVirtual;
+        
+        Sound(const Sample& sample)
+        : sample(sample), instance(-1, -1)
+        {
+        }
+    };
+    typedef std::map<unsigned, Sound> Sounds;
+    
+    double range, threshold;
+    double listenerX, listenerY;
+    Sounds sounds;
+    unsigned nextId;
+    
+    double volumeOf(const Sound& sound) const
+    {
+        double distance = Gosu::distance(listenerX, listenerY, sound.x, sound.y);
+        return sound.volume * std::max(0.0, 1 - distance / range);
+    }
+    
+    double panOf(const Sound& sound) const
+    {
+        return clamp((sound.x - listenerX) / range, -1.0, 1.0);
+    }
+    
+    void start(Sound& sound, double volume)
+    {
+        sound.instance = sound.sample.playPan(panOf(sound), volume,
+            sound.speed, sound.looping, sound.priority);
+        sound.isVirtual = false;
+    }
+    
+    // Returns false if the sound should be forgotten.
+    bool update(Sound& sound)
+    {
+        double volume = volumeOf(sound);
+        bool audible = volume >= threshold;
+        
+        if (sound.isVirtual)
+        {
+            if (audible)
+                start(sound, volume);
+            return true;
+        }
+        
+        // Finished, stopped from outside, or its channel was taken.
+        if (!sound.instance.playing() && !sound.instance.paused())
+        {
+            sound.isVirtual = true;
+            return sound.looping;
+        }
+        
+        if (!audible)
+        {
+            sound.instance.stop();
+            sound.isVirtual = true;
+            return sound.looping;
+        }
+        
+        sound.instance.changeVolume(volume);
+        sound.instance.changePan(panOf(sound));
+        return true;
+    }
+};
+
+Gosu::SoundScape::SoundScape(double range, double threshold)
+: pimpl(new Impl)
+{
+    pimpl->range = range;
+    pimpl->threshold = threshold;
+    pimpl->listenerX = pimpl->listenerY = 0;
+    pimpl->nextId = 0;
+}
+
+Gosu::SoundScape::~SoundScape()
+{
+}
+
+double Gosu::SoundScape::listenerX() const
+{
+    return pimpl->listenerX;
+}
+
+double Gosu::SoundScape::listenerY() const
+{
+    return pimpl->listenerY;
+}
+
+void Gosu::SoundScape::setListener(double x, double y)
+{
+    pimpl->listenerX = x;
+    pimpl->listenerY = y;
+}
+
+unsigned Gosu::SoundScape::play(const Sample& sample, double x, double y,
+    double volume, double speed, bool looping, int priority)
+{
+    Impl::Sound sound(sample);
+    sound.x = x;
+    sound.y = y;
+    sound.volume = volume;
+    sound.speed = speed;
+    sound.looping = looping;
+    sound.priority = priority;
+    sound.isVirtual = true;
+    
+    unsigned id = pimpl->nextId++;
+    double attenuated = pimpl->volumeOf(sound);
+    if (attenuated >= pimpl->threshold)
+        pimpl->start(sound, attenuated);
+    if (!sound.isVirtual || looping)
+        pimpl->sounds.insert(std::make_pair(id, sound));
+    return id;
+}
+
+void Gosu::SoundScape::move(unsigned sound, double x, double y)
+{
+    Impl::Sounds::iterator iter = pimpl->sounds.find(sound);
+    if (iter == pimpl->sounds.end())
+        return;
+    iter->second.x = x;
+    iter->second.y = y;
+}
+
+void Gosu::SoundScape::stop(unsigned sound)
+{
+    Impl::Sounds::iterator iter = pimpl->sounds.find(sound);
+    if (iter == pimpl->sounds.end())
+        return;
+    if (!iter->second.isVirtual)
+        iter->second.instance.stop();
+    pimpl->sounds.erase(iter);
+}
+
+void Gosu::SoundScape::stopAll()
+{
+    for (Impl::Sounds::iterator iter = pimpl->sounds.begin();
+            iter != pimpl->sounds.end(); ++iter)
+    {
+        if (!iter->second.isVirtual)
+            iter->second.instance.stop();
+    }
+    pimpl->sounds.clear();
+}
+
+void Gosu::SoundScape::update()
+{
+    for (Impl::Sounds::iterator iter = pimpl->sounds.begin();
+            iter != pimpl->sounds.end(); )
+    {
+        if (pimpl->update(iter->second))
+            ++iter;
+        else
+            pimpl->sounds.erase(iter++);
+    }
+}
+
+unsigned Gosu::SoundScape::audibleSounds() const
+{
+    unsigned audible = 0;
+    for (Impl::Sounds::const_iterator iter = pimpl->sounds.begin();
+            iter != pimpl->sounds.end(); ++iter)
+    {
+        if (!iter->second.isVirtual)
+            ++audible;
+    }
+    return audible;
+}
+
+unsigned Gosu::SoundScape::virtualSounds() const
+{
+    return pimpl->sounds.size() - audibleSounds();
+}
@@ -0,0 +1,200 @@
+#ifndef GOSUIMPL_DECODEDCACHE_HPP
+#define GOSUIMPL_DECODEDCACHE_HPP
+
+#include <Gosu/IO.hpp>
+#include <Gosu/Platform.hpp>
+#include <Gosu/TR1.hpp>
+#include <Gosu/Utility.hpp>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace Gosu
+{
+    // Decoded data on disk, so that files do not have to be decoded again
+    // on the next start. Each source file gets a cache file named after a
+    // hash of its filename, which remembers the size and time of
+    // modification of the source, and two values that describe the data
+    // (e.g. the format and sample rate of a sample). The cache is only an
+    // optimization; if it cannot be read or written, files are decoded as
+    // usual.
+    class DecodedCache
+    {
+        enum { VERSION = 1 };
+
+        std::tr1::uint32_t magic;
+        std::wstring cacheFilename;
+        std::string source;
+        std::tr1::uint64_t sourceSize, sourceTime;
+        bool valid;
+        // The cache file while it is open for reading.
+        mutable std::auto_ptr<File> file;
+
+        static std::tr1::uint64_t hash(const std::string& str)
+        {
+            // 64-bit FNV-1a
+            const std::tr1::uint64_t prime = (static_cast<std::tr1::uint64_t>(1) << 40) + 0x1b3;
+            std::tr1::uint64_t result =
+                (static_cast<std::tr1::uint64_t>(0xcbf29ce4) << 32) + 0x84222325;
+            for (std::size_t i = 0; i < str.size(); ++i)
+            {
+                result ^= static_cast<unsigned char>(str[i]);
+                result *= prime;
+            }
+            return result;
+        }
+
+        bool stampSource(const std::wstring& filename)
+        {
+            #ifdef GOSU_IS_WIN
+            struct _stat64 info;
+            if (_wstat64(filename.c_str(), &info) != 0)
+                return false;
+            #else
+            struct stat info;
+            if (stat(narrow(filename).c_str(), &info) != 0)
+                return false;
+            #endif
+            sourceSize = info.st_size;
+            sourceTime = info.st_mtime;
+            return true;
+        }
+
+        static std::size_t headerSize()
+        {
+            return 6 * sizeof(std::tr1::uint32_t) + 3 * sizeof(std::tr1::uint64_t);
+        }
+
+    public:
+        // Kinds of cached data, used as the magic number of the files.
+        enum Kind
+        {
+            SAMPLES = 0x4d435047, // "GPCM"
+            PIXELS = 0x41424752 // "RGBA"
+        };
+
+        DecodedCache(Kind kind, const std::wstring& directory,
+            const std::wstring& filename)
+        : magic(kind), source(wstringToUTF8(filename)), valid(false)
+        {
+            if (directory.empty() || !stampSource(filename))
+                return;
+
+            char name[17];
+            std::sprintf(name, "%08lx%08lx",
+                static_cast<unsigned long>(hash(source) >> 32),
+                static_cast<unsigned long>(hash(source) & 0xffffffff));
+            cacheFilename = directory + widen(name) +
+                (kind == PIXELS ? L".rgba" : L".pcm");
+            valid = true;
+        }
+
+        // Returns true and fills in the arguments if the cache has data for
+        // the source file in its current version. The data can then be
+        // fetched with read, which is cheap since cache files are mapped.
+        bool open(std::tr1::uint32_t& first, std::tr1::uint32_t& second,
+            std::tr1::uint64_t& dataSize) const
+        {
+            if (!valid)
+                return false;
+
+            try
+            {
+                file.reset(new File(cacheFilename));
+                Reader reader = file->frontReader();
+                if (file->size() < headerSize())
+                    return false;
+
+                if (reader.getPod<std::tr1::uint32_t>() != magic ||
+                        reader.getPod<std::tr1::uint32_t>() != VERSION ||
+                        reader.getPod<std::tr1::uint64_t>() != sourceSize ||
+                        reader.getPod<std::tr1::uint64_t>() != sourceTime)
+                    return false;
+                std::tr1::uint32_t sourceLength = reader.getPod<std::tr1::uint32_t>();
+                first = reader.getPod<std::tr1::uint32_t>();
+                second = reader.getPod<std::tr1::uint32_t>();
+                std::tr1::uint32_t reserved = reader.getPod<std::tr1::uint32_t>();
+                (void)reserved;
+                dataSize = reader.getPod<std::tr1::uint64_t>();
+                if (sourceLength != source.size() ||
+                        file->size() != headerSize() + sourceLength + dataSize)
+                    return false;
+
+                // Guards against collisions of the hash.
+                std::string cachedSource(sourceLength, '\0');
+                if (sourceLength > 0)
+                    reader.read(&cachedSource[0], sourceLength);
+                return cachedSource == source;
+            }
+            catch (const std::exception&)
+            {
+                return false;
+            }
+        }
+
+        // Copies the data of a successfully opened cache file.
+        bool read(void* data) const
+        {
+            try
+            {
+                std::size_t offset = headerSize() + source.size();
+                if (file->size() > offset)
+                    file->read(offset, file->size() - offset, data);
+                file.reset();
+                return true;
+            }
+            catch (const std::exception&)
+            {
+                file.reset();
+                return false;
+            }
+        }
+
+        bool load(std::tr1::uint32_t& first, std::tr1::uint32_t& second,
+            std::vector<char>& data) const
+        {
+            std::tr1::uint64_t dataSize;
+            if (!open(first, second, dataSize))
+                return false;
+            data.resize(static_cast<std::size_t>(dataSize));
+            return read(data.empty() ? 0 : &data[0]);
+        }
+
+        void store(std::tr1::uint32_t first, std::tr1::uint32_t second,
+            const void* data, std::size_t dataSize) const
+        {
+            if (!valid)
+                return;
+            // Not replaceable on Windows while it is still mapped.
+            file.reset();
+
+            try
+            {
+                File out(cacheFilename, fmReplace);
+                Writer writer = out.backWriter();
+                writer.writePod<std::tr1::uint32_t>(magic);
+                writer.writePod<std::tr1::uint32_t>(VERSION);
+                writer.writePod<std::tr1::uint64_t>(sourceSize);
+                writer.writePod<std::tr1::uint64_t>(sourceTime);
+                writer.writePod<std::tr1::uint32_t>(source.size());
+                writer.writePod<std::tr1::uint32_t>(first);
+                writer.writePod<std::tr1::uint32_t>(second);
+                writer.writePod<std::tr1::uint32_t>(0);
+                writer.writePod<std::tr1::uint64_t>(dataSize);
+                writer.write(source.data(), source.size());
+                if (dataSize > 0)
+                    writer.write(data, dataSize);
+            }
+            catch (const std::exception&)
+            {
+            }
+        }
+    };
+}
+
+#endif
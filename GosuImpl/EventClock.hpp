@@ -0,0 +1,45 @@
+#ifndef GOSUIMPL_EVENTCLOCK_HPP
+#define GOSUIMPL_EVENTCLOCK_HPP
+
+#include <Gosu/Timing.hpp>
+#include <Gosu/TR1.hpp>
+
+namespace Gosu
+{
+    // Translates the timestamps that the system puts on input events into
+    // the time of Gosu::microseconds(). The system's clock starts at an
+    // unknown point, so the offset between the two is estimated from when
+    // events arrive: an event cannot arrive before it happened, so the
+    // smallest difference seen yet is the closest estimate.
+    class EventClock
+    {
+        // If events seem to arrive this much later than they used to, in
+        // microseconds, the system's clock must have wrapped or jumped.
+        static const std::tr1::uint64_t MAX_DELAY = 60000000;
+
+        std::tr1::int64_t offset;
+        bool known;
+
+    public:
+        EventClock()
+        : offset(0), known(false)
+        {
+        }
+
+        // Both times in microseconds. Returns when the event happened.
+        std::tr1::uint64_t convert(std::tr1::uint64_t timestamp,
+            std::tr1::uint64_t arrival = microseconds())
+        {
+            std::tr1::int64_t difference = static_cast<std::tr1::int64_t>(arrival - timestamp);
+            if (!known || difference < offset ||
+                    difference > offset + static_cast<std::tr1::int64_t>(MAX_DELAY))
+            {
+                offset = difference;
+                known = true;
+            }
+            return timestamp + offset;
+        }
+    };
+}
+
+#endif
@@ -1,6 +1,8 @@
 #include <Gosu/IO.hpp>
 #include <Gosu/Utility.hpp>
+#include <algorithm>
 #include <stdexcept>
+#include <cstdio>
 #include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
@@ -21,8 +23,11 @@ struct Gosu::File::Impl
 {
     int fd;
     void* mapping;
+    // Kept up to date by resize() and write(), so that size() does not
+    // have to ask the system.
+    std::size_t size;
     
-    Impl() : fd(-1), mapping(noMapping) {}
+    Impl() : fd(-1), mapping(noMapping), size(0) {}
     ~Impl()
     {
         if (fd > 0)
@@ -55,25 +60,55 @@ Gosu::File::File(const std::wstring& filename, FileMode mode)
     if (pimpl->fd < 0)
         throw std::runtime_error("Cannot open file " + narrow(filename));
     
-    if (mode == fmRead && size() > 0)
-        pimpl->mapping = mmap(0, size(), PROT_READ, 0, pimpl->fd, 0);
+    off_t end = lseek(pimpl->fd, 0, SEEK_END);
+    pimpl->size = end < 0 ? 0 : static_cast<std::size_t>(end);
+    
+    // If mapping fails, read() falls back to the file descriptor.
+    if (mode == fmRead && pimpl->size > 0)
+    {
+        pimpl->mapping = mmap(0, pimpl->size, PROT_READ, MAP_PRIVATE, pimpl->fd, 0);
+        // Most files are loaded from front to back, so the system may read
+        // ahead aggressively.
+        if (pimpl->mapping != noMapping)
+            madvise(pimpl->mapping, pimpl->size, MADV_SEQUENTIAL);
+    }
 }
 
 Gosu::File::~File()
 {
     if (pimpl->mapping != noMapping)
-        munmap(pimpl->mapping, size());
+        munmap(pimpl->mapping, pimpl->size);
 }
 
 std::size_t Gosu::File::size() const
 {
-    // IMPR: Error checking?
-    return lseek(pimpl->fd, 0, SEEK_END);
+    return pimpl->size;
 }
 
 void Gosu::File::resize(std::size_t newSize)
 {
-    ftruncate(pimpl->fd, newSize);
+    if (ftruncate(pimpl->fd, newSize) == 0)
+        pimpl->size = newSize;
+}
+
+void Gosu::File::prefetch(std::size_t offset, std::size_t length) const
+{
+    if (offset >= pimpl->size)
+        return;
+    length = std::min(length, pimpl->size - offset);
+    
+    if (pimpl->mapping != noMapping)
+    {
+        // madvise() needs an address at the start of a page.
+        std::size_t pageSize = sysconf(_SC_PAGESIZE);
+        std::size_t start = offset / pageSize * pageSize;
+        madvise(static_cast<char*>(pimpl->mapping) + start,
+            length + offset - start, MADV_WILLNEED);
+    }
+    #ifdef POSIX_FADV_WILLNEED
+    else
+        posix_fadvise(pimpl->fd, offset, length, POSIX_FADV_WILLNEED);
+    #endif
 }
 
 void Gosu::File::read(std::size_t offset, std::size_t length,
@@ -87,14 +122,48 @@ void Gosu::File::read(std::size_t offset, std::size_t length,
     }
     
     // IMPR: Error checking?
-    lseek(pimpl->fd, offset, SEEK_SET);
-    ::read(pimpl->fd, destBuffer, length);
+    pread(pimpl->fd, destBuffer, length, offset);
+}
+
+const void* Gosu::File::view(std::size_t offset, std::size_t length) const
+{
+    if (pimpl->mapping == noMapping || length == 0 || offset + length > pimpl->size)
+        return 0;
+    return static_cast<const char*>(pimpl->mapping) + offset;
 }
 
 void Gosu::File::write(std::size_t offset, std::size_t length,
     const void* sourceBuffer)
 {
     // IMPR: Error checking?
-    lseek(pimpl->fd, offset, SEEK_SET);
-    ::write(pimpl->fd, sourceBuffer, length);
+    ssize_t written = pwrite(pimpl->fd, sourceBuffer, length, offset);
+    if (written > 0)
+        pimpl->size = std::max(pimpl->size, offset + static_cast<std::size_t>(written));
+}
+
+void Gosu::saveFileAtomically(const Buffer& buffer, const std::wstring& filename)
+{
+    std::string target = narrow(filename), temporary = target + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_TRUNC | O_CREAT,
+        S_IRUSR|S_IWUSR|S_IRGRP|S_IWGRP|S_IROTH|S_IWOTH);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open file " + temporary);
+    
+    const char* data = static_cast<const char*>(buffer.data());
+    std::size_t written = 0;
+    while (written < buffer.size())
+    {
+        ssize_t result = ::write(fd, data + written, buffer.size() - written);
+        if (result <= 0)
+            break;
+        written += result;
+    }
+    // The data has to be on the disk before the rename is, or a crash
+    // could leave an empty file behind after all.
+    bool complete = written == buffer.size() && fsync(fd) == 0;
+    if (close(fd) != 0 || !complete || std::rename(temporary.c_str(), target.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        throw std::runtime_error("Cannot save file " + target);
+    }
 }
@@ -73,6 +73,17 @@ void Gosu::File::read(std::size_t offset, std::size_t length,
     Win::check(::ReadFile(pimpl->handle, destBuffer, length, &dummy, 0));
 }
 
+const void* Gosu::File::view(std::size_t, std::size_t) const
+{
+    // Windows files are not mapped into memory (yet).
+    return 0;
+}
+
+void Gosu::File::prefetch(std::size_t, std::size_t) const
+{
+    // Not supported yet; Windows reads ahead on its own for sequential access.
+}
+
 void Gosu::File::write(std::size_t offset, std::size_t length,
     const void* sourceBuffer)
 {
@@ -81,3 +92,27 @@ void Gosu::File::write(std::size_t offset, std::size_t length,
     DWORD dummy;
     Win::check(::WriteFile(pimpl->handle, sourceBuffer, length, &dummy, 0));
 }
+
+void Gosu::saveFileAtomically(const Buffer& buffer, const std::wstring& filename)
+{
+    std::wstring temporary = filename + L".tmp";
+    HANDLE handle = ::CreateFileW(temporary.c_str(), GENERIC_WRITE, 0, 0,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+    if (handle == INVALID_HANDLE_VALUE)
+        Win::throwLastError("opening " + Gosu::narrow(temporary));
+
+    // The data has to be on the disk before the file is replaced, or a
+    // crash could leave an empty file behind after all.
+    DWORD written = 0;
+    bool saved = ::WriteFile(handle, buffer.data(), buffer.size(), &written, 0) &&
+        written == buffer.size() && ::FlushFileBuffers(handle);
+    ::CloseHandle(handle);
+    if (!saved || !::MoveFileExW(temporary.c_str(), filename.c_str(),
+            MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+    {
+        DWORD error = ::GetLastError();
+        ::DeleteFileW(temporary.c_str());
+        ::SetLastError(error);
+        Win::throwLastError("saving " + Gosu::narrow(filename));
+    }
+}
@@ -0,0 +1,151 @@
+#ifndef GOSUIMPL_FRAMEPACER_HPP
+#define GOSUIMPL_FRAMEPACER_HPP
+
+#include <Gosu/Timing.hpp>
+#include <Gosu/TR1.hpp>
+#include <algorithm>
+
+namespace Gosu
+{
+    // Decides when Window calls update next. Each deadline is exactly one
+    // interval after the previous one, no matter how late a frame was, so
+    // that rounding and oversleeping do not add up over time. Only if the
+    // game falls behind by more than a whole interval does it start over,
+    // instead of rushing through the frames it missed.
+    // With a fixed timestep, the window draws as often as it can instead,
+    // and asks for the number of updates that are due before each frame.
+    class FramePacer
+    {
+        // Sleeping can overshoot by this much, in microseconds, so precise
+        // pacing yields the CPU for the rest of the time.
+        static const unsigned SPIN_MARGIN = 2000;
+        // Updates per frame when catching up with a fixed timestep. If
+        // updating takes longer than the interval, the game slows down
+        // instead of spending more and more time catching up.
+        static const unsigned MAX_STEPS = 5;
+
+        std::tr1::uint64_t interval, deadline;
+        bool precise;
+        // Time that has passed, but has not been simulated by updates yet.
+        std::tr1::uint64_t backlog, lastStep;
+
+        // Returns false if the deadline cannot be met anymore.
+        bool inSchedule(std::tr1::uint64_t now)
+        {
+            if (deadline != 0 && now <= deadline + interval)
+                return true;
+            deadline = now;
+            return false;
+        }
+
+        void spinUntilDeadline()
+        {
+            while (microseconds() < deadline)
+                sleep(0);
+        }
+
+    public:
+        FramePacer()
+        : interval(0), deadline(0), precise(false), backlog(0), lastStep(0)
+        {
+        }
+
+        void setInterval(double milliseconds)
+        {
+            interval = static_cast<std::tr1::uint64_t>(milliseconds * 1000);
+        }
+
+        void setPrecise(bool precise)
+        {
+            this->precise = precise;
+        }
+
+        bool isPrecise() const
+        {
+            return precise;
+        }
+
+        // In microseconds, 0 if the next frame is due.
+        std::tr1::uint64_t remaining() const
+        {
+            std::tr1::uint64_t now = microseconds();
+            return deadline > now ? deadline - now : 0;
+        }
+
+        // For loops that can block: Waits until the next frame is due.
+        void wait()
+        {
+            std::tr1::uint64_t now = microseconds();
+            if (inSchedule(now) && deadline > now)
+            {
+                if (!precise)
+                    sleep((deadline - now) / 1000);
+                else
+                {
+                    while (deadline > now + SPIN_MARGIN + 1000)
+                    {
+                        sleep((deadline - now - SPIN_MARGIN) / 1000);
+                        now = microseconds();
+                    }
+                    spinUntilDeadline();
+                }
+            }
+            deadline += interval;
+        }
+
+        // For event loops that must not block for long: Returns true and
+        // schedules the following frame if the next one is due.
+        bool due()
+        {
+            std::tr1::uint64_t now = microseconds();
+            if (inSchedule(now) && deadline > now)
+            {
+                if (!precise || deadline - now > SPIN_MARGIN)
+                    return false;
+                spinUntilDeadline();
+            }
+            deadline += interval;
+            return true;
+        }
+
+        // Starts counting the time for the fixed timestep anew, so that the
+        // first call to stepsDue returns one update.
+        void restartSteps()
+        {
+            lastStep = 0;
+        }
+
+        // Returns how many updates have to be run with a fixed timestep to
+        // catch up with the time.
+        unsigned stepsDue()
+        {
+            std::tr1::uint64_t now = microseconds();
+            if (lastStep == 0)
+                backlog = interval;
+            else
+                backlog += now - lastStep;
+            lastStep = now;
+
+            backlog = std::min<std::tr1::uint64_t>(backlog, MAX_STEPS * interval);
+            unsigned steps = interval ? static_cast<unsigned>(backlog / interval) : 1;
+            backlog -= steps * interval;
+            return steps;
+        }
+
+        // How far the time has advanced from the last update towards the
+        // next one, between 0 and 1.
+        double stepAlpha() const
+        {
+            return interval ? static_cast<double>(backlog) / interval : 0;
+        }
+
+        // In microseconds.
+        std::tr1::uint64_t untilNextStep() const
+        {
+            std::tr1::uint64_t passed = backlog + (microseconds() - lastStep);
+            return passed < interval ? interval - passed : 0;
+        }
+    };
+}
+
+#endif
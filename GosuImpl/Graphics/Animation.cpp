@@ -0,0 +1,223 @@
+#include <Gosu/Animation.hpp>
+#include <Gosu/Timing.hpp>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+
+struct Gosu::Animation::Data
+{
+    std::vector<Image> frames;
+    // When each frame ends, counted from the start of the animation.
+    std::vector<unsigned long> ends;
+};
+
+Gosu::Animation::Animation(const std::vector<Image>& frames, unsigned frameDuration)
+{
+    if (frames.empty() || frameDuration == 0)
+        throw std::invalid_argument("Animation needs frames and a duration");
+
+    std::tr1::shared_ptr<Data> data(new Data);
+    data->frames = frames;
+    for (unsigned i = 1; i <= frames.size(); ++i)
+        data->ends.push_back(static_cast<unsigned long>(i) * frameDuration);
+    this->data = data;
+}
+
+Gosu::Animation::Animation(const std::vector<Image>& frames,
+    const std::vector<unsigned>& durations)
+{
+    if (frames.empty() || frames.size() != durations.size())
+        throw std::invalid_argument("Animation needs one duration for each frame");
+
+    std::tr1::shared_ptr<Data> data(new Data);
+    data->frames = frames;
+    unsigned long end = 0;
+    for (unsigned i = 0; i < durations.size(); ++i)
+        data->ends.push_back(end += durations[i]);
+    if (end == 0)
+        throw std::invalid_argument("Animation needs a duration");
+    this->data = data;
+}
+
+unsigned Gosu::Animation::frameCount() const
+{
+    return data->frames.size();
+}
+
+const Gosu::Image& Gosu::Animation::frame(unsigned index) const
+{
+    if (index >= data->frames.size())
+        throw std::out_of_range("Animation frame out of range");
+    return data->frames[index];
+}
+
+unsigned long Gosu::Animation::duration() const
+{
+    return data->ends.back();
+}
+
+unsigned Gosu::Animation::frameIndexAt(unsigned long time, bool looping) const
+{
+    time = looping ? time % duration() : std::min(time, duration() - 1);
+    return std::upper_bound(data->ends.begin(), data->ends.end(), time) - data->ends.begin();
+}
+
+const Gosu::Image& Gosu::Animation::frameAt(unsigned long time, bool looping) const
+{
+    return data->frames[frameIndexAt(time, looping)];
+}
+
+struct Gosu::Animator::Impl
+{
+    SpriteLayer* layer;
+    // Time of the animator, which stands still while it is paused.
+    unsigned long time, lastUpdate;
+    bool paused;
+
+    struct Player
+    {
+        SpriteLayer::Handle sprite;
+        Animation animation;
+        bool looping;
+        double speed;
+        unsigned long start;
+        // Time of the next frame change, or ULONG_MAX once the animation
+        // has finished.
+        unsigned long next;
+        unsigned frame;
+
+        Player(SpriteLayer::Handle sprite, const Animation& animation)
+        : sprite(sprite), animation(animation)
+        {
+        }
+    };
+    // Contiguous so that update() runs through them quickly.
+    std::vector<Player> players;
+    std::map<SpriteLayer::Handle, std::size_t> indices;
+
+    void advance(Player& player)
+    {
+        unsigned long elapsed =
+            static_cast<unsigned long>((time - player.start) * player.speed);
+        unsigned frame = player.animation.frameIndexAt(elapsed, player.looping);
+        if (frame != player.frame)
+        {
+            player.frame = frame;
+            layer->setImage(player.sprite, player.animation.frame(frame));
+        }
+
+        const std::vector<unsigned long>& ends = player.animation.data->ends;
+        if (!player.looping && frame == ends.size() - 1)
+        {
+            player.next = ULONG_MAX;
+            return;
+        }
+        unsigned long duration = ends.back();
+        unsigned long end = elapsed / duration * duration + ends[frame];
+        player.next = player.start +
+            static_cast<unsigned long>(std::ceil(end / player.speed));
+        // Rounding must not keep the player on the same time forever.
+        if (player.next <= time)
+            player.next = time + 1;
+    }
+
+    void erase(std::size_t index)
+    {
+        indices.erase(players[index].sprite);
+        if (index != players.size() - 1)
+        {
+            players[index] = players.back();
+            indices[players[index].sprite] = index;
+        }
+        players.pop_back();
+    }
+};
+
+Gosu::Animator::Animator(SpriteLayer& layer)
+: pimpl(new Impl)
+{
+    pimpl->layer = &layer;
+    pimpl->time = 0;
+    pimpl->lastUpdate = milliseconds();
+    pimpl->paused = false;
+}
+
+Gosu::Animator::~Animator()
+{
+}
+
+void Gosu::Animator::play(SpriteLayer::Handle sprite, const Animation& animation,
+    bool looping, double speed)
+{
+    if (!pimpl->layer->contains(sprite))
+        throw std::invalid_argument("Invalid SpriteLayer handle");
+    if (!(speed > 0))
+        throw std::invalid_argument("Animation speed must be positive");
+
+    std::map<SpriteLayer::Handle, std::size_t>::iterator iter = pimpl->indices.find(sprite);
+    if (iter == pimpl->indices.end())
+    {
+        iter = pimpl->indices.insert(std::make_pair(sprite, pimpl->players.size())).first;
+        pimpl->players.push_back(Impl::Player(sprite, animation));
+    }
+
+    Impl::Player& player = pimpl->players[iter->second];
+    player.animation = animation;
+    player.looping = looping;
+    player.speed = speed;
+    player.start = pimpl->time;
+    player.frame = UINT_MAX;
+    pimpl->advance(player);
+}
+
+void Gosu::Animator::stop(SpriteLayer::Handle sprite)
+{
+    std::map<SpriteLayer::Handle, std::size_t>::iterator iter = pimpl->indices.find(sprite);
+    if (iter != pimpl->indices.end())
+        pimpl->erase(iter->second);
+}
+
+bool Gosu::Animator::playing(SpriteLayer::Handle sprite) const
+{
+    std::map<SpriteLayer::Handle, std::size_t>::const_iterator iter =
+        pimpl->indices.find(sprite);
+    return iter != pimpl->indices.end() && pimpl->players[iter->second].next != ULONG_MAX;
+}
+
+std::size_t Gosu::Animator::size() const
+{
+    return pimpl->players.size();
+}
+
+void Gosu::Animator::setPaused(bool paused)
+{
+    pimpl->paused = paused;
+}
+
+bool Gosu::Animator::paused() const
+{
+    return pimpl->paused;
+}
+
+void Gosu::Animator::update()
+{
+    unsigned long now = milliseconds();
+    if (!pimpl->paused)
+        pimpl->time += now - pimpl->lastUpdate;
+    pimpl->lastUpdate = now;
+
+    for (std::size_t i = 0; i < pimpl->players.size(); )
+    {
+        Impl::Player& player = pimpl->players[i];
+        if (!pimpl->layer->contains(player.sprite))
+        {
+            pimpl->erase(i);
+            continue;
+        }
+        if (pimpl->time >= player.next)
+            pimpl->advance(player);
+        ++i;
+    }
+}
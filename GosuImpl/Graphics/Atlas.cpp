@@ -0,0 +1,322 @@
+#include <Gosu/Atlas.hpp>
+#include <Gosu/Archive.hpp>
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/Graphics.hpp>
+#include <Gosu/Image.hpp>
+#include <Gosu/IO.hpp>
+#include <Gosu/Utility.hpp>
+#include <GosuImpl/Graphics/BlockAllocator.hpp>
+#include <GosuImpl/Graphics/Macro.hpp>
+#include <GosuImpl/Graphics/Texture.hpp>
+#include <GosuImpl/Graphics/TexChunk.hpp>
+#include <GosuImpl/LZ4.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+// An atlas starts with a header and an index, followed by the pixels of all
+// pages. All numbers are unsigned 32-bit little-endian integers.
+//   Header: "GosuAtls", size of the (square) pages, number of pages,
+//           number of images
+//   Index:  one record per image, sorted by name: page, left, top, width
+//           and height of its block on the page, which includes one pixel
+//           of padding on each side, length of the name, and the name as
+//           UTF-8 without a terminator
+//   Pages:  size of the compressed pixels, followed by the pixels of the
+//           page as RGBA bytes, compressed as one LZ4 block (see LZ4.hpp)
+
+namespace Gosu
+{
+    namespace
+    {
+        const char MAGIC[8] = { 'G', 'o', 's', 'u', 'A', 't', 'l', 's' };
+        enum { HEADER_SIZE = 20, RECORD_SIZE = 24 };
+
+        typedef std::tr1::uint32_t UInt32;
+
+        std::string normalize(const std::wstring& name)
+        {
+            std::string result = wstringToUTF8(name);
+            std::replace(result.begin(), result.end(), '\\', '/');
+            return result;
+        }
+
+        struct Sprite
+        {
+            std::string name;
+            Bitmap padded;
+            unsigned page;
+            BlockAllocator::Block block;
+        };
+
+        // Big images first pack best; ties are broken by name so that the
+        // layout does not depend on the order in which names are given.
+        bool packedBefore(const Sprite* a, const Sprite* b)
+        {
+            if (a->padded.height() != b->padded.height())
+                return a->padded.height() > b->padded.height();
+            if (a->padded.width() != b->padded.width())
+                return a->padded.width() > b->padded.width();
+            return a->name < b->name;
+        }
+
+        bool sortedBefore(const Sprite* a, const Sprite* b)
+        {
+            return a->name < b->name;
+        }
+    }
+}
+
+struct Gosu::Atlas::Impl
+{
+    Graphics* graphics;
+    std::vector<std::string> names;
+    std::vector<std::tr1::shared_ptr<Image> > images;
+    // Saved macros refer to textures by their index in here.
+    std::vector<std::tr1::shared_ptr<Texture> > pages;
+};
+
+Gosu::Atlas::Atlas(Graphics& graphics, const std::wstring& filename, unsigned formatFlags)
+: pimpl(new Impl)
+{
+    pimpl->graphics = &graphics;
+
+    const std::string invalid = "Invalid atlas " + wstringToUTF8(filename);
+
+    std::auto_ptr<File> file;
+    const Resource* source = findInMountedArchives(filename);
+    if (!source)
+    {
+        file.reset(new File(filename));
+        source = file.get();
+    }
+    const std::size_t fileSize = source->size();
+    Reader reader = source->frontReader();
+
+    char magic[sizeof MAGIC];
+    if (fileSize < HEADER_SIZE)
+        throw std::runtime_error(invalid);
+    reader.read(magic, sizeof magic);
+    if (!std::equal(MAGIC, MAGIC + sizeof MAGIC, magic))
+        throw std::runtime_error(invalid);
+
+    UInt32 pageSize = reader.getPod<UInt32>(boLittle);
+    UInt32 pageCount = reader.getPod<UInt32>(boLittle);
+    UInt32 imageCount = reader.getPod<UInt32>(boLittle);
+    if (pageSize == 0 || pageSize > MAX_TEXTURE_SIZE ||
+            imageCount > (fileSize - HEADER_SIZE) / RECORD_SIZE)
+        throw std::runtime_error(invalid);
+
+    std::vector<BlockAllocator::Block> blocks(imageCount);
+    std::vector<UInt32> pages(imageCount);
+    pimpl->names.resize(imageCount);
+    for (UInt32 i = 0; i < imageCount; ++i)
+    {
+        if (fileSize - reader.position() < RECORD_SIZE)
+            throw std::runtime_error(invalid);
+        pages[i] = reader.getPod<UInt32>(boLittle);
+        BlockAllocator::Block& block = blocks[i];
+        block.left = reader.getPod<UInt32>(boLittle);
+        block.top = reader.getPod<UInt32>(boLittle);
+        block.width = reader.getPod<UInt32>(boLittle);
+        block.height = reader.getPod<UInt32>(boLittle);
+        UInt32 nameLength = reader.getPod<UInt32>(boLittle);
+        if (pages[i] >= pageCount || block.width < 2 || block.height < 2 ||
+                block.width > pageSize || block.left > pageSize - block.width ||
+                block.height > pageSize || block.top > pageSize - block.height ||
+                nameLength > fileSize - reader.position())
+            throw std::runtime_error(invalid);
+
+        std::string& name = pimpl->names[i];
+        name.resize(nameLength);
+        if (nameLength > 0)
+            reader.read(&name[0], nameLength);
+
+        // Lookups rely on the order.
+        if (i > 0 && !(pimpl->names[i - 1] < name))
+            throw std::runtime_error(invalid);
+    }
+
+    // Each page is uploaded at once, and its blocks are only reserved on
+    // the texture so that they are given back when the images go away.
+    pimpl->images.resize(imageCount);
+    Bitmap page(pageSize, pageSize);
+    std::vector<char> compressed;
+    for (UInt32 p = 0; p < pageCount; ++p)
+    {
+        if (fileSize - reader.position() < 4)
+            throw std::runtime_error(invalid);
+        UInt32 size = reader.getPod<UInt32>(boLittle);
+        if (size > fileSize - reader.position())
+            throw std::runtime_error(invalid);
+        const void* data = reader.view(size);
+        if (data)
+            reader.seek(size);
+        else
+        {
+            compressed.resize(size);
+            if (size > 0)
+                reader.read(&compressed[0], size);
+            data = compressed.empty() ? 0 : &compressed[0];
+        }
+        LZ4::decompress(data, size, page.data(),
+            static_cast<std::size_t>(pageSize) * pageSize * sizeof(Color));
+
+        std::tr1::shared_ptr<Texture> texture(new Texture(pageSize, false, false,
+            pixelFormat(formatFlags)));
+        pimpl->pages.push_back(texture);
+        GLFence fence = texture->upload(BlockAllocator::Block(0, 0, pageSize, pageSize), page);
+        TexChunk* last = 0;
+        for (UInt32 i = 0; i < imageCount; ++i)
+        {
+            if (pages[i] != p)
+                continue;
+            const BlockAllocator::Block& block = blocks[i];
+            texture->reserveBlock(block);
+            std::auto_ptr<TexChunk> chunk = graphics.createTexChunk(texture,
+                block.left + 1, block.top + 1, block.width - 2, block.height - 2, 1);
+            last = chunk.get();
+            pimpl->images[i].reset(new Image(std::auto_ptr<ImageData>(chunk)));
+        }
+        // Like with Font, the fence tells when the whole page has arrived.
+        if (last)
+            last->setUploadFence(fence);
+        else if (fence)
+            glSyncFunctions().deleteSync(fence);
+    }
+}
+
+Gosu::Atlas::~Atlas()
+{
+}
+
+std::size_t Gosu::Atlas::size() const
+{
+    return pimpl->names.size();
+}
+
+std::wstring Gosu::Atlas::name(std::size_t index) const
+{
+    return utf8ToWstring(pimpl->names.at(index));
+}
+
+const Gosu::Image* Gosu::Atlas::find(const std::wstring& name) const
+{
+    std::string normalized = normalize(name);
+    std::vector<std::string>::const_iterator it =
+        std::lower_bound(pimpl->names.begin(), pimpl->names.end(), normalized);
+    if (it == pimpl->names.end() || *it != normalized)
+        return 0;
+    return pimpl->images[it - pimpl->names.begin()].get();
+}
+
+const Gosu::Image& Gosu::Atlas::image(const std::wstring& name) const
+{
+    const Image* result = find(name);
+    if (!result)
+        throw std::runtime_error("Cannot find " + wstringToUTF8(name) + " in atlas");
+    return *result;
+}
+
+void Gosu::Atlas::saveMacro(const Image& macro, const std::wstring& filename) const
+{
+    const Macro* data = dynamic_cast<const Macro*>(&macro.getData());
+    if (!data)
+        throw std::invalid_argument("Only macros can be saved with an atlas");
+
+    Buffer buffer;
+    Writer writer = buffer.backWriter();
+    data->save(writer, pimpl->pages);
+    saveFileAtomically(buffer, filename);
+}
+
+std::auto_ptr<Gosu::ImageData> Gosu::Atlas::loadMacro(const std::wstring& filename) const
+{
+    std::auto_ptr<File> file;
+    const Resource* source = findInMountedArchives(filename);
+    if (!source)
+    {
+        file.reset(new File(filename));
+        source = file.get();
+    }
+    return pimpl->graphics->loadMacro(source->frontReader(), source->size(), pimpl->pages);
+}
+
+void Gosu::createAtlas(const std::wstring& filename,
+    const std::vector<std::wstring>& names, const std::wstring& directory,
+    unsigned pageSize)
+{
+    if (pageSize == 0 || pageSize > MAX_TEXTURE_SIZE)
+        throw std::invalid_argument("Invalid atlas page size");
+
+    std::wstring prefix = directory.empty() ? directory : directory + L"/";
+    std::vector<Sprite> sprites(names.size());
+    std::vector<Sprite*> order(names.size());
+    for (std::size_t i = 0; i < names.size(); ++i)
+    {
+        Sprite& sprite = sprites[i];
+        sprite.name = normalize(names[i]);
+        Bitmap bitmap;
+        loadImageFile(bitmap, prefix + names[i]);
+        applyBorderFlags(sprite.padded, bitmap, 0, 0, bitmap.width(), bitmap.height(),
+            bfSmooth);
+        if (sprite.padded.width() > pageSize || sprite.padded.height() > pageSize)
+            throw std::invalid_argument(sprite.name + " does not fit onto an atlas page");
+        order[i] = &sprite;
+    }
+
+    // The same packer that places images at runtime, but once per page and
+    // ahead of time.
+    std::sort(order.begin(), order.end(), packedBefore);
+    std::vector<std::tr1::shared_ptr<BlockAllocator> > allocators;
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        Sprite& sprite = *order[i];
+        unsigned width = sprite.padded.width(), height = sprite.padded.height();
+        for (sprite.page = 0; sprite.page < allocators.size(); ++sprite.page)
+            if (allocators[sprite.page]->alloc(width, height, sprite.block))
+                break;
+        if (sprite.page == allocators.size())
+        {
+            allocators.push_back(std::tr1::shared_ptr<BlockAllocator>(
+                new BlockAllocator(pageSize, pageSize)));
+            allocators.back()->alloc(width, height, sprite.block);
+        }
+    }
+
+    std::sort(order.begin(), order.end(), sortedBefore);
+    for (std::size_t i = 1; i < order.size(); ++i)
+        if (order[i - 1]->name == order[i]->name)
+            throw std::invalid_argument("Duplicate image name in atlas");
+
+    File out(filename, fmReplace);
+    Writer writer = out.backWriter();
+    writer.write(MAGIC, sizeof MAGIC);
+    writer.writePod<UInt32>(pageSize, boLittle);
+    writer.writePod<UInt32>(allocators.size(), boLittle);
+    writer.writePod<UInt32>(order.size(), boLittle);
+    for (std::size_t i = 0; i < order.size(); ++i)
+    {
+        const Sprite& sprite = *order[i];
+        writer.writePod<UInt32>(sprite.page, boLittle);
+        writer.writePod<UInt32>(sprite.block.left, boLittle);
+        writer.writePod<UInt32>(sprite.block.top, boLittle);
+        writer.writePod<UInt32>(sprite.block.width, boLittle);
+        writer.writePod<UInt32>(sprite.block.height, boLittle);
+        writer.writePod<UInt32>(sprite.name.size(), boLittle);
+        writer.write(sprite.name.data(), sprite.name.size());
+    }
+
+    std::vector<char> packed;
+    for (std::size_t p = 0; p < allocators.size(); ++p)
+    {
+        Bitmap page(pageSize, pageSize);
+        for (std::size_t i = 0; i < sprites.size(); ++i)
+            if (sprites[i].page == p)
+                page.insert(sprites[i].padded, sprites[i].block.left, sprites[i].block.top);
+        packed.clear();
+        LZ4::compress(page.data(),
+            static_cast<std::size_t>(pageSize) * pageSize * sizeof(Color), packed);
+        writer.writePod<UInt32>(packed.size(), boLittle);
+        writer.write(&packed[0], packed.size());
+    }
+}
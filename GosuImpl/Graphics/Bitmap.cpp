@@ -1,85 +1,156 @@
-#include <Gosu/Bitmap.hpp>
-#include <cassert>
-#include <algorithm>
-#include <vector>
-
-void Gosu::Bitmap::swap(Bitmap& other)
-{
-    std::swap(pixels, other.pixels);
-    std::swap(w, other.w);
-    std::swap(h, other.h);
-}
-
-void Gosu::Bitmap::resize(unsigned width, unsigned height, Color c)
-{
-    if (width == w && height == h)
-        return;
-    
-    Bitmap temp(width, height, c);
-    temp.insert(*this, 0, 0);
-    swap(temp);
-}
-
-void Gosu::Bitmap::fill(Color c)
-{
-    std::fill(pixels.begin(), pixels.end(), c);
-}
-
-void Gosu::Bitmap::replace(Color what, Color with)
-{
-    std::replace(pixels.begin(), pixels.end(), what, with);
-}
-
-void Gosu::Bitmap::insert(const Bitmap& source, int x, int y)
-{
-    insert(source, x, y, 0, 0, source.width(), source.height());
-}
-
-void Gosu::Bitmap::insert(const Bitmap& source, int x, int y, unsigned srcX,
-    unsigned srcY, unsigned srcWidth, unsigned srcHeight)
-{
-    if (x < 0)
-    {
-        unsigned clipLeft = -x;
-
-        if (clipLeft >= srcWidth)
-            return;
-
-        srcX += clipLeft;
-        srcWidth -= clipLeft;
-        x = 0;
-    }
-
-    if (y < 0)
-    {
-        unsigned clipTop = -y;
-
-        if (clipTop >= srcHeight)
-            return;
-
-        srcY += clipTop;
-        srcHeight -= clipTop;
-        y = 0;
-    }
-
-    if (x + srcWidth > w)
-    {
-        if (static_cast<unsigned>(x) >= w)
-            return;
-
-        srcWidth = w - x;
-    }
-
-    if (y + srcHeight > h)
-    {
-        if (static_cast<unsigned>(y) >= h)
-            return;
-
-        srcHeight = h - y;
-    }
-
-    for (unsigned relY = 0; relY < srcHeight; ++relY)
-        for (unsigned relX = 0; relX < srcWidth; ++relX)
-            setPixel(x + relX, y + relY,
-                source.getPixel(srcX + relX, srcY + relY));
-}
+#include <Gosu/Bitmap.hpp>
+#include <GosuImpl/Graphics/BitmapPool.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <cassert>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+void Gosu::Bitmap::swap(Bitmap& other)
+{
+    std::swap(pixels, other.pixels);
+    std::swap(w, other.w);
+    std::swap(h, other.h);
+}
+
+void Gosu::Bitmap::resize(unsigned width, unsigned height, Color c)
+{
+    if (width == w && height == h)
+        return;
+    
+    // Rearranged in place, so that shrinking keeps the memory and growing
+    // only allocates if the capacity is too small.
+    unsigned keptWidth = std::min(width, w), keptHeight = std::min(height, h);
+    std::size_t oldSize = pixels.size(), newSize = std::size_t(width) * height;
+    if (width <= w)
+    {
+        // Rows move towards the front, so they can be copied front to back.
+        if (width < w)
+            for (unsigned y = 1; y < keptHeight; ++y)
+                std::copy(pixels.begin() + y * w, pixels.begin() + y * w + width,
+                    pixels.begin() + y * width);
+        pixels.resize(newSize, c);
+    }
+    else
+    {
+        // Rows move towards the back, so the last one is moved first.
+        pixels.resize(newSize, c);
+        for (unsigned y = keptHeight; y-- > 0; )
+        {
+            std::copy_backward(pixels.begin() + y * w, pixels.begin() + y * w + keptWidth,
+                pixels.begin() + y * width + keptWidth);
+            std::fill(pixels.begin() + y * width + keptWidth,
+                pixels.begin() + (y + 1) * width, c);
+        }
+    }
+    // Whatever is left of the old pixels below the kept rows.
+    std::size_t stale = std::min(oldSize, newSize);
+    if (std::size_t(keptHeight) * width < stale)
+        std::fill(pixels.begin() + keptHeight * width, pixels.begin() + stale, c);
+    w = width;
+    h = height;
+}
+
+namespace
+{
+    // Deliberately never destroyed, since images may still be created
+    // during static destruction (e.g. in Ruby).
+    struct Pool
+    {
+        Gosu::Mutex mutex;
+        std::vector<Gosu::Bitmap> bitmaps;
+    };
+    Pool* const pool = new Pool;
+}
+
+void Gosu::takePooledBitmap(Bitmap& bitmap)
+{
+    Lock lock(pool->mutex);
+    if (pool->bitmaps.empty())
+        return;
+    bitmap.swap(pool->bitmaps.back());
+    pool->bitmaps.pop_back();
+}
+
+void Gosu::returnPooledBitmap(Bitmap& bitmap)
+{
+    // The size is the best guess at the capacity. A bitmap that was larger
+    // before it was shrunk slips through, which only costs memory.
+    if (std::size_t(bitmap.width()) * bitmap.height() > MAX_POOLED_PIXELS)
+        return;
+    bitmap.resize(0, 0);
+    
+    Lock lock(pool->mutex);
+    if (pool->bitmaps.size() == MAX_POOLED_BITMAPS)
+        return;
+    pool->bitmaps.push_back(Bitmap());
+    pool->bitmaps.back().swap(bitmap);
+}
+
+void Gosu::Bitmap::fill(Color c)
+{
+    std::fill(pixels.begin(), pixels.end(), c);
+}
+
+void Gosu::Bitmap::replace(Color what, Color with)
+{
+    std::replace(pixels.begin(), pixels.end(), what, with);
+}
+
+void Gosu::Bitmap::insert(const Bitmap& source, int x, int y)
+{
+    insert(source, x, y, 0, 0, source.width(), source.height());
+}
+
+void Gosu::Bitmap::insert(const Bitmap& source, int x, int y, unsigned srcX,
+    unsigned srcY, unsigned srcWidth, unsigned srcHeight)
+{
+    if (x < 0)
+    {
+        unsigned clipLeft = -x;
+
+        if (clipLeft >= srcWidth)
+            return;
+
+        srcX += clipLeft;
+        srcWidth -= clipLeft;
+        x = 0;
+    }
+
+    if (y < 0)
+    {
+        unsigned clipTop = -y;
+
+        if (clipTop >= srcHeight)
+            return;
+
+        srcY += clipTop;
+        srcHeight -= clipTop;
+        y = 0;
+    }
+
+    if (x + srcWidth > w)
+    {
+        if (static_cast<unsigned>(x) >= w)
+            return;
+
+        srcWidth = w - x;
+    }
+
+    if (y + srcHeight > h)
+    {
+        if (static_cast<unsigned>(y) >= h)
+            return;
+
+        srcHeight = h - y;
+    }
+
+    // Rows are contiguous in both bitmaps, so each clipped row is copied
+    // at once; with memmove, since a bitmap may be inserted into itself.
+    if (srcWidth == 0)
+        return;
+    for (unsigned relY = 0; relY < srcHeight; ++relY)
+        std::memmove(&pixels[(y + relY) * w + x],
+            &source.pixels[(srcY + relY) * source.w + srcX],
+            srcWidth * sizeof(Color));
+}
@@ -116,8 +116,18 @@ void Gosu::loadImageFile(Bitmap& bitmap, Reader reader)
     ObjRef<NSAutoreleasePool> pool([NSAutoreleasePool new]);
     
     std::size_t length = reader.resource().size() - reader.position();
-    ObjRef<NSMutableData> buffer([[NSMutableData alloc] initWithLength: length]);
-    reader.read([buffer.get() mutableBytes], length);
+    // The image is converted before this function returns, so the data can
+    // be used in place if the resource offers a view of it.
+    ObjRef<NSData> buffer;
+    if (const void* view = reader.view(length))
+        buffer.reset([[NSData alloc] initWithBytesNoCopy: const_cast<void*>(view)
+            length: length freeWhenDone: NO]);
+    else
+    {
+        NSMutableData* copy = [[NSMutableData alloc] initWithLength: length];
+        reader.read([copy mutableBytes], length);
+        buffer.reset(copy);
+    }
     
     ObjRef<APPLE_IMAGE> image([[APPLE_IMAGE alloc] initWithData: buffer.get()]);
     if (!image.get())
@@ -1,50 +1,81 @@
 #include <Gosu/Bitmap.hpp>
+#include <GosuImpl/Graphics/PixelKernels.hpp>
 #include <vector>
 
-void Gosu::applyColorKey(Bitmap& bitmap, Color key)
+namespace
 {
-    std::vector<Color> surroundingColors;
-    surroundingColors.reserve(4);
+    // 65536 / n, rounded up, so that (sum * reciprocals[n]) >> 16 equals
+    // sum / n for the sums of up to four channel values.
+    const unsigned reciprocals[5] = { 0, 65536, 32768, 21846, 16384 };
+}
 
-    for (unsigned y = 0; y < bitmap.height(); ++y)
-        for (unsigned x = 0; x < bitmap.width(); ++x)
-            if (bitmap.getPixel(x, y) == key)
+void Gosu::applyColorKey(Bitmap& bitmap, Color key)
+{
+    unsigned width = bitmap.width(), height = bitmap.height();
+    if (width * height == 0)
+        return;
+    
+    // First pass: Mark the pixels that are not the key, with a border of
+    // zeroes around the bitmap so that the second pass needs no special
+    // cases for the edges. Replaced pixels never count as neighbors, no
+    // matter in which order they are visited.
+    unsigned pitch = width + 2;
+    std::vector<unsigned char> opaque(pitch * (height + 2));
+    const Color* src = bitmap.data();
+    for (unsigned y = 0; y < height; ++y)
+    {
+        unsigned char* row = &opaque[(y + 1) * pitch + 1];
+        for (unsigned x = 0; x < width; ++x)
+            row[x] = src[y * width + x] != key;
+    }
+    
+    // Second pass: Replace each key pixel by the average of its opaque
+    // neighbors, made fully transparent.
+    Color* pixels = bitmap.data();
+    for (unsigned y = 0; y < height; ++y)
+    {
+        const unsigned char* row = &opaque[(y + 1) * pitch + 1];
+        const unsigned char* above = row - pitch;
+        const unsigned char* below = row + pitch;
+        Color* line = pixels + y * width;
+        // Out of range neighbors are never read because their weight is 0,
+        // but their addresses must exist; these point at the row itself.
+        const Color* lineAbove = y > 0 ? line - width : line;
+        const Color* lineBelow = y < height - 1 ? line + width : line;
+        
+        for (unsigned x = 0; x < width; ++x)
+        {
+            if (row[x])
+                continue;
+            
+            const unsigned char* here = row + x;
+            unsigned wLeft = here[-1], wRight = here[1];
+            unsigned wAbove = above[x], wBelow = below[x];
+            unsigned count = wLeft + wRight + wAbove + wBelow;
+            if (count == 0)
             {
-                surroundingColors.clear();
-                if (x > 0 && bitmap.getPixel(x - 1, y) != key)
-                    surroundingColors.push_back(bitmap.getPixel(x - 1, y));
-                if (x < bitmap.width() - 1 && bitmap.getPixel(x + 1, y) != key)
-                    surroundingColors.push_back(bitmap.getPixel(x + 1, y));
-                if (y > 0 && bitmap.getPixel(x, y - 1) != key)
-                    surroundingColors.push_back(bitmap.getPixel(x, y - 1));
-                if (y < bitmap.height() - 1 && bitmap.getPixel(x, y + 1) != key)
-                    surroundingColors.push_back(bitmap.getPixel(x, y + 1));
-
-                if (surroundingColors.empty())
-                {
-                    bitmap.setPixel(x, y, Color::NONE);
-                    continue;
-                }
-
-                unsigned red = 0, green = 0, blue = 0;
-                for (unsigned i = 0; i < surroundingColors.size(); ++i)
-                {
-                    red += surroundingColors[i].red();
-                    green += surroundingColors[i].green();
-                    blue += surroundingColors[i].blue();
-                }
-                bitmap.setPixel(x, y, Color(0, red / surroundingColors.size(),
-                    green / surroundingColors.size(), blue / surroundingColors.size()));
+                line[x] = Color::NONE;
+                continue;
             }
+            
+            Color left = line[x - wLeft], right = line[x + wRight];
+            Color up = lineAbove[x], down = lineBelow[x];
+            unsigned red = wLeft * left.red() + wRight * right.red() +
+                wAbove * up.red() + wBelow * down.red();
+            unsigned green = wLeft * left.green() + wRight * right.green() +
+                wAbove * up.green() + wBelow * down.green();
+            unsigned blue = wLeft * left.blue() + wRight * right.blue() +
+                wAbove * up.blue() + wBelow * down.blue();
+            unsigned reciprocal = reciprocals[count];
+            line[x] = Color(0, red * reciprocal >> 16, green * reciprocal >> 16,
+                blue * reciprocal >> 16);
+        }
+    }
 }
 
 void Gosu::unapplyColorKey(Bitmap& bitmap, Color color)
 {
-    Color* p = bitmap.data();
-    for (int i = bitmap.width() * bitmap.height(); i > 0; --i, ++p)
-        if (p->alpha() == 0)
-            *p = color;
-        else
-            p->setAlpha(255);
+    if (bitmap.width() * bitmap.height() > 0)
+        Pixels::unapplyColorKey(bitmap.data(), bitmap.width() * bitmap.height(), color);
 }
 
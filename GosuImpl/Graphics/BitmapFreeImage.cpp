@@ -3,8 +3,10 @@
 #include <Gosu/Platform.hpp>
 #include <Gosu/TR1.hpp>
 #include <Gosu/Utility.hpp>
+#include <GosuImpl/Graphics/BitmapPool.hpp>
+#include <GosuImpl/Graphics/PixelKernels.hpp>
+#include <algorithm>
 #include <stdexcept>
-#include <vector>
 #include <FreeImage.h>
 
 // Compatibility with FreeImage <3.1.3. Subtly changes Gosu's behavior though.
@@ -28,9 +30,8 @@ namespace
     {
         // Since FreeImage gracefully ignores the MASK parameters above, we
         // manually exchange the R and B channels.
-        std::tr1::uint32_t* p = reinterpret_cast<std::tr1::uint32_t*>(bitmap.data());
-        for (int i = bitmap.width() * bitmap.height(); i > 0; --i, ++p)
-            *p = (*p & 0xff00ff00) | ((*p << 16) & 0x00ff0000) | ((*p >> 16) & 0x000000ff);
+        if (bitmap.width() * bitmap.height() > 0)
+            Gosu::Pixels::swapRedAndBlue(bitmap.data(), bitmap.width() * bitmap.height());
     }
 
     FIBITMAP* ensure32bits(FIBITMAP* fib)
@@ -49,17 +50,36 @@ namespace
     {
         bitmap.resize(FreeImage_GetWidth(fib), FreeImage_GetHeight(fib));
         fib = ensure32bits(fib);
-        FreeImage_ConvertToRawBits(reinterpret_cast<BYTE*>(bitmap.data()),
-            fib, bitmap.width() * 4, 32,
-            FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, TRUE);
-        FreeImage_Unload(fib);
-        reshuffleBitmap(bitmap);
+        if (FreeImage_GetImageType(fib) == FIT_BITMAP && FreeImage_GetBPP(fib) == 32)
+        {
+            // Rows are stored bottom-up; each is flipped into place and
+            // has its channels exchanged in the same pass.
+            unsigned width = bitmap.width(), height = bitmap.height();
+            for (unsigned y = 0; y < height; ++y)
+                Gosu::Pixels::swapRedAndBlue(bitmap.data() + y * width,
+                    reinterpret_cast<const Gosu::Color*>(FreeImage_GetScanLine(fib, height - 1 - y)),
+                    width);
+            FreeImage_Unload(fib);
+        }
+        else
+        {
+            FreeImage_ConvertToRawBits(reinterpret_cast<BYTE*>(bitmap.data()),
+                fib, bitmap.width() * 4, 32,
+                FI_RGBA_RED_MASK, FI_RGBA_GREEN_MASK, FI_RGBA_BLUE_MASK, TRUE);
+            FreeImage_Unload(fib);
+            reshuffleBitmap(bitmap);
+        }
         if (fif == FIF_BMP)
             Gosu::applyColorKey(bitmap, Gosu::Color::FUCHSIA);
     }
     
-    FIBITMAP* bitmapToFIB(Gosu::Bitmap bitmap, FREE_IMAGE_FORMAT fif)
+    FIBITMAP* bitmapToFIB(const Gosu::Bitmap& source, FREE_IMAGE_FORMAT fif)
     {
+        // FreeImage copies the pixels anyway, so they are rearranged in
+        // a pooled bitmap.
+        Gosu::ScratchBitmap scratch;
+        Gosu::Bitmap& bitmap = *scratch;
+        bitmap = source;
         reshuffleBitmap(bitmap);
         if (fif == FIF_BMP)
             unapplyColorKey(bitmap, Gosu::Color::FUCHSIA);
@@ -90,6 +110,35 @@ namespace
         return ((Gosu::Writer*)handle)->position();
     }
     
+    // Wrap Gosu::Reader as a FreeImageIO, for resources that cannot offer
+    // a view. Reads are cut off at the end of the resource.
+    unsigned DLL_CALLCONV ReaderReadProc(void *buffer, unsigned size, unsigned count, fi_handle handle)
+    {
+        Gosu::Reader& reader = *(Gosu::Reader*)handle;
+        std::size_t left = reader.position() < reader.resource().size() ?
+            reader.resource().size() - reader.position() : 0;
+        if (size == 0)
+            return 0;
+        count = static_cast<unsigned>(std::min<std::size_t>(count, left / size));
+        reader.read(buffer, size * count);
+        return count;
+    }
+    int DLL_CALLCONV ReaderSeekProc(fi_handle handle, long offset, int origin)
+    {
+        Gosu::Reader& reader = *(Gosu::Reader*)handle;
+        switch (origin)
+        {
+        case SEEK_SET: reader.setPosition(offset); break;
+        case SEEK_CUR: reader.seek(offset); break;
+        case SEEK_END: reader.setPosition(reader.resource().size() + offset); break;
+        };
+        return 0;
+    }
+    long DLL_CALLCONV ReaderTellProc(fi_handle handle)
+    {
+        return ((Gosu::Reader*)handle)->position();
+    }
+    
     // TODO: This is not thread safe!
     
     std::string lastFreeImageError;
@@ -134,12 +183,26 @@ namespace Gosu
 
     void FI(loadImageFile)(Bitmap& bitmap, Gosu::Reader input)
     {
-        // Read all available input
-        std::vector<BYTE> data(input.resource().size() - input.position());
-        input.read(&data[0], data.size());
-        FIMEMORY* fim = FreeImage_OpenMemory(&data[0], data.size());
-        FREE_IMAGE_FORMAT fif = FreeImage_GetFileTypeFromMemory(fim);
-        FIBITMAP* fib = FreeImage_LoadFromMemory(fif, fim, GOSU_FIFLAGS);
+        // Decode the rest of the input where it is if the resource allows it
+        // (mapped files, buffers); otherwise, FreeImage reads from it
+        // piece by piece, without a copy of the whole input.
+        std::size_t length = input.resource().size() - input.position();
+        BYTE* bytes = static_cast<BYTE*>(const_cast<void*>(input.view(length)));
+        FREE_IMAGE_FORMAT fif;
+        FIBITMAP* fib;
+        if (bytes)
+        {
+            FIMEMORY* fim = FreeImage_OpenMemory(bytes, length);
+            fif = FreeImage_GetFileTypeFromMemory(fim);
+            fib = FreeImage_LoadFromMemory(fif, fim, GOSU_FIFLAGS);
+            FreeImage_CloseMemory(fim);
+        }
+        else
+        {
+            FreeImageIO fio = { ReaderReadProc, NULL, ReaderSeekProc, ReaderTellProc };
+            fif = FreeImage_GetFileTypeFromHandle(&fio, &input);
+            fib = FreeImage_LoadFromHandle(fif, &fio, &input, GOSU_FIFLAGS);
+        }
         checkForFreeImageErrors(fib);
         fibToBitmap(bitmap, fib, fif);
     }
@@ -0,0 +1,35 @@
+#ifndef GOSUIMPL_GRAPHICS_BITMAPPOOL_HPP
+#define GOSUIMPL_GRAPHICS_BITMAPPOOL_HPP
+
+#include <Gosu/Bitmap.hpp>
+
+namespace Gosu
+{
+    // Bitmaps whose memory is kept around for temporary pixels, like the
+    // padded copy of an image on its way to a texture, so that creating
+    // images and text does not allocate every time. Bitmaps are handed out
+    // empty but with the capacity they had before; bitmaps above
+    // MAX_POOLED_PIXELS are freed instead of being kept. Thread-safe.
+    enum { MAX_POOLED_BITMAPS = 8, MAX_POOLED_PIXELS = 1024 * 1024 };
+    void takePooledBitmap(Bitmap& bitmap);
+    void returnPooledBitmap(Bitmap& bitmap);
+
+    // A bitmap from the pool for as long as it lives. Starts out empty, so
+    // it needs to be resized (or filled by something like applyBorderFlags).
+    class ScratchBitmap
+    {
+        ScratchBitmap(const ScratchBitmap&);
+        ScratchBitmap& operator=(const ScratchBitmap&);
+
+        Bitmap bitmap;
+
+    public:
+        ScratchBitmap() { takePooledBitmap(bitmap); }
+        ~ScratchBitmap() { returnPooledBitmap(bitmap); }
+
+        Bitmap& operator*() { return bitmap; }
+        Bitmap* operator->() { return &bitmap; }
+    };
+}
+
+#endif
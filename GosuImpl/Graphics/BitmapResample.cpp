@@ -0,0 +1,195 @@
+#include <Gosu/Bitmap.hpp>
+#include <GosuImpl/Graphics/BitmapView.hpp>
+#include <Gosu/TR1.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Resampling is separable: Each row is first resampled horizontally, and
+// the results are then combined vertically. Both passes work on colors
+// multiplied by alpha, so that transparent pixels do not darken their
+// neighbors, and in fixed point with weights that add up to 65536. The
+// inner loop of the vertical pass runs over whole rows and is left to the
+// compiler's vectorizer.
+
+namespace
+{
+    typedef std::tr1::uint32_t UInt32;
+    typedef std::tr1::uint16_t UInt16;
+
+    enum { ONE = 65536 };
+
+    struct Tap
+    {
+        unsigned index, weight;
+        Tap(unsigned index, unsigned weight) : index(index), weight(weight) {}
+    };
+
+    // For each pixel of the result along one axis, the source pixels that
+    // it is made of.
+    struct Axis
+    {
+        // Taps of pixel i are taps[begin[i]] to taps[begin[i + 1] - 1].
+        std::vector<std::size_t> begin;
+        std::vector<Tap> taps;
+
+        void add(unsigned index, unsigned weight)
+        {
+            if (weight == 0)
+                return;
+            if (taps.size() > begin.back() && taps.back().index == index)
+                taps.back().weight += weight;
+            else
+                taps.push_back(Tap(index, weight));
+        }
+
+        Axis(unsigned srcSize, unsigned size, Gosu::ResampleFilter filter)
+        {
+            double scale = double(srcSize) / size;
+            for (unsigned i = 0; i < size; ++i)
+            {
+                begin.push_back(taps.size());
+                if (filter == Gosu::rfBox)
+                {
+                    // Each source pixel counts with the part of it that is
+                    // covered. Rounding the cumulative coverage keeps the
+                    // sum of the weights exact.
+                    double start = i * scale, end = (i + 1) * scale;
+                    unsigned first = static_cast<unsigned>(start);
+                    unsigned last = std::min(srcSize - 1, static_cast<unsigned>(std::ceil(end)) - 1);
+                    unsigned covered = 0;
+                    for (unsigned j = first; j <= last; ++j)
+                    {
+                        double until = std::min(end, j + 1.0) - start;
+                        unsigned total = j == last ? unsigned(ONE) :
+                            static_cast<unsigned>(until / (end - start) * ONE + 0.5);
+                        add(j, total - covered);
+                        covered = total;
+                    }
+                }
+                else
+                {
+                    double center = (i + 0.5) * scale - 0.5;
+                    double floor = std::floor(center);
+                    unsigned weight = static_cast<unsigned>((center - floor) * ONE + 0.5);
+                    int left = static_cast<int>(floor), right = left + 1;
+                    int maxIndex = static_cast<int>(srcSize) - 1;
+                    add(std::max(0, std::min(left, maxIndex)), ONE - weight);
+                    add(std::max(0, std::min(right, maxIndex)), weight);
+                }
+            }
+            begin.push_back(taps.size());
+        }
+    };
+
+    // Resamples a row horizontally into r * a, g * a, b * a and 255 * a
+    // per pixel, each fitting into 16 bits.
+    void resampleRow(const Gosu::Color* source, const Axis& axis, unsigned width,
+        std::vector<UInt32>& premultiplied, UInt16* out)
+    {
+        for (std::size_t i = 0; i < premultiplied.size() / 4; ++i)
+        {
+            unsigned alpha = source[i].alpha();
+            premultiplied[i * 4 + 0] = source[i].red() * alpha;
+            premultiplied[i * 4 + 1] = source[i].green() * alpha;
+            premultiplied[i * 4 + 2] = source[i].blue() * alpha;
+            premultiplied[i * 4 + 3] = 255 * alpha;
+        }
+
+        for (unsigned x = 0; x < width; ++x)
+        {
+            UInt32 sums[4] = { ONE / 2, ONE / 2, ONE / 2, ONE / 2 };
+            for (std::size_t t = axis.begin[x]; t < axis.begin[x + 1]; ++t)
+            {
+                const UInt32* pixel = &premultiplied[axis.taps[t].index * 4];
+                UInt32 weight = axis.taps[t].weight;
+                for (int c = 0; c < 4; ++c)
+                    sums[c] += pixel[c] * weight;
+            }
+            for (int c = 0; c < 4; ++c)
+                out[x * 4 + c] = static_cast<UInt16>(sums[c] >> 16);
+        }
+    }
+}
+
+void Gosu::resample(Bitmap& dest, const Bitmap& source,
+    unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
+    unsigned width, unsigned height, ResampleFilter filter)
+{
+    // Written into dest right away unless it is the source, so that its
+    // memory is reused.
+    Bitmap temp;
+    Bitmap& result = &dest == &source ? temp : dest;
+    result.resize(0, 0);
+    result.resize(width, height);
+    if (width * height == 0 || srcWidth * srcHeight == 0)
+    {
+        if (&result == &temp)
+            dest.swap(temp);
+        return;
+    }
+    if (width == srcWidth && height == srcHeight)
+    {
+        result.insert(source, 0, 0, srcX, srcY, srcWidth, srcHeight);
+        if (&result == &temp)
+            dest.swap(temp);
+        return;
+    }
+
+    BitmapView view(source, srcX, srcY, srcWidth, srcHeight);
+    Axis horizontal(srcWidth, width, filter), vertical(srcHeight, height, filter);
+
+    // Horizontally resampled rows, computed when they are first needed and
+    // dropped once no row of the result needs them anymore.
+    std::vector<std::vector<UInt16> > rows(srcHeight);
+    std::vector<UInt32> premultiplied(srcWidth * 4), sums(width * 4);
+    Color* out = result.data();
+    for (unsigned y = 0; y < height; ++y)
+    {
+        std::fill(sums.begin(), sums.end(), static_cast<UInt32>(ONE / 2));
+        for (std::size_t t = vertical.begin[y]; t < vertical.begin[y + 1]; ++t)
+        {
+            unsigned index = vertical.taps[t].index;
+            std::vector<UInt16>& row = rows[index];
+            if (row.empty())
+            {
+                row.resize(width * 4);
+                resampleRow(view.row(index), horizontal, width, premultiplied, &row[0]);
+            }
+
+            const UInt16* in = &row[0];
+            UInt32 weight = vertical.taps[t].weight;
+            UInt32* acc = &sums[0];
+            for (unsigned i = 0; i < width * 4; ++i)
+                acc[i] += in[i] * weight;
+        }
+        if (y + 1 < height)
+            for (unsigned i = vertical.taps[vertical.begin[y]].index;
+                    i < vertical.taps[vertical.begin[y + 1]].index; ++i)
+                std::vector<UInt16>().swap(rows[i]);
+
+        for (unsigned x = 0; x < width; ++x)
+        {
+            const UInt32* pixel = &sums[x * 4];
+            UInt32 alpha = pixel[3] >> 16;
+            if (alpha == 0)
+            {
+                *out++ = Color::NONE;
+                continue;
+            }
+            Color c((alpha + 127) / 255,
+                std::min<UInt32>(255, ((pixel[0] >> 16) * 255 + alpha / 2) / alpha),
+                std::min<UInt32>(255, ((pixel[1] >> 16) * 255 + alpha / 2) / alpha),
+                std::min<UInt32>(255, ((pixel[2] >> 16) * 255 + alpha / 2) / alpha));
+            *out++ = c;
+        }
+    }
+    if (&result == &temp)
+        dest.swap(temp);
+}
+
+void Gosu::resample(Bitmap& dest, const Bitmap& source,
+    unsigned width, unsigned height, ResampleFilter filter)
+{
+    resample(dest, source, 0, 0, source.width(), source.height(), width, height, filter);
+}
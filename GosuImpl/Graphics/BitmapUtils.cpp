@@ -2,6 +2,7 @@
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/IO.hpp>
 #include <Gosu/Platform.hpp>
+#include <algorithm>
 
 Gosu::Reader Gosu::loadFromPNG(Bitmap& bitmap, Reader reader)
 {
@@ -37,39 +38,44 @@ void Gosu::applyBorderFlags(Bitmap& dest, const Bitmap& source,
     dest.resize(srcWidth + 2, srcHeight + 2);
 
     // The borders are made "harder" by duplicating the original bitmap's
-    // borders.
+    // borders, and are transparent otherwise. dest may be reused, so they
+    // are cleared either way.
+    bool top = (borderFlags & bfTileableTop) != 0;
+    bool bottom = (borderFlags & bfTileableBottom) != 0;
+    bool left = (borderFlags & bfTileableLeft) != 0;
+    bool right = (borderFlags & bfTileableRight) != 0;
+    unsigned lastX = dest.width() - 1, lastY = dest.height() - 1;
+    Color* pixels = dest.data();
 
     // Top.
-    if (borderFlags & bfTileableTop)
+    if (top)
         dest.insert(source, 1, 0, srcX, srcY, srcWidth, 1);
+    else
+        std::fill(pixels, pixels + dest.width(), Color::NONE);
     // Bottom.
-    if (borderFlags & bfTileableBottom)
-        dest.insert(source, 1, dest.height() - 1,
-            srcX, srcY + srcHeight - 1, srcWidth, 1);
-    // Left.
-    if (borderFlags & bfTileableLeft)
-        dest.insert(source, 0, 1, srcX, srcY, 1, srcHeight);
-    // Right.
-    if (borderFlags & bfTileableRight)
-        dest.insert(source, dest.width() - 1, 1, 
-            srcX + srcWidth - 1, srcY, 1, srcHeight);
+    if (bottom)
+        dest.insert(source, 1, lastY, srcX, srcY + srcHeight - 1, srcWidth, 1);
+    else
+        std::fill(pixels + lastY * dest.width(), pixels + dest.width() * dest.height(),
+            Color::NONE);
+    // Left and right.
+    for (unsigned y = 1; y < lastY; ++y)
+    {
+        pixels[y * dest.width()] = left ?
+            source.getPixel(srcX, srcY + y - 1) : Color::NONE;
+        pixels[y * dest.width() + lastX] = right ?
+            source.getPixel(srcX + srcWidth - 1, srcY + y - 1) : Color::NONE;
+    }
 
-    // Top left.
-    if ((borderFlags & bfTileableTop) && (borderFlags & bfTileableLeft))
-        dest.setPixel(0, 0,
-            source.getPixel(srcX, srcY));
-    // Top right.
-    if ((borderFlags & bfTileableTop) && (borderFlags & bfTileableRight))
-        dest.setPixel(dest.width() - 1, 0,
-            source.getPixel(srcX + srcWidth - 1, srcY));
-    // Bottom left.
-    if ((borderFlags & bfTileableBottom) && (borderFlags & bfTileableLeft))
-        dest.setPixel(0, dest.height() - 1,
-            source.getPixel(srcX, srcY + srcHeight - 1));
-    // Bottom right.
-    if ((borderFlags & bfTileableBottom) && (borderFlags & bfTileableRight))
-        dest.setPixel(dest.width() - 1, dest.height() - 1,
-            source.getPixel(srcX + srcWidth - 1, srcY + srcHeight - 1));
+    // Corners, only if both of their sides are tileable.
+    dest.setPixel(0, 0, top && left ?
+        source.getPixel(srcX, srcY) : Color::NONE);
+    dest.setPixel(lastX, 0, top && right ?
+        source.getPixel(srcX + srcWidth - 1, srcY) : Color::NONE);
+    dest.setPixel(0, lastY, bottom && left ?
+        source.getPixel(srcX, srcY + srcHeight - 1) : Color::NONE);
+    dest.setPixel(lastX, lastY, bottom && right ?
+        source.getPixel(srcX + srcWidth - 1, srcY + srcHeight - 1) : Color::NONE);
 
     // Now put the final image into the prepared borders.
     dest.insert(source, 1, 1, srcX, srcY, srcWidth, srcHeight);
@@ -0,0 +1,66 @@
+#ifndef GOSUIMPL_GRAPHICS_BITMAPVIEW_HPP
+#define GOSUIMPL_GRAPHICS_BITMAPVIEW_HPP
+
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/Color.hpp>
+#include <algorithm>
+#include <cassert>
+
+namespace Gosu
+{
+    // A rectangle of pixels inside a Bitmap that it does not own, so that
+    // parts of a bitmap can be passed on without copying them. Rows are
+    // pitch pixels apart. Only valid as long as the bitmap is not changed.
+    class BitmapView
+    {
+        const Color* pixels_;
+        unsigned width_, height_, pitch_;
+
+    public:
+        BitmapView(const Bitmap& bitmap)
+        : pixels_(bitmap.width() * bitmap.height() ? bitmap.data() : 0),
+          width_(bitmap.width()), height_(bitmap.height()), pitch_(bitmap.width())
+        {
+        }
+
+        BitmapView(const Bitmap& bitmap, unsigned x, unsigned y,
+            unsigned width, unsigned height)
+        : pixels_(width * height ? bitmap.data() + y * bitmap.width() + x : 0),
+          width_(width), height_(height), pitch_(bitmap.width())
+        {
+            assert(x + width <= bitmap.width() && y + height <= bitmap.height());
+        }
+
+        unsigned width() const { return width_; }
+        unsigned height() const { return height_; }
+        unsigned pitch() const { return pitch_; }
+
+        // Whether the rows follow each other without gaps, i.e. the pixels
+        // can be handed to OpenGL as they are.
+        bool contiguous() const { return pitch_ == width_ || height_ <= 1; }
+
+        const Color* row(unsigned y) const { return pixels_ + y * pitch_; }
+        Color getPixel(unsigned x, unsigned y) const { return pixels_[y * pitch_ + x]; }
+
+        // Only call if contiguous() or if the rows are read with pitch().
+        const Color* data() const { return pixels_; }
+
+        // Resizes dest to the size of the view, using the memory it already
+        // has if it can.
+        void copyTo(Bitmap& dest) const
+        {
+            dest.resize(width_, height_);
+            for (unsigned y = 0; y < height_; ++y)
+                std::copy(row(y), row(y) + width_, dest.data() + y * width_);
+        }
+
+        Bitmap toBitmap() const
+        {
+            Bitmap result;
+            copyTo(result);
+            return result;
+        }
+    };
+}
+
+#endif
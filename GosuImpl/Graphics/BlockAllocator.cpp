@@ -1,46 +1,224 @@
 #include <GosuImpl/Graphics/BlockAllocator.hpp>
+#include <algorithm>
+#include <map>
 #include <stdexcept>
+#include <utility>
 #include <vector>
 
+// Skyline packer: The upper edge of all space ever allocated is kept as a list
+// of horizontal segments, and new blocks are placed as low as possible on top
+// of it. Freed blocks go into a list of free rectangles that is searched first
+// and is merged whenever two free rectangles share an edge. Free space that
+// touches the skyline is given back to it.
+
 struct Gosu::BlockAllocator::Impl
 {
     unsigned width, height;
 
-    typedef std::vector<Block> Blocks;
+    // All allocated blocks by their top left corner.
+    typedef std::map<std::pair<unsigned, unsigned>, Block> Blocks;
     Blocks blocks;
-    unsigned firstX, firstY;
+
+    struct Segment
+    {
+        unsigned x, y, width;
+        Segment(unsigned x, unsigned y, unsigned width) : x(x), y(y), width(width) {}
+    };
+    typedef std::vector<Segment> Skyline;
+    Skyline skyline;
+
+    typedef std::vector<Block> FreeRects;
+    FreeRects freeRects;
+
     unsigned maxW, maxH;
-    
-    void markBlockUsed(const Block& block, unsigned aWidth, unsigned aHeight)
+    unsigned long usedArea;
+
+    // Returns the lowest y at which a block of the given width fits on the
+    // skyline starting at segment i, or height if there is none.
+    unsigned fitOnSkyline(std::size_t i, unsigned aWidth) const
     {
-        firstX += aWidth;
-        if (firstX + aWidth >= width)
+        unsigned x = skyline[i].x;
+        if (x + aWidth > width)
+            return height;
+
+        unsigned y = 0;
+        for (unsigned remaining = aWidth; remaining > 0; ++i)
         {
-            firstX = 0;
-            firstY += aHeight;
+            y = std::max(y, skyline[i].y);
+            if (skyline[i].width >= remaining)
+                break;
+            remaining -= skyline[i].width;
         }
-        blocks.push_back(block);
+        return y;
     }
 
-    bool isBlockFree(const Block& block) const
+    bool allocOnSkyline(unsigned aWidth, unsigned aHeight, Block& b)
     {
-        // (The right-th column and the bottom-th row are outside of the block.)
-        unsigned right = block.left + block.width;
-        unsigned bottom = block.top + block.height;
-
-        // Block isn't valid.
-        if (right > width || bottom > height)
+        // Bottom-left rule: Lowest top edge first, then the leftmost.
+        std::size_t bestIndex = skyline.size();
+        unsigned bestY = height;
+        for (std::size_t i = 0; i < skyline.size(); ++i)
+        {
+            unsigned y = fitOnSkyline(i, aWidth);
+            if (y + aHeight <= height && y < bestY)
+                bestIndex = i, bestY = y;
+        }
+        if (bestIndex == skyline.size())
             return false;
 
-        // Test if the block collides with any existing rects.
-        Blocks::const_iterator i, end = blocks.end();
-        for (i = blocks.begin(); i != end; ++i)
-            if (i->left < right && block.left < i->left + i->width &&
-                i->top < bottom && block.top < i->top + i->height)
+        b = Block(skyline[bestIndex].x, bestY, aWidth, aHeight);
+        raiseSkyline(b);
+        return true;
+    }
+
+    // Splits segments so that one starts at x, if x is inside the texture.
+    std::size_t splitSkylineAt(unsigned x)
+    {
+        std::size_t i = 0;
+        while (i < skyline.size() && skyline[i].x + skyline[i].width <= x)
+            ++i;
+        if (i < skyline.size() && skyline[i].x < x)
+        {
+            Segment right(x, skyline[i].y, skyline[i].x + skyline[i].width - x);
+            skyline[i].width = x - skyline[i].x;
+            skyline.insert(skyline.begin() + ++i, right);
+        }
+        return i;
+    }
+
+    // Sets the skyline to y across the horizontal span of the block.
+    void setSkyline(unsigned left, unsigned right, unsigned y)
+    {
+        std::size_t first = splitSkylineAt(left);
+        std::size_t last = splitSkylineAt(right);
+        skyline.erase(skyline.begin() + first, skyline.begin() + last);
+        skyline.insert(skyline.begin() + first, Segment(left, y, right - left));
+
+        // Merge neighbors of equal height.
+        for (std::size_t i = 1; i < skyline.size(); )
+            if (skyline[i - 1].y == skyline[i].y)
             {
+                skyline[i - 1].width += skyline[i].width;
+                skyline.erase(skyline.begin() + i);
+            }
+            else
+                ++i;
+    }
+
+    void raiseSkyline(const Block& b)
+    {
+        // Space below the new block that the skyline passes over is lost to
+        // the skyline, so remember it as free space.
+        unsigned right = b.left + b.width;
+        FreeRects gaps;
+        for (std::size_t i = 0; i < skyline.size(); ++i)
+        {
+            const Segment& s = skyline[i];
+            unsigned segLeft = std::max(s.x, b.left);
+            unsigned segRight = std::min(s.x + s.width, right);
+            if (segLeft < segRight && s.y < b.top)
+                gaps.push_back(Block(segLeft, s.y, segRight - segLeft, b.top - s.y));
+        }
+        setSkyline(b.left, right, b.top + b.height);
+        for (FreeRects::const_iterator it = gaps.begin(); it != gaps.end(); ++it)
+            addFreeRect(*it);
+    }
+
+    // Gives free space back to the skyline if nothing is above it.
+    bool lowerSkyline(const Block& b)
+    {
+        unsigned right = b.left + b.width;
+        for (std::size_t i = 0; i < skyline.size(); ++i)
+        {
+            const Segment& s = skyline[i];
+            if (s.x < right && b.left < s.x + s.width && s.y != b.top + b.height)
                 return false;
+        }
+        setSkyline(b.left, right, b.top);
+        return true;
+    }
+
+    static bool tryMerge(Block& a, const Block& b)
+    {
+        if (a.top == b.top && a.height == b.height)
+        {
+            if (a.left + a.width == b.left)
+                return a.width += b.width, true;
+            if (b.left + b.width == a.left)
+                return a.left = b.left, a.width += b.width, true;
+        }
+        if (a.left == b.left && a.width == b.width)
+        {
+            if (a.top + a.height == b.top)
+                return a.height += b.height, true;
+            if (b.top + b.height == a.top)
+                return a.top = b.top, a.height += b.height, true;
+        }
+        return false;
+    }
+
+    void addFreeRect(Block rect)
+    {
+        // Merge with neighbors until nothing changes anymore.
+        for (bool merged = true; merged; )
+        {
+            merged = false;
+
+            if (lowerSkyline(rect))
+            {
+                // The skyline may now touch other free rects too.
+                for (std::size_t i = 0; i < freeRects.size(); ++i)
+                    if (lowerSkyline(freeRects[i]))
+                    {
+                        freeRects.erase(freeRects.begin() + i);
+                        i = static_cast<std::size_t>(-1);
+                    }
+                return;
             }
 
+            for (FreeRects::iterator it = freeRects.begin(); it != freeRects.end(); ++it)
+                if (tryMerge(rect, *it))
+                {
+                    freeRects.erase(it);
+                    merged = true;
+                    break;
+                }
+        }
+        freeRects.push_back(rect);
+    }
+
+    bool allocFromFreeRects(unsigned aWidth, unsigned aHeight, Block& b)
+    {
+        // Best fit: The free rect that leaves the least area unused.
+        FreeRects::iterator best = freeRects.end();
+        for (FreeRects::iterator it = freeRects.begin(); it != freeRects.end(); ++it)
+            if (it->width >= aWidth && it->height >= aHeight &&
+                (best == freeRects.end() || it->width * it->height < best->width * best->height))
+                best = it;
+        if (best == freeRects.end())
+            return false;
+
+        Block rect = *best;
+        freeRects.erase(best);
+        b = Block(rect.left, rect.top, aWidth, aHeight);
+
+        // Guillotine split along the shorter leftover axis so that the
+        // larger remaining piece stays as big as possible.
+        unsigned restW = rect.width - aWidth, restH = rect.height - aHeight;
+        if (restW < restH)
+        {
+            if (restW)
+                addFreeRect(Block(rect.left + aWidth, rect.top, restW, aHeight));
+            if (restH)
+                addFreeRect(Block(rect.left, rect.top + aHeight, rect.width, restH));
+        }
+        else
+        {
+            if (restW)
+                addFreeRect(Block(rect.left + aWidth, rect.top, restW, rect.height));
+            if (restH)
+                addFreeRect(Block(rect.left, rect.top + aHeight, aWidth, restH));
+        }
         return true;
     }
 };
@@ -51,11 +229,11 @@ Gosu::BlockAllocator::BlockAllocator(unsigned width, unsigned height)
     pimpl->width = width;
     pimpl->height = height;
 
-    pimpl->firstX = 0;
-    pimpl->firstY = 0;
+    pimpl->skyline.push_back(Impl::Segment(0, 0, width));
 
     pimpl->maxW = width;
     pimpl->maxH = height;
+    pimpl->usedArea = 0;
 }
 
 Gosu::BlockAllocator::~BlockAllocator()
@@ -81,57 +259,78 @@ bool Gosu::BlockAllocator::alloc(unsigned aWidth, unsigned aHeight, Block& b)
     // We know there's no space left.
     if (aWidth > pimpl->maxW && aHeight > pimpl->maxH)
         return false;
-    
-    // Start to look for a place next to the last returned rect. Chances are
-    // good we'll find a place there.
-    b = Block(pimpl->firstX, pimpl->firstY, aWidth, aHeight);
-    if (pimpl->isBlockFree(b))
+
+    if (pimpl->allocFromFreeRects(aWidth, aHeight, b) ||
+        pimpl->allocOnSkyline(aWidth, aHeight, b))
     {
-        pimpl->markBlockUsed(b, aWidth, aHeight);
+        pimpl->blocks[std::make_pair(b.left, b.top)] = b;
+        pimpl->usedArea += static_cast<unsigned long>(b.width) * b.height;
         return true;
     }
 
-    // Brute force: Look for a free place on this texture.
-    unsigned& x = b.left;
-    unsigned& y = b.top;
-    for (y = 0; y <= height() - aHeight; y += 16)
-        for (x = 0; x <= width() - aWidth; x += 8)
-        {
-            if (!pimpl->isBlockFree(b))
-                continue;
-
-            // Found a nice place!
-
-            // Try to make up for the large for()-stepping.
-            while (y > 0 && pimpl->isBlockFree(Block(x, y - 1, aWidth, aHeight)))
-                --y;
-            while (x > 0 && pimpl->isBlockFree(Block(x - 1, y, aWidth, aHeight)))
-                --x;
-            
-            pimpl->markBlockUsed(b, aWidth, aHeight);
-            return true;
-        }
-
     // So there was no space for the bitmap. Remember this for later.
     pimpl->maxW = aWidth - 1;
     pimpl->maxH = aHeight - 1;
     return false;
 }
 
+void Gosu::BlockAllocator::reserve(const Block& b)
+{
+    if (b.left + b.width > width() || b.top + b.height > height())
+        throw std::invalid_argument("Tried to reserve a block outside of the allocator");
+
+    pimpl->setSkyline(0, pimpl->width, pimpl->height);
+    pimpl->freeRects.clear();
+    pimpl->blocks[std::make_pair(b.left, b.top)] = b;
+    pimpl->usedArea += static_cast<unsigned long>(b.width) * b.height;
+}
+
 void Gosu::BlockAllocator::free(unsigned left, unsigned top)
 {
-    for (Impl::Blocks::iterator i = pimpl->blocks.begin();
-        i != pimpl->blocks.end(); ++i)
-    {
-        if (i->left == left && i->top == top)
-        {
-            pimpl->blocks.erase(i);
-			// Be optimistic again!
-            pimpl->maxW = pimpl->width - 1;
-            pimpl->maxH = pimpl->height - 1;
-            return;
-        }
-    }
+    Impl::Blocks::iterator block = pimpl->blocks.find(std::make_pair(left, top));
+    if (block == pimpl->blocks.end())
+        throw std::logic_error("Tried to free an invalid block");
+
+    pimpl->addFreeRect(block->second);
+    pimpl->usedArea -= static_cast<unsigned long>(block->second.width) * block->second.height;
+    pimpl->blocks.erase(block);
+    // Be optimistic again!
+    pimpl->maxW = pimpl->width - 1;
+    pimpl->maxH = pimpl->height - 1;
+}
+
+void Gosu::BlockAllocator::split(unsigned left, unsigned top,
+    unsigned cellWidth, unsigned cellHeight)
+{
+    Impl::Blocks::iterator block = pimpl->blocks.find(std::make_pair(left, top));
+    if (block == pimpl->blocks.end())
+        throw std::logic_error("Tried to split an invalid block");
+    Block whole = block->second;
+    if (cellWidth == 0 || cellHeight == 0 ||
+            whole.width % cellWidth != 0 || whole.height % cellHeight != 0)
+        throw std::logic_error("Tried to split a block into uneven cells");
+
+    pimpl->blocks.erase(block);
+    for (unsigned y = whole.top; y < whole.top + whole.height; y += cellHeight)
+        for (unsigned x = whole.left; x < whole.left + whole.width; x += cellWidth)
+            pimpl->blocks[std::make_pair(x, y)] = Block(x, y, cellWidth, cellHeight);
+}
+
+unsigned Gosu::BlockAllocator::numBlocks() const
+{
+    return pimpl->blocks.size();
+}
 
-    throw std::logic_error("Tried to free an invalid block");
+unsigned long Gosu::BlockAllocator::usedArea() const
+{
+    return pimpl->usedArea;
+}
+
+unsigned long Gosu::BlockAllocator::fragmentedArea() const
+{
+    unsigned long result = 0;
+    for (Impl::FreeRects::const_iterator it = pimpl->freeRects.begin(),
+            end = pimpl->freeRects.end(); it != end; ++it)
+        result += static_cast<unsigned long>(it->width) * it->height;
+    return result;
 }
@@ -1,33 +1,46 @@
-#ifndef GOSUIMPL_BLOCKALLOCATOR_HPP
-#define GOSUIMPL_BLOCKALLOCATOR_HPP
-
-#include <memory>
-
-namespace Gosu
-{
-    class BlockAllocator
-    {
-        struct Impl;
-        const std::auto_ptr<Impl> pimpl;
-
-    public:
-        struct Block
-        {
-            unsigned left, top, width, height;
-            Block() {}
-            Block(unsigned aLeft, unsigned aTop, unsigned aWidth, unsigned aHeight)
-            : left(aLeft), top(aTop), width(aWidth), height(aHeight) {}
-        };
-    
-        BlockAllocator(unsigned width, unsigned height);
-        ~BlockAllocator();
-
-        unsigned width() const;
-        unsigned height() const;
-
-        bool alloc(unsigned width, unsigned height, Block& block);
-        void free(unsigned left, unsigned top);
-    };
-}
-
-#endif
+#ifndef GOSUIMPL_BLOCKALLOCATOR_HPP
+#define GOSUIMPL_BLOCKALLOCATOR_HPP
+
+#include <memory>
+
+namespace Gosu
+{
+    class BlockAllocator
+    {
+        struct Impl;
+        const std::auto_ptr<Impl> pimpl;
+
+    public:
+        struct Block
+        {
+            unsigned left, top, width, height;
+            Block() {}
+            Block(unsigned aLeft, unsigned aTop, unsigned aWidth, unsigned aHeight)
+            : left(aLeft), top(aTop), width(aWidth), height(aHeight) {}
+        };
+    
+        BlockAllocator(unsigned width, unsigned height);
+        ~BlockAllocator();
+
+        unsigned width() const;
+        unsigned height() const;
+
+        bool alloc(unsigned width, unsigned height, Block& block);
+        // Marks a block that was placed elsewhere (e.g. by an atlas builder)
+        // as used. The skyline cannot describe such blocks, so the rest of
+        // the allocator's space is only reused as blocks are freed.
+        void reserve(const Block& block);
+        void free(unsigned left, unsigned top);
+        // Turns an allocated block into a grid of blocks of the given size,
+        // which are then freed one by one. The block's size must be a
+        // multiple of it.
+        void split(unsigned left, unsigned top, unsigned cellWidth, unsigned cellHeight);
+        
+        unsigned numBlocks() const;
+        unsigned long usedArea() const;
+        // Free space that can only be reused by blocks that fit into the gaps.
+        unsigned long fragmentedArea() const;
+    };
+}
+
+#endif
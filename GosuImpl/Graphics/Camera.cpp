@@ -0,0 +1,171 @@
+#include <Gosu/Camera.hpp>
+#include <Gosu/Graphics.hpp>
+#include <Gosu/Math.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+struct Gosu::Camera::Impl
+{
+    Graphics* graphics;
+    double x, y, zoom, angle;
+    // A width of 0 stands for the whole screen.
+    double viewLeft, viewTop, viewWidth, viewHeight;
+    bool inLayer, clipping;
+
+    double width() const
+    {
+        return viewWidth ? viewWidth : graphics->width();
+    }
+
+    double height() const
+    {
+        return viewWidth ? viewHeight : graphics->height();
+    }
+
+    // Sine and cosine as used by Gosu::rotate.
+    void rotation(double& s, double& c) const
+    {
+        s = offsetX(angle, 1);
+        c = -offsetY(angle, 1);
+    }
+};
+
+Gosu::Camera::Camera(Graphics& graphics)
+: pimpl(new Impl)
+{
+    pimpl->graphics = &graphics;
+    pimpl->x = pimpl->y = 0;
+    pimpl->zoom = 1;
+    pimpl->angle = 0;
+    pimpl->viewLeft = pimpl->viewTop = pimpl->viewWidth = pimpl->viewHeight = 0;
+    pimpl->inLayer = pimpl->clipping = false;
+}
+
+Gosu::Camera::~Camera()
+{
+}
+
+double Gosu::Camera::x() const
+{
+    return pimpl->x;
+}
+
+double Gosu::Camera::y() const
+{
+    return pimpl->y;
+}
+
+void Gosu::Camera::setPosition(double x, double y)
+{
+    pimpl->x = x, pimpl->y = y;
+}
+
+double Gosu::Camera::zoom() const
+{
+    return pimpl->zoom;
+}
+
+void Gosu::Camera::setZoom(double zoom)
+{
+    if (!(zoom > 0))
+        throw std::invalid_argument("Camera zoom must be positive");
+    pimpl->zoom = zoom;
+}
+
+double Gosu::Camera::angle() const
+{
+    return pimpl->angle;
+}
+
+void Gosu::Camera::setAngle(double angle)
+{
+    pimpl->angle = angle;
+}
+
+void Gosu::Camera::setViewport(double left, double top, double width, double height)
+{
+    if (width <= 0 || height <= 0)
+        throw std::invalid_argument("Invalid Camera viewport");
+
+    bool wholeScreen = left == 0 && top == 0 &&
+        width == pimpl->graphics->width() && height == pimpl->graphics->height();
+    pimpl->viewLeft = left, pimpl->viewTop = top;
+    pimpl->viewWidth = wholeScreen ? 0 : width;
+    pimpl->viewHeight = wholeScreen ? 0 : height;
+}
+
+Gosu::Transform Gosu::Camera::transform(double parallax) const
+{
+    Transform result = translate(-pimpl->x * parallax, -pimpl->y * parallax);
+    if (pimpl->angle != 0)
+        result = multiply(result, rotate(pimpl->angle));
+    if (pimpl->zoom != 1)
+        result = multiply(result, scale(pimpl->zoom));
+    return multiply(result, translate(pimpl->viewLeft + pimpl->width() / 2,
+        pimpl->viewTop + pimpl->height() / 2));
+}
+
+void Gosu::Camera::visibleRect(double& left, double& top, double& right, double& bottom,
+    double parallax) const
+{
+    double xs[4] = { 0, 1, 0, 1 }, ys[4] = { 0, 0, 1, 1 };
+    for (int i = 0; i < 4; ++i)
+    {
+        double x, y;
+        toWorld(pimpl->viewLeft + xs[i] * pimpl->width(),
+            pimpl->viewTop + ys[i] * pimpl->height(), x, y, parallax);
+        if (i == 0)
+            left = right = x, top = bottom = y;
+        else
+        {
+            left = std::min(left, x), right = std::max(right, x);
+            top = std::min(top, y), bottom = std::max(bottom, y);
+        }
+    }
+}
+
+void Gosu::Camera::toWorld(double screenX, double screenY, double& x, double& y,
+    double parallax) const
+{
+    double dx = (screenX - pimpl->viewLeft - pimpl->width() / 2) / pimpl->zoom;
+    double dy = (screenY - pimpl->viewTop - pimpl->height() / 2) / pimpl->zoom;
+    double s, c;
+    pimpl->rotation(s, c);
+    x = c * dx + s * dy + pimpl->x * parallax;
+    y = c * dy - s * dx + pimpl->y * parallax;
+}
+
+void Gosu::Camera::toScreen(double x, double y, double& screenX, double& screenY,
+    double parallax) const
+{
+    double dx = x - pimpl->x * parallax, dy = y - pimpl->y * parallax;
+    double s, c;
+    pimpl->rotation(s, c);
+    screenX = (c * dx - s * dy) * pimpl->zoom + pimpl->viewLeft + pimpl->width() / 2;
+    screenY = (s * dx + c * dy) * pimpl->zoom + pimpl->viewTop + pimpl->height() / 2;
+}
+
+void Gosu::Camera::beginLayer(double parallax)
+{
+    if (pimpl->inLayer)
+        throw std::logic_error("Camera layers cannot be nested");
+
+    pimpl->clipping = pimpl->viewWidth != 0;
+    if (pimpl->clipping)
+        pimpl->graphics->beginClipping(pimpl->viewLeft, pimpl->viewTop,
+            pimpl->viewWidth, pimpl->viewHeight);
+    pimpl->graphics->pushTransform(Camera::transform(parallax));
+    pimpl->inLayer = true;
+}
+
+void Gosu::Camera::endLayer()
+{
+    if (!pimpl->inLayer)
+        throw std::logic_error("No Camera layer to end");
+
+    pimpl->graphics->popTransform();
+    if (pimpl->clipping)
+        pimpl->graphics->endClipping();
+    pimpl->inLayer = false;
+}
@@ -0,0 +1,153 @@
+#include <Gosu/CollisionMask.hpp>
+#include <Gosu/Archive.hpp>
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/IO.hpp>
+#include <GosuImpl/Graphics/BitmapPool.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+using std::tr1::uint32_t;
+
+void Gosu::CollisionMask::build(const Bitmap& bitmap, unsigned srcX, unsigned srcY,
+    unsigned srcWidth, unsigned srcHeight, unsigned alphaThreshold)
+{
+    if (srcX + srcWidth > bitmap.width() || srcY + srcHeight > bitmap.height())
+        throw std::invalid_argument("CollisionMask source rectangle out of range");
+
+    w = srcWidth, h = srcHeight;
+    stride = (w + 31) / 32 + 1;
+    bits.assign(stride * h, 0);
+    for (unsigned y = 0; y < h; ++y)
+    {
+        const Color* in = bitmap.data() + (srcY + y) * bitmap.width() + srcX;
+        uint32_t* out = &bits[y * stride];
+        for (unsigned x = 0; x < w; ++x)
+            if (in[x].alpha() >= alphaThreshold)
+                out[x / 32] |= uint32_t(1) << (x % 32);
+    }
+}
+
+uint32_t Gosu::CollisionMask::word(unsigned row, unsigned x) const
+{
+    const uint32_t* in = &bits[row * stride + x / 32];
+    unsigned shift = x % 32;
+    // Shifting by 32 would be undefined.
+    return shift == 0 ? in[0] : in[0] >> shift | in[1] << (32 - shift);
+}
+
+Gosu::CollisionMask::CollisionMask()
+: w(0), h(0), stride(0)
+{
+}
+
+Gosu::CollisionMask::CollisionMask(const Bitmap& bitmap, unsigned alphaThreshold)
+{
+    build(bitmap, 0, 0, bitmap.width(), bitmap.height(), alphaThreshold);
+}
+
+Gosu::CollisionMask::CollisionMask(const Bitmap& bitmap, unsigned srcX, unsigned srcY,
+    unsigned srcWidth, unsigned srcHeight, unsigned alphaThreshold)
+{
+    build(bitmap, srcX, srcY, srcWidth, srcHeight, alphaThreshold);
+}
+
+bool Gosu::CollisionMask::solid(int x, int y) const
+{
+    if (x < 0 || y < 0 || x >= static_cast<int>(w) || y >= static_cast<int>(h))
+        return false;
+    return bits[y * stride + x / 32] >> (x % 32) & 1;
+}
+
+bool Gosu::CollisionMask::overlaps(const CollisionMask& other,
+    int offsetX, int offsetY) const
+{
+    // The intersection of both masks, in this mask's pixels.
+    int left = std::max(0, offsetX), right = std::min<int>(w, offsetX + int(other.w));
+    int top = std::max(0, offsetY), bottom = std::min<int>(h, offsetY + int(other.h));
+    if (left >= right || top >= bottom)
+        return false;
+
+    for (int y = top; y < bottom; ++y)
+        for (int x = left; x < right; x += 32)
+        {
+            uint32_t overlap = word(y, x) & other.word(y - offsetY, x - offsetX);
+            if (right - x < 32)
+                overlap &= (uint32_t(1) << (right - x)) - 1;
+            if (overlap)
+                return true;
+        }
+    return false;
+}
+
+Gosu::CollisionMask Gosu::CollisionMask::scaled(double factorX, double factorY) const
+{
+    CollisionMask result;
+    result.w = static_cast<unsigned>(std::fabs(w * factorX) + 0.5);
+    result.h = static_cast<unsigned>(std::fabs(h * factorY) + 0.5);
+    result.stride = (result.w + 31) / 32 + 1;
+    result.bits.assign(result.stride * result.h, 0);
+    if (result.w == 0 || result.h == 0)
+        return result;
+
+    // Samples the pixel under the center of each new one.
+    std::vector<unsigned> columns(result.w);
+    for (unsigned x = 0; x < result.w; ++x)
+    {
+        unsigned column = std::min<unsigned>(w - 1, (x + 0.5) * w / result.w);
+        columns[x] = factorX < 0 ? w - 1 - column : column;
+    }
+    for (unsigned y = 0; y < result.h; ++y)
+    {
+        unsigned row = std::min<unsigned>(h - 1, (y + 0.5) * h / result.h);
+        if (factorY < 0)
+            row = h - 1 - row;
+        uint32_t* out = &result.bits[y * result.stride];
+        for (unsigned x = 0; x < result.w; ++x)
+            if (bits[row * stride + columns[x] / 32] >> (columns[x] % 32) & 1)
+                out[x / 32] |= uint32_t(1) << (x % 32);
+    }
+    return result;
+}
+
+std::vector<Gosu::CollisionMask> Gosu::loadCollisionMasks(const Bitmap& bitmap,
+    int tileWidth, int tileHeight, unsigned alphaThreshold)
+{
+    int tilesX, tilesY;
+
+    if (tileWidth > 0)
+        tilesX = bitmap.width() / tileWidth;
+    else
+    {
+        tilesX = -tileWidth;
+        tileWidth = bitmap.width() / tilesX;
+    }
+
+    if (tileHeight > 0)
+        tilesY = bitmap.height() / tileHeight;
+    else
+    {
+        tilesY = -tileHeight;
+        tileHeight = bitmap.height() / tilesY;
+    }
+
+    std::vector<CollisionMask> result;
+    result.reserve(tilesX * tilesY);
+    for (int y = 0; y < tilesY; ++y)
+        for (int x = 0; x < tilesX; ++x)
+            result.push_back(CollisionMask(bitmap, x * tileWidth, y * tileHeight,
+                tileWidth, tileHeight, alphaThreshold));
+    return result;
+}
+
+std::vector<Gosu::CollisionMask> Gosu::loadCollisionMasks(const std::wstring& filename,
+    int tileWidth, int tileHeight, unsigned alphaThreshold)
+{
+    ScratchBitmap bmp;
+    if (const Resource* packed = findInMountedArchives(filename))
+        loadImageFile(*bmp, packed->frontReader());
+    else
+        loadCachedImageFile(*bmp, filename);
+    return loadCollisionMasks(*bmp, tileWidth, tileHeight, alphaThreshold);
+}
@@ -1,5 +1,6 @@
 #include <Gosu/Color.hpp>
 #include <Gosu/Math.hpp>
+#include <GosuImpl/Graphics/PixelKernels.hpp>
 #include <algorithm>
 
 namespace
@@ -125,6 +126,28 @@ Gosu::Color Gosu::multiply(Color a, Color b)
                  round(a.blue()  * b.blue()  / 255.0));
 }
 
+void Gosu::colorsFromHSV(Color* dest, const float* hsv, std::size_t count,
+    Color::Channel alpha)
+{
+    Pixels::fromHSV(dest, hsv, count, alpha);
+}
+
+void Gosu::interpolate(Color* dest, const Color* a, const Color* b,
+    std::size_t count, double weight)
+{
+    Pixels::interpolate(dest, a, b, count, clamp<int>(round(weight * 256), 0, 256));
+}
+
+void Gosu::multiply(Color* dest, const Color* a, const Color* b, std::size_t count)
+{
+    Pixels::multiply(dest, a, b, count);
+}
+
+void Gosu::colorsFromFloats(Color* dest, const float* rgba, std::size_t count)
+{
+    Pixels::fromFloats(dest, rgba, count);
+}
+
 const Gosu::Color Gosu::Color::NONE    = 0x00000000;
 const Gosu::Color Gosu::Color::BLACK   = 0xff000000;
 const Gosu::Color Gosu::Color::GRAY    = 0xff808080;
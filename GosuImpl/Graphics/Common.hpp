@@ -3,7 +3,11 @@
 
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/Graphics.hpp>
+#include <Gosu/ImageData.hpp>
+#include <Gosu/Inspection.hpp>
+#include <Gosu/Math.hpp>
 #include <Gosu/Platform.hpp>
+#include <GosuImpl/Threading.hpp>
 
 #if defined(GOSU_IS_WIN)
 #ifndef NOMINMAX
@@ -21,13 +25,38 @@
 #endif
 
 #include <algorithm>
+#include <cmath>
 #include <list>
 #include <vector>
 
+// Vector instructions for the transform math below. NEON only supports
+// doubles on 64-bit ARM.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GOSU_USE_SSE2
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#define GOSU_USE_NEON
+#include <arm_neon.h>
+#endif
+
 namespace Gosu
 {
+    class DrawOpQueue;
     struct RenderState;
     class RenderStateManager;
+    
+    // Counters of the frame currently being rendered. Graphics::end makes
+    // them available through rendererStatistics() and resets them.
+    // Render and drawing threads count into their own copies.
+    extern GOSU_THREAD_LOCAL RendererStatistics frameStatistics;
+    
+    // The queue that the calling thread draws into between
+    // Graphics::beginThreadQueue and endThreadQueue, or null.
+    extern GOSU_THREAD_LOCAL DrawOpQueue* threadQueue;
+    
+    // See Graphics::setPremultipliedAlpha. Only changes while no textures
+    // exist, so all threads may read it.
+    extern bool premultipliedAlpha;
 
     const GLuint NO_TEXTURE = static_cast<GLuint>(-1);
     const unsigned NO_CLIPPING = 0xffffffff;
@@ -45,26 +74,86 @@ namespace Gosu
             // Clipping, but same
                 (x == other.x && y == other.y && width == other.width && height == other.height);
         }
+        
+        // Strict weak ordering that is consistent with operator==.
+        bool operator<(const ClipRect& other) const
+        {
+            if (width == NO_CLIPPING || other.width == NO_CLIPPING)
+                return width != NO_CLIPPING && other.width == NO_CLIPPING;
+            if (x != other.x)
+                return x < other.x;
+            if (y != other.y)
+                return y < other.y;
+            if (width != other.width)
+                return width < other.width;
+            return height < other.height;
+        }
     };
 }
 
 namespace Gosu
 {
+    // How a Texture stores its pixels. Images choose one with their border
+    // flags, and only share textures with images of the same format.
+    enum PixelFormat
+    {
+        pfRGBA8888,
+        pfRGBA4444,
+        pfRGB565,
+        pfAlpha8
+    };
+    
+    inline PixelFormat pixelFormat(unsigned borderFlags)
+    {
+        return static_cast<PixelFormat>((borderFlags & bfAlpha8) / bfRGBA4444);
+    }
+    
     class Texture;
+    class TextureArray;
     class TexChunk;
     class ClipRectStack;
     struct DrawOp;
     class DrawOpQueue;
+    class GLBlockArena;
+    class GPUTimer;
+    class FrameLimiter;
+    class ResolutionScaler;
+    class ScreenReader;
+    class RenderThread;
     typedef std::list<Transform> Transforms;
     typedef std::list<DrawOpQueue> DrawOpQueueStack;
     class Macro;
+    
+    // The vertex format of draw ops, macros and the batches that are passed
+    // to OpenGL: 20 bytes, with the color in OpenGL's RGBA byte order (see
+    // Color::gl). Texture coordinates are zero for untextured vertices.
     struct ArrayVertex
     {
-        GLfloat texCoords[2];
-        GLuint color;
-        GLfloat vertices[3];
+        GLfloat x, y;
+        GLfloat u, v;
+        Color c;
+        
+        ArrayVertex() {}
+        ArrayVertex(GLfloat x, GLfloat y, Color c)
+        : x(x), y(y), u(0), v(0), c(c)
+        {
+        }
     };
     
+    // Points OpenGL's vertex, texture coordinate and color arrays at
+    // interleaved vertices. With a buffer object bound, vertices is an
+    // offset into it instead.
+    inline void setVertexPointers(const ArrayVertex* vertices)
+    {
+        const char* base = reinterpret_cast<const char*>(vertices);
+        glVertexPointer(2, GL_FLOAT, sizeof(ArrayVertex), base);
+        glTexCoordPointer(2, GL_FLOAT, sizeof(ArrayVertex), base + 2 * sizeof(GLfloat));
+        glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(ArrayVertex), base + 4 * sizeof(GLfloat));
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+    }
+    
     template<typename T>
     bool isPToTheLeftOfAB(T xa, T ya,
         T xb, T yb, T xp, T yp)
@@ -85,20 +174,107 @@ namespace Gosu
         }
     }
     
+    // Corners of an ImageInstance (see Image::drawMany) of the given size:
+    // top left, top right, bottom left, bottom right, as for ImageData::draw.
+    inline void instanceCorners(const ImageInstance& instance,
+        double width, double height, double xs[4], double ys[4])
+    {
+        double halfWidth = width * instance.scale / 2;
+        double halfHeight = height * instance.scale / 2;
+        double cosine = 1, sine = 0;
+        if (instance.angle != 0)
+        {
+            offsetXY(instance.angle, 1, sine, cosine);
+            cosine = -cosine;
+        }
+        
+        // Rotated half extents along the image's own axes.
+        double rightX = halfWidth * cosine, rightY = halfWidth * sine;
+        double downX = -halfHeight * sine, downY = halfHeight * cosine;
+        xs[0] = instance.x - rightX - downX, ys[0] = instance.y - rightY - downY;
+        xs[1] = instance.x + rightX - downX, ys[1] = instance.y + rightY - downY;
+        xs[2] = instance.x - rightX + downX, ys[2] = instance.y - rightY + downY;
+        xs[3] = instance.x + rightX + downX, ys[3] = instance.y + rightY + downY;
+    }
+    
+    // True for everything built from translate, rotate and scale: these
+    // never use the projective part of the matrix, so points can be
+    // transformed without a division.
+    inline bool isAffine(const Transform& transform)
+    {
+        return transform[3] == 0 && transform[7] == 0 && transform[15] == 1;
+    }
+    
     inline Transform multiply(const Transform& left, const Transform& right)
     {
+        // Each row of the result is a weighted sum of the rows of right. All
+        // versions add up in the same order, so they give the same results.
         Gosu::Transform result;
-        for (int i = 0; i < 16; ++i) {
-            result[i] = 0;
+        #if defined(GOSU_USE_SSE2)
+        for (int row = 0; row < 4; ++row)
+        {
+            __m128d low = _mm_setzero_pd(), high = _mm_setzero_pd();
             for (int j = 0; j < 4; ++j)
-                result[i] += left[i / 4 * 4 + j] * right[i % 4 + j * 4];
+            {
+                __m128d factor = _mm_set1_pd(left[row * 4 + j]);
+                low = _mm_add_pd(low, _mm_mul_pd(factor, _mm_loadu_pd(&right[j * 4])));
+                high = _mm_add_pd(high, _mm_mul_pd(factor, _mm_loadu_pd(&right[j * 4 + 2])));
+            }
+            _mm_storeu_pd(&result[row * 4], low);
+            _mm_storeu_pd(&result[row * 4 + 2], high);
+        }
+        #elif defined(GOSU_USE_NEON)
+        for (int row = 0; row < 4; ++row)
+        {
+            float64x2_t low = vdupq_n_f64(0), high = vdupq_n_f64(0);
+            for (int j = 0; j < 4; ++j)
+            {
+                double factor = left[row * 4 + j];
+                low = vaddq_f64(low, vmulq_n_f64(vld1q_f64(&right[j * 4]), factor));
+                high = vaddq_f64(high, vmulq_n_f64(vld1q_f64(&right[j * 4 + 2]), factor));
+            }
+            vst1q_f64(&result[row * 4], low);
+            vst1q_f64(&result[row * 4 + 2], high);
         }
+        #else
+        for (int row = 0; row < 4; ++row)
+            for (int column = 0; column < 4; ++column)
+                result[row * 4 + column] = 0 +
+                    left[row * 4 + 0] * right[column +  0] +
+                    left[row * 4 + 1] * right[column +  4] +
+                    left[row * 4 + 2] * right[column +  8] +
+                    left[row * 4 + 3] * right[column + 12];
+        #endif
         return result;
     }
     
     template<typename Float>
     void applyTransform(const Transform& transform, Float& x, Float& y)
     {
+        if (isAffine(transform))
+        {
+            #if defined(GOSU_USE_SSE2)
+            __m128d out = _mm_add_pd(_mm_add_pd(
+                _mm_mul_pd(_mm_set1_pd(x), _mm_loadu_pd(&transform[0])),
+                _mm_mul_pd(_mm_set1_pd(y), _mm_loadu_pd(&transform[4]))),
+                _mm_loadu_pd(&transform[12]));
+            double result[2];
+            _mm_storeu_pd(result, out);
+            x = result[0], y = result[1];
+            #elif defined(GOSU_USE_NEON)
+            float64x2_t out = vaddq_f64(vaddq_f64(
+                vmulq_n_f64(vld1q_f64(&transform[0]), x),
+                vmulq_n_f64(vld1q_f64(&transform[4]), y)),
+                vld1q_f64(&transform[12]));
+            x = vgetq_lane_f64(out, 0), y = vgetq_lane_f64(out, 1);
+            #else
+            double newX = x * transform[0] + y * transform[4] + transform[12];
+            double newY = x * transform[1] + y * transform[5] + transform[13];
+            x = newX, y = newY;
+            #endif
+            return;
+        }
+        
         Float in[4] = { x, y, 0, 1 };
         Float out[4] = { 0, 0, 0, 0 };
         for (int i = 0; i < 4; ++i)
@@ -108,17 +284,6 @@ namespace Gosu
         y = out[1] / out[3];
     }
     
-    inline void multiplyBitmapAlpha(Bitmap& bmp, Color::Channel alpha)
-    {
-        for (int y = 0; y < bmp.height(); ++y)
-            for (int x = 0; x < bmp.width(); ++x)
-            {
-                Color c = bmp.getPixel(x, y);
-                c.setAlpha(c.alpha() * alpha / 255);
-                bmp.setPixel(x, y, c);
-            }
-    }
-    
     #ifdef GOSU_IS_IPHONE
     int clipRectBaseFactor();
     #else
@@ -127,6 +292,27 @@ namespace Gosu
     
     bool isEntity(const std::wstring& name);
     const Bitmap& entityBitmap(const std::wstring& name);
+    
+    // Like loadImageFile, but looks into the decoded image cache first and
+    // fills it (see Image::setDecodedCacheDirectory).
+    void loadCachedImageFile(Bitmap& bitmap, const std::wstring& filename);
+    
+    // Returns a line of unformatted text drawn as by drawText onto a new
+    // bitmap that is fontHeight pixels high and as wide as textWidth would
+    // report. Lays the text out only once, so it is the cheaper choice for
+    // callers that need both the width and the pixels. Implemented next to
+    // drawText by each platform.
+    Bitmap renderText(const std::wstring& text, Color c,
+        const std::wstring& fontName, unsigned fontHeight, unsigned fontFlags);
+    
+    // Whether textWidth and renderText may be called for the given font by
+    // several threads at once, without holding textMutex.
+    bool isReentrantFont(const std::wstring& fontName);
+    
+    // Held while text is rendered on worker threads, since rendering is not
+    // reentrant on every platform (see asyncCreateText).
+    class Mutex;
+    extern Mutex textMutex;
 }
 
 #endif
@@ -0,0 +1,257 @@
+#include <GosuImpl/Graphics/CompressedTexture.hpp>
+#include <Gosu/TR1.hpp>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using std::tr1::uint8_t;
+using std::tr1::uint16_t;
+using std::tr1::uint32_t;
+
+namespace Gosu
+{
+    namespace
+    {
+        const GLenum RGB_DXT1  = 0x83F0, RGBA_DXT1 = 0x83F1,
+                     RGBA_DXT3 = 0x83F2, RGBA_DXT5 = 0x83F3,
+                     ETC1_RGB8 = 0x8D64,
+                     ETC2_RGB8 = 0x9274, ETC2_RGB8_A1 = 0x9276, ETC2_RGBA8 = 0x9278,
+                     PVRTC_RGB_4BPP = 0x8C00, PVRTC_RGB_2BPP = 0x8C01,
+                     PVRTC_RGBA_4BPP = 0x8C02, PVRTC_RGBA_2BPP = 0x8C03;
+
+        bool isPVRTC(GLenum format)
+        {
+            return format >= PVRTC_RGB_4BPP && format <= PVRTC_RGBA_2BPP;
+        }
+
+        void setBlockSize(CompressedTexture& texture)
+        {
+            texture.blockWidth = texture.blockHeight = 4;
+            switch (texture.format)
+            {
+            case RGB_DXT1: case RGBA_DXT1: case ETC1_RGB8: case ETC2_RGB8: case ETC2_RGB8_A1:
+            case PVRTC_RGB_4BPP: case PVRTC_RGBA_4BPP:
+                texture.blockBytes = 8;
+                break;
+            case RGBA_DXT3: case RGBA_DXT5: case ETC2_RGBA8:
+                texture.blockBytes = 16;
+                break;
+            case PVRTC_RGB_2BPP: case PVRTC_RGBA_2BPP:
+                texture.blockWidth = 8;
+                texture.blockBytes = 8;
+                break;
+            default:
+                throw std::runtime_error("Unsupported compressed texture format");
+            }
+        }
+
+        const char KTX_IDENTIFIER[12] =
+            { '\xAB', 'K', 'T', 'X', ' ', '1', '1', '\xBB', '\r', '\n', '\x1A', '\n' };
+
+        void loadDDS(CompressedTexture& texture, Reader reader)
+        {
+            reader.seek(12);
+            texture.height = reader.getPod<uint32_t>(boLittle);
+            texture.width = reader.getPod<uint32_t>(boLittle);
+            reader.setPosition(80);
+            uint32_t pixelFormatFlags = reader.getPod<uint32_t>(boLittle);
+            char fourCC[4];
+            reader.read(fourCC, 4);
+
+            const uint32_t DDPF_ALPHAPIXELS = 0x1, DDPF_FOURCC = 0x4;
+            if (!(pixelFormatFlags & DDPF_FOURCC))
+                throw std::runtime_error("Uncompressed DDS files are not supported");
+            if (std::memcmp(fourCC, "DXT1", 4) == 0)
+                texture.format = (pixelFormatFlags & DDPF_ALPHAPIXELS) ? RGBA_DXT1 : RGB_DXT1;
+            else if (std::memcmp(fourCC, "DXT3", 4) == 0)
+                texture.format = RGBA_DXT3;
+            else if (std::memcmp(fourCC, "DXT5", 4) == 0)
+                texture.format = RGBA_DXT5;
+            else
+                throw std::runtime_error("Unsupported DDS format (only DXT1, DXT3 and DXT5 work)");
+            setBlockSize(texture);
+
+            reader.setPosition(128);
+            texture.data.resize(texture.bytesFor(texture.width, texture.height));
+            reader.read(&texture.data[0], texture.data.size());
+        }
+
+        void loadKTX(CompressedTexture& texture, Reader reader)
+        {
+            reader.seek(sizeof KTX_IDENTIFIER);
+            ByteOrder order = reader.getPod<uint32_t>(boLittle) == 0x04030201 ? boLittle : boBig;
+            uint32_t header[12];
+            for (int i = 0; i < 12; ++i)
+                header[i] = reader.getPod<uint32_t>(order);
+            // glType, glTypeSize, glFormat, glInternalFormat, glBaseInternalFormat,
+            // pixelWidth, pixelHeight, pixelDepth, numberOfArrayElements,
+            // numberOfFaces, numberOfMipmapLevels, bytesOfKeyValueData.
+            if (header[0] != 0 || header[2] != 0)
+                throw std::runtime_error("KTX file does not contain compressed data");
+            if (header[7] > 1 || header[8] > 1 || header[9] != 1)
+                throw std::runtime_error("Only 2D KTX textures are supported");
+
+            texture.format = header[3];
+            texture.width = header[5];
+            texture.height = std::max<uint32_t>(header[6], 1);
+            setBlockSize(texture);
+
+            reader.seek(header[11]);
+            uint32_t imageSize = reader.getPod<uint32_t>(order);
+            if (imageSize < texture.bytesFor(texture.width, texture.height))
+                throw std::runtime_error("KTX file is truncated");
+            texture.data.resize(imageSize);
+            reader.read(&texture.data[0], texture.data.size());
+        }
+
+        Color rgb565(uint16_t value)
+        {
+            unsigned r = (value >> 11) & 0x1f, g = (value >> 5) & 0x3f, b = value & 0x1f;
+            return Color((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+        }
+
+        Color mix(Color a, Color b, unsigned weightA, unsigned weightB)
+        {
+            unsigned sum = weightA + weightB;
+            return Color((a.red() * weightA + b.red() * weightB) / sum,
+                (a.green() * weightA + b.green() * weightB) / sum,
+                (a.blue() * weightA + b.blue() * weightB) / sum);
+        }
+
+        uint16_t read16(const uint8_t* bytes)
+        {
+            return bytes[0] | (bytes[1] << 8);
+        }
+
+        uint32_t read32(const uint8_t* bytes)
+        {
+            return read16(bytes) | (static_cast<uint32_t>(read16(bytes + 2)) << 16);
+        }
+
+        // Decodes the color part of a DXT block into 16 pixels.
+        void decodeColors(const uint8_t* block, bool punchThrough, Color pixels[16])
+        {
+            uint16_t c0 = read16(block), c1 = read16(block + 2);
+            Color palette[4];
+            palette[0] = rgb565(c0);
+            palette[1] = rgb565(c1);
+            if (c0 > c1 || !punchThrough)
+            {
+                palette[2] = mix(palette[0], palette[1], 2, 1);
+                palette[3] = mix(palette[0], palette[1], 1, 2);
+            }
+            else
+            {
+                palette[2] = mix(palette[0], palette[1], 1, 1);
+                palette[3] = Color::NONE;
+            }
+
+            uint32_t indices = read32(block + 4);
+            for (int i = 0; i < 16; ++i, indices >>= 2)
+                pixels[i] = palette[indices & 3];
+        }
+
+        void decodeDXT5Alpha(const uint8_t* block, Color pixels[16])
+        {
+            unsigned alpha[8];
+            alpha[0] = block[0];
+            alpha[1] = block[1];
+            if (alpha[0] > alpha[1])
+                for (int i = 1; i < 7; ++i)
+                    alpha[i + 1] = (alpha[0] * (7 - i) + alpha[1] * i) / 7;
+            else
+            {
+                for (int i = 1; i < 5; ++i)
+                    alpha[i + 1] = (alpha[0] * (5 - i) + alpha[1] * i) / 5;
+                alpha[6] = 0;
+                alpha[7] = 255;
+            }
+
+            // 16 indices of three bits each, little endian.
+            std::tr1::uint64_t indices = 0;
+            for (int i = 7; i >= 2; --i)
+                indices = (indices << 8) | block[i];
+            for (int i = 0; i < 16; ++i, indices >>= 3)
+                pixels[i].setAlpha(alpha[indices & 7]);
+        }
+    }
+}
+
+std::size_t Gosu::CompressedTexture::bytesFor(unsigned areaWidth, unsigned areaHeight) const
+{
+    std::size_t blocksX = (areaWidth + blockWidth - 1) / blockWidth;
+    std::size_t blocksY = (areaHeight + blockHeight - 1) / blockHeight;
+    // PVRTC always needs at least 2x2 blocks.
+    if (isPVRTC(format))
+        blocksX = std::max<std::size_t>(blocksX, 2), blocksY = std::max<std::size_t>(blocksY, 2);
+    return blocksX * blocksY * blockBytes;
+}
+
+bool Gosu::CompressedTexture::supportsSubImages() const
+{
+    return !isPVRTC(format);
+}
+
+bool Gosu::isCompressedTextureFile(Reader reader)
+{
+    if (reader.resource().size() < reader.position() + sizeof KTX_IDENTIFIER)
+        return false;
+    char magic[sizeof KTX_IDENTIFIER];
+    reader.read(magic, sizeof magic);
+    return std::memcmp(magic, "DDS ", 4) == 0 ||
+        std::memcmp(magic, KTX_IDENTIFIER, sizeof KTX_IDENTIFIER) == 0;
+}
+
+void Gosu::loadCompressedTexture(CompressedTexture& texture, Reader reader)
+{
+    char magic[4];
+    Reader(reader).read(magic, 4);
+    if (std::memcmp(magic, "DDS ", 4) == 0)
+        loadDDS(texture, reader);
+    else
+        loadKTX(texture, reader);
+
+    if (texture.width == 0 || texture.height == 0)
+        throw std::runtime_error("Compressed texture is empty");
+}
+
+bool Gosu::canDecompress(const CompressedTexture& texture)
+{
+    return texture.format >= RGB_DXT1 && texture.format <= RGBA_DXT5;
+}
+
+Gosu::Bitmap Gosu::decompress(const CompressedTexture& texture)
+{
+    if (!canDecompress(texture))
+        throw std::runtime_error("Compressed texture format is not supported by the graphics driver");
+
+    Bitmap bitmap(texture.width, texture.height);
+    const uint8_t* block = reinterpret_cast<const uint8_t*>(&texture.data[0]);
+    for (unsigned top = 0; top < texture.height; top += 4)
+        for (unsigned left = 0; left < texture.width; left += 4)
+        {
+            Color pixels[16];
+            switch (texture.format)
+            {
+            case RGB_DXT1:
+            case RGBA_DXT1:
+                decodeColors(block, texture.format == RGBA_DXT1, pixels);
+                break;
+            case RGBA_DXT3:
+                decodeColors(block + 8, false, pixels);
+                for (int i = 0; i < 16; ++i)
+                    pixels[i].setAlpha(((block[i / 2] >> (i % 2 * 4)) & 0xf) * 0x11);
+                break;
+            case RGBA_DXT5:
+                decodeColors(block + 8, false, pixels);
+                decodeDXT5Alpha(block, pixels);
+                break;
+            }
+            block += texture.blockBytes;
+
+            for (unsigned y = 0; y < 4 && top + y < texture.height; ++y)
+                for (unsigned x = 0; x < 4 && left + x < texture.width; ++x)
+                    bitmap.setPixel(left + x, top + y, pixels[y * 4 + x]);
+        }
+    return bitmap;
+}
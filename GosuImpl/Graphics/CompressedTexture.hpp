@@ -0,0 +1,41 @@
+#ifndef GOSUIMPL_GRAPHICS_COMPRESSEDTEXTURE_HPP
+#define GOSUIMPL_GRAPHICS_COMPRESSEDTEXTURE_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/IO.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <vector>
+
+namespace Gosu
+{
+    // Pre-compressed texture data as found in DDS and KTX files. Only the
+    // first mipmap level is kept.
+    struct CompressedTexture
+    {
+        GLenum format;
+        unsigned width, height;
+        // All supported formats store fixed-size blocks of pixels.
+        unsigned blockWidth, blockHeight, blockBytes;
+        std::vector<char> data;
+
+        // Size of an image area in bytes; width and height are rounded up to
+        // whole blocks.
+        std::size_t bytesFor(unsigned areaWidth, unsigned areaHeight) const;
+        // PVRTC textures cannot be updated partially, so they can only be
+        // used if they are square and have a power-of-two size.
+        bool supportsSubImages() const;
+    };
+
+    // Recognizes DDS (with DXT1, DXT3 or DXT5 data) and KTX files.
+    bool isCompressedTextureFile(Reader reader);
+    // Throws std::runtime_error for files that cannot be used.
+    void loadCompressedTexture(CompressedTexture& texture, Reader reader);
+
+    // For drivers without support for the texture's format. Only works for
+    // S3TC (DXT) textures, throws std::runtime_error otherwise.
+    bool canDecompress(const CompressedTexture& texture);
+    Bitmap decompress(const CompressedTexture& texture);
+}
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef GOSUIMPL_GRAPHICS_DEFERREDIMAGE_HPP
+#define GOSUIMPL_GRAPHICS_DEFERREDIMAGE_HPP
+
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/ImageData.hpp>
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <memory>
+
+namespace Gosu
+{
+    // An image that was created on a thread without an OpenGL context. Its
+    // pixels wait in main memory until the thread that owns the context
+    // creates the actual image from them at the start of the next frame
+    // (see Graphics::begin). Until then, it is not ready and drawing it
+    // does nothing.
+    class DeferredImage : public ImageData
+    {
+    public:
+        // Shared with Graphics, which only keeps a weak reference to it.
+        struct Slot
+        {
+            // Guards the bitmap against insert and toBitmap on other threads.
+            Mutex mutex;
+            Bitmap bitmap;
+            unsigned borderFlags;
+            // Only set on the thread that owns the context, before anything
+            // is drawn in the frame, so reading it while drawing needs no lock.
+            std::auto_ptr<ImageData> data;
+        };
+
+    private:
+        std::tr1::shared_ptr<Slot> slot;
+        int w, h;
+
+    public:
+        DeferredImage(const std::tr1::shared_ptr<Slot>& slot)
+        : slot(slot), w(slot->bitmap.width()), h(slot->bitmap.height())
+        {
+        }
+
+        int width() const { return w; }
+        int height() const { return h; }
+
+        void draw(double x1, double y1, Color c1,
+            double x2, double y2, Color c2,
+            double x3, double y3, Color c3,
+            double x4, double y4, Color c4,
+            ZPos z, AlphaMode mode) const
+        {
+            if (slot->data.get())
+                slot->data->draw(x1, y1, c1, x2, y2, c2, x3, y3, c3, x4, y4, c4, z, mode);
+        }
+
+        void drawMany(const ImageInstance* instances, std::size_t count,
+            ZPos z, AlphaMode mode) const
+        {
+            if (slot->data.get())
+                slot->data->drawMany(instances, count, z, mode);
+        }
+
+        void drawMesh(const MeshVertex* vertices, std::size_t vertexCount,
+            const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const
+        {
+            if (slot->data.get())
+                slot->data->drawMesh(vertices, vertexCount, indices, indexCount, z, mode);
+        }
+
+        const GLTexInfo* glTexInfo() const
+        {
+            return slot->data.get() ? slot->data->glTexInfo() : 0;
+        }
+
+        Bitmap toBitmap() const
+        {
+            Lock lock(slot->mutex);
+            return slot->data.get() ? slot->data->toBitmap() : slot->bitmap;
+        }
+
+        void insert(const Bitmap& bitmap, int x, int y)
+        {
+            Lock lock(slot->mutex);
+            if (slot->data.get())
+                slot->data->insert(bitmap, x, y);
+            else
+                slot->bitmap.insert(bitmap, x, y);
+        }
+
+        bool ready() const
+        {
+            return slot->data.get() && slot->data->ready();
+        }
+    };
+}
+
+#endif
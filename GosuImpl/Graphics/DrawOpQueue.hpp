@@ -1,14 +1,24 @@
 #ifndef GOSUIMPL_GRAPHICS_DRAWOPQUEUE_HPP
 #define GOSUIMPL_GRAPHICS_DRAWOPQUEUE_HPP
 
+#include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
 #include <Gosu/TR1.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
 #include <GosuImpl/Graphics/TransformStack.hpp>
 #include <GosuImpl/Graphics/ClipRectStack.hpp>
 #include <GosuImpl/Graphics/DrawOp.hpp>
+#include <GosuImpl/Graphics/FrameCapture.hpp>
+#include <GosuImpl/Graphics/GLBlockArena.hpp>
+#include <GosuImpl/Graphics/GPUTimer.hpp>
+#include <GosuImpl/Graphics/PixelKernels.hpp>
 #include <cassert>
 #include <algorithm>
+#include <functional>
+#include <limits>
 #include <map>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 #include <cmath>
 
@@ -19,40 +29,871 @@ class Gosu::DrawOpQueue
 
     typedef std::vector<DrawOp> DrawOps;
     DrawOps ops;
-    typedef std::vector<std::tr1::function<void()> > GLBlocks;
-    GLBlocks glBlocks;
-
+    // The render states that ops refer to by index. Consecutive ops with
+    // the same render state share an entry.
+    typedef std::vector<RenderState> RenderStates;
+    RenderStates renderStates;
+    GLBlockArena glBlocks;
+    // The GLStateFlags of each block.
+    std::vector<unsigned> glBlockStates;
+    
 public:
-    void scheduleDrawOp(DrawOp op)
+    typedef std::vector<std::tr1::shared_ptr<Texture> > Textures;
+    typedef std::vector<std::tr1::shared_ptr<ShaderProgram> > Programs;
+    
+private:
+    // Keeps every texture referenced by the queued ops alive until the queue
+    // is cleared. Each texture is only retained once.
+    Textures textures;
+    
+    // Shaders work like textures, but are pushed and popped by the user.
+    Programs programStack, programs;
+    
+    // Queues that other threads have drawn into, see Graphics::beginThreadQueue.
+    // Their ops are sorted by Z already, and reference their own transforms.
+    typedef std::vector<std::tr1::shared_ptr<DrawOpQueue> > SubQueues;
+    SubQueues subQueues;
+    
+    void retainTexture(const std::tr1::shared_ptr<Texture>& texture)
     {
-        if (clipRectStack.clippedWorldAway())
+        // Consecutive ops usually come from the same texture.
+        if (!textures.empty() && textures.back() == texture)
             return;
-
+        if (std::find(textures.begin(), textures.end(), texture) == textures.end())
+            textures.push_back(texture);
+    }
+    
+    // Size of the screen in physical pixels, for culling. Queues that record
+    // macros have no viewport since they may be drawn anywhere.
+    bool culling;
+    double viewportWidth, viewportHeight;
+    
+    // True if the op lies completely outside of the viewport or the current
+    // clipping rectangle, with a pixel of tolerance for lines.
+    bool isCulled(const DrawOp& op)
+    {
+        if (!culling || op.verticesOrBlockIndex < 2)
+            return false;
+        
+        double xs[4], ys[4];
+        for (int i = 0; i < op.verticesOrBlockIndex; ++i)
+            xs[i] = op.vertices[i].x, ys[i] = op.vertices[i].y;
+        return isCulled(xs, ys, op.verticesOrBlockIndex);
+    }
+    
+    bool isCulled(const double* xs, const double* ys, int count)
+    {
+        const Transform& transform = transformStack.current();
+        double left, top, right, bottom;
+        for (int i = 0; i < count; ++i)
+        {
+            double x = xs[i], y = ys[i];
+            applyTransform(transform, x, y);
+            if (i == 0)
+                left = right = x, top = bottom = y;
+            else
+            {
+                left = std::min(left, x), right = std::max(right, x);
+                top = std::min(top, y), bottom = std::max(bottom, y);
+            }
+        }
+        
+        double viewLeft, viewTop, viewRight, viewBottom;
+        viewRect(viewLeft, viewTop, viewRight, viewBottom);
+        return right < viewLeft - 1 || left > viewRight + 1 ||
+            bottom < viewTop - 1 || top > viewBottom + 1;
+    }
+    
+    // The viewport, narrowed down to the current clipping rectangle.
+    void viewRect(double& left, double& top, double& right, double& bottom)
+    {
+        left = 0, top = 0, right = viewportWidth, bottom = viewportHeight;
+        if (const ClipRect* cr = clipRectStack.maybeEffectiveRect())
+        {
+            // Clip rects are stored the way glScissor wants them.
+            double fac = clipRectBaseFactor();
+            left = std::max(left, cr->x / fac);
+            right = std::min(right, (cr->x + cr->width) / fac);
+            top = std::max(top, viewportHeight - (cr->y + cr->height) / fac);
+            bottom = std::min(bottom, viewportHeight - cr->y / fac);
+        }
+    }
+    
+    // If enabled, transforms are applied to the vertices right away, so that
+    // all ops share the identity transform and batching does not depend on
+    // them. Whether the current transform is the identity anyway is cached.
+    bool pretransforming;
+    Transform identity;
+    const Transform* lastTransform;
+    bool lastTransformIsIdentity;
+    
+    void pretransform(DrawOp& op, RenderState& renderState)
+    {
+        const Transform& transform = transformStack.current();
+        if (&transform != lastTransform)
+        {
+            lastTransform = &transform;
+            lastTransformIsIdentity = transform == identity;
+        }
+        
+        if (!lastTransformIsIdentity)
+            for (int i = 0; i < op.verticesOrBlockIndex; ++i)
+            {
+                double x = op.vertices[i].x, y = op.vertices[i].y;
+                applyTransform(transform, x, y);
+                op.vertices[i].x = x, op.vertices[i].y = y;
+            }
+        renderState.transform = &identity;
+    }
+    
+    // If enabled, ops that lie completely inside of the clipping rectangle
+    // do not use it at all, and quads that are aligned with the screen and
+    // have a single color are trimmed to it. Either way, they no longer need
+    // glScissor and can be batched with unclipped ops. Everything else, e.g.
+    // rotated images, is still clipped by glScissor.
+    bool geometricClipping;
+    double clipScreenHeight;
+    
+    // Returns false if nothing is left of the op.
+    bool clipGeometrically(DrawOp& op, RenderState& renderState, const ClipRect& cr)
+    {
+        // Same rounding as glScissor.
+        double clipLeft = static_cast<GLint>(cr.x);
+        double clipRight = clipLeft + static_cast<GLint>(cr.width);
+        double clipBottom = clipScreenHeight - static_cast<GLint>(cr.y);
+        double clipTop = clipBottom - static_cast<GLint>(cr.height);
+        
+        const Transform& transform = *renderState.transform;
+        double xs[4], ys[4];
+        double left, top, right, bottom;
+        for (int i = 0; i < op.verticesOrBlockIndex; ++i)
+        {
+            xs[i] = op.vertices[i].x, ys[i] = op.vertices[i].y;
+            applyTransform(transform, xs[i], ys[i]);
+            if (i == 0)
+                left = right = xs[i], top = bottom = ys[i];
+            else
+            {
+                left = std::min(left, xs[i]), right = std::max(right, xs[i]);
+                top = std::min(top, ys[i]), bottom = std::max(bottom, ys[i]);
+            }
+        }
+        
+        if (left >= clipLeft && right <= clipRight && top >= clipTop && bottom <= clipBottom)
+            return true;
+        if (right <= clipLeft || left >= clipRight || bottom <= clipTop || top >= clipBottom)
+            return false;
+        
+        // Corners in the order of their texture coordinates (see
+        // DrawOp::setTexCoords): left/top, right/top, right/bottom, left/bottom.
+        const int a = 0, b = 1, c = 2, d = 3;
+        bool trimmable = op.verticesOrBlockIndex == 4 && isAffine(transform) &&
+            transform[1] == 0 && transform[4] == 0 &&
+            ys[a] == ys[b] && ys[d] == ys[c] && xs[a] == xs[d] && xs[b] == xs[c] &&
+            xs[a] != xs[b] && ys[a] != ys[d] &&
+            op.vertices[a].c == op.vertices[b].c && op.vertices[a].c == op.vertices[c].c &&
+            op.vertices[a].c == op.vertices[d].c;
+        if (!trimmable)
+        {
+            renderState.clipRect = cr;
+            return true;
+        }
+        
+        // Trim on the screen, interpolate the texture coordinates, then go
+        // back through the (axis-aligned) transform.
+        double x0 = clamp(xs[a], clipLeft, clipRight), x1 = clamp(xs[b], clipLeft, clipRight);
+        double y0 = clamp(ys[a], clipTop, clipBottom), y1 = clamp(ys[d], clipTop, clipBottom);
+        if (renderState.texture)
+        {
+            GLfloat texLeft = op.vertices[a].u, texTop = op.vertices[a].v;
+            GLfloat width = op.vertices[c].u - texLeft, height = op.vertices[c].v - texTop;
+            op.setTexCoords(texLeft + width * (x0 - xs[a]) / (xs[b] - xs[a]),
+                texTop + height * (y0 - ys[a]) / (ys[d] - ys[a]),
+                texLeft + width * (x1 - xs[a]) / (xs[b] - xs[a]),
+                texTop + height * (y1 - ys[a]) / (ys[d] - ys[a]));
+        }
+        
+        x0 = (x0 - transform[12]) / transform[0], x1 = (x1 - transform[12]) / transform[0];
+        y0 = (y0 - transform[13]) / transform[5], y1 = (y1 - transform[13]) / transform[5];
+        op.vertices[a].x = x0, op.vertices[a].y = y0;
+        op.vertices[b].x = x1, op.vertices[b].y = y0;
+        op.vertices[c].x = x1, op.vertices[c].y = y1;
+        op.vertices[d].x = x0, op.vertices[d].y = y1;
+        return true;
+    }
+    
+    // With premultiplied alpha, vertex colors are premultiplied like the
+    // textures. Additive ops become default ops with an alpha of zero: The
+    // blend function then adds their colors without darkening the target,
+    // and both can share batches.
+    static void premultiply(DrawOp& op, RenderState& renderState)
+    {
+        bool additive = renderState.mode == amAdd;
+        if (additive)
+            renderState.mode = amDefault;
+        for (int i = 0; i < op.verticesOrBlockIndex; ++i)
+        {
+            op.vertices[i].c = Pixels::premultiply(op.vertices[i].c);
+            if (additive)
+                op.vertices[i].c.setAlpha(0);
+        }
+    }
+    
+    // Stores the op with the given render state, which only needs the
+    // texture and the alpha mode to be set.
+    void appendDrawOp(DrawOp& op, RenderState& renderState)
+    {
         #ifdef GOSU_IS_IPHONE
         // No triangles, no lines supported
         assert (op.verticesOrBlockIndex == 4);
         #endif
+        
+        if (premultipliedAlpha)
+            premultiply(op, renderState);
 
-        op.renderState.transform = &transformStack.current();
+        if (pretransforming)
+            pretransform(op, renderState);
+        else
+            renderState.transform = &transformStack.current();
         if (const ClipRect* cr = clipRectStack.maybeEffectiveRect())
-            op.renderState.clipRect = *cr;
+        {
+            #ifndef GOSU_IS_IPHONE
+            if (geometricClipping)
+            {
+                if (!clipGeometrically(op, renderState, *cr))
+                    return;
+            }
+            else
+            #endif
+                renderState.clipRect = *cr;
+        }
+        if (!programStack.empty())
+        {
+            if (programs.empty() || programs.back() != programStack.back())
+                if (std::find(programs.begin(), programs.end(), programStack.back()) == programs.end())
+                    programs.push_back(programStack.back());
+            renderState.program = programStack.back().get();
+        }
+        op.renderStateIndex = indexOf(renderState);
         ops.push_back(op);
     }
+    
+    unsigned indexOf(const RenderState& renderState)
+    {
+        if (renderStates.empty() || !(renderStates.back() == renderState))
+            renderStates.push_back(renderState);
+        return renderStates.size() - 1;
+    }
+    
+    // Z ranges in which ops may be reordered to minimize state changes.
+    typedef std::vector<std::pair<ZPos, ZPos> > ZRanges;
+    ZRanges reorderableRanges;
+    
+    // Orders indices into renderStates by the states they refer to.
+    struct IsOrderedByRenderState
+    {
+        const RenderStates& renderStates;
+        
+        explicit IsOrderedByRenderState(const RenderStates& renderStates)
+        : renderStates(renderStates)
+        {
+        }
+        
+        bool operator()(unsigned lhs, unsigned rhs) const
+        {
+            return renderStates[lhs] < renderStates[rhs];
+        }
+    };
+    
+    static bool isInRanges(const ZRanges& ranges, ZPos z)
+    {
+        for (ZRanges::const_iterator it = ranges.begin(), end = ranges.end(); it != end; ++it)
+            if (z >= it->first && z <= it->second)
+                return true;
+        return false;
+    }
+    
+    bool isReorderable(ZPos z) const
+    {
+        return isInRanges(reorderableRanges, z);
+    }
+    
+    // Z ranges whose ops are opaque, see Graphics::markOpaque. Where the
+    // depth buffer can be used, those ops are not sorted but drawn with a
+    // depth test, before the others.
+    ZRanges opaqueRanges;
+    DrawOps opaqueOps;
+    // Z values of all ops of the frame, which are mapped to depth values.
+    ZPos minZ, maxZ;
+    
+    bool isOpaque(const DrawOp& op) const
+    {
+        return op.verticesOrBlockIndex >= 0 &&
+            renderStates[op.renderStateIndex].mode == amDefault &&
+            isInRanges(opaqueRanges, op.z);
+    }
+    
+    #ifndef GOSU_IS_IPHONE
+    bool canTestDepth() const
+    {
+        if (opaqueRanges.empty() || !glBlocks.empty() || capture)
+            return false;
+        GLint depthBits = 0;
+        glGetIntegerv(GL_DEPTH_BITS, &depthBits);
+        return depthBits > 0;
+    }
+    #endif
+    
+    // Moves the opaque ops to the end of opaqueOps, keeping their order.
+    // Also widens minZ/maxZ to all ops.
+    void separateOpaqueOps()
+    {
+        DrawOps::iterator kept = ops.begin();
+        for (DrawOps::iterator op = ops.begin(), end = ops.end(); op != end; ++op)
+        {
+            minZ = std::min(minZ, op->z);
+            maxZ = std::max(maxZ, op->z);
+            if (isOpaque(*op))
+                opaqueOps.push_back(*op);
+            else
+                *kept++ = *op;
+        }
+        ops.erase(kept, ops.end());
+    }
+    
+    // Higher Z values are nearer. Stays below the depth of 1 that the depth
+    // buffer is cleared to.
+    GLdouble depthOf(ZPos z) const
+    {
+        return maxZ == minZ ? 0.5 : (maxZ - z) / (maxZ - minZ) * 0.999;
+    }
+    
+    // Scratch space for sorting, kept to reuse its capacity.
+    DrawOps sortedOps;
+    typedef std::vector<std::tr1::uint64_t> SortKeys;
+    SortKeys sortKeys, sortScratch;
+    std::vector<ZPos> zLevels;
+    std::vector<bool> groupedLevels;
+    std::vector<unsigned> stateOrder, stateRanks;
+    
+    // Number of bits needed to tell count values apart.
+    static unsigned bitsFor(std::size_t count)
+    {
+        unsigned bits = 0;
+        while (bits < 64 && (std::tr1::uint64_t(1) << bits) < count)
+            ++bits;
+        return bits;
+    }
+    
+    // Fills zLevels with the distinct Z values of the ops in ascending order.
+    // Games usually only use a handful, so look for them linearly first.
+    void collectZLevels()
+    {
+        static const std::size_t MAX_LINEAR_LEVELS = 64;
+        zLevels.clear();
+        for (DrawOps::const_iterator op = ops.begin(), end = ops.end(); op != end; ++op)
+        {
+            if (op != ops.begin() && op->z == (op - 1)->z)
+                continue;
+            if (std::find(zLevels.begin(), zLevels.end(), op->z) != zLevels.end())
+                continue;
+            if (zLevels.size() == MAX_LINEAR_LEVELS)
+            {
+                zLevels.clear();
+                for (op = ops.begin(); op != end; ++op)
+                    zLevels.push_back(op->z);
+                break;
+            }
+            zLevels.push_back(op->z);
+        }
+        std::sort(zLevels.begin(), zLevels.end());
+        zLevels.erase(std::unique(zLevels.begin(), zLevels.end()), zLevels.end());
+    }
+    
+    // Numbers the render states in ascending order, with equal states
+    // sharing a number.
+    void rankRenderStates()
+    {
+        stateOrder.resize(renderStates.size());
+        for (unsigned i = 0; i < stateOrder.size(); ++i)
+            stateOrder[i] = i;
+        std::sort(stateOrder.begin(), stateOrder.end(), IsOrderedByRenderState(renderStates));
+        
+        stateRanks.resize(renderStates.size());
+        unsigned rank = 0;
+        for (std::size_t i = 0; i < stateOrder.size(); ++i)
+        {
+            if (i > 0 && renderStates[stateOrder[i - 1]] < renderStates[stateOrder[i]])
+                ++rank;
+            stateRanks[stateOrder[i]] = rank;
+        }
+    }
+    
+    // LSD radix sort on bytes, skipping those that are the same in all keys.
+    static void radixSort(SortKeys& keys, SortKeys& scratch, unsigned bits)
+    {
+        // Counting is not worth it for a few keys.
+        if (keys.size() < 256)
+        {
+            std::sort(keys.begin(), keys.end());
+            return;
+        }
+        
+        scratch.resize(keys.size());
+        for (unsigned shift = 0; shift < bits; shift += 8)
+        {
+            std::size_t offsets[256] = {};
+            for (SortKeys::const_iterator key = keys.begin(); key != keys.end(); ++key)
+                ++offsets[*key >> shift & 0xff];
+            if (offsets[keys.front() >> shift & 0xff] == keys.size())
+                continue;
+            
+            std::size_t offset = 0;
+            for (int digit = 0; digit < 256; ++digit)
+                std::swap(offset, offsets[digit]), offset += offsets[digit];
+            for (SortKeys::const_iterator key = keys.begin(); key != keys.end(); ++key)
+                scratch[offsets[*key >> shift & 0xff]++] = *key;
+            keys.swap(scratch);
+        }
+    }
+    
+    // Stable sort by Z that moves every DrawOp exactly once. Each op gets a
+    // 64-bit key made of the rank of its Z value, optionally the rank of its
+    // render state, and its index, which makes the keys unique and the sort
+    // stable. Only the keys are sorted; the index is in their lowest bits.
+    // With groupByRenderState, ops in reorderable Z levels are grouped by
+    // render state. Levels that contain GL code are left alone because it
+    // may depend on the order.
+    void sortByKeys(bool groupByRenderState)
+    {
+        using std::tr1::uint64_t;
+        
+        if (ops.size() < 2)
+            return;
+        
+        // Fast path: Ops have already been submitted in Z order.
+        if (!groupByRenderState)
+        {
+            DrawOps::const_iterator op = ops.begin() + 1, end = ops.end();
+            while (op != end && !(op->z < (op - 1)->z))
+                ++op;
+            if (op == end)
+                return;
+        }
+        
+        collectZLevels();
+        unsigned levelBits = bitsFor(zLevels.size()), indexBits = bitsFor(ops.size());
+        unsigned stateBits = groupByRenderState ? bitsFor(renderStates.size()) : 0;
+        // Only happens with millions of ops; grouping is an optimization.
+        if (levelBits + stateBits + indexBits > 64)
+            groupByRenderState = false, stateBits = 0;
+        
+        // First pass: the rank of each op's Z value.
+        sortKeys.resize(ops.size());
+        std::size_t level = 0;
+        for (std::size_t i = 0; i < ops.size(); ++i)
+        {
+            if (zLevels[level] != ops[i].z)
+                level = std::lower_bound(zLevels.begin(), zLevels.end(), ops[i].z) -
+                    zLevels.begin();
+            sortKeys[i] = level;
+        }
+        
+        if (groupByRenderState)
+        {
+            rankRenderStates();
+            groupedLevels.resize(zLevels.size());
+            for (std::size_t i = 0; i < zLevels.size(); ++i)
+                groupedLevels[i] = isReorderable(zLevels[i]);
+            for (std::size_t i = 0; i < ops.size(); ++i)
+                if (ops[i].verticesOrBlockIndex < 0)
+                    groupedLevels[sortKeys[i]] = false;
+        }
+        
+        // Second pass: the complete keys.
+        bool sorted = true;
+        for (std::size_t i = 0; i < ops.size(); ++i)
+        {
+            uint64_t key = sortKeys[i] << stateBits;
+            if (groupByRenderState && groupedLevels[sortKeys[i]])
+                key |= stateRanks[ops[i].renderStateIndex];
+            sortKeys[i] = key << indexBits | i;
+            sorted = sorted && (i == 0 || sortKeys[i - 1] < sortKeys[i]);
+        }
+        if (sorted)
+            return;
+        
+        radixSort(sortKeys, sortScratch, levelBits + stateBits + indexBits);
+        uint64_t indexMask = (uint64_t(1) << indexBits) - 1;
+        sortedOps.resize(ops.size());
+        for (std::size_t i = 0; i < ops.size(); ++i)
+            sortedOps[i] = ops[sortKeys[i] & indexMask];
+        ops.swap(sortedOps);
+    }
+    
+    // Merges each quad into the most recent vertex array with the same render
+    // state, unless something drawn since then overlaps it, i.e. if the result
+    // looks exactly the same. Tile maps that alternate between textures thus
+    // collapse into one array per texture.
+    // Overlaps are tracked conservatively on a grid whose cells are as large
+    // as a typical quad.
+    static void coalesce(VertexArrays& vas)
+    {
+        std::vector<GLfloat> sizes;
+        for (VertexArrays::const_iterator va = vas.begin(); va != vas.end(); ++va)
+            for (std::size_t i = 0; i + 4 <= va->vertices.size(); i += 4)
+            {
+                GLfloat left, top, right, bottom;
+                quadBounds(&va->vertices[i], left, top, right, bottom);
+                sizes.push_back(std::min(right - left, bottom - top));
+            }
+        if (sizes.size() < 2)
+            return;
+        std::nth_element(sizes.begin(), sizes.begin() + sizes.size() / 2, sizes.end());
+        GLfloat cellSize = std::max<GLfloat>(sizes[sizes.size() / 2], 1);
+        
+        VertexArrays result;
+        std::vector<VertexArrays::iterator> groups;
+        // Most recent group for each render state.
+        typedef std::map<RenderState, std::size_t> LatestGroups;
+        LatestGroups latestGroups;
+        // Most recent group that has drawn into each grid cell.
+        typedef std::tr1::unordered_map<std::tr1::uint64_t, std::size_t> Cells;
+        Cells cells;
+        
+        for (VertexArrays::const_iterator va = vas.begin(); va != vas.end(); ++va)
+            for (std::size_t i = 0; i + 4 <= va->vertices.size(); i += 4)
+            {
+                GLfloat left, top, right, bottom;
+                quadBounds(&va->vertices[i], left, top, right, bottom);
+                int cellLeft = static_cast<int>(std::floor(left / cellSize));
+                int cellTop = static_cast<int>(std::floor(top / cellSize));
+                int cellRight = std::max(cellLeft, static_cast<int>(std::ceil(right / cellSize)) - 1);
+                int cellBottom = std::max(cellTop, static_cast<int>(std::ceil(bottom / cellSize)) - 1);
+                
+                std::size_t obstacle = 0;
+                bool hasObstacle = false;
+                for (int y = cellTop; y <= cellBottom; ++y)
+                    for (int x = cellLeft; x <= cellRight; ++x)
+                    {
+                        Cells::const_iterator cell = cells.find(cellKey(x, y));
+                        if (cell != cells.end() && (!hasObstacle || cell->second > obstacle))
+                            obstacle = cell->second, hasObstacle = true;
+                    }
+                
+                LatestGroups::iterator latest = latestGroups.find(va->renderState);
+                std::size_t group;
+                if (latest != latestGroups.end() && (!hasObstacle || obstacle <= latest->second))
+                    group = latest->second;
+                else
+                {
+                    group = groups.size();
+                    groups.push_back(result.insert(result.end(), VertexArray()));
+                    groups.back()->renderState = va->renderState;
+                    latestGroups[va->renderState] = group;
+                }
+                
+                std::vector<ArrayVertex>& vertices = groups[group]->vertices;
+                vertices.insert(vertices.end(), &va->vertices[i], &va->vertices[i] + 4);
+                
+                for (int y = cellTop; y <= cellBottom; ++y)
+                    for (int x = cellLeft; x <= cellRight; ++x)
+                    {
+                        std::size_t& cell = cells[cellKey(x, y)];
+                        cell = std::max(cell, group);
+                    }
+            }
+        
+        vas.swap(result);
+    }
+    
+    static void quadBounds(const ArrayVertex* quad,
+        GLfloat& left, GLfloat& top, GLfloat& right, GLfloat& bottom)
+    {
+        left = right = quad[0].x;
+        top = bottom = quad[0].y;
+        for (int i = 1; i < 4; ++i)
+        {
+            left = std::min(left, quad[i].x);
+            right = std::max(right, quad[i].x);
+            top = std::min(top, quad[i].y);
+            bottom = std::max(bottom, quad[i].y);
+        }
+    }
+    
+    static std::tr1::uint64_t cellKey(int x, int y)
+    {
+        return static_cast<std::tr1::uint64_t>(static_cast<std::tr1::uint32_t>(x)) << 32 |
+            static_cast<std::tr1::uint32_t>(y);
+    }
+    
+    // Merges the ops of all sub-queues into the sorted ops of this one, using
+    // a heap of the next Z value of each queue. Ops with the same Z go to
+    // this queue first, then to the sub-queues in the order they were added.
+    void mergeSubQueues()
+    {
+        if (subQueues.empty())
+            return;
+        
+        // The render states of the sub-queues are appended to those of this
+        // queue, so their ops' indices are offset.
+        std::vector<const DrawOps*> runs(1, &ops);
+        std::vector<unsigned> offsets(1, 0);
+        std::size_t total = ops.size();
+        for (SubQueues::const_iterator it = subQueues.begin(); it != subQueues.end(); ++it)
+        {
+            runs.push_back(&(*it)->ops);
+            offsets.push_back(renderStates.size());
+            renderStates.insert(renderStates.end(),
+                (*it)->renderStates.begin(), (*it)->renderStates.end());
+            total += (*it)->ops.size();
+        }
+        
+        typedef std::pair<ZPos, std::size_t> Head;
+        std::vector<Head> heads;
+        std::vector<std::size_t> positions(runs.size(), 0);
+        for (std::size_t i = 0; i < runs.size(); ++i)
+            if (!runs[i]->empty())
+                heads.push_back(Head(runs[i]->front().z, i));
+        std::make_heap(heads.begin(), heads.end(), std::greater<Head>());
+        
+        sortedOps.clear();
+        sortedOps.reserve(total);
+        while (!heads.empty())
+        {
+            std::pop_heap(heads.begin(), heads.end(), std::greater<Head>());
+            Head& head = heads.back();
+            const DrawOps& run = *runs[head.second];
+            std::size_t& position = positions[head.second];
+            
+            // Take everything with this Z value from the queue at once.
+            do
+            {
+                sortedOps.push_back(run[position++]);
+                sortedOps.back().renderStateIndex += offsets[head.second];
+            }
+            while (position < run.size() && run[position].z == head.first);
+            
+            if (position < run.size())
+            {
+                head.first = run[position].z;
+                std::push_heap(heads.begin(), heads.end(), std::greater<Head>());
+            }
+            else
+                heads.pop_back();
+        }
+        ops.swap(sortedOps);
+    }
+    
+    void sortOps()
+    {
+        GOSU_TRACE("DrawOpQueue::sort");
+        std::tr1::uint64_t start = microseconds();
+        
+        // Apply Z-Ordering. Sub-queues are only merged once this queue is
+        // sorted by Z, so grouping by render state needs a second pass then.
+        if (subQueues.empty())
+            sortByKeys(!reorderableRanges.empty());
+        else
+        {
+            sortByKeys(false);
+            mergeSubQueues();
+            if (!reorderableRanges.empty())
+                sortByKeys(true);
+        }
+        
+        frameStatistics.sortTime += microseconds() - start;
+    }
+
+    // Where the ops go once they are sorted, see captureNextFrame.
+    Buffer* capture;
+    unsigned captureWidth, captureHeight;
+    
+    static void doNothing()
+    {
+    }
+    
+    // Vertices of consecutive draw ops that share the same render state and
+    // primitive type. Kept alive between frames so that its capacity can be
+    // reused.
+    std::vector<ArrayVertex> batch;
+    
+    #ifndef GOSU_IS_IPHONE
+    GLenum batchPrimitive;
+
+    void flushBatch()
+    {
+        if (batch.empty())
+            return;
+        setVertexPointers(&batch[0]);
+        glDrawArrays(batchPrimitive, 0, batch.size());
+        ++frameStatistics.batches;
+        frameStatistics.vertices += batch.size();
+        batch.clear();
+    }
+    #else
+    // OpenGL ES has no quads, and only 16-bit indices.
+    static const std::size_t MAX_BATCH_VERTICES = 65536;
+    
+    // The two triangles (0, 1, 2) and (1, 2, 3) of each quad in the batch,
+    // for as many quads as the largest batch so far.
+    std::vector<GLushort> quadIndices;
+    
+    void flushBatch()
+    {
+        if (batch.empty())
+            return;
+        std::size_t quads = batch.size() / 4;
+        for (std::size_t quad = quadIndices.size() / 6; quad < quads; ++quad)
+        {
+            GLushort first = quad * 4;
+            GLushort indices[6] = { first, first + 1, first + 2,
+                first + 1, first + 2, first + 3 };
+            quadIndices.insert(quadIndices.end(), indices, indices + 6);
+        }
+        setVertexPointers(&batch[0]);
+        glDrawElements(GL_TRIANGLES, quads * 6, GL_UNSIGNED_SHORT, &quadIndices[0]);
+        ++frameStatistics.batches;
+        frameStatistics.vertices += batch.size();
+        batch.clear();
+    }
+    #endif
 
-    void scheduleGL(std::tr1::function<void()> glBlock, ZPos z)
+public:
+    DrawOpQueue()
+    : culling(false), viewportWidth(0), viewportHeight(0),
+      pretransforming(false), identity(scale(1)), lastTransform(0),
+      geometricClipping(false), clipScreenHeight(0), capture(0)
+    {
+    }
+    
+    void setGeometricClipping(bool enabled)
+    {
+        geometricClipping = enabled;
+    }
+    
+    void setPretransforming(bool enabled)
+    {
+        pretransforming = enabled;
+    }
+    
+    void scheduleDrawOp(DrawOp op, AlphaMode mode)
+    {
+        ++frameStatistics.scheduledOps;
+        if (clipRectStack.clippedWorldAway())
+            return;
+        if (isCulled(op))
+        {
+            ++frameStatistics.culledOps;
+            return;
+        }
+        
+        RenderState renderState;
+        renderState.mode = mode;
+        appendDrawOp(op, renderState);
+    }
+    
+    void scheduleDrawOp(DrawOp op, AlphaMode mode, const std::tr1::shared_ptr<Texture>& texture)
+    {
+        ++frameStatistics.scheduledOps;
+        if (clipRectStack.clippedWorldAway())
+            return;
+        if (isCulled(op))
+        {
+            ++frameStatistics.culledOps;
+            return;
+        }
+        
+        retainTexture(texture);
+        if (texture->isLayer())
+        {
+            GLfloat offset = TextureArray::layerOffset(texture->layer());
+            for (int i = 0; i < op.verticesOrBlockIndex; ++i)
+                op.vertices[i].v += offset;
+        }
+        RenderState renderState;
+        renderState.mode = mode;
+        renderState.texture = texture.get();
+        appendDrawOp(op, renderState);
+    }
+    
+    // For drawing code that can skip work for invisible quads. Always false
+    // if culling is disabled.
+    bool isQuadCulled(double x1, double y1, double x2, double y2,
+        double x3, double y3, double x4, double y4)
+    {
+        if (!culling)
+            return false;
+        if (clipRectStack.clippedWorldAway())
+            return true;
+        
+        double xs[4] = { x1, x2, x3, x4 }, ys[4] = { y1, y2, y3, y4 };
+        return isCulled(xs, ys, 4);
+    }
+    
+    // Bounding box of what can be seen, in the coordinates before the
+    // current transform. Returns false if anything could be seen, i.e. if
+    // culling is disabled or the transform is not affine.
+    bool visibleArea(double& left, double& top, double& right, double& bottom)
+    {
+        const Transform& t = transformStack.current();
+        double det = t[0] * t[5] - t[1] * t[4];
+        if (!culling || !isAffine(t) || det == 0)
+            return false;
+        
+        double viewLeft, viewTop, viewRight, viewBottom;
+        viewRect(viewLeft, viewTop, viewRight, viewBottom);
+        double xs[4] = { viewLeft, viewRight, viewLeft, viewRight };
+        double ys[4] = { viewTop, viewTop, viewBottom, viewBottom };
+        for (int i = 0; i < 4; ++i)
+        {
+            // Inverse of applyTransform for affine transforms.
+            double dx = xs[i] - t[12], dy = ys[i] - t[13];
+            double x = (dx * t[5] - dy * t[4]) / det;
+            double y = (dy * t[0] - dx * t[1]) / det;
+            if (i == 0)
+                left = right = x, top = bottom = y;
+            else
+            {
+                left = std::min(left, x), right = std::max(right, x);
+                top = std::min(top, y), bottom = std::max(bottom, y);
+            }
+        }
+        return true;
+    }
+    
+    // Enables culling of ops that end up outside of the given area.
+    void setViewport(double width, double height)
+    {
+        culling = true;
+        viewportWidth = width;
+        viewportHeight = height;
+    }
+    
+    void disableCulling()
+    {
+        culling = false;
+    }
+
+    // modifiedState: The GLStateFlags that are set up again after the block.
+    template<typename Functor>
+    void scheduleGL(const Functor& glBlock, ZPos z, unsigned modifiedState = gsAll)
     {
         // TODO: Document this case: Clipped-away GL blocks are *not* being run.
         if (clipRectStack.clippedWorldAway())
             return;
 
         int complementOfBlockIndex = ~(int)glBlocks.size();
-        glBlocks.push_back(glBlock);
+        glBlocks.push(glBlock);
+        glBlockStates.push_back(modifiedState);
 
         DrawOp op;
         op.verticesOrBlockIndex = complementOfBlockIndex;
-        op.renderState.transform = &transformStack.current();
+        RenderState renderState;
+        renderState.transform = &transformStack.current();
         if (const ClipRect* cr = clipRectStack.maybeEffectiveRect())
-            op.renderState.clipRect = *cr;
+            renderState.clipRect = *cr;
+        op.renderStateIndex = indexOf(renderState);
         op.z = z;
         ops.push_back(op);
     }
@@ -76,6 +917,7 @@ public:
         // TODO: This should really happen *right before* setting up
         // the glScissor.
         physY = screenHeight - physY - physHeight;
+        clipScreenHeight = screenHeight;
 
         clipRectStack.beginClipping(physX, physY, physWidth, physHeight);
     }
@@ -84,9 +926,17 @@ public:
     {
         clipRectStack.endClipping();
     }
+    
+    // The current clipping rectangle in glScissor's coordinates, or 0 if
+    // there is none or everything has been clipped away.
+    const ClipRect* clipRect() const
+    {
+        return clipRectStack.maybeEffectiveRect();
+    }
 
     void setBaseTransform(const Transform& baseTransform)
     {
+        lastTransform = 0;
         transformStack.setBaseTransform(baseTransform);
     }
 
@@ -100,69 +950,321 @@ public:
         transformStack.pop();
     }
 
-    void performDrawOpsAndCode()
+    void pushProgram(const std::tr1::shared_ptr<ShaderProgram>& program)
     {
-        // Apply Z-Ordering.
-        std::stable_sort(ops.begin(), ops.end());
+        programStack.push_back(program);
+    }
+    
+    void popProgram()
+    {
+        if (programStack.empty())
+            throw std::logic_error("popShader called without a matching pushShader");
+        programStack.pop_back();
+    }
 
-        RenderStateManager manager;
-        #ifdef GOSU_IS_IPHONE
-        if (ops.empty())
-            return;
+    void allowReordering(ZPos fromZ, ZPos toZ)
+    {
+        reorderableRanges.push_back(std::make_pair(fromZ, toZ));
+    }
+    
+    void disallowReordering()
+    {
+        reorderableRanges.clear();
+    }
+    
+    void markOpaque(ZPos fromZ, ZPos toZ)
+    {
+        opaqueRanges.push_back(std::make_pair(fromZ, toZ));
+    }
+    
+    void unmarkOpaque()
+    {
+        opaqueRanges.clear();
+    }
 
-        DrawOps::const_iterator current = ops.begin(), last = ops.end() - 1;
-        for (; current != last; ++current)
+    // The timer, if any, measures the GL blocks.
+    // scissorScale: See RenderStateManager.
+    void performDrawOpsAndCode(GPUTimer* timer = 0, double scissorScale = 1)
+    {
+        #ifndef GOSU_IS_IPHONE
+        // Opaque ops skip sorting, except for those of sub-queues, which
+        // have been sorted on their own threads.
+        if (canTestDepth())
         {
-            manager.setRenderState(current->renderState);
-            current->perform(&*(current + 1));
+            minZ = std::numeric_limits<ZPos>::max();
+            maxZ = -std::numeric_limits<ZPos>::max();
+            separateOpaqueOps();
+            bool hadSubQueues = !subQueues.empty();
+            sortOps();
+            if (hadSubQueues)
+                separateOpaqueOps();
         }
-        manager.setRenderState(last->renderState);
-        last->perform(0);
-        #else
+        else
+        #endif
+            sortOps();
+        if (capture)
+        {
+            captureDrawOps(ops, renderStates, captureWidth, captureHeight, *capture);
+            capture = 0;
+        }
+        GOSU_TRACE("DrawOpQueue::submit");
+
+        RenderStateManager manager(scissorScale);
+        #ifdef GOSU_IS_IPHONE
+        // All ops are quads, so batches only end where the render state
+        // changes.
+        const RenderState* batchState = 0;
         for (DrawOps::const_iterator current = ops.begin(), last = ops.end();
-            current != last; ++current)
+                current != last; ++current)
+        {
+            const RenderState& renderState = renderStates[current->renderStateIndex];
+            if (batchState == 0 || (batchState != &renderState && !(*batchState == renderState)) ||
+                    batch.size() == MAX_BATCH_VERTICES)
+            {
+                flushBatch();
+                manager.setRenderState(renderState);
+                batchState = &renderState;
+            }
+            current->appendTo(batch);
+        }
+        flushBatch();
+        #else
+        // Opaque ops go first, front to back. In reverse order, the first
+        // op that is drawn onto a pixel is the one that would have been
+        // drawn last when sorted, so a depth test of GL_LESS keeps it.
+        // The remaining ops are tested against them, but do not write depth.
+        bool testingDepth = !opaqueOps.empty();
+        if (testingDepth)
+        {
+            glClear(GL_DEPTH_BUFFER_BIT);
+            glEnable(GL_DEPTH_TEST);
+            glDepthFunc(GL_LESS);
+            glDisable(GL_BLEND);
+            glEnable(GL_ALPHA_TEST);
+            glAlphaFunc(GL_GEQUAL, 0.5f);
+            frameStatistics.opaqueOps += opaqueOps.size();
+        }
+        
+        // Client vertex array state is only touched between these two calls.
+        glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+        
+        if (testingDepth)
+        {
+            performOps(opaqueOps.rbegin(), opaqueOps.rend(), manager, true, timer);
+            glEnable(GL_BLEND);
+            glDisable(GL_ALPHA_TEST);
+            glDepthMask(GL_FALSE);
+            glDepthFunc(GL_LEQUAL);
+        }
+        performOps(ops.begin(), ops.end(), manager, testingDepth, timer);
+        
+        glPopClientAttrib();
+        
+        if (testingDepth)
+        {
+            glDepthMask(GL_TRUE);
+            glDepthRange(0, 1);
+            glDisable(GL_DEPTH_TEST);
+        }
+        #endif
+    }
+    
+    #ifndef GOSU_IS_IPHONE
+    // Draws ops in batches. With depth testing, each batch only holds ops
+    // of the same Z value, which the depth range is set to.
+    template<typename Iterator>
+    void performOps(Iterator current, Iterator last, RenderStateManager& manager,
+        bool testingDepth, GPUTimer* timer)
+    {
+        const RenderState* batchState = 0;
+        ZPos batchZ = 0;
+        for (; current != last; ++current)
         {
-            manager.setRenderState(current->renderState);
+            const RenderState& renderState = renderStates[current->renderStateIndex];
             if (current->verticesOrBlockIndex >= 0)
-                current->perform(0);
+            {
+                // Start a new batch if this op cannot be drawn with the previous ones.
+                if (batchState == 0 || (batchState != &renderState && !(*batchState == renderState)) ||
+                    batchPrimitive != current->primitive() || (testingDepth && batchZ != current->z))
+                {
+                    flushBatch();
+                    manager.setRenderState(renderState);
+                    batchState = &renderState;
+                    batchPrimitive = current->primitive();
+                    if (testingDepth)
+                    {
+                        batchZ = current->z;
+                        glDepthRange(depthOf(batchZ), depthOf(batchZ));
+                    }
+                }
+                current->appendTo(batch);
+            }
             else
             {
+                flushBatch();
+                batchState = 0;
+                manager.setRenderState(renderState);
+                
                 // GL code
                 int blockIndex = ~current->verticesOrBlockIndex;
                 assert (blockIndex >= 0);
                 assert (blockIndex < glBlocks.size());
-                glBlocks[blockIndex]();
-                manager.enforceAfterUntrustedGL();
+                // Do not leak our vertex arrays into custom code.
+                glPopClientAttrib();
+                if (timer)
+                    timer->beginGLBlock();
+                glBlocks.call(blockIndex);
+                if (timer)
+                    timer->endGLBlock();
+                ++frameStatistics.glBlocks;
+                glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+                manager.enforceAfterUntrustedGL(glBlockStates[blockIndex]);
             }
         }
-        #endif
+        flushBatch();
     }
+    #endif
 
-    void compileTo(VertexArrays& vas)
+    // A GL block that was recorded into a macro. It runs before the vertex
+    // array at arrayIndex, with the transform that was current when it was
+    // scheduled.
+    struct CompiledBlock
     {
-        if (!glBlocks.empty())
-            throw std::logic_error("Custom code cannot be recorded into a macro");
-
-        std::stable_sort(ops.begin(), ops.end());
+        std::size_t arrayIndex;
+        Transform transform;
+        std::tr1::function<void()> code;
+    };
+    typedef std::vector<CompiledBlock> CompiledBlocks;
+    
+    void compileTo(VertexArrays& vas, CompiledBlocks& blocks)
+    {
+        sortOps();
+        VertexArrays run;
         for (DrawOps::const_iterator op = ops.begin(), end = ops.end(); op != end; ++op)
-            op->compileTo(vas);
+        {
+            const RenderState& renderState = renderStates[op->renderStateIndex];
+            if (op->verticesOrBlockIndex >= 0)
+            {
+                op->compileTo(renderState, run);
+                continue;
+            }
+            
+            // Quads are only merged between blocks, since blocks may depend
+            // on what has been drawn before them.
+            coalesce(run);
+            vas.splice(vas.end(), run);
+            CompiledBlock block;
+            block.arrayIndex = vas.size();
+            block.transform = *renderState.transform;
+            block.code = glBlocks.function(~op->verticesOrBlockIndex);
+            blocks.push_back(block);
+        }
+        coalesce(run);
+        vas.splice(vas.end(), run);
+    }
+
+    bool hasGLBlocks() const
+    {
+        return !glBlocks.empty();
+    }
+    
+    // Called by the thread that drew into the queue once it is done, so
+    // that merging it later only has to interleave the sorted ops.
+    void prepareForMerging()
+    {
+        std::tr1::uint64_t start = microseconds();
+        sortByKeys(false);
+        frameStatistics.sortTime += microseconds() - start;
+    }
+    
+    // Makes the next performDrawOpsAndCode append its sorted ops to the
+    // buffer, see FrameCapture.hpp. The size is that of the screen.
+    void captureNextFrame(Buffer& buffer, unsigned width, unsigned height)
+    {
+        capture = &buffer;
+        captureWidth = width;
+        captureHeight = height;
+    }
+    
+    // Replaces the queued ops with those of a captured frame, whose textures
+    // must have been created. The frame must outlive the queued ops.
+    // Captured GL blocks do nothing when they are replayed.
+    void replay(const CapturedFrame& frame)
+    {
+        clearQueue();
+        ops = frame.ops;
+        renderStates = frame.renderStates;
+        for (unsigned i = 0; i < frame.glBlocks; ++i)
+            glBlocks.push(&doNothing);
+        glBlockStates.assign(frame.glBlocks, unsigned(gsNone));
+    }
+    
+    // The queue must have been prepared for merging, and must not have any
+    // GL blocks.
+    void addSubQueue(const std::tr1::shared_ptr<DrawOpQueue>& queue)
+    {
+        assert (!queue->hasGLBlocks());
+        subQueues.push_back(queue);
+    }
+
+    const Textures& retainedTextures() const
+    {
+        return textures;
+    }
+
+    const Programs& retainedPrograms() const
+    {
+        return programs;
     }
 
     // This retains the current stack of transforms and clippings.
     void clearQueue()
     {
+        textures.clear();
+        programs.clear();
         glBlocks.clear();
+        glBlockStates.clear();
         ops.clear();
+        opaqueOps.clear();
+        renderStates.clear();
+        subQueues.clear();
     }
 
     // This clears the queue and starts with new stacks. This must not be called
     // when endClipping/popTransform calls might still be pending.
     void reset()
     {
+        lastTransform = 0;
+        capture = 0;
         transformStack.reset();
         clipRectStack.clear();
+        programStack.clear();
         clearQueue();
     }
+
+    // Takes over everything that persists across frames from another queue.
+    // Used for pipelined rendering, which alternates between two queues.
+    // Must be called right after reset().
+    void copySettings(const DrawOpQueue& other)
+    {
+        culling = other.culling;
+        viewportWidth = other.viewportWidth;
+        viewportHeight = other.viewportHeight;
+        pretransforming = other.pretransforming;
+        geometricClipping = other.geometricClipping;
+        reorderableRanges = other.reorderableRanges;
+        opaqueRanges = other.opaqueRanges;
+        setBaseTransform(other.transformStack.base());
+    }
 };
 
+namespace Gosu
+{
+    // Where drawing on the calling thread goes.
+    inline DrawOpQueue& currentQueue(DrawOpQueueStack& queues)
+    {
+        return threadQueue ? *threadQueue : queues.back();
+    }
+}
+
 #endif
@@ -1,46 +1,237 @@
 #include <Gosu/Font.hpp>
+#include <Gosu/Async.hpp>
 #include <Gosu/Graphics.hpp>
 #include <Gosu/Image.hpp>
 #include <Gosu/Math.hpp>
+#include <Gosu/Shader.hpp>
 #include <Gosu/Text.hpp>
+#include <Gosu/Trace.hpp>
 #include <Gosu/TR1.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
 #include <GosuImpl/Graphics/FormattedString.hpp>
+#include <GosuImpl/Graphics/TexChunk.hpp>
+#include <GosuImpl/Graphics/Texture.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <algorithm>
 #include <cassert>
+#include <cmath>
 #include <map>
+#include <stdexcept>
+#include <vector>
 using namespace std;
 
+namespace
+{
+    // Distance field characters store how far each pixel is from the edge,
+    // at half the resolution that they are rendered at, mapped to the alpha
+    // channel so that 128 is the edge and each pixel of distance (at the
+    // font's own size) is SPREAD steps.
+    enum { SPREAD = 32 };
+    
+    const char* distanceFieldSource =
+        "uniform sampler2D glyphs;\n"
+        "void main()\n"
+        "{\n"
+        "    float distance = texture2D(glyphs, gl_TexCoord[0].xy).a;\n"
+        "    float smoothing = clamp(fwidth(distance) * 0.75, 0.001, 0.5);\n"
+        "    float alpha = smoothstep(0.5 - smoothing, 0.5 + smoothing, distance);\n"
+        "    gl_FragColor = vec4(gl_Color.rgb, gl_Color.a * alpha);\n"
+        "}\n";
+    
+    // One program for all fonts, which lives as long as any of them.
+    tr1::shared_ptr<Gosu::Shader> sharedDistanceFieldShader()
+    {
+        static tr1::weak_ptr<Gosu::Shader> shared;
+        tr1::shared_ptr<Gosu::Shader> result = shared.lock();
+        if (!result)
+        {
+            result.reset(new Gosu::Shader(distanceFieldSource));
+            shared = result;
+        }
+        return result;
+    }
+    
+    const double FAR_AWAY = 1e20;
+    
+    // Squared Euclidean distance transform of one row or column, by
+    // Felzenszwalb and Huttenlocher: the lower envelope of the parabolas
+    // rooted at each sample.
+    void distanceTransform(const vector<double>& f, vector<double>& d,
+        vector<int>& v, vector<double>& z)
+    {
+        int n = f.size();
+        v.resize(n);
+        z.resize(n + 1);
+        int k = 0;
+        v[0] = 0;
+        z[0] = -FAR_AWAY;
+        z[1] = FAR_AWAY;
+        for (int q = 1; q < n; ++q)
+        {
+            double s;
+            while (true)
+            {
+                s = ((f[q] + q * q) - (f[v[k]] + v[k] * v[k])) / (2.0 * q - 2.0 * v[k]);
+                if (s > z[k] || k == 0)
+                    break;
+                --k;
+            }
+            if (s <= z[k])
+            {
+                // Only possible for k == 0; the new parabola replaces it.
+                v[0] = q;
+                z[1] = FAR_AWAY;
+                continue;
+            }
+            ++k;
+            v[k] = q;
+            z[k] = s;
+            z[k + 1] = FAR_AWAY;
+        }
+        k = 0;
+        for (int q = 0; q < n; ++q)
+        {
+            while (z[k + 1] < q)
+                ++k;
+            d[q] = (q - v[k]) * (q - v[k]) + f[v[k]];
+        }
+    }
+    
+    // Distances from every pixel to the nearest one for which inside is
+    // the given value.
+    vector<double> distancesTo(const Gosu::Bitmap& coverage, bool inside)
+    {
+        unsigned w = coverage.width(), h = coverage.height();
+        vector<double> grid(w * h);
+        for (unsigned y = 0; y < h; ++y)
+            for (unsigned x = 0; x < w; ++x)
+                grid[y * w + x] = (coverage.getPixel(x, y).alpha() >= 128) == inside ? 0 : FAR_AWAY;
+        
+        vector<double> f(max(w, h)), d(max(w, h)), z;
+        vector<int> v;
+        f.resize(h), d.resize(h);
+        for (unsigned x = 0; x < w; ++x)
+        {
+            for (unsigned y = 0; y < h; ++y)
+                f[y] = grid[y * w + x];
+            distanceTransform(f, d, v, z);
+            for (unsigned y = 0; y < h; ++y)
+                grid[y * w + x] = d[y];
+        }
+        f.resize(w), d.resize(w);
+        for (unsigned y = 0; y < h; ++y)
+        {
+            copy(grid.begin() + y * w, grid.begin() + (y + 1) * w, f.begin());
+            distanceTransform(f, d, v, z);
+            for (unsigned x = 0; x < w; ++x)
+                grid[y * w + x] = sqrt(d[x]);
+        }
+        return grid;
+    }
+    
+    // Turns a character rendered at twice the font's size into a white
+    // distance field at the font's size.
+    Gosu::Bitmap toDistanceField(const Gosu::Bitmap& coverage)
+    {
+        unsigned w = coverage.width(), h = coverage.height();
+        vector<double> outside = distancesTo(coverage, true);
+        vector<double> inside = distancesTo(coverage, false);
+        
+        Gosu::Bitmap result((w + 1) / 2, (h + 1) / 2);
+        for (unsigned y = 0; y < result.height(); ++y)
+            for (unsigned x = 0; x < result.width(); ++x)
+            {
+                // Averages the signed distances of the four rendered pixels,
+                // positive inside, then halves them for the smaller size.
+                double sum = 0;
+                unsigned count = 0;
+                for (unsigned sy = y * 2; sy < min(y * 2 + 2, h); ++sy)
+                    for (unsigned sx = x * 2; sx < min(x * 2 + 2, w); ++sx, ++count)
+                    {
+                        unsigned i = sy * w + sx;
+                        // The edge lies between inside and outside pixels.
+                        sum += inside[i] > 0 ? inside[i] - 0.5 : 0.5 - outside[i];
+                    }
+                double distance = sum / count / 2;
+                double alpha = Gosu::clamp(128 + distance * SPREAD, 0.0, 255.0);
+                result.setPixel(x, y, Gosu::Color(static_cast<Gosu::Color::Channel>(alpha), 255, 255, 255));
+            }
+        return result;
+    }
+}
+
 struct Gosu::Font::Impl
 {
     Graphics* graphics;
     wstring name;
     unsigned height, flags;
+    // Only set for fonts with distance field characters.
+    tr1::shared_ptr<Shader> distanceFieldShader;
 
-    // Unicode planes of 2^16 characters each. On Windows, where wchar_t is only 16 bits wide, only
-    // the first plane will ever be touched.
     struct CharInfo
     {
         auto_ptr<Image> image;
         double factor;
+        bool distanceField;
+        // The image's width times factor, set along with the image.
+        double advance;
     };
-    typedef tr1::array<CharInfo, 65536> Plane;
-    auto_ptr<Plane> planes[16][ffCombinations];
+    
+    // Characters are kept in pages of PAGE_SIZE consecutive code points
+    // that share their flags, which are only created once one of them is
+    // used. Text mostly comes from a few small ranges of Unicode, so this
+    // keeps fonts small without giving up on fast lookups.
+    enum { PAGE_SIZE = 128 };
+    typedef tr1::array<CharInfo, PAGE_SIZE> Page;
+    typedef tr1::unordered_map<tr1::uint32_t, tr1::shared_ptr<Page> > Pages;
+    Pages pages;
+    // The last page that was used, since text rarely leaves one.
+    tr1::uint32_t lastPageKey;
+    Page* lastPage;
+    // The first LATIN1 code points of each flag combination, looked up
+    // without any hashing since most text, and nearly all HUDs, stays in
+    // them. Entries point into pages, which are never released.
+    enum { LATIN1 = 256 };
+    tr1::array<CharInfo*, LATIN1 * ffCombinations> latin1;
     
     map<wstring, tr1::shared_ptr<Image> > entityCache;
     
+    Impl()
+    : lastPageKey(0), lastPage(0)
+    {
+        latin1.assign(0);
+    }
+    
     CharInfo& charInfo(wchar_t wc, unsigned flags)
     {
-        size_t planeIndex = wc / 65536;
-        size_t charIndex  = wc % 65536;
-        
-        if (planeIndex >= 16)
+        tr1::uint32_t codePoint = static_cast<tr1::uint32_t>(wc);
+        if (codePoint < LATIN1 && flags < ffCombinations)
+        {
+            CharInfo*& entry = latin1[flags * LATIN1 + codePoint];
+            if (!entry)
+                entry = &pagedCharInfo(codePoint, flags);
+            return *entry;
+        }
+        return pagedCharInfo(codePoint, flags);
+    }
+    
+    CharInfo& pagedCharInfo(tr1::uint32_t codePoint, unsigned flags)
+    {
+        if (codePoint > 0x10ffff)
             throw invalid_argument("Unicode plane out of reach");
         if (flags >= ffCombinations)
             throw invalid_argument("Font flags out of range");
         
-        if (!planes[planeIndex][flags].get())
-            planes[planeIndex][flags].reset(new Plane);
-        return (*planes[planeIndex][flags])[charIndex];
+        tr1::uint32_t pageKey = codePoint / PAGE_SIZE * ffCombinations + flags;
+        if (!lastPage || lastPageKey != pageKey)
+        {
+            tr1::shared_ptr<Page>& page = pages[pageKey];
+            if (!page)
+                page.reset(new Page);
+            lastPageKey = pageKey;
+            lastPage = page.get();
+        }
+        return (*lastPage)[codePoint % PAGE_SIZE];
     }
     
     const Image& imageAt(const FormattedString& fs, unsigned i)
@@ -53,24 +244,192 @@ struct Gosu::Font::Impl
             return *ptr;
         }
         
-        wchar_t wc = fs.charAt(i);
-        unsigned flags = fs.flagsAt(i);
+        return *glyph(fs.charAt(i), fs.flagsAt(i)).image;
+    }
+    
+    // Returns a character, rendering it first if it has not been yet.
+    CharInfo& glyph(wchar_t wc, unsigned flags)
+    {
         CharInfo& info = charInfo(wc, flags);
-        
-        if (info.image.get())
-            return *info.image;
-        
+        if (!info.image.get())
+        {
+            GOSU_TRACE_STARTUP("Font glyph miss");
+            setGlyph(info, renderGlyph(wc, flags));
+        }
+        return info;
+    }
+    
+    // Does not touch the cache, so it can run on a worker thread (with
+    // textMutex held).
+    Bitmap renderGlyph(wchar_t wc, unsigned flags) const
+    {
         wstring charString(1, wc);
         // TODO: Would be nice to have.
         // if (isFormattingChar(wc))
         //     charString.clear();
-        unsigned charWidth = Gosu::textWidth(charString, name, height, flags);
+        Bitmap bitmap = renderText(charString, Color::WHITE, name, height, flags);
+        return distanceFieldShader ? toDistanceField(bitmap) : bitmap;
+    }
+    
+    // Characters are packed onto textures that only this font uses, so
+    // that a line of text is drawn without switching textures. They are
+    // uploaded in batches by flushUploads(), which every function of Font
+    // that can create characters calls before it returns.
+    vector<tr1::shared_ptr<Texture> > atlases;
+    struct PendingUpload
+    {
+        tr1::shared_ptr<Texture> texture;
+        BlockAllocator::Block block;
+        // Including the padding.
+        Bitmap pixels;
+        TexChunk* chunk;
+    };
+    vector<PendingUpload> pendingUploads;
+    
+    unsigned atlasSize() const
+    {
+        // Room for at least 16 rows of characters.
+        unsigned size = 256;
+        while (size < 16 * (height + 2) && size < graphics->atlasSize())
+            size *= 2;
+        return size;
+    }
+    
+    bool allocOnAtlas(const Bitmap& padded, tr1::shared_ptr<Texture>& texture,
+        BlockAllocator::Block& block)
+    {
+        if (!atlases.empty() && atlases.back()->allocBlock(padded.width(), padded.height(), block))
+        {
+            texture = atlases.back();
+            return true;
+        }
+        if (padded.width() > atlasSize() || padded.height() > atlasSize())
+            return false;
+        // Glyphs are white, so their alpha is all there is to keep.
+        texture.reset(new Texture(atlasSize(), false, false,
+            hasTextureSwizzle() ? pfAlpha8 : pfRGBA8888));
+        texture->setMemoryCategory(mcFontGlyphs);
+        if (!texture->allocBlock(padded.width(), padded.height(), block))
+            return false;
+        atlases.push_back(texture);
+        return true;
+    }
+    
+    void setGlyph(CharInfo& info, const Bitmap& bitmap)
+    {
+        // Distance fields are at the font's size already.
+        info.distanceField = distanceFieldShader.get() != 0;
+        info.factor = info.distanceField ? 1.0 : 0.5;
         
-        Bitmap bitmap(charWidth, height);
-        drawText(bitmap, charString, 0, 0, Color::WHITE, name, height, flags);
-        info.image.reset(new Image(*graphics, bitmap));
-        info.factor = 0.5;
-        return *info.image;
+        PendingUpload upload;
+        applyBorderFlags(upload.pixels, bitmap, 0, 0, bitmap.width(), bitmap.height(), bfSmooth);
+        if (!allocOnAtlas(upload.pixels, upload.texture, upload.block))
+        {
+            // Too large for an atlas.
+            info.image.reset(new Image(*graphics, bitmap));
+            info.advance = info.image->width() * info.factor;
+            return;
+        }
+        
+        auto_ptr<TexChunk> chunk = graphics->createTexChunk(upload.texture,
+            upload.block.left + 1, upload.block.top + 1, bitmap.width(), bitmap.height(), 1);
+        upload.chunk = chunk.get();
+        pendingUploads.push_back(PendingUpload());
+        pendingUploads.back().texture = upload.texture;
+        pendingUploads.back().block = upload.block;
+        pendingUploads.back().pixels.swap(upload.pixels);
+        pendingUploads.back().chunk = upload.chunk;
+        info.image.reset(new Image(auto_ptr<ImageData>(chunk.release())));
+        info.advance = info.image->width() * info.factor;
+    }
+    
+    struct UploadOrder
+    {
+        const vector<PendingUpload>* uploads;
+        
+        bool operator()(size_t lhs, size_t rhs) const
+        {
+            const PendingUpload& l = (*uploads)[lhs];
+            const PendingUpload& r = (*uploads)[rhs];
+            if (l.texture != r.texture)
+                return l.texture < r.texture;
+            if (l.block.top != r.block.top)
+                return l.block.top < r.block.top;
+            return l.block.left < r.block.left;
+        }
+    };
+    
+    // Characters of the same height usually end up next to each other, so
+    // runs of them are uploaded at once.
+    void flushUploads()
+    {
+        vector<size_t> order(pendingUploads.size());
+        for (size_t i = 0; i < order.size(); ++i)
+            order[i] = i;
+        UploadOrder byPosition = { &pendingUploads };
+        sort(order.begin(), order.end(), byPosition);
+        
+        for (size_t first = 0, last; first < order.size(); first = last)
+        {
+            PendingUpload& start = pendingUploads[order[first]];
+            BlockAllocator::Block run = start.block;
+            for (last = first + 1; last < order.size(); ++last)
+            {
+                const PendingUpload& next = pendingUploads[order[last]];
+                if (next.texture != start.texture || next.block.top != run.top ||
+                        next.block.height != run.height || next.block.left != run.left + run.width)
+                    break;
+                run.width += next.block.width;
+            }
+            
+            GLFence fence;
+            if (last == first + 1)
+                fence = start.texture->upload(run, start.pixels);
+            else
+            {
+                Bitmap pixels(run.width, run.height);
+                for (size_t i = first; i < last; ++i)
+                {
+                    const PendingUpload& upload = pendingUploads[order[i]];
+                    pixels.insert(upload.pixels, upload.block.left - run.left, 0);
+                }
+                fence = start.texture->upload(run, pixels);
+            }
+            // The fence only tells when the whole run has arrived, which is
+            // what the last character of it waits for anyway.
+            pendingUploads[order[last - 1]].chunk->setUploadFence(fence);
+        }
+        pendingUploads.clear();
+    }
+    
+    // Characters rendered by Font::preload on a worker thread.
+    struct Preloaded
+    {
+        wstring characters;
+        unsigned flags;
+        vector<Bitmap> bitmaps;
+    };
+    
+    static void renderPreloaded(tr1::shared_ptr<const Impl> impl,
+        tr1::shared_ptr<Preloaded> preloaded)
+    {
+        Lock lock(textMutex);
+        for (size_t i = 0; i < preloaded->characters.size(); ++i)
+            preloaded->bitmaps.push_back(
+                impl->renderGlyph(preloaded->characters[i], preloaded->flags));
+    }
+    
+    static void createPreloaded(tr1::shared_ptr<Impl> impl,
+        tr1::shared_ptr<Preloaded> preloaded)
+    {
+        for (size_t i = 0; i < preloaded->characters.size(); ++i)
+        {
+            // The character may have been drawn in the meantime.
+            CharInfo& info = impl->charInfo(preloaded->characters[i], preloaded->flags);
+            if (!info.image.get())
+                impl->setGlyph(info, preloaded->bitmaps[i]);
+        }
+        impl->flushUploads();
     }
     
     double factorAt(const FormattedString& fs, unsigned index)
@@ -79,16 +438,109 @@ struct Gosu::Font::Impl
             return 1;
         return charInfo(fs.charAt(index), fs.flagsAt(index)).factor;
     }
+    
+    bool distanceFieldAt(const FormattedString& fs, unsigned index)
+    {
+        if (fs.entityAt(index))
+            return false;
+        return charInfo(fs.charAt(index), fs.flagsAt(index)).distanceField;
+    }
+    
+    // Has the distance field shader pushed while characters that need it
+    // are drawn, and only then, so that entities and images from setImage
+    // are drawn as they are.
+    class ShaderScope
+    {
+        Graphics& graphics;
+        const Shader* shader;
+        bool pushed;
+        
+    public:
+        ShaderScope(Graphics& graphics, const tr1::shared_ptr<Shader>& shader)
+        : graphics(graphics), shader(shader.get()), pushed(false)
+        {
+        }
+        
+        ~ShaderScope()
+        {
+            if (pushed)
+                graphics.popShader();
+        }
+        
+        void set(bool distanceField)
+        {
+            if (distanceField == pushed)
+                return;
+            if (distanceField)
+                graphics.pushShader(*shader);
+            else
+                graphics.popShader();
+            pushed = distanceField;
+        }
+    };
+    
+    void draw(const FormattedString& fs, double x, double y, ZPos z,
+        double factorX, double factorY, Color c, AlphaMode mode)
+    {
+        ShaderScope scope(*graphics, distanceFieldShader);
+        for (unsigned i = 0; i < fs.length(); ++i)
+        {
+            if (fs.entityAt(i))
+            {
+                const Image& image = imageAt(fs, i);
+                scope.set(false);
+                image.draw(x, y, z, factorX, factorY,
+                    Gosu::Color(fs.colorAt(i).alpha() * c.alpha() / 255, 255, 255, 255), mode);
+                x += image.width() * factorX;
+                continue;
+            }
+            
+            // One lookup for everything about the character.
+            const CharInfo& info = glyph(fs.charAt(i), fs.flagsAt(i));
+            scope.set(info.distanceField);
+            info.image->draw(x, y, z, factorX * info.factor, factorY * info.factor,
+                Gosu::multiply(fs.colorAt(i), c), mode);
+            x += info.advance * factorX;
+        }
+        flushUploads();
+    }
+    
+    double width(const FormattedString& fs)
+    {
+        double result = 0;
+        for (unsigned i = 0; i < fs.length(); ++i)
+            result += fs.entityAt(i) ? imageAt(fs, i).width() :
+                glyph(fs.charAt(i), fs.flagsAt(i)).advance;
+        flushUploads();
+        return result;
+    }
 };
 
 Gosu::Font::Font(Graphics& graphics, const wstring& fontName, unsigned fontHeight,
-    unsigned fontFlags)
+    unsigned fontFlags, bool distanceField)
 : pimpl(new Impl)
 {
     pimpl->graphics = &graphics;
     pimpl->name = fontName;
     pimpl->height = fontHeight * 2;
     pimpl->flags = fontFlags;
+    
+    if (distanceField)
+    {
+        // Without shaders, the characters are rendered as usual.
+        try
+        {
+            pimpl->distanceFieldShader = sharedDistanceFieldShader();
+        }
+        catch (const runtime_error&)
+        {
+        }
+    }
+}
+
+bool Gosu::Font::distanceField() const
+{
+    return pimpl->distanceFieldShader.get() != 0;
 }
 
 wstring Gosu::Font::name() const
@@ -109,35 +561,18 @@ unsigned Gosu::Font::flags() const
 double Gosu::Font::textWidthDefined(const wstring& text, int b, int u, int i, double factorX) const
 {
     FormattedString fs(text.c_str(), 0, b, u, i);
-    double result = 0;
-    for (unsigned i = 0; i < fs.length(); ++i)
-    {
-        const Image& image = pimpl->imageAt(fs, i);
-        double factor = pimpl->factorAt(fs, i);
-        result += image.width() * factor;
-    }
-    return result * factorX;
+    return pimpl->width(fs) * factorX;
 }
 
 double Gosu::Font::textWidth(const wstring& text, double factorX) const {
-  return textWidthDefined(text, (flags() & ffBold) ? 1 : 0, (flags() & ffUnderline) ? 1 : 0, (flags() & ffItalic) ? 1 : 0);
+  return textWidthDefined(text, (flags() & ffBold) ? 1 : 0, (flags() & ffUnderline) ? 1 : 0, (flags() & ffItalic) ? 1 : 0, factorX);
 }
 
 void Gosu::Font::draw(const wstring& text, double x, double y, ZPos z,
     double factorX, double factorY, Color c, AlphaMode mode) const
 {
     FormattedString fs(text.c_str(), flags());
-    
-    for (unsigned i = 0; i < fs.length(); ++i)
-    {
-        const Image& image = pimpl->imageAt(fs, i);
-        double factor = pimpl->factorAt(fs, i);
-        Gosu::Color color = fs.entityAt(i)
-                          ? Gosu::Color(fs.colorAt(i).alpha() * c.alpha() / 255, 255, 255, 255)
-                          : Gosu::multiply(fs.colorAt(i), c);
-        image.draw(x, y, z, factorX * factor, factorY * factor, color, mode);
-        x += image.width() * factorX * factor;
-    }
+    pimpl->draw(fs, x, y, z, factorX, factorY, c, mode);
 }
 
 void Gosu::Font::drawDefined(const wstring& text, double x, double y, ZPos z,
@@ -145,17 +580,7 @@ void Gosu::Font::drawDefined(const wstring& text, double x, double y, ZPos z,
 {
   // The only thing that makes us different from the "normal" Font::draw.
   FormattedString fs(text.c_str(), 0, bold, underline, italic);
-
-  for (unsigned i = 0; i < fs.length(); ++i)
-  {
-      const Image& image = pimpl->imageAt(fs, i);
-      double factor = pimpl->factorAt(fs, i);
-      Gosu::Color color = fs.entityAt(i)
-                        ? Gosu::Color(fs.colorAt(i).alpha() * c.alpha() / 255, 255, 255, 255)
-                        : Gosu::multiply(fs.colorAt(i), c);
-      image.draw(x, y, z, factorX * factor, factorY * factor, color, mode);
-      x += image.width() * factorX * factor;
-  }
+  pimpl->draw(fs, x, y, z, factorX, factorY, c, mode);
 }
 
 void Gosu::Font::drawRel(const wstring& text, double x, double y, ZPos z,
@@ -181,6 +606,155 @@ void Gosu::Font::setImage(wchar_t wc, unsigned fontFlags, const Image& image)
         throw logic_error("Cannot set image for the same Font character twice or after it has been drawn");
     ci.image.reset(new Gosu::Image(image));
     ci.factor = 1.0;
+    ci.distanceField = false;
+    ci.advance = image.width();
+}
+
+void Gosu::Font::preload(const wstring& characters) const
+{
+    preload(characters, flags());
+}
+
+void Gosu::Font::preload(const wstring& characters, unsigned fontFlags) const
+{
+    for (unsigned i = 0; i < characters.size(); ++i)
+        pimpl->glyph(characters[i], fontFlags);
+    pimpl->flushUploads();
+}
+
+void Gosu::Font::preload(wchar_t first, wchar_t last) const
+{
+    for (tr1::uint32_t wc = first; wc <= static_cast<tr1::uint32_t>(last); ++wc)
+        pimpl->glyph(wc, flags());
+    pimpl->flushUploads();
+}
+
+void Gosu::Font::preload(AsyncPool& pool, const wstring& characters,
+    unsigned fontFlags) const
+{
+    // Only renders what is missing, and looks that up here, because the
+    // cache must not be touched by the worker.
+    tr1::shared_ptr<Impl::Preloaded> preloaded(new Impl::Preloaded);
+    preloaded->flags = fontFlags;
+    for (unsigned i = 0; i < characters.size(); ++i)
+        if (!pimpl->charInfo(characters[i], fontFlags).image.get() &&
+                preloaded->characters.find(characters[i]) == wstring::npos)
+            preloaded->characters += characters[i];
+    if (preloaded->characters.empty())
+        return;
+    
+    pool.enqueue(tr1::bind(&Impl::renderPreloaded, pimpl, preloaded),
+        tr1::bind(&Impl::createPreloaded, pimpl, preloaded));
+}
+
+std::size_t Gosu::Font::memoryUsage() const
+{
+    std::size_t result = 0;
+    for (unsigned i = 0; i < pimpl->atlases.size(); ++i)
+        result += pimpl->atlases[i]->memory();
+    return result;
+}
+
+struct Gosu::TextLayout::Impl
+{
+    Font font;
+    wstring text;
+    bool dirty;
+    
+    // Everything that Font::draw figures out per character, with the
+    // position relative to the start of the text.
+    struct Glyph
+    {
+        const Image* image;
+        double x, factor;
+        Color color;
+        bool entity, distanceField;
+    };
+    vector<Glyph> glyphs;
+    double width;
+    
+    Impl(const Font& font, const wstring& text)
+    : font(font), text(text), dirty(true), width(0)
+    {
+    }
+    
+    void layOut()
+    {
+        if (!dirty)
+            return;
+        
+        Font::Impl& fontImpl = *font.pimpl;
+        FormattedString fs(text.c_str(), font.flags());
+        glyphs.resize(fs.length());
+        width = 0;
+        for (unsigned i = 0; i < fs.length(); ++i)
+        {
+            Glyph& glyph = glyphs[i];
+            glyph.image = &fontImpl.imageAt(fs, i);
+            glyph.x = width;
+            glyph.factor = fontImpl.factorAt(fs, i);
+            glyph.color = fs.colorAt(i);
+            glyph.entity = fs.entityAt(i) != 0;
+            glyph.distanceField = fontImpl.distanceFieldAt(fs, i);
+            width += glyph.image->width() * glyph.factor;
+        }
+        fontImpl.flushUploads();
+        dirty = false;
+    }
+};
+
+Gosu::TextLayout::TextLayout(const Font& font, const wstring& text)
+: pimpl(new Impl(font, text))
+{
+}
+
+const Gosu::Font& Gosu::TextLayout::font() const
+{
+    return pimpl->font;
+}
+
+void Gosu::TextLayout::setFont(const Font& font)
+{
+    pimpl->font = font;
+    pimpl->dirty = true;
+}
+
+const wstring& Gosu::TextLayout::text() const
+{
+    return pimpl->text;
+}
+
+void Gosu::TextLayout::setText(const wstring& text)
+{
+    if (text == pimpl->text)
+        return;
+    pimpl->text = text;
+    pimpl->dirty = true;
+}
+
+double Gosu::TextLayout::width() const
+{
+    pimpl->layOut();
+    return pimpl->width;
+}
+
+void Gosu::TextLayout::draw(double x, double y, ZPos z,
+    double factorX, double factorY, Color c, AlphaMode mode) const
+{
+    pimpl->layOut();
+    
+    const Font::Impl& fontImpl = *pimpl->font.pimpl;
+    Font::Impl::ShaderScope scope(*fontImpl.graphics, fontImpl.distanceFieldShader);
+    for (unsigned i = 0; i < pimpl->glyphs.size(); ++i)
+    {
+        const Impl::Glyph& glyph = pimpl->glyphs[i];
+        scope.set(glyph.distanceField);
+        Gosu::Color color = glyph.entity
+                          ? Gosu::Color(glyph.color.alpha() * c.alpha() / 255, 255, 255, 255)
+                          : Gosu::multiply(glyph.color, c);
+        glyph.image->draw(x + glyph.x * factorX, y, z,
+            factorX * glyph.factor, factorY * glyph.factor, color, mode);
+    }
 }
 
 void Gosu::Font::drawRot(const wstring& text, double x, double y, ZPos z, double angle,
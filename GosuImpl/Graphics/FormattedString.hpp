@@ -4,10 +4,12 @@
 #include <Gosu/Color.hpp>
 #include <Gosu/Utility.hpp>
 #include <Gosu/TR1.hpp>
+#include <algorithm>
 #include <cassert>
 #include <cwchar>
 #include <cwctype>
 #include <stdexcept>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -15,25 +17,54 @@ namespace Gosu
 {
     class FormattedString
     {
-        struct FormattedChar
+        // A run of characters with the same style. Each entity is a span of
+        // its own.
+        struct Span
         {
-            wchar_t wc;
+            unsigned begin;
             Gosu::Color color;
             unsigned flags;
-            std::wstring entity;
+            // Index into Data::entities plus one, or 0 for text.
+            unsigned entity;
+        };
+        
+        // Shared by all copies and ranges of a string, which are thus cheap
+        // to create. Never changes once the string has been parsed.
+        struct Data
+        {
+            // Entities are stored as 0 characters.
+            std::wstring text;
+            // Sorted by begin, the first one begins at 0.
+            std::vector<Span> spans;
+            std::vector<std::wstring> entities;
+            
+            void append(wchar_t wc, Gosu::Color color, unsigned flags)
+            {
+                if (spans.empty() || spans.back().entity ||
+                        spans.back().color != color || spans.back().flags != flags)
+                {
+                    Span span = { static_cast<unsigned>(text.size()), color, flags, 0 };
+                    spans.push_back(span);
+                }
+                text += wc;
+            }
             
-            bool sameStyleAs(const FormattedChar& other) const
+            void appendEntity(const std::wstring& name, Gosu::Color color)
             {
-                return wc && other.wc && color == other.color && flags == other.flags;
+                std::vector<std::wstring>::iterator it =
+                    std::find(entities.begin(), entities.end(), name);
+                unsigned entity = static_cast<unsigned>(it - entities.begin()) + 1;
+                if (it == entities.end())
+                    entities.push_back(name);
+                Span span = { static_cast<unsigned>(text.size()), color, 0, entity };
+                spans.push_back(span);
+                text += L'\0';
             }
         };
+        std::tr1::shared_ptr<const Data> data;
+        // The part of data->text that this string consists of.
+        unsigned first, last;
         
-        // If characters.empty(), use these for the whole string.
-        std::wstring simpleString;
-        unsigned simpleFlags;
-        // If not characters.empty(), ignore above fields and use this.
-        std::vector<FormattedChar> characters;
-
         static unsigned flags(int b, int u, int i)
         {
             unsigned flags = 0;
@@ -43,14 +74,27 @@ namespace Gosu
             return flags;
         }
         
+        static bool beginsAfter(unsigned pos, const Span& span)
+        {
+            return pos < span.begin;
+        }
+        
+        std::vector<Span>::const_iterator spanAt(unsigned index) const
+        {
+            return std::upper_bound(data->spans.begin(), data->spans.end(),
+                first + index, beginsAfter) - 1;
+        }
+        
     public:
         FormattedString()
+        : first(0), last(0)
         {
         }
         
         //! If baseFlags is set, it has priority over b, u and i.
         //! If baseFlags is 0, it is constructed out of b, u and i.
         explicit FormattedString(const wchar_t* html, unsigned baseFlags, int b = 0, int u = 0, int i = 0)
+        : first(0), last(0)
         {
             // Remove \r characters if existent. Avoid a copy if we don't need one.
             std::wstring unixified;
@@ -80,14 +124,20 @@ namespace Gosu
               i = (baseFlags & ffItalic) ? 1 : 0;
             }
 
+            std::tr1::shared_ptr<Data> parsed(new Data);
+            data = parsed;
+            last = len;
+            
             // Just skip all this if there are entities or formatting tags in the string.
             if (std::wcscspn(html, L"<&") == len)
             {
-                simpleString = html;
-                simpleFlags = baseFlags;
+                parsed->text = html;
+                Span span = { 0, Color::WHITE, baseFlags, 0 };
+                parsed->spans.push_back(span);
                 return;
             }
 
+            parsed->text.reserve(len);
             unsigned pos = 0;
             std::vector<Gosu::Color> c;
             c.push_back(0xffffffff);
@@ -156,22 +206,19 @@ namespace Gosu
                 }
                 if (!std::wcsncmp(html + pos, L"&lt;", 4))
                 {
-                    FormattedChar fc = { L'<', c.back(), flags(b,u,i) };
-                    characters.push_back(fc);
+                    parsed->append(L'<', c.back(), flags(b,u,i));
                     pos += 4;
                     continue;
                 }
                 if (!std::wcsncmp(html + pos, L"&gt;", 4))
                 {
-                    FormattedChar fc = { L'>', c.back(), flags(b,u,i) };
-                    characters.push_back(fc);
+                    parsed->append(L'>', c.back(), flags(b,u,i));
                     pos += 4;
                     continue;
                 }
                 if (!std::wcsncmp(html + pos, L"&amp;", 5))
                 {
-                    FormattedChar fc = { L'&', c.back(), flags(b,u,i) };
-                    characters.push_back(fc);
+                    parsed->append(L'&', c.back(), flags(b,u,i));
                     pos += 5;
                     continue;
                 }
@@ -189,86 +236,67 @@ namespace Gosu
                         if (endOfEntity >= len)
                             goto normalCharacter;
                     }
-                    FormattedChar fc = { 0, c.back(), 0, std::wstring(html + pos + 1, html + endOfEntity) };
-                    if (!isEntity(fc.entity))
+                    std::wstring entity(html + pos + 1, html + endOfEntity);
+                    if (!isEntity(entity))
                         goto normalCharacter;
-                    characters.push_back(fc);
+                    parsed->appendEntity(entity, c.back());
                     pos = endOfEntity + 1;
                     continue;
                 }
                 
             normalCharacter:                
-                FormattedChar fc = { html[pos], c.back(), flags(b,u,i) };
-                characters.push_back(fc);
+                parsed->append(html[pos], c.back(), flags(b,u,i));
                 pos += 1;
             }
+            last = parsed->text.size();
         }
         
         std::wstring unformat() const
         {
-            if (characters.empty())
-                return simpleString;
-            
-            std::wstring result(characters.size(), 0);
-            for (int i = 0; i < characters.size(); ++i)
-                result[i] = characters[i].wc;
-            return result;
+            if (!data)
+                return std::wstring();
+            return data->text.substr(first, last - first);
         }
         
         const wchar_t* entityAt(unsigned index) const
         {
-            if (characters.empty())
-                return 0;
-            
-            assert (index <= characters.size());
+            assert (index < length());
             
-            if (characters[index].wc != 0 || characters[index].entity.empty())
+            unsigned entity = spanAt(index)->entity;
+            if (entity == 0)
                 return 0;
-            return characters[index].entity.c_str();
+            return data->entities[entity - 1].c_str();
         }
         
         wchar_t charAt(unsigned index) const
         {
-            if (characters.empty())
-                return simpleString[index];
-            else
-                return characters[index].wc;
+            return data->text[first + index];
         }
         
         unsigned flagsAt(unsigned index) const
         {
-            if (characters.empty())
-                return simpleFlags;
-            else
-                return characters[index].flags;
+            return spanAt(index)->flags;
         }
         
         Gosu::Color colorAt(unsigned index) const
         {
-            if (characters.empty())
-                return Color::WHITE;
-            else
-                return characters[index].color;
+            return spanAt(index)->color;
         }
         
         unsigned length() const
         {
-            if (unsigned len = characters.size())
-                return len;
-            else
-                return simpleString.length();
+            return last - first;
         }
         
+        // Shares the characters with this string instead of copying them.
         FormattedString range(unsigned begin, unsigned end) const
         {
+            assert (begin <= end && end <= length());
+            
             FormattedString result;
-            if (characters.empty())
-            {
-                result.simpleString.assign(simpleString.begin() + begin, simpleString.begin() + end);
-                result.simpleFlags = simpleFlags;
-            }
-            else
-                result.characters.assign(characters.begin() + begin, characters.begin() + end);
+            result.data = data;
+            result.first = first + begin;
+            result.last = first + end;
             return result;
         }
         
@@ -286,20 +314,26 @@ namespace Gosu
             return result;
         }
         
+        // Returns where the part that the character at index belongs to
+        // ends, i.e. the first index with a different style, or length().
+        // For walking through the parts without splitParts.
+        unsigned endOfPart(unsigned index) const
+        {
+            std::vector<Span>::const_iterator next = spanAt(index) + 1;
+            unsigned end = next == data->spans.end() ? last : std::min(next->begin, last);
+            return end - first;
+        }
+        
         std::vector<FormattedString> splitParts() const
         {
-            if (characters.empty())
-                return std::vector<FormattedString>(1, *this);
-            
             std::vector<FormattedString> result;
-            unsigned begin = 0;
-            for (unsigned cur = 1; cur < length(); ++cur)
-                if (!characters[begin].sameStyleAs(characters[cur]))
-                {
-                    result.push_back(range(begin, cur));
-                    begin = cur;
-                }
-            result.push_back(range(begin, length()));
+            for (unsigned begin = 0, end; begin < length(); begin = end)
+            {
+                end = endOfPart(begin);
+                result.push_back(range(begin, end));
+            }
+            if (result.empty())
+                result.push_back(*this);
             return result;
         }
     };
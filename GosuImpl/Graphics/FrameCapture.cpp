@@ -0,0 +1,228 @@
+#include <GosuImpl/Graphics/FrameCapture.hpp>
+#include <GosuImpl/Graphics/Texture.hpp>
+#include <Gosu/Utility.hpp>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+
+// A capture starts with a header, followed by the textures, the transforms
+// and the ops. Integers are 32 bits, floating-point numbers are stored as
+// floats or doubles like in DrawOp; everything is little-endian.
+//   Header:     "GosuCapt", version, width and height of the screen in
+//               pixels, 1 if alpha is premultiplied, number of textures,
+//               of transforms and of ops
+//   Textures:   size, 1 if mipmapped
+//   Transforms: 16 doubles each
+//   Ops:        Z (double), texture index or -1, transform index, clip
+//               rectangle (4 doubles, width NO_CLIPPING if none), alpha
+//               mode, shader index or -1, texture coordinates left, top,
+//               right, bottom (floats), number of vertices or -1 for a GL
+//               block, then four vertices of x, y (floats) and ARGB color
+
+namespace Gosu
+{
+    namespace
+    {
+        const char MAGIC[8] = { 'G', 'o', 's', 'u', 'C', 'a', 'p', 't' };
+        const std::tr1::uint32_t VERSION = 1;
+        enum { HEADER_SIZE = 36, TEXTURE_SIZE = 8, TRANSFORM_SIZE = 128, OP_SIZE = 124 };
+
+        typedef std::tr1::uint32_t UInt32;
+        typedef std::tr1::int32_t Int32;
+
+        // Numbers each distinct pointer in the order they are first seen.
+        template<typename T>
+        Int32 indexOf(T* pointer, std::map<T*, Int32>& indices)
+        {
+            if (!pointer)
+                return -1;
+            typename std::map<T*, Int32>::iterator it = indices.find(pointer);
+            if (it != indices.end())
+                return it->second;
+            Int32 index = static_cast<Int32>(indices.size());
+            indices[pointer] = index;
+            return index;
+        }
+
+        template<typename T>
+        std::vector<T*> byIndex(const std::map<T*, Int32>& indices)
+        {
+            std::vector<T*> result(indices.size());
+            for (typename std::map<T*, Int32>::const_iterator it = indices.begin();
+                    it != indices.end(); ++it)
+                result[it->second] = it->first;
+            return result;
+        }
+    }
+}
+
+void Gosu::captureDrawOps(const std::vector<DrawOp>& ops,
+    const std::vector<RenderState>& renderStates, unsigned width, unsigned height,
+    Buffer& buffer)
+{
+    std::map<Texture*, Int32> textures;
+    std::map<const Transform*, Int32> transforms;
+    std::map<ShaderProgram*, Int32> programs;
+    Buffer opData;
+    Writer opWriter = opData.backWriter();
+    for (std::vector<DrawOp>::const_iterator op = ops.begin(); op != ops.end(); ++op)
+    {
+        const RenderState& rs = renderStates[op->renderStateIndex];
+        opWriter.writePod(op->z, boLittle);
+        opWriter.writePod(indexOf(rs.texture, textures), boLittle);
+        opWriter.writePod(indexOf(rs.transform, transforms), boLittle);
+        opWriter.writePod(rs.clipRect.x, boLittle);
+        opWriter.writePod(rs.clipRect.y, boLittle);
+        opWriter.writePod(rs.clipRect.width, boLittle);
+        opWriter.writePod(rs.clipRect.height, boLittle);
+        opWriter.writePod<UInt32>(rs.mode, boLittle);
+        opWriter.writePod(indexOf(rs.program, programs), boLittle);
+        // Textured ops are quads whose texture coordinates form a
+        // rectangle, see DrawOp::setTexCoords.
+        const ArrayVertex& topLeft = op->vertices[0];
+        #ifdef GOSU_IS_IPHONE
+        const ArrayVertex& bottomRight = op->vertices[3];
+        #else
+        const ArrayVertex& bottomRight = op->vertices[2];
+        #endif
+        GLfloat left = 0, top = 0, right = 0, bottom = 0;
+        if (rs.texture)
+            left = topLeft.u, top = topLeft.v, right = bottomRight.u, bottom = bottomRight.v;
+        opWriter.writePod(left, boLittle);
+        opWriter.writePod(top, boLittle);
+        opWriter.writePod(right, boLittle);
+        opWriter.writePod(bottom, boLittle);
+        opWriter.writePod<Int32>(op->verticesOrBlockIndex < 0 ? -1 : op->verticesOrBlockIndex,
+            boLittle);
+        for (int i = 0; i < 4; ++i)
+        {
+            // GL blocks leave their vertices uninitialized.
+            ArrayVertex vertex = op->verticesOrBlockIndex > i ?
+                op->vertices[i] : ArrayVertex(0, 0, Color::NONE);
+            opWriter.writePod(vertex.x, boLittle);
+            opWriter.writePod(vertex.y, boLittle);
+            opWriter.writePod(vertex.c.argb(), boLittle);
+        }
+    }
+
+    Writer writer = buffer.backWriter();
+    writer.write(MAGIC, sizeof MAGIC);
+    writer.writePod(VERSION, boLittle);
+    writer.writePod<UInt32>(width, boLittle);
+    writer.writePod<UInt32>(height, boLittle);
+    writer.writePod<UInt32>(premultipliedAlpha, boLittle);
+    writer.writePod<UInt32>(textures.size(), boLittle);
+    writer.writePod<UInt32>(transforms.size(), boLittle);
+    writer.writePod<UInt32>(ops.size(), boLittle);
+
+    std::vector<Texture*> textureList = byIndex(textures);
+    for (std::size_t i = 0; i < textureList.size(); ++i)
+    {
+        writer.writePod<UInt32>(textureList[i]->size(), boLittle);
+        writer.writePod<UInt32>(textureList[i]->isMipmapped(), boLittle);
+    }
+    std::vector<const Transform*> transformList = byIndex(transforms);
+    for (std::size_t i = 0; i < transformList.size(); ++i)
+        for (int j = 0; j < 16; ++j)
+            writer.writePod((*transformList[i])[j], boLittle);
+
+    if (opData.size() > 0)
+        writer.write(opData.data(), opData.size());
+}
+
+Gosu::CapturedFrame::CapturedFrame(const std::wstring& filename)
+: glBlocks(0)
+{
+    const std::string invalid = "Invalid frame capture " + wstringToUTF8(filename);
+
+    File file(filename);
+    const std::size_t fileSize = file.size();
+    Reader reader = file.frontReader();
+
+    char magic[sizeof MAGIC];
+    if (fileSize < HEADER_SIZE)
+        throw std::runtime_error(invalid);
+    reader.read(magic, sizeof magic);
+    if (!std::equal(MAGIC, MAGIC + sizeof MAGIC, magic) ||
+            reader.getPod<UInt32>(boLittle) != VERSION)
+        throw std::runtime_error(invalid);
+
+    width = reader.getPod<UInt32>(boLittle);
+    height = reader.getPod<UInt32>(boLittle);
+    premultiplied = reader.getPod<UInt32>(boLittle) != 0;
+    UInt32 textureCount = reader.getPod<UInt32>(boLittle);
+    UInt32 transformCount = reader.getPod<UInt32>(boLittle);
+    UInt32 opCount = reader.getPod<UInt32>(boLittle);
+    std::size_t rest = fileSize - HEADER_SIZE;
+    if (textureCount > rest / TEXTURE_SIZE || transformCount > rest / TRANSFORM_SIZE ||
+            opCount > rest / OP_SIZE || textureCount * TEXTURE_SIZE +
+            transformCount * TRANSFORM_SIZE + std::size_t(opCount) * OP_SIZE != rest)
+        throw std::runtime_error(invalid);
+
+    textureInfos.resize(textureCount);
+    for (UInt32 i = 0; i < textureCount; ++i)
+    {
+        textureInfos[i].size = reader.getPod<UInt32>(boLittle);
+        textureInfos[i].mipmapped = reader.getPod<UInt32>(boLittle) != 0;
+        if (textureInfos[i].size == 0)
+            throw std::runtime_error(invalid);
+    }
+
+    transforms.resize(transformCount);
+    for (UInt32 i = 0; i < transformCount; ++i)
+        for (int j = 0; j < 16; ++j)
+            transforms[i][j] = reader.getPod<double>(boLittle);
+
+    ops.resize(opCount);
+    renderStates.resize(opCount);
+    textureIndices.resize(opCount);
+    for (UInt32 i = 0; i < opCount; ++i)
+    {
+        DrawOp& op = ops[i];
+        RenderState& rs = renderStates[i];
+        op.renderStateIndex = i;
+        op.z = reader.getPod<double>(boLittle);
+        Int32 texture = reader.getPod<Int32>(boLittle);
+        UInt32 transform = reader.getPod<UInt32>(boLittle);
+        rs.clipRect.x = reader.getPod<double>(boLittle);
+        rs.clipRect.y = reader.getPod<double>(boLittle);
+        rs.clipRect.width = reader.getPod<double>(boLittle);
+        rs.clipRect.height = reader.getPod<double>(boLittle);
+        UInt32 mode = reader.getPod<UInt32>(boLittle);
+        reader.getPod<Int32>(boLittle);
+        GLfloat left = reader.getPod<float>(boLittle);
+        GLfloat top = reader.getPod<float>(boLittle);
+        GLfloat right = reader.getPod<float>(boLittle);
+        GLfloat bottom = reader.getPod<float>(boLittle);
+        Int32 vertices = reader.getPod<Int32>(boLittle);
+        for (int v = 0; v < 4; ++v)
+        {
+            GLfloat x = reader.getPod<float>(boLittle);
+            GLfloat y = reader.getPod<float>(boLittle);
+            op.vertices[v] = ArrayVertex(x, y, Color(reader.getPod<UInt32>(boLittle)));
+        }
+        if (texture >= 0)
+            op.setTexCoords(left, top, right, bottom);
+
+        if (texture < -1 || texture >= Int32(textureCount) || transform >= transformCount ||
+                mode > amMultiply || (vertices != -1 && (vertices < 2 || vertices > 4)))
+            throw std::runtime_error(invalid);
+        textureIndices[i] = texture;
+        rs.transform = &transforms[transform];
+        rs.mode = static_cast<AlphaMode>(mode);
+        op.verticesOrBlockIndex = vertices < 0 ? ~int(glBlocks++) : vertices;
+    }
+}
+
+void Gosu::CapturedFrame::createTextures()
+{
+    if (!textures.empty() || textureInfos.empty())
+        return;
+
+    for (std::size_t i = 0; i < textureInfos.size(); ++i)
+        textures.push_back(std::tr1::shared_ptr<Texture>(
+            new Texture(textureInfos[i].size, false, textureInfos[i].mipmapped)));
+    for (std::size_t i = 0; i < ops.size(); ++i)
+        if (textureIndices[i] >= 0)
+            renderStates[i].texture = textures[textureIndices[i]].get();
+}
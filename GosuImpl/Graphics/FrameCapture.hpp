@@ -0,0 +1,61 @@
+#ifndef GOSUIMPL_GRAPHICS_FRAMECAPTURE_HPP
+#define GOSUIMPL_GRAPHICS_FRAMECAPTURE_HPP
+
+#include <Gosu/Fwd.hpp>
+#include <Gosu/IO.hpp>
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/DrawOp.hpp>
+#include <string>
+#include <vector>
+
+namespace Gosu
+{
+    // Appends the ops of a frame, in the order in which they are about to be
+    // rendered, to the buffer. Textures, transforms and shaders are stored
+    // by identity; pixels, shader code and GL blocks are not stored at all.
+    // The ops refer to the given render states.
+    void captureDrawOps(const std::vector<DrawOp>& ops,
+        const std::vector<RenderState>& renderStates, unsigned width, unsigned height,
+        Buffer& buffer);
+
+    // A frame that has been saved by Graphics::captureFrame, for replaying
+    // it without the game that drew it (see DrawOpQueue::replay).
+    class CapturedFrame
+    {
+        // Not copyable, since the ops point into the other members.
+        CapturedFrame(const CapturedFrame&);
+        CapturedFrame& operator=(const CapturedFrame&);
+
+        // Index of each op's texture, or -1.
+        std::vector<int> textureIndices;
+
+    public:
+        struct TextureInfo
+        {
+            unsigned size;
+            bool mipmapped;
+        };
+
+        unsigned width, height;
+        bool premultiplied;
+        std::vector<TextureInfo> textureInfos;
+        std::vector<std::tr1::shared_ptr<Texture> > textures;
+        std::vector<Transform> transforms;
+        // One render state per op.
+        std::vector<RenderState> renderStates;
+        // GL blocks are numbered from 0 to glBlocks - 1.
+        std::vector<DrawOp> ops;
+        unsigned glBlocks;
+
+        explicit CapturedFrame(const std::wstring& filename);
+
+        // Creates textures of the captured sizes, with undefined contents,
+        // and points the ops to them. Needs an OpenGL context, so this is
+        // not done by the constructor. Shaders are not recreated; captured
+        // ops are drawn with the fixed-function pipeline.
+        void createTextures();
+    };
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef GOSUIMPL_GRAPHICS_FRAMELIMITER_HPP
+#define GOSUIMPL_GRAPHICS_FRAMELIMITER_HPP
+
+#include <Gosu/Trace.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <deque>
+#include <stdexcept>
+
+// Keeps the driver from queueing up more than a given number of frames
+// after swapping buffers, which it otherwise does for two or three frames,
+// each of them adding to the time between reading input and showing its
+// effect. A fence goes after each swap, and before the next frame is
+// updated, the window waits for the fence from that many frames ago.
+// Without fences (OpenGL 3.2 or ARB_sync), it does nothing.
+class Gosu::FrameLimiter
+{
+    // Not copyable
+    FrameLimiter(const FrameLimiter&);
+    FrameLimiter& operator=(const FrameLimiter&);
+
+    // 0 leaves it to the driver.
+    unsigned frames;
+    // Fences of the frames that may still be in flight, oldest first.
+    std::deque<GLFence> fences;
+
+    void pop(bool waitForGPU)
+    {
+        const GLSyncFunctions& sync = glSyncFunctions();
+        if (waitForGPU)
+            sync.clientWaitSync(fences.front(), GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        sync.deleteSync(fences.front());
+        fences.pop_front();
+    }
+
+public:
+    enum { MAX_FRAMES = 3 };
+
+    FrameLimiter()
+    : frames(0)
+    {
+    }
+
+    void setFrames(unsigned frames)
+    {
+        if (frames > MAX_FRAMES)
+            throw std::invalid_argument("At most three frames can be in flight");
+        this->frames = frames;
+    }
+
+    // Call right after swapping buffers, in the context that swapped them.
+    void frameSwapped()
+    {
+        if (frames == 0 || !glSyncFunctions().available)
+            return;
+        fences.push_back(glSyncFunctions().fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    }
+
+    // Call before updating the next frame.
+    void wait()
+    {
+        // When the limit is lifted, old fences are not worth waiting for.
+        if (frames == 0)
+            reset();
+        if (frames == 0 || fences.size() < frames)
+            return;
+        GOSU_TRACE("Wait for GPU");
+        while (fences.size() >= frames)
+            pop(true);
+    }
+
+    // Drops all fences. Call before the context goes away.
+    void reset()
+    {
+        while (!fences.empty())
+            pop(false);
+    }
+};
+
+#endif
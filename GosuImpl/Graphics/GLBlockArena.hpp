@@ -0,0 +1,147 @@
+#ifndef GOSUIMPL_GRAPHICS_GLBLOCKARENA_HPP
+#define GOSUIMPL_GRAPHICS_GLBLOCKARENA_HPP
+
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Stores the GL blocks of a DrawOpQueue for one frame. The functors are
+// copied into chunks of memory that are kept from frame to frame, so that
+// scheduling a block (e.g. for every Macro::draw) does not allocate once
+// the chunks have grown large enough. Only empty arenas can be copied.
+class Gosu::GLBlockArena
+{
+    // Functors are placed at multiples of this from the start of a chunk,
+    // which is aligned for any type by operator new.
+    static const std::size_t ALIGNMENT = 16;
+    static const std::size_t CHUNK_SIZE = 16384;
+
+    struct Entry
+    {
+        void* functor;
+        void (*call)(const void* functor);
+        void (*destroy)(void* functor);
+        std::tr1::function<void()> (*copy)(const void* functor);
+    };
+    std::vector<Entry> entries;
+
+    std::vector<char*> chunks;
+    std::size_t currentChunk, usedInChunk;
+    // Functors that do not fit into a chunk get memory of their own until
+    // the next clear().
+    std::vector<char*> oversized;
+
+    GLBlockArena& operator=(const GLBlockArena&);
+
+    template<typename Functor>
+    static void callFunctor(const void* functor)
+    {
+        (*static_cast<const Functor*>(functor))();
+    }
+
+    template<typename Functor>
+    static void destroyFunctor(void* functor)
+    {
+        static_cast<Functor*>(functor)->~Functor();
+    }
+
+    template<typename Functor>
+    static std::tr1::function<void()> copyFunctor(const void* functor)
+    {
+        return *static_cast<const Functor*>(functor);
+    }
+
+    void* allocate(std::size_t size)
+    {
+        size = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        if (size > CHUNK_SIZE)
+        {
+            oversized.reserve(oversized.size() + 1);
+            oversized.push_back(new char[size]);
+            return oversized.back();
+        }
+
+        if (currentChunk < chunks.size() && usedInChunk + size > CHUNK_SIZE)
+            ++currentChunk, usedInChunk = 0;
+        if (currentChunk == chunks.size())
+        {
+            chunks.reserve(chunks.size() + 1);
+            chunks.push_back(new char[CHUNK_SIZE]);
+        }
+        void* result = chunks[currentChunk] + usedInChunk;
+        usedInChunk += size;
+        return result;
+    }
+
+public:
+    GLBlockArena()
+    : currentChunk(0), usedInChunk(0)
+    {
+    }
+
+    // For std::list::resize, which copies a new, empty queue.
+    GLBlockArena(const GLBlockArena& other)
+    : currentChunk(0), usedInChunk(0)
+    {
+        assert (other.empty());
+    }
+
+    ~GLBlockArena()
+    {
+        clear();
+        for (std::size_t i = 0; i < chunks.size(); ++i)
+            delete[] chunks[i];
+    }
+
+    std::size_t size() const
+    {
+        return entries.size();
+    }
+
+    bool empty() const
+    {
+        return entries.empty();
+    }
+
+    template<typename Functor>
+    void push(const Functor& functor)
+    {
+        if (entries.size() == entries.capacity())
+            entries.reserve(entries.size() * 2 + 16);
+
+        Entry entry;
+        entry.functor = new(allocate(sizeof(Functor))) Functor(functor);
+        entry.call = &callFunctor<Functor>;
+        entry.destroy = &destroyFunctor<Functor>;
+        entry.copy = &copyFunctor<Functor>;
+        entries.push_back(entry);
+    }
+
+    void call(std::size_t index) const
+    {
+        entries[index].call(entries[index].functor);
+    }
+
+    // A copy of the block that outlives the arena, for macros.
+    std::tr1::function<void()> function(std::size_t index) const
+    {
+        return entries[index].copy(entries[index].functor);
+    }
+
+    // Destroys all blocks, but keeps the chunks for the next frame.
+    void clear()
+    {
+        for (std::size_t i = 0; i < entries.size(); ++i)
+            entries[i].destroy(entries[i].functor);
+        entries.clear();
+        currentChunk = usedInChunk = 0;
+        for (std::size_t i = 0; i < oversized.size(); ++i)
+            delete[] oversized[i];
+        oversized.clear();
+    }
+};
+
+#endif
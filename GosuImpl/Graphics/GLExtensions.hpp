@@ -0,0 +1,569 @@
+#ifndef GOSUIMPL_GRAPHICS_GLEXTENSIONS_HPP
+#define GOSUIMPL_GRAPHICS_GLEXTENSIONS_HPP
+
+// Runtime access to OpenGL functionality beyond version 1.1, which is all that
+// Windows exports directly. All lookups happen lazily, so these functions may
+// only be called while a GL context is current.
+
+#include <GosuImpl/Graphics/Common.hpp>
+#include <Gosu/TR1.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#if defined(GOSU_IS_MAC) && !defined(GOSU_IS_IPHONE)
+#include <dlfcn.h>
+#elif defined(GOSU_IS_X)
+// Declared by hand to keep <GL/glx.h> and Xlib's macros out of the renderer.
+extern "C" void (*glXGetProcAddressARB(const GLubyte* procName))();
+#endif
+
+#ifdef GOSU_IS_WIN
+#define GOSU_GLAPIENTRY APIENTRY
+#else
+#define GOSU_GLAPIENTRY
+#endif
+
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#endif
+#ifndef GL_STATIC_DRAW
+#define GL_STATIC_DRAW 0x88E4
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_PIXEL_PACK_BUFFER
+#define GL_PIXEL_PACK_BUFFER 0x88EB
+#endif
+#ifndef GL_STREAM_READ
+#define GL_STREAM_READ 0x88E1
+#endif
+#ifndef GL_READ_ONLY
+#define GL_READ_ONLY 0x88B8
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#endif
+#ifndef GL_SYNC_FLUSH_COMMANDS_BIT
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#endif
+#ifndef GL_TIMEOUT_IGNORED
+#define GL_TIMEOUT_IGNORED 0xFFFFFFFFFFFFFFFFull
+#endif
+#ifndef GL_ALREADY_SIGNALED
+#define GL_ALREADY_SIGNALED 0x911A
+#endif
+#ifndef GL_CONDITION_SATISFIED
+#define GL_CONDITION_SATISFIED 0x911C
+#endif
+#ifndef GL_TEXTURE_MAX_LEVEL
+#define GL_TEXTURE_MAX_LEVEL 0x813D
+#endif
+#ifndef GL_NUM_COMPRESSED_TEXTURE_FORMATS
+#define GL_NUM_COMPRESSED_TEXTURE_FORMATS 0x86A2
+#endif
+#ifndef GL_COMPRESSED_TEXTURE_FORMATS
+#define GL_COMPRESSED_TEXTURE_FORMATS 0x86A3
+#endif
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER 0x8D40
+#endif
+#ifndef GL_FRAMEBUFFER_BINDING
+#define GL_FRAMEBUFFER_BINDING 0x8CA6
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE
+#define GL_FRAMEBUFFER_COMPLETE 0x8CD5
+#endif
+#ifndef GL_COLOR_ATTACHMENT0
+#define GL_COLOR_ATTACHMENT0 0x8CE0
+#endif
+#ifndef GL_FRAGMENT_SHADER
+#define GL_FRAGMENT_SHADER 0x8B30
+#endif
+#ifndef GL_VERTEX_SHADER
+#define GL_VERTEX_SHADER 0x8B31
+#endif
+#ifndef GL_COMPILE_STATUS
+#define GL_COMPILE_STATUS 0x8B81
+#endif
+#ifndef GL_LINK_STATUS
+#define GL_LINK_STATUS 0x8B82
+#endif
+#ifndef GL_INFO_LOG_LENGTH
+#define GL_INFO_LOG_LENGTH 0x8B84
+#endif
+#ifndef GL_CURRENT_PROGRAM
+#define GL_CURRENT_PROGRAM 0x8B8D
+#endif
+#ifndef GL_QUERY_RESULT
+#define GL_QUERY_RESULT 0x8866
+#endif
+#ifndef GL_QUERY_RESULT_AVAILABLE
+#define GL_QUERY_RESULT_AVAILABLE 0x8867
+#endif
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP 0x8E28
+#endif
+#ifndef GL_TEXTURE_2D_ARRAY
+#define GL_TEXTURE_2D_ARRAY 0x8C1A
+#endif
+#ifndef GL_MAX_ARRAY_TEXTURE_LAYERS
+#define GL_MAX_ARRAY_TEXTURE_LAYERS 0x88FF
+#endif
+#ifndef GL_UNSIGNED_SHORT_4_4_4_4
+#define GL_UNSIGNED_SHORT_4_4_4_4 0x8033
+#endif
+#ifndef GL_UNSIGNED_SHORT_5_6_5
+#define GL_UNSIGNED_SHORT_5_6_5 0x8363
+#endif
+#ifndef GL_R8
+#define GL_R8 0x8229
+#endif
+#ifndef GL_TEXTURE_SWIZZLE_RGBA
+#define GL_TEXTURE_SWIZZLE_RGBA 0x8E46
+#endif
+
+namespace Gosu
+{
+    // Looks for name in a space-separated list of extensions, such as the
+    // ones of GL, GLX or WGL.
+    inline bool hasExtension(const char* extensions, const char* name)
+    {
+        if (!extensions)
+            return false;
+
+        // Make sure not to match prefixes of other extension names.
+        std::size_t length = std::strlen(name);
+        for (const char* pos = extensions; (pos = std::strstr(pos, name)); pos += length)
+            if ((pos == extensions || pos[-1] == ' ') &&
+                (pos[length] == ' ' || pos[length] == 0))
+                return true;
+        return false;
+    }
+
+    inline bool hasGLExtension(const char* name)
+    {
+        return hasExtension(reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS)), name);
+    }
+
+    // Returns true if the GL version is at least major.minor.
+    inline bool hasGLVersion(int major, int minor)
+    {
+        const char* version = reinterpret_cast<const char*>(glGetString(GL_VERSION));
+        if (!version)
+            return false;
+
+        // The version string starts with "major.minor", optionally preceded
+        // by a profile name on OpenGL ES.
+        while (*version && (*version < '0' || *version > '9'))
+            ++version;
+        int actualMajor = 0, actualMinor = 0;
+        while (*version >= '0' && *version <= '9')
+            actualMajor = actualMajor * 10 + (*version++ - '0');
+        if (*version == '.')
+            while (*++version >= '0' && *version <= '9')
+                actualMinor = actualMinor * 10 + (*version - '0');
+        return actualMajor > major || (actualMajor == major && actualMinor >= minor);
+    }
+
+    // Texture swizzles (OpenGL 3.3, ARB_texture_swizzle or
+    // EXT_texture_swizzle), which let a one-channel texture be sampled as
+    // white with alpha.
+    inline bool hasTextureSwizzle()
+    {
+        #ifdef GOSU_IS_IPHONE
+        return false;
+        #else
+        static const bool available = hasGLVersion(3, 3) ||
+            hasGLExtension("GL_ARB_texture_swizzle") || hasGLExtension("GL_EXT_texture_swizzle");
+        return available;
+        #endif
+    }
+
+    // Returns 0 if the function does not exist.
+    inline void* lookupGLFunction(const char* name)
+    {
+        #if defined(GOSU_IS_WIN)
+        return (void*)wglGetProcAddress(name);
+        #elif defined(GOSU_IS_IPHONE)
+        return 0;
+        #elif defined(GOSU_IS_MAC)
+        return dlsym(RTLD_DEFAULT, name);
+        #else
+        return (void*)glXGetProcAddressARB(reinterpret_cast<const GLubyte*>(name));
+        #endif
+    }
+
+    template<typename Function>
+    bool loadGLFunction(Function& function, const char* name)
+    {
+        function = (Function)lookupGLFunction(name);
+        return function != 0;
+    }
+
+    // Vertex buffer objects (OpenGL 1.5 or ARB_vertex_buffer_object).
+    struct GLBufferFunctions
+    {
+        typedef void (GOSU_GLAPIENTRY *GenBuffers)(GLsizei n, GLuint* buffers);
+        typedef void (GOSU_GLAPIENTRY *DeleteBuffers)(GLsizei n, const GLuint* buffers);
+        typedef void (GOSU_GLAPIENTRY *BindBuffer)(GLenum target, GLuint buffer);
+        typedef void (GOSU_GLAPIENTRY *BufferData)(GLenum target, std::ptrdiff_t size,
+            const GLvoid* data, GLenum usage);
+        typedef GLvoid* (GOSU_GLAPIENTRY *MapBuffer)(GLenum target, GLenum access);
+        typedef GLboolean (GOSU_GLAPIENTRY *UnmapBuffer)(GLenum target);
+
+        bool available;
+        // Whether buffers can also be bound as GL_PIXEL_UNPACK_BUFFER and
+        // GL_PIXEL_PACK_BUFFER (OpenGL 2.1 or ARB_pixel_buffer_object).
+        bool pixelBuffers;
+        GenBuffers genBuffers;
+        DeleteBuffers deleteBuffers;
+        BindBuffer bindBuffer;
+        BufferData bufferData;
+        MapBuffer mapBuffer;
+        UnmapBuffer unmapBuffer;
+
+        GLBufferFunctions()
+        {
+            if (hasGLVersion(1, 5))
+                available = loadGLFunction(genBuffers, "glGenBuffers") &&
+                    loadGLFunction(deleteBuffers, "glDeleteBuffers") &&
+                    loadGLFunction(bindBuffer, "glBindBuffer") &&
+                    loadGLFunction(bufferData, "glBufferData") &&
+                    loadGLFunction(mapBuffer, "glMapBuffer") &&
+                    loadGLFunction(unmapBuffer, "glUnmapBuffer");
+            else if (hasGLExtension("GL_ARB_vertex_buffer_object"))
+                available = loadGLFunction(genBuffers, "glGenBuffersARB") &&
+                    loadGLFunction(deleteBuffers, "glDeleteBuffersARB") &&
+                    loadGLFunction(bindBuffer, "glBindBufferARB") &&
+                    loadGLFunction(bufferData, "glBufferDataARB") &&
+                    loadGLFunction(mapBuffer, "glMapBufferARB") &&
+                    loadGLFunction(unmapBuffer, "glUnmapBufferARB");
+            else
+                available = false;
+            
+            pixelBuffers = available && (hasGLVersion(2, 1) ||
+                hasGLExtension("GL_ARB_pixel_buffer_object") ||
+                hasGLExtension("GL_EXT_pixel_buffer_object"));
+        }
+    };
+
+    inline const GLBufferFunctions& glBufferFunctions()
+    {
+        static const GLBufferFunctions functions;
+        return functions;
+    }
+    
+    // Compressed textures (OpenGL 1.3 or ARB_texture_compression, always
+    // available on OpenGL ES).
+    struct GLCompressionFunctions
+    {
+        typedef void (GOSU_GLAPIENTRY *CompressedTexImage2D)(GLenum target, GLint level,
+            GLenum internalFormat, GLsizei width, GLsizei height, GLint border,
+            GLsizei imageSize, const GLvoid* data);
+        typedef void (GOSU_GLAPIENTRY *CompressedTexSubImage2D)(GLenum target, GLint level,
+            GLint xOffset, GLint yOffset, GLsizei width, GLsizei height, GLenum format,
+            GLsizei imageSize, const GLvoid* data);
+        
+        bool available;
+        CompressedTexImage2D compressedTexImage2D;
+        CompressedTexSubImage2D compressedTexSubImage2D;
+        // Formats that the driver accepts, from GL_COMPRESSED_TEXTURE_FORMATS.
+        std::vector<GLint> formats;
+        
+        GLCompressionFunctions()
+        {
+            #ifdef GOSU_IS_IPHONE
+            compressedTexImage2D = glCompressedTexImage2D;
+            compressedTexSubImage2D = glCompressedTexSubImage2D;
+            available = true;
+            #else
+            if (hasGLVersion(1, 3))
+                available = loadGLFunction(compressedTexImage2D, "glCompressedTexImage2D") &&
+                    loadGLFunction(compressedTexSubImage2D, "glCompressedTexSubImage2D");
+            else if (hasGLExtension("GL_ARB_texture_compression"))
+                available = loadGLFunction(compressedTexImage2D, "glCompressedTexImage2DARB") &&
+                    loadGLFunction(compressedTexSubImage2D, "glCompressedTexSubImage2DARB");
+            else
+                available = false;
+            #endif
+            
+            if (available)
+            {
+                GLint numFormats = 0;
+                glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &numFormats);
+                formats.resize(numFormats);
+                if (numFormats > 0)
+                    glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, &formats[0]);
+            }
+        }
+        
+        bool supports(GLenum format) const
+        {
+            return available &&
+                std::find(formats.begin(), formats.end(), static_cast<GLint>(format)) != formats.end();
+        }
+    };
+    
+    inline const GLCompressionFunctions& glCompressionFunctions()
+    {
+        static const GLCompressionFunctions functions;
+        return functions;
+    }
+    
+    // Fences (OpenGL 3.2 or ARB_sync). GLsync is an opaque pointer, which is
+    // not declared by older headers.
+    typedef void* GLFence;
+    
+    struct GLSyncFunctions
+    {
+        typedef GLFence (GOSU_GLAPIENTRY *FenceSync)(GLenum condition, GLbitfield flags);
+        typedef GLenum (GOSU_GLAPIENTRY *ClientWaitSync)(GLFence sync, GLbitfield flags,
+            std::tr1::uint64_t timeout);
+        typedef void (GOSU_GLAPIENTRY *DeleteSync)(GLFence sync);
+        
+        bool available;
+        FenceSync fenceSync;
+        ClientWaitSync clientWaitSync;
+        DeleteSync deleteSync;
+        
+        GLSyncFunctions()
+        {
+            available = (hasGLVersion(3, 2) || hasGLExtension("GL_ARB_sync")) &&
+                loadGLFunction(fenceSync, "glFenceSync") &&
+                loadGLFunction(clientWaitSync, "glClientWaitSync") &&
+                loadGLFunction(deleteSync, "glDeleteSync");
+        }
+    };
+    
+    inline const GLSyncFunctions& glSyncFunctions()
+    {
+        static const GLSyncFunctions functions;
+        return functions;
+    }
+    
+    // Framebuffer objects (OpenGL 3.0, ARB_framebuffer_object or
+    // EXT_framebuffer_object, always available on iOS).
+    struct GLFramebufferFunctions
+    {
+        typedef void (GOSU_GLAPIENTRY *GenFramebuffers)(GLsizei n, GLuint* framebuffers);
+        typedef void (GOSU_GLAPIENTRY *DeleteFramebuffers)(GLsizei n, const GLuint* framebuffers);
+        typedef void (GOSU_GLAPIENTRY *BindFramebuffer)(GLenum target, GLuint framebuffer);
+        typedef void (GOSU_GLAPIENTRY *FramebufferTexture2D)(GLenum target, GLenum attachment,
+            GLenum texTarget, GLuint texture, GLint level);
+        typedef GLenum (GOSU_GLAPIENTRY *CheckFramebufferStatus)(GLenum target);
+        
+        bool available;
+        GenFramebuffers genFramebuffers;
+        DeleteFramebuffers deleteFramebuffers;
+        BindFramebuffer bindFramebuffer;
+        FramebufferTexture2D framebufferTexture2D;
+        CheckFramebufferStatus checkFramebufferStatus;
+        
+        GLFramebufferFunctions()
+        {
+            #ifdef GOSU_IS_IPHONE
+            genFramebuffers = glGenFramebuffersOES;
+            deleteFramebuffers = glDeleteFramebuffersOES;
+            bindFramebuffer = glBindFramebufferOES;
+            framebufferTexture2D = glFramebufferTexture2DOES;
+            checkFramebufferStatus = glCheckFramebufferStatusOES;
+            available = true;
+            #else
+            if (hasGLVersion(3, 0) || hasGLExtension("GL_ARB_framebuffer_object"))
+                available = loadGLFunction(genFramebuffers, "glGenFramebuffers") &&
+                    loadGLFunction(deleteFramebuffers, "glDeleteFramebuffers") &&
+                    loadGLFunction(bindFramebuffer, "glBindFramebuffer") &&
+                    loadGLFunction(framebufferTexture2D, "glFramebufferTexture2D") &&
+                    loadGLFunction(checkFramebufferStatus, "glCheckFramebufferStatus");
+            else if (hasGLExtension("GL_EXT_framebuffer_object"))
+                available = loadGLFunction(genFramebuffers, "glGenFramebuffersEXT") &&
+                    loadGLFunction(deleteFramebuffers, "glDeleteFramebuffersEXT") &&
+                    loadGLFunction(bindFramebuffer, "glBindFramebufferEXT") &&
+                    loadGLFunction(framebufferTexture2D, "glFramebufferTexture2DEXT") &&
+                    loadGLFunction(checkFramebufferStatus, "glCheckFramebufferStatusEXT");
+            else
+                available = false;
+            #endif
+        }
+    };
+    
+    inline const GLFramebufferFunctions& glFramebufferFunctions()
+    {
+        static const GLFramebufferFunctions functions;
+        return functions;
+    }
+    
+    // GLSL programs (OpenGL 2.0). The ARB_shader_objects functions are not
+    // used since they take handles instead of names.
+    struct GLShaderFunctions
+    {
+        typedef GLuint (GOSU_GLAPIENTRY *CreateShader)(GLenum type);
+        typedef void (GOSU_GLAPIENTRY *DeleteShader)(GLuint shader);
+        typedef void (GOSU_GLAPIENTRY *ShaderSource)(GLuint shader, GLsizei count,
+            const char** strings, const GLint* lengths);
+        typedef void (GOSU_GLAPIENTRY *CompileShader)(GLuint shader);
+        typedef void (GOSU_GLAPIENTRY *GetShaderiv)(GLuint shader, GLenum name, GLint* param);
+        typedef void (GOSU_GLAPIENTRY *GetShaderInfoLog)(GLuint shader, GLsizei maxLength,
+            GLsizei* length, char* log);
+        typedef GLuint (GOSU_GLAPIENTRY *CreateProgram)();
+        typedef void (GOSU_GLAPIENTRY *DeleteProgram)(GLuint program);
+        typedef void (GOSU_GLAPIENTRY *AttachShader)(GLuint program, GLuint shader);
+        typedef void (GOSU_GLAPIENTRY *LinkProgram)(GLuint program);
+        typedef void (GOSU_GLAPIENTRY *GetProgramiv)(GLuint program, GLenum name, GLint* param);
+        typedef void (GOSU_GLAPIENTRY *GetProgramInfoLog)(GLuint program, GLsizei maxLength,
+            GLsizei* length, char* log);
+        typedef void (GOSU_GLAPIENTRY *UseProgram)(GLuint program);
+        typedef GLint (GOSU_GLAPIENTRY *GetUniformLocation)(GLuint program, const char* name);
+        typedef void (GOSU_GLAPIENTRY *Uniform1i)(GLint location, GLint value);
+        typedef void (GOSU_GLAPIENTRY *Uniform1f)(GLint location, GLfloat x);
+        typedef void (GOSU_GLAPIENTRY *Uniform2f)(GLint location, GLfloat x, GLfloat y);
+        typedef void (GOSU_GLAPIENTRY *Uniform4f)(GLint location, GLfloat x, GLfloat y,
+            GLfloat z, GLfloat w);
+        
+        bool available;
+        CreateShader createShader;
+        DeleteShader deleteShader;
+        ShaderSource shaderSource;
+        CompileShader compileShader;
+        GetShaderiv getShaderiv;
+        GetShaderInfoLog getShaderInfoLog;
+        CreateProgram createProgram;
+        DeleteProgram deleteProgram;
+        AttachShader attachShader;
+        LinkProgram linkProgram;
+        GetProgramiv getProgramiv;
+        GetProgramInfoLog getProgramInfoLog;
+        UseProgram useProgram;
+        GetUniformLocation getUniformLocation;
+        Uniform1i uniform1i;
+        Uniform1f uniform1f;
+        Uniform2f uniform2f;
+        Uniform4f uniform4f;
+        
+        GLShaderFunctions()
+        {
+            #ifdef GOSU_IS_IPHONE
+            // OpenGL ES 1 has no shaders.
+            available = false;
+            #else
+            available = hasGLVersion(2, 0) &&
+                loadGLFunction(createShader, "glCreateShader") &&
+                loadGLFunction(deleteShader, "glDeleteShader") &&
+                loadGLFunction(shaderSource, "glShaderSource") &&
+                loadGLFunction(compileShader, "glCompileShader") &&
+                loadGLFunction(getShaderiv, "glGetShaderiv") &&
+                loadGLFunction(getShaderInfoLog, "glGetShaderInfoLog") &&
+                loadGLFunction(createProgram, "glCreateProgram") &&
+                loadGLFunction(deleteProgram, "glDeleteProgram") &&
+                loadGLFunction(attachShader, "glAttachShader") &&
+                loadGLFunction(linkProgram, "glLinkProgram") &&
+                loadGLFunction(getProgramiv, "glGetProgramiv") &&
+                loadGLFunction(getProgramInfoLog, "glGetProgramInfoLog") &&
+                loadGLFunction(useProgram, "glUseProgram") &&
+                loadGLFunction(getUniformLocation, "glGetUniformLocation") &&
+                loadGLFunction(uniform1i, "glUniform1i") &&
+                loadGLFunction(uniform1f, "glUniform1f") &&
+                loadGLFunction(uniform2f, "glUniform2f") &&
+                loadGLFunction(uniform4f, "glUniform4f");
+            #endif
+        }
+    };
+    
+    inline const GLShaderFunctions& glShaderFunctions()
+    {
+        static const GLShaderFunctions functions;
+        return functions;
+    }
+    
+    // Array textures (OpenGL 3.0). Only usable together with shaders, which
+    // are the only way to sample them, and framebuffers, which are the only
+    // way to read back a single layer.
+    struct GLTextureArrayFunctions
+    {
+        typedef void (GOSU_GLAPIENTRY *TexImage3D)(GLenum target, GLint level,
+            GLint internalFormat, GLsizei width, GLsizei height, GLsizei depth, GLint border,
+            GLenum format, GLenum type, const GLvoid* data);
+        typedef void (GOSU_GLAPIENTRY *TexSubImage3D)(GLenum target, GLint level,
+            GLint xOffset, GLint yOffset, GLint zOffset, GLsizei width, GLsizei height,
+            GLsizei depth, GLenum format, GLenum type, const GLvoid* data);
+        typedef void (GOSU_GLAPIENTRY *FramebufferTextureLayer)(GLenum target,
+            GLenum attachment, GLuint texture, GLint level, GLint layer);
+        
+        bool available;
+        TexImage3D texImage3D;
+        TexSubImage3D texSubImage3D;
+        FramebufferTextureLayer framebufferTextureLayer;
+        GLint maxLayers;
+        
+        GLTextureArrayFunctions()
+        : maxLayers(0)
+        {
+            #ifdef GOSU_IS_IPHONE
+            available = false;
+            #else
+            available = hasGLVersion(3, 0) && glShaderFunctions().available &&
+                glFramebufferFunctions().available &&
+                loadGLFunction(texImage3D, "glTexImage3D") &&
+                loadGLFunction(texSubImage3D, "glTexSubImage3D") &&
+                loadGLFunction(framebufferTextureLayer, "glFramebufferTextureLayer");
+            if (available)
+                glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+            #endif
+        }
+    };
+    
+    inline const GLTextureArrayFunctions& glTextureArrayFunctions()
+    {
+        static const GLTextureArrayFunctions functions;
+        return functions;
+    }
+    
+    // Timestamp queries (OpenGL 3.3 or ARB_timer_query).
+    struct GLTimerFunctions
+    {
+        typedef void (GOSU_GLAPIENTRY *GenQueries)(GLsizei n, GLuint* queries);
+        typedef void (GOSU_GLAPIENTRY *DeleteQueries)(GLsizei n, const GLuint* queries);
+        typedef void (GOSU_GLAPIENTRY *QueryCounter)(GLuint query, GLenum target);
+        typedef void (GOSU_GLAPIENTRY *GetQueryObjectiv)(GLuint query, GLenum name, GLint* param);
+        typedef void (GOSU_GLAPIENTRY *GetQueryObjectui64v)(GLuint query, GLenum name,
+            std::tr1::uint64_t* param);
+        
+        bool available;
+        GenQueries genQueries;
+        DeleteQueries deleteQueries;
+        QueryCounter queryCounter;
+        GetQueryObjectiv getQueryObjectiv;
+        GetQueryObjectui64v getQueryObjectui64v;
+        
+        GLTimerFunctions()
+        {
+            #ifdef GOSU_IS_IPHONE
+            available = false;
+            #else
+            available = (hasGLVersion(3, 3) || hasGLExtension("GL_ARB_timer_query")) &&
+                loadGLFunction(genQueries, "glGenQueries") &&
+                loadGLFunction(deleteQueries, "glDeleteQueries") &&
+                loadGLFunction(queryCounter, "glQueryCounter") &&
+                loadGLFunction(getQueryObjectiv, "glGetQueryObjectiv") &&
+                loadGLFunction(getQueryObjectui64v, "glGetQueryObjectui64v");
+            #endif
+        }
+    };
+    
+    inline const GLTimerFunctions& glTimerFunctions()
+    {
+        static const GLTimerFunctions functions;
+        return functions;
+    }
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef GOSUIMPL_GRAPHICS_GPUTIMER_HPP
+#define GOSUIMPL_GRAPHICS_GPUTIMER_HPP
+
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <cstddef>
+#include <vector>
+
+// Measures how long the GPU takes for each frame, and for the custom GL code
+// in it. The results only arrive a few frames later, so that reading them
+// never waits for the GPU.
+class Gosu::GPUTimer
+{
+    // Not copyable
+    GPUTimer(const GPUTimer&);
+    GPUTimer& operator=(const GPUTimer&);
+    
+    // Timestamp queries of one frame: its start, pairs around GL blocks,
+    // and its end. Kept around to be reused.
+    struct Frame
+    {
+        std::vector<GLuint> queries;
+        std::size_t used;
+    };
+    
+    enum { LATENCY = 3 };
+    Frame frames[LATENCY];
+    unsigned current;
+    bool inFrame;
+    unsigned long frameTime, glBlockTime;
+    
+    void timestamp()
+    {
+        const GLTimerFunctions& gl = glTimerFunctions();
+        Frame& frame = frames[current];
+        if (frame.used == frame.queries.size())
+        {
+            GLuint query;
+            gl.genQueries(1, &query);
+            frame.queries.push_back(query);
+        }
+        gl.queryCounter(frame.queries[frame.used++], GL_TIMESTAMP);
+    }
+    
+    std::tr1::uint64_t result(const Frame& frame, std::size_t index) const
+    {
+        std::tr1::uint64_t nanoseconds = 0;
+        glTimerFunctions().getQueryObjectui64v(frame.queries[index], GL_QUERY_RESULT, &nanoseconds);
+        return nanoseconds;
+    }
+    
+    void collect(const Frame& frame)
+    {
+        if (frame.used < 2)
+            return;
+        
+        // Queries finish in order, so if the last one is available, all are.
+        // Otherwise, the frame is dropped rather than stalling.
+        GLint available = 0;
+        glTimerFunctions().getQueryObjectiv(frame.queries[frame.used - 1],
+            GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+        
+        frameTime = (result(frame, frame.used - 1) - result(frame, 0)) / 1000;
+        glBlockTime = 0;
+        for (std::size_t i = 1; i + 1 < frame.used - 1; i += 2)
+            glBlockTime += (result(frame, i + 1) - result(frame, i)) / 1000;
+    }
+    
+public:
+    GPUTimer()
+    : current(0), inFrame(false), frameTime(0), glBlockTime(0)
+    {
+        for (unsigned i = 0; i < LATENCY; ++i)
+            frames[i].used = 0;
+    }
+    
+    ~GPUTimer()
+    {
+        for (unsigned i = 0; i < LATENCY; ++i)
+            if (!frames[i].queries.empty())
+                glTimerFunctions().deleteQueries(frames[i].queries.size(), &frames[i].queries[0]);
+    }
+    
+    void beginFrame()
+    {
+        // The oldest frame's queries are reused for the new one.
+        current = (current + 1) % LATENCY;
+        collect(frames[current]);
+        frames[current].used = 0;
+        
+        timestamp();
+        inFrame = true;
+    }
+    
+    void endFrame()
+    {
+        if (!inFrame)
+            return;
+        timestamp();
+        inFrame = false;
+    }
+    
+    // GL blocks are only timed during frames; render targets cannot run
+    // any, and all other drawing happens between begin and end.
+    void beginGLBlock()
+    {
+        if (inFrame)
+            timestamp();
+    }
+    
+    void endGLBlock()
+    {
+        if (inFrame)
+            timestamp();
+    }
+    
+    // In microseconds, for the most recent frame whose results have arrived.
+    unsigned long lastFrameTime() const
+    {
+        return frameTime;
+    }
+    
+    unsigned long lastGLBlockTime() const
+    {
+        return glBlockTime;
+    }
+};
+
+#endif
@@ -3,6 +3,7 @@
 #import <UIKit/UIKit.h>
 
 #import <Gosu/Graphics.hpp>
+#import <Gosu/Timing.hpp>
 #import <GosuImpl/Graphics/Common.hpp>
 #import <GosuImpl/Graphics/GosuView.hpp>
 
@@ -12,7 +13,7 @@ namespace Gosu
 {
     namespace FPS
     {
-        void registerFrame();
+        void registerFrame(unsigned long drawTime, unsigned long swapTime);
     }
 }
 
@@ -85,7 +86,7 @@ int Gosu::clipRectBaseFactor()
     if (not windowInstance().needsRedraw())
         return;
     
-    Gosu::FPS::registerFrame();
+    std::tr1::uint64_t drawStart = Gosu::microseconds();
     
     [EAGLContext setCurrentContext:context];
     glBindFramebufferOES(GL_FRAMEBUFFER_OES, viewFramebuffer);
@@ -96,8 +97,10 @@ int Gosu::clipRectBaseFactor()
         windowInstance().graphics().end();
     }
     
+    std::tr1::uint64_t swapStart = Gosu::microseconds();
     glBindRenderbufferOES(GL_RENDERBUFFER_OES, viewRenderbuffer);
     [context presentRenderbuffer:GL_RENDERBUFFER_OES];
+    Gosu::FPS::registerFrame(swapStart - drawStart, Gosu::microseconds() - swapStart);
 }
 
 - (void)layoutSubviews {
@@ -1,25 +1,196 @@
 #include <Gosu/Graphics.hpp>
+#include <GosuImpl/Graphics/BitmapPool.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/DeferredImage.hpp>
 #include <GosuImpl/Graphics/DrawOp.hpp>
+#include <GosuImpl/Graphics/FrameCapture.hpp>
+#include <GosuImpl/Graphics/GPUTimer.hpp>
+#include <GosuImpl/Graphics/RenderThread.hpp>
+#include <GosuImpl/Graphics/ResolutionScaler.hpp>
 #include <GosuImpl/Graphics/Texture.hpp>
 #include <GosuImpl/Graphics/TexChunk.hpp>
 #include <GosuImpl/Graphics/LargeImageData.hpp>
 #include <GosuImpl/Graphics/Macro.hpp>
+#include <GosuImpl/Graphics/PixelKernels.hpp>
+#include <GosuImpl/Graphics/ScaledImage.hpp>
+#include <GosuImpl/Graphics/ScreenReader.hpp>
+#include <GosuImpl/Graphics/CompressedTexture.hpp>
+#include <GosuImpl/Graphics/ShaderProgram.hpp>
+#include <GosuImpl/Threading.hpp>
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/Image.hpp>
+#include <Gosu/IO.hpp>
+#include <Gosu/Math.hpp>
 #include <Gosu/Platform.hpp>
-#if 0
-#include <thread>
-#endif
+#include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
 #include <cmath>
 #include <algorithm>
 #include <limits>
+#include <memory>
+#include <map>
+#include <string>
+#include <vector>
 
 #ifdef GOSU_IS_IPHONE
 #import <UIKit/UIKit.h>
 #include <GosuImpl/Orientation.hpp>
 #endif
 
+namespace Gosu
+{
+    GOSU_THREAD_LOCAL RendererStatistics frameStatistics;
+    GOSU_THREAD_LOCAL DrawOpQueue* threadQueue;
+    bool premultipliedAlpha = false;
+    
+    namespace
+    {
+        RendererStatistics statisticsOfLastFrame = RendererStatistics();
+        
+        // What the calling thread had counted when it began its thread
+        // queue, for telling the main thread what drawing into it took.
+        GOSU_THREAD_LOCAL unsigned scheduledOpsAtBegin, culledOpsAtBegin;
+        
+        // Consumers for ScreenReader, called on its worker thread.
+        
+        void saveScreenshotFile(const std::wstring& filename, Bitmap& bitmap)
+        {
+            saveImageFile(bitmap, filename);
+        }
+        
+        struct VideoCapture
+        {
+            File file;
+            std::size_t written;
+            
+            explicit VideoCapture(const std::wstring& filename)
+            : file(filename, fmReplace), written(0)
+            {
+            }
+        };
+        
+        void writeVideoFrame(std::tr1::shared_ptr<VideoCapture> capture, Bitmap& bitmap)
+        {
+            std::size_t bytes = bitmap.width() * bitmap.height() * sizeof(Color);
+            capture->file.write(capture->written, bytes, bitmap.data());
+            capture->written += bytes;
+        }
+        
+        // Set on the thread that created the Graphics object, which owns
+        // the OpenGL context that textures are created in.
+        GOSU_THREAD_LOCAL bool ownsContext;
+        
+        void throwIfDrawingOnThread(const char* what)
+        {
+            if (threadQueue)
+                throw std::logic_error(std::string(what) +
+                    " is not allowed while drawing into a thread queue");
+        }
+        
+        // Adds what the render thread counted to the main thread's counters.
+        void addRenderingStatistics(const RendererStatistics& rendering)
+        {
+            frameStatistics.sortTime += rendering.sortTime;
+            frameStatistics.batches += rendering.batches;
+            frameStatistics.vertices += rendering.vertices;
+            frameStatistics.textureBinds += rendering.textureBinds;
+            frameStatistics.transformChanges += rendering.transformChanges;
+            frameStatistics.clipChanges += rendering.clipChanges;
+            frameStatistics.blendChanges += rendering.blendChanges;
+            frameStatistics.glBlocks += rendering.glBlocks;
+            frameStatistics.opaqueOps += rendering.opaqueOps;
+        }
+        
+        // Maps pixel coordinates to the viewport, with (0; 0) in its upper
+        // left corner. For render targets, the image is upside down so that
+        // its top row ends up in the first row of the texture. The viewport
+        // can be smaller than the area, see ResolutionScaler.
+        void setUpProjection(unsigned width, unsigned height, bool upsideDown = false,
+            unsigned viewportWidth = 0, unsigned viewportHeight = 0)
+        {
+            glMatrixMode(GL_PROJECTION);
+            glLoadIdentity();
+            glViewport(0, 0, viewportWidth ? viewportWidth : width,
+                viewportHeight ? viewportHeight : height);
+            #ifdef GOSU_IS_IPHONE
+            glOrthof(0, width, upsideDown ? 0 : height, upsideDown ? height : 0, -1, 1);
+            #else
+            glOrtho(0, width, upsideDown ? 0 : height, upsideDown ? height : 0, -1, 1);
+            #endif
+            
+            glMatrixMode(GL_MODELVIEW);
+            glLoadIdentity();
+        }
+        
+        void setUpRenderContext(const std::tr1::function<void()>& makeCurrent,
+            unsigned width, unsigned height)
+        {
+            makeCurrent();
+            setUpProjection(width, height);
+            glEnable(GL_BLEND);
+        }
+        
+        // Points on the unit circle, shared by all circles; those with fewer
+        // segments use every n-th point. Filled in during static
+        // initialization, so that thread queues can read it without locking.
+        struct CircleTable
+        {
+            static const unsigned SEGMENTS = 256;
+            double xs[SEGMENTS + 1], ys[SEGMENTS + 1];
+            
+            CircleTable()
+            {
+                for (unsigned i = 0; i < SEGMENTS; ++i)
+                {
+                    xs[i] = std::cos(2 * pi * i / SEGMENTS);
+                    ys[i] = std::sin(2 * pi * i / SEGMENTS);
+                }
+                xs[SEGMENTS] = xs[0];
+                ys[SEGMENTS] = ys[0];
+            }
+        };
+        const CircleTable circleTable;
+        
+        // The smallest power of two, but at least 8, for which the segments
+        // stay within a quarter of a pixel of the actual circle.
+        unsigned circleSegments(double radius)
+        {
+            unsigned segments = 8;
+            while (segments < CircleTable::SEGMENTS &&
+                    radius * (1 - std::cos(pi / segments)) > 0.25)
+                segments *= 2;
+            return segments;
+        }
+        
+        // Corners in the order that drawQuad takes them in, i.e. a and d
+        // are opposite of each other.
+        void scheduleQuad(DrawOpQueue& queue, double xa, double ya, double xb, double yb,
+            double xc, double yc, double xd, double yd, Color c, ZPos z, AlphaMode mode)
+        {
+            DrawOp op;
+            op.verticesOrBlockIndex = 4;
+            op.vertices[0] = ArrayVertex(xa, ya, c);
+            op.vertices[1] = ArrayVertex(xb, yb, c);
+        #ifdef GOSU_IS_IPHONE
+            op.vertices[2] = ArrayVertex(xc, yc, c);
+            op.vertices[3] = ArrayVertex(xd, yd, c);
+        #else
+            op.vertices[3] = ArrayVertex(xc, yc, c);
+            op.vertices[2] = ArrayVertex(xd, yd, c);
+        #endif
+            op.z = z;
+            queue.scheduleDrawOp(op, mode);
+        }
+        
+        void scheduleRect(DrawOpQueue& queue, double x, double y, double width, double height,
+            Color c, ZPos z, AlphaMode mode)
+        {
+            scheduleQuad(queue, x, y, x + width, y, x, y + height, x + width, y + height,
+                c, z, mode);
+        }
+    }
+}
+
 struct Gosu::Graphics::Impl
 {
     unsigned virtWidth, virtHeight;
@@ -29,9 +200,309 @@ struct Gosu::Graphics::Impl
     typedef std::vector<std::tr1::shared_ptr<Texture> > Textures;
     Textures textures;
     
-#if 0
-    std::mutex texMutex;
-#endif
+    // Empty textures are only released after this many frames, so that
+    // images that are recreated right away do not cause any churn.
+    static const unsigned RELEASE_DELAY = 120;
+    unsigned spareTextures;
+    // See setImageScale and setMaxImageResolution.
+    double imageScale;
+    unsigned maxImageResolution;
+    // See setAtlasSize; the largest texture size that OpenGL supports.
+    unsigned atlasSize, maxTextureSize;
+    // See setTextureArrays. New pages go onto the last array that still
+    // exists and has a free layer.
+    unsigned textureArrayLayers;
+    std::vector<std::tr1::weak_ptr<TextureArray> > textureArrays;
+    // Number of consecutive frames each texture has been empty for.
+    typedef std::map<const Texture*, unsigned> EmptyFrames;
+    EmptyFrames emptyFrames;
+    
+    // When the current frame began on the CPU, in microseconds.
+    std::tr1::uint64_t frameStart;
+    // Only exists while GPU timing is enabled.
+    std::auto_ptr<GPUTimer> gpuTimer;
+    
+    // See setDynamicResolution; the scaler only exists while it is on. The
+    // HUD queue takes the place of queues.front() between beginHUD and
+    // endHUD, and is drawn at full resolution after the rest.
+    double dynamicFrameTime, dynamicMinScale;
+    std::auto_ptr<ResolutionScaler> scaler;
+    DrawOpQueueStack hudQueue;
+    bool inHUD;
+    
+    // See setPartialRedraw; the scaler is then kept at full scale and keeps
+    // the frame between begin calls. The region is the bounding box of
+    // what has been invalidated since the last frame, in logical pixels.
+    bool partialRedraw, redrawAll, hasDirtyRegion;
+    double dirtyLeft, dirtyTop, dirtyRight, dirtyBottom;
+    
+    bool usesPartialRedraw() const
+    {
+        #ifdef GOSU_IS_IPHONE
+        return false;
+        #else
+        return partialRedraw && dynamicFrameTime <= 0 && glFramebufferFunctions().available;
+        #endif
+    }
+    
+    // Limits the frame to the dirty region: only that part of the texture
+    // is cleared, and everything else is culled and scissored away by a
+    // clipping rectangle around the whole frame.
+    void beginPartialRedraw(Color clearWithColor)
+    {
+        if (scaler.get() && scaler->scale() != 1)
+            scaler.reset();
+        if (!scaler.get())
+        {
+            scaler.reset(new ResolutionScaler(physWidth, physHeight));
+            redrawAll = true;
+        }
+        
+        if (redrawAll)
+            scaler->begin(clearWithColor);
+        else
+        {
+            DrawOpQueue& queue = queues.front();
+            if (hasDirtyRegion)
+                queue.beginClipping(dirtyLeft, dirtyTop, dirtyRight - dirtyLeft,
+                    dirtyBottom - dirtyTop, physHeight);
+            else
+                queue.beginClipping(0, 0, 0, 0, physHeight);
+            ClipRect nothing = { 0, 0, 0, 0 };
+            scaler->begin(clearWithColor, queue.clipRect() ? queue.clipRect() : &nothing);
+        }
+        redrawAll = hasDirtyRegion = false;
+    }
+    
+    // Frames are only cleared when they are rendered by the render thread.
+    Color clearColor;
+    // Holds the queue of the frame that the render thread works on, while
+    // the next frame is drawn into queues.front().
+    DrawOpQueueStack renderedQueue;
+    
+    // Thread queues start out with the settings of the main queue as of
+    // begin(), since the main queue itself may change at any time.
+    DrawOpQueue threadQueueSettings;
+    // Thread queues that have been ended, and what drawing into them was
+    // counted on their threads. Guarded by the mutex.
+    Mutex threadQueueMutex;
+    std::vector<std::tr1::shared_ptr<DrawOpQueue> > endedThreadQueues;
+    RendererStatistics threadStatistics;
+    
+    #ifndef GOSU_IS_IPHONE
+    // Only exists while the screen is being read, since its buffers take
+    // as much video memory as a few screens.
+    std::auto_ptr<ScreenReader> screenReader;
+    std::vector<std::wstring> screenshotFiles;
+    std::tr1::shared_ptr<VideoCapture> videoCapture;
+    
+    // Called at the end of each frame, after everything has been drawn.
+    void readScreen()
+    {
+        if (screenshotFiles.empty() && !videoCapture && !screenReader.get())
+            return;
+        
+        if (!screenReader.get())
+            screenReader.reset(new ScreenReader(physWidth, physHeight));
+        for (std::size_t i = 0; i < screenshotFiles.size(); ++i)
+            screenReader->read(std::tr1::bind(saveScreenshotFile, screenshotFiles[i],
+                std::tr1::placeholders::_1));
+        screenshotFiles.clear();
+        if (videoCapture)
+            screenReader->read(std::tr1::bind(writeVideoFrame, videoCapture,
+                std::tr1::placeholders::_1));
+        
+        screenReader->update();
+        if (!videoCapture && screenReader->idle())
+            screenReader.reset();
+    }
+    #endif
+    
+    // Images that other threads have created since the last frame, see
+    // DeferredImage. Guarded by the mutex.
+    Mutex deferredMutex;
+    std::vector<std::tr1::weak_ptr<DeferredImage::Slot> > deferredImages;
+    
+    // Creates the actual images for deferredImages that are still alive.
+    void createDeferredImages(Graphics& graphics)
+    {
+        std::vector<std::tr1::weak_ptr<DeferredImage::Slot> > slots;
+        {
+            Lock lock(deferredMutex);
+            slots.swap(deferredImages);
+        }
+        for (std::size_t i = 0; i < slots.size(); ++i)
+        {
+            std::tr1::shared_ptr<DeferredImage::Slot> slot = slots[i].lock();
+            if (!slot)
+                continue;
+            try
+            {
+                Lock lock(slot->mutex);
+                const Bitmap& bmp = slot->bitmap;
+                slot->data = graphics.createImage(bmp, 0, 0, bmp.width(), bmp.height(),
+                    slot->borderFlags);
+                Bitmap().swap(slot->bitmap);
+            }
+            catch (...)
+            {
+                // The rest are tried again next frame.
+                Lock lock(deferredMutex);
+                deferredImages.insert(deferredImages.end(), slots.begin() + i + 1, slots.end());
+                throw;
+            }
+        }
+    }
+    
+    // Creates an empty atlas page, as a layer of a texture array if possible.
+    // Arrays only hold full-precision pages.
+    std::tr1::shared_ptr<Texture> newAtlasPage(bool mipmapped, PixelFormat format)
+    {
+        std::tr1::shared_ptr<Texture> page;
+        if (mipmapped || format != pfRGBA8888 || textureArrayLayers == 0)
+        {
+            page.reset(new Texture(atlasSize, false, mipmapped, format));
+            return page;
+        }
+        
+        std::tr1::shared_ptr<TextureArray> array;
+        if (!textureArrays.empty())
+            array = textureArrays.back().lock();
+        unsigned layer;
+        if (!array || array->size() != atlasSize || !array->allocLayer(layer))
+        {
+            array.reset(new TextureArray(atlasSize, textureArrayLayers));
+            array->allocLayer(layer);
+            textureArrays.push_back(array);
+        }
+        page.reset(new Texture(array, layer));
+        return page;
+    }
+    
+    // Sets up the projection for the screen, or for the scaler's texture
+    // while the world is rendered into it.
+    void setUpScreenProjection()
+    {
+        if (scaler.get() && scaler->rendering())
+            setUpProjection(physWidth, physHeight, false, scaler->width(), scaler->height());
+        else
+            setUpProjection(physWidth, physHeight);
+    }
+    
+    double scissorScale() const
+    {
+        return scaler.get() && scaler->rendering() ? scaler->scale() : 1;
+    }
+    
+    void mergeThreadQueues()
+    {
+        Lock lock(threadQueueMutex);
+        for (std::size_t i = 0; i < endedThreadQueues.size(); ++i)
+            queues.front().addSubQueue(endedThreadQueues[i]);
+        endedThreadQueues.clear();
+        
+        frameStatistics.scheduledOps += threadStatistics.scheduledOps;
+        frameStatistics.culledOps += threadStatistics.culledOps;
+        frameStatistics.sortTime += threadStatistics.sortTime;
+        threadStatistics = RendererStatistics();
+    }
+    
+    void handOffFrame()
+    {
+        renderThread->finish();
+        addRenderingStatistics(renderThread->statisticsOfLastFrame());
+        
+        // The queue that has just been rendered is drawn into next.
+        DrawOpQueue& next = renderedQueue.front();
+        next.reset();
+        next.copySettings(queues.front());
+        renderedQueue.splice(renderedQueue.end(), queues, queues.begin());
+        queues.splice(queues.begin(), renderedQueue, renderedQueue.begin());
+        
+        renderThread->render(renderedQueue.front(), clearColor);
+    }
+    
+    void releaseEmptyTextures()
+    {
+        EmptyFrames ages;
+        std::vector<unsigned> releasableAges;
+        for (Textures::const_iterator it = textures.begin(); it != textures.end(); ++it)
+            if ((*it)->chunks().empty())
+            {
+                unsigned age = emptyFrames[it->get()] + 1;
+                ages[it->get()] = age;
+                if (age >= RELEASE_DELAY)
+                    releasableAges.push_back(age);
+            }
+        emptyFrames.swap(ages);
+        
+        if (emptyFrames.size() <= spareTextures || releasableAges.empty())
+            return;
+        
+        // Keep the spares that have been empty for the shortest time.
+        std::size_t toRelease = std::min(emptyFrames.size() - spareTextures, releasableAges.size());
+        std::sort(releasableAges.rbegin(), releasableAges.rend());
+        unsigned minAge = releasableAges[toRelease - 1];
+        
+        for (Textures::iterator it = textures.begin(); it != textures.end() && toRelease > 0; )
+        {
+            EmptyFrames::iterator age = emptyFrames.find(it->get());
+            if (age != emptyFrames.end() && age->second >= minAge)
+            {
+                emptyFrames.erase(age);
+                it = textures.erase(it);
+                --toRelease;
+            }
+            else
+                ++it;
+        }
+    }
+    
+    unsigned long textureBudget;
+    // Counts calls to end(); used to find the least recently drawn textures.
+    unsigned long frame;
+    // Where the next frame is captured to, see captureFrame. Empty if not.
+    std::wstring captureFilename;
+    
+    static bool isLessRecentlyDrawn(const std::tr1::shared_ptr<Texture>& lhs,
+        const std::tr1::shared_ptr<Texture>& rhs)
+    {
+        return lhs->lastDrawnFrame() < rhs->lastDrawnFrame();
+    }
+    
+    void enforceTextureBudget()
+    {
+    #ifndef GOSU_IS_IPHONE
+        unsigned long used = textureMemory();
+        if (textureBudget == 0 || used <= textureBudget)
+            return;
+        
+        Textures candidates = textures;
+        std::sort(candidates.begin(), candidates.end(), isLessRecentlyDrawn);
+        for (Textures::iterator it = candidates.begin();
+                it != candidates.end() && used > textureBudget; ++it)
+        {
+            // Everything from here on is needed for the current frame.
+            if ((*it)->lastDrawnFrame() >= frame)
+                break;
+            
+            if (!(*it)->chunks().empty())
+            {
+                Bitmap content = (*it)->toBitmap(0, 0, (*it)->size(), (*it)->size());
+                // Evicting detaches the chunk, so iterate over a copy.
+                Texture::Chunks chunks = (*it)->chunks();
+                for (Texture::Chunks::iterator chunk = chunks.begin(); chunk != chunks.end(); ++chunk)
+                    (*chunk)->evict(content);
+            }
+            
+            // Macros may still keep the texture alive, in which case its
+            // memory is only freed together with them.
+            used -= std::min(used, (*it)->memory());
+            emptyFrames.erase(it->get());
+            textures.erase(std::find(textures.begin(), textures.end(), *it));
+        }
+    #endif
+    }
 
 #ifdef GOSU_IS_IPHONE
     Transform transformForOrientation(Orientation orientation)
@@ -57,11 +528,16 @@ struct Gosu::Graphics::Impl
         queues.front().setBaseTransform(transformForOrientation(currentOrientation()));
     }
 #endif
+    
+    // Last member, so that the thread is stopped before anything it might
+    // still be rendering is destroyed.
+    std::auto_ptr<RenderThread> renderThread;
 };
 
 Gosu::Graphics::Graphics(unsigned physWidth, unsigned physHeight, bool fullscreen)
 : pimpl(new Impl)
 {
+    GOSU_TRACE_STARTUP("Graphics creation");
     pimpl->physWidth  = physWidth;
     pimpl->physHeight = physHeight;
     pimpl->virtWidth  = physWidth;
@@ -70,25 +546,32 @@ Gosu::Graphics::Graphics(unsigned physWidth, unsigned physHeight, bool fullscree
     std::swap(pimpl->virtWidth, pimpl->virtHeight);
     #endif
     pimpl->fullscreen = fullscreen;
+    pimpl->threadStatistics = RendererStatistics();
+    pimpl->spareTextures = 1;
+    pimpl->imageScale = 1;
+    pimpl->maxImageResolution = 0;
+    GLint maxTextureSize;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    pimpl->maxTextureSize = maxTextureSize;
+    pimpl->atlasSize = std::min(MAX_TEXTURE_SIZE, pimpl->maxTextureSize);
+    pimpl->textureArrayLayers = 0;
+    pimpl->textureBudget = 0;
+    pimpl->frame = 1;
+    pimpl->frameStart = 0;
+    pimpl->dynamicFrameTime = 0;
+    pimpl->dynamicMinScale = 1;
+    pimpl->hudQueue.resize(1);
+    pimpl->inHUD = false;
+    pimpl->partialRedraw = pimpl->redrawAll = pimpl->hasDirtyRegion = false;
+    ownsContext = true;
     
     // Should be merged into RenderState altogether.
-    
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glViewport(0, 0, physWidth, physHeight);
-    #ifdef GOSU_IS_IPHONE
-    glOrthof(0, physWidth, physHeight, 0, -1, 1);
-    #else
-    glOrtho(0, physWidth, physHeight, 0, -1, 1);
-    #endif
-    
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
-    
+    setUpProjection(physWidth, physHeight);
     glEnable(GL_BLEND);
     
     // Create default draw-op queue.
     pimpl->queues.resize(1);
+    pimpl->queues.front().setViewport(physWidth, physHeight);
 }
 
 Gosu::Graphics::~Graphics()
@@ -130,41 +613,467 @@ bool Gosu::Graphics::begin(Gosu::Color clearWithColor)
     // If recording is in process, cancel it.
     assert (pimpl->queues.size() == 1);
     pimpl->queues.resize(1);
+    pimpl->createDeferredImages(*this);
     // Clear leftover transforms, clip rects etc.
     pimpl->queues.front().reset();
     
     #ifdef GOSU_IS_IPHONE
     pimpl->updateBaseTransform();
     #endif
+    pimpl->threadQueueSettings.reset();
+    pimpl->threadQueueSettings.copySettings(pimpl->queues.front());
+    pimpl->hudQueue.front().reset();
+    pimpl->hudQueue.front().copySettings(pimpl->queues.front());
+    std::tr1::uint64_t lastFrameStart = pimpl->frameStart;
+    pimpl->frameStart = microseconds();
+    
+    // The render thread may still be presenting the last frame.
+    if (pimpl->renderThread.get())
+    {
+        pimpl->clearColor = clearWithColor;
+        return true;
+    }
+    
     glClearColor(clearWithColor.red() / 255.f, clearWithColor.green() / 255.f,
         clearWithColor.blue() / 255.f, clearWithColor.alpha() / 255.f);
+    if (pimpl->gpuTimer.get())
+        pimpl->gpuTimer->beginFrame();
+    
+    #ifndef GOSU_IS_IPHONE
+    if (pimpl->usesPartialRedraw())
+    {
+        // The texture covers the whole screen, so the screen needs no clear.
+        pimpl->beginPartialRedraw(clearWithColor);
+        return true;
+    }
+    #endif
+    
     glClear(GL_COLOR_BUFFER_BIT);
     
+    #ifndef GOSU_IS_IPHONE
+    if (pimpl->dynamicFrameTime <= 0 || !glFramebufferFunctions().available)
+        pimpl->scaler.reset();
+    else
+    {
+        if (!pimpl->scaler.get())
+            pimpl->scaler.reset(new ResolutionScaler(pimpl->physWidth, pimpl->physHeight));
+        // The GPU time is more to the point, but arrives a few frames late;
+        // without it, the time between frames has to do.
+        double frameTime = pimpl->gpuTimer.get() ? statisticsOfLastFrame.gpuTime :
+            lastFrameStart ? pimpl->frameStart - lastFrameStart : 0;
+        pimpl->scaler->update(frameTime / 1000, pimpl->dynamicFrameTime, pimpl->dynamicMinScale);
+        pimpl->scaler->begin(clearWithColor);
+    }
+    #endif
+    
     return true;
 }
 
 void Gosu::Graphics::end()
 {
+    GOSU_TRACE("Graphics::end");
+    std::tr1::uint64_t flushStart = microseconds();
+    
     // If recording is in process, cancel it.
     assert (pimpl->queues.size() == 1);
     pimpl->queues.resize(1);
+    if (pimpl->inHUD)
+        endHUD();
     
-    flush();
+    Buffer capture;
+    std::wstring captureFilename;
+    captureFilename.swap(pimpl->captureFilename);
+    if (!captureFilename.empty())
+        pimpl->queues.front().captureNextFrame(capture, pimpl->physWidth, pimpl->physHeight);
     
-    glFlush();
+    pimpl->mergeThreadQueues();
+    if (pimpl->renderThread.get())
+    {
+        pimpl->handOffFrame();
+        // The capture is written by the render thread.
+        if (!captureFilename.empty())
+            pimpl->renderThread->finish();
+    }
+    else
+    {
+        flush();
+        
+        if (pimpl->scaler.get() && pimpl->scaler->rendering())
+        {
+            pimpl->scaler->end();
+            setUpProjection(pimpl->physWidth, pimpl->physHeight);
+            pimpl->hudQueue.front().performDrawOpsAndCode(pimpl->gpuTimer.get());
+            pimpl->hudQueue.front().clearQueue();
+        }
+        
+        if (pimpl->gpuTimer.get())
+        {
+            pimpl->gpuTimer->endFrame();
+            frameStatistics.gpuTime = pimpl->gpuTimer->lastFrameTime();
+            frameStatistics.glBlockGPUTime = pimpl->gpuTimer->lastGLBlockTime();
+        }
+        
+        #ifndef GOSU_IS_IPHONE
+        pimpl->readScreen();
+        #endif
+        
+        glFlush();
+    }
+    
+    std::tr1::uint64_t now = microseconds();
+    frameStatistics.cpuTime = now - pimpl->frameStart;
+    frameStatistics.flushTime = now - flushStart;
+    if (!captureFilename.empty())
+        saveFile(capture, captureFilename);
+    statisticsOfLastFrame = frameStatistics;
+    frameStatistics = RendererStatistics();
+    
+    pimpl->releaseEmptyTextures();
+    pimpl->enforceTextureBudget();
+    ++pimpl->frame;
 }
 
 void Gosu::Graphics::flush()
 {
     if (pimpl->queues.size() != 1)
         throw std::logic_error("Flushing to screen is not allowed while creating a macro");
+    if (pimpl->renderThread.get())
+        throw std::logic_error("Flushing to screen is not allowed while rendering on a separate thread");
+    throwIfDrawingOnThread("Flushing to screen");
     
-    pimpl->queues.front().performDrawOpsAndCode();
+    pimpl->mergeThreadQueues();
+    pimpl->queues.front().performDrawOpsAndCode(pimpl->gpuTimer.get(), pimpl->scissorScale());
     pimpl->queues.front().clearQueue();
 }
 
+void Gosu::Graphics::setSpareTextures(unsigned spareTextures)
+{
+    pimpl->spareTextures = spareTextures;
+}
+
+void Gosu::Graphics::setImageScale(double scale)
+{
+    pimpl->imageScale = scale;
+}
+
+void Gosu::Graphics::setMaxImageResolution(unsigned pixels)
+{
+    pimpl->maxImageResolution = pixels;
+}
+
+void Gosu::Graphics::setAtlasSize(unsigned size)
+{
+    unsigned atlasSize = 256;
+    while (atlasSize * 2 <= size && atlasSize * 2 <= pimpl->maxTextureSize)
+        atlasSize *= 2;
+    pimpl->atlasSize = atlasSize;
+}
+
+unsigned Gosu::Graphics::atlasSize() const
+{
+    return pimpl->atlasSize;
+}
+
+void Gosu::Graphics::setTextureArrays(unsigned layers)
+{
+    const GLTextureArrayFunctions& arrays = glTextureArrayFunctions();
+    pimpl->textureArrayLayers =
+        arrays.available ? std::min<unsigned>(layers, arrays.maxLayers) : 0;
+    // Existing arrays keep their pages, but new pages go onto a new array.
+    pimpl->textureArrays.clear();
+}
+
+void Gosu::Graphics::setDynamicResolution(double milliseconds, double minScale)
+{
+    pimpl->dynamicFrameTime = milliseconds;
+    pimpl->dynamicMinScale = clamp(minScale, 0.0, 1.0);
+}
+
+void Gosu::Graphics::setPartialRedraw(bool partialRedraw)
+{
+    pimpl->partialRedraw = partialRedraw;
+    pimpl->redrawAll = true;
+}
+
+bool Gosu::Graphics::partialRedraw() const
+{
+    return pimpl->partialRedraw;
+}
+
+void Gosu::Graphics::invalidate(double x, double y, double width, double height)
+{
+    if (width <= 0 || height <= 0)
+        return;
+    
+    if (!pimpl->hasDirtyRegion)
+    {
+        pimpl->dirtyLeft = x, pimpl->dirtyTop = y;
+        pimpl->dirtyRight = x + width, pimpl->dirtyBottom = y + height;
+        pimpl->hasDirtyRegion = true;
+        return;
+    }
+    pimpl->dirtyLeft = std::min(pimpl->dirtyLeft, x);
+    pimpl->dirtyTop = std::min(pimpl->dirtyTop, y);
+    pimpl->dirtyRight = std::max(pimpl->dirtyRight, x + width);
+    pimpl->dirtyBottom = std::max(pimpl->dirtyBottom, y + height);
+}
+
+void Gosu::Graphics::invalidateAll()
+{
+    pimpl->redrawAll = true;
+}
+
+double Gosu::Graphics::resolutionScale() const
+{
+    return pimpl->scaler.get() ? pimpl->scaler->scale() : 1;
+}
+
+void Gosu::Graphics::beginHUD()
+{
+    throwIfDrawingOnThread("Drawing a HUD");
+    if (pimpl->queues.size() > 1)
+        throw std::logic_error("Drawing a HUD is not allowed while creating a macro");
+    if (pimpl->inHUD)
+        throw std::logic_error("HUD is already being drawn");
+    
+    // Without scaling, the HUD is drawn like everything else.
+    pimpl->inHUD = true;
+    if (pimpl->scaler.get() && pimpl->scaler->rendering())
+        pimpl->queues.swap(pimpl->hudQueue);
+}
+
+void Gosu::Graphics::endHUD()
+{
+    if (!pimpl->inHUD)
+        throw std::logic_error("No HUD is being drawn");
+    if (pimpl->queues.size() > 1)
+        throw std::logic_error("Ending a HUD is not allowed while creating a macro");
+    
+    pimpl->inHUD = false;
+    if (pimpl->scaler.get() && pimpl->scaler->rendering())
+        pimpl->queues.swap(pimpl->hudQueue);
+}
+
+void Gosu::Graphics::setCulling(bool culling)
+{
+    if (culling)
+        pimpl->queues.front().setViewport(pimpl->physWidth, pimpl->physHeight);
+    else
+        pimpl->queues.front().disableCulling();
+}
+
+bool Gosu::Graphics::isVisible(double x1, double y1, double x2, double y2,
+    double x3, double y3, double x4, double y4) const
+{
+    return !currentQueue(pimpl->queues).isQuadCulled(x1, y1, x2, y2, x3, y3, x4, y4);
+}
+
+bool Gosu::Graphics::visibleArea(double& left, double& top,
+    double& right, double& bottom) const
+{
+    return currentQueue(pimpl->queues).visibleArea(left, top, right, bottom);
+}
+
+unsigned Gosu::culledDrawOps()
+{
+    return statisticsOfLastFrame.culledOps;
+}
+
+Gosu::RendererStatistics Gosu::rendererStatistics()
+{
+    return statisticsOfLastFrame;
+}
+
+void Gosu::Graphics::setPretransforming(bool pretransforming)
+{
+    pimpl->queues.front().setPretransforming(pretransforming);
+}
+
+void Gosu::Graphics::setGeometricClipping(bool geometricClipping)
+{
+    pimpl->queues.front().setGeometricClipping(geometricClipping);
+}
+
+void Gosu::Graphics::setPremultipliedAlpha(bool premultiplied)
+{
+    if (premultiplied == premultipliedAlpha)
+        return;
+    if (!pimpl->textures.empty())
+        throw std::logic_error("Premultiplied alpha must be set before creating images");
+    premultipliedAlpha = premultiplied;
+}
+
+void Gosu::Graphics::setGPUTiming(bool gpuTiming)
+{
+    if (!gpuTiming)
+        pimpl->gpuTimer.reset();
+    // Queries cannot be shared with the render thread's context.
+    else if (!pimpl->gpuTimer.get() && !pimpl->renderThread.get() &&
+            glTimerFunctions().available)
+        pimpl->gpuTimer.reset(new GPUTimer);
+}
+
+void Gosu::Graphics::beginThreadQueue()
+{
+    if (threadQueue)
+        throw std::logic_error("This thread is already drawing into a thread queue");
+    
+    threadQueue = new DrawOpQueue;
+    threadQueue->copySettings(pimpl->threadQueueSettings);
+    scheduledOpsAtBegin = frameStatistics.scheduledOps;
+    culledOpsAtBegin = frameStatistics.culledOps;
+}
+
+void Gosu::Graphics::endThreadQueue()
+{
+    if (!threadQueue)
+        throw std::logic_error("endThreadQueue called without a matching beginThreadQueue");
+    
+    std::tr1::shared_ptr<DrawOpQueue> queue(threadQueue);
+    threadQueue = 0;
+    unsigned long sortTime = frameStatistics.sortTime;
+    queue->prepareForMerging();
+    
+    Lock lock(pimpl->threadQueueMutex);
+    pimpl->endedThreadQueues.push_back(queue);
+    pimpl->threadStatistics.scheduledOps += frameStatistics.scheduledOps - scheduledOpsAtBegin;
+    pimpl->threadStatistics.culledOps += frameStatistics.culledOps - culledOpsAtBegin;
+    pimpl->threadStatistics.sortTime += frameStatistics.sortTime - sortTime;
+}
+
+bool Gosu::Graphics::rendersOnThread() const
+{
+    return pimpl->renderThread.get() != 0;
+}
+
+void Gosu::Graphics::captureFrame(const std::wstring& filename)
+{
+    if (filename.empty())
+        throw std::invalid_argument("Graphics::captureFrame needs a filename");
+    pimpl->captureFilename = filename;
+}
+
+Gosu::Bitmap Gosu::Graphics::screenshot()
+{
+#ifdef GOSU_IS_IPHONE
+    throw std::logic_error("Graphics::screenshot not supported on iOS");
+#else
+    if (rendersOnThread())
+        throw std::logic_error("Graphics::screenshot cannot be used while rendering on a thread");
+    
+    unsigned width = pimpl->physWidth, height = pimpl->physHeight;
+    Bitmap bitmap(width, height);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, bitmap.data());
+    ScreenReader::toScreenshot(bitmap, premultipliedAlpha);
+    return bitmap;
+#endif
+}
+
+void Gosu::Graphics::saveScreenshot(const std::wstring& filename)
+{
+#ifdef GOSU_IS_IPHONE
+    throw std::logic_error("Graphics::saveScreenshot not supported on iOS");
+#else
+    if (rendersOnThread())
+        throw std::logic_error("Graphics::saveScreenshot cannot be used while rendering on a thread");
+    
+    pimpl->screenshotFiles.push_back(filename);
+#endif
+}
+
+void Gosu::Graphics::beginVideoCapture(const std::wstring& filename)
+{
+#ifdef GOSU_IS_IPHONE
+    throw std::logic_error("Video capture not supported on iOS");
+#else
+    if (rendersOnThread())
+        throw std::logic_error("Video capture cannot be used while rendering on a thread");
+    
+    // Opened here, so that errors are reported right away.
+    pimpl->videoCapture.reset(new VideoCapture(filename));
+#endif
+}
+
+void Gosu::Graphics::endVideoCapture()
+{
+#ifndef GOSU_IS_IPHONE
+    // Frames that are still being read keep the file open.
+    pimpl->videoCapture.reset();
+#endif
+}
+
+void Gosu::Graphics::startRenderThread(const std::tr1::function<void()>& makeCurrent,
+    const std::tr1::function<void()>& present, const std::tr1::function<void()>& release)
+{
+    if (pimpl->renderThread.get())
+        return;
+    
+    setGPUTiming(false);
+    pimpl->scaler.reset();
+    pimpl->renderedQueue.resize(1);
+    pimpl->renderThread.reset(new RenderThread(
+        std::tr1::bind(setUpRenderContext, makeCurrent, pimpl->physWidth, pimpl->physHeight),
+        present, release));
+}
+
+void Gosu::Graphics::stopRenderThread()
+{
+    pimpl->renderThread.reset();
+    pimpl->renderedQueue.clear();
+}
+
+void Gosu::Graphics::setTextureBudget(unsigned long bytes)
+{
+    pimpl->textureBudget = bytes;
+}
+
+unsigned long Gosu::Graphics::frameNumber() const
+{
+    return pimpl->frame;
+}
+
+void Gosu::Graphics::restoreTexChunk(TexChunk& chunk)
+{
+    // Uploading needs the main thread's context.
+    throwIfDrawingOnThread("Drawing an evicted image");
+    const Bitmap& pixels = chunk.pixelsWhileEvicted();
+    
+    BlockAllocator::Block block;
+    std::tr1::shared_ptr<Texture> texture;
+    for (Impl::Textures::iterator i = pimpl->textures.begin(); i != pimpl->textures.end(); ++i)
+        if ((*i)->isMipmapped() == chunk.isMipmapped() && (*i)->format() == chunk.pixelFormat() &&
+                (*i)->allocBlock(pixels.width(), pixels.height(), block))
+        {
+            texture = *i;
+            break;
+        }
+    
+    if (!texture)
+    {
+        texture = pimpl->newAtlasPage(chunk.isMipmapped(), chunk.pixelFormat());
+        pimpl->textures.push_back(texture);
+        if (!texture->allocBlock(pixels.width(), pixels.height(), block))
+            throw std::logic_error("Internal texture block allocation error");
+    }
+    
+    texture->setLastDrawn(pimpl->frame);
+    GLFence fence = texture->upload(block, pixels);
+    chunk.relocate(texture, block.left, block.top);
+    chunk.setUploadFence(fence);
+}
+
+std::auto_ptr<Gosu::TexChunk> Gosu::Graphics::createTexChunk(
+    std::tr1::shared_ptr<Texture> texture, int x, int y, int width, int height, int padding)
+{
+    throwIfDrawingOnThread("Creating an image");
+    texture->setLastDrawn(pimpl->frame);
+    return std::auto_ptr<TexChunk>(new TexChunk(*this, pimpl->queues, texture,
+        x, y, width, height, padding));
+}
+
 void Gosu::Graphics::beginGL()
 {
+    throwIfDrawingOnThread("Custom OpenGL");
     if (pimpl->queues.size() > 1)
         throw std::logic_error("Custom OpenGL is not allowed while creating a macro");
     
@@ -186,20 +1095,14 @@ void Gosu::Graphics::endGL()
     glPopAttrib();
 
     // Restore matrices.
-    
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glViewport(0, 0, pimpl->physWidth, pimpl->physHeight);
-    glOrtho(0, pimpl->physWidth, pimpl->physHeight, 0, -1, 1);
-
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    pimpl->setUpScreenProjection();
     glEnable(GL_BLEND);
 #endif
 }
 
 #ifdef GOSU_IS_IPHONE
-void Gosu::Graphics::scheduleGL(const std::tr1::function<void()>& functor, Gosu::ZPos z)
+void Gosu::Graphics::scheduleGL(const std::tr1::function<void()>& functor, Gosu::ZPos z,
+    unsigned modifiedState)
 {
     throw std::logic_error("Custom OpenGL is unsupported on the iPhone");
 }
@@ -229,11 +1132,44 @@ namespace Gosu
             graphics.endGL();            
         }
     };
+    
+    // Runs in Gosu's own state. The modelview matrix and everything else
+    // are set up again by the RenderStateManager, only the projection is
+    // saved here.
+    struct RunTransformingGLFunctor
+    {
+        std::tr1::function<void()> functor;
+        
+        explicit RunTransformingGLFunctor(const std::tr1::function<void()>& functor)
+        : functor(functor)
+        {
+        }
+        
+        void operator()() const
+        {
+            glMatrixMode(GL_PROJECTION);
+            glPushMatrix();
+            glMatrixMode(GL_MODELVIEW);
+            
+            functor();
+            
+            glMatrixMode(GL_PROJECTION);
+            glPopMatrix();
+        }
+    };
 }
 
-void Gosu::Graphics::scheduleGL(const std::tr1::function<void()>& functor, Gosu::ZPos z)
+void Gosu::Graphics::scheduleGL(const std::tr1::function<void()>& functor, Gosu::ZPos z,
+    unsigned modifiedState)
 {
-    pimpl->queues.back().scheduleGL(RunGLFunctor(*this, functor), z);
+    throwIfDrawingOnThread("Custom OpenGL");
+    DrawOpQueue& queue = pimpl->queues.back();
+    if ((modifiedState & gsAll) == gsAll)
+        queue.scheduleGL(RunGLFunctor(*this, functor), z);
+    else if (modifiedState & gsTransform)
+        queue.scheduleGL(RunTransformingGLFunctor(functor), z, modifiedState);
+    else
+        queue.scheduleGL(functor, z, modifiedState);
 }
 #endif
 
@@ -242,16 +1178,17 @@ void Gosu::Graphics::beginClipping(double x, double y, double width, double heig
     if (pimpl->queues.size() > 1)
         throw std::logic_error("Clipping is not allowed while creating a macro yet");
     
-    pimpl->queues.back().beginClipping(x, y, width, height, pimpl->physHeight);
+    currentQueue(pimpl->queues).beginClipping(x, y, width, height, pimpl->physHeight);
 }
 
 void Gosu::Graphics::endClipping()
 {
-    pimpl->queues.back().endClipping();
+    currentQueue(pimpl->queues).endClipping();
 }
 
 void Gosu::Graphics::beginRecording()
 {
+    throwIfDrawingOnThread("Recording a macro");
     pimpl->queues.resize(pimpl->queues.size() + 1);
 }
 
@@ -260,31 +1197,116 @@ std::auto_ptr<Gosu::ImageData> Gosu::Graphics::endRecording(int width, int heigh
     if (pimpl->queues.size() == 1)
         throw std::logic_error("No macro recording in progress that can be captured");
     
-    std::auto_ptr<ImageData> result(new Macro(*this, pimpl->queues.back(), width, height));
+    std::auto_ptr<ImageData> result(new Macro(*this, pimpl->queues, width, height));
     pimpl->queues.pop_back();
     return result;
 }
 
+std::auto_ptr<Gosu::ImageData> Gosu::Graphics::loadMacro(Reader reader, std::size_t size,
+    const std::vector<std::tr1::shared_ptr<Texture> >& pages)
+{
+    throwIfDrawingOnThread("Loading a macro");
+    return std::auto_ptr<ImageData>(new Macro(*this, pimpl->queues, reader, size, pages));
+}
+
+std::auto_ptr<Gosu::ImageData> Gosu::Graphics::createRenderTexture(unsigned width,
+    unsigned height)
+{
+    if (width == 0 || height == 0 ||
+            width > pimpl->maxTextureSize || height > pimpl->maxTextureSize)
+        throw std::invalid_argument("Invalid render target size");
+    
+    unsigned size = 64;
+    while (size < width || size < height)
+        size *= 2;
+    
+    // Dedicated textures are never evicted or compacted, which would
+    // detach the texture from the framebuffer.
+    std::tr1::shared_ptr<Texture> texture(new Texture(size, true));
+    BlockAllocator::Block block;
+    if (!texture->allocBlock(width, height, block))
+        throw std::logic_error("Internal texture block allocation error");
+    return std::auto_ptr<ImageData>(new TexChunk(*this, pimpl->queues, texture,
+        block.left, block.top, block.width, block.height, 0));
+}
+
+void Gosu::Graphics::beginRenderTarget(unsigned width, unsigned height)
+{
+    throwIfDrawingOnThread("Rendering into a render target");
+    pimpl->queues.resize(pimpl->queues.size() + 1);
+    pimpl->queues.back().setViewport(width, height);
+}
+
+void Gosu::Graphics::endRenderTarget(unsigned width, unsigned height, Color clearWithColor)
+{
+    if (pimpl->queues.size() == 1)
+        throw std::logic_error("No render target in progress");
+    
+    // Take the queue off the stack first so that errors leave it intact.
+    DrawOpQueueStack queue;
+    queue.splice(queue.begin(), pimpl->queues, --pimpl->queues.end());
+    setUpProjection(width, height, true);
+    // Render textures hold what was drawn into them, premultiplied or not.
+    if (premultipliedAlpha)
+        clearWithColor = Pixels::premultiply(clearWithColor);
+    glClearColor(clearWithColor.red() / 255.f, clearWithColor.green() / 255.f,
+        clearWithColor.blue() / 255.f, clearWithColor.alpha() / 255.f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    
+    queue.front().performDrawOpsAndCode();
+    
+    pimpl->setUpScreenProjection();
+}
+
 void Gosu::Graphics::pushTransform(const Gosu::Transform& transform)
 {
-    pimpl->queues.back().pushTransform(transform);
+    currentQueue(pimpl->queues).pushTransform(transform);
 }
 
 void Gosu::Graphics::popTransform()
 {
-    pimpl->queues.back().popTransform();
+    currentQueue(pimpl->queues).popTransform();
+}
+
+void Gosu::Graphics::pushShader(const Shader& shader)
+{
+    currentQueue(pimpl->queues).pushProgram(shader.program);
+}
+
+void Gosu::Graphics::popShader()
+{
+    currentQueue(pimpl->queues).popProgram();
+}
+
+void Gosu::Graphics::allowReordering(ZPos fromZ, ZPos toZ)
+{
+    pimpl->queues.front().allowReordering(fromZ, toZ);
+}
+
+void Gosu::Graphics::disallowReordering()
+{
+    pimpl->queues.front().disallowReordering();
+}
+
+void Gosu::Graphics::markOpaque(ZPos fromZ, ZPos toZ)
+{
+    pimpl->queues.front().markOpaque(fromZ, toZ);
+}
+
+void Gosu::Graphics::unmarkOpaque()
+{
+    pimpl->queues.front().unmarkOpaque();
 }
 
 void Gosu::Graphics::drawLine(double x1, double y1, Color c1,
     double x2, double y2, Color c2, ZPos z, AlphaMode mode)
 {
     DrawOp op;
-    op.renderState.mode = mode;
     op.verticesOrBlockIndex = 2;
-    op.vertices[0] = DrawOp::Vertex(x1, y1, c1);
-    op.vertices[1] = DrawOp::Vertex(x2, y2, c2);
+    op.vertices[0] = ArrayVertex(x1, y1, c1);
+    op.vertices[1] = ArrayVertex(x2, y2, c2);
     op.z = z;
-    pimpl->queues.back().scheduleDrawOp(op);
+    currentQueue(pimpl->queues).scheduleDrawOp(op, mode);
 }
 
 void Gosu::Graphics::drawTriangle(double x1, double y1, Color c1,
@@ -292,17 +1314,16 @@ void Gosu::Graphics::drawTriangle(double x1, double y1, Color c1,
     ZPos z, AlphaMode mode)
 {
     DrawOp op;
-    op.renderState.mode = mode;
     op.verticesOrBlockIndex = 3;
-    op.vertices[0] = DrawOp::Vertex(x1, y1, c1);
-    op.vertices[1] = DrawOp::Vertex(x2, y2, c2);
-    op.vertices[2] = DrawOp::Vertex(x3, y3, c3);
+    op.vertices[0] = ArrayVertex(x1, y1, c1);
+    op.vertices[1] = ArrayVertex(x2, y2, c2);
+    op.vertices[2] = ArrayVertex(x3, y3, c3);
 #ifdef GOSU_IS_IPHONE
     op.verticesOrBlockIndex = 4;
     op.vertices[3] = op.vertices[2];
 #endif
     op.z = z;
-    pimpl->queues.back().scheduleDrawOp(op);
+    currentQueue(pimpl->queues).scheduleDrawOp(op, mode);
 }
 
 void Gosu::Graphics::drawQuad(double x1, double y1, Color c1,
@@ -312,27 +1333,203 @@ void Gosu::Graphics::drawQuad(double x1, double y1, Color c1,
     reorderCoordinatesIfNecessary(x1, y1, x2, y2, x3, y3, c3, x4, y4, c4);
 
     DrawOp op;
-    op.renderState.mode = mode;
     op.verticesOrBlockIndex = 4;
-    op.vertices[0] = DrawOp::Vertex(x1, y1, c1);
-    op.vertices[1] = DrawOp::Vertex(x2, y2, c2);
+    op.vertices[0] = ArrayVertex(x1, y1, c1);
+    op.vertices[1] = ArrayVertex(x2, y2, c2);
 // TODO: Should be harmonized
 #ifdef GOSU_IS_IPHONE
-    op.vertices[2] = DrawOp::Vertex(x3, y3, c3);
-    op.vertices[3] = DrawOp::Vertex(x4, y4, c4);
+    op.vertices[2] = ArrayVertex(x3, y3, c3);
+    op.vertices[3] = ArrayVertex(x4, y4, c4);
 #else
-    op.vertices[3] = DrawOp::Vertex(x3, y3, c3);
-    op.vertices[2] = DrawOp::Vertex(x4, y4, c4);
+    op.vertices[3] = ArrayVertex(x3, y3, c3);
+    op.vertices[2] = ArrayVertex(x4, y4, c4);
 #endif
     op.z = z;
-    pimpl->queues.back().scheduleDrawOp(op);
+    currentQueue(pimpl->queues).scheduleDrawOp(op, mode);
+}
+
+void Gosu::Graphics::drawRects(const RectInstance* rects, std::size_t count, double thickness,
+    ZPos z, AlphaMode mode)
+{
+    DrawOpQueue& queue = currentQueue(pimpl->queues);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const RectInstance& r = rects[i];
+        if (thickness <= 0 || 2 * thickness >= r.width || 2 * thickness >= r.height)
+        {
+            scheduleRect(queue, r.x, r.y, r.width, r.height, r.color, z, mode);
+            continue;
+        }
+        
+        // The top and bottom edges span the whole width.
+        double innerHeight = r.height - 2 * thickness;
+        scheduleRect(queue, r.x, r.y, r.width, thickness, r.color, z, mode);
+        scheduleRect(queue, r.x, r.y + r.height - thickness, r.width, thickness, r.color, z, mode);
+        scheduleRect(queue, r.x, r.y + thickness, thickness, innerHeight, r.color, z, mode);
+        scheduleRect(queue, r.x + r.width - thickness, r.y + thickness, thickness, innerHeight,
+            r.color, z, mode);
+    }
+}
+
+void Gosu::Graphics::drawCircles(const CircleInstance* circles, std::size_t count,
+    double thickness, ZPos z, AlphaMode mode)
+{
+    DrawOpQueue& queue = currentQueue(pimpl->queues);
+    const double* xs = circleTable.xs;
+    const double* ys = circleTable.ys;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const CircleInstance& circle = circles[i];
+        if (circle.radius <= 0)
+            continue;
+        unsigned step = CircleTable::SEGMENTS / circleSegments(circle.radius);
+        double x = circle.x, y = circle.y, r = circle.radius;
+        
+        if (thickness <= 0 || thickness >= r)
+        {
+            // Each quad covers two segments of a triangle fan around the
+            // center.
+            for (unsigned j = 0; j < CircleTable::SEGMENTS; j += 2 * step)
+                scheduleQuad(queue, x, y, x + xs[j] * r, y + ys[j] * r,
+                    x + xs[j + 2 * step] * r, y + ys[j + 2 * step] * r,
+                    x + xs[j + step] * r, y + ys[j + step] * r, circle.color, z, mode);
+            continue;
+        }
+        
+        double inner = r - thickness;
+        for (unsigned j = 0; j < CircleTable::SEGMENTS; j += step)
+            scheduleQuad(queue, x + xs[j] * r, y + ys[j] * r,
+                x + xs[j + step] * r, y + ys[j + step] * r,
+                x + xs[j] * inner, y + ys[j] * inner,
+                x + xs[j + step] * inner, y + ys[j + step] * inner, circle.color, z, mode);
+    }
+}
+
+void Gosu::Graphics::drawPolyline(const double* points, std::size_t count, double thickness,
+    Color c, ZPos z, AlphaMode mode, bool closed)
+{
+    // Repeated points have no direction to offset the line from.
+    std::vector<double> xs, ys;
+    for (std::size_t i = 0; i < count; ++i)
+        if (xs.empty() || points[2 * i] != xs.back() || points[2 * i + 1] != ys.back())
+        {
+            xs.push_back(points[2 * i]);
+            ys.push_back(points[2 * i + 1]);
+        }
+    if (closed && xs.size() > 2 && xs.front() == xs.back() && ys.front() == ys.back())
+        xs.pop_back(), ys.pop_back();
+    std::size_t n = xs.size();
+    if (n < 2 || thickness <= 0)
+        return;
+    std::size_t segments = closed && n > 2 ? n : n - 1;
+    
+    // Unit normals of the segments.
+    std::vector<double> nxs(segments), nys(segments);
+    for (std::size_t i = 0; i < segments; ++i)
+    {
+        double dx = xs[(i + 1) % n] - xs[i], dy = ys[(i + 1) % n] - ys[i];
+        double length = std::sqrt(dx * dx + dy * dy);
+        nxs[i] = -dy / length;
+        nys[i] = dx / length;
+    }
+    
+    DrawOpQueue& queue = currentQueue(pimpl->queues);
+    double half = thickness / 2;
+    for (std::size_t i = 0; i < segments; ++i)
+    {
+        std::size_t next = (i + 1) % n;
+        // Offsets of the segment's start and end from the center line.
+        double offsets[2][2];
+        for (int end = 0; end < 2; ++end)
+        {
+            offsets[end][0] = nxs[i] * half;
+            offsets[end][1] = nys[i] * half;
+            
+            // The neighboring segment at this end, if any.
+            std::size_t other;
+            if (end == 0 && (i > 0 || segments == n))
+                other = (i + segments - 1) % segments;
+            else if (end == 1 && (i + 1 < segments || segments == n))
+                other = (i + 1) % segments;
+            else
+                continue;
+            
+            // The miter is as long as half / cos(angle / 2); beyond four
+            // times that, the segments are left unjoined.
+            double mx = nxs[i] + nxs[other], my = nys[i] + nys[other];
+            double squaredLength = mx * mx + my * my;
+            if (squaredLength < 0.25)
+                continue;
+            offsets[end][0] = mx * 2 * half / squaredLength;
+            offsets[end][1] = my * 2 * half / squaredLength;
+        }
+        
+        scheduleQuad(queue, xs[i] + offsets[0][0], ys[i] + offsets[0][1],
+            xs[next] + offsets[1][0], ys[next] + offsets[1][1],
+            xs[i] - offsets[0][0], ys[i] - offsets[0][1],
+            xs[next] - offsets[1][0], ys[next] - offsets[1][1], c, z, mode);
+    }
+}
+
+bool Gosu::Graphics::storedSize(unsigned width, unsigned height,
+    unsigned& storedWidth, unsigned& storedHeight) const
+{
+    double scale = std::min(pimpl->imageScale, 1.0);
+    unsigned maxResolution = pimpl->maxImageResolution;
+    if (maxResolution && std::max(width, height) * scale > maxResolution)
+        scale = double(maxResolution) / std::max(width, height);
+    
+    storedWidth = std::max(1u, static_cast<unsigned>(width * scale + 0.5));
+    storedHeight = std::max(1u, static_cast<unsigned>(height * scale + 0.5));
+    if (storedWidth >= width && storedHeight >= height)
+    {
+        storedWidth = width;
+        storedHeight = height;
+        return false;
+    }
+    return true;
 }
 
 std::auto_ptr<Gosu::ImageData> Gosu::Graphics::createImage(
     const Bitmap& src, unsigned srcX, unsigned srcY,
     unsigned srcWidth, unsigned srcHeight, unsigned borderFlags)
 {
-    static const unsigned maxSize = MAX_TEXTURE_SIZE;
+    GOSU_TRACE("Graphics::createImage");
+    if (!ownsContext)
+    {
+        std::tr1::shared_ptr<DeferredImage::Slot> slot(new DeferredImage::Slot);
+        slot->bitmap.resize(srcWidth, srcHeight);
+        slot->bitmap.insert(src, 0, 0, srcX, srcY, srcWidth, srcHeight);
+        slot->borderFlags = borderFlags;
+        std::auto_ptr<ImageData> result(new DeferredImage(slot));
+        Lock lock(pimpl->deferredMutex);
+        pimpl->deferredImages.push_back(slot);
+        return result;
+    }
+    
+    unsigned storedWidth, storedHeight;
+    if (!storedSize(srcWidth, srcHeight, storedWidth, storedHeight))
+        return createStoredImage(src, srcX, srcY, srcWidth, srcHeight, borderFlags);
+    
+    ScratchBitmap scaled;
+    resample(*scaled, src, srcX, srcY, srcWidth, srcHeight, storedWidth, storedHeight);
+    return std::auto_ptr<ImageData>(new ScaledImage(createStoredImage(*scaled,
+        0, 0, storedWidth, storedHeight, borderFlags), srcWidth, srcHeight));
+}
+
+std::auto_ptr<Gosu::ImageData> Gosu::Graphics::createStoredImage(
+    const Bitmap& src, unsigned srcX, unsigned srcY,
+    unsigned srcWidth, unsigned srcHeight, unsigned borderFlags)
+{
+    const unsigned maxSize = pimpl->atlasSize;
+    
+#ifdef GOSU_IS_IPHONE
+    bool mipmapped = false;
+#else
+    bool mipmapped = (borderFlags & bfMipmapped) != 0;
+#endif
+    // Each pixel format has its own atlas pages.
+    PixelFormat format = pixelFormat(borderFlags);
 
     // Special case: If the texture is supposed to have hard borders,
     // is quadratic, has a size that is at least 64 pixels but less than 256
@@ -342,67 +1539,266 @@ std::auto_ptr<Gosu::ImageData> Gosu::Graphics::createImage(
         (srcWidth & (srcWidth - 1)) == 0 &&
         srcWidth >= 64)
     {
-        std::tr1::shared_ptr<Texture> texture(new Texture(srcWidth));
+        std::tr1::shared_ptr<Texture> texture(new Texture(srcWidth, true, mipmapped, format));
+        // The source area is uploaded from where it is in the bitmap.
         std::auto_ptr<ImageData> data;
-        
-        // Use the source bitmap directly if the source area completely covers
-        // it.
-        if (srcX == 0 && srcWidth == src.width() &&
-            srcY == 0 && srcHeight == src.height())
-        {
-            data = texture->tryAlloc(*this, pimpl->queues, texture, src, 0);
-        }
-        else
-        {
-            Bitmap trimmedSrc;
-            trimmedSrc.resize(srcWidth, srcHeight);
-            trimmedSrc.insert(src, 0, 0, srcX, srcY, srcWidth, srcHeight);
-            data = texture->tryAlloc(*this, pimpl->queues, texture, trimmedSrc, 0);
-        }
-        
+        data = texture->tryAlloc(*this, pimpl->queues, texture,
+            BitmapView(src, srcX, srcY, srcWidth, srcHeight), 0);
         if (!data.get())
             throw std::logic_error("Internal texture block allocation error");
         return data;
     }
     
     // Too large to fit on a single texture. 
-    if (srcWidth > maxSize - 2 || srcHeight > maxSize - 2)
+    unsigned maxPartSize = maxSize - 2 * (mipmapped ? Texture::MIPMAP_PADDING : 1);
+    if (srcWidth > maxPartSize || srcHeight > maxPartSize)
     {
-        Bitmap bmp(srcWidth, srcHeight);
-        bmp.insert(src, 0, 0, srcX, srcY, srcWidth, srcHeight);
         std::auto_ptr<ImageData> lidi;
-        lidi.reset(new LargeImageData(*this, bmp, maxSize - 2, maxSize - 2, borderFlags));
+        lidi.reset(new LargeImageData(*this, pimpl->queues, src, srcX, srcY, srcWidth, srcHeight,
+            maxPartSize, maxPartSize, borderFlags));
         return lidi;
     }
     
-    Bitmap bmp;
-    applyBorderFlags(bmp, src, srcX, srcY, srcWidth, srcHeight, borderFlags);
-
-#if 0
-    std::mutex::scoped_lock lock(pimpl->texMutex);
-#endif
-    
     // Try to put the bitmap into one of the already allocated textures.
     for (Impl::Textures::iterator i = pimpl->textures.begin(); i != pimpl->textures.end(); ++i)
     {
         std::tr1::shared_ptr<Texture> texture(*i);
+        if (texture->isMipmapped() != mipmapped || texture->format() != format)
+            continue;
         
         std::auto_ptr<ImageData> data;
-        data = texture->tryAlloc(*this, pimpl->queues, texture, bmp, 1);
+        data = texture->tryAlloc(*this, pimpl->queues, texture,
+            src, srcX, srcY, srcWidth, srcHeight, borderFlags);
         if (data.get())
+        {
+            texture->setLastDrawn(pimpl->frame);
             return data;
+        }
     }
     
     // All textures are full: Create a new one.
     
     std::tr1::shared_ptr<Texture> texture;
-    texture.reset(new Texture(maxSize));
+    texture = pimpl->newAtlasPage(mipmapped, format);
+    texture->setLastDrawn(pimpl->frame);
     pimpl->textures.push_back(texture);
     
     std::auto_ptr<ImageData> data;
-    data = texture->tryAlloc(*this, pimpl->queues, texture, bmp, 1);
+    data = texture->tryAlloc(*this, pimpl->queues, texture,
+        src, srcX, srcY, srcWidth, srcHeight, borderFlags);
     if (!data.get())
         throw std::logic_error("Internal texture block allocation error");
 
     return data;
 }
+
+std::vector<Gosu::Image> Gosu::Graphics::createTiles(
+    const Bitmap& src, unsigned tileWidth, unsigned tileHeight,
+    unsigned columns, unsigned rows, unsigned borderFlags)
+{
+    std::vector<Image> result;
+    if (columns == 0 || rows == 0)
+        return result;
+    result.reserve(columns * rows);
+    unsigned cellWidth = tileWidth + 2, cellHeight = tileHeight + 2;
+    
+    // Tiles that get textures of their own, need mipmaps or are scaled go
+    // through createImage one by one.
+    bool dedicated = (borderFlags & bfTileable) == bfTileable &&
+        tileWidth == tileHeight && (tileWidth & (tileWidth - 1)) == 0 && tileWidth >= 64;
+    unsigned storedWidth, storedHeight;
+    if (dedicated || (borderFlags & bfMipmapped) ||
+        storedSize(tileWidth, tileHeight, storedWidth, storedHeight) ||
+        cellWidth > pimpl->atlasSize || cellHeight > pimpl->atlasSize)
+    {
+        for (unsigned i = 0; i < columns * rows; ++i)
+            result.push_back(Image(createImage(src, i % columns * tileWidth,
+                i / columns * tileHeight, tileWidth, tileHeight, borderFlags)));
+        return result;
+    }
+    
+    unsigned groupColumns = std::min(columns, pimpl->atlasSize / cellWidth);
+    unsigned groupRows = std::min(rows, pimpl->atlasSize / cellHeight);
+    // Tiles are created group by group, and sorted afterwards.
+    std::vector<Image> created;
+    std::vector<std::size_t> position(columns * rows);
+    created.reserve(columns * rows);
+    ScratchBitmap padded, cell;
+    for (unsigned top = 0; top < rows; top += groupRows)
+        for (unsigned left = 0; left < columns; left += groupColumns)
+        {
+            unsigned groupWidth = std::min(groupColumns, columns - left);
+            unsigned groupHeight = std::min(groupRows, rows - top);
+            
+            // All tiles of the group with their borders, laid out like
+            // the cells on the texture.
+            padded->resize(groupWidth * cellWidth, groupHeight * cellHeight);
+            for (unsigned y = 0; y < groupHeight; ++y)
+                for (unsigned x = 0; x < groupWidth; ++x)
+                {
+                    applyBorderFlags(*cell, src, (left + x) * tileWidth, (top + y) * tileHeight,
+                        tileWidth, tileHeight, borderFlags);
+                    padded->insert(*cell, x * cellWidth, y * cellHeight);
+                }
+            
+            std::tr1::shared_ptr<Texture> texture;
+            BlockAllocator::Block block;
+            for (Impl::Textures::iterator i = pimpl->textures.begin(); i != pimpl->textures.end(); ++i)
+                if (!(*i)->isMipmapped() && (*i)->format() == pixelFormat(borderFlags) &&
+                        (*i)->allocGrid(cellWidth, cellHeight, groupWidth, groupHeight, block))
+                {
+                    texture = *i;
+                    break;
+                }
+            if (!texture)
+            {
+                texture = pimpl->newAtlasPage(false, pixelFormat(borderFlags));
+                pimpl->textures.push_back(texture);
+                if (!texture->allocGrid(cellWidth, cellHeight, groupWidth, groupHeight, block))
+                    throw std::logic_error("Internal texture block allocation error");
+            }
+            texture->setLastDrawn(pimpl->frame);
+            
+            GLFence fence = texture->upload(block, *padded);
+            TexChunk* last = 0;
+            for (unsigned y = 0; y < groupHeight; ++y)
+                for (unsigned x = 0; x < groupWidth; ++x)
+                {
+                    std::auto_ptr<TexChunk> chunk(new TexChunk(*this, pimpl->queues, texture,
+                        block.left + x * cellWidth + 1, block.top + y * cellHeight + 1,
+                        tileWidth, tileHeight, 1));
+                    last = chunk.get();
+                    position[(top + y) * columns + left + x] = created.size();
+                    created.push_back(Image(std::auto_ptr<ImageData>(chunk)));
+                }
+            // The fence tells when the whole group has arrived, which is
+            // what the last tile of it waits for anyway.
+            last->setUploadFence(fence);
+        }
+    
+    for (unsigned i = 0; i < columns * rows; ++i)
+        result.push_back(created[position[i]]);
+    return result;
+}
+
+namespace
+{
+    bool isLessUsed(const std::tr1::shared_ptr<Gosu::Texture>& lhs,
+        const std::tr1::shared_ptr<Gosu::Texture>& rhs)
+    {
+        return lhs->usedArea() < rhs->usedArea();
+    }
+    
+    struct Relocation
+    {
+        Gosu::TexChunk* chunk;
+        std::tr1::shared_ptr<Gosu::Texture> target;
+        Gosu::BlockAllocator::Block block;
+    };
+}
+
+std::auto_ptr<Gosu::ImageData> Gosu::Graphics::createCompressedImage(Reader reader)
+{
+    CompressedTexture data;
+    loadCompressedTexture(data, reader);
+    
+    unsigned size = 4;
+    while (size < data.width || size < data.height)
+        size *= 2;
+    
+    if (!glCompressionFunctions().supports(data.format) || size > pimpl->maxTextureSize)
+    {
+        Bitmap bmp = decompress(data);
+        // createImage premultiplies again, see setPremultipliedAlpha.
+        if (premultipliedAlpha && bmp.width() * bmp.height() > 0)
+            Pixels::unpremultiply(bmp.data(), bmp.width() * bmp.height());
+        return createImage(bmp, 0, 0, bmp.width(), bmp.height(), bfSmooth);
+    }
+    if (!data.supportsSubImages() && (data.width != size || data.height != size))
+        throw std::runtime_error("PVRTC textures must be square and have a power-of-two size");
+    
+    std::tr1::shared_ptr<Texture> texture(new Texture(size, data));
+    BlockAllocator::Block block;
+    if (!texture->allocBlock(data.width, data.height, block))
+        throw std::logic_error("Internal texture block allocation error");
+    return std::auto_ptr<ImageData>(new TexChunk(*this, pimpl->queues, texture,
+        block.left, block.top, block.width, block.height, 0));
+}
+
+unsigned Gosu::Graphics::compactTextures()
+{
+    #ifdef GOSU_IS_IPHONE
+    // Textures cannot be read back on iOS.
+    return 0;
+    #else
+    Impl::Textures& textures = pimpl->textures;
+    unsigned released = 0;
+    
+    // Empty the sparsest textures first, moving their contents onto the
+    // fullest ones that still have room.
+    Impl::Textures candidates = textures;
+    std::sort(candidates.begin(), candidates.end(), isLessUsed);
+    
+    for (Impl::Textures::iterator source = candidates.begin(); source != candidates.end(); ++source)
+    {
+        unsigned long area = static_cast<unsigned long>((*source)->size()) * (*source)->size();
+        if ((*source)->usedArea() * 2 > area)
+            break;
+        
+        Impl::Textures targets;
+        // Chunks keep their layout, so they can only move between textures
+        // of the same kind.
+        for (Impl::Textures::iterator it = textures.begin(); it != textures.end(); ++it)
+            if (*it != *source && (*it)->isMipmapped() == (*source)->isMipmapped() &&
+                    (*it)->format() == (*source)->format())
+                targets.push_back(*it);
+        std::sort(targets.rbegin(), targets.rend(), isLessUsed);
+        
+        // Reserve space for every chunk first; give up on this texture if
+        // not all of them fit elsewhere.
+        std::vector<Relocation> relocations;
+        const Texture::Chunks& chunks = (*source)->chunks();
+        for (Texture::Chunks::const_iterator chunk = chunks.begin(); chunk != chunks.end(); ++chunk)
+        {
+            Relocation relocation;
+            relocation.chunk = *chunk;
+            Impl::Textures::iterator target = targets.begin();
+            for (; target != targets.end(); ++target)
+                if ((*target)->allocBlock((*chunk)->blockWidth(), (*chunk)->blockHeight(),
+                        relocation.block))
+                    break;
+            if (target == targets.end())
+                break;
+            relocation.target = *target;
+            relocations.push_back(relocation);
+        }
+        
+        if (relocations.size() != chunks.size())
+        {
+            for (std::vector<Relocation>::iterator it = relocations.begin(); it != relocations.end(); ++it)
+                it->target->free(it->block.left, it->block.top);
+            continue;
+        }
+        
+        // Copy the pixels over. The source texture is downloaded only once.
+        if (!relocations.empty())
+        {
+            Bitmap content = (*source)->toBitmap(0, 0, (*source)->size(), (*source)->size());
+            for (std::vector<Relocation>::iterator it = relocations.begin(); it != relocations.end(); ++it)
+            {
+                GLFence fence = it->target->upload(it->block, BitmapView(content,
+                    it->chunk->blockLeft(), it->chunk->blockTop(), it->block.width, it->block.height));
+                it->chunk->relocate(it->target, it->block.left, it->block.top);
+                it->chunk->setUploadFence(fence);
+            }
+        }
+        
+        // Queued draw operations and macros may still keep the texture alive
+        // for a while, but no new images will be put onto it.
+        textures.erase(std::find(textures.begin(), textures.end(), *source));
+        ++released;
+    }
+    
+    return released;
+    #endif
+}
@@ -1,26 +1,149 @@
 #include <Gosu/Image.hpp>
+#include <Gosu/Archive.hpp>
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/Graphics.hpp>
 #include <Gosu/ImageData.hpp>
 #include <Gosu/Math.hpp>
 #include <Gosu/IO.hpp>
+#include <Gosu/Text.hpp>
+#include <GosuImpl/Graphics/BitmapPool.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/CompressedTexture.hpp>
+#include <GosuImpl/Graphics/ScaledImage.hpp>
+#include <GosuImpl/Graphics/SubImage.hpp>
+#include <GosuImpl/Graphics/TexChunk.hpp>
+#include <GosuImpl/DecodedCache.hpp>
+#include <GosuImpl/ResourceCache.hpp>
+#include <stdexcept>
+
+namespace GosusDarkSide
+{
+    // Can point to a function that calls work(arg) while the threads of a
+    // scripting language keep running, e.g. without Ruby's interpreter lock.
+    typedef void (*BlockingHook)(void (*work)(void*), void* arg);
+    BlockingHook blockingCall = 0;
+}
+
+namespace
+{
+    std::wstring decodedCacheDirectory;
+    
+    // The parameters of either createText. Rasterizing needs no OpenGL, so
+    // it can run through GosusDarkSide::blockingCall.
+    struct TextJob
+    {
+        const std::wstring* text;
+        const std::wstring* fontName;
+        unsigned fontHeight, fontFlags;
+        bool wrapped;
+        int lineSpacing;
+        unsigned width;
+        Gosu::TextAlign align;
+        Gosu::Bitmap bitmap;
+        
+        static void run(void* data)
+        {
+            TextJob& job = *static_cast<TextJob*>(data);
+            if (job.wrapped)
+                job.bitmap = Gosu::createText(*job.text, *job.fontName, job.fontHeight,
+                    job.lineSpacing, job.width, job.align, job.fontFlags);
+            else
+                job.bitmap = Gosu::createText(*job.text, *job.fontName, job.fontHeight,
+                    job.fontFlags);
+        }
+        
+        void operator()()
+        {
+            if (GosusDarkSide::blockingCall)
+                GosusDarkSide::blockingCall(run, this);
+            else
+                run(this);
+        }
+    };
+    
+    // Looks into the mounted archives before the file system.
+    void loadBitmap(Gosu::Bitmap& bitmap, const std::wstring& filename)
+    {
+        if (const Gosu::Resource* packed = Gosu::findInMountedArchives(filename))
+            Gosu::loadImageFile(bitmap, packed->frontReader());
+        else
+            Gosu::loadCachedImageFile(bitmap, filename);
+    }
+}
+
+void Gosu::loadCachedImageFile(Bitmap& bitmap, const std::wstring& filename)
+{
+    DecodedCache cache(DecodedCache::PIXELS, decodedCacheDirectory, filename);
+    std::tr1::uint32_t width, height;
+    std::tr1::uint64_t bytes;
+    if (cache.open(width, height, bytes) &&
+            bytes == static_cast<std::tr1::uint64_t>(width) * height * sizeof(Color))
+    {
+        Bitmap cached(width, height);
+        if (width * height == 0 || cache.read(cached.data()))
+        {
+            bitmap.swap(cached);
+            return;
+        }
+    }
+    
+    loadImageFile(bitmap, filename);
+    if (bitmap.width() * bitmap.height() > 0)
+        cache.store(bitmap.width(), bitmap.height(), bitmap.data(),
+            bitmap.width() * bitmap.height() * sizeof(Color));
+}
+
+void Gosu::Image::setDecodedCacheDirectory(const std::wstring& directory)
+{
+    decodedCacheDirectory = directory;
+}
 
 Gosu::Image::Image(Graphics& graphics, const std::wstring& filename, bool tileable)
 {
-	// Forward.
-	Bitmap bmp;
-	loadImageFile(bmp, filename);
-	Image(graphics, bmp, tileable).data.swap(data);
+    ResourceCache::Key key(filename, &graphics, tileable);
+    std::tr1::shared_ptr<void> cached = imageCache().find(key);
+    if (cached)
+    {
+        data = std::tr1::static_pointer_cast<ImageData>(cached);
+        return;
+    }
+    
+    std::auto_ptr<File> file;
+    const Resource* source = findInMountedArchives(filename);
+    if (!source)
+    {
+        file.reset(new File(filename));
+        source = file.get();
+    }
+    if (isCompressedTextureFile(source->frontReader()))
+        data.reset(graphics.createCompressedImage(source->frontReader()).release());
+    else
+    {
+        // Forward.
+        ScratchBitmap bmp;
+        loadBitmap(*bmp, filename);
+        Image(graphics, *bmp, tileable).data.swap(data);
+    }
+    imageCache().insert(key, data);
 }
 
 Gosu::Image::Image(Graphics& graphics, const std::wstring& filename,
     unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
     bool tileable)
 {
+    ResourceCache::Key key(filename, &graphics, tileable, srcX, srcY, srcWidth, srcHeight);
+    std::tr1::shared_ptr<void> cached = imageCache().find(key);
+    if (cached)
+    {
+        data = std::tr1::static_pointer_cast<ImageData>(cached);
+        return;
+    }
+    
 	// Forward.
-	Bitmap bmp;
-	loadImageFile(bmp, filename);
-	Image(graphics, bmp, srcX, srcY, srcWidth, srcHeight, tileable).data.swap(data);
+	ScratchBitmap bmp;
+	loadBitmap(*bmp, filename);
+	Image(graphics, *bmp, srcX, srcY, srcWidth, srcHeight, tileable).data.swap(data);
+    imageCache().insert(key, data);
 }
 
 Gosu::Image::Image(Graphics& graphics, const Bitmap& source, bool tileable)
@@ -42,6 +165,43 @@ Gosu::Image::Image(std::auto_ptr<ImageData> data)
 {
 }
 
+Gosu::Image::Image(const std::tr1::shared_ptr<ImageData>& data)
+:   data(data)
+{
+}
+
+Gosu::Image Gosu::Image::fromText(Graphics& graphics, const std::wstring& text,
+    const std::wstring& fontName, unsigned fontHeight, unsigned fontFlags)
+{
+    TextImageCache::Key key(text, fontName, &graphics, false, fontHeight, fontFlags);
+    std::tr1::shared_ptr<void> cached = textImageCache().find(key);
+    if (cached)
+        return Image(std::tr1::static_pointer_cast<ImageData>(cached));
+    
+    TextJob job = { &text, &fontName, fontHeight, fontFlags, false };
+    job();
+    Image image(graphics, job.bitmap);
+    textImageCache().insert(key, image.data, 4 * image.width() * image.height());
+    return image;
+}
+
+Gosu::Image Gosu::Image::fromText(Graphics& graphics, const std::wstring& text,
+    const std::wstring& fontName, unsigned fontHeight, int lineSpacing,
+    unsigned width, TextAlign align, unsigned fontFlags)
+{
+    TextImageCache::Key key(text, fontName, &graphics, true, fontHeight, fontFlags,
+        lineSpacing, width, align);
+    std::tr1::shared_ptr<void> cached = textImageCache().find(key);
+    if (cached)
+        return Image(std::tr1::static_pointer_cast<ImageData>(cached));
+    
+    TextJob job = { &text, &fontName, fontHeight, fontFlags, true, lineSpacing, width, align };
+    job();
+    Image image(graphics, job.bitmap);
+    textImageCache().insert(key, image.data, 4 * image.width() * image.height());
+    return image;
+}
+
 unsigned Gosu::Image::width() const
 {
     return data->width();
@@ -82,8 +242,8 @@ void Gosu::Image::drawRot(double x, double y, ZPos z,
 {
     double sizeX = width()  * factorX;
     double sizeY = height() * factorY;
-    double offsX = offsetX(angle, 1);
-    double offsY = offsetY(angle, 1);
+    double offsX, offsY;
+    offsetXY(angle, 1, offsX, offsY);
 
     // Offset to the centers of the original Image's edges when it is rotated
     // by <angle> degrees.
@@ -107,6 +267,116 @@ void Gosu::Image::drawRot(double x, double y, ZPos z,
                c, z, mode);
 }
 
+void Gosu::Image::drawMany(const ImageInstance* instances, std::size_t count,
+    ZPos z, AlphaMode mode) const
+{
+    data->drawMany(instances, count, z, mode);
+}
+
+void Gosu::Image::drawMany(const std::vector<ImageInstance>& instances,
+    ZPos z, AlphaMode mode) const
+{
+    if (!instances.empty())
+        data->drawMany(&instances[0], instances.size(), z, mode);
+}
+
+void Gosu::Image::drawMesh(const MeshVertex* vertices, std::size_t vertexCount,
+    const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const
+{
+    if (indexCount % 3 != 0)
+        throw std::invalid_argument("drawMesh expects three indices per triangle");
+    for (std::size_t i = 0; i < indexCount; ++i)
+        if (indices[i] >= vertexCount)
+            throw std::invalid_argument("Index in drawMesh out of range");
+    if (indexCount > 0)
+        data->drawMesh(vertices, vertexCount, indices, indexCount, z, mode);
+}
+
+void Gosu::Image::drawMesh(const std::vector<MeshVertex>& vertices,
+    const std::vector<unsigned>& indices, ZPos z, AlphaMode mode) const
+{
+    if (!indices.empty())
+        drawMesh(vertices.empty() ? 0 : &vertices[0], vertices.size(),
+            &indices[0], indices.size(), z, mode);
+}
+
+void Gosu::instanceCorners(const ImageInstance* instances, std::size_t count,
+    double width, double height, double* xs, double* ys)
+{
+    for (std::size_t i = 0; i < count; ++i)
+        instanceCorners(instances[i], width, height, xs + i * 4, ys + i * 4);
+}
+
+void Gosu::ImageData::drawMany(const ImageInstance* instances, std::size_t count,
+    ZPos z, AlphaMode mode) const
+{
+    double xs[4], ys[4];
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        instanceCorners(instances[i], width(), height(), xs, ys);
+        Color c = instances[i].color;
+        draw(xs[0], ys[0], c, xs[1], ys[1], c, xs[2], ys[2], c, xs[3], ys[3], c, z, mode);
+    }
+}
+
+void Gosu::ImageData::drawMesh(const MeshVertex* vertices, std::size_t vertexCount,
+    const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const
+{
+    throw std::logic_error("drawMesh is only supported for images on a single texture");
+}
+
+bool Gosu::Image::ready() const
+{
+    return data->ready();
+}
+
+std::auto_ptr<Gosu::Image> Gosu::Image::subimage(int x, int y, int width, int height) const
+{
+    std::auto_ptr<Image> result;
+    
+    int right = std::min<int>(x + width, this->width());
+    int bottom = std::min<int>(y + height, this->height());
+    x = std::max(x, 0);
+    y = std::max(y, 0);
+    width = std::max(right - x, 0);
+    height = std::max(bottom - y, 0);
+    
+    // Parts of parts are taken from the original chunk directly. Parts of
+    // scaled images are scaled the same way.
+    std::tr1::shared_ptr<ImageData> parent = data;
+    const ScaledImage* scaled = dynamic_cast<ScaledImage*>(data.get());
+    ImageData* stored = scaled ? &scaled->storedData() : data.get();
+    TexChunk* chunk = dynamic_cast<TexChunk*>(stored);
+    int offsetX = 0, offsetY = 0;
+    if (SubImage* sub = dynamic_cast<SubImage*>(stored))
+    {
+        parent = sub->parentData();
+        chunk = &sub->texChunk();
+        offsetX = sub->left();
+        offsetY = sub->top();
+    }
+    if (!chunk)
+        return result;
+    
+    if (!scaled)
+    {
+        std::auto_ptr<ImageData> part(new SubImage(parent, *chunk,
+            offsetX + x, offsetY + y, width, height));
+        result.reset(new Image(part));
+        return result;
+    }
+    
+    int storedLeft = x * stored->width() / scaled->width();
+    int storedTop = y * stored->height() / scaled->height();
+    int storedRight = (x + width) * stored->width() / scaled->width();
+    int storedBottom = (y + height) * stored->height() / scaled->height();
+    std::auto_ptr<ImageData> part(new SubImage(parent, *chunk,
+        offsetX + storedLeft, offsetY + storedTop,
+        storedRight - storedLeft, storedBottom - storedTop));
+    result.reset(new Image(std::auto_ptr<ImageData>(new ScaledImage(part, width, height))));
+    return result;
+}
+
 Gosu::ImageData& Gosu::Image::getData() const
 {
     return *data;
@@ -115,7 +385,6 @@ Gosu::ImageData& Gosu::Image::getData() const
 std::vector<Gosu::Image> Gosu::loadTiles(Graphics& graphics, const Bitmap& bmp, int tileWidth, int tileHeight, bool tileable)
 {
     int tilesX, tilesY;
-    std::vector<Image> images;
     
     if (tileWidth > 0)
         tilesX = bmp.width() / tileWidth;
@@ -133,16 +402,13 @@ std::vector<Gosu::Image> Gosu::loadTiles(Graphics& graphics, const Bitmap& bmp,
         tileHeight = bmp.height() / tilesY;
     }
     
-    for (int y = 0; y < tilesY; ++y)
-        for (int x = 0; x < tilesX; ++x)
-            images.push_back(Image(graphics, bmp, x * tileWidth, y * tileHeight, tileWidth, tileHeight, tileable));
-    
-    return images;
+    return graphics.createTiles(bmp, tileWidth, tileHeight, tilesX, tilesY,
+        tileable ? bfTileable : bfSmooth);
 }
 
 std::vector<Gosu::Image> Gosu::loadTiles(Graphics& graphics, const std::wstring& filename, int tileWidth, int tileHeight, bool tileable)
 {
-    Bitmap bmp;
-    loadImageFile(bmp, filename);
-    return loadTiles(graphics, bmp, tileWidth, tileHeight, tileable);
+    ScratchBitmap bmp;
+    loadBitmap(*bmp, filename);
+    return loadTiles(graphics, *bmp, tileWidth, tileHeight, tileable);
 }
@@ -1,50 +1,103 @@
 #include <GosuImpl/Graphics/LargeImageData.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/DrawOpQueue.hpp>
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/Graphics.hpp>
 #include <Gosu/Math.hpp>
+#include <Gosu/TR1.hpp>
 #include <cmath>
+#include <stdexcept>
 using namespace std;
 
-Gosu::LargeImageData::LargeImageData(Graphics& graphics,
-    const Bitmap& source, unsigned partWidth, unsigned partHeight,
-    unsigned borderFlags)
+Gosu::LargeImageData::LargeImageData(Graphics& graphics, DrawOpQueueStack& queues,
+    const Bitmap& source, unsigned srcX, unsigned srcY, unsigned srcWidth,
+    unsigned srcHeight, unsigned partWidth, unsigned partHeight, unsigned borderFlags)
+: graphics(graphics), queues(queues), borderFlags(borderFlags & ~bfStreamed),
+  partMemory(mcLargeImageParts), streamed((borderFlags & bfStreamed) != 0),
+  sourceMemory(mcStreamedImages)
 {
-    fullWidth = source.width();
-    fullHeight = source.height();
-    partsX = trunc(ceil(1.0 * source.width() / partWidth));
-    partsY = trunc(ceil(1.0 * source.height() / partHeight));
+    fullWidth = srcWidth;
+    fullHeight = srcHeight;
+    partsX = trunc(ceil(1.0 * srcWidth / partWidth));
+    partsY = trunc(ceil(1.0 * srcHeight / partHeight));
     this->partWidth = partWidth;
     this->partHeight = partHeight;
 
     parts.resize(partsX * partsY);
+    
+    // Every part but the last has the full size, so the edges between
+    // them do not change between draws.
+    for (unsigned x = 0; x <= partsX; ++x)
+        edgesX.push_back(x == partsX ? 1.0 : 1.0 * x * partWidth / srcWidth);
+    for (unsigned y = 0; y <= partsY; ++y)
+        edgesY.push_back(y == partsY ? 1.0 : 1.0 * y * partHeight / srcHeight);
+    for (unsigned x = 0; x <= partsX; ++x)
+        weightsX.push_back(Gosu::round(edgesX[x] * 256));
+    for (unsigned y = 0; y <= partsY; ++y)
+        weightsY.push_back(Gosu::round(edgesY[y] * 256));
+    
+    if (streamed)
+    {
+        this->source.resize(srcWidth, srcHeight);
+        this->source.insert(source, 0, 0, srcX, srcY, srcWidth, srcHeight);
+        sourceMemory.set(static_cast<unsigned long>(srcWidth) * srcHeight * 4);
+        lastVisible.resize(parts.size());
+        return;
+    }
 
     for (unsigned y = 0; y < partsY; ++y)
         for (unsigned x = 0; x < partsX; ++x)
+            createPart(x, y, source, srcX, srcY);
+}
+
+void Gosu::LargeImageData::partSize(unsigned px, unsigned py,
+    unsigned& width, unsigned& height) const
+{
+    // The right-most parts don't necessarily have the full width.
+    width = partWidth;
+    if (px == partsX - 1 && fullWidth % partWidth != 0)
+        width = fullWidth % partWidth;
+
+    // Same for the parts on the bottom.
+    height = partHeight;
+    if (py == partsY - 1 && fullHeight % partHeight != 0)
+        height = fullHeight % partHeight;
+}
+
+void Gosu::LargeImageData::createPart(unsigned x, unsigned y, const Bitmap& pixels,
+    unsigned srcX, unsigned srcY) const
+{
+    unsigned srcWidth, srcHeight;
+    partSize(x, y, srcWidth, srcHeight);
+
+    unsigned localBorderFlags = bfTileable | (borderFlags & (bfMipmapped | bfAlpha8));
+    if (x == 0)
+        localBorderFlags = (localBorderFlags & ~bfTileableLeft) | (borderFlags & bfTileableLeft);
+    if (x == partsX - 1)
+        localBorderFlags = (localBorderFlags & ~bfTileableRight) | (borderFlags & bfTileableRight);
+    if (y == 0)
+        localBorderFlags = (localBorderFlags & ~bfTileableTop) | (borderFlags & bfTileableTop);
+    if (y == partsY - 1)
+        localBorderFlags = (localBorderFlags & ~bfTileableBottom) | (borderFlags & bfTileableBottom);
+    
+    parts[y * partsX + x].reset(graphics.createStoredImage(pixels,
+        srcX + x * partWidth, srcY + y * partHeight,
+        srcWidth, srcHeight, localBorderFlags).release());
+    partMemory.set(partMemory.get() + static_cast<unsigned long>(srcWidth) * srcHeight * 4);
+}
+
+void Gosu::LargeImageData::releaseInvisibleParts() const
+{
+    static const unsigned long RELEASE_DELAY = 120;
+    
+    unsigned long frame = graphics.frameNumber();
+    for (unsigned i = 0; i < parts.size(); ++i)
+        if (parts[i] && lastVisible[i] + RELEASE_DELAY < frame)
         {
-            // The right-most parts don't necessarily have the full width.
-            unsigned srcWidth = partWidth;
-            if (x == partsX - 1 && source.width() % partWidth != 0)
-                srcWidth = source.width() % partWidth;
-
-            // Same for the parts on the bottom.
-            unsigned srcHeight = partHeight;
-            if (y == partsY - 1 && source.height() % partHeight != 0)
-                srcHeight = source.height() % partHeight;
-
-            unsigned localBorderFlags = bfTileable;
-            if (x == 0)
-                localBorderFlags = (localBorderFlags & ~bfTileableLeft) | (borderFlags & bfTileableLeft);
-            if (x == partsX - 1)
-                localBorderFlags = (localBorderFlags & ~bfTileableRight) | (borderFlags & bfTileableRight);
-            if (y == 0)
-                localBorderFlags = (localBorderFlags & ~bfTileableTop) | (borderFlags & bfTileableTop);
-            if (y == partsY - 1)
-                localBorderFlags = (localBorderFlags & ~bfTileableBottom) | (borderFlags & bfTileableBottom);
-            
-            parts[y * partsX + x].reset(graphics.createImage(source,
-                x * partWidth, y * partHeight, srcWidth, srcHeight,
-                localBorderFlags).release());
+            unsigned width, height;
+            partSize(i % partsX, i / partsX, width, height);
+            partMemory.set(partMemory.get() - static_cast<unsigned long>(width) * height * 4);
+            parts[i].reset();
         }
 }
 
@@ -67,14 +120,24 @@ namespace
         return a + (b - a) * ratio;
     }
 
-    Gosu::Color ipl(Gosu::Color a, Gosu::Color b, double ratio)
+    // Interpolates all four channels at once in 16-bit lanes, with the
+    // weight of b in 1/256 (0 to 256). Off by at most one from exact
+    // rounding.
+    typedef std::tr1::uint64_t Lanes;
+    
+    Lanes spread(Gosu::Color c)
     {
-        Gosu::Color result;
-        result.setAlpha(Gosu::round(ipl(a.alpha(), b.alpha(), ratio)));
-        result.setRed  (Gosu::round(ipl(a.red(),   b.red(),   ratio)));
-        result.setGreen(Gosu::round(ipl(a.green(), b.green(), ratio)));
-        result.setBlue (Gosu::round(ipl(a.blue(),  b.blue(),  ratio)));
-        return result;
+        Lanes argb = c.argb();
+        argb = (argb | argb << 16) & 0x0000ffff0000ffffull;
+        return (argb | argb << 8) & 0x00ff00ff00ff00ffull;
+    }
+    
+    Gosu::Color ipl(Lanes a, Lanes b, unsigned weight)
+    {
+        Lanes mixed = (a * (256 - weight) + b * weight + 0x0080008000800080ull) >> 8;
+        mixed &= 0x00ff00ff00ff00ffull;
+        mixed = (mixed | mixed >> 8) & 0x0000ffff0000ffffull;
+        return Gosu::Color(static_cast<unsigned>(mixed | mixed >> 16));
     }
 }
 
@@ -84,41 +147,89 @@ void Gosu::LargeImageData::draw(double x1, double y1, Color c1,
 {
     if (parts.empty())
         return;
+    // Parts are created and released on the main thread only.
+    if (streamed && threadQueue)
+        throw std::logic_error("Streamed images cannot be drawn into thread queues");
 
     reorderCoordinatesIfNecessary(x1, y1, x2, y2, x3, y3, c3, x4, y4, c4);
     
+    DrawOpQueue& queue = currentQueue(queues);
+    
+    // Plain white or tinted images need no color interpolation.
+    bool uniform = c1 == c2 && c1 == c3 && c1 == c4;
+    Lanes l1 = spread(c1), l2 = spread(c2), l3 = spread(c3), l4 = spread(c4);
+    
     for (unsigned py = 0; py < partsY; ++py)
+    {
+        double relYT = edgesY[py], relYB = edgesY[py + 1];
+        
+        // Skip whole rows that cannot be seen.
+        double leftXT = ipl(x1, x3, relYT), rightXT = ipl(x2, x4, relYT);
+        double leftXB = ipl(x1, x3, relYB), rightXB = ipl(x2, x4, relYB);
+        double leftYT = ipl(y1, y3, relYT), rightYT = ipl(y2, y4, relYT);
+        double leftYB = ipl(y1, y3, relYB), rightYB = ipl(y2, y4, relYB);
+        if (queue.isQuadCulled(leftXT, leftYT, rightXT, rightYT,
+                leftXB, leftYB, rightXB, rightYB))
+            continue;
+        
+        Lanes leftCT = l1, rightCT = l1, leftCB = l1, rightCB = l1;
+        if (!uniform)
+        {
+            leftCT = spread(ipl(l1, l3, weightsY[py]));
+            rightCT = spread(ipl(l2, l4, weightsY[py]));
+            leftCB = spread(ipl(l1, l3, weightsY[py + 1]));
+            rightCB = spread(ipl(l2, l4, weightsY[py + 1]));
+        }
+        
         for (unsigned px = 0; px < partsX; ++px)
         {
-            ImageData& part = *parts[py * partsX + px];
-
-            double relXL = static_cast<double>(px * partWidth) / width();
-            double relXR = static_cast<double>(px * partWidth + part.width()) / width();
-            double relYT = static_cast<double>(py * partHeight) / height();
-            double relYB = static_cast<double>(py * partHeight + part.height()) / height();
+            double relXL = edgesX[px], relXR = edgesX[px + 1];
 
-            double absXTL = ipl(ipl(x1, x3, relYT), ipl(x2, x4, relYT), relXL);
-            double absXTR = ipl(ipl(x1, x3, relYT), ipl(x2, x4, relYT), relXR);
-            double absXBL = ipl(ipl(x1, x3, relYB), ipl(x2, x4, relYB), relXL);
-            double absXBR = ipl(ipl(x1, x3, relYB), ipl(x2, x4, relYB), relXR);
+            double absXTL = ipl(leftXT, rightXT, relXL);
+            double absXTR = ipl(leftXT, rightXT, relXR);
+            double absXBL = ipl(leftXB, rightXB, relXL);
+            double absXBR = ipl(leftXB, rightXB, relXR);
 
-            double absYTL = ipl(ipl(y1, y3, relYT), ipl(y2, y4, relYT), relXL);
-            double absYTR = ipl(ipl(y1, y3, relYT), ipl(y2, y4, relYT), relXR);
-            double absYBL = ipl(ipl(y1, y3, relYB), ipl(y2, y4, relYB), relXL);
-            double absYBR = ipl(ipl(y1, y3, relYB), ipl(y2, y4, relYB), relXR);
+            double absYTL = ipl(leftYT, rightYT, relXL);
+            double absYTR = ipl(leftYT, rightYT, relXR);
+            double absYBL = ipl(leftYB, rightYB, relXL);
+            double absYBR = ipl(leftYB, rightYB, relXR);
+            
+            if (queue.isQuadCulled(absXTL, absYTL, absXTR, absYTR,
+                    absXBL, absYBL, absXBR, absYBR))
+                continue;
 
-            Color absCTL = ipl(ipl(c1, c3, relYT), ipl(c2, c4, relYT), relXL);
-            Color absCTR = ipl(ipl(c1, c3, relYT), ipl(c2, c4, relYT), relXR);
-            Color absCBL = ipl(ipl(c1, c3, relYB), ipl(c2, c4, relYB), relXL);
-            Color absCBR = ipl(ipl(c1, c3, relYB), ipl(c2, c4, relYB), relXR);
+            Color absCTL = c1, absCTR = c1, absCBL = c1, absCBR = c1;
+            if (!uniform)
+            {
+                absCTL = ipl(leftCT, rightCT, weightsX[px]);
+                absCTR = ipl(leftCT, rightCT, weightsX[px + 1]);
+                absCBL = ipl(leftCB, rightCB, weightsX[px]);
+                absCBR = ipl(leftCB, rightCB, weightsX[px + 1]);
+            }
+            
+            unsigned index = py * partsX + px;
+            if (streamed)
+            {
+                if (!parts[index])
+                    createPart(px, py, source, 0, 0);
+                lastVisible[index] = graphics.frameNumber();
+            }
 
-            part.draw(absXTL, absYTL, absCTL, absXTR, absYTR, absCTR,
+            parts[index]->draw(absXTL, absYTL, absCTL, absXTR, absYTR, absCTR,
                 absXBL, absYBL, absCBL, absXBR, absYBR, absCBR, z, mode);
         }
+    }
+    
+    if (streamed)
+        releaseInvisibleParts();
 }
 
 Gosu::Bitmap Gosu::LargeImageData::toBitmap() const
 {
+    if (streamed)
+        return source;
+    
     Bitmap bitmap(width(), height());
     for (int x = 0; x < partsX; ++x)
         for (int y = 0; y < partsY; ++y)
@@ -128,7 +239,20 @@ Gosu::Bitmap Gosu::LargeImageData::toBitmap() const
 
 void Gosu::LargeImageData::insert(const Bitmap& bitmap, int atX, int atY)
 {
+    if (streamed)
+        source.insert(bitmap, atX, atY);
+    
     for (int x = 0; x < partsX; ++x)
         for (int y = 0; y < partsY; ++y)
-            parts[y * partsX + x]->insert(bitmap, atX - x * partWidth, atY - y * partHeight);
+            if (parts[y * partsX + x])
+                parts[y * partsX + x]->insert(bitmap, atX - x * partWidth, atY - y * partHeight);
+}
+
+bool Gosu::LargeImageData::ready() const
+{
+    // Streamed parts that have not been created yet do not count.
+    for (unsigned i = 0; i < parts.size(); ++i)
+        if (parts[i] && !parts[i]->ready())
+            return false;
+    return true;
 }
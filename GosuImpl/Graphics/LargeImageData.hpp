@@ -2,19 +2,48 @@
 #define GOSUIMPL_LARGEIMAGEDATA_HPP
 
 #include <Gosu/Fwd.hpp>
+#include <Gosu/Bitmap.hpp>
 #include <Gosu/ImageData.hpp>
 #include <Gosu/TR1.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/MemoryStatistics.hpp>
 #include <vector>
 
 namespace Gosu
 {
     class LargeImageData : public ImageData
     {
+        Graphics& graphics;
+        DrawOpQueueStack& queues;
         unsigned fullWidth, fullHeight, partsX, partsY, partWidth, partHeight;
-        std::vector<std::tr1::shared_ptr<ImageData> > parts;
+        unsigned borderFlags;
+        mutable std::vector<std::tr1::shared_ptr<ImageData> > parts;
+        // Edges of the parts relative to the full size, from 0 to 1, and
+        // as weights for colors (see draw). partsX + 1 and partsY + 1 each.
+        std::vector<double> edgesX, edgesY;
+        std::vector<unsigned> weightsX, weightsY;
+        // Pixels of the parts that currently exist.
+        mutable MemoryCount partMemory;
+        
+        // Only used for streamed images (see bfStreamed): The pixels that
+        // parts are created from, and the frame in which each part was last
+        // visible.
+        bool streamed;
+        Bitmap source;
+        mutable std::vector<unsigned long> lastVisible;
+        MemoryCount sourceMemory;
+        
+        void partSize(unsigned px, unsigned py, unsigned& width, unsigned& height) const;
+        // Creates a part from pixels whose top left corner is at (srcX;
+        // srcY) of the given bitmap.
+        void createPart(unsigned px, unsigned py, const Bitmap& pixels,
+            unsigned srcX, unsigned srcY) const;
+        void releaseInvisibleParts() const;
 
     public:
-        LargeImageData(Graphics& graphics, const Bitmap& source,
+        // Creates the parts straight from the given area of source.
+        LargeImageData(Graphics& graphics, DrawOpQueueStack& queues, const Bitmap& source,
+            unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
             unsigned partWidth, unsigned partHeight, unsigned borderFlags);
 
         int width() const;
@@ -33,6 +62,7 @@ namespace Gosu
         
         Bitmap toBitmap() const;
         void insert(const Bitmap& bitmap, int x, int y);
+        bool ready() const;
     };
 }
 
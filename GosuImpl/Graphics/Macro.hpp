@@ -3,20 +3,185 @@
 
 #include <Gosu/Fwd.hpp>
 #include <Gosu/ImageData.hpp>
+#include <Gosu/IO.hpp>
+#include <Gosu/Math.hpp>
+#include <Gosu/RenderTarget.hpp>
 #include <Gosu/TR1.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
 #include <GosuImpl/Graphics/DrawOpQueue.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <GosuImpl/MemoryStatistics.hpp>
+#include <climits>
 #include <cmath>
 #include <algorithm>
 #include <memory>
 #include <stdexcept>
 
+// Saved macros (see Atlas::saveMacro) start with a header, followed by one
+// record per vertex array and the vertices of all arrays. All numbers are
+// unsigned 32-bit little-endian integers.
+//   Header:   "GosuMcro", width, height, number of vertex arrays
+//   Records:  index of the atlas page the array is drawn from plus one, or 0
+//             if it is untextured, alpha mode, number of vertices
+//   Vertices: laid out like ArrayVertex, x, y, u and v as little-endian
+//             32-bit floats and the color as RGBA bytes, so that they can be
+//             uploaded into the buffer object as they are
+
 class Gosu::Macro : public Gosu::ImageData
 {
     typedef double Float;
+    typedef std::tr1::uint32_t UInt32;
+    
+    enum { MAGIC_SIZE = 8, HEADER_SIZE = 20, RECORD_SIZE = 12, VERTEX_SIZE = 20 };
+    static const char* magic()
+    {
+        return "GosuMcro";
+    }
+    
+    // Everything that is recorded. Shared with the scheduled draw calls, so
+    // that a macro can be freed, or be recorded into another one, while it
+    // still has to be drawn.
+    struct Contents
+    {
+        VertexArrays vertexArrays;
+        // The render states in vertexArrays do not own their textures.
+        DrawOpQueue::Textures textures;
+        DrawOpQueue::Programs programs;
+        DrawOpQueue::CompiledBlocks blocks;
+        int w, h;
+        
+        // If supported, all vertex arrays are uploaded into one static buffer
+        // object once. vertexArrays is kept around as a fallback.
+        GLuint buffer;
+        // Index of the first vertex of each VertexArray in the buffer.
+        std::vector<GLint> firstVertices;
+        
+        // Runs of consecutive quads of one VertexArray that lie close
+        // together, so that drawing a large macro can skip the parts that
+        // are off the screen. Quads are not reordered, since those of one
+        // render state may overlap.
+        enum { CHUNK_VERTICES = 1024, CHUNK_EXTENT = 512 };
+        struct Chunk
+        {
+            GLint first;
+            GLsizei count;
+            Float left, top, right, bottom;
+            
+            bool overlaps(Float l, Float t, Float r, Float b) const
+            {
+                return left <= r && right >= l && top <= b && bottom >= t;
+            }
+        };
+        std::vector<Chunk> chunks;
+        // Index of the first chunk of each VertexArray, and the end of the
+        // last one.
+        std::vector<std::size_t> firstChunks;
+        
+        // Reused between calls to avoid reallocating.
+        std::vector<ArrayVertex> tintedVertices;
+        
+        MemoryCount memory;
+        
+        Contents()
+        : buffer(0), memory(mcMacros)
+        {
+        }
+        
+        ~Contents()
+        {
+            #ifndef GOSU_IS_IPHONE
+            if (buffer)
+                glBufferFunctions().deleteBuffers(1, &buffer);
+            #endif
+        }
+        
+        void uploadVertexArrays()
+        {
+            #ifndef GOSU_IS_IPHONE
+            if (!glBufferFunctions().available || vertexArrays.empty())
+                return;
+            
+            std::vector<ArrayVertex> allVertices;
+            for (VertexArrays::const_iterator it = vertexArrays.begin(), end = vertexArrays.end(); it != end; ++it)
+                allVertices.insert(allVertices.end(), it->vertices.begin(), it->vertices.end());
+            uploadVertexArrays(allVertices.empty() ? 0 : &allVertices[0]);
+            #endif
+        }
+        
+        // Like uploadVertexArrays(), for when the vertices of all arrays are
+        // already next to each other.
+        void uploadVertexArrays(const ArrayVertex* allVertices)
+        {
+            #ifndef GOSU_IS_IPHONE
+            const GLBufferFunctions& gl = glBufferFunctions();
+            if (!gl.available || vertexArrays.empty())
+                return;
+            
+            GLint count = 0;
+            for (VertexArrays::const_iterator it = vertexArrays.begin(), end = vertexArrays.end(); it != end; ++it)
+            {
+                firstVertices.push_back(count);
+                count += it->vertices.size();
+            }
+            
+            gl.genBuffers(1, &buffer);
+            gl.bindBuffer(GL_ARRAY_BUFFER, buffer);
+            gl.bufferData(GL_ARRAY_BUFFER, count * sizeof(ArrayVertex),
+                allVertices, GL_STATIC_DRAW);
+            gl.bindBuffer(GL_ARRAY_BUFFER, 0);
+            #endif
+        }
+        
+        void buildChunks()
+        {
+            for (VertexArrays::const_iterator it = vertexArrays.begin(), end = vertexArrays.end(); it != end; ++it)
+            {
+                firstChunks.push_back(chunks.size());
+                const std::vector<ArrayVertex>& vertices = it->vertices;
+                for (std::size_t i = 0; i + 4 <= vertices.size(); i += 4)
+                {
+                    Float left = vertices[i].x, right = left;
+                    Float top = vertices[i].y, bottom = top;
+                    for (std::size_t j = i + 1; j < i + 4; ++j)
+                    {
+                        left = std::min<Float>(left, vertices[j].x);
+                        right = std::max<Float>(right, vertices[j].x);
+                        top = std::min<Float>(top, vertices[j].y);
+                        bottom = std::max<Float>(bottom, vertices[j].y);
+                    }
+                    
+                    if (chunks.size() > firstChunks.back())
+                    {
+                        Chunk& chunk = chunks.back();
+                        Float l = std::min(chunk.left, left), r = std::max(chunk.right, right);
+                        Float t = std::min(chunk.top, top), b = std::max(chunk.bottom, bottom);
+                        if (chunk.count < CHUNK_VERTICES && r - l <= CHUNK_EXTENT && b - t <= CHUNK_EXTENT)
+                        {
+                            chunk.count += 4;
+                            chunk.left = l, chunk.right = r, chunk.top = t, chunk.bottom = b;
+                            continue;
+                        }
+                    }
+                    Chunk chunk = { static_cast<GLint>(i), 4, left, top, right, bottom };
+                    chunks.push_back(chunk);
+                }
+            }
+            firstChunks.push_back(chunks.size());
+        }
+        
+        // The vertices, twice if they are in a buffer object as well.
+        void countMemory()
+        {
+            unsigned long bytes = 0;
+            for (VertexArrays::const_iterator it = vertexArrays.begin(), end = vertexArrays.end(); it != end; ++it)
+                bytes += it->vertices.size() * sizeof(ArrayVertex);
+            memory.set((buffer ? 2 * bytes : bytes) + chunks.size() * sizeof(Chunk));
+        }
+    };
     
     Graphics& graphics;
-    VertexArrays vertexArrays;
+    DrawOpQueueStack& queues;
+    std::tr1::shared_ptr<Contents> contents;
     int w, h;
     
     Transform findTransformForTarget(Float x1, Float y1, Float x2, Float y2, Float x3, Float y3, Float x4, Float y4) const
@@ -163,36 +328,333 @@ class Gosu::Macro : public Gosu::ImageData
         return result;
     }
     
-    void drawVertexArrays(Float x1, Float y1, Float x2, Float y2, Float x3, Float y3, Float x4, Float y4) const
+    // Arguments of one Macro::draw call, scheduled as a GL block.
+    struct DrawCall
+    {
+        std::tr1::shared_ptr<Contents> contents;
+        Transform transform;
+        Color c1, c2, c3, c4;
+        // What can be seen of the coordinates passed to Macro::draw, if
+        // culling is on (see DrawOpQueue::visibleArea).
+        bool culling;
+        double visibleLeft, visibleTop, visibleRight, visibleBottom;
+        
+        void operator()() const
+        {
+            drawVertexArrays(*contents, *this);
+        }
+    };
+    
+    // Bounding box of the visible part of the macro in its own coordinates.
+    // Returns false if all of it has to be drawn.
+    static bool visibleArea(const DrawCall& call, Float& left, Float& top,
+        Float& right, Float& bottom)
+    {
+        const Transform& t = call.transform;
+        double det = t[0] * t[5] - t[1] * t[4];
+        if (!call.culling || !isAffine(t) || det == 0)
+            return false;
+        
+        double xs[4] = { call.visibleLeft, call.visibleRight, call.visibleLeft, call.visibleRight };
+        double ys[4] = { call.visibleTop, call.visibleTop, call.visibleBottom, call.visibleBottom };
+        for (int i = 0; i < 4; ++i)
+        {
+            double dx = xs[i] - t[12], dy = ys[i] - t[13];
+            double x = (dx * t[5] - dy * t[4]) / det;
+            double y = (dy * t[0] - dx * t[1]) / det;
+            if (i == 0)
+                left = right = x, top = bottom = y;
+            else
+            {
+                left = std::min<Float>(left, x), right = std::max<Float>(right, x);
+                top = std::min<Float>(top, y), bottom = std::max<Float>(bottom, y);
+            }
+        }
+        return true;
+    }
+    
+    // Multiplies the recorded vertex colors with the four corner colors,
+    // interpolated across the macro's area.
+    static const std::vector<ArrayVertex>& tint(Contents& contents,
+        const std::vector<ArrayVertex>& vertices, GLint first, GLsizei count,
+        const DrawCall& call)
+    {
+        bool uniform = call.c1 == call.c2 && call.c1 == call.c3 && call.c1 == call.c4;
+        int w = contents.w, h = contents.h;
+        
+        std::vector<ArrayVertex>& tintedVertices = contents.tintedVertices;
+        tintedVertices.assign(vertices.begin() + first, vertices.begin() + first + count);
+        for (std::vector<ArrayVertex>::iterator it = tintedVertices.begin(),
+                end = tintedVertices.end(); it != end; ++it)
+        {
+            Color tint = call.c1;
+            if (!uniform)
+            {
+                double u = w ? clamp<double>(it->x / w, 0, 1) : 0;
+                double v = h ? clamp<double>(it->y / h, 0, 1) : 0;
+                tint = interpolate(interpolate(call.c1, call.c2, u),
+                    interpolate(call.c3, call.c4, u), v);
+            }
+            it->c = multiply(it->c, tint);
+        }
+        return tintedVertices;
+    }
+    
+    static void runBlock(const DrawOpQueue::CompiledBlock& block)
+    {
+        #ifndef GOSU_IS_IPHONE
+        glPushMatrix();
+        glMultMatrixd(&block.transform[0]);
+        block.code();
+        ++frameStatistics.glBlocks;
+        glMatrixMode(GL_MODELVIEW);
+        glPopMatrix();
+        #endif
+    }
+    
+    // Runs the recorded GL blocks that come before the vertex array with
+    // the given index, inside of the macro's transform.
+    static void runBlocks(const Contents& contents, std::size_t& nextBlock, std::size_t arrayIndex,
+        bool usingBuffer)
     {
-        // TODO: Macros should not be split up just because they have different transforms! This is insane.
-        // They should be premultiplied and have the same transform by definition. Then, the transformation
-        // only had to be performed here once.
+        #ifndef GOSU_IS_IPHONE
+        bool ran = false;
+        for (; nextBlock < contents.blocks.size() &&
+                contents.blocks[nextBlock].arrayIndex == arrayIndex; ++nextBlock)
+        {
+            if (!ran && usingBuffer)
+                glBufferFunctions().bindBuffer(GL_ARRAY_BUFFER, 0);
+            ran = true;
+            runBlock(contents.blocks[nextBlock]);
+        }
+        if (!ran)
+            return;
         
+        // The render states are applied again for each vertex array anyway.
+        glEnable(GL_BLEND);
+        if (usingBuffer)
+        {
+            glBufferFunctions().bindBuffer(GL_ARRAY_BUFFER, contents.buffer);
+            setVertexPointers(0);
+        }
+        #endif
+    }
+    
+    static void drawVertexArrays(Contents& contents, const DrawCall& call)
+    {
         #ifndef GOSU_IS_IPHONE
         glEnable(GL_BLEND);
         glMatrixMode(GL_MODELVIEW);
         
-        Transform transform =
-            findTransformForTarget(x1, y1, x2, y2, x3, y3, x4, y4);
+        // All render states of a macro share the same transform.
+        glPushMatrix();
+        glMultMatrixd(&call.transform[0]);
         
-        for (VertexArrays::const_iterator it = vertexArrays.begin(), end = vertexArrays.end(); it != end; ++it)
+        bool tinted = call.c1 != Color::WHITE || call.c2 != Color::WHITE ||
+            call.c3 != Color::WHITE || call.c4 != Color::WHITE;
+        // Tinted vertices cannot come from the static buffer, but everything
+        // is still drawn with one call per run of visible chunks.
+        bool usingBuffer = contents.buffer && !tinted;
+        if (usingBuffer)
+        {
+            glBufferFunctions().bindBuffer(GL_ARRAY_BUFFER, contents.buffer);
+            setVertexPointers(0);
+        }
+        
+        Float left, top, right, bottom;
+        bool culling = visibleArea(call, left, top, right, bottom);
+        const VertexArrays& vertexArrays = contents.vertexArrays;
+        const std::vector<Contents::Chunk>& chunks = contents.chunks;
+        std::size_t index = 0, nextBlock = 0;
+        
+        for (VertexArrays::const_iterator it = vertexArrays.begin(), end = vertexArrays.end(); it != end; ++it, ++index)
         {
-            glPushMatrix();
-            it->renderState.apply();
-            glMultMatrixd(&transform[0]);
-            glInterleavedArrays(GL_T2F_C4UB_V3F, 0, &it->vertices[0]);
-            glDrawArrays(GL_QUADS, 0, it->vertices.size());
-            glPopMatrix();
+            runBlocks(contents, nextBlock, index, usingBuffer);
+            
+            bool applied = false;
+            std::size_t chunk = contents.firstChunks[index], lastChunk = contents.firstChunks[index + 1];
+            while (chunk < lastChunk)
+            {
+                if (culling && !chunks[chunk].overlaps(left, top, right, bottom))
+                {
+                    ++chunk;
+                    continue;
+                }
+                
+                // Chunks that are visible one after another are drawn at once.
+                GLint first = chunks[chunk].first;
+                GLsizei count = 0;
+                for (; chunk < lastChunk && (!culling ||
+                        chunks[chunk].overlaps(left, top, right, bottom)); ++chunk)
+                    count += chunks[chunk].count;
+                
+                if (!applied)
+                    it->renderState.apply(), applied = true;
+                if (tinted)
+                {
+                    setVertexPointers(&tint(contents, it->vertices, first, count, call)[0]);
+                    glDrawArrays(GL_QUADS, 0, count);
+                }
+                else if (usingBuffer)
+                    glDrawArrays(GL_QUADS, contents.firstVertices[index] + first, count);
+                else
+                {
+                    setVertexPointers(&it->vertices[0]);
+                    glDrawArrays(GL_QUADS, first, count);
+                }
+                ++frameStatistics.batches;
+                frameStatistics.vertices += count;
+            }
         }
+        if (usingBuffer)
+            glBufferFunctions().bindBuffer(GL_ARRAY_BUFFER, 0);
+        
+        // Blocks recorded after the last vertex array. The buffer, if any,
+        // is not bound anymore.
+        for (; nextBlock < contents.blocks.size(); ++nextBlock)
+            runBlock(contents.blocks[nextBlock]);
+        
+        if (!contents.programs.empty())
+            ShaderProgram::use(0);
+        glPopMatrix();
         #endif
     }
     
 public:
-    Macro(Graphics& graphics, DrawOpQueue& queue, int width, int height)
-    : graphics(graphics), w(width), h(height)
+    // Compiles what was drawn into queues.back().
+    Macro(Graphics& graphics, DrawOpQueueStack& queues, int width, int height)
+    : graphics(graphics), queues(queues), contents(new Contents), w(width), h(height)
     {
-        queue.compileTo(vertexArrays);
+        DrawOpQueue& queue = queues.back();
+        queue.compileTo(contents->vertexArrays, contents->blocks);
+        contents->textures = queue.retainedTextures();
+        contents->programs = queue.retainedPrograms();
+        contents->w = width;
+        contents->h = height;
+        contents->uploadVertexArrays();
+        contents->buildChunks();
+        contents->countMemory();
+    }
+    
+    // Loads a macro that was saved with the given atlas pages, see save.
+    Macro(Graphics& graphics, DrawOpQueueStack& queues, Reader reader, std::size_t size,
+        const DrawOpQueue::Textures& pages)
+    : graphics(graphics), queues(queues), contents(new Contents), w(0), h(0)
+    {
+        if (sizeof(ArrayVertex) != VERTEX_SIZE)
+            throw std::logic_error("Macros cannot be loaded on this platform");
+        
+        std::size_t limit = reader.position() + size;
+        char header[MAGIC_SIZE];
+        if (size < HEADER_SIZE)
+            throw std::runtime_error("Invalid saved macro");
+        reader.read(header, MAGIC_SIZE);
+        if (!std::equal(header, header + MAGIC_SIZE, magic()))
+            throw std::runtime_error("Invalid saved macro");
+        
+        UInt32 width = reader.getPod<UInt32>(boLittle);
+        UInt32 height = reader.getPod<UInt32>(boLittle);
+        UInt32 arrayCount = reader.getPod<UInt32>(boLittle);
+        if (width > INT_MAX || height > INT_MAX ||
+                arrayCount > (limit - reader.position()) / RECORD_SIZE)
+            throw std::runtime_error("Invalid saved macro");
+        
+        std::size_t vertexCount = 0;
+        for (UInt32 i = 0; i < arrayCount; ++i)
+        {
+            UInt32 page = reader.getPod<UInt32>(boLittle);
+            UInt32 mode = reader.getPod<UInt32>(boLittle);
+            UInt32 count = reader.getPod<UInt32>(boLittle);
+            std::size_t room = (limit - reader.position()) / VERTEX_SIZE;
+            if (page > pages.size() || mode > amMultiply || count % 4 != 0 ||
+                    vertexCount > room || count > room - vertexCount)
+                throw std::runtime_error("Invalid saved macro");
+            
+            contents->vertexArrays.push_back(VertexArray());
+            VertexArray& va = contents->vertexArrays.back();
+            va.renderState.texture = page ? pages[page - 1].get() : 0;
+            va.renderState.mode = static_cast<AlphaMode>(mode);
+            va.vertices.resize(count);
+            vertexCount += count;
+        }
+        if (vertexCount > (limit - reader.position()) / VERTEX_SIZE)
+            throw std::runtime_error("Invalid saved macro");
+        
+        // The vertices are uploaded straight from the file where possible.
+        std::vector<ArrayVertex> copy;
+        const ArrayVertex* allVertices =
+            static_cast<const ArrayVertex*>(reader.view(vertexCount * VERTEX_SIZE));
+        if (!allVertices || nativeByteOrder != boLittle)
+        {
+            copy.resize(vertexCount);
+            if (vertexCount > 0)
+                reader.read(&copy[0], vertexCount * VERTEX_SIZE);
+            if (nativeByteOrder != boLittle)
+                for (std::size_t i = 0; i < vertexCount; ++i)
+                    swapByteOrder(&copy[i].x, sizeof(GLfloat), 4);
+            allVertices = copy.empty() ? 0 : &copy[0];
+        }
+        
+        const ArrayVertex* next = allVertices;
+        for (VertexArrays::iterator it = contents->vertexArrays.begin(),
+                end = contents->vertexArrays.end(); it != end; ++it)
+        {
+            std::copy(next, next + it->vertices.size(), it->vertices.begin());
+            next += it->vertices.size();
+        }
+        
+        contents->textures = pages;
+        contents->w = w = width;
+        contents->h = h = height;
+        contents->uploadVertexArrays(allVertices);
+        contents->buildChunks();
+        contents->countMemory();
+    }
+    
+    // Writes the macro in the format described at the top of this file.
+    // Throws if it uses textures other than the given ones, shaders, or
+    // custom OpenGL code, none of which can be saved.
+    void save(Writer& writer, const DrawOpQueue::Textures& pages) const
+    {
+        if (!contents->blocks.empty() || !contents->programs.empty())
+            throw std::invalid_argument("Macros with custom OpenGL code or shaders cannot be saved");
+        
+        const VertexArrays& vertexArrays = contents->vertexArrays;
+        writer.write(magic(), MAGIC_SIZE);
+        writer.writePod<UInt32>(w, boLittle);
+        writer.writePod<UInt32>(h, boLittle);
+        writer.writePod<UInt32>(vertexArrays.size(), boLittle);
+        for (VertexArrays::const_iterator it = vertexArrays.begin(), end = vertexArrays.end(); it != end; ++it)
+        {
+            UInt32 page = 0;
+            if (Texture* texture = it->renderState.texture)
+            {
+                while (page < pages.size() && pages[page].get() != texture)
+                    ++page;
+                if (page == pages.size())
+                    throw std::invalid_argument("Macro uses images that are not from this atlas");
+                ++page;
+            }
+            writer.writePod<UInt32>(page, boLittle);
+            writer.writePod<UInt32>(it->renderState.mode, boLittle);
+            writer.writePod<UInt32>(it->vertices.size(), boLittle);
+        }
+        
+        for (VertexArrays::const_iterator it = vertexArrays.begin(), end = vertexArrays.end(); it != end; ++it)
+        {
+            if (nativeByteOrder == boLittle)
+            {
+                if (!it->vertices.empty())
+                    writer.write(&it->vertices[0], it->vertices.size() * VERTEX_SIZE);
+                continue;
+            }
+            for (std::size_t i = 0; i < it->vertices.size(); ++i)
+            {
+                ArrayVertex vertex = it->vertices[i];
+                swapByteOrder(&vertex.x, sizeof(GLfloat), 4);
+                writer.write(&vertex, VERTEX_SIZE);
+            }
+        }
     }
     
     int width() const
@@ -211,10 +673,22 @@ public:
         double x4, double y4, Color c4,
         ZPos z, AlphaMode mode) const
     {
-        if (c1 != 0xffffffff || c2 != 0xffffffff || c3 != 0xffffffff || c4 != 0xffffffff)
-            throw std::invalid_argument("Macros cannot be tinted with colors yet");
-        std::tr1::function<void()> f = std::tr1::bind(&Macro::drawVertexArrays, this, x1, y1, x2, y2, x3, y3, x4, y4);
-        graphics.scheduleGL(f, z);
+        DrawCall call = { contents, findTransformForTarget(x1, y1, x2, y2, x3, y3, x4, y4),
+            c1, c2, c3, c4 };
+        call.culling = queues.back().visibleArea(call.visibleLeft, call.visibleTop,
+            call.visibleRight, call.visibleBottom);
+        #ifdef GOSU_IS_IPHONE
+        throw std::logic_error("Custom OpenGL is unsupported on the iPhone");
+        #else
+        if (threadQueue)
+            throw std::logic_error("Drawing a macro is not allowed while drawing into a thread queue");
+        // Scheduled directly rather than through Graphics::scheduleGL, so
+        // that the call is not wrapped into a std::tr1::function, which
+        // would allocate. Only recorded GL blocks can change more than the
+        // render states.
+        queues.back().scheduleGL(call, z, contents->blocks.empty() ?
+            gsTexture | gsBlending | gsProgram : gsAll);
+        #endif
     }
     
     const Gosu::GLTexInfo* glTexInfo() const
@@ -222,9 +696,18 @@ public:
         return 0;
     }
     
+    // Rendered through a render target, so this needs framebuffer objects.
     Gosu::Bitmap toBitmap() const
     {
-        throw std::logic_error("Gosu::Macro cannot be rendered as Gosu::Bitmap yet");
+        if (w <= 0 || h <= 0)
+            return Bitmap();
+        
+        RenderTarget target(graphics, w, h);
+        target.begin();
+        draw(0, 0, Color::WHITE, w, 0, Color::WHITE, 0, h, Color::WHITE, w, h, Color::WHITE,
+            0, amDefault);
+        target.end();
+        return target.image().getData().toBitmap();
     }
     
     void insert(const Bitmap& bitmap, int x, int y)
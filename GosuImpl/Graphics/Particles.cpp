@@ -0,0 +1,187 @@
+#include <Gosu/Particles.hpp>
+#include <Gosu/Image.hpp>
+#include <Gosu/ImageData.hpp>
+#include <Gosu/Math.hpp>
+#include <algorithm>
+#include <vector>
+
+Gosu::ParticleSettings::ParticleSettings()
+: rate(10), minLifetime(1), maxLifetime(1), direction(0), spread(0),
+  minSpeed(50), maxSpeed(50), accelerationX(0), accelerationY(0),
+  minSpin(0), maxSpin(0), startScale(1), endScale(1),
+  startColor(Color::WHITE), endColor(Color::NONE)
+{
+}
+
+struct Gosu::ParticleEmitter::Impl
+{
+    Image image;
+    ParticleSettings settings;
+    unsigned maxParticles;
+    double x, y;
+    // Fraction of a particle that is due to be emitted.
+    double pendingEmission;
+    
+    // One entry per particle in each array, so that update() runs through
+    // memory linearly and can be vectorized by the compiler.
+    std::vector<double> posX, posY, velX, velY, angle, spin, age, invLifetime;
+    
+    // Scratch space for draw().
+    mutable std::vector<ImageInstance> instances;
+    
+    explicit Impl(const Image& image)
+    : image(image)
+    {
+    }
+    
+    unsigned count() const
+    {
+        return posX.size();
+    }
+    
+    void spawn(unsigned number)
+    {
+        number = std::min(number, maxParticles - std::min(maxParticles, count()));
+        for (unsigned i = 0; i < number; ++i)
+        {
+            double direction = settings.direction +
+                random(-settings.spread, settings.spread);
+            double speed = random(settings.minSpeed, settings.maxSpeed);
+            double lifetime = random(settings.minLifetime, settings.maxLifetime);
+            
+            posX.push_back(x);
+            posY.push_back(y);
+            double velocityX, velocityY;
+            offsetXY(direction, speed, velocityX, velocityY);
+            velX.push_back(velocityX);
+            velY.push_back(velocityY);
+            angle.push_back(direction);
+            spin.push_back(random(settings.minSpin, settings.maxSpin));
+            age.push_back(0);
+            invLifetime.push_back(lifetime > 0 ? 1 / lifetime : 1e10);
+        }
+    }
+    
+    void removeDead()
+    {
+        // Move the last living particle into each gap; order does not matter.
+        unsigned n = count();
+        for (unsigned i = 0; i < n; )
+        {
+            if (age[i] * invLifetime[i] < 1)
+            {
+                ++i;
+                continue;
+            }
+            --n;
+            posX[i] = posX[n], posY[i] = posY[n];
+            velX[i] = velX[n], velY[i] = velY[n];
+            angle[i] = angle[n], spin[i] = spin[n];
+            age[i] = age[n], invLifetime[i] = invLifetime[n];
+        }
+        posX.resize(n), posY.resize(n), velX.resize(n), velY.resize(n);
+        angle.resize(n), spin.resize(n), age.resize(n), invLifetime.resize(n);
+    }
+};
+
+Gosu::ParticleEmitter::ParticleEmitter(const Image& image,
+    const ParticleSettings& settings, unsigned maxParticles)
+: pimpl(new Impl(image))
+{
+    pimpl->settings = settings;
+    pimpl->maxParticles = maxParticles;
+    pimpl->x = pimpl->y = 0;
+    pimpl->pendingEmission = 0;
+}
+
+Gosu::ParticleEmitter::~ParticleEmitter()
+{
+}
+
+const Gosu::ParticleSettings& Gosu::ParticleEmitter::settings() const
+{
+    return pimpl->settings;
+}
+
+void Gosu::ParticleEmitter::setSettings(const ParticleSettings& settings)
+{
+    pimpl->settings = settings;
+}
+
+double Gosu::ParticleEmitter::x() const
+{
+    return pimpl->x;
+}
+
+double Gosu::ParticleEmitter::y() const
+{
+    return pimpl->y;
+}
+
+void Gosu::ParticleEmitter::setPosition(double x, double y)
+{
+    pimpl->x = x;
+    pimpl->y = y;
+}
+
+unsigned Gosu::ParticleEmitter::particles() const
+{
+    return pimpl->count();
+}
+
+void Gosu::ParticleEmitter::emit(unsigned count)
+{
+    pimpl->spawn(count);
+}
+
+void Gosu::ParticleEmitter::update(double seconds)
+{
+    Impl& p = *pimpl;
+    unsigned n = p.count();
+    
+    double accelX = p.settings.accelerationX * seconds;
+    double accelY = p.settings.accelerationY * seconds;
+    for (unsigned i = 0; i < n; ++i)
+    {
+        p.velX[i] += accelX;
+        p.velY[i] += accelY;
+    }
+    for (unsigned i = 0; i < n; ++i)
+    {
+        p.posX[i] += p.velX[i] * seconds;
+        p.posY[i] += p.velY[i] * seconds;
+    }
+    for (unsigned i = 0; i < n; ++i)
+    {
+        p.angle[i] += p.spin[i] * seconds;
+        p.age[i] += seconds;
+    }
+    p.removeDead();
+    
+    p.pendingEmission += p.settings.rate * seconds;
+    unsigned due = static_cast<unsigned>(p.pendingEmission);
+    p.pendingEmission -= due;
+    p.spawn(due);
+}
+
+void Gosu::ParticleEmitter::draw(ZPos z, AlphaMode mode) const
+{
+    const Impl& p = *pimpl;
+    unsigned n = p.count();
+    if (n == 0)
+        return;
+    
+    const ParticleSettings& s = p.settings;
+    p.instances.resize(n);
+    for (unsigned i = 0; i < n; ++i)
+    {
+        double t = std::min(p.age[i] * p.invLifetime[i], 1.0);
+        ImageInstance& instance = p.instances[i];
+        instance.x = p.posX[i];
+        instance.y = p.posY[i];
+        instance.scale = s.startScale + (s.endScale - s.startScale) * t;
+        instance.angle = p.angle[i];
+        instance.color = interpolate(s.startColor, s.endColor, t);
+    }
+    p.image.drawMany(p.instances, z, mode);
+}
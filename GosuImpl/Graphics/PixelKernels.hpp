@@ -0,0 +1,626 @@
+#ifndef GOSUIMPL_GRAPHICS_PIXELKERNELS_HPP
+#define GOSUIMPL_GRAPHICS_PIXELKERNELS_HPP
+
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/Color.hpp>
+#include <Gosu/Platform.hpp>
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+
+// Loops over the pixels of whole bitmaps that run while images are loaded or
+// text is rendered. Each has vector versions for SSE2 and NEON (see
+// Common.hpp), which handle four pixels at a time and leave the rest to the
+// scalar version. They assume that alpha is the highest byte of a pixel,
+// hence only on little-endian machines.
+
+#if defined(GOSU_IS_LITTLE_ENDIAN) && defined(GOSU_USE_SSE2)
+#define GOSUIMPL_PIXELS_SSE2
+#elif defined(GOSU_IS_LITTLE_ENDIAN) && defined(GOSU_USE_NEON)
+#define GOSUIMPL_PIXELS_NEON
+#endif
+
+namespace Gosu
+{
+    namespace Pixels
+    {
+        typedef std::tr1::uint32_t Pixel;
+
+        inline Pixel toPixel(Color c)
+        {
+            Pixel result;
+            std::memcpy(&result, &c, sizeof result);
+            return result;
+        }
+
+        // x / 255 for x up to 255 * 255, truncated or rounded, without a
+        // division.
+        inline unsigned divide255(unsigned x)
+        {
+            return (x + 1 + (x >> 8)) >> 8;
+        }
+
+        inline unsigned divide255Rounded(unsigned x)
+        {
+            x += 128;
+            return (x + (x >> 8)) >> 8;
+        }
+
+        // Exchanges the red and blue channels while copying pixels, e.g.
+        // from a decoder's buffer. in may be the same as out.
+        inline void swapRedAndBlue(Color* out, const Color* in, std::size_t count)
+        {
+            const Pixel* p = reinterpret_cast<const Pixel*>(in);
+            Pixel* o = reinterpret_cast<Pixel*>(out);
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            const __m128i keep = _mm_set1_epi32(0xff00ff00);
+            const __m128i high = _mm_set1_epi32(0x00ff0000);
+            const __m128i low = _mm_set1_epi32(0x000000ff);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                v = _mm_or_si128(_mm_and_si128(v, keep),
+                    _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 16), high),
+                                 _mm_and_si128(_mm_srli_epi32(v, 16), low)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(o + i), v);
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            const uint32x4_t keep = vdupq_n_u32(0xff00ff00);
+            const uint32x4_t high = vdupq_n_u32(0x00ff0000);
+            const uint32x4_t low = vdupq_n_u32(0x000000ff);
+            for (; i + 4 <= count; i += 4)
+            {
+                uint32x4_t v = vld1q_u32(p + i);
+                v = vorrq_u32(vandq_u32(v, keep),
+                    vorrq_u32(vandq_u32(vshlq_n_u32(v, 16), high),
+                              vandq_u32(vshrq_n_u32(v, 16), low)));
+                vst1q_u32(o + i, v);
+            }
+        #endif
+            for (; i < count; ++i)
+                o[i] = (p[i] & 0xff00ff00) | ((p[i] << 16) & 0x00ff0000) | ((p[i] >> 16) & 0x000000ff);
+        }
+
+        // Exchanges the red and blue channels.
+        inline void swapRedAndBlue(Color* pixels, std::size_t count)
+        {
+            swapRedAndBlue(pixels, pixels, count);
+        }
+
+        // Replaces fully transparent pixels by key and makes all others
+        // opaque (see unapplyColorKey).
+        inline void unapplyColorKey(Color* pixels, std::size_t count, Color key)
+        {
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2) || defined(GOSUIMPL_PIXELS_NEON)
+            Pixel* p = reinterpret_cast<Pixel*>(pixels);
+        #endif
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            const __m128i alpha = _mm_set1_epi32(0xff000000);
+            const __m128i keyValue = _mm_set1_epi32(toPixel(key));
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(v, alpha), _mm_setzero_si128());
+                v = _mm_or_si128(_mm_and_si128(transparent, keyValue),
+                    _mm_andnot_si128(transparent, _mm_or_si128(v, alpha)));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), v);
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            const uint32x4_t alpha = vdupq_n_u32(0xff000000);
+            const uint32x4_t keyValue = vdupq_n_u32(toPixel(key));
+            for (; i + 4 <= count; i += 4)
+            {
+                uint32x4_t v = vld1q_u32(p + i);
+                uint32x4_t transparent = vceqq_u32(vandq_u32(v, alpha), vdupq_n_u32(0));
+                vst1q_u32(p + i, vbslq_u32(transparent, keyValue, vorrq_u32(v, alpha)));
+            }
+        #endif
+            for (; i < count; ++i)
+                if (pixels[i].alpha() == 0)
+                    pixels[i] = key;
+                else
+                    pixels[i].setAlpha(255);
+        }
+
+        // Multiplies the alpha channel of every pixel by alpha / 255,
+        // rounding down.
+        inline void multiplyAlpha(Color* pixels, std::size_t count, Color::Channel alpha)
+        {
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2) || defined(GOSUIMPL_PIXELS_NEON)
+            Pixel* p = reinterpret_cast<Pixel*>(pixels);
+        #endif
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            const __m128i colors = _mm_set1_epi32(0x00ffffff);
+            const __m128i factor = _mm_set1_epi32(alpha);
+            const __m128i one = _mm_set1_epi32(1);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                // The products fit into the lower 16 bits of each pixel.
+                __m128i x = _mm_mullo_epi16(_mm_srli_epi32(v, 24), factor);
+                x = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(x, one), _mm_srli_epi32(x, 8)), 8);
+                v = _mm_or_si128(_mm_and_si128(v, colors), _mm_slli_epi32(x, 24));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), v);
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            const uint32x4_t colors = vdupq_n_u32(0x00ffffff);
+            const uint32x4_t one = vdupq_n_u32(1);
+            for (; i + 4 <= count; i += 4)
+            {
+                uint32x4_t v = vld1q_u32(p + i);
+                uint32x4_t x = vmulq_n_u32(vshrq_n_u32(v, 24), alpha);
+                x = vshrq_n_u32(vaddq_u32(vaddq_u32(x, one), vshrq_n_u32(x, 8)), 8);
+                vst1q_u32(p + i, vorrq_u32(vandq_u32(v, colors), vshlq_n_u32(x, 24)));
+            }
+        #endif
+            for (; i < count; ++i)
+                pixels[i].setAlpha(divide255(pixels[i].alpha() * alpha));
+        }
+
+        // Multiplies the color channels by alpha / 255, rounded, for
+        // Graphics::setPremultipliedAlpha.
+        inline Color premultiply(Color c)
+        {
+            return Color(c.alpha(), divide255Rounded(c.red() * c.alpha()),
+                divide255Rounded(c.green() * c.alpha()), divide255Rounded(c.blue() * c.alpha()));
+        }
+
+        inline void premultiply(Color* pixels, std::size_t count)
+        {
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            Pixel* p = reinterpret_cast<Pixel*>(pixels);
+            const __m128i alphaMask = _mm_set1_epi32(0xff000000);
+            const __m128i half = _mm_set1_epi16(128);
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                // Two pixels per register, as eight 16-bit channels.
+                __m128i lo = _mm_unpacklo_epi8(v, zero), hi = _mm_unpackhi_epi8(v, zero);
+                __m128i loAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+                __m128i hiAlpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+                lo = _mm_add_epi16(_mm_mullo_epi16(lo, loAlpha), half);
+                hi = _mm_add_epi16(_mm_mullo_epi16(hi, hiAlpha), half);
+                lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+                hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+                __m128i result = _mm_packus_epi16(lo, hi);
+                result = _mm_or_si128(_mm_andnot_si128(alphaMask, result), _mm_and_si128(alphaMask, v));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), result);
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            unsigned char* bytes = reinterpret_cast<unsigned char*>(pixels);
+            for (; i + 8 <= count; i += 8)
+            {
+                uint8x8x4_t v = vld4_u8(bytes + i * 4);
+                for (int channel = 0; channel < 3; ++channel)
+                {
+                    uint16x8_t x = vmull_u8(v.val[channel], v.val[3]);
+                    v.val[channel] = vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+                }
+                vst4_u8(bytes + i * 4, v);
+            }
+        #endif
+            for (; i < count; ++i)
+                pixels[i] = premultiply(pixels[i]);
+        }
+
+        // The reverse, for reading textures back. Only runs when images are
+        // copied to main memory, and has no vector version.
+        inline void unpremultiply(Color* pixels, std::size_t count)
+        {
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                unsigned alpha = pixels[i].alpha();
+                if (alpha == 0)
+                    pixels[i] = Color::NONE;
+                else if (alpha < 255)
+                    pixels[i] = Color(alpha,
+                        std::min(255u, (pixels[i].red() * 255 + alpha / 2) / alpha),
+                        std::min(255u, (pixels[i].green() * 255 + alpha / 2) / alpha),
+                        std::min(255u, (pixels[i].blue() * 255 + alpha / 2) / alpha));
+            }
+        }
+
+        // Writes c with its alpha multiplied by each coverage value / 255,
+        // rounded, like multiply(c, Color(coverage, 255, 255, 255)).
+        inline void colorByCoverage(Color* out, const unsigned char* coverage,
+            std::size_t count, Color c)
+        {
+            Color rgb = c;
+            rgb.setAlpha(0);
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            Pixel* p = reinterpret_cast<Pixel*>(out);
+            const __m128i colors = _mm_set1_epi32(toPixel(rgb));
+            const __m128i factor = _mm_set1_epi32(c.alpha());
+            const __m128i half = _mm_set1_epi32(128);
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 4 <= count; i += 4)
+            {
+                int bytes;
+                std::memcpy(&bytes, coverage + i, sizeof bytes);
+                __m128i x = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+                x = _mm_add_epi32(_mm_mullo_epi16(x, factor), half);
+                x = _mm_srli_epi32(_mm_add_epi32(x, _mm_srli_epi32(x, 8)), 8);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i),
+                    _mm_or_si128(colors, _mm_slli_epi32(x, 24)));
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            Pixel* p = reinterpret_cast<Pixel*>(out);
+            const uint32x4_t colors = vdupq_n_u32(toPixel(rgb));
+            const uint32x4_t half = vdupq_n_u32(128);
+            for (; i + 4 <= count; i += 4)
+            {
+                uint32x4_t x = { coverage[i], coverage[i + 1], coverage[i + 2], coverage[i + 3] };
+                x = vaddq_u32(vmulq_n_u32(x, c.alpha()), half);
+                x = vshrq_n_u32(vaddq_u32(x, vshrq_n_u32(x, 8)), 8);
+                vst1q_u32(p + i, vorrq_u32(colors, vshlq_n_u32(x, 24)));
+            }
+        #endif
+            for (; i < count; ++i)
+            {
+                out[i] = rgb;
+                out[i].setAlpha(divide255Rounded(c.alpha() * coverage[i]));
+            }
+        }
+
+        // Blends a and b with weight / 256 of b, rounded, for the batch
+        // version of Gosu::interpolate. Any of the arrays may be the same.
+        inline void interpolate(Color* out, const Color* a, const Color* b,
+            std::size_t count, unsigned weight)
+        {
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            const Pixel* pa = reinterpret_cast<const Pixel*>(a);
+            const Pixel* pb = reinterpret_cast<const Pixel*>(b);
+            Pixel* p = reinterpret_cast<Pixel*>(out);
+            const __m128i weightA = _mm_set1_epi16(256 - weight);
+            const __m128i weightB = _mm_set1_epi16(weight);
+            const __m128i half = _mm_set1_epi16(128);
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + i));
+                __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + i));
+                // At most 255 * 256 + 128, so the sums fit into 16 bits.
+                __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), weightA),
+                    _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), weightB));
+                __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), weightA),
+                    _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), weightB));
+                lo = _mm_srli_epi16(_mm_add_epi16(lo, half), 8);
+                hi = _mm_srli_epi16(_mm_add_epi16(hi, half), 8);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), _mm_packus_epi16(lo, hi));
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            const unsigned char* ba = reinterpret_cast<const unsigned char*>(a);
+            const unsigned char* bb = reinterpret_cast<const unsigned char*>(b);
+            unsigned char* bytes = reinterpret_cast<unsigned char*>(out);
+            for (; i + 4 <= count; i += 4)
+            {
+                uint8x16_t va = vld1q_u8(ba + i * 4), vb = vld1q_u8(bb + i * 4);
+                uint16x8_t lo = vmlaq_n_u16(vmulq_n_u16(vmovl_u8(vget_low_u8(va)), 256 - weight),
+                    vmovl_u8(vget_low_u8(vb)), weight);
+                uint16x8_t hi = vmlaq_n_u16(vmulq_n_u16(vmovl_u8(vget_high_u8(va)), 256 - weight),
+                    vmovl_u8(vget_high_u8(vb)), weight);
+                vst1q_u8(bytes + i * 4, vcombine_u8(vrshrn_n_u16(lo, 8), vrshrn_n_u16(hi, 8)));
+            }
+        #endif
+            for (; i < count; ++i)
+                out[i] = Color((a[i].alpha() * (256 - weight) + b[i].alpha() * weight + 128) >> 8,
+                    (a[i].red() * (256 - weight) + b[i].red() * weight + 128) >> 8,
+                    (a[i].green() * (256 - weight) + b[i].green() * weight + 128) >> 8,
+                    (a[i].blue() * (256 - weight) + b[i].blue() * weight + 128) >> 8);
+        }
+
+        // Multiplies the channels of a and b / 255, rounded, like
+        // Gosu::multiply. Any of the arrays may be the same.
+        inline void multiply(Color* out, const Color* a, const Color* b, std::size_t count)
+        {
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            const Pixel* pa = reinterpret_cast<const Pixel*>(a);
+            const Pixel* pb = reinterpret_cast<const Pixel*>(b);
+            Pixel* p = reinterpret_cast<Pixel*>(out);
+            const __m128i half = _mm_set1_epi16(128);
+            const __m128i zero = _mm_setzero_si128();
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + i));
+                __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + i));
+                __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(va, zero),
+                    _mm_unpacklo_epi8(vb, zero)), half);
+                __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(va, zero),
+                    _mm_unpackhi_epi8(vb, zero)), half);
+                lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+                hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), _mm_packus_epi16(lo, hi));
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            const unsigned char* ba = reinterpret_cast<const unsigned char*>(a);
+            const unsigned char* bb = reinterpret_cast<const unsigned char*>(b);
+            unsigned char* bytes = reinterpret_cast<unsigned char*>(out);
+            for (; i + 4 <= count; i += 4)
+            {
+                uint8x16_t va = vld1q_u8(ba + i * 4), vb = vld1q_u8(bb + i * 4);
+                uint16x8_t lo = vmull_u8(vget_low_u8(va), vget_low_u8(vb));
+                uint16x8_t hi = vmull_u8(vget_high_u8(va), vget_high_u8(vb));
+                vst1q_u8(bytes + i * 4, vcombine_u8(vrshrn_n_u16(vrsraq_n_u16(lo, lo, 8), 8),
+                    vrshrn_n_u16(vrsraq_n_u16(hi, hi, 8), 8)));
+            }
+        #endif
+            for (; i < count; ++i)
+                out[i] = Color(divide255Rounded(a[i].alpha() * b[i].alpha()),
+                    divide255Rounded(a[i].red() * b[i].red()),
+                    divide255Rounded(a[i].green() * b[i].green()),
+                    divide255Rounded(a[i].blue() * b[i].blue()));
+        }
+
+        // One channel of an HSV color with the hue in sixths of the circle
+        // (0..6), without branching on the sector: n is 5 for red, 3 for
+        // green and 1 for blue. The vector versions below do the same.
+        inline float hsvChannel(float n, float sectors, float s, float v)
+        {
+            float k = n + sectors;
+            if (k >= 6)
+                k -= 6;
+            float c = (v - v * s * std::max(0.f, std::min(std::min(k, 4 - k), 1.f))) * 255;
+            return std::min(std::max(c, 0.f), 255.f);
+        }
+
+        // Converts triples of hue, saturation and value to colors, like
+        // Color::fromAHSV, in floats. Results may be one step lower than
+        // those of fromAHSV.
+        inline void fromHSV(Color* out, const float* hsv, std::size_t count,
+            Color::Channel alpha)
+        {
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            Pixel* p = reinterpret_cast<Pixel*>(out);
+            const __m128 perSector = _mm_set1_ps(1 / 60.f);
+            const __m128 perCircle = _mm_set1_ps(1 / 6.f);
+            const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+            const __m128 four = _mm_set1_ps(4), six = _mm_set1_ps(6);
+            const __m128 max = _mm_set1_ps(255);
+            const __m128i alphas = _mm_set1_epi32(Pixel(alpha) << 24);
+            for (; i + 4 <= count; i += 4)
+            {
+                const float* in = hsv + i * 3;
+                __m128 h = _mm_set_ps(in[9], in[6], in[3], in[0]);
+                __m128 s = _mm_set_ps(in[10], in[7], in[4], in[1]);
+                __m128 v = _mm_set_ps(in[11], in[8], in[5], in[2]);
+                
+                // Normalized to 0..6, with floor() made from truncation.
+                h = _mm_mul_ps(h, perSector);
+                __m128 circles = _mm_mul_ps(h, perCircle);
+                __m128 floor = _mm_cvtepi32_ps(_mm_cvttps_epi32(circles));
+                floor = _mm_sub_ps(floor, _mm_and_ps(_mm_cmpgt_ps(floor, circles), one));
+                h = _mm_sub_ps(h, _mm_mul_ps(floor, six));
+                
+                __m128 vs = _mm_mul_ps(v, s);
+                __m128i result = alphas;
+                for (int channel = 0; channel < 3; ++channel)
+                {
+                    __m128 k = _mm_add_ps(h, _mm_set1_ps(5 - 2 * channel));
+                    k = _mm_sub_ps(k, _mm_and_ps(_mm_cmpge_ps(k, six), six));
+                    __m128 f = _mm_max_ps(zero, _mm_min_ps(_mm_min_ps(k, _mm_sub_ps(four, k)), one));
+                    __m128 c = _mm_mul_ps(_mm_sub_ps(v, _mm_mul_ps(vs, f)), max);
+                    c = _mm_min_ps(_mm_max_ps(c, zero), max);
+                    result = _mm_or_si128(result,
+                        _mm_slli_epi32(_mm_cvttps_epi32(c), 8 * channel));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(p + i), result);
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            Pixel* p = reinterpret_cast<Pixel*>(out);
+            const float32x4_t zero = vdupq_n_f32(0), one = vdupq_n_f32(1);
+            const float32x4_t four = vdupq_n_f32(4), six = vdupq_n_f32(6);
+            const float32x4_t max = vdupq_n_f32(255);
+            const uint32x4_t alphas = vdupq_n_u32(Pixel(alpha) << 24);
+            for (; i + 4 <= count; i += 4)
+            {
+                float32x4x3_t in = vld3q_f32(hsv + i * 3);
+                float32x4_t h = vmulq_n_f32(in.val[0], 1 / 60.f);
+                float32x4_t s = in.val[1], v = in.val[2];
+                
+                float32x4_t circles = vmulq_n_f32(h, 1 / 6.f);
+                float32x4_t floor = vcvtq_f32_s32(vcvtq_s32_f32(circles));
+                floor = vsubq_f32(floor, vreinterpretq_f32_u32(vandq_u32(
+                    vcgtq_f32(floor, circles), vreinterpretq_u32_f32(one))));
+                h = vsubq_f32(h, vmulq_f32(floor, six));
+                
+                float32x4_t vs = vmulq_f32(v, s);
+                uint32x4_t result = alphas;
+                for (int channel = 0; channel < 3; ++channel)
+                {
+                    float32x4_t k = vaddq_f32(h, vdupq_n_f32(5 - 2 * channel));
+                    k = vsubq_f32(k, vreinterpretq_f32_u32(vandq_u32(
+                        vcgeq_f32(k, six), vreinterpretq_u32_f32(six))));
+                    float32x4_t f = vmaxq_f32(zero, vminq_f32(vminq_f32(k, vsubq_f32(four, k)), one));
+                    float32x4_t c = vmulq_f32(vsubq_f32(v, vmulq_f32(vs, f)), max);
+                    c = vminq_f32(vmaxq_f32(c, zero), max);
+                    result = vorrq_u32(result, vshlq_u32(vcvtq_u32_f32(c),
+                        vdupq_n_s32(8 * channel)));
+                }
+                vst1q_u32(p + i, result);
+            }
+        #endif
+            for (; i < count; ++i)
+            {
+                const float* in = hsv + i * 3;
+                float sectors = in[0] * (1 / 60.f);
+                sectors -= std::floor(sectors * (1 / 6.f)) * 6;
+                out[i] = Color(alpha, hsvChannel(5, sectors, in[1], in[2]),
+                    hsvChannel(3, sectors, in[1], in[2]), hsvChannel(1, sectors, in[1], in[2]));
+            }
+        }
+        
+        // Rounds a channel from 0..1 to 0..255. NaN becomes 0, like in the
+        // vector versions below.
+        inline Color::Channel floatChannel(float f)
+        {
+            return static_cast<Color::Channel>((f > 0 ? (f < 1 ? f : 1) : 0) * 255 + 0.5f);
+        }
+        
+        // Converts red, green, blue and alpha floats from 0..1, clamped, to
+        // colors. Works on bytes, so it does not depend on the byte order.
+        inline void fromFloats(Color* out, const float* rgba, std::size_t count)
+        {
+            std::size_t i = 0;
+            Color::Channel* bytes = reinterpret_cast<Color::Channel*>(out);
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+            const __m128 max = _mm_set1_ps(255), half = _mm_set1_ps(0.5f);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i channels[4];
+                for (int j = 0; j < 4; ++j)
+                {
+                    // max returns its second operand for NaN.
+                    __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(rgba + i * 4 + j * 4), zero), one);
+                    channels[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, max), half));
+                }
+                __m128i result = _mm_packus_epi16(_mm_packs_epi32(channels[0], channels[1]),
+                    _mm_packs_epi32(channels[2], channels[3]));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(bytes + i * 4), result);
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            const float32x4_t zero = vdupq_n_f32(0), one = vdupq_n_f32(1);
+            const float32x4_t half = vdupq_n_f32(0.5f);
+            for (; i + 4 <= count; i += 4)
+            {
+                uint16x4_t channels[4];
+                for (int j = 0; j < 4; ++j)
+                {
+                    // The conversion turns NaN into 0.
+                    float32x4_t f = vminq_f32(vmaxq_f32(vld1q_f32(rgba + i * 4 + j * 4), zero), one);
+                    channels[j] = vmovn_u32(vcvtq_u32_f32(vmlaq_n_f32(half, f, 255)));
+                }
+                vst1q_u8(bytes + i * 4, vcombine_u8(
+                    vmovn_u16(vcombine_u16(channels[0], channels[1])),
+                    vmovn_u16(vcombine_u16(channels[2], channels[3]))));
+            }
+        #endif
+            for (i *= 4; i < count * 4; ++i)
+                bytes[i] = floatChannel(rgba[i]);
+        }
+        
+    #if defined(GOSUIMPL_PIXELS_SSE2)
+        // Narrows 32-bit values of up to 0xffff to 16 bits and stores them.
+        // SSE2 can only pack with signed saturation, hence the offset.
+        inline void store16(std::tr1::uint16_t* out, __m128i x)
+        {
+            const __m128i offset = _mm_set1_epi32(0x8000);
+            x = _mm_packs_epi32(_mm_sub_epi32(x, offset), _mm_setzero_si128());
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(out),
+                _mm_add_epi16(x, _mm_set1_epi16(-0x8000)));
+        }
+    #endif
+        
+        // Conversions for textures in the reduced formats of Texture, which
+        // keep the upper bits of each channel. The 16-bit formats have red
+        // in their highest bits, as GL_UNSIGNED_SHORT_4_4_4_4 and 5_6_5.
+        inline void toRGBA4444(std::tr1::uint16_t* out, const Color* in, std::size_t count)
+        {
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            const Pixel* p = reinterpret_cast<const Pixel*>(in);
+            const __m128i red = _mm_set1_epi32(0xf000), green = _mm_set1_epi32(0x0f00);
+            const __m128i blue = _mm_set1_epi32(0x00f0);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                store16(out + i, _mm_or_si128(
+                    _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 8), red),
+                                 _mm_and_si128(_mm_srli_epi32(v, 4), green)),
+                    _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), blue),
+                                 _mm_srli_epi32(v, 28))));
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+            const uint8x8_t high = vdup_n_u8(0xf0);
+            for (; i + 8 <= count; i += 8)
+            {
+                uint8x8x4_t v = vld4_u8(bytes + i * 4);
+                uint8x8x2_t result;
+                result.val[0] = vorr_u8(vand_u8(v.val[2], high), vshr_n_u8(v.val[3], 4));
+                result.val[1] = vorr_u8(vand_u8(v.val[0], high), vshr_n_u8(v.val[1], 4));
+                vst2_u8(reinterpret_cast<unsigned char*>(out + i), result);
+            }
+        #endif
+            for (; i < count; ++i)
+                out[i] = static_cast<std::tr1::uint16_t>((in[i].red() >> 4) << 12 |
+                    (in[i].green() >> 4) << 8 | (in[i].blue() >> 4) << 4 | in[i].alpha() >> 4);
+        }
+        
+        inline void toRGB565(std::tr1::uint16_t* out, const Color* in, std::size_t count)
+        {
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            const Pixel* p = reinterpret_cast<const Pixel*>(in);
+            const __m128i red = _mm_set1_epi32(0xf800), green = _mm_set1_epi32(0x07e0);
+            const __m128i blue = _mm_set1_epi32(0x001f);
+            for (; i + 4 <= count; i += 4)
+            {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                store16(out + i, _mm_or_si128(
+                    _mm_or_si128(_mm_and_si128(_mm_slli_epi32(v, 8), red),
+                                 _mm_and_si128(_mm_srli_epi32(v, 5), green)),
+                    _mm_and_si128(_mm_srli_epi32(v, 19), blue)));
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+            for (; i + 8 <= count; i += 8)
+            {
+                uint8x8x4_t v = vld4_u8(bytes + i * 4);
+                uint8x8x2_t result;
+                result.val[0] = vorr_u8(vand_u8(vshl_n_u8(v.val[1], 3), vdup_n_u8(0xe0)),
+                    vshr_n_u8(v.val[2], 3));
+                result.val[1] = vorr_u8(vand_u8(v.val[0], vdup_n_u8(0xf8)),
+                    vshr_n_u8(v.val[1], 5));
+                vst2_u8(reinterpret_cast<unsigned char*>(out + i), result);
+            }
+        #endif
+            for (; i < count; ++i)
+                out[i] = static_cast<std::tr1::uint16_t>((in[i].red() >> 3) << 11 |
+                    (in[i].green() >> 2) << 5 | in[i].blue() >> 3);
+        }
+        
+        inline void toAlpha8(unsigned char* out, const Color* in, std::size_t count)
+        {
+            std::size_t i = 0;
+        #if defined(GOSUIMPL_PIXELS_SSE2)
+            const Pixel* p = reinterpret_cast<const Pixel*>(in);
+            for (; i + 16 <= count; i += 16)
+            {
+                __m128i v[4];
+                for (int j = 0; j < 4; ++j)
+                    v[j] = _mm_srli_epi32(_mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(p + i + j * 4)), 24);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(
+                    _mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3])));
+            }
+        #elif defined(GOSUIMPL_PIXELS_NEON)
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(in);
+            for (; i + 8 <= count; i += 8)
+                vst1_u8(out + i, vld4_u8(bytes + i * 4).val[3]);
+        #endif
+            for (; i < count; ++i)
+                out[i] = in[i].alpha();
+        }
+    }
+    
+    inline void multiplyBitmapAlpha(Bitmap& bmp, Color::Channel alpha)
+    {
+        if (bmp.width() * bmp.height() > 0)
+            Pixels::multiplyAlpha(bmp.data(), bmp.width() * bmp.height(), alpha);
+    }
+}
+
+#endif
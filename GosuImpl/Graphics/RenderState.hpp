@@ -3,26 +3,63 @@
 
 #include <GosuImpl/Graphics/Common.hpp>
 #include <GosuImpl/Graphics/Texture.hpp>
+#include <GosuImpl/Graphics/ShaderProgram.hpp>
+#include <cmath>
+#include <functional>
 
 // Properties that potentially need to be changed between each draw operation.
 // This does not include the color or vertex data of the actual quads.
 struct Gosu::RenderState
 {
-    std::tr1::shared_ptr<Texture> texture;
+    // Not owned. DrawOpQueue and Macro keep the textures alive instead, so that
+    // copying render states does not touch any reference counts.
+    Texture* texture;
     const Transform* transform;
     ClipRect clipRect;
     AlphaMode mode;
+    // Not owned either; 0 means fixed-function.
+    ShaderProgram* program;
     
     RenderState()
-    : transform(0), mode(amDefault)
+    : texture(0), transform(0), mode(amDefault), program(0)
     {
         clipRect.width = NO_CLIPPING;
     }
     
+    // Atlas pages on the same texture array count as the same texture, so
+    // that ops on them end up in the same batch.
+    GLuint textureName() const
+    {
+        return texture ? texture->texName() : 0;
+    }
+    
+    // Texture arrays cannot be drawn without a shader; unless there is one
+    // already, they bring their own.
+    ShaderProgram* effectiveProgram() const
+    {
+        if (program || !texture || !texture->isLayer())
+            return program;
+        return TextureArray::program();
+    }
+    
     bool operator==(const RenderState& rhs) const
     {
-        return texture == rhs.texture && transform == rhs.transform &&
-            clipRect == rhs.clipRect && mode == rhs.mode;
+        return textureName() == rhs.textureName() && transform == rhs.transform &&
+            clipRect == rhs.clipRect && mode == rhs.mode && program == rhs.program;
+    }
+    
+    // Arbitrary order that puts equal render states next to each other.
+    bool operator<(const RenderState& rhs) const
+    {
+        if (textureName() != rhs.textureName())
+            return textureName() < rhs.textureName();
+        if (transform != rhs.transform)
+            return std::less<const Transform*>()(transform, rhs.transform);
+        if (mode != rhs.mode)
+            return mode < rhs.mode;
+        if (program != rhs.program)
+            return std::less<ShaderProgram*>()(program, rhs.program);
+        return clipRect < rhs.clipRect;
     }
     
     void applyTexture() const
@@ -30,7 +67,7 @@ struct Gosu::RenderState
         if (texture)
         {
             glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, texture->texName());
+            glBindTexture(texture->target(), texture->texName());
         }
         else
             glDisable(GL_TEXTURE_2D);
@@ -38,7 +75,16 @@ struct Gosu::RenderState
     
     void applyAlphaMode() const
     {
-        if (mode == amAdd)
+        // Additive ops never reach this with premultiplied alpha, see
+        // DrawOpQueue::premultiply.
+        if (premultipliedAlpha)
+        {
+            if (mode == amMultiply)
+                glBlendFunc(GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA);
+            else
+                glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        }
+        else if (mode == amAdd)
             glBlendFunc(GL_SRC_ALPHA, GL_ONE);
         else if (mode == amMultiply)
             glBlendFunc(GL_DST_COLOR, GL_ZERO);
@@ -46,6 +92,11 @@ struct Gosu::RenderState
             glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
     
+    void applyProgram() const
+    {
+        ShaderProgram::use(effectiveProgram());
+    }
+    
     void applyClipRect() const
     {
         if (clipRect.width == NO_CLIPPING)
@@ -64,6 +115,7 @@ struct Gosu::RenderState
         applyTexture();
         // TODO: No inner clipRect yet - how would this work?!
         applyAlphaMode();
+        applyProgram();
     }
     #endif
 };
@@ -76,24 +128,42 @@ class Gosu::RenderStateManager : private Gosu::RenderState
     RenderStateManager(const RenderStateManager&);
     RenderStateManager& operator=(const RenderStateManager&);
     
+    // Clip rects are in screen pixels, which are this many pixels of the
+    // framebuffer (see ResolutionScaler).
+    double scissorScale;
+    
+    void applyScissor() const
+    {
+        if (scissorScale == 1)
+            glScissor(clipRect.x, clipRect.y, clipRect.width, clipRect.height);
+        else
+        {
+            GLint left = std::floor(clipRect.x * scissorScale);
+            GLint bottom = std::floor(clipRect.y * scissorScale);
+            GLint right = std::ceil((clipRect.x + clipRect.width) * scissorScale);
+            GLint top = std::ceil((clipRect.y + clipRect.height) * scissorScale);
+            glScissor(left, bottom, right - left, top - bottom);
+        }
+    }
+    
     void applyTransform() const
     {
         glMatrixMode(GL_MODELVIEW);
-        glLoadIdentity();
         
         #ifndef GOSU_IS_IPHONE
-        glMultMatrixd(&(*transform)[0]);
+        glLoadMatrixd(&(*transform)[0]);
         #else
         // TODO: Ouch, should always use floats!
         GLfloat matrix[16];
         for (int i = 0; i < 16; ++i)
             matrix[i] = (*transform)[i];
-        glMultMatrixf(matrix);
+        glLoadMatrixf(matrix);
         #endif
     }
     
 public:
-    RenderStateManager()
+    explicit RenderStateManager(double scissorScale = 1)
+    : scissorScale(scissorScale)
     {
         applyAlphaMode();
         // Preserve previous MV matrix
@@ -106,7 +176,8 @@ public:
         ClipRect noClipping;
         noClipping.width = NO_CLIPPING;
         setClipRect(noClipping);
-        setTexture(std::tr1::shared_ptr<Texture>());
+        setTexture(0);
+        setProgram(0);
         // Return to previous MV matrix
         glMatrixMode(GL_MODELVIEW);
         glPopMatrix();
@@ -118,12 +189,20 @@ public:
         setTransform(rs.transform);
         setClipRect(rs.clipRect);
         setAlphaMode(rs.mode);
+        setProgram(rs.effectiveProgram());
     }
     
-    void setTexture(std::tr1::shared_ptr<Texture> newTexture)
+    void setTexture(Texture* newTexture)
     {
         if (newTexture == texture)
             return;
+        
+        // Another page of the same texture array.
+        if (newTexture && texture && newTexture->texName() == texture->texName())
+        {
+            texture = newTexture;
+            return;
+        }
     
         if (newTexture)
         {
@@ -131,7 +210,8 @@ public:
             
             if (!texture)
                 glEnable(GL_TEXTURE_2D);
-            glBindTexture(GL_TEXTURE_2D, newTexture->texName());
+            glBindTexture(newTexture->target(), newTexture->texName());
+            ++frameStatistics.textureBinds;
         }
         else
             // New texture is NO_TEXTURE, disable texturing.
@@ -145,6 +225,7 @@ public:
             return;
         transform = newTransform;
         applyTransform();
+        ++frameStatistics.transformChanges;
     }
 
     void setClipRect(const ClipRect& newClipRect)
@@ -156,6 +237,7 @@ public:
             {
                 glDisable(GL_SCISSOR_TEST);
                 clipRect.width = NO_CLIPPING;
+                ++frameStatistics.clipChanges;
             }
         }
         else
@@ -165,13 +247,15 @@ public:
             {
                 glEnable(GL_SCISSOR_TEST);
                 clipRect = newClipRect;
-                glScissor(clipRect.x, clipRect.y, clipRect.width, clipRect.height);
+                applyScissor();
+                ++frameStatistics.clipChanges;
             }
             // Adjust clipping if necessary
             else if (!(clipRect == newClipRect))
             {
                 clipRect = newClipRect;
-                glScissor(clipRect.x, clipRect.y, clipRect.width, clipRect.height);
+                applyScissor();
+                ++frameStatistics.clipChanges;
             }
         }
     }
@@ -182,18 +266,45 @@ public:
             return;
         mode = newMode;
         applyAlphaMode();
+        ++frameStatistics.blendChanges;
     }
     
-    // The cached values may have been messed with. Reset them again.
-    void enforceAfterUntrustedGL() const
+    void setProgram(ShaderProgram* newProgram)
+    {
+        if (newProgram == program)
+            return;
+        program = newProgram;
+        applyProgram();
+    }
+    
+    // The cached values may have been messed with. Reset those that the
+    // code declared to change (see GLStateFlags) again.
+    void enforceAfterUntrustedGL(unsigned modifiedState = gsAll) const
     {
         // TODO: Actually, we don't have to worry about anything pushed
         // using glPushAttribs because beginGL/endGL will take care of that.
         
-        applyTexture();
-        applyTransform();
-        applyClipRect();
-        applyAlphaMode();
+        if (modifiedState & gsTexture)
+            applyTexture();
+        if (modifiedState & gsTransform)
+            applyTransform();
+        if (modifiedState & gsClipping)
+        {
+            if (clipRect.width == NO_CLIPPING)
+                glDisable(GL_SCISSOR_TEST);
+            else
+            {
+                glEnable(GL_SCISSOR_TEST);
+                applyScissor();
+            }
+        }
+        if (modifiedState & gsBlending)
+        {
+            glEnable(GL_BLEND);
+            applyAlphaMode();
+        }
+        if (modifiedState & gsProgram)
+            applyProgram();
     }
 };
 
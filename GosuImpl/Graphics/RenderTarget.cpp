@@ -0,0 +1,114 @@
+#include <Gosu/RenderTarget.hpp>
+#include <Gosu/Graphics.hpp>
+#include <Gosu/ImageData.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <stdexcept>
+
+struct Gosu::RenderTarget::Impl
+{
+    Graphics* graphics;
+    unsigned width, height;
+    GLuint framebuffer;
+    std::auto_ptr<Image> image;
+    bool dirty, rendering;
+    Color clearColor;
+
+    // Restores whatever framebuffer was bound before, which is not 0 on iOS.
+    class Binding
+    {
+        GLint previous;
+
+    public:
+        explicit Binding(GLuint framebuffer)
+        {
+            glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+            glFramebufferFunctions().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        }
+
+        ~Binding()
+        {
+            glFramebufferFunctions().bindFramebuffer(GL_FRAMEBUFFER, previous);
+        }
+    };
+};
+
+Gosu::RenderTarget::RenderTarget(Graphics& graphics, unsigned width, unsigned height)
+: pimpl(new Impl)
+{
+    const GLFramebufferFunctions& fbo = glFramebufferFunctions();
+    if (!fbo.available)
+        throw std::runtime_error("Render targets are not supported by the graphics driver");
+
+    pimpl->graphics = &graphics;
+    pimpl->width = width;
+    pimpl->height = height;
+    pimpl->dirty = true;
+    pimpl->rendering = false;
+    pimpl->image.reset(new Image(graphics.createRenderTexture(width, height)));
+
+    fbo.genFramebuffers(1, &pimpl->framebuffer);
+    GLenum status;
+    {
+        Impl::Binding binding(pimpl->framebuffer);
+        fbo.framebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+            pimpl->image->getData().glTexInfo()->texName, 0);
+        status = fbo.checkFramebufferStatus(GL_FRAMEBUFFER);
+    }
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fbo.deleteFramebuffers(1, &pimpl->framebuffer);
+        throw std::runtime_error("Could not create render target");
+    }
+}
+
+Gosu::RenderTarget::~RenderTarget()
+{
+    glFramebufferFunctions().deleteFramebuffers(1, &pimpl->framebuffer);
+}
+
+unsigned Gosu::RenderTarget::width() const
+{
+    return pimpl->width;
+}
+
+unsigned Gosu::RenderTarget::height() const
+{
+    return pimpl->height;
+}
+
+bool Gosu::RenderTarget::dirty() const
+{
+    return pimpl->dirty;
+}
+
+void Gosu::RenderTarget::markDirty()
+{
+    pimpl->dirty = true;
+}
+
+void Gosu::RenderTarget::begin(Color clearWithColor)
+{
+    if (pimpl->rendering)
+        throw std::logic_error("Render target is already being rendered");
+
+    pimpl->graphics->beginRenderTarget(pimpl->width, pimpl->height);
+    pimpl->rendering = true;
+    pimpl->clearColor = clearWithColor;
+}
+
+void Gosu::RenderTarget::end()
+{
+    if (!pimpl->rendering)
+        throw std::logic_error("Render target has not been begun");
+
+    pimpl->rendering = false;
+    Impl::Binding binding(pimpl->framebuffer);
+    pimpl->graphics->endRenderTarget(pimpl->width, pimpl->height, pimpl->clearColor);
+    pimpl->dirty = false;
+}
+
+const Gosu::Image& Gosu::RenderTarget::image() const
+{
+    return *pimpl->image;
+}
@@ -0,0 +1,147 @@
+#ifndef GOSUIMPL_GRAPHICS_RENDERTHREAD_HPP
+#define GOSUIMPL_GRAPHICS_RENDERTHREAD_HPP
+
+#include <Gosu/Color.hpp>
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/DrawOpQueue.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// Renders and presents one queue at a time on a thread of its own, with an
+// OpenGL context that shares its objects with the one of the main thread.
+// Only one frame is in flight at a time; handing off the next one waits for
+// the last one to be presented.
+class Gosu::RenderThread
+{
+    // Not copyable
+    RenderThread(const RenderThread&);
+    RenderThread& operator=(const RenderThread&);
+
+public:
+    typedef std::tr1::function<void()> Callback;
+
+private:
+    Callback makeCurrent, present, release;
+    Semaphore frameQueued, frameDone;
+
+    // Only used by the thread between frameQueued and frameDone.
+    DrawOpQueue* queue;
+    Color clearColor;
+    GLFence fence;
+    RendererStatistics statistics;
+    std::string error;
+
+    bool busy, quitting;
+    // Last member, so that the thread is joined before anything else goes.
+    std::auto_ptr<Thread> thread;
+
+    void run()
+    {
+        makeCurrent();
+        while (true)
+        {
+            frameQueued.wait();
+            if (quitting)
+                break;
+            try
+            {
+                renderFrame();
+            }
+            catch (const std::exception& e)
+            {
+                error = e.what();
+            }
+            frameDone.post();
+        }
+        release();
+    }
+
+    void renderFrame()
+    {
+        frameStatistics = RendererStatistics();
+
+        // Textures uploaded by the main thread must be complete first.
+        if (fence)
+        {
+            const GLSyncFunctions& sync = glSyncFunctions();
+            sync.clientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            sync.deleteSync(fence);
+        }
+
+        glClearColor(clearColor.red() / 255.f, clearColor.green() / 255.f,
+            clearColor.blue() / 255.f, clearColor.alpha() / 255.f);
+        glClear(GL_COLOR_BUFFER_BIT);
+        queue->performDrawOpsAndCode();
+        present();
+
+        statistics = frameStatistics;
+    }
+
+public:
+    // All callbacks are called on the new thread.
+    RenderThread(const Callback& makeCurrent, const Callback& present,
+        const Callback& release)
+    : makeCurrent(makeCurrent), present(present), release(release),
+      queue(0), fence(0), statistics(), busy(false), quitting(false)
+    {
+        thread.reset(new Thread(std::tr1::bind(&RenderThread::run, this)));
+    }
+
+    ~RenderThread()
+    {
+        if (busy)
+            frameDone.wait();
+        quitting = true;
+        frameQueued.post();
+        thread.reset();
+    }
+
+    // Waits for the last frame to be presented. Rethrows what went wrong
+    // while rendering it, if anything.
+    void finish()
+    {
+        if (!busy)
+            return;
+        frameDone.wait();
+        busy = false;
+
+        if (!error.empty())
+        {
+            std::string message;
+            message.swap(error);
+            throw std::runtime_error(message);
+        }
+    }
+
+    // What rendering the last finished frame added to frameStatistics.
+    const RendererStatistics& statisticsOfLastFrame() const
+    {
+        return statistics;
+    }
+
+    // The queue must not be touched until finish() has returned.
+    void render(DrawOpQueue& queue, Color clearColor)
+    {
+        finish();
+
+        this->queue = &queue;
+        this->clearColor = clearColor;
+        const GLSyncFunctions& sync = glSyncFunctions();
+        fence = sync.available ? sync.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+        // Without fences, finishing is the only way to be sure.
+        if (fence)
+            glFlush();
+        else
+            glFinish();
+
+        busy = true;
+        frameQueued.post();
+    }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef GOSUIMPL_GRAPHICS_RESOLUTIONSCALER_HPP
+#define GOSUIMPL_GRAPHICS_RESOLUTIONSCALER_HPP
+
+#include <Gosu/Color.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Renders frames into an offscreen texture at a fraction of the screen's
+// resolution, and stretches it over the screen afterwards (see
+// Graphics::setDynamicResolution). The fraction follows the measured frame
+// time. The texture always has the size of the screen, so that changing
+// the fraction only changes the part of it that is used. At full scale, the
+// texture also keeps what is not redrawn between frames, which is what
+// Graphics::setPartialRedraw uses it for. Not used on iOS.
+class Gosu::ResolutionScaler
+{
+    // Not copyable
+    ResolutionScaler(const ResolutionScaler&);
+    ResolutionScaler& operator=(const ResolutionScaler&);
+
+    // Scales are multiples of this, so that tiny changes do not make the
+    // picture flicker.
+    static const unsigned STEPS = 32;
+
+    unsigned screenWidth, screenHeight;
+    GLuint texture, framebuffer;
+    GLint previousFramebuffer;
+    unsigned steps;
+    bool bound;
+
+public:
+    ResolutionScaler(unsigned screenWidth, unsigned screenHeight)
+    : screenWidth(screenWidth), screenHeight(screenHeight), steps(STEPS), bound(false)
+    {
+        const GLFramebufferFunctions& fbo = glFramebufferFunctions();
+
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, screenWidth, screenHeight, 0,
+            GL_RGBA, GL_UNSIGNED_BYTE, 0);
+
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        fbo.genFramebuffers(1, &framebuffer);
+        fbo.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        fbo.framebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        GLenum status = fbo.checkFramebufferStatus(GL_FRAMEBUFFER);
+        fbo.bindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        if (status != GL_FRAMEBUFFER_COMPLETE)
+        {
+            fbo.deleteFramebuffers(1, &framebuffer);
+            glDeleteTextures(1, &texture);
+            throw std::runtime_error("Could not create framebuffer for dynamic resolution");
+        }
+    }
+
+    ~ResolutionScaler()
+    {
+        if (bound)
+            glFramebufferFunctions().bindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        glFramebufferFunctions().deleteFramebuffers(1, &framebuffer);
+        glDeleteTextures(1, &texture);
+    }
+
+    double scale() const
+    {
+        return 1.0 * steps / STEPS;
+    }
+
+    unsigned width() const
+    {
+        return std::max(1u, static_cast<unsigned>(screenWidth * scale() + 0.5));
+    }
+
+    unsigned height() const
+    {
+        return std::max(1u, static_cast<unsigned>(screenHeight * scale() + 0.5));
+    }
+
+    // True between begin and end.
+    bool rendering() const
+    {
+        return bound;
+    }
+
+    // Moves the scale towards one at which a frame would have taken
+    // targetTime. The time to fill the screen grows with its area, i.e. the
+    // square of the scale. At most two steps are taken per frame, and none
+    // if the frame time is within 5% of the target, so that the scale does
+    // not oscillate.
+    void update(double frameTime, double targetTime, double minScale)
+    {
+        unsigned minSteps = std::min<unsigned>(STEPS,
+            std::max(1.0, std::ceil(minScale * STEPS)));
+        steps = std::max(steps, minSteps);
+        if (frameTime > 0 && std::abs(frameTime - targetTime) > targetTime * 0.05)
+        {
+            double ideal = scale() * std::sqrt(targetTime / frameTime) * STEPS;
+            if (ideal < steps)
+                steps -= std::min(steps - minSteps, std::min(2u,
+                    static_cast<unsigned>(std::ceil(steps - ideal))));
+            else
+                steps += std::min(STEPS - steps, std::min(2u,
+                    static_cast<unsigned>(ideal - steps)));
+        }
+    }
+
+    // Redirects drawing into the texture and clears the used part of it, or
+    // only the given region of it (in glScissor's coordinates).
+    void begin(Color clearWithColor, const ClipRect* region = 0)
+    {
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glFramebufferFunctions().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        bound = true;
+        glViewport(0, 0, width(), height());
+        glClearColor(clearWithColor.red() / 255.f, clearWithColor.green() / 255.f,
+            clearWithColor.blue() / 255.f, clearWithColor.alpha() / 255.f);
+        if (region)
+        {
+            glEnable(GL_SCISSOR_TEST);
+            glScissor(region->x, region->y, region->width, region->height);
+        }
+        glClear(GL_COLOR_BUFFER_BIT);
+        if (region)
+            glDisable(GL_SCISSOR_TEST);
+    }
+
+    // Switches back to the screen and stretches the texture over all of it.
+    // Expects the projection that Graphics sets up for the screen.
+    void end()
+    {
+        if (!bound)
+            return;
+        glFramebufferFunctions().bindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        bound = false;
+
+        // The texture's first row is the bottom of the picture.
+        GLfloat right = 1.0f * width() / screenWidth, top = 1.0f * height() / screenHeight;
+        GLfloat w = screenWidth, h = screenHeight;
+        GLfloat vertices[8] = { 0, 0, w, 0, w, h, 0, h };
+        GLfloat texCoords[8] = { 0, top, right, top, right, 0, 0, 0 };
+
+        #ifndef GOSU_IS_IPHONE
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+        glDisable(GL_BLEND);
+        glEnable(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glColor4f(1, 1, 1, 1);
+        glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(2, GL_FLOAT, 0, vertices);
+        glTexCoordPointer(2, GL_FLOAT, 0, texCoords);
+        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+        glPopClientAttrib();
+        glDisable(GL_TEXTURE_2D);
+        glEnable(GL_BLEND);
+        glPopMatrix();
+        ++frameStatistics.batches;
+        #endif
+    }
+};
+
+#endif
@@ -0,0 +1,86 @@
+#ifndef GOSUIMPL_GRAPHICS_SCALEDIMAGE_HPP
+#define GOSUIMPL_GRAPHICS_SCALEDIMAGE_HPP
+
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/ImageData.hpp>
+#include <GosuImpl/Graphics/TexChunk.hpp>
+#include <algorithm>
+#include <memory>
+
+namespace Gosu
+{
+    // An image that is stored at a lower resolution than it is drawn with
+    // (see Graphics::setImageScale). It keeps its original size, so that
+    // games work the same no matter how much of it is stored.
+    class ScaledImage : public ImageData
+    {
+        std::auto_ptr<ImageData> stored;
+        int w, h;
+
+    public:
+        ScaledImage(std::auto_ptr<ImageData> stored, int w, int h)
+        : stored(stored), w(w), h(h)
+        {
+        }
+
+        ImageData& storedData() const { return *stored; }
+
+        int width() const { return w; }
+        int height() const { return h; }
+
+        void draw(double x1, double y1, Color c1,
+            double x2, double y2, Color c2,
+            double x3, double y3, Color c3,
+            double x4, double y4, Color c4,
+            ZPos z, AlphaMode mode) const
+        {
+            stored->draw(x1, y1, c1, x2, y2, c2, x3, y3, c3, x4, y4, c4, z, mode);
+        }
+
+        void drawMany(const ImageInstance* instances, std::size_t count,
+            ZPos z, AlphaMode mode) const
+        {
+            if (const TexChunk* chunk = dynamic_cast<const TexChunk*>(stored.get()))
+                chunk->drawManyParts(*chunk->glTexInfo(), w, h, instances, count, z, mode);
+            else
+                ImageData::drawMany(instances, count, z, mode);
+        }
+
+        // Texture coordinates are relative, so the mesh does not care about
+        // the scale.
+        void drawMesh(const MeshVertex* vertices, std::size_t vertexCount,
+            const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const
+        {
+            stored->drawMesh(vertices, vertexCount, indices, indexCount, z, mode);
+        }
+
+        const GLTexInfo* glTexInfo() const
+        {
+            return stored->glTexInfo();
+        }
+
+        // Scaled back up, so only as sharp as the stored pixels.
+        Bitmap toBitmap() const
+        {
+            Bitmap result;
+            resample(result, stored->toBitmap(), w, h, rfBilinear);
+            return result;
+        }
+
+        void insert(const Bitmap& bitmap, int x, int y)
+        {
+            Bitmap scaled;
+            resample(scaled, bitmap,
+                std::max<int>(1, int(bitmap.width()) * stored->width() / w),
+                std::max<int>(1, int(bitmap.height()) * stored->height() / h));
+            stored->insert(scaled, x * stored->width() / w, y * stored->height() / h);
+        }
+
+        bool ready() const
+        {
+            return stored->ready();
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,206 @@
+#ifndef GOSUIMPL_GRAPHICS_SCREENREADER_HPP
+#define GOSUIMPL_GRAPHICS_SCREENREADER_HPP
+
+#include <Gosu/Async.hpp>
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <GosuImpl/Graphics/PixelKernels.hpp>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+// Reads the screen without waiting for the GPU, for Graphics::saveScreenshot
+// and beginVideoCapture. Each read goes into one of a few pixel buffers and
+// is only mapped once its fence has been signaled (or, without fences, once
+// the other buffers have been used). Whatever is done with the pixels then,
+// e.g. encoding them, happens on a worker thread, one read after another.
+// Without pixel buffer objects, the screen is read right away, and only the
+// rest happens on the worker. Not used on iOS.
+class Gosu::ScreenReader
+{
+    ScreenReader(const ScreenReader&);
+    ScreenReader& operator=(const ScreenReader&);
+
+public:
+    // Called on the worker with the pixels as Graphics::screenshot returns them.
+    typedef std::tr1::function<void(Bitmap&)> Consumer;
+
+private:
+    static const unsigned BUFFERS = 3;
+    // When more reads wait for the worker, reading waits for it, so that
+    // their pixels do not pile up in memory.
+    static const unsigned MAX_QUEUED = 8;
+
+    struct Read
+    {
+        // 0 if the pixels have been read right away.
+        GLuint buffer;
+        GLFence fence;
+        unsigned long frame;
+        std::tr1::shared_ptr<Bitmap> pixels;
+        Consumer consumer;
+        bool premultiplied;
+    };
+
+    unsigned width, height;
+    std::vector<GLuint> buffers, freeBuffers;
+    std::deque<Read> reads;
+    unsigned long frame;
+    AsyncPool worker;
+
+    static void consume(std::tr1::shared_ptr<Bitmap> pixels, Consumer consumer,
+        bool premultiplied)
+    {
+        toScreenshot(*pixels, premultiplied);
+        consumer(*pixels);
+    }
+
+    // Returns false if the read is not complete yet and wait is false.
+    bool complete(Read& read, bool wait)
+    {
+        if (read.buffer)
+        {
+            const GLSyncFunctions& sync = glSyncFunctions();
+            if (read.fence)
+            {
+                GLenum status = wait ?
+                    sync.clientWaitSync(read.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED) :
+                    sync.clientWaitSync(read.fence, 0, 0);
+                if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                    return false;
+                sync.deleteSync(read.fence);
+                read.fence = 0;
+            }
+            else if (!wait && frame < read.frame + BUFFERS - 1)
+                return false;
+
+            const GLBufferFunctions& gl = glBufferFunctions();
+            read.pixels.reset(new Bitmap(width, height));
+            gl.bindBuffer(GL_PIXEL_PACK_BUFFER, read.buffer);
+            if (const void* mapped = gl.mapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY))
+            {
+                std::memcpy(read.pixels->data(), mapped, width * height * sizeof(Color));
+                gl.unmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            gl.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            freeBuffers.push_back(read.buffer);
+        }
+        worker.enqueue(std::tr1::bind(consume, read.pixels, read.consumer, read.premultiplied));
+        return true;
+    }
+
+public:
+    ScreenReader(unsigned width, unsigned height)
+    : width(width), height(height), frame(0), worker(1)
+    {
+        const GLBufferFunctions& gl = glBufferFunctions();
+        if (!gl.pixelBuffers)
+            return;
+
+        buffers.resize(BUFFERS);
+        gl.genBuffers(BUFFERS, &buffers[0]);
+        for (unsigned i = 0; i < BUFFERS; ++i)
+        {
+            gl.bindBuffer(GL_PIXEL_PACK_BUFFER, buffers[i]);
+            gl.bufferData(GL_PIXEL_PACK_BUFFER, width * height * sizeof(Color), 0, GL_STREAM_READ);
+        }
+        gl.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        freeBuffers = buffers;
+    }
+
+    // Waits for all reads, so that no screenshot or frame gets lost.
+    ~ScreenReader()
+    {
+        try
+        {
+            finish();
+        }
+        catch (...)
+        {
+        }
+        if (!buffers.empty())
+            glBufferFunctions().deleteBuffers(BUFFERS, &buffers[0]);
+    }
+
+    // Turns pixels from glReadPixels into what Graphics::screenshot returns:
+    // top row first, and without premultiplied alpha.
+    static void toScreenshot(Bitmap& bitmap, bool premultiplied)
+    {
+        unsigned w = bitmap.width(), h = bitmap.height();
+        // OpenGL stores the bottom row first.
+        for (unsigned y = 0; y < h / 2; ++y)
+            std::swap_ranges(bitmap.data() + y * w, bitmap.data() + (y + 1) * w,
+                bitmap.data() + (h - 1 - y) * w);
+        if (premultiplied)
+            Pixels::unpremultiply(bitmap.data(), w * h);
+    }
+
+    // Starts reading what has been drawn so far.
+    void read(const Consumer& consumer)
+    {
+        // All buffers are in use; the oldest read has to be completed.
+        if (freeBuffers.empty() && !buffers.empty())
+        {
+            complete(reads.front(), true);
+            reads.pop_front();
+        }
+
+        Read read;
+        read.buffer = 0;
+        read.fence = 0;
+        read.frame = frame;
+        read.consumer = consumer;
+        read.premultiplied = premultipliedAlpha;
+        if (!freeBuffers.empty())
+        {
+            read.buffer = freeBuffers.back();
+            freeBuffers.pop_back();
+            const GLBufferFunctions& gl = glBufferFunctions();
+            gl.bindBuffer(GL_PIXEL_PACK_BUFFER, read.buffer);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            gl.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            if (glSyncFunctions().available)
+                read.fence = glSyncFunctions().fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+        else
+        {
+            read.pixels.reset(new Bitmap(width, height));
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, read.pixels->data());
+        }
+        reads.push_back(read);
+    }
+
+    // Called once per frame, after the reads of the frame. Hands the reads
+    // that are complete to the worker, and rethrows what went wrong on it.
+    void update()
+    {
+        ++frame;
+        while (!reads.empty() && complete(reads.front(), false))
+            reads.pop_front();
+        if (worker.pending() > MAX_QUEUED)
+            worker.finish();
+        else
+            worker.deliver();
+    }
+
+    // Completes all reads and waits for the worker.
+    void finish()
+    {
+        while (!reads.empty())
+        {
+            complete(reads.front(), true);
+            reads.pop_front();
+        }
+        worker.finish();
+    }
+
+    bool idle() const
+    {
+        return reads.empty() && worker.pending() == 0;
+    }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#include <Gosu/Shader.hpp>
+#include <GosuImpl/Graphics/ShaderProgram.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+namespace Gosu
+{
+    namespace
+    {
+        // Works with the fixed-function matrix stack, so that transforms
+        // and the projection set up by Graphics apply as usual.
+        const char* DEFAULT_VERTEX_SOURCE =
+            "void main()\n"
+            "{\n"
+            "    gl_Position = ftransform();\n"
+            "    gl_FrontColor = gl_Color;\n"
+            "    gl_TexCoord[0] = gl_MultiTexCoord0;\n"
+            "}\n";
+
+        GLuint compileShader(GLenum type, const std::string& source)
+        {
+            const GLShaderFunctions& gl = glShaderFunctions();
+            GLuint shader = gl.createShader(type);
+            const char* sourcePtr = source.c_str();
+            gl.shaderSource(shader, 1, &sourcePtr, 0);
+            gl.compileShader(shader);
+
+            GLint status, logLength;
+            gl.getShaderiv(shader, GL_COMPILE_STATUS, &status);
+            if (status)
+                return shader;
+
+            gl.getShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+            std::vector<char> log(std::max<GLint>(logLength, 1));
+            gl.getShaderInfoLog(shader, log.size(), 0, &log[0]);
+            gl.deleteShader(shader);
+            throw std::runtime_error("Could not compile " +
+                std::string(type == GL_VERTEX_SHADER ? "vertex" : "fragment") + " shader: " +
+                std::string(&log[0]));
+        }
+
+        // Makes a program current for setting uniforms on it, and restores
+        // the previous one afterwards.
+        class UsingProgram
+        {
+            GLint previous;
+
+        public:
+            explicit UsingProgram(GLuint program)
+            {
+                glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+                glShaderFunctions().useProgram(program);
+            }
+
+            ~UsingProgram()
+            {
+                glShaderFunctions().useProgram(previous);
+            }
+        };
+    }
+}
+
+Gosu::ShaderProgram::ShaderProgram(const std::string& vertexSource,
+    const std::string& fragmentSource)
+{
+    const GLShaderFunctions& gl = glShaderFunctions();
+    if (!gl.available)
+        throw std::runtime_error("Shaders are not supported by the graphics driver");
+
+    GLuint vertexShader = compileShader(GL_VERTEX_SHADER,
+        vertexSource.empty() ? DEFAULT_VERTEX_SOURCE : vertexSource);
+    GLuint fragmentShader;
+    try
+    {
+        fragmentShader = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    }
+    catch (...)
+    {
+        gl.deleteShader(vertexShader);
+        throw;
+    }
+
+    name = gl.createProgram();
+    gl.attachShader(name, vertexShader);
+    gl.attachShader(name, fragmentShader);
+    gl.linkProgram(name);
+    // Only flagged for deletion until the program is deleted.
+    gl.deleteShader(vertexShader);
+    gl.deleteShader(fragmentShader);
+
+    GLint status, logLength;
+    gl.getProgramiv(name, GL_LINK_STATUS, &status);
+    if (!status)
+    {
+        gl.getProgramiv(name, GL_INFO_LOG_LENGTH, &logLength);
+        std::vector<char> log(std::max<GLint>(logLength, 1));
+        gl.getProgramInfoLog(name, log.size(), 0, &log[0]);
+        gl.deleteProgram(name);
+        throw std::runtime_error("Could not link shader: " + std::string(&log[0]));
+    }
+}
+
+Gosu::ShaderProgram::~ShaderProgram()
+{
+    glShaderFunctions().deleteProgram(name);
+}
+
+GLint Gosu::ShaderProgram::uniformLocation(const std::string& uniform) const
+{
+    return glShaderFunctions().getUniformLocation(name, uniform.c_str());
+}
+
+Gosu::Shader::Shader(const std::string& fragmentSource, const std::string& vertexSource)
+: program(new ShaderProgram(vertexSource, fragmentSource))
+{
+}
+
+void Gosu::Shader::setUniform(const std::string& name, float value)
+{
+    GLint location = program->uniformLocation(name);
+    if (location == -1)
+        return;
+    UsingProgram binding(program->glName());
+    glShaderFunctions().uniform1f(location, value);
+}
+
+void Gosu::Shader::setUniform(const std::string& name, float x, float y)
+{
+    GLint location = program->uniformLocation(name);
+    if (location == -1)
+        return;
+    UsingProgram binding(program->glName());
+    glShaderFunctions().uniform2f(location, x, y);
+}
+
+void Gosu::Shader::setUniform(const std::string& name, float x, float y, float z, float w)
+{
+    GLint location = program->uniformLocation(name);
+    if (location == -1)
+        return;
+    UsingProgram binding(program->glName());
+    glShaderFunctions().uniform4f(location, x, y, z, w);
+}
+
+void Gosu::Shader::setUniform(const std::string& name, int value)
+{
+    GLint location = program->uniformLocation(name);
+    if (location == -1)
+        return;
+    UsingProgram binding(program->glName());
+    glShaderFunctions().uniform1i(location, value);
+}
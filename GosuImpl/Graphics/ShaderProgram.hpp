@@ -0,0 +1,39 @@
+#ifndef GOSUIMPL_GRAPHICS_SHADERPROGRAM_HPP
+#define GOSUIMPL_GRAPHICS_SHADERPROGRAM_HPP
+
+#include <Gosu/Shader.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <string>
+
+// A linked GLSL program. Owned by Shader objects, and retained by DrawOpQueue
+// and Macro just like textures.
+class Gosu::ShaderProgram
+{
+    ShaderProgram(const ShaderProgram&);
+    ShaderProgram& operator=(const ShaderProgram&);
+    
+    GLuint name;
+    
+public:
+    ShaderProgram(const std::string& vertexSource, const std::string& fragmentSource);
+    ~ShaderProgram();
+    
+    GLuint glName() const
+    {
+        return name;
+    }
+    
+    // Makes this program current; 0 switches back to fixed-function.
+    static void use(const ShaderProgram* program)
+    {
+        const GLShaderFunctions& gl = glShaderFunctions();
+        if (gl.available)
+            gl.useProgram(program ? program->name : 0);
+    }
+    
+    // Returns -1 for uniforms that do not exist.
+    GLint uniformLocation(const std::string& uniform) const;
+};
+
+#endif
@@ -0,0 +1,288 @@
+#include <Gosu/SpriteLayer.hpp>
+#include <Gosu/Graphics.hpp>
+#include <Gosu/ImageData.hpp>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    // Handles keep the slot of a sprite in their lower bits, and the
+    // generation of the slot in the rest, so that stale handles can be told
+    // apart from those of sprites that reused the slot.
+    const unsigned SLOT_BITS = 20;
+    const unsigned long SLOT_MASK = (1ul << SLOT_BITS) - 1;
+}
+
+struct Gosu::SpriteLayer::Impl
+{
+    Graphics* graphics;
+    unsigned bucketSize;
+
+    struct Sprite
+    {
+        Image image;
+        double x, y, angle, factorX, factorY;
+        Color color;
+        ZPos z;
+        unsigned long generation;
+        bool alive;
+        // Where the sprite is in buckets[z].
+        unsigned bucket, indexInBucket;
+
+        explicit Sprite(const Image& image)
+        : image(image)
+        {
+        }
+    };
+    std::vector<Sprite> sprites;
+    std::vector<unsigned> freeSlots;
+    std::size_t size;
+
+    struct Bucket
+    {
+        std::vector<unsigned> slots;
+        // Empty while the bucket has to be recorded again.
+        std::tr1::shared_ptr<ImageData> macro;
+        // Bounding box of the sprites, for culling.
+        double left, top, right, bottom;
+    };
+    typedef std::map<ZPos, std::vector<Bucket> > Buckets;
+    Buckets buckets;
+
+    Sprite& at(Handle handle)
+    {
+        unsigned long slot = handle & SLOT_MASK;
+        if (slot >= sprites.size() || !sprites[slot].alive ||
+                sprites[slot].generation != (handle >> SLOT_BITS))
+            throw std::invalid_argument("Invalid SpriteLayer handle");
+        return sprites[slot];
+    }
+
+    Bucket& bucketOf(const Sprite& sprite)
+    {
+        return buckets[sprite.z][sprite.bucket];
+    }
+
+    void insert(unsigned slot)
+    {
+        Sprite& sprite = sprites[slot];
+        std::vector<Bucket>& list = buckets[sprite.z];
+        // Usually the last bucket is the one that still has room.
+        unsigned index = list.size();
+        while (index > 0 && list[index - 1].slots.size() >= bucketSize)
+            --index;
+        if (index == 0)
+        {
+            list.push_back(Bucket());
+            index = list.size();
+        }
+        Bucket& bucket = list[index - 1];
+        sprite.bucket = index - 1;
+        sprite.indexInBucket = bucket.slots.size();
+        bucket.slots.push_back(slot);
+        bucket.macro.reset();
+    }
+
+    void erase(unsigned slot)
+    {
+        Sprite& sprite = sprites[slot];
+        Buckets::iterator list = buckets.find(sprite.z);
+        Bucket& bucket = list->second[sprite.bucket];
+        unsigned last = bucket.slots.back();
+        bucket.slots[sprite.indexInBucket] = last;
+        sprites[last].indexInBucket = sprite.indexInBucket;
+        bucket.slots.pop_back();
+        bucket.macro.reset();
+
+        while (!list->second.empty() && list->second.back().slots.empty())
+            list->second.pop_back();
+        if (list->second.empty())
+            buckets.erase(list);
+    }
+
+    void record(Bucket& bucket)
+    {
+        bucket.left = bucket.top = 1e300;
+        bucket.right = bucket.bottom = -1e300;
+
+        graphics->beginRecording();
+        for (unsigned i = 0; i < bucket.slots.size(); ++i)
+        {
+            const Sprite& sprite = sprites[bucket.slots[i]];
+            sprite.image.drawRot(sprite.x, sprite.y, 0, sprite.angle, 0.5, 0.5,
+                sprite.factorX, sprite.factorY, sprite.color);
+
+            // Half the diagonal covers the sprite at any angle.
+            double w = sprite.image.width() * sprite.factorX;
+            double h = sprite.image.height() * sprite.factorY;
+            double radius = std::sqrt(w * w + h * h) / 2;
+            bucket.left = std::min(bucket.left, sprite.x - radius);
+            bucket.top = std::min(bucket.top, sprite.y - radius);
+            bucket.right = std::max(bucket.right, sprite.x + radius);
+            bucket.bottom = std::max(bucket.bottom, sprite.y + radius);
+        }
+        // Recorded at the sprites' own coordinates, and drawn with a 1x1
+        // target so that they stay there.
+        bucket.macro.reset(graphics->endRecording(1, 1).release());
+    }
+};
+
+Gosu::SpriteLayer::SpriteLayer(Graphics& graphics, unsigned bucketSize)
+: pimpl(new Impl)
+{
+    if (bucketSize == 0)
+        throw std::invalid_argument("Invalid SpriteLayer bucket size");
+
+    pimpl->graphics = &graphics;
+    pimpl->bucketSize = bucketSize;
+    pimpl->size = 0;
+}
+
+Gosu::SpriteLayer::~SpriteLayer()
+{
+}
+
+Gosu::SpriteLayer::Handle Gosu::SpriteLayer::add(const Image& image,
+    double x, double y, ZPos z, double angle, double factorX, double factorY, Color c)
+{
+    unsigned slot;
+    if (!pimpl->freeSlots.empty())
+    {
+        slot = pimpl->freeSlots.back();
+        pimpl->freeSlots.pop_back();
+        pimpl->sprites[slot].image = image;
+    }
+    else
+    {
+        if (pimpl->sprites.size() > SLOT_MASK)
+            throw std::length_error("Too many sprites in SpriteLayer");
+        slot = pimpl->sprites.size();
+        pimpl->sprites.push_back(Impl::Sprite(image));
+        pimpl->sprites.back().generation = 0;
+    }
+
+    Impl::Sprite& sprite = pimpl->sprites[slot];
+    sprite.x = x, sprite.y = y, sprite.z = z;
+    sprite.angle = angle, sprite.factorX = factorX, sprite.factorY = factorY;
+    sprite.color = c;
+    sprite.alive = true;
+    pimpl->insert(slot);
+    ++pimpl->size;
+    return (sprite.generation << SLOT_BITS) | slot;
+}
+
+void Gosu::SpriteLayer::remove(Handle handle)
+{
+    Impl::Sprite& sprite = pimpl->at(handle);
+    unsigned slot = handle & SLOT_MASK;
+    pimpl->erase(slot);
+    sprite.alive = false;
+    sprite.generation = (sprite.generation + 1) & (~0ul >> SLOT_BITS);
+    pimpl->freeSlots.push_back(slot);
+    --pimpl->size;
+}
+
+void Gosu::SpriteLayer::clear()
+{
+    for (unsigned slot = 0; slot < pimpl->sprites.size(); ++slot)
+        if (pimpl->sprites[slot].alive)
+            remove((pimpl->sprites[slot].generation << SLOT_BITS) | slot);
+}
+
+bool Gosu::SpriteLayer::contains(Handle handle) const
+{
+    unsigned long slot = handle & SLOT_MASK;
+    return slot < pimpl->sprites.size() && pimpl->sprites[slot].alive &&
+        pimpl->sprites[slot].generation == (handle >> SLOT_BITS);
+}
+
+std::size_t Gosu::SpriteLayer::size() const
+{
+    return pimpl->size;
+}
+
+void Gosu::SpriteLayer::setImage(Handle handle, const Image& image)
+{
+    Impl::Sprite& sprite = pimpl->at(handle);
+    sprite.image = image;
+    pimpl->bucketOf(sprite).macro.reset();
+}
+
+void Gosu::SpriteLayer::setPosition(Handle handle, double x, double y)
+{
+    Impl::Sprite& sprite = pimpl->at(handle);
+    if (sprite.x == x && sprite.y == y)
+        return;
+    sprite.x = x, sprite.y = y;
+    pimpl->bucketOf(sprite).macro.reset();
+}
+
+void Gosu::SpriteLayer::setTransform(Handle handle, double angle,
+    double factorX, double factorY)
+{
+    Impl::Sprite& sprite = pimpl->at(handle);
+    if (sprite.angle == angle && sprite.factorX == factorX && sprite.factorY == factorY)
+        return;
+    sprite.angle = angle, sprite.factorX = factorX, sprite.factorY = factorY;
+    pimpl->bucketOf(sprite).macro.reset();
+}
+
+void Gosu::SpriteLayer::setColor(Handle handle, Color c)
+{
+    Impl::Sprite& sprite = pimpl->at(handle);
+    if (sprite.color == c)
+        return;
+    sprite.color = c;
+    pimpl->bucketOf(sprite).macro.reset();
+}
+
+void Gosu::SpriteLayer::setZ(Handle handle, ZPos z)
+{
+    Impl::Sprite& sprite = pimpl->at(handle);
+    if (sprite.z == z)
+        return;
+    unsigned slot = handle & SLOT_MASK;
+    pimpl->erase(slot);
+    sprite.z = z;
+    pimpl->insert(slot);
+}
+
+double Gosu::SpriteLayer::x(Handle handle) const
+{
+    return pimpl->at(handle).x;
+}
+
+double Gosu::SpriteLayer::y(Handle handle) const
+{
+    return pimpl->at(handle).y;
+}
+
+Gosu::ZPos Gosu::SpriteLayer::z(Handle handle) const
+{
+    return pimpl->at(handle).z;
+}
+
+void Gosu::SpriteLayer::draw(AlphaMode mode) const
+{
+    for (Impl::Buckets::iterator list = pimpl->buckets.begin();
+            list != pimpl->buckets.end(); ++list)
+        for (unsigned i = 0; i < list->second.size(); ++i)
+        {
+            Impl::Bucket& bucket = list->second[i];
+            if (bucket.slots.empty())
+                continue;
+            // Buckets are only recorded again once they are drawn.
+            if (!bucket.macro)
+                pimpl->record(bucket);
+
+            if (!pimpl->graphics->isVisible(bucket.left, bucket.top, bucket.right, bucket.top,
+                    bucket.left, bucket.bottom, bucket.right, bucket.bottom))
+                continue;
+
+            Color c = Color::WHITE;
+            bucket.macro->draw(0, 0, c, 1, 0, c, 0, 1, c, 1, 1, c, list->first, mode);
+        }
+}
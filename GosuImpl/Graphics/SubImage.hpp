@@ -0,0 +1,97 @@
+#ifndef GOSUIMPL_GRAPHICS_SUBIMAGE_HPP
+#define GOSUIMPL_GRAPHICS_SUBIMAGE_HPP
+
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/ImageData.hpp>
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Graphics/TexChunk.hpp>
+#include <algorithm>
+
+namespace Gosu
+{
+    // A rectangle of a TexChunk, drawn from the chunk's texture without a
+    // copy of its own. Keeps the image it was taken from alive, and asks
+    // the chunk for its position every time, since chunks can be moved to
+    // another texture or evicted.
+    class SubImage : public ImageData
+    {
+        std::tr1::shared_ptr<ImageData> parent;
+        TexChunk& chunk;
+        int x, y, w, h;
+        mutable GLTexInfo info;
+
+    public:
+        // x and y are relative to the chunk, and the rectangle must lie
+        // inside of it.
+        SubImage(const std::tr1::shared_ptr<ImageData>& parent, TexChunk& chunk,
+            int x, int y, int w, int h)
+        : parent(parent), chunk(chunk), x(x), y(y), w(w), h(h)
+        {
+        }
+
+        const std::tr1::shared_ptr<ImageData>& parentData() const { return parent; }
+        TexChunk& texChunk() const { return chunk; }
+        int left() const { return x; }
+        int top() const { return y; }
+
+        int width() const { return w; }
+        int height() const { return h; }
+
+        void draw(double x1, double y1, Color c1,
+            double x2, double y2, Color c2,
+            double x3, double y3, Color c3,
+            double x4, double y4, Color c4,
+            ZPos z, AlphaMode mode) const
+        {
+            chunk.drawPart(chunk.partInfo(x, y, w, h),
+                x1, y1, c1, x2, y2, c2, x3, y3, c3, x4, y4, c4, z, mode);
+        }
+
+        void drawMany(const ImageInstance* instances, std::size_t count,
+            ZPos z, AlphaMode mode) const
+        {
+            chunk.drawManyParts(chunk.partInfo(x, y, w, h), w, h,
+                instances, count, z, mode);
+        }
+
+        void drawMesh(const MeshVertex* vertices, std::size_t vertexCount,
+            const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const
+        {
+            chunk.drawMeshPart(chunk.partInfo(x, y, w, h), vertices, indices, indexCount,
+                z, mode);
+        }
+
+        const GLTexInfo* glTexInfo() const
+        {
+            info = chunk.partInfo(x, y, w, h);
+            return &info;
+        }
+
+        Bitmap toBitmap() const
+        {
+            return chunk.toBitmap(x, y, w, h);
+        }
+
+        // Only changes the pixels inside this rectangle, but they are also
+        // changed in the image this was taken from.
+        void insert(const Bitmap& bitmap, int left, int top)
+        {
+            int right = std::min<int>(left + bitmap.width(), w);
+            int bottom = std::min<int>(top + bitmap.height(), h);
+            int clippedLeft = std::max(left, 0), clippedTop = std::max(top, 0);
+            if (clippedLeft >= right || clippedTop >= bottom)
+                return;
+
+            Bitmap clipped(right - clippedLeft, bottom - clippedTop);
+            clipped.insert(bitmap, left - clippedLeft, top - clippedTop);
+            chunk.insert(clipped, x + clippedLeft, y + clippedTop);
+        }
+
+        bool ready() const
+        {
+            return chunk.ready();
+        }
+    };
+}
+
+#endif
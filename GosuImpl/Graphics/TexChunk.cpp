@@ -3,10 +3,36 @@
 #include <GosuImpl/Graphics/DrawOpQueue.hpp>
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/Graphics.hpp>
+#include <Gosu/Inspection.hpp>
+
+namespace Gosu
+{
+    namespace
+    {
+        unsigned long evictions = 0, reloads = 0;
+    }
+}
 
 Gosu::TexChunk::TexChunk(Graphics& graphics, DrawOpQueueStack& queues,
     std::tr1::shared_ptr<Texture> texture, int x, int y, int w, int h, int padding)
-: graphics(graphics), queues(queues), texture(texture), x(x), y(y), w(w), h(h), padding(padding)
+: graphics(graphics), queues(queues), texture(texture), x(x), y(y), w(w), h(h), padding(padding),
+  mipmapped(texture->isMipmapped()), format(texture->format()), uploadFence(0)
+{
+    updateInfo();
+    texture->attach(this);
+}
+
+Gosu::TexChunk::~TexChunk()
+{
+    setUploadFence(0);
+    if (texture)
+    {
+        texture->detach(this);
+        texture->free(x - padding, y - padding);
+    }
+}
+
+void Gosu::TexChunk::updateInfo()
 {
     info.texName = texture->texName();
     float textureSize = texture->size();
@@ -16,9 +42,65 @@ Gosu::TexChunk::TexChunk(Graphics& graphics, DrawOpQueueStack& queues,
     info.bottom = (y + h) / textureSize;
 }
 
-Gosu::TexChunk::~TexChunk()
+void Gosu::TexChunk::relocate(std::tr1::shared_ptr<Texture> newTexture, int blockLeft, int blockTop)
+{
+    if (texture)
+    {
+        texture->detach(this);
+        texture->free(x - padding, y - padding);
+    }
+    else
+    {
+        Bitmap().swap(evictedPixels);
+        ++reloads;
+    }
+    
+    texture = newTexture;
+    x = blockLeft + padding;
+    y = blockTop + padding;
+    updateInfo();
+    texture->attach(this);
+}
+
+void Gosu::TexChunk::evict(const Bitmap& textureContent)
 {
+    evictedPixels.resize(blockWidth(), blockHeight());
+    evictedPixels.insert(textureContent, -blockLeft(), -blockTop());
+    
+    setUploadFence(0);
+    texture->detach(this);
     texture->free(x - padding, y - padding);
+    texture.reset();
+    ++evictions;
+}
+
+void Gosu::TexChunk::restore() const
+{
+    // Restoring does not change what the chunk looks like, only where its
+    // pixels are.
+    if (evicted())
+        graphics.restoreTexChunk(const_cast<TexChunk&>(*this));
+}
+
+void Gosu::TexChunk::setUploadFence(GLFence fence)
+{
+    if (uploadFence)
+        glSyncFunctions().deleteSync(uploadFence);
+    uploadFence = fence;
+}
+
+bool Gosu::TexChunk::ready() const
+{
+    if (!uploadFence)
+        return true;
+    
+    // Only polls; never blocks.
+    GLenum status = glSyncFunctions().clientWaitSync(uploadFence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+    glSyncFunctions().deleteSync(uploadFence);
+    uploadFence = 0;
+    return true;
 }
 
 void Gosu::TexChunk::draw(double x1, double y1, Color c1,
@@ -27,69 +109,188 @@ void Gosu::TexChunk::draw(double x1, double y1, Color c1,
     double x4, double y4, Color c4,
     ZPos z, AlphaMode mode) const
 {
+    drawPart(*glTexInfo(), x1, y1, c1, x2, y2, c2, x3, y3, c3, x4, y4, c4, z, mode);
+}
+
+void Gosu::TexChunk::drawPart(const GLTexInfo& part,
+    double x1, double y1, Color c1,
+    double x2, double y2, Color c2,
+    double x3, double y3, Color c3,
+    double x4, double y4, Color c4,
+    ZPos z, AlphaMode mode) const
+{
+    restore();
+    texture->setLastDrawn(graphics.frameNumber());
+    
     DrawOp op;
-    op.renderState.texture = texture;
-    op.renderState.mode = mode;
     
     reorderCoordinatesIfNecessary(x1, y1, x2, y2, x3, y3, c3, x4, y4, c4);
     
     op.verticesOrBlockIndex = 4;
-    op.vertices[0] = DrawOp::Vertex(x1, y1, c1);
-    op.vertices[1] = DrawOp::Vertex(x2, y2, c2);
+    op.vertices[0] = ArrayVertex(x1, y1, c1);
+    op.vertices[1] = ArrayVertex(x2, y2, c2);
 // TODO: Should be harmonized
 #ifdef GOSU_IS_IPHONE
-    op.vertices[2] = DrawOp::Vertex(x3, y3, c3);
-    op.vertices[3] = DrawOp::Vertex(x4, y4, c4);
+    op.vertices[2] = ArrayVertex(x3, y3, c3);
+    op.vertices[3] = ArrayVertex(x4, y4, c4);
+#else
+    op.vertices[3] = ArrayVertex(x3, y3, c3);
+    op.vertices[2] = ArrayVertex(x4, y4, c4);
+#endif
+    op.setTexCoords(part.left, part.top, part.right, part.bottom);
+    
+    op.z = z;
+    currentQueue(queues).scheduleDrawOp(op, mode, texture);
+}
+
+void Gosu::TexChunk::drawMany(const ImageInstance* instances, std::size_t count,
+    ZPos z, AlphaMode mode) const
+{
+    drawManyParts(*glTexInfo(), w, h, instances, count, z, mode);
+}
+
+void Gosu::TexChunk::drawManyParts(const GLTexInfo& part, int width, int height,
+    const ImageInstance* instances, std::size_t count, ZPos z, AlphaMode mode) const
+{
+    if (count == 0)
+        return;
+    
+    restore();
+    texture->setLastDrawn(graphics.frameNumber());
+    
+    DrawOp op;
+    op.verticesOrBlockIndex = 4;
+    op.z = z;
+    
+    // Rotating and scaling uniformly never flips the quad, so the corners do
+    // not need to be reordered.
+    DrawOpQueue& queue = currentQueue(queues);
+    double xs[4], ys[4];
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        instanceCorners(instances[i], width, height, xs, ys);
+        Color c = instances[i].color;
+        op.vertices[0] = ArrayVertex(xs[0], ys[0], c);
+        op.vertices[1] = ArrayVertex(xs[1], ys[1], c);
+#ifdef GOSU_IS_IPHONE
+        op.vertices[2] = ArrayVertex(xs[2], ys[2], c);
+        op.vertices[3] = ArrayVertex(xs[3], ys[3], c);
 #else
-    op.vertices[3] = DrawOp::Vertex(x3, y3, c3);
-    op.vertices[2] = DrawOp::Vertex(x4, y4, c4);
+        op.vertices[3] = ArrayVertex(xs[2], ys[2], c);
+        op.vertices[2] = ArrayVertex(xs[3], ys[3], c);
 #endif
-    op.left = info.left;
-    op.top = info.top;
-    op.right = info.right;
-    op.bottom = info.bottom;
+        op.setTexCoords(part.left, part.top, part.right, part.bottom);
+        queue.scheduleDrawOp(op, mode, texture);
+    }
+}
+
+void Gosu::TexChunk::drawMesh(const MeshVertex* vertices, std::size_t vertexCount,
+    const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const
+{
+    drawMeshPart(*glTexInfo(), vertices, indices, indexCount, z, mode);
+}
+
+void Gosu::TexChunk::drawMeshPart(const GLTexInfo& part, const MeshVertex* vertices,
+    const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const
+{
+    if (indexCount == 0)
+        return;
     
+    restore();
+    texture->setLastDrawn(graphics.frameNumber());
+    
+    DrawOp op;
+    op.verticesOrBlockIndex = 4;
     op.z = z;
-    queues.back().scheduleDrawOp(op);
+    
+    DrawOpQueue& queue = currentQueue(queues);
+    GLfloat width = part.right - part.left, height = part.bottom - part.top;
+    for (std::size_t i = 0; i + 2 < indexCount; i += 3)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            const MeshVertex& vertex = vertices[indices[i + j]];
+            op.vertices[j] = ArrayVertex(vertex.x, vertex.y, vertex.color);
+            op.vertices[j].u = part.left + width * vertex.u;
+            op.vertices[j].v = part.top + height * vertex.v;
+        }
+        op.vertices[3] = op.vertices[2];
+        queue.scheduleDrawOp(op, mode, texture);
+    }
 }
 
 const Gosu::GLTexInfo* Gosu::TexChunk::glTexInfo() const
 {
+    restore();
     return &info;
 }
 
+Gosu::GLTexInfo Gosu::TexChunk::partInfo(int left, int top, int width, int height) const
+{
+    restore();
+    GLTexInfo result = info;
+    float textureSize = texture->size();
+    result.left = (x + left) / textureSize;
+    result.top = (y + top) / textureSize;
+    result.right = (x + left + width) / textureSize;
+    result.bottom = (y + top + height) / textureSize;
+    return result;
+}
+
+int Gosu::TexChunk::alignUp(int size) const
+{
+    int alignment = mipmapped ? Texture::MIPMAP_PADDING : 1;
+    return (size + alignment - 1) / alignment * alignment;
+}
+
 Gosu::Bitmap Gosu::TexChunk::toBitmap() const
 {
-    return texture->toBitmap(x, y, w, h);
+    return toBitmap(0, 0, w, h);
+}
+
+Gosu::Bitmap Gosu::TexChunk::toBitmap(int left, int top, int width, int height) const
+{
+    if (evicted())
+    {
+        Bitmap result(width, height);
+        result.insert(evictedPixels, -padding - left, -padding - top);
+        return result;
+    }
+    return texture->toBitmap(x + left, y + top, width, height);
 }
 
 void Gosu::TexChunk::insert(const Bitmap& original, int x, int y)
 {
     // TODO: Should respect borderFlags.
     
-    Bitmap alternate;
-    const Bitmap* bitmap = &original;
-    if (x < 0 || y < 0 || x + original.width() > w || y + original.height() > h)
-    {
-        int offsetX = 0, offsetY = 0, trimmedWidth = original.width(), trimmedHeight = original.height();
-        if (x < 0)
-            offsetX = x, trimmedWidth  += x, x = 0;
-        if (y < 0)
-            offsetY = y, trimmedHeight += y, y = 0;
-        if (x + trimmedWidth > w)
-            trimmedWidth  -= (w - x - trimmedWidth);
-        if (y + trimmedHeight > h)
-            trimmedHeight -= (h - y - trimmedHeight);
-            
-        if (trimmedWidth <= 0 || trimmedHeight <= 0)
-            return;
+    restore();    
+    int offsetX = 0, offsetY = 0, trimmedWidth = original.width(), trimmedHeight = original.height();
+    if (x < 0)
+        offsetX = -x, trimmedWidth  += x, x = 0;
+    if (y < 0)
+        offsetY = -y, trimmedHeight += y, y = 0;
+    if (x + trimmedWidth > w)
+        trimmedWidth  = w - x;
+    if (y + trimmedHeight > h)
+        trimmedHeight = h - y;
         
-        alternate.resize(trimmedWidth, trimmedHeight);
-        alternate.insert(original, offsetX, offsetY);
-        bitmap = &alternate;
-    }
+    if (trimmedWidth <= 0 || trimmedHeight <= 0)
+        return;
     
-    glBindTexture(GL_TEXTURE_2D, texName());
-    glTexSubImage2D(GL_TEXTURE_2D, 0, this->x + x, this->y + y, bitmap->width(), bitmap->height(),
-        Color::GL_FORMAT, GL_UNSIGNED_BYTE, bitmap->data());
+    setUploadFence(texture->upload(BlockAllocator::Block(this->x + x, this->y + y,
+        trimmedWidth, trimmedHeight),
+        BitmapView(original, offsetX, offsetY, trimmedWidth, trimmedHeight)));
+    if (texture->isMipmapped())
+        texture->updateMipmaps(BlockAllocator::Block(blockLeft(), blockTop(),
+            blockWidth(), blockHeight()));
+}
+
+unsigned long Gosu::textureEvictions()
+{
+    return evictions;
+}
+
+unsigned long Gosu::textureReloads()
+{
+    return reloads;
 }
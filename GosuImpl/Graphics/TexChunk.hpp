@@ -2,9 +2,11 @@
 #define GOSUIMPL_GRAPHICS_TEXCHUNK_HPP
 
 #include <Gosu/Fwd.hpp>
+#include <Gosu/Bitmap.hpp>
 #include <Gosu/ImageData.hpp>
 #include <Gosu/TR1.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
 #include <memory>
 #include <vector>
 #include <stdexcept>
@@ -13,12 +15,26 @@ class Gosu::TexChunk : public Gosu::ImageData
 {
     Graphics& graphics;
     DrawOpQueueStack& queues;
+    // Empty while the chunk is evicted.
     std::tr1::shared_ptr<Texture> texture;
     int x, y, w, h, padding;
+    bool mipmapped;
+    PixelFormat format;
+    
+    // The whole block, including padding, while the chunk is evicted.
+    Bitmap evictedPixels;
     
     // Cached for faster access.
     GLTexInfo info;
     
+    // Set while an asynchronous upload into this chunk is in flight.
+    mutable GLFence uploadFence;
+    
+    void updateInfo();
+    int alignUp(int size) const;
+    // Evicted chunks are restored before their texture is used.
+    void restore() const;
+    
 public:
     TexChunk(Graphics& graphics, DrawOpQueueStack& queues,
              std::tr1::shared_ptr<Texture> texture, int x, int y, int w, int h, int padding);
@@ -36,17 +52,65 @@ public:
     
     GLuint texName() const
     {
+        restore();
         return info.texName;
     }
     
+    // The allocated area on the texture, including padding.
+    int blockLeft() const { return x - padding; }
+    int blockTop() const { return y - padding; }
+    int blockWidth() const { return alignUp(w + 2 * padding); }
+    int blockHeight() const { return alignUp(h + 2 * padding); }
+    
+    // Moves this chunk to a block that has already been allocated and filled
+    // on another texture, and frees the old block.
+    void relocate(std::tr1::shared_ptr<Texture> newTexture, int blockLeft, int blockTop);
+    
+    // Lets go of the texture, keeping a copy of the chunk's block in main
+    // memory. textureContent must be the complete texture.
+    void evict(const Bitmap& textureContent);
+    bool evicted() const { return !texture; }
+    bool isMipmapped() const { return mipmapped; }
+    PixelFormat pixelFormat() const { return format; }
+    const Bitmap& pixelsWhileEvicted() const { return evictedPixels; }
+    
+    // Takes ownership of the fence returned by Texture::upload.
+    void setUploadFence(GLFence fence);
+    bool ready() const;
+    
     void draw(double x1, double y1, Color c1,
         double x2, double y2, Color c2,
         double x3, double y3, Color c3,
         double x4, double y4, Color c4,
         ZPos z, AlphaMode mode) const;
         
+    // Skips everything that the quads have in common.
+    void drawMany(const ImageInstance* instances, std::size_t count,
+        ZPos z, AlphaMode mode) const;
+        
     const GLTexInfo* glTexInfo() const;
+    
+    // For SubImage: The texture coordinates of a rectangle of the chunk,
+    // which change when the chunk is moved, and draw, drawMany and drawMesh
+    // with them. The part must have been taken right before.
+    GLTexInfo partInfo(int left, int top, int width, int height) const;
+    void drawPart(const GLTexInfo& part,
+        double x1, double y1, Color c1,
+        double x2, double y2, Color c2,
+        double x3, double y3, Color c3,
+        double x4, double y4, Color c4,
+        ZPos z, AlphaMode mode) const;
+    void drawManyParts(const GLTexInfo& part, int width, int height,
+        const ImageInstance* instances, std::size_t count, ZPos z, AlphaMode mode) const;
+    // Each triangle becomes a quad with its last corner repeated, so that
+    // meshes end up in the same batches as images.
+    void drawMesh(const MeshVertex* vertices, std::size_t vertexCount,
+        const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const;
+    void drawMeshPart(const GLTexInfo& part, const MeshVertex* vertices,
+        const unsigned* indices, std::size_t indexCount, ZPos z, AlphaMode mode) const;
+    
     Gosu::Bitmap toBitmap() const;
+    Gosu::Bitmap toBitmap(int left, int top, int width, int height) const;
     void insert(const Bitmap& bitmap, int x, int y);
 };
 
@@ -5,12 +5,17 @@
 #include <Gosu/Math.hpp>
 #include <Gosu/TR1.hpp>
 #include <Gosu/Utility.hpp>
+#include <GosuImpl/Graphics/BitmapPool.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
 #include <GosuImpl/Graphics/FormattedString.hpp>
+#include <GosuImpl/Graphics/PixelKernels.hpp>
+#include <GosuImpl/Threading.hpp>
 #include <cassert>
 #include <cmath>
 #include <algorithm>
 #include <map>
+#include <memory>
+#include <stdexcept>
 #include <vector>
 using namespace std;
 
@@ -36,21 +41,55 @@ namespace Gosu
             
             return false;
         }
+        
+        // Copies the visible pixels of a bitmap from renderText, like
+        // drawText would have set them, so that overhanging parts of the
+        // text before are kept.
+        void insertText(Bitmap& bmp, const Bitmap& text, int x, int y)
+        {
+            for (int relY = 0; relY < text.height(); ++relY)
+            {
+                if (y + relY < 0 || y + relY >= bmp.height())
+                    continue;
+                for (int relX = 0; relX < text.width(); ++relX)
+                {
+                    Color c = text.getPixel(relX, relY);
+                    if (c.alpha() != 0 && x + relX >= 0 && x + relX < bmp.width())
+                        bmp.setPixel(x + relX, y + relY, c);
+                }
+            }
+        }
     
         struct WordInfo
         {
             FormattedString text;
+            // The parts of text with the same formatting, and how wide the
+            // text before each of them is, so that drawing a word does not
+            // need to measure it again.
+            vector<FormattedString> parts;
+            vector<unsigned> partOffsets;
             unsigned width;
             unsigned spaceWidth;
         };
         typedef vector<WordInfo> Words;
 
+        // Texts with fewer lines per thread are drawn on one thread, since
+        // starting threads is not free either.
+        enum { MIN_LINES_PER_BAND = 8 };
+
         // Local helper class which manages building the bitmap from the
-        // collected words.
+        // collected words. Lines are only recorded while the text is laid
+        // out, so that the bitmap can be allocated in its final size.
         class TextBlockBuilder
         {
-            Bitmap bmp;
-            unsigned usedLines, allocatedLines;
+            struct Line
+            {
+                Words words;
+                unsigned wordsWidth;
+                bool overrideAlign;
+            };
+            vector<Line> lines;
+            unsigned width_;
 
             wstring fontName;
             unsigned fontHeight;
@@ -59,82 +98,45 @@ namespace Gosu
 
             unsigned spaceWidth_;
 
-            void allocNextLine()
-            {
-                ++usedLines;
-                if (usedLines == allocatedLines)
-                {
-                    allocatedLines += 10;
-                    bmp.resize(bmp.width(),
-                        fontHeight * allocatedLines + lineSpacing * (allocatedLines - 1),
-                        Color::NONE);
-                }
-            }
-
-        public:
-            TextBlockBuilder(const wstring& fontName, unsigned fontHeight,
-                int lineSpacing, unsigned width, TextAlign align)
-            {
-                usedLines = 0;
-                allocatedLines = 10;
-                
-                bmp.resize(width, (lineSpacing + fontHeight) * allocatedLines, 0x00ffffff);
-
-                this->fontName = fontName;
-                this->fontHeight = fontHeight;
-                this->lineSpacing = lineSpacing;
-                this->align = align;
-
-                spaceWidth_ = textWidth(FormattedString(L" ", 0));
-            }
+            // Widths of the parts measured so far, by text and flags, since
+            // the same words tend to appear many times.
+            typedef map<pair<wstring, unsigned>, unsigned> Widths;
+            Widths widths;
 
-            unsigned width() const
+            unsigned partWidth(const FormattedString& part)
             {
-                return bmp.width();
+                if (part.entityAt(0))
+                    return entityBitmap(part.entityAt(0)).width();
+
+                pair<wstring, unsigned> key(part.unformat(), part.flagsAt(0));
+                Widths::iterator iter = widths.find(key);
+                if (iter == widths.end())
+                    iter = widths.insert(make_pair(key, Gosu::textWidth(key.first,
+                        fontName, fontHeight, key.second))).first;
+                return iter->second;
             }
 
-            unsigned textWidth(const FormattedString& text) const
+            void drawLine(Bitmap& bmp, const Line& line, unsigned top) const
             {
-                if (text.length() == 0)
-                    return 0;
-                
-                if (text.entityAt(0))
-                    return entityBitmap(text.entityAt(0)).width();
-                
-                vector<FormattedString> parts = text.splitParts();
-                unsigned result = 0;
-                for (unsigned i = 0; i < parts.size(); ++i)
-                    result += Gosu::textWidth(parts[i].unformat(), fontName, fontHeight, parts[i].flagsAt(0));
-                return result;
-            }
+                const Words& words = line.words;
 
-            void addLine(Words::const_iterator begin, Words::const_iterator end,
-                unsigned wordsWidth, bool overrideAlign)
-            {
-                allocNextLine();
-                
-                unsigned words = end - begin;
-                
                 unsigned totalSpacing = 0;
-                if (begin < end)
-                    for (Words::const_iterator i = begin; i != end - 1; ++i)
+                if (!words.empty())
+                    for (Words::const_iterator i = words.begin(); i != words.end() - 1; ++i)
                         totalSpacing += i->spaceWidth;
 
-                // Where does the line start? (y)
-                unsigned top = (usedLines - 1) * (fontHeight + lineSpacing);
-
                 // Where does the line start? (x)
                 double pos;
                 switch (align)
                 {
                 // Start so that the text touches the right border.
                 case taRight:
-                    pos = bmp.width() - wordsWidth - totalSpacing;
+                    pos = bmp.width() - line.wordsWidth - totalSpacing;
                     break;
 
                 // Start so that the text is centered.
                 case taCenter:
-                    pos = bmp.width() - wordsWidth - totalSpacing;
+                    pos = bmp.width() - line.wordsWidth - totalSpacing;
                     pos /= 2;
                     break;
 
@@ -143,48 +145,140 @@ namespace Gosu
                     pos = 0;
                 }
                 
-                for (Words::const_iterator cur = begin; cur != end; ++cur)
+                for (Words::const_iterator cur = words.begin(); cur != words.end(); ++cur)
                 {
-                    vector<FormattedString> parts = cur->text.splitParts();
-                    int x = 0;
-                    for (int i = 0; i < parts.size(); ++i)
+                    for (unsigned i = 0; i < cur->parts.size(); ++i)
                     {
-                        FormattedString& part = parts[i];
+                        const FormattedString& part = cur->parts[i];
+                        int x = trunc(pos) + cur->partOffsets[i];
                         
                         if (part.entityAt(0))
                         {
-                            Gosu::Bitmap entity = entityBitmap(part.entityAt(0));
-                            multiplyBitmapAlpha(entity, part.colorAt(0).alpha());
-                            bmp.insert(entity, trunc(pos) + x, trunc(top));
-                            x += entity.width();
+                            ScratchBitmap entity;
+                            *entity = entityBitmap(part.entityAt(0));
+                            multiplyBitmapAlpha(*entity, part.colorAt(0).alpha());
+                            bmp.insert(*entity, x, top);
                             continue;
                         }
                         
-                        wstring unformattedPart = part.unformat();
-                        drawText(bmp, unformattedPart, trunc(pos) + x, trunc(top),
-                            part.colorAt(0), fontName, fontHeight, part.flagsAt(0));
-                        x += Gosu::textWidth(unformattedPart, fontName, fontHeight,
-                            part.flagsAt(0));
+                        Gosu::Bitmap text = renderText(part.unformat(), part.colorAt(0),
+                            fontName, fontHeight, part.flagsAt(0));
+                        insertText(bmp, text, x, top);
                     }
                     
-                    if (align == taJustify && !overrideAlign)
-                        pos += cur->width + 1.0 * (width() - wordsWidth) / (words - 1);
+                    if (align == taJustify && !line.overrideAlign)
+                        pos += cur->width + 1.0 * (width() - line.wordsWidth) / (words.size() - 1);
                     else
                         pos += cur->width + cur->spaceWidth;
                 }
             }
+
+        public:
+            TextBlockBuilder(const wstring& fontName, unsigned fontHeight,
+                int lineSpacing, unsigned width, TextAlign align)
+            {
+                width_ = width;
+
+                this->fontName = fontName;
+                this->fontHeight = fontHeight;
+                this->lineSpacing = lineSpacing;
+                this->align = align;
+
+                spaceWidth_ = partWidth(FormattedString(L" ", 0));
+            }
+
+            unsigned width() const
+            {
+                return width_;
+            }
+
+            // Splits the word into its parts and measures each of them once.
+            void measure(WordInfo& word)
+            {
+                word.width = 0;
+                if (word.text.length() == 0)
+                    return;
+                
+                word.parts = word.text.splitParts();
+                word.partOffsets.resize(word.parts.size());
+                for (unsigned i = 0; i < word.parts.size(); ++i)
+                {
+                    word.partOffsets[i] = word.width;
+                    word.width += partWidth(word.parts[i]);
+                }
+            }
+
+            void addLine(Words::const_iterator begin, Words::const_iterator end,
+                unsigned wordsWidth, bool overrideAlign)
+            {
+                lines.push_back(Line());
+                lines.back().words.assign(begin, end);
+                lines.back().wordsWidth = wordsWidth;
+                lines.back().overrideAlign = overrideAlign;
+            }
             
             void addEmptyLine()
             {
-                allocNextLine();
+                lines.push_back(Line());
+                lines.back().wordsWidth = 0;
+                lines.back().overrideAlign = true;
+            }
+
+            // Draws the lines [first..last[ onto a bitmap of their own.
+            void drawBand(unsigned first, unsigned last, Bitmap& band, string& error) const
+            {
+                try
+                {
+                    unsigned bandLines = last - first;
+                    band.resize(width_, fontHeight * bandLines + lineSpacing * (bandLines - 1),
+                        0x00ffffff);
+                    for (unsigned i = first; i < last; ++i)
+                        drawLine(band, lines[i], (i - first) * (fontHeight + lineSpacing));
+                }
+                catch (const exception& e)
+                {
+                    error = e.what();
+                }
             }
 
             Bitmap result() const
             {
-                Bitmap result = bmp;
-                result.resize(result.width(),
-                    fontHeight * usedLines + lineSpacing * (usedLines - 1));
-                return result;
+                unsigned usedLines = lines.size();
+                Bitmap bmp(width_, fontHeight * usedLines + lineSpacing * (usedLines - 1),
+                    0x00ffffff);
+                
+                // Long texts are split into bands of lines that are drawn
+                // by threads of their own, if the font allows that.
+                unsigned bands = min(hardwareThreads(), usedLines / MIN_LINES_PER_BAND);
+                if (bands < 2 || !isReentrantFont(fontName))
+                {
+                    for (unsigned i = 0; i < usedLines; ++i)
+                        drawLine(bmp, lines[i], i * (fontHeight + lineSpacing));
+                    return bmp;
+                }
+                
+                vector<Bitmap> bitmaps(bands);
+                vector<string> errors(bands);
+                {
+                    // The first band is drawn on this thread.
+                    vector<tr1::shared_ptr<Thread> > threads;
+                    for (unsigned b = 1; b < bands; ++b)
+                        threads.push_back(tr1::shared_ptr<Thread>(new Thread(
+                            tr1::bind(&TextBlockBuilder::drawBand, this,
+                                b * usedLines / bands, (b + 1) * usedLines / bands,
+                                tr1::ref(bitmaps[b]), tr1::ref(errors[b])))));
+                    drawBand(0, usedLines / bands, bitmaps[0], errors[0]);
+                }
+                
+                // Bands do overlap if the line spacing is negative, so only
+                // the visible pixels are copied, like drawLine does.
+                for (unsigned b = 0; b < bands; ++b)
+                {
+                    if (!errors[b].empty())
+                        throw runtime_error(errors[b]);
+                    insertText(bmp, bitmaps[b], 0, b * usedLines / bands * (fontHeight + lineSpacing));
+                }
+                return bmp;
             }
             
             unsigned spaceWidth() const
@@ -253,7 +347,7 @@ namespace Gosu
                     if (beginOfWord != cur)
                     {
                         newWord.text = paragraph.range(beginOfWord, cur);
-                        newWord.width = builder.textWidth(newWord.text);
+                        builder.measure(newWord);
                         newWord.spaceWidth = builder.spaceWidth();
                         collectedWords.push_back(newWord);
                     }
@@ -266,13 +360,13 @@ namespace Gosu
                     if (beginOfWord != cur)
                     {
                         newWord.text = paragraph.range(beginOfWord, cur);
-                        newWord.width = builder.textWidth(newWord.text);
+                        builder.measure(newWord);
                         newWord.spaceWidth = 0;
                         collectedWords.push_back(newWord);
                     }
                     // Add glyph as a single "word"
                     newWord.text = paragraph.range(cur, cur + 1);
-                    newWord.width = builder.textWidth(newWord.text);
+                    builder.measure(newWord);
                     newWord.spaceWidth = 0;
                     collectedWords.push_back(newWord);
                     beginOfWord = cur + 1;
@@ -282,7 +376,7 @@ namespace Gosu
             {
                 WordInfo lastWord;
                 lastWord.text = paragraph.range(beginOfWord, paragraph.length());
-                lastWord.width = builder.textWidth(lastWord.text);
+                builder.measure(lastWord);
                 lastWord.spaceWidth = 0;
                 collectedWords.push_back(lastWord);
             }
@@ -339,28 +433,27 @@ Gosu::Bitmap Gosu::createText(const wstring& text,
             continue;
         
         unsigned x = 0;
-        vector<FormattedString> parts = lines[i].splitParts();
-        for (int p = 0; p < parts.size(); ++p)
+        for (unsigned begin = 0, end; begin < lines[i].length(); begin = end)
         {
-            const FormattedString& part = parts[p];
+            end = lines[i].endOfPart(begin);
+            FormattedString part = lines[i].range(begin, end);
             if (part.length() == 1 && part.entityAt(0))
             {
-                Gosu::Bitmap entity = entityBitmap(part.entityAt(0));
-                multiplyBitmapAlpha(entity, part.colorAt(0).alpha());
-                bmp.resize(max(bmp.width(), x + entity.width()), bmp.height());
-                bmp.insert(entity, x, i * fontHeight);
-                x += entity.width();
+                ScratchBitmap entity;
+                *entity = entityBitmap(part.entityAt(0));
+                multiplyBitmapAlpha(*entity, part.colorAt(0).alpha());
+                bmp.resize(max(bmp.width(), x + entity->width()), bmp.height());
+                bmp.insert(*entity, x, i * fontHeight);
+                x += entity->width();
                 continue;
             }
                 
             assert(part.length() > 0);
-            wstring unformattedText = part.unformat();
-            unsigned partWidth =
-                textWidth(unformattedText, fontName, fontHeight, part.flagsAt(0));
-            bmp.resize(max(bmp.width(), x + partWidth), bmp.height());
-            drawText(bmp, unformattedText, x, i * fontHeight, part.colorAt(0),
+            Bitmap text = renderText(part.unformat(), part.colorAt(0),
                 fontName, fontHeight, part.flagsAt(0));
-            x += partWidth;
+            bmp.resize(max(bmp.width(), x + text.width()), bmp.height());
+            insertText(bmp, text, x, i * fontHeight);
+            x += text.width();
         }
     }
     
@@ -384,8 +477,9 @@ bool Gosu::isEntity(const wstring& name)
 
 const Gosu::Bitmap& Gosu::entityBitmap(const wstring& name)
 {
-    tr1::shared_ptr<Gosu::Bitmap>& ptr = entities[name];
-    if (!ptr)
+    // Does not use operator[], so that text can be drawn on several threads.
+    map<wstring, tr1::shared_ptr<Gosu::Bitmap> >::const_iterator iter = entities.find(name);
+    if (iter == entities.end() || !iter->second)
         throw runtime_error("Unknown entity: " + Gosu::wstringToUTF8(name));
-    return *ptr;
+    return *iter->second;
 }
@@ -9,6 +9,7 @@
 #include <Gosu/Utility.hpp>
 #include <Gosu/IO.hpp>
 #include <GosuImpl/MacUtility.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
 #include <cmath>
 #include <stdexcept>
 #include <map>
@@ -192,6 +193,11 @@ namespace
     };
 }
 
+bool Gosu::isReentrantFont(const std::wstring& fontName)
+{
+    return false;
+}
+
 unsigned Gosu::textWidth(const std::wstring& text,
     const std::wstring& fontName, unsigned fontHeight, unsigned fontFlags)
 {
@@ -212,6 +218,38 @@ unsigned Gosu::textWidth(const std::wstring& text,
     return rect.right + 1 - rect.left + 1; // add one pixel on OS X
 }
 
+namespace
+{
+    void drawLayout(Gosu::Bitmap& bitmap, ATSULayoutAndStyle& atlas, const Rect& rect,
+        int x, int y, Gosu::Color c, const std::wstring& fontName, unsigned fontHeight)
+    {
+        CachedFontInfo& font = getFont(fontName);
+        
+        int width = rect.right + 1 - rect.left + 1; // add one pixel on OS X
+        std::vector<std::tr1::uint32_t> buf(width * fontHeight);
+        {
+            MacBitmap helper(&buf[0], width, fontHeight);
+            atlas.drawToContext(X2Fix(-rect.left), X2Fix(fontHeight / font.heightAt1Pt * font.descentAt1Pt),
+                                helper.context());
+        }
+        
+        int effectiveWidth = Gosu::clamp<int>(width, 0, bitmap.width() - x);
+        int effectiveHeight = Gosu::clamp<int>(fontHeight, 0, bitmap.height() - y);
+        
+        for (int relY = 0; relY < effectiveHeight; ++relY)
+            for (int relX = 0; relX < effectiveWidth; ++relX)
+            {
+    #ifdef __BIG_ENDIAN__
+                Gosu::Color::Channel alpha = buf[relY * width + relX];
+    #else
+                Gosu::Color::Channel alpha = Gosu::Color(buf[relY * width + relX]).alpha();
+    #endif
+                if (alpha != 0)
+                    bitmap.setPixel(x + relX, y + relY, multiply(c, Gosu::Color(alpha, 0xff, 0xff, 0xff)));
+            }
+    }
+}
+
 void Gosu::drawText(Bitmap& bitmap, const std::wstring& text, int x, int y,
     Color c, const std::wstring& fontName, unsigned fontHeight,
     unsigned fontFlags)
@@ -222,28 +260,29 @@ void Gosu::drawText(Bitmap& bitmap, const std::wstring& text, int x, int y,
     if (text.empty())
         return;
 
-    CachedFontInfo& font = getFont(fontName);
-    
     ATSULayoutAndStyle atlas(text, fontName, fontHeight, fontFlags);
-    Rect rect = atlas.textExtents();
-    int width = rect.right + 1 - rect.left + 1; // add one pixel on OS X
-    std::vector<std::tr1::uint32_t> buf(width * fontHeight);
-    {
-        MacBitmap helper(&buf[0], width, fontHeight);
-        atlas.drawToContext(X2Fix(-rect.left), X2Fix(fontHeight / font.heightAt1Pt * font.descentAt1Pt),
-                            helper.context());
-    }
+    drawLayout(bitmap, atlas, atlas.textExtents(), x, y, c, fontName, fontHeight);
+}
+
+Gosu::Bitmap Gosu::renderText(const std::wstring& text, Color c,
+    const std::wstring& fontName, unsigned fontHeight, unsigned fontFlags)
+{
+    if (text.find_first_of(L"\r\n") != std::wstring::npos)
+        throw std::invalid_argument("the argument to renderText cannot contain line breaks");
     
-    int effectiveWidth = Gosu::clamp<int>(width, 0, bitmap.width() - x);
-    int effectiveHeight = Gosu::clamp<int>(fontHeight, 0, bitmap.height() - y);
+    // The same special cases as in textWidth.
+    if (text.empty())
+        return Bitmap(1, fontHeight);
     
-    for (int relY = 0; relY < effectiveHeight; ++relY)
-        for (int relX = 0; relX < effectiveWidth; ++relX)
-        {
-#ifdef __BIG_ENDIAN__
-            Color::Channel alpha = buf[relY * width + relX];
-#else
-            Color::Channel alpha = Color(buf[relY * width + relX]).alpha();
+    ATSULayoutAndStyle atlas(text, fontName, fontHeight, fontFlags);
+    Rect rect = atlas.textExtents();
+    // Spaces still have to be drawn, in case they are underlined.
+    unsigned width = text == L" " ? fontHeight / 3 : rect.right + 1 - rect.left + 1;
+    Bitmap result(width, fontHeight);
+    drawLayout(result, atlas, rect, 0, 0, c, fontName, fontHeight);
+    return result;
+}
+
 #endif
             if (alpha != 0)
                 bitmap.setPixel(x + relX, y + relY, multiply(c, Color(alpha, 0xff, 0xff, 0xff)));
@@ -7,6 +7,7 @@
 #include <Gosu/Utility.hpp>
 #include <Gosu/Math.hpp>
 #include <GosuImpl/MacUtility.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
 #include <map>
 #include <cmath>
 using namespace std;
@@ -128,26 +129,98 @@ namespace
 }
 #endif
 
+namespace
+{
+    // Measures the text at fontHeight points. This will, of course, compute a
+    // too large size; fontHeight is in pixels, the methods expect points.
+    void measure(NSString* string, const wstring& fontName, unsigned fontHeight,
+        unsigned fontFlags, double& width, double& height)
+    {
+        OSXFont* font = getFont(fontName, fontFlags, fontHeight);
+        #ifndef GOSU_IS_IPHONE
+        ObjRef<NSDictionary> attributes(attributeDictionary(font, fontFlags));
+        NSSize size = [string sizeWithAttributes: attributes.get()];
+        #else
+        CGSize size = [string sizeWithFont: font];
+        #endif
+        width = size.width;
+        height = size.height;
+    }
+    
+    // Draws text that has been measured at the given height, width pixels wide.
+    void drawMeasuredText(Gosu::Bitmap& bitmap, NSString* string, double measuredHeight,
+        unsigned width, int x, int y, Gosu::Color c, const wstring& fontName,
+        unsigned fontHeight, unsigned fontFlags)
+    {
+        // Get the width and height of the image
+        Gosu::Bitmap bmp(width, fontHeight);
+        
+        // Use a temporary context to draw the CGImage to the buffer.
+        CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+        CGContextRef context =
+            CGBitmapContextCreate(bmp.data(),
+                                  bmp.width(), bmp.height(), 8, bmp.width() * 4,
+                                  colorSpace,
+                                  kCGImageAlphaPremultipliedLast);
+        CGColorSpaceRelease(colorSpace);
+        #ifdef GOSU_IS_IPHONE
+        CGFloat color[] = { 1.f, 1.f, 1.f, 0.f };
+        CGContextSetStrokeColor(context, color);
+        CGContextSetFillColor(context, color);
+        #endif
+        
+        // Use new font with proper size this time.
+        OSXFont* font = getFont(fontName, fontFlags, fontHeight * fontHeight / measuredHeight);
+
+        #ifdef GOSU_IS_IPHONE
+        CGContextTranslateCTM(context, 0, fontHeight);
+        CGContextScaleCTM(context, 1, -1);
+        UIGraphicsPushContext(context);
+            [string drawAtPoint: CGPointZero withFont: font];
+        UIGraphicsPopContext();
+        #else
+        NSPoint NSPointZero = { 0, 0 };
+        ObjRef<NSDictionary> attributes(attributeDictionary(font, fontFlags));
+        
+        [NSGraphicsContext saveGraphicsState];
+        [NSGraphicsContext setCurrentContext:
+            [NSGraphicsContext graphicsContextWithGraphicsPort:(void *)context flipped:false]];
+        [string drawAtPoint: NSPointZero withAttributes: attributes.get()];
+        [NSGraphicsContext restoreGraphicsState];
+        #endif
+        CGContextRelease(context);
+
+        int effectiveWidth = Gosu::clamp<int>(width, 0, bitmap.width() - x);
+        int effectiveHeight = Gosu::clamp<int>(fontHeight, 0, bitmap.height() - y);
+        
+        // Now copy the set pixels back.
+        for (int relY = 0; relY < effectiveHeight; ++relY)
+            for (int relX = 0; relX < effectiveWidth; ++relX)
+            {
+                c.setAlpha(bmp.getPixel(relX, relY).alpha());
+                if (c.alpha())
+                    bitmap.setPixel(x + relX, y + relY, c);
+            }
+    }
+}
+
+bool Gosu::isReentrantFont(const wstring& fontName)
+{
+    return false;
+}
+
 unsigned Gosu::textWidth(const wstring& text,
     const wstring& fontName, unsigned fontHeight, unsigned fontFlags)
 {
     if (text.find_first_of(L"\r\n") != wstring::npos)
         throw std::invalid_argument("the argument to textWidth cannot contain line breaks");
     
-    OSXFont* font = getFont(fontName, fontFlags, fontHeight);
-    
-    // This will, of course, compute a too large size; fontHeight is in pixels,
-    // the method expects point.
     ObjRef<NSString> string([[NSString alloc] initWithUTF8String: wstringToUTF8(text).c_str()]);
-    #ifndef GOSU_IS_IPHONE
-    ObjRef<NSDictionary> attributes(attributeDictionary(font, fontFlags));
-    NSSize size = [string.obj() sizeWithAttributes: attributes.get()];
-    #else
-    CGSize size = [string.obj() sizeWithFont: font];
-    #endif
+    double width, height;
+    measure(string.obj(), fontName, fontHeight, fontFlags, width, height);
     
     // Now adjust the scaling...
-    return ceil(size.width / size.height * fontHeight);
+    return ceil(width / height * fontHeight);
 }
 
 void Gosu::drawText(Bitmap& bitmap, const wstring& text, int x, int y,
@@ -157,16 +230,30 @@ void Gosu::drawText(Bitmap& bitmap, const wstring& text, int x, int y,
     if (text.find_first_of(L"\r\n") != wstring::npos)
         throw std::invalid_argument("the argument to drawText cannot contain line breaks");
     
-    OSXFont* font = getFont(fontName, fontFlags, fontHeight);
     ObjRef<NSString> string([[NSString alloc] initWithUTF8String: wstringToUTF8(text).c_str()]);
+    double width, height;
+    measure(string.obj(), fontName, fontHeight, fontFlags, width, height);
+    drawMeasuredText(bitmap, string.obj(), height, round(width / height * fontHeight),
+        x, y, c, fontName, fontHeight, fontFlags);
+}
 
-    // This will, of course, compute a too large size; fontHeight is in pixels, the method expects point.
-    #ifndef GOSU_IS_IPHONE
-    ObjRef<NSDictionary> attributes(attributeDictionary(font, fontFlags));
-    NSSize size = [string.obj() sizeWithAttributes: attributes.get()];
-    #else
-    CGSize size = [string.obj() sizeWithFont: font];
-    #endif
+Gosu::Bitmap Gosu::renderText(const wstring& text, Color c,
+    const wstring& fontName, unsigned fontHeight, unsigned fontFlags)
+{
+    if (text.find_first_of(L"\r\n") != wstring::npos)
+        throw std::invalid_argument("the argument to renderText cannot contain line breaks");
+    
+    ObjRef<NSString> string([[NSString alloc] initWithUTF8String: wstringToUTF8(text).c_str()]);
+    double width, height;
+    measure(string.obj(), fontName, fontHeight, fontFlags, width, height);
+    // As wide as textWidth says.
+    Bitmap result(ceil(width / height * fontHeight), fontHeight);
+    drawMeasuredText(result, string.obj(), height, result.width(),
+        0, 0, c, fontName, fontHeight, fontFlags);
+    return result;
+}
+
+#endif
     
     unsigned width = round(size.width / size.height * fontHeight);
 
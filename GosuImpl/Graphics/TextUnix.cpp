@@ -1,15 +1,24 @@
 #include <Gosu/Text.hpp>
 #include <Gosu/Bitmap.hpp>
+#include <Gosu/Trace.hpp>
 #include <Gosu/Utility.hpp>
+#include <GosuImpl/Graphics/BitmapPool.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
+#include <GosuImpl/Graphics/PixelKernels.hpp>
+#include <GosuImpl/Threading.hpp>
 
 #include <pango/pango.h>
 #include <pango/pangoft2.h>
 #include <glib.h>
 #include <SDL/SDL_ttf.h>
 
+#include <algorithm>
+#include <map>
 #include <string>
 #include <cstring>
+#include <utility>
 #include <stdexcept>
+#include <vector>
 
 std::wstring Gosu::defaultFontName()
 {
@@ -20,6 +29,11 @@ namespace Gosu
 {
     // Used for system fonts
     // Adapted from original version by Jan Lücker
+    // Setting up Pango is expensive, so renderers are kept and reused, each
+    // with its context, its layout and a description for every font it has
+    // seen. Each renderer also has its own font map, so that several
+    // threads can render text at once, each with a renderer of its own
+    // (see PangoLease).
     class PangoRenderer
     {
         PangoRenderer(const PangoRenderer&);
@@ -27,47 +41,54 @@ namespace Gosu
         
         int width, height;
 
+        PangoFontMap* fontMap;
         PangoContext* context;
         PangoLayout* layout;
-        PangoFontDescription *font_description;
-        PangoAttribute* attr;
-        PangoAttrList* attrList;
+        
+        typedef std::pair<std::pair<std::wstring, unsigned>, unsigned> FontKey;
+        typedef std::map<FontKey, PangoFontDescription*> Descriptions;
+        Descriptions descriptions;
 
     public:
         PangoRenderer()
+        : width(0), height(0)
         {
-            font_description = NULL;
-            attr = NULL;
-            attrList = NULL;
+            GOSU_TRACE_STARTUP("Font backend setup");
+            g_type_init();
+
+            int dpi_x = 100, dpi_y = 100;
+            fontMap = pango_ft2_font_map_new();
+            pango_ft2_font_map_set_resolution(PANGO_FT2_FONT_MAP(fontMap), dpi_x, dpi_y);
+            context = pango_ft2_font_map_create_context(PANGO_FT2_FONT_MAP(fontMap));
+            pango_context_set_language(context, pango_language_from_string ("en_US"));
+            pango_context_set_base_dir(context, PANGO_DIRECTION_LTR);
+
+            layout = pango_layout_new(context);
+            pango_layout_set_alignment(layout, PANGO_ALIGN_LEFT);
+            pango_layout_set_width(layout, -1);
         }
+        
         ~PangoRenderer()
         {
-            g_object_unref(context);
+            for (Descriptions::iterator it = descriptions.begin(); it != descriptions.end(); ++it)
+                pango_font_description_free(it->second);
             g_object_unref(layout);
-
-            if(font_description)
-                pango_font_description_free(font_description);
-            if(attr)
-                pango_attribute_destroy(attr);
+            g_object_unref(context);
+            g_object_unref(fontMap);
         }
-        unsigned textWidth(const std::wstring& text,
-            const std::wstring& fontFace, unsigned fontHeight,
-            unsigned fontFlags)
+        
+    private:
+        PangoFontDescription* description(const std::wstring& fontFace,
+            unsigned fontHeight, unsigned fontFlags)
         {
-            g_type_init();
-
-            int dpi_x = 100, dpi_y = 100;
-
-            context = pango_ft2_get_context(dpi_x, dpi_y);
-
-            pango_context_set_language(context, pango_language_from_string ("en_US"));
-            PangoDirection init_dir = PANGO_DIRECTION_LTR;
-            pango_context_set_base_dir(context, init_dir);
-
-            font_description = pango_font_description_new();
-
-            pango_font_description_set_family(font_description,
-                g_strdup(narrow(fontFace).c_str()));
+            // Underlining is an attribute of the text, not of the font.
+            FontKey key(std::make_pair(fontFace, fontHeight), fontFlags & (ffBold | ffItalic));
+            Descriptions::iterator it = descriptions.find(key);
+            if (it != descriptions.end())
+                return it->second;
+            
+            PangoFontDescription* font_description = pango_font_description_new();
+            pango_font_description_set_family(font_description, narrow(fontFace).c_str());
             pango_font_description_set_style(font_description,
                 (fontFlags & ffItalic) ? PANGO_STYLE_ITALIC : PANGO_STYLE_NORMAL);
             pango_font_description_set_variant(font_description, PANGO_VARIANT_NORMAL);
@@ -76,52 +97,72 @@ namespace Gosu
             pango_font_description_set_stretch(font_description, PANGO_STRETCH_NORMAL);
             int init_scale = int(fontHeight/2.0 + 0.5);
             pango_font_description_set_size(font_description, init_scale * PANGO_SCALE);
+            descriptions[key] = font_description;
+            return font_description;
+        }
+        
+        // Lays out the text in the shared layout and measures it.
+        void layOut(const std::wstring& text, const std::wstring& fontFace,
+            unsigned fontHeight, unsigned fontFlags)
+        {
+            pango_layout_set_font_description(layout,
+                description(fontFace, fontHeight, fontFlags));
 
-            pango_context_set_font_description(context, font_description);
-
-
-            layout = pango_layout_new(context);
-
+            // IMPR: Catch errors? (Last NULL-Pointer)
+            gchar* utf8Str = g_ucs4_to_utf8((gunichar*)text.c_str(), text.length(), NULL, NULL, NULL);
+            pango_layout_set_text(layout, utf8Str, -1);
 
             if(fontFlags & ffUnderline)
             {
-        //        PangoAttribute *attr;
-                attr = pango_attr_underline_new(PANGO_UNDERLINE_SINGLE);
+                PangoAttribute* attr = pango_attr_underline_new(PANGO_UNDERLINE_SINGLE);
                 attr->start_index = 0;
-                attr->end_index = text.length();
-        //        PangoAttrList* attrList;
-                attrList = pango_attr_list_new();
+                attr->end_index = std::strlen(utf8Str);
+                PangoAttrList* attrList = pango_attr_list_new();
                 pango_attr_list_insert(attrList, attr);
                 pango_layout_set_attributes(layout, attrList);
                 pango_attr_list_unref(attrList);
             }
-
-
-            // IMPR: Catch errors? (Last NULL-Pointer)
-            gchar* utf8Str = g_ucs4_to_utf8((gunichar*)text.c_str(), text.length(), NULL, NULL, NULL);
-            pango_layout_set_text(layout, utf8Str, -1);
+            else
+                pango_layout_set_attributes(layout, NULL);
             g_free(utf8Str);
 
-            PangoDirection base_dir = pango_context_get_base_dir(context);
-            pango_layout_set_alignment(layout,
-                base_dir == PANGO_DIRECTION_LTR ? PANGO_ALIGN_LEFT : PANGO_ALIGN_RIGHT);
-
-            pango_layout_set_width(layout, -1);
-
             PangoRectangle logical_rect;
-
             pango_layout_get_pixel_extents(layout, NULL, &logical_rect);
             height = logical_rect.height;
             width = logical_rect.width;
+        }
 
+    public:
+        unsigned textWidth(const std::wstring& text,
+            const std::wstring& fontFace, unsigned fontHeight,
+            unsigned fontFlags)
+        {
+            layOut(text, fontFace, fontHeight, fontFlags);
             return width;
         }
+        
         void drawText(Bitmap& bitmap, const std::wstring& text, int x, int y,
             Color c, const std::wstring& fontFace, unsigned fontHeight,
             unsigned fontFlags)
         {
-            textWidth(text, fontFace, fontHeight, fontFlags);
-
+            layOut(text, fontFace, fontHeight, fontFlags);
+            drawLayout(bitmap, x, y, c, fontHeight);
+        }
+        
+        Bitmap renderText(const std::wstring& text, Color c,
+            const std::wstring& fontFace, unsigned fontHeight,
+            unsigned fontFlags)
+        {
+            layOut(text, fontFace, fontHeight, fontFlags);
+            Bitmap result(width, fontHeight);
+            drawLayout(result, 0, 0, c, fontHeight);
+            return result;
+        }
+        
+    private:
+        // Draws what layOut has prepared.
+        void drawLayout(Bitmap& bitmap, int x, int y, Color c, unsigned fontHeight)
+        {
             FT_Bitmap ft_bitmap;
 
             guchar* buf = new guchar[width * height];
@@ -141,24 +182,62 @@ namespace Gosu
             int min_height = height;
             if((unsigned)height > fontHeight) min_height = fontHeight;
 
+            int rowLength = std::min(width, int(bitmap.width()) - x);
+            if (x < 0 || rowLength <= 0)
+                min_height = 0;
+
             for(int y2 = 0; y2 < min_height; y2++)
             {
                 if (y + y2 < 0 || y + y2 >= bitmap.height())
                     break;
 
-                for(int x2 = 0; x2 < width; x2++)
-                {
-                    if (x + x2 < 0 || x + x2 >= bitmap.width())
-                        break;
-                    unsigned val = ft_bitmap.buffer[y2*width+x2];
-                    Color color = multiply(c, Gosu::Color(val, 255, 255, 255));
-                    bitmap.setPixel(x2 + x, y2 + y, color);
-                }
+                Pixels::colorByCoverage(bitmap.data() + (y + y2) * bitmap.width() + x,
+                    ft_bitmap.buffer + y2 * width, rowLength, c);
             }
 
             delete[] buf;
         }
     };
+    
+    namespace
+    {
+        Mutex idleRenderersMutex;
+        std::vector<PangoRenderer*> idleRenderers;
+    }
+    
+    // Borrows an idle renderer for the current thread, or creates one if
+    // all of them are in use. Usually there is only one.
+    class PangoLease
+    {
+        PangoLease(const PangoLease&);
+        PangoLease& operator=(const PangoLease&);
+        
+        PangoRenderer* renderer;
+        
+    public:
+        PangoLease()
+        {
+            Lock lock(idleRenderersMutex);
+            if (idleRenderers.empty())
+                renderer = new PangoRenderer;
+            else
+            {
+                renderer = idleRenderers.back();
+                idleRenderers.pop_back();
+            }
+        }
+        
+        ~PangoLease()
+        {
+            Lock lock(idleRenderersMutex);
+            idleRenderers.push_back(renderer);
+        }
+        
+        PangoRenderer* operator->() const
+        {
+            return renderer;
+        }
+    };
 
 
     // Used for custom TTF files
@@ -239,16 +318,30 @@ namespace Gosu
             return SDLSurface(font, text, 0xffffff).width();
         }
 
+        Bitmap renderText(const std::wstring& text, Gosu::Color c, unsigned fontHeight) {
+            SDLSurface surf(font, text, c);
+            Gosu::Bitmap result(surf.width(), fontHeight);
+            unsigned rows = std::min(surf.height(), fontHeight);
+            std::memcpy(result.data(), surf.data(), result.width() * rows * 4);
+            return result;
+        }
+
         void drawText(Bitmap& bmp, const std::wstring& text, int x, int y, Gosu::Color c) {
             SDLSurface surf(font, text, c);
-            Gosu::Bitmap temp;
-            temp.resize(surf.width(), surf.height());
-            std::memcpy(temp.data(), surf.data(), temp.width() * temp.height() * 4);
-            bmp.insert(temp, x, y);
+            Gosu::ScratchBitmap temp;
+            temp->resize(surf.width(), surf.height());
+            std::memcpy(temp->data(), surf.data(), temp->width() * temp->height() * 4);
+            bmp.insert(*temp, x, y);
         }
     };
 }
 
+bool Gosu::isReentrantFont(const std::wstring& fontName)
+{
+    // SDL_ttf is not reentrant.
+    return fontName.find(L"/") == std::wstring::npos;
+}
+
 unsigned Gosu::textWidth(const std::wstring& text,
     const std::wstring& fontName, unsigned fontHeight,
     unsigned fontFlags)
@@ -257,7 +350,7 @@ unsigned Gosu::textWidth(const std::wstring& text,
         throw std::invalid_argument("the argument to textWidth cannot contain line breaks");
     
     if (fontName.find(L"/") == std::wstring::npos)
-        return PangoRenderer().textWidth(text, fontName, fontHeight, fontFlags);
+        return PangoLease()->textWidth(text, fontName, fontHeight, fontFlags);
     else
         return SDLTTFRenderer(fontName, fontHeight).textWidth(text);
 }
@@ -270,7 +363,19 @@ void Gosu::drawText(Bitmap& bitmap, const std::wstring& text, int x, int y,
         throw std::invalid_argument("the argument to drawText cannot contain line breaks");
     
     if (fontName.find(L"/") == std::wstring::npos)
-        PangoRenderer().drawText(bitmap, text, x, y, c, fontName, fontHeight, fontFlags);
+        PangoLease()->drawText(bitmap, text, x, y, c, fontName, fontHeight, fontFlags);
     else
         SDLTTFRenderer(fontName, fontHeight).drawText(bitmap, text, x, y, c);
 }
+
+Gosu::Bitmap Gosu::renderText(const std::wstring& text, Color c,
+    const std::wstring& fontName, unsigned fontHeight, unsigned fontFlags)
+{
+    if (text.find_first_of(L"\r\n") != std::wstring::npos)
+        throw std::invalid_argument("the argument to renderText cannot contain line breaks");
+    
+    if (fontName.find(L"/") == std::wstring::npos)
+        return PangoLease()->renderText(text, c, fontName, fontHeight, fontFlags);
+    else
+        return SDLTTFRenderer(fontName, fontHeight).renderText(text, c, fontHeight);
+}
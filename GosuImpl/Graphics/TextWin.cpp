@@ -3,8 +3,10 @@
 
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/Text.hpp>
+#include <Gosu/Trace.hpp>
 #include <Gosu/Utility.hpp>
 #include <Gosu/WinUtility.hpp>
+#include <GosuImpl/Graphics/Common.hpp>
 #include <cstdlib>
 #include <cwchar>
 #include <algorithm>
@@ -118,6 +120,7 @@ namespace Gosu
 					std::make_pair(fontName, fontHeight | fontFlags << 16);
                 if (loadedFonts.count(key) == 0)
                 {
+                    GOSU_TRACE_STARTUP("Font backend setup");
                     LOGFONT logfont = { fontHeight, 0, 0, 0,
                         fontFlags & ffBold ? FW_BOLD : FW_NORMAL,
                         fontFlags & ffItalic ? TRUE : FALSE,
@@ -142,6 +145,12 @@ namespace Gosu
     }
 };
 
+bool Gosu::isReentrantFont(const std::wstring& fontName)
+{
+    // Loaded fonts are kept in maps that are not synchronized.
+    return false;
+}
+
 unsigned Gosu::textWidth(const std::wstring& text,
     const std::wstring& fontName, unsigned fontHeight, unsigned fontFlags)
 {
@@ -158,6 +167,41 @@ unsigned Gosu::textWidth(const std::wstring& text,
     return size.cx;
 }
 
+namespace
+{
+    // Draws text whose width has already been measured.
+    void drawMeasuredText(Gosu::Bitmap& bitmap, const std::wstring& text, int x, int y,
+        Gosu::Color c, const std::wstring& fontName, unsigned fontHeight,
+        unsigned fontFlags, unsigned width)
+    {
+        using namespace Gosu;
+        
+        WinBitmap helper(width, fontHeight);
+        helper.selectFont(fontName, fontHeight, fontFlags);
+
+        if (::SetTextColor(helper.context(), 0xffffff) == CLR_INVALID)
+            Win::throwLastError("setting the text color");
+
+        Win::check(::SetBkMode(helper.context(), TRANSPARENT),
+            "setting a bitmap's background mode to TRANSPARENT");
+
+        ::ExtTextOut(helper.context(), 0, 0, 0, 0, text.c_str(), text.length(), 0);
+        
+        for (unsigned relY = 0; relY < fontHeight; ++relY)
+            for (unsigned relX = 0; relX < width; ++relX)
+            {
+                Color pixel = c;
+                Color::Channel srcAlpha = GetPixel(helper.context(), relX, relY) & 0xff;
+                if (srcAlpha == 0)
+                    continue;
+                pixel = multiply(c, Color(srcAlpha, 255, 255, 255));
+                if (pixel != 0 && x + relX >= 0 && x + relX < bitmap.width() &&
+                    y + relY >= 0 && y + relY < bitmap.height())
+                    bitmap.setPixel(x + relX, y + relY, pixel);
+            }
+    }
+}
+
 void Gosu::drawText(Bitmap& bitmap, const std::wstring& text, int x, int y,
     Color c, const std::wstring& fontName, unsigned fontHeight,
     unsigned fontFlags)
@@ -166,28 +210,17 @@ void Gosu::drawText(Bitmap& bitmap, const std::wstring& text, int x, int y,
         throw std::invalid_argument("the argument to drawText cannot contain line breaks");
     
     unsigned width = textWidth(text, fontName, fontHeight, fontFlags);
+    drawMeasuredText(bitmap, text, x, y, c, fontName, fontHeight, fontFlags, width);
+}
 
-    WinBitmap helper(width, fontHeight);
-    helper.selectFont(fontName, fontHeight, fontFlags);
-
-    if (::SetTextColor(helper.context(), 0xffffff) == CLR_INVALID)
-        Win::throwLastError("setting the text color");
-
-    Win::check(::SetBkMode(helper.context(), TRANSPARENT),
-        "setting a bitmap's background mode to TRANSPARENT");
-
-    ::ExtTextOut(helper.context(), 0, 0, 0, 0, text.c_str(), text.length(), 0);
+Gosu::Bitmap Gosu::renderText(const std::wstring& text, Color c,
+    const std::wstring& fontName, unsigned fontHeight, unsigned fontFlags)
+{
+    if (text.find_first_of(L"\r\n") != std::wstring::npos)
+        throw std::invalid_argument("the argument to renderText cannot contain line breaks");
     
-    for (unsigned relY = 0; relY < fontHeight; ++relY)
-        for (unsigned relX = 0; relX < width; ++relX)
-        {
-            Color pixel = c;
-            Color::Channel srcAlpha = GetPixel(helper.context(), relX, relY) & 0xff;
-            if (srcAlpha == 0)
-                continue;
-            pixel = multiply(c, Color(srcAlpha, 255, 255, 255));
-            if (pixel != 0 && x + relX >= 0 && x + relX < bitmap.width() &&
-                y + relY >= 0 && y + relY < bitmap.height())
-                bitmap.setPixel(x + relX, y + relY, pixel);
-        }
+    unsigned width = textWidth(text, fontName, fontHeight, fontFlags);
+    Bitmap result(width, fontHeight);
+    drawMeasuredText(result, text, 0, 0, c, fontName, fontHeight, fontFlags, width);
+    return result;
 }
@@ -1,53 +1,332 @@
 #include <Gosu/Graphics.hpp>
 #include <GosuImpl/Graphics/Texture.hpp>
+#include <GosuImpl/Graphics/BitmapPool.hpp>
 #include <GosuImpl/Graphics/TexChunk.hpp>
+#include <GosuImpl/Graphics/PixelKernels.hpp>
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/Platform.hpp>
+#include <algorithm>
+#include <cstring>
+#include <set>
 #include <stdexcept>
 
 namespace Gosu
 {
     bool undocumentedRetrofication = false;
+    
+    namespace
+    {
+        // All living textures, for inspection. Deliberately never destroyed,
+        // since textures may outlive static destruction (e.g. in Ruby).
+        typedef std::set<const Texture*> TextureRegistry;
+        TextureRegistry& textureRegistry()
+        {
+            static TextureRegistry* registry = new TextureRegistry;
+            return *registry;
+        }
+        
+        // Below this many pixels, uploading from client memory is cheaper
+        // than setting up a pixel buffer.
+        const unsigned PIXEL_BUFFER_MIN_PIXELS = 256 * 256;
+        
+        // Below this many pixels, copying an image into a padded bitmap is
+        // cheaper than uploading its borders one by one.
+        const unsigned SEPARATE_BORDERS_MIN_PIXELS = 64 * 64;
+        
+        // Returns a bitmap of the given size with bmp at (offset; offset),
+        // with its outermost pixels repeated to fill everything around it.
+        Bitmap extendEdges(const BitmapView& bmp, unsigned offset, unsigned width, unsigned height)
+        {
+            Bitmap result(width, height);
+            for (unsigned y = 0; y < height; ++y)
+            {
+                int srcY = std::min<int>(std::max<int>(int(y) - int(offset), 0), bmp.height() - 1);
+                for (unsigned x = 0; x < width; ++x)
+                {
+                    int srcX = std::min<int>(std::max<int>(int(x) - int(offset), 0), bmp.width() - 1);
+                    result.setPixel(x, y, bmp.getPixel(srcX, srcY));
+                }
+            }
+            return result;
+        }
+        
+        // Box filter that weighs colors by their alpha, so that transparent
+        // borders do not darken the edges.
+        Bitmap halve(const BitmapView& bmp)
+        {
+            Bitmap result(bmp.width() / 2, bmp.height() / 2);
+            for (unsigned y = 0; y < result.height(); ++y)
+                for (unsigned x = 0; x < result.width(); ++x)
+                {
+                    unsigned a = 0, r = 0, g = 0, b = 0;
+                    for (unsigned i = 0; i < 4; ++i)
+                    {
+                        Color c = bmp.getPixel(x * 2 + i % 2, y * 2 + i / 2);
+                        a += c.alpha();
+                        r += c.red() * c.alpha();
+                        g += c.green() * c.alpha();
+                        b += c.blue() * c.alpha();
+                    }
+                    if (a > 0)
+                        result.setPixel(x, y, Color(a / 4, r / a, g / a, b / a));
+                }
+            return result;
+        }
+        
+        // Splits the t coordinate back into the layer and the position on it
+        // (see TextureArray::layerOffset), and otherwise does what the
+        // fixed-function pipeline would.
+        const char* ARRAY_VERTEX_SOURCE =
+            "#version 130\n"
+            "out vec3 texCoord;\n"
+            "out vec4 color;\n"
+            "void main()\n"
+            "{\n"
+            "    gl_Position = ftransform();\n"
+            "    float layer = floor(gl_MultiTexCoord0.t * 0.5);\n"
+            "    texCoord = vec3(gl_MultiTexCoord0.s, gl_MultiTexCoord0.t - 2.0 * layer, layer);\n"
+            "    color = gl_Color;\n"
+            "}\n";
+        const char* ARRAY_FRAGMENT_SOURCE =
+            "#version 130\n"
+            "uniform sampler2DArray pages;\n"
+            "in vec3 texCoord;\n"
+            "in vec4 color;\n"
+            "void main()\n"
+            "{\n"
+            "    gl_FragColor = texture(pages, texCoord) * color;\n"
+            "}\n";
+        
+        void setTextureParameters(GLenum target, bool mipmapped)
+        {
+            if (undocumentedRetrofication)
+            {
+                glTexParameteri(target, GL_TEXTURE_MIN_FILTER,
+                    mipmapped ? GL_NEAREST_MIPMAP_NEAREST : GL_NEAREST);
+                glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            }
+            else
+                glTexParameteri(target, GL_TEXTURE_MIN_FILTER,
+                    mipmapped ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+            
+            if (mipmapped)
+                glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, Texture::MIPMAP_LEVELS);
+            
+#ifdef GL_CLAMP_TO_EDGE
+            glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+#else
+            glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP);
+            glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP);
+#endif
+        }
+    }
 }
 
-Gosu::Texture::Texture(unsigned size)
-: allocator(size, size), num(0)
+Gosu::TextureArray::TextureArray(unsigned size, unsigned layers)
+: arraySize(size), usedLayers(layers),
+  counted(mcAtlasTextures, static_cast<unsigned long>(size) * size * 4 * layers)
 {
-    // Create texture name.
     glGenTextures(1, &name);
     if (name == static_cast<GLuint>(-1))
-        throw std::runtime_error("Couldn't create OpenGL texture");
-   
-    // Create empty texture.
-    glBindTexture(GL_TEXTURE_2D, name);
+        throw std::runtime_error("Couldn't create OpenGL texture array");
+    
+    glBindTexture(GL_TEXTURE_2D_ARRAY, name);
+    setTextureParameters(GL_TEXTURE_2D_ARRAY, false);
+    glTextureArrayFunctions().texImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, size, size, layers,
+        0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+}
+
+Gosu::TextureArray::~TextureArray()
+{
+    glDeleteTextures(1, &name);
+}
+
+bool Gosu::TextureArray::allocLayer(unsigned& layer)
+{
+    std::vector<bool>::iterator it = std::find(usedLayers.begin(), usedLayers.end(), false);
+    if (it == usedLayers.end())
+        return false;
+    *it = true;
+    layer = it - usedLayers.begin();
+    return true;
+}
+
+void Gosu::TextureArray::freeLayer(unsigned layer)
+{
+    usedLayers.at(layer) = false;
+}
+
+Gosu::ShaderProgram* Gosu::TextureArray::program()
+{
+    // Like the texture registry, deliberately never destroyed. The sampler
+    // uniform stays at its default, texture unit 0.
+    static ShaderProgram* program =
+        new ShaderProgram(ARRAY_VERTEX_SOURCE, ARRAY_FRAGMENT_SOURCE);
+    return program;
+}
+
+Gosu::Texture::Texture(unsigned size, bool dedicated, bool mipmapped, PixelFormat format)
+: allocator(size, size), num(0), dedicated(dedicated), mipmapped(mipmapped),
+  pixelFormat(format), glFormat(Color::GL_FORMAT), glType(GL_UNSIGNED_BYTE), pixelSize(4),
+  bytes(0), lastDrawn(0), counted(dedicated ? mcDedicatedTextures : mcAtlasTextures)
+{
 #ifdef GOSU_IS_IPHONE
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, allocator.width(), allocator.height(), 0,
-                 GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    GLint internalFormat = GL_RGBA;
+    // OpenGL ES has no intensity textures, see below.
+    if (pixelFormat == pfAlpha8 && premultipliedAlpha)
+        pixelFormat = pfRGBA8888;
 #else
-    glTexImage2D(GL_TEXTURE_2D, 0, 4, allocator.width(), allocator.height(), 0,
-                 GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    GLint internalFormat = 4;
+#endif
+    
+    create();
+    
+    switch (pixelFormat)
+    {
+    case pfRGBA8888:
+        break;
+    case pfRGBA4444:
+        glFormat = GL_RGBA, glType = GL_UNSIGNED_SHORT_4_4_4_4, pixelSize = 2;
+#ifndef GOSU_IS_IPHONE
+        internalFormat = GL_RGBA4;
+#endif
+        break;
+    case pfRGB565:
+        glFormat = GL_RGB, glType = GL_UNSIGNED_SHORT_5_6_5, pixelSize = 2;
+#ifndef GOSU_IS_IPHONE
+        internalFormat = GL_RGB5;
 #endif
+        break;
+    case pfAlpha8:
+        glFormat = GL_ALPHA, pixelSize = 1;
+        internalFormat = GL_ALPHA;
+#ifndef GOSU_IS_IPHONE
+        if (hasTextureSwizzle())
+        {
+            // White with alpha, or the same premultiplied.
+            const GLint white[4] = { GL_ONE, GL_ONE, GL_ONE, GL_RED };
+            const GLint premultiplied[4] = { GL_RED, GL_RED, GL_RED, GL_RED };
+            glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA,
+                premultipliedAlpha ? premultiplied : white);
+            glFormat = GL_RED, internalFormat = GL_R8;
+        }
+        // Without swizzles, the fixed-function pipeline still gets it right:
+        // Alpha textures leave the color as it is, and intensity textures
+        // multiply it and the alpha by the same value.
+        else if (premultipliedAlpha)
+            glFormat = GL_LUMINANCE, internalFormat = GL_INTENSITY8;
+        else
+            internalFormat = GL_ALPHA8;
+#endif
+        break;
+    }
+   
+    // Create empty texture.
+    for (unsigned level = 0; level <= (mipmapped ? MIPMAP_LEVELS : 0); ++level)
+    {
+        unsigned levelSize = std::max(size >> level, 1u);
+        bytes += static_cast<unsigned long>(levelSize) * levelSize * pixelSize;
+        glTexImage2D(GL_TEXTURE_2D, level, internalFormat, levelSize, levelSize, 0,
+                     glFormat == Color::GL_FORMAT ? GL_RGBA : glFormat, glType, 0);
+    }
+    counted.set(bytes);
+}
+
+Gosu::Texture::Texture(unsigned size, const CompressedTexture& data)
+: allocator(size, size), num(0), dedicated(true), mipmapped(false),
+  pixelFormat(pfRGBA8888), glFormat(Color::GL_FORMAT), glType(GL_UNSIGNED_BYTE), pixelSize(4),
+  bytes(data.bytesFor(size, size)), lastDrawn(0), counted(mcDedicatedTextures, bytes)
+{
+    create();
     
-    if (undocumentedRetrofication)
+    const GLCompressionFunctions& compression = glCompressionFunctions();
+    if (data.width == size && data.height == size)
+        compression.compressedTexImage2D(GL_TEXTURE_2D, 0, data.format, size, size, 0,
+            data.data.size(), &data.data[0]);
+    else
     {
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        // Block formats can be updated in units of whole blocks.
+        std::vector<char> empty(bytes);
+        compression.compressedTexImage2D(GL_TEXTURE_2D, 0, data.format, size, size, 0,
+            empty.size(), &empty[0]);
+        unsigned width = (data.width + data.blockWidth - 1) / data.blockWidth * data.blockWidth;
+        unsigned height = (data.height + data.blockHeight - 1) / data.blockHeight * data.blockHeight;
+        compression.compressedTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, data.format,
+            data.bytesFor(width, height), &data.data[0]);
     }
+}
+
+Gosu::Texture::Texture(const std::tr1::shared_ptr<TextureArray>& array, unsigned layer)
+: allocator(array->size(), array->size()), name(array->texName()), num(0), dedicated(false),
+  mipmapped(false), pixelFormat(pfRGBA8888), glFormat(Color::GL_FORMAT), glType(GL_UNSIGNED_BYTE),
+  pixelSize(4), bytes(static_cast<unsigned long>(array->size()) * array->size() * 4),
+  lastDrawn(0), counted(mcAtlasTextures), array(array), arrayLayer(layer)
+{
+    // The array counts the memory of all its layers up front.
+    textureRegistry().insert(this);
+}
+
+void Gosu::Texture::create()
+{
+    // Create texture name.
+    glGenTextures(1, &name);
+    if (name == static_cast<GLuint>(-1))
+        throw std::runtime_error("Couldn't create OpenGL texture");
+    
+    glBindTexture(GL_TEXTURE_2D, name);
+    setTextureParameters(GL_TEXTURE_2D, mipmapped);
+    
+    textureRegistry().insert(this);
+}
+
+void Gosu::Texture::bind() const
+{
+    glBindTexture(target(), name);
+}
+
+void Gosu::Texture::texSubImage(const BlockAllocator::Block& block, const GLvoid* pixels)
+{
+    if (array)
+        glTextureArrayFunctions().texSubImage3D(GL_TEXTURE_2D_ARRAY, 0, block.left, block.top,
+            arrayLayer, block.width, block.height, 1, Color::GL_FORMAT, GL_UNSIGNED_BYTE, pixels);
     else
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, block.left, block.top, block.width, block.height,
+            Color::GL_FORMAT, GL_UNSIGNED_BYTE, pixels);
+}
+
+void Gosu::Texture::texSubImagePacked(unsigned level, unsigned x, unsigned y,
+    const BitmapView& bmp)
+{
+    if (bmp.width() * bmp.height() == 0)
+        return;
     
-#ifdef GL_CLAMP_TO_EDGE
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-#else
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-#endif
+    std::vector<unsigned char> packed(bmp.width() * bmp.height() * pixelSize);
+    for (unsigned row = 0; row < bmp.height(); ++row)
+    {
+        unsigned char* out = &packed[row * bmp.width() * pixelSize];
+        if (pixelFormat == pfRGBA4444)
+            Pixels::toRGBA4444(reinterpret_cast<std::tr1::uint16_t*>(out), bmp.row(row), bmp.width());
+        else if (pixelFormat == pfRGB565)
+            Pixels::toRGB565(reinterpret_cast<std::tr1::uint16_t*>(out), bmp.row(row), bmp.width());
+        else
+            Pixels::toAlpha8(out, bmp.row(row), bmp.width());
+    }
+    
+    // Rows of one or two bytes per pixel need not be aligned to four bytes.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, level, x, y, bmp.width(), bmp.height(),
+        glFormat, glType, &packed[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
 Gosu::Texture::~Texture()
 {
-    glDeleteTextures(1, &name);
+    textureRegistry().erase(this);
+    if (array)
+        array->freeLayer(arrayLayer);
+    else
+        glDeleteTextures(1, &name);
 }
 
 unsigned Gosu::Texture::size() const
@@ -55,30 +334,310 @@ unsigned Gosu::Texture::size() const
     return allocator.width(); // == height
 }
 
-GLuint Gosu::Texture::texName() const
+void Gosu::Texture::blockSize(unsigned width, unsigned height, unsigned padding,
+    unsigned& blockWidth, unsigned& blockHeight) const
+{
+    // Widen the padding so that no mip level mixes in neighboring blocks.
+    unsigned extra = (mipmapped && padding > 0) ? MIPMAP_PADDING - padding : 0;
+    unsigned align = alignment();
+    blockWidth = (width + 2 * extra + align - 1) / align * align;
+    blockHeight = (height + 2 * extra + align - 1) / align * align;
+}
+
+std::auto_ptr<Gosu::TexChunk>
+    Gosu::Texture::fillBlock(Graphics& graphics, DrawOpQueueStack& queues,
+        std::tr1::shared_ptr<Texture> ptr, const BlockAllocator::Block& block,
+        const BitmapView& bmp, unsigned padding)
+{
+    // See blockSize.
+    unsigned extra = (mipmapped && padding > 0) ? MIPMAP_PADDING - padding : 0;
+    std::auto_ptr<Gosu::TexChunk> result(new TexChunk(graphics, queues, ptr,
+                              block.left + padding + extra, block.top + padding + extra,
+                              bmp.width() - 2 * padding, bmp.height() - 2 * padding,
+                              padding + extra));
+    
+    if (block.width == bmp.width() && block.height == bmp.height())
+        result->setUploadFence(upload(block, bmp));
+    else
+        result->setUploadFence(upload(block, extendEdges(bmp, extra, block.width, block.height)));
+    return result;
+}
+
+std::auto_ptr<Gosu::TexChunk>
+    Gosu::Texture::tryAlloc(Graphics& graphics, DrawOpQueueStack& queues,
+        std::tr1::shared_ptr<Texture> ptr, const BitmapView& bmp, unsigned padding)
 {
-    return name;
+    std::auto_ptr<Gosu::TexChunk> result;
+    
+    unsigned width, height;
+    blockSize(bmp.width(), bmp.height(), padding, width, height);
+    BlockAllocator::Block block;
+    if (!allocBlock(width, height, block))
+        return result;
+    
+    return fillBlock(graphics, queues, ptr, block, bmp, padding);
 }
 
 std::auto_ptr<Gosu::TexChunk>
     Gosu::Texture::tryAlloc(Graphics& graphics, DrawOpQueueStack& queues,
-        std::tr1::shared_ptr<Texture> ptr, const Bitmap& bmp, unsigned padding)
+        std::tr1::shared_ptr<Texture> ptr, const Bitmap& source,
+        unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
+        unsigned borderFlags)
 {
     std::auto_ptr<Gosu::TexChunk> result;
     
+    // Mipmapped textures need the whole block at once to compute the mip
+    // levels from, and small images are not worth several uploads.
+    if (mipmapped || srcWidth * srcHeight < SEPARATE_BORDERS_MIN_PIXELS)
+    {
+        // Allocated first, so that nothing is copied for full textures.
+        unsigned width, height;
+        blockSize(srcWidth + 2, srcHeight + 2, 1, width, height);
+        BlockAllocator::Block block;
+        if (!allocBlock(width, height, block))
+            return result;
+        
+        ScratchBitmap padded;
+        applyBorderFlags(*padded, source, srcX, srcY, srcWidth, srcHeight, borderFlags);
+        return fillBlock(graphics, queues, ptr, block, *padded, 1);
+    }
+    
     BlockAllocator::Block block;
-    if (!allocator.alloc(bmp.width(), bmp.height(), block))
+    if (!allocBlock(srcWidth + 2, srcHeight + 2, block))
         return result;
     
-    result.reset(new TexChunk(graphics, queues, ptr, block.left + padding, block.top + padding,
-                              block.width - 2 * padding, block.height - 2 * padding, padding));
+    result.reset(new TexChunk(graphics, queues, ptr, block.left + 1, block.top + 1,
+        srcWidth, srcHeight, 1));
+    GLFence fence = upload(BlockAllocator::Block(block.left + 1, block.top + 1,
+        srcWidth, srcHeight), BitmapView(source, srcX, srcY, srcWidth, srcHeight));
     
-    glBindTexture(GL_TEXTURE_2D, name);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, block.left, block.top, block.width, block.height,
-                 Color::GL_FORMAT, GL_UNSIGNED_BYTE, bmp.data());
+    // The borders repeat the outermost pixels on tileable sides, and are
+    // transparent elsewhere. They have to be uploaded either way, since the
+    // block may still hold the pixels of an image that was freed.
+    unsigned right = srcX + srcWidth - 1, bottom = srcY + srcHeight - 1;
+    bool tileableTop = (borderFlags & bfTileableTop) != 0;
+    bool tileableBottom = (borderFlags & bfTileableBottom) != 0;
+    bool tileableLeft = (borderFlags & bfTileableLeft) != 0;
+    bool tileableRight = (borderFlags & bfTileableRight) != 0;
+    
+    ScratchBitmap edge;
+    Bitmap& row = *edge;
+    row.resize(srcWidth + 2, 1);
+    if (tileableTop)
+    {
+        row.insert(source, 1, 0, srcX, srcY, srcWidth, 1);
+        if (tileableLeft)
+            row.setPixel(0, 0, source.getPixel(srcX, srcY));
+        if (tileableRight)
+            row.setPixel(srcWidth + 1, 0, source.getPixel(right, srcY));
+    }
+    upload(BlockAllocator::Block(block.left, block.top, srcWidth + 2, 1), row);
+    
+    std::fill(row.data(), row.data() + row.width(), Color::NONE);
+    if (tileableBottom)
+    {
+        row.insert(source, 1, 0, srcX, bottom, srcWidth, 1);
+        if (tileableLeft)
+            row.setPixel(0, 0, source.getPixel(srcX, bottom));
+        if (tileableRight)
+            row.setPixel(srcWidth + 1, 0, source.getPixel(right, bottom));
+    }
+    upload(BlockAllocator::Block(block.left, block.top + srcHeight + 1, srcWidth + 2, 1), row);
+    
+    Bitmap& column = *edge;
+    column.resize(1, srcHeight);
+    std::fill(column.data(), column.data() + srcHeight, Color::NONE);
+    if (tileableLeft)
+        column.insert(source, 0, 0, srcX, srcY, 1, srcHeight);
+    upload(BlockAllocator::Block(block.left, block.top + 1, 1, srcHeight), column);
+    
+    std::fill(column.data(), column.data() + srcHeight, Color::NONE);
+    if (tileableRight)
+        column.insert(source, 0, 0, right, srcY, 1, srcHeight);
+    upload(BlockAllocator::Block(block.left + srcWidth + 1, block.top + 1, 1, srcHeight), column);
+    
+    result->setUploadFence(fence);
+    return result;
+}
 
+bool Gosu::Texture::allocBlock(unsigned width, unsigned height, BlockAllocator::Block& block)
+{
+    if (!allocator.alloc(width, height, block))
+        return false;
     num += 1;
-    return result;
+    return true;
+}
+
+bool Gosu::Texture::allocGrid(unsigned cellWidth, unsigned cellHeight,
+    unsigned columns, unsigned rows, BlockAllocator::Block& block)
+{
+    if (!allocator.alloc(cellWidth * columns, cellHeight * rows, block))
+        return false;
+    allocator.split(block.left, block.top, cellWidth, cellHeight);
+    num += columns * rows;
+    return true;
+}
+
+void Gosu::Texture::reserveBlock(const BlockAllocator::Block& block)
+{
+    allocator.reserve(block);
+    num += 1;
+}
+
+Gosu::GLFence Gosu::Texture::upload(const BlockAllocator::Block& block, const BitmapView& bmp)
+{
+    if (!premultipliedAlpha)
+        return uploadPixels(block, bmp);
+    
+    ScratchBitmap premultiplied;
+    bmp.copyTo(*premultiplied);
+    if (bmp.width() * bmp.height() > 0)
+        Pixels::premultiply(premultiplied->data(), bmp.width() * bmp.height());
+    return uploadPixels(block, *premultiplied);
+}
+
+Gosu::GLFence Gosu::Texture::uploadPixels(const BlockAllocator::Block& block, const BitmapView& bmp)
+{
+    bind();
+    
+    // Converted pixels are small enough to upload right away.
+    if (pixelFormat != pfRGBA8888)
+    {
+        texSubImagePacked(0, block.left, block.top, bmp);
+        uploadMipmaps(block, bmp);
+        return 0;
+    }
+    
+#ifndef GOSU_IS_IPHONE
+    const GLBufferFunctions& buffers = glBufferFunctions();
+    if (buffers.pixelBuffers && bmp.width() * bmp.height() >= PIXEL_BUFFER_MIN_PIXELS)
+    {
+        // Copying into a fresh pixel buffer lets glTexSubImage2D return right
+        // away; the driver transfers the data while the next frames run.
+        GLuint buffer;
+        buffers.genBuffers(1, &buffer);
+        buffers.bindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        std::size_t bytes = bmp.width() * bmp.height() * sizeof(Color);
+        buffers.bufferData(GL_PIXEL_UNPACK_BUFFER, bytes, 0, GL_STREAM_DRAW);
+        
+        bool staged = false;
+        if (void* mapped = buffers.mapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY))
+        {
+            if (bmp.contiguous())
+                std::memcpy(mapped, bmp.data(), bytes);
+            else
+                for (unsigned y = 0; y < bmp.height(); ++y)
+                    std::memcpy(static_cast<Color*>(mapped) + y * bmp.width(), bmp.row(y),
+                        bmp.width() * sizeof(Color));
+            // Unmapping can fail if the buffer's memory was lost meanwhile.
+            staged = buffers.unmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+        }
+        if (staged)
+            texSubImage(block, 0);
+        
+        // The buffer is only really deleted once the transfer is done.
+        buffers.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        buffers.deleteBuffers(1, &buffer);
+        
+        if (staged)
+        {
+            uploadMipmaps(block, bmp);
+            const GLSyncFunctions& sync = glSyncFunctions();
+            return sync.available ? sync.fenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+        }
+    }
+#endif
+    
+#ifdef GOSU_IS_IPHONE
+    // OpenGL ES cannot skip pixels between rows.
+    if (!bmp.contiguous())
+    {
+        Bitmap copy = bmp.toBitmap();
+        texSubImage(block, copy.data());
+        uploadMipmaps(block, bmp);
+        return 0;
+    }
+#else
+    if (!bmp.contiguous())
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, bmp.pitch());
+#endif
+    texSubImage(block, bmp.data());
+#ifndef GOSU_IS_IPHONE
+    if (!bmp.contiguous())
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+#endif
+    uploadMipmaps(block, bmp);
+    return 0;
+}
+
+void Gosu::Texture::uploadMipmaps(const BlockAllocator::Block& block, const BitmapView& bmp)
+{
+    // Partial updates (see TexChunk::insert) use updateMipmaps afterwards.
+    unsigned align = alignment();
+    if (!mipmapped || block.left % align || block.top % align ||
+            block.width % align || block.height % align)
+        return;
+    
+    Bitmap level;
+    for (unsigned i = 1; i <= MIPMAP_LEVELS; ++i)
+    {
+        Bitmap smaller = i == 1 ? halve(bmp) : halve(level);
+        if (pixelFormat != pfRGBA8888)
+            texSubImagePacked(i, block.left >> i, block.top >> i, smaller);
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, i, block.left >> i, block.top >> i,
+                smaller.width(), smaller.height(), Color::GL_FORMAT, GL_UNSIGNED_BYTE, smaller.data());
+        level.swap(smaller);
+    }
+}
+
+void Gosu::Texture::updateMipmaps(const BlockAllocator::Block& block)
+{
+#ifndef GOSU_IS_IPHONE
+    Bitmap content = readPixels(block.left, block.top, block.width, block.height);
+    bind();
+    uploadMipmaps(block, content);
+#endif
+}
+
+void Gosu::Texture::attach(TexChunk* chunk)
+{
+    liveChunks.insert(chunk);
+}
+
+void Gosu::Texture::detach(TexChunk* chunk)
+{
+    liveChunks.erase(chunk);
+}
+
+const Gosu::Texture::Chunks& Gosu::Texture::chunks() const
+{
+    return liveChunks;
+}
+
+bool Gosu::Texture::isDedicated() const
+{
+    return dedicated;
+}
+
+bool Gosu::Texture::isMipmapped() const
+{
+    return mipmapped;
+}
+
+unsigned Gosu::Texture::alignment() const
+{
+    return mipmapped ? MIPMAP_PADDING : 1;
+}
+
+unsigned long Gosu::Texture::usedArea() const
+{
+    return allocator.usedArea();
+}
+
+unsigned long Gosu::Texture::memory() const
+{
+    return bytes;
 }
 
 void Gosu::Texture::free(unsigned x, unsigned y)
@@ -88,16 +647,108 @@ void Gosu::Texture::free(unsigned x, unsigned y)
 }
 
 Gosu::Bitmap Gosu::Texture::toBitmap(unsigned x, unsigned y, unsigned width, unsigned height) const
+{
+    Bitmap bitmap = readPixels(x, y, width, height);
+    if (premultipliedAlpha && width * height > 0)
+        Pixels::unpremultiply(bitmap.data(), width * height);
+    return bitmap;
+}
+
+Gosu::Bitmap Gosu::Texture::readPixels(unsigned x, unsigned y, unsigned width, unsigned height) const
 {
 #ifdef GOSU_IS_IPHONE
     throw std::logic_error("Texture::toBitmap not supported on iOS");
 #else
-    Gosu::Bitmap fullTexture(size(), size());
-    glBindTexture(GL_TEXTURE_2D, name);
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, fullTexture.data());
+    // One-channel textures cannot be attached to a framebuffer on older
+    // drivers, and reading them as RGBA would not give back white.
+    if (pixelFormat == pfAlpha8)
+    {
+        std::vector<unsigned char> alpha(size() * size());
+        bind();
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        // Intensity textures are read through their red channel.
+        glGetTexImage(GL_TEXTURE_2D, 0, glFormat == GL_ALPHA ? GL_ALPHA : GL_RED,
+            GL_UNSIGNED_BYTE, &alpha[0]);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        
+        Gosu::Bitmap bitmap(width, height);
+        for (unsigned row = 0; row < height; ++row)
+            for (unsigned column = 0; column < width; ++column)
+            {
+                Color::Channel a = alpha[(y + row) * size() + x + column];
+                bitmap.setPixel(column, row, premultipliedAlpha ? Color(a, a, a, a) : Color(a, 255, 255, 255));
+            }
+        return bitmap;
+    }
+    
+    // Attaching the texture to a framebuffer lets glReadPixels read just
+    // the rectangle, instead of downloading the whole texture.
+    const GLFramebufferFunctions& fbo = glFramebufferFunctions();
+    if (fbo.available && width * height > 0)
+    {
+        GLint previous;
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+        GLuint framebuffer;
+        fbo.genFramebuffers(1, &framebuffer);
+        fbo.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        if (array)
+            glTextureArrayFunctions().framebufferTextureLayer(GL_FRAMEBUFFER,
+                GL_COLOR_ATTACHMENT0, name, 0, arrayLayer);
+        else
+            fbo.framebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, name, 0);
+        
+        Gosu::Bitmap bitmap;
+        if (fbo.checkFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE)
+        {
+            bitmap.resize(width, height);
+            glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, bitmap.data());
+        }
+        
+        fbo.bindFramebuffer(GL_FRAMEBUFFER, previous);
+        fbo.deleteFramebuffers(1, &framebuffer);
+        if (bitmap.width() == width)
+            return bitmap;
+    }
+    
+    // Arrays can only be downloaded with all their layers at once.
+    unsigned layers = array ? array->layers() : 1;
+    Gosu::Bitmap fullTexture(size(), size() * layers);
+    bind();
+    glGetTexImage(target(), 0, GL_RGBA, GL_UNSIGNED_BYTE, fullTexture.data());
     Gosu::Bitmap bitmap(width, height);
-    bitmap.insert(fullTexture, -int(x), -int(y));
+    bitmap.insert(fullTexture, -int(x), -int(y + (array ? arrayLayer * size() : 0)));
     
     return bitmap;
 #endif
 }
+
+Gosu::TextureStatistics Gosu::Texture::statistics() const
+{
+    TextureStatistics result;
+    result.size = size();
+    result.dedicated = dedicated;
+    result.blocks = allocator.numBlocks();
+    result.usedArea = allocator.usedArea();
+    result.fragmentedArea = allocator.fragmentedArea();
+    result.freeArea = static_cast<unsigned long>(size()) * size() -
+        result.usedArea - result.fragmentedArea;
+    return result;
+}
+
+std::vector<Gosu::TextureStatistics> Gosu::textureStatistics()
+{
+    std::vector<TextureStatistics> result;
+    for (TextureRegistry::const_iterator it = textureRegistry().begin(),
+            end = textureRegistry().end(); it != end; ++it)
+        result.push_back((*it)->statistics());
+    return result;
+}
+
+unsigned long Gosu::textureMemory()
+{
+    unsigned long result = 0;
+    for (TextureRegistry::const_iterator it = textureRegistry().begin(),
+            end = textureRegistry().end(); it != end; ++it)
+        result += (*it)->memory();
+    return result;
+}
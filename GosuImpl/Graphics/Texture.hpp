@@ -4,29 +4,177 @@
 #include <Gosu/Fwd.hpp>
 #include <Gosu/Bitmap.hpp>
 #include <Gosu/TR1.hpp>
+#include <GosuImpl/Graphics/BitmapView.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
 #include <GosuImpl/Graphics/TexChunk.hpp>
 #include <GosuImpl/Graphics/BlockAllocator.hpp>
+#include <GosuImpl/Graphics/CompressedTexture.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <GosuImpl/Graphics/ShaderProgram.hpp>
+#include <GosuImpl/MemoryStatistics.hpp>
+#include <Gosu/Inspection.hpp>
+#include <set>
 #include <vector>
 
 namespace Gosu
 {
+    // Atlas pages of the same size as the layers of one GL_TEXTURE_2D_ARRAY,
+    // so that images on different pages can be drawn in one batch (see
+    // Graphics::setTextureArrays). Each page is a Texture that owns a layer,
+    // and the array lives as long as any of them. There is no fixed-function
+    // way to sample arrays, so they are drawn with a built-in shader that
+    // takes the layer from the t texture coordinate, see layerOffset.
+    class TextureArray
+    {
+        TextureArray(const TextureArray&);
+        TextureArray& operator=(const TextureArray&);
+        
+        GLuint name;
+        unsigned arraySize;
+        std::vector<bool> usedLayers;
+        // Counts all layers, used or not, since all of them take memory.
+        MemoryCount counted;
+        
+    public:
+        // glTextureArrayFunctions() must be available.
+        TextureArray(unsigned size, unsigned layers);
+        ~TextureArray();
+        
+        GLuint texName() const { return name; }
+        unsigned size() const { return arraySize; }
+        unsigned layers() const { return usedLayers.size(); }
+        // Returns false if all layers are in use.
+        bool allocLayer(unsigned& layer);
+        void freeLayer(unsigned layer);
+        
+        // Added to the t texture coordinates of the layer's vertices. Layers
+        // are two apart so that a coordinate of 1 still rounds down to its
+        // own layer in the shader.
+        static GLfloat layerOffset(unsigned layer) { return 2.0f * layer; }
+        // Stands in for the fixed-function pipeline, with the same result.
+        static ShaderProgram* program();
+    };
+    
     class Texture
     {
         BlockAllocator allocator;
         GLuint name;
         unsigned num;
+        bool dedicated;
+        bool mipmapped;
+        PixelFormat pixelFormat;
+        // How pixels of that format are passed to glTexSubImage2D, and their
+        // size in bytes.
+        GLenum glFormat, glType;
+        unsigned pixelSize;
+        unsigned long bytes;
+        unsigned long lastDrawn;
+        MemoryCount counted;
+        // Set if this texture is a layer of an array instead of having a
+        // texture name of its own.
+        std::tr1::shared_ptr<TextureArray> array;
+        unsigned arrayLayer;
+        
+        void create();
+        void bind() const;
+        void texSubImage(const BlockAllocator::Block& block, const GLvoid* pixels);
+        // Converts the bitmap to a reduced format while uploading it into a
+        // mip level.
+        void texSubImagePacked(unsigned level, unsigned x, unsigned y, const BitmapView& bmp);
+        void uploadMipmaps(const BlockAllocator::Block& block, const BitmapView& bmp);
+        // upload and toBitmap without the conversion to and from
+        // premultiplied alpha.
+        GLFence uploadPixels(const BlockAllocator::Block& block, const BitmapView& bmp);
+        Gosu::Bitmap readPixels(unsigned x, unsigned y, unsigned width, unsigned height) const;
+        // Size of the block needed for a bitmap that includes the padding.
+        void blockSize(unsigned width, unsigned height, unsigned padding,
+            unsigned& blockWidth, unsigned& blockHeight) const;
+        // Uploads the bitmap, which includes the padding, into the center
+        // of an allocated block and creates a chunk for it.
+        std::auto_ptr<TexChunk> fillBlock(Graphics& graphics, DrawOpQueueStack& queues,
+            std::tr1::shared_ptr<Texture> ptr, const BlockAllocator::Block& block,
+            const BitmapView& bmp, unsigned padding);
+        
+    public:
+        typedef std::set<TexChunk*> Chunks;
+        
+        // Mipmapped textures stop at 1/8 of the original size, so blocks on
+        // them are aligned to and padded by 8 pixels.
+        static const unsigned MIPMAP_LEVELS = 3;
+        static const unsigned MIPMAP_PADDING = 1 << MIPMAP_LEVELS;
+        
+    private:
+        Chunks liveChunks;
 
     public:
-        Texture(unsigned size);
+        // Dedicated textures hold exactly one image (e.g. a tileable one).
+        explicit Texture(unsigned size, bool dedicated = false, bool mipmapped = false,
+            PixelFormat format = pfRGBA8888);
+        // Creates a dedicated texture with the compressed data in its top
+        // left corner. The driver must support the format.
+        Texture(unsigned size, const CompressedTexture& data);
+        // An atlas page on a layer that has been allocated on the array.
+        Texture(const std::tr1::shared_ptr<TextureArray>& array, unsigned layer);
         ~Texture();
         unsigned size() const;
-        GLuint texName() const;
+        // Shared by all layers of an array.
+        GLuint texName() const { return name; }
+        // GL_TEXTURE_2D, or GL_TEXTURE_2D_ARRAY for layers.
+        GLenum target() const { return array ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D; }
+        bool isLayer() const { return array.get() != 0; }
+        unsigned layer() const { return arrayLayer; }
+        // On mipmapped textures, a padding of 1 is widened as needed.
         std::auto_ptr<TexChunk> 
             tryAlloc(Graphics& graphics, DrawOpQueueStack& queues,
-                std::tr1::shared_ptr<Texture> ptr, const Bitmap& bmp, unsigned padding);
+                std::tr1::shared_ptr<Texture> ptr, const BitmapView& bmp, unsigned padding);
+        // Like the other tryAlloc, but adds the padding of one pixel that
+        // applyBorderFlags would add to the given area of source. Larger
+        // images are uploaded straight from source, with the borders
+        // uploaded apart from them.
+        std::auto_ptr<TexChunk>
+            tryAlloc(Graphics& graphics, DrawOpQueueStack& queues,
+                std::tr1::shared_ptr<Texture> ptr, const Bitmap& source,
+                unsigned srcX, unsigned srcY, unsigned srcWidth, unsigned srcHeight,
+                unsigned borderFlags);
         void free(unsigned x, unsigned y);
         Gosu::Bitmap toBitmap(unsigned x, unsigned y, unsigned width, unsigned height) const;
+        TextureStatistics statistics() const;
+        
+        // Used by TexChunk to keep track of which chunks live on a texture.
+        void attach(TexChunk* chunk);
+        void detach(TexChunk* chunk);
+        const Chunks& chunks() const;
+        
+        bool isDedicated() const;
+        bool isMipmapped() const;
+        PixelFormat format() const { return pixelFormat; }
+        // All blocks on this texture start and end at multiples of this.
+        unsigned alignment() const;
+        // Recreates the mipmaps of a block from the texture's contents.
+        void updateMipmaps(const BlockAllocator::Block& block);
+        unsigned long usedArea() const;
+        // Frame number (see Graphics) in which this texture was last used.
+        unsigned long lastDrawnFrame() const { return lastDrawn; }
+        void setLastDrawn(unsigned long frame) { lastDrawn = frame; }
+        // Video memory used by this texture.
+        unsigned long memory() const;
+        // Textures count as atlas or dedicated textures in memoryStatistics
+        // unless they are moved to another category, e.g. by a font.
+        void setMemoryCategory(MemoryCategory category) { counted.setCategory(category); }
+        // Reserves a block without creating a TexChunk for it (for relocation).
+        bool allocBlock(unsigned width, unsigned height, BlockAllocator::Block& block);
+        // Reserves a block for a grid of columns x rows cells at once. Each
+        // cell is freed on its own, like a block from allocBlock.
+        bool allocGrid(unsigned cellWidth, unsigned cellHeight,
+            unsigned columns, unsigned rows, BlockAllocator::Block& block);
+        // Marks a block that is known to be free as used (see
+        // BlockAllocator::reserve).
+        void reserveBlock(const BlockAllocator::Block& block);
+        // Large uploads are staged through a pixel buffer if possible, in
+        // which case a fence is returned that is signaled once the texture
+        // has the data. Otherwise returns 0. The view does not need to be
+        // contiguous.
+        GLFence upload(const BlockAllocator::Block& block, const BitmapView& bmp);
     };
 }
 
@@ -0,0 +1,175 @@
+#include <Gosu/TileLayer.hpp>
+#include <Gosu/Graphics.hpp>
+#include <Gosu/ImageData.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace
+{
+    // Index of the chunk that contains the given offset, clamped to
+    // [0; max].
+    unsigned chunkIndex(double offset, double chunkSize, unsigned max)
+    {
+        if (offset <= 0)
+            return 0;
+        double index = std::floor(offset / chunkSize);
+        return index >= max ? max : static_cast<unsigned>(index);
+    }
+}
+
+struct Gosu::TileLayer::Impl
+{
+    Graphics* graphics;
+    std::vector<Image> tiles;
+    unsigned columns, rows, chunkSize;
+    unsigned tileWidth, tileHeight;
+    std::vector<int> cells;
+    
+    struct Chunk
+    {
+        // Empty while the chunk has no tiles.
+        std::tr1::shared_ptr<ImageData> macro;
+        bool dirty;
+        unsigned usedCells;
+    };
+    unsigned chunksX, chunksY;
+    std::vector<Chunk> chunks;
+    
+    Chunk& chunkAt(unsigned column, unsigned row)
+    {
+        return chunks[row / chunkSize * chunksX + column / chunkSize];
+    }
+    
+    void record(Chunk& chunk, unsigned chunkX, unsigned chunkY)
+    {
+        chunk.dirty = false;
+        chunk.macro.reset();
+        if (chunk.usedCells == 0)
+            return;
+        
+        unsigned firstColumn = chunkX * chunkSize, firstRow = chunkY * chunkSize;
+        unsigned endColumn = std::min(firstColumn + chunkSize, columns);
+        unsigned endRow = std::min(firstRow + chunkSize, rows);
+        
+        graphics->beginRecording();
+        for (unsigned row = firstRow; row < endRow; ++row)
+            for (unsigned column = firstColumn; column < endColumn; ++column)
+            {
+                int tile = cells[row * columns + column];
+                if (tile != NO_TILE)
+                    tiles[tile].draw(double(column - firstColumn) * tileWidth,
+                        double(row - firstRow) * tileHeight, 0);
+            }
+        chunk.macro.reset(graphics->endRecording((endColumn - firstColumn) * tileWidth,
+            (endRow - firstRow) * tileHeight).release());
+    }
+};
+
+Gosu::TileLayer::TileLayer(Graphics& graphics, const std::vector<Image>& tiles,
+    unsigned columns, unsigned rows, unsigned chunkSize)
+: pimpl(new Impl)
+{
+    if (tiles.empty())
+        throw std::invalid_argument("TileLayer needs at least one tile");
+    if (chunkSize == 0)
+        throw std::invalid_argument("Invalid TileLayer chunk size");
+    
+    pimpl->graphics = &graphics;
+    pimpl->tiles = tiles;
+    pimpl->columns = columns;
+    pimpl->rows = rows;
+    pimpl->chunkSize = chunkSize;
+    pimpl->tileWidth = tiles.front().width();
+    pimpl->tileHeight = tiles.front().height();
+    pimpl->cells.resize(columns * rows, NO_TILE);
+    
+    pimpl->chunksX = (columns + chunkSize - 1) / chunkSize;
+    pimpl->chunksY = (rows + chunkSize - 1) / chunkSize;
+    Impl::Chunk empty = { std::tr1::shared_ptr<ImageData>(), false, 0 };
+    pimpl->chunks.resize(pimpl->chunksX * pimpl->chunksY, empty);
+}
+
+Gosu::TileLayer::~TileLayer()
+{
+}
+
+unsigned Gosu::TileLayer::columns() const
+{
+    return pimpl->columns;
+}
+
+unsigned Gosu::TileLayer::rows() const
+{
+    return pimpl->rows;
+}
+
+int Gosu::TileLayer::tile(unsigned column, unsigned row) const
+{
+    if (column >= pimpl->columns || row >= pimpl->rows)
+        throw std::out_of_range("TileLayer cell out of range");
+    return pimpl->cells[row * pimpl->columns + column];
+}
+
+void Gosu::TileLayer::setTile(unsigned column, unsigned row, int tile)
+{
+    if (column >= pimpl->columns || row >= pimpl->rows)
+        throw std::out_of_range("TileLayer cell out of range");
+    if (tile != NO_TILE && (tile < 0 || tile >= static_cast<int>(pimpl->tiles.size())))
+        throw std::out_of_range("Invalid tile index");
+    
+    int& cell = pimpl->cells[row * pimpl->columns + column];
+    if (cell == tile)
+        return;
+    
+    Impl::Chunk& chunk = pimpl->chunkAt(column, row);
+    if (cell == NO_TILE)
+        ++chunk.usedCells;
+    else if (tile == NO_TILE)
+        --chunk.usedCells;
+    cell = tile;
+    // Chunks are only recorded again once they are drawn.
+    chunk.dirty = true;
+}
+
+void Gosu::TileLayer::draw(double x, double y, ZPos z, Color c, AlphaMode mode) const
+{
+    if (pimpl->chunks.empty())
+        return;
+    
+    double chunkWidth = double(pimpl->chunkSize) * pimpl->tileWidth;
+    double chunkHeight = double(pimpl->chunkSize) * pimpl->tileHeight;
+    
+    // Only the chunks in the visible area are looked at, so that large
+    // maps cost nothing for what is off-screen.
+    unsigned firstX = 0, firstY = 0, endX = pimpl->chunksX, endY = pimpl->chunksY;
+    double left, top, right, bottom;
+    if (pimpl->graphics->visibleArea(left, top, right, bottom))
+    {
+        firstX = chunkIndex(left - x, chunkWidth, pimpl->chunksX);
+        firstY = chunkIndex(top - y, chunkHeight, pimpl->chunksY);
+        endX = chunkIndex(right - x, chunkWidth, pimpl->chunksX - 1) + 1;
+        endY = chunkIndex(bottom - y, chunkHeight, pimpl->chunksY - 1) + 1;
+        if (right < x || bottom < y)
+            return;
+    }
+    
+    for (unsigned chunkY = firstY; chunkY < endY; ++chunkY)
+        for (unsigned chunkX = firstX; chunkX < endX; ++chunkX)
+        {
+            Impl::Chunk& chunk = pimpl->chunks[chunkY * pimpl->chunksX + chunkX];
+            if (chunk.usedCells == 0)
+                continue;
+            
+            double left = x + chunkX * chunkWidth, top = y + chunkY * chunkHeight;
+            double right = left + chunkWidth, bottom = top + chunkHeight;
+            if (!pimpl->graphics->isVisible(left, top, right, top, left, bottom, right, bottom))
+                continue;
+            
+            if (chunk.dirty)
+                pimpl->record(chunk, chunkX, chunkY);
+            ImageData& macro = *chunk.macro;
+            right = left + macro.width(), bottom = top + macro.height();
+            macro.draw(left, top, c, right, top, c, left, bottom, c, right, bottom, c, z, mode);
+        }
+}
@@ -4,13 +4,14 @@
 #include <Gosu/Graphics.hpp>
 #include <Gosu/Math.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
-#include <cmath>
 
 Gosu::Transform
 Gosu::rotate(double angle, double aroundX, double aroundY)
 {
-    double c = std::cos(degreesToRadians(angle));
-    double s = std::sin(degreesToRadians(angle));
+    // offsetY is the negative cosine.
+    double s, c;
+    offsetXY(angle, 1, s, c);
+    c = -c;
     Gosu::Transform result = {
         +c, +s, 0, 0,
         -s, +c, 0, 0,
@@ -1,34 +1,70 @@
 #ifndef GOSUIMPL_GRAPHICS_TRANSFORMSTACK_HPP
 #define GOSUIMPL_GRAPHICS_TRANSFORMSTACK_HPP
 
+#include <Gosu/TR1.hpp>
 #include <GosuImpl/Graphics/Common.hpp>
 #include <cassert>
-#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <vector>
 
 namespace Gosu
 {
     class TransformStack
     {
-        // All the matrices that are pushed right now.
-        Transforms individual;
         // All the absolute matrices that have been created since last reset.
-        Transforms absolute;
-        // Points to one absolute transform.
-        Transforms::const_iterator currentIterator;
+        // A deque never moves its elements, so pointers handed out by
+        // current() stay valid until the next reset.
+        typedef std::deque<Transform> Pool;
+        Pool absolute;
+        // Indices into 'absolute', mapped from the hash of the matrix.
+        typedef std::tr1::unordered_multimap<std::size_t, std::size_t> Index;
+        Index index;
         
-        void makeCurrent(const Transform& transform)
+        // Remembers which absolute matrix resulted from pushing a given
+        // matrix onto a given absolute matrix, so that repeated push/pop
+        // sequences (UI code, scrolling layers...) do not multiply again.
+        struct Product
         {
-            currentIterator =
-                std::find(absolute.begin(), absolute.end(), transform);
-            if (currentIterator == absolute.end())
-                currentIterator = absolute.insert(absolute.end(), transform);
+            std::size_t parent;
+            Transform factor;
+            std::size_t result;
+        };
+        typedef std::vector<Product> Products;
+        Products products;
+        Index productIndex;
+        
+        // The absolute matrix for each level of the stack, bottom first.
+        std::vector<std::size_t> stack;
+        
+        static std::size_t hashTransform(const Transform& transform)
+        {
+            std::tr1::hash<double> hasher;
+            std::size_t result = 0;
+            for (int i = 0; i < 16; ++i)
+                result ^= hasher(transform[i]) + 0x9e3779b9 + (result << 6) + (result >> 2);
+            return result;
+        }
+        
+        std::size_t makeCurrent(const Transform& transform)
+        {
+            std::size_t hash = hashTransform(transform);
+            std::pair<Index::const_iterator, Index::const_iterator> range =
+                index.equal_range(hash);
+            for (; range.first != range.second; ++range.first)
+                if (absolute[range.first->second] == transform)
+                    return range.first->second;
+            
+            absolute.push_back(transform);
+            index.insert(Index::value_type(hash, absolute.size() - 1));
+            return absolute.size() - 1;
         }
         
     public:
         TransformStack()
         {
             reset();
-            individual.front() = absolute.front() = scale(1);
+            setBaseTransform(scale(1));
         }
                 
         void reset()
@@ -36,63 +72,66 @@ namespace Gosu
             // Every queue has a base transform that is always the current transform.
             // This keeps the code a bit more uniform, and allows the window to
             // set a base transform in the main rendering queue.
-            individual.resize(1);
             absolute.resize(1);
-            currentIterator = absolute.begin();
-        }
-        
-        TransformStack(const TransformStack& other)
-        {
-            *this = other;
+            index.clear();
+            index.insert(Index::value_type(hashTransform(absolute.front()), 0));
+            products.clear();
+            productIndex.clear();
+            stack.assign(1, 0);
         }
         
-        // Custom assignment to ensure valid currentIterator
-        TransformStack& operator=(const TransformStack &other)
+        void setBaseTransform(const Transform& baseTransform)
         {
-            individual = other.individual;
-            absolute = other.absolute;
-            
-            // Reset our currentIterator to point to the respective element
-            // in our own 'absolute' transforms by iterating both lists up to
-            // the other lists' current iterator
-            currentIterator = absolute.begin();
-            Transforms::const_iterator otherIterator = other.absolute.begin();
-            while (otherIterator != other.currentIterator)
-                ++currentIterator, ++otherIterator;
+            assert (stack.size() == 1);
+            assert (absolute.size() == 1);
             
-            return *this;
+            absolute.front() = baseTransform;
+            index.clear();
+            index.insert(Index::value_type(hashTransform(baseTransform), 0));
         }
         
-        void setBaseTransform(const Transform& baseTransform)
+        const Transform& base() const
         {
-            assert (individual.size() == 1);
-            assert (absolute.size() == 1);
-            
-            individual.front() = absolute.front() = baseTransform;
+            return absolute.front();
         }
         
         const Transform& current()
         {
-            return *currentIterator;
+            return absolute[stack.back()];
         }
         
         void push(const Transform& transform)
         {
-            individual.push_back(transform);
-            Transform result = multiply(transform, current());
-            makeCurrent(result);
+            std::size_t parent = stack.back();
+            std::size_t hash = hashTransform(transform) ^ parent;
+            
+            std::pair<Index::const_iterator, Index::const_iterator> range =
+                productIndex.equal_range(hash);
+            for (; range.first != range.second; ++range.first)
+            {
+                const Product& product = products[range.first->second];
+                if (product.parent == parent && product.factor == transform)
+                {
+                    stack.push_back(product.result);
+                    return;
+                }
+            }
+            
+            Product product;
+            product.parent = parent;
+            product.factor = transform;
+            product.result = makeCurrent(multiply(transform, absolute[parent]));
+            products.push_back(product);
+            productIndex.insert(Index::value_type(hash, products.size() - 1));
+            stack.push_back(product.result);
         }
         
         void pop()
         {
-            assert (individual.size() > 1);
+            assert (stack.size() > 1);
             
-            individual.pop_back();
-            Transform result = scale(1);
-            for (Transforms::reverse_iterator it = individual.rbegin(),
-                    end = individual.rend(); it != end; ++it)
-                result = multiply(result, *it);
-            makeCurrent(result);
+            // The absolute matrix below is still known, no need to multiply again.
+            stack.pop_back();
         }
     };
 }
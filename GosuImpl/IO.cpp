@@ -1,13 +1,84 @@
 #include <Gosu/IO.hpp>
+#include <Gosu/TR1.hpp>
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
+namespace
+{
+    // Values are copied in and out with memcpy, since they may be floats or
+    // unaligned. Compilers turn these loops into vector shuffles.
+    
+    void swap16(char* p, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i, p += 2)
+        {
+            std::tr1::uint16_t v;
+            std::memcpy(&v, p, 2);
+            v = static_cast<std::tr1::uint16_t>(v << 8 | v >> 8);
+            std::memcpy(p, &v, 2);
+        }
+    }
+    
+    void swap32(char* p, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i, p += 4)
+        {
+            std::tr1::uint32_t v;
+            std::memcpy(&v, p, 4);
+            v = v << 24 | (v & 0xff00) << 8 | (v >> 8 & 0xff00) | v >> 24;
+            std::memcpy(p, &v, 4);
+        }
+    }
+    
+    void swap64(char* p, std::size_t count)
+    {
+        for (std::size_t i = 0; i < count; ++i, p += 8)
+        {
+            std::tr1::uint32_t lo, hi;
+            std::memcpy(&lo, p, 4);
+            std::memcpy(&hi, p + 4, 4);
+            lo = lo << 24 | (lo & 0xff00) << 8 | (lo >> 8 & 0xff00) | lo >> 24;
+            hi = hi << 24 | (hi & 0xff00) << 8 | (hi >> 8 & 0xff00) | hi >> 24;
+            std::memcpy(p, &hi, 4);
+            std::memcpy(p + 4, &lo, 4);
+        }
+    }
+}
+
+void Gosu::swapByteOrder(void* values, std::size_t size, std::size_t count)
+{
+    char* p = static_cast<char*>(values);
+    switch (size)
+    {
+    case 1:
+        break;
+    case 2:
+        swap16(p, count);
+        break;
+    case 4:
+        swap32(p, count);
+        break;
+    case 8:
+        swap64(p, count);
+        break;
+    default:
+        for (std::size_t i = 0; i < count; ++i, p += size)
+            std::reverse(p, p + size);
+    }
+}
+
 void Gosu::Reader::read(void* dest, std::size_t length)
 {
     res->read(pos, length, dest);
     seek(length);
 }
 
+const void* Gosu::Reader::view(std::size_t length) const
+{
+    return res->view(pos, length);
+}
+
 void Gosu::Writer::write(const void* source, std::size_t length)
 {
     // Try to resize the source if necessary.
@@ -18,6 +89,36 @@ void Gosu::Writer::write(const void* source, std::size_t length)
     seek(length);
 }
 
+void Gosu::Writer::writeSwapped(const void* source, std::size_t size, std::size_t count)
+{
+    if (pos + size * count > res->size())
+        res->resize(pos + size * count);
+    
+    // Swapped in pieces that fit on the stack.
+    char buf[4096];
+    std::size_t perPiece = std::max<std::size_t>(sizeof buf / size, 1);
+    const char* p = static_cast<const char*>(source);
+    while (count > 0)
+    {
+        std::size_t n = std::min(count, perPiece);
+        if (n * size > sizeof buf)
+        {
+            // Values larger than the buffer; rare enough to be written one by one.
+            std::vector<char> value(p, p + size);
+            std::reverse(value.begin(), value.end());
+            write(&value[0], size);
+        }
+        else
+        {
+            std::memcpy(buf, p, n * size);
+            swapByteOrder(buf, size, n);
+            write(buf, n * size);
+        }
+        p += n * size;
+        count -= n;
+    }
+}
+
 std::size_t Gosu::Buffer::size() const
 {
     return buf.size();
@@ -25,9 +126,23 @@ std::size_t Gosu::Buffer::size() const
 
 void Gosu::Buffer::resize(std::size_t newSize)
 {
+    // Writers grow buffers in many small steps, so the capacity is at least
+    // doubled whenever it runs out. std::vector does not promise that.
+    if (newSize > buf.capacity())
+        buf.reserve(std::max(newSize, buf.capacity() * 2));
     buf.resize(newSize);
 }
 
+void Gosu::Buffer::reserve(std::size_t capacity)
+{
+    buf.reserve(capacity);
+}
+
+std::size_t Gosu::Buffer::capacity() const
+{
+    return buf.capacity();
+}
+
 void Gosu::Buffer::read(std::size_t offset, std::size_t length,
     void* destBuffer) const
 {
@@ -36,6 +151,13 @@ void Gosu::Buffer::read(std::size_t offset, std::size_t length,
         std::memcpy(destBuffer, &buf[offset], length);
 }
 
+const void* Gosu::Buffer::view(std::size_t offset, std::size_t length) const
+{
+    if (length == 0 || offset + length > size())
+        return 0;
+    return &buf[offset];
+}
+
 void Gosu::Buffer::write(std::size_t offset, std::size_t length,
     const void* sourceBuffer)
 {
@@ -44,6 +166,129 @@ void Gosu::Buffer::write(std::size_t offset, std::size_t length,
         std::memcpy(&buf[offset], sourceBuffer, length);
 }
 
+Gosu::BufferPool::BufferPool()
+{
+}
+
+Gosu::BufferPool::~BufferPool()
+{
+    for (std::size_t i = 0; i < buffers.size(); ++i)
+        delete buffers[i];
+}
+
+std::auto_ptr<Gosu::Buffer> Gosu::BufferPool::acquire(std::size_t capacity)
+{
+    std::auto_ptr<Buffer> buffer;
+    if (buffers.empty())
+        buffer.reset(new Buffer);
+    else
+    {
+        buffer.reset(buffers.back());
+        buffers.pop_back();
+    }
+    buffer->reserve(capacity);
+    return buffer;
+}
+
+void Gosu::BufferPool::release(std::auto_ptr<Buffer> buffer)
+{
+    if (!buffer.get())
+        return;
+    // Keeps the memory that has been reserved.
+    buffer->resize(0);
+    // Make sure that push_back cannot throw after the buffer has been
+    // released from its auto_ptr.
+    buffers.reserve(buffers.size() + 1);
+    buffers.push_back(buffer.release());
+}
+
+std::size_t Gosu::BufferPool::available() const
+{
+    return buffers.size();
+}
+
+Gosu::BufferedFile::BufferedFile(const std::wstring& filename, FileMode mode,
+    std::size_t bufferSize)
+: file(filename, mode), bufferOffset(0), capacity(bufferSize), logicalSize(file.size())
+{
+    buffer.reserve(capacity);
+}
+
+Gosu::BufferedFile::~BufferedFile()
+{
+    try
+    {
+        flush();
+    }
+    catch (...)
+    {
+    }
+}
+
+std::size_t Gosu::BufferedFile::size() const
+{
+    return logicalSize;
+}
+
+void Gosu::BufferedFile::resize(std::size_t newSize)
+{
+    logicalSize = newSize;
+    if (newSize <= bufferOffset)
+        buffer.clear();
+    else if (newSize < bufferOffset + buffer.size())
+        buffer.resize(newSize - bufferOffset);
+}
+
+void Gosu::BufferedFile::read(std::size_t offset, std::size_t length,
+    void* destBuffer) const
+{
+    // Only what has been collected since the last flush is not in the file.
+    if (!buffer.empty() && offset < bufferOffset + buffer.size() &&
+            offset + length > bufferOffset)
+        const_cast<BufferedFile*>(this)->flush();
+    file.read(offset, length, destBuffer);
+}
+
+void Gosu::BufferedFile::write(std::size_t offset, std::size_t length,
+    const void* sourceBuffer)
+{
+    logicalSize = std::max(logicalSize, offset + length);
+
+    // Writes that continue the buffer, or go back into it (e.g. to fill in
+    // a header), are collected as long as they fit.
+    if (buffer.empty())
+        bufferOffset = offset;
+    if (offset < bufferOffset || offset > bufferOffset + buffer.size() ||
+            offset + length - bufferOffset > capacity)
+    {
+        flush();
+        if (length >= capacity)
+        {
+            file.write(offset, length, sourceBuffer);
+            return;
+        }
+        bufferOffset = offset;
+    }
+
+    std::size_t end = offset + length - bufferOffset;
+    if (end > buffer.size())
+        buffer.resize(end);
+    if (length)
+        std::memcpy(&buffer[offset - bufferOffset], sourceBuffer, length);
+}
+
+void Gosu::BufferedFile::flush()
+{
+    if (!buffer.empty())
+    {
+        file.write(bufferOffset, buffer.size(), &buffer[0]);
+        buffer.clear();
+    }
+    // Appending has usually given the file its size already.
+    if (file.size() != logicalSize)
+        file.resize(logicalSize);
+}
+
 void Gosu::loadFile(Buffer& buffer, const std::wstring& filename)
 {
     File file(filename);
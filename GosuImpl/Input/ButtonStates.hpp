@@ -0,0 +1,78 @@
+#ifndef GOSUIMPL_INPUT_BUTTONSTATES_HPP
+#define GOSUIMPL_INPUT_BUTTONSTATES_HPP
+
+#include <Gosu/Input.hpp>
+#include <Gosu/TR1.hpp>
+#include <bitset>
+
+namespace Gosu
+{
+    // Which buttons are held down, and which went down or up during the
+    // last Input::update. Gosu's own button ids are kept in bitsets, so
+    // that looking them up is cheap; other ids, such as unusual X keysyms,
+    // go into a hash table.
+    class ButtonStates
+    {
+        enum { DOWN = 1, PRESSED = 2, RELEASED = 4 };
+
+        std::bitset<numButtons> down, pressed, released;
+        typedef std::tr1::unordered_map<unsigned, unsigned char> Others;
+        Others others;
+
+        unsigned char otherFlags(unsigned id) const
+        {
+            Others::const_iterator iter = others.find(id);
+            return iter == others.end() ? 0 : iter->second;
+        }
+
+    public:
+        // Forgets which buttons went down or up during the last update.
+        void beginUpdate()
+        {
+            pressed.reset();
+            released.reset();
+            for (Others::iterator iter = others.begin(); iter != others.end(); )
+            {
+                iter->second &= DOWN;
+                if (iter->second == 0)
+                    others.erase(iter++);
+                else
+                    ++iter;
+            }
+        }
+
+        void set(unsigned id, bool isDown)
+        {
+            if (id < numButtons)
+            {
+                if (isDown)
+                    pressed.set(id);
+                else
+                    released.set(id);
+                down.set(id, isDown);
+            }
+            else
+            {
+                unsigned char& flags = others[id];
+                flags = isDown ? (flags | DOWN | PRESSED) : ((flags & ~DOWN) | RELEASED);
+            }
+        }
+
+        bool isDown(unsigned id) const
+        {
+            return id < numButtons ? down.test(id) : (otherFlags(id) & DOWN) != 0;
+        }
+
+        bool wasPressed(unsigned id) const
+        {
+            return id < numButtons ? pressed.test(id) : (otherFlags(id) & PRESSED) != 0;
+        }
+
+        bool wasReleased(unsigned id) const
+        {
+            return id < numButtons ? released.test(id) : (otherFlags(id) & RELEASED) != 0;
+        }
+    };
+}
+
+#endif
@@ -2,6 +2,10 @@
 #import <Carbon/Carbon.h>
 #include <Gosu/Input.hpp>
 #include <Gosu/TextInput.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
+#include <GosuImpl/EventClock.hpp>
+#include <GosuImpl/Input/ButtonStates.hpp>
 #include <GosuImpl/MacUtility.hpp>
 #include <Gosu/TR1.hpp>
 #include <Gosu/Utility.hpp>
@@ -476,7 +480,15 @@ namespace {
         }
     }
 	 
-    std::tr1::array<bool, Gosu::numButtons> buttonStates = { false };
+    Gosu::ButtonStates buttonStates;
+}
+
+namespace Gosu
+{
+    namespace FPS
+    {
+        void registerInputEvent(std::tr1::uint64_t eventTime);
+    }
 }
 
 struct Gosu::Input::Impl
@@ -493,18 +505,27 @@ struct Gosu::Input::Impl
     {
         Button btn;
         bool down;
-        WaitingButton(unsigned btnId, bool down) : btn(btnId), down(down) {}
+        std::tr1::uint64_t time;
+        WaitingButton(unsigned btnId, bool down, std::tr1::uint64_t time)
+        : btn(btnId), down(down), time(time) {}
     };
     std::vector<WaitingButton> queue;
+    
+    // NSEvent timestamps are in seconds since the system started.
+    EventClock clock;
+    // When the NSEvent that is being fed happened.
+    std::tr1::uint64_t nsEventTime;
+    std::tr1::uint64_t eventTime;
 
     Impl(Input& input)
-    : input(input), textInput(0), mouseFactorX(1), mouseFactorY(1), currentMods(0)
+    : input(input), textInput(0), mouseFactorX(1), mouseFactorY(1), currentMods(0),
+      nsEventTime(0), eventTime(0)
     {
     }
     
     void enqueue(unsigned btnId, bool down)
     {
-        queue.push_back(WaitingButton(btnId, down));
+        queue.push_back(WaitingButton(btnId, down, nsEventTime));
     }
 
     void updateMods(unsigned newMods)
@@ -561,6 +582,9 @@ bool Gosu::Input::feedNSEvent(void* event)
         
     if (type == NSKeyDown && [ev isARepeat])
         return false;
+    
+    pimpl->nsEventTime = pimpl->clock.convert(
+        static_cast<std::tr1::uint64_t>([ev timestamp] * 1000000));
             
     // Process modifier keys.
     unsigned mods = [ev modifierFlags];
@@ -626,10 +650,23 @@ Gosu::Button Gosu::Input::charToId(wchar_t ch)
 
 bool Gosu::Input::down(Gosu::Button btn) const
 {
-    if (btn == noButton || btn.id() >= numButtons)
-        return false;
+    return buttonStates.isDown(btn.id());
+}
 
-    return buttonStates.at(btn.id());
+void Gosu::Input::downMany(const Button* buttons, std::size_t count, bool* result) const
+{
+    for (std::size_t i = 0; i < count; ++i)
+        result[i] = buttonStates.isDown(buttons[i].id());
+}
+
+bool Gosu::Input::pressed(Button btn) const
+{
+    return buttonStates.wasPressed(btn.id());
+}
+
+bool Gosu::Input::released(Button btn) const
+{
+    return buttonStates.wasReleased(btn.id());
 }
 
 double Gosu::Input::mouseX() const
@@ -687,12 +724,17 @@ double Gosu::Input::accelerometerZ() const
 
 void Gosu::Input::update()
 {
+    GOSU_TRACE("Input::update");
     pimpl->refreshMousePosition();
+    buttonStates.beginUpdate();
     
     for (unsigned i = 0; i < pimpl->queue.size(); ++i)
     {
         Impl::WaitingButton& wb = pimpl->queue[i];
-        buttonStates.at(wb.btn.id()) = wb.down;
+        buttonStates.set(wb.btn.id(), wb.down);
+        pimpl->eventTime = wb.time;
+        if (wb.down)
+            FPS::registerInputEvent(wb.time);
         if (wb.down && onButtonDown)
             onButtonDown(wb.btn);
         else if (!wb.down && onButtonUp)
@@ -702,11 +744,15 @@ void Gosu::Input::update()
     
     static System sys;
     std::tr1::array<bool, gpNum> gpState = sys.poll();
+    // Gamepads are polled, so their buttons changed just now.
+    pimpl->eventTime = microseconds();
     for (unsigned i = 0; i < gpNum; ++i)
     {
-        if (buttonStates[i + gpRangeBegin] != gpState[i])
+        if (buttonStates.isDown(i + gpRangeBegin) != gpState[i])
         {
-            buttonStates[i + gpRangeBegin] = gpState[i];
+            buttonStates.set(i + gpRangeBegin, gpState[i]);
+            if (gpState[i])
+                FPS::registerInputEvent(pimpl->eventTime);
             if (gpState[i] && onButtonDown)
                 onButtonDown(Button(gpRangeBegin + i));
             else if (!gpState[i] && onButtonUp)
@@ -715,6 +761,11 @@ void Gosu::Input::update()
     }
 }
 
+std::tr1::uint64_t Gosu::Input::eventTime() const
+{
+    return pimpl->eventTime;
+}
+
 Gosu::TextInput* Gosu::Input::textInput() const
 {
     return pimpl->textInput;
@@ -1,10 +1,12 @@
 #include <Gosu/Input.hpp>
 #include <Gosu/TextInput.hpp>
+#include <Gosu/Timing.hpp>
 
 #include <GosuImpl/MacUtility.hpp>
 #include <GosuImpl/Orientation.hpp>
 #include <GosuImpl/Input/AccelerometerReader.hpp>
 #import <UIKit/UIKit.h>
+#include <algorithm>
 
 struct Gosu::TextInput::Impl {};
 Gosu::TextInput::TextInput() {}
@@ -95,6 +97,21 @@ bool Gosu::Input::down(Button btn) const
     return false;
 }
 
+void Gosu::Input::downMany(const Button* buttons, std::size_t count, bool* result) const
+{
+    std::fill(result, result + count, false);
+}
+
+bool Gosu::Input::pressed(Button btn) const
+{
+    return false;
+}
+
+bool Gosu::Input::released(Button btn) const
+{
+    return false;
+}
+
 double Gosu::Input::mouseX() const
 {
     return pimpl->mouseX;
@@ -173,6 +190,12 @@ void Gosu::Input::update()
     }
 }
 
+std::tr1::uint64_t Gosu::Input::eventTime() const
+{
+    // There are no button events on iOS.
+    return microseconds();
+}
+
 Gosu::TextInput* Gosu::Input::textInput() const
 {
     return 0;
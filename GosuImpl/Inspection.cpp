@@ -1,14 +1,119 @@
 #include <Gosu/Inspection.hpp>
+#include <Gosu/Color.hpp>
+#include <Gosu/Graphics.hpp>
 #include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
+#include <GosuImpl/MemoryStatistics.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 namespace Gosu
 {
+    namespace
+    {
+        // Ten seconds at 60 frames per second.
+        const unsigned FRAME_HISTORY = 600;
+        // Time per frame at 60 frames per second, in milliseconds.
+        const double BUDGET = 1000.0 / 60;
+        
+        // In microseconds, indexed by FramePhase.
+        struct FrameTimes
+        {
+            unsigned long phases[fpTotal + 1];
+        };
+        
+        // Ring buffer of the most recent frames. nextFrame is where the next
+        // one will be stored.
+        std::vector<FrameTimes> history;
+        unsigned nextFrame = 0;
+        
+        unsigned long pendingUpdateTime = 0;
+        std::tr1::uint64_t lastFrameEnd = 0;
+        
+        std::tr1::function<void (const FrameReport&)> frameCallback;
+        
+        // Button presses that have been handled but not shown yet, and a
+        // ring buffer of how long the most recent ones took to be shown,
+        // in microseconds.
+        std::vector<std::tr1::uint64_t> pendingEvents;
+        std::vector<unsigned long> latencies;
+        unsigned nextLatency = 0;
+        
+        // Indexed by MemoryCategory. Textures and samples may be created
+        // and destroyed on other threads.
+        long memoryCounters[mcCount];
+        
+        Mutex& memoryMutex()
+        {
+            static Mutex mutex;
+            return mutex;
+        }
+        
+        // The given number of most recent frames, oldest first.
+        std::vector<FrameTimes> recentFrames(unsigned frames)
+        {
+            std::size_t size = history.size();
+            frames = std::min<std::size_t>(frames, size);
+            
+            std::vector<FrameTimes> result(frames);
+            for (unsigned i = 0; i < frames; ++i)
+                result[i] = history[(nextFrame + size - frames + i) % size];
+            return result;
+        }
+        
+        // Nearest-rank percentile, so that p99 of fewer than 100 frames is
+        // the worst frame instead of an interpolated value.
+        double percentile(const std::vector<double>& sorted, unsigned percent)
+        {
+            std::size_t rank = (sorted.size() * percent + 99) / 100;
+            return sorted[std::max<std::size_t>(rank, 1) - 1];
+        }
+        
+        // Expects times in milliseconds.
+        FrameTimeStatistics summarize(std::vector<double>& times)
+        {
+            FrameTimeStatistics result = FrameTimeStatistics();
+            result.frames = times.size();
+            if (times.empty())
+                return result;
+            
+            double sum = 0;
+            for (std::size_t i = 0; i < times.size(); ++i)
+                sum += times[i];
+            std::sort(times.begin(), times.end());
+            
+            result.minimum = times.front();
+            result.average = sum / times.size();
+            result.p50 = percentile(times, 50);
+            result.p95 = percentile(times, 95);
+            result.p99 = percentile(times, 99);
+            result.maximum = times.back();
+            return result;
+        }
+    }
+    
     namespace FPS
     {
         int fps, accum, sec;
+        
+        // Called by each platform's Window with times in microseconds.
+        void registerUpdate(unsigned long updateTime)
+        {
+            pendingUpdateTime += updateTime;
+        }
+        
+        // Called by each platform's Input for every button press, with the
+        // time of microseconds() at which it happened.
+        void registerInputEvent(std::tr1::uint64_t eventTime)
+        {
+            pendingEvents.push_back(eventTime);
+        }
 
-        void registerFrame()
+        void registerFrame(unsigned long drawTime, unsigned long swapTime)
         {
+            finishStartup();
             ++accum;
             int newSec = Gosu::milliseconds() / 1000;
             if (sec != newSec)
@@ -17,6 +122,45 @@ namespace Gosu
                 fps = accum;
                 accum = 0;
             }
+            
+            std::tr1::uint64_t now = microseconds();
+            FrameTimes times;
+            times.phases[fpUpdate] = pendingUpdateTime;
+            times.phases[fpDraw] = drawTime;
+            times.phases[fpSwap] = swapTime;
+            // The first frame has no predecessor to measure from.
+            times.phases[fpTotal] = lastFrameEnd ? now - lastFrameEnd :
+                pendingUpdateTime + drawTime + swapTime;
+            lastFrameEnd = now;
+            pendingUpdateTime = 0;
+            
+            if (history.size() < FRAME_HISTORY)
+                history.push_back(times);
+            else
+                history[nextFrame] = times;
+            nextFrame = (nextFrame + 1) % FRAME_HISTORY;
+            
+            if (frameCallback)
+            {
+                FrameReport report;
+                report.update = times.phases[fpUpdate];
+                report.draw = drawTime;
+                report.swap = swapTime;
+                report.total = times.phases[fpTotal];
+                report.flush = rendererStatistics().flushTime;
+                frameCallback(report);
+            }
+            
+            for (std::size_t i = 0; i < pendingEvents.size(); ++i)
+            {
+                unsigned long latency = now > pendingEvents[i] ? now - pendingEvents[i] : 0;
+                if (latencies.size() < FRAME_HISTORY)
+                    latencies.push_back(latency);
+                else
+                    latencies[nextLatency] = latency;
+                nextLatency = (nextLatency + 1) % FRAME_HISTORY;
+            }
+            pendingEvents.clear();
         }
     }
     
@@ -24,4 +168,93 @@ namespace Gosu
     {
         return FPS::fps;
     }
+    
+    void setFrameCallback(const std::tr1::function<void (const FrameReport&)>& callback)
+    {
+        frameCallback = callback;
+    }
+}
+
+Gosu::FrameTimeStatistics Gosu::frameTimeStatistics(FramePhase phase, unsigned frames)
+{
+    std::vector<FrameTimes> recent = recentFrames(frames);
+    std::vector<double> times(recent.size());
+    for (std::size_t i = 0; i < recent.size(); ++i)
+        times[i] = recent[i].phases[phase] / 1000.0;
+    return summarize(times);
+}
+
+Gosu::FrameTimeStatistics Gosu::inputLatencyStatistics(unsigned events)
+{
+    std::size_t size = latencies.size();
+    events = std::min<std::size_t>(events, size);
+    std::vector<double> times(events);
+    for (unsigned i = 0; i < events; ++i)
+        times[i] = latencies[(nextLatency + size - events + i) % size] / 1000.0;
+    return summarize(times);
+}
+
+void Gosu::drawFrameTimeGraph(Graphics& graphics, double x, double y,
+    double width, double height, ZPos z, unsigned frames)
+{
+    const Color background = 0x80000000;
+    const Color colors[fpTotal + 1] = { 0xff4080ff, 0xff40ff40, 0xffa0a0a0, 0x60ffffff };
+    const Color budgetLine = 0xffff4040;
+    
+    graphics.drawQuad(x, y, background, x + width, y, background,
+        x, y + height, background, x + width, y + height, background, z);
+    
+    if (frames == 0)
+        return;
+    std::vector<FrameTimes> recent = recentFrames(frames);
+    double barWidth = width / frames;
+    // Recent frames end at the right edge, even while the history fills up.
+    double left = x + width - barWidth * recent.size();
+    double pixelsPerMicrosecond = height / (2 * BUDGET * 1000);
+    
+    for (std::size_t i = 0; i < recent.size(); ++i, left += barWidth)
+    {
+        double bottom = y + height;
+        unsigned long stacked = 0;
+        for (int phase = fpUpdate; phase <= fpTotal; ++phase)
+        {
+            // The total bar only shows what the other phases do not cover.
+            unsigned long time = recent[i].phases[phase];
+            if (phase == fpTotal)
+                time = time > stacked ? time - stacked : 0;
+            stacked += time;
+            
+            double top = std::max(bottom - time * pixelsPerMicrosecond, y);
+            if (top < bottom)
+                graphics.drawQuad(left, top, colors[phase], left + barWidth, top, colors[phase],
+                    left, bottom, colors[phase], left + barWidth, bottom, colors[phase], z);
+            bottom = top;
+        }
+    }
+    
+    double budgetY = y + height / 2;
+    graphics.drawQuad(x, budgetY, budgetLine, x + width, budgetY, budgetLine,
+        x, budgetY + 1, budgetLine, x + width, budgetY + 1, budgetLine, z);
+}
+
+void Gosu::countMemory(MemoryCategory category, long bytes)
+{
+    Lock lock(memoryMutex());
+    memoryCounters[category] += bytes;
+}
+
+Gosu::MemoryStatistics Gosu::memoryStatistics()
+{
+    Lock lock(memoryMutex());
+    MemoryStatistics result;
+    result.atlasTextures = memoryCounters[mcAtlasTextures];
+    result.dedicatedTextures = memoryCounters[mcDedicatedTextures];
+    result.fontGlyphs = memoryCounters[mcFontGlyphs];
+    result.largeImageParts = memoryCounters[mcLargeImageParts];
+    result.streamedImages = memoryCounters[mcStreamedImages];
+    result.samples = memoryCounters[mcSamples];
+    result.songs = memoryCounters[mcSongs];
+    result.macros = memoryCounters[mcMacros];
+    result.sockets = memoryCounters[mcSockets];
+    return result;
 }
@@ -0,0 +1,163 @@
+#ifndef GOSUIMPL_LZ4_HPP
+#define GOSUIMPL_LZ4_HPP
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+// Compression in the LZ4 block format: a sequence of literals followed by a
+// match, repeated. Every sequence starts with a token byte that holds the
+// number of literals in its upper four bits and the length of the match,
+// minus four, in its lower four bits; 15 means that more bytes of the
+// length follow, each of which is added until one is not 255. The match is
+// given by a 16-bit little-endian offset back into the output. The last
+// sequence consists of literals only.
+// The compressor is a simple greedy one: Fast, but it does not get close to
+// the ratios of LZ4's high-compression mode.
+
+namespace Gosu
+{
+    namespace LZ4
+    {
+        enum
+        {
+            MIN_MATCH = 4,
+            // The format requires the last five bytes to be literals and
+            // the last match to start twelve bytes before the end.
+            LAST_LITERALS = 5, MATCH_LIMIT = 12,
+            MAX_OFFSET = 65535,
+            HASH_BITS = 14
+        };
+
+        inline unsigned read32(const unsigned char* p)
+        {
+            return p[0] | p[1] << 8 | p[2] << 16 | static_cast<unsigned>(p[3]) << 24;
+        }
+
+        inline void putLength(std::vector<char>& out, std::size_t length)
+        {
+            for (; length >= 255; length -= 255)
+                out.push_back(static_cast<char>(255));
+            out.push_back(static_cast<char>(length));
+        }
+
+        inline void putSequence(std::vector<char>& out, const unsigned char* literals,
+            std::size_t literalLength, std::size_t offset, std::size_t matchLength)
+        {
+            std::size_t matchCode = matchLength ? matchLength - MIN_MATCH : 0;
+            out.push_back(static_cast<char>(
+                (literalLength < 15 ? literalLength : 15) << 4 |
+                (matchCode < 15 ? matchCode : 15)));
+            if (literalLength >= 15)
+                putLength(out, literalLength - 15);
+            out.insert(out.end(), literals, literals + literalLength);
+            if (matchLength == 0)
+                return;
+            out.push_back(static_cast<char>(offset & 0xff));
+            out.push_back(static_cast<char>(offset >> 8));
+            if (matchCode >= 15)
+                putLength(out, matchCode - 15);
+        }
+
+        // Appends the compressed form of the given bytes to out.
+        inline void compress(const void* source, std::size_t size, std::vector<char>& out)
+        {
+            const unsigned char* in = static_cast<const unsigned char*>(source);
+            std::size_t anchor = 0;
+            if (size > MATCH_LIMIT)
+            {
+                // Last position at which each hash of four bytes was seen,
+                // plus one, so that zero means none.
+                std::vector<std::size_t> table(1 << HASH_BITS);
+                std::size_t pos = 0, limit = size - MATCH_LIMIT;
+                while (pos < limit)
+                {
+                    unsigned sequence = read32(in + pos);
+                    unsigned hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+                    std::size_t candidate = table[hash];
+                    table[hash] = pos + 1;
+                    if (candidate == 0 || pos - (candidate - 1) > MAX_OFFSET ||
+                            read32(in + candidate - 1) != sequence)
+                    {
+                        ++pos;
+                        continue;
+                    }
+
+                    std::size_t match = candidate - 1, length = MIN_MATCH;
+                    while (pos + length < size - LAST_LITERALS &&
+                            in[match + length] == in[pos + length])
+                        ++length;
+                    putSequence(out, in + anchor, pos - anchor, pos - match, length);
+                    pos += length;
+                    anchor = pos;
+                }
+            }
+            putSequence(out, in + anchor, size - anchor, 0, 0);
+        }
+
+        inline void broken()
+        {
+            throw std::runtime_error("Broken LZ4 data");
+        }
+
+        inline std::size_t getLength(const unsigned char*& p, const unsigned char* end)
+        {
+            std::size_t result = 0;
+            unsigned char byte;
+            do
+            {
+                if (p == end)
+                    broken();
+                byte = *p++;
+                result += byte;
+            }
+            while (byte == 255);
+            return result;
+        }
+
+        // Decompresses data that is known to expand to exactly destSize
+        // bytes. Throws an exception if it is broken.
+        inline void decompress(const void* source, std::size_t size,
+            void* dest, std::size_t destSize)
+        {
+            const unsigned char* p = static_cast<const unsigned char*>(source);
+            const unsigned char* end = p + size;
+            unsigned char* out = static_cast<unsigned char*>(dest);
+            std::size_t written = 0;
+
+            while (p != end)
+            {
+                unsigned token = *p++;
+                std::size_t literals = token >> 4;
+                if (literals == 15)
+                    literals += getLength(p, end);
+                if (literals > static_cast<std::size_t>(end - p) ||
+                        literals > destSize - written)
+                    broken();
+                std::memcpy(out + written, p, literals);
+                p += literals;
+                written += literals;
+                if (p == end)
+                    break;
+
+                if (end - p < 2)
+                    broken();
+                std::size_t offset = p[0] | p[1] << 8;
+                p += 2;
+                std::size_t length = token & 15;
+                if (length == 15)
+                    length += getLength(p, end);
+                length += MIN_MATCH;
+                if (offset == 0 || offset > written || length > destSize - written)
+                    broken();
+                // Byte by byte, since matches may overlap what they produce.
+                for (std::size_t i = 0; i < length; ++i, ++written)
+                    out[written] = out[written - offset];
+            }
+            if (written != destSize)
+                broken();
+        }
+    }
+}
+
+#endif
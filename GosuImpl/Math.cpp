@@ -1,21 +1,167 @@
 #include <Gosu/Math.hpp>
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Threading.hpp>
 #include <cmath>
-#include <cstdlib>
+#include <ctime>
+
+namespace
+{
+    using std::tr1::uint32_t;
+    using std::tr1::uint64_t;
+    
+    // PCG32 (XSH RR variant, see pcg-random.org) with a fixed stream.
+    // Works on a copy of the thread's state, so that bulk generation keeps
+    // it in a register instead of going through thread-local storage.
+    struct Generator
+    {
+        uint64_t state;
+        
+        uint32_t next()
+        {
+            uint64_t old = state;
+            state = old * 6364136223846793005ull + 1442695040888963407ull;
+            uint32_t shifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+            unsigned rotation = static_cast<unsigned>(old >> 59);
+            return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+        }
+        
+        double real(double min, double max)
+        {
+            return next() * (1.0 / 4294967296.0) * (max - min) + min;
+        }
+        
+        // Multiplies instead of taking the remainder; the bias is at most
+        // range / 2^32.
+        int integer(int min, int max)
+        {
+            if (max <= min)
+                return min;
+            uint32_t range = static_cast<uint32_t>(max) - static_cast<uint32_t>(min);
+            return static_cast<int>(static_cast<uint32_t>(min) +
+                static_cast<uint32_t>((static_cast<uint64_t>(next()) * range) >> 32));
+        }
+    };
+    
+    GOSU_THREAD_LOCAL uint64_t threadState;
+    GOSU_THREAD_LOCAL bool threadSeeded;
+    unsigned long seededThreads;
+    
+    // Spreads similar seeds over the whole state (SplitMix64's finalizer).
+    uint64_t mix(uint64_t value)
+    {
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+    
+    Generator load()
+    {
+        if (!threadSeeded)
+        {
+            // The address of the state tells threads apart, the counter
+            // threads that reuse the same address, the time runs.
+            uint64_t address = reinterpret_cast<std::size_t>(&threadState);
+            threadState = mix(mix(static_cast<uint64_t>(std::time(0))) ^
+                mix(address) ^ ++seededThreads);
+            threadSeeded = true;
+        }
+        Generator generator = { threadState };
+        return generator;
+    }
+    
+    void store(const Generator& generator)
+    {
+        threadState = generator.state;
+    }
+}
 
 double Gosu::random(double min, double max)
 {
-    double rnd = std::rand();
-    return rnd / (static_cast<double>(RAND_MAX) + 1) * (max - min) + min;
+    Generator generator = load();
+    double result = generator.real(min, max);
+    store(generator);
+    return result;
+}
+
+int Gosu::randomInt(int min, int max)
+{
+    Generator generator = load();
+    int result = generator.integer(min, max);
+    store(generator);
+    return result;
+}
+
+void Gosu::seedRandom(unsigned long seed)
+{
+    threadState = mix(seed);
+    threadSeeded = true;
+}
+
+void Gosu::fillRandom(double* values, std::size_t count, double min, double max)
+{
+    Generator generator = load();
+    for (std::size_t i = 0; i < count; ++i)
+        values[i] = generator.real(min, max);
+    store(generator);
+}
+
+void Gosu::fillRandom(int* values, std::size_t count, int min, int max)
+{
+    Generator generator = load();
+    for (std::size_t i = 0; i < count; ++i)
+        values[i] = generator.integer(min, max);
+    store(generator);
+}
+
+namespace
+{
+    // Sine and cosine of an angle in degrees. The angle is reduced to
+    // -45..45 degrees from the nearest multiple of 90, exactly for all but
+    // huge angles, where the Taylor series below are off by less than 1e-15.
+    void sinCos(double angle, double& sine, double& cosine)
+    {
+        // Keeps the number of quarters in the range of long.
+        if (std::fabs(angle) > 1e9)
+            angle = std::fmod(angle, 360.0);
+        long quarters = Gosu::round(angle / 90);
+        double x = (angle - quarters * 90.0) * (3.14159265358979323846 / 180);
+        double x2 = x * x;
+        double s = x * (1 + x2 * (-1.0 / 6 + x2 * (1.0 / 120 + x2 * (-1.0 / 5040 +
+            x2 * (1.0 / 362880 + x2 * (-1.0 / 39916800 + x2 * (1.0 / 6227020800.0)))))));
+        double c = 1 + x2 * (-1.0 / 2 + x2 * (1.0 / 24 + x2 * (-1.0 / 720 +
+            x2 * (1.0 / 40320 + x2 * (-1.0 / 3628800 + x2 * (1.0 / 479001600.0 +
+            x2 * (-1.0 / 87178291200.0)))))));
+        
+        switch (quarters & 3)
+        {
+        case 0: sine = +s, cosine = +c; break;
+        case 1: sine = +c, cosine = -s; break;
+        case 2: sine = -s, cosine = -c; break;
+        default: sine = -c, cosine = +s; break;
+        }
+    }
 }
 
 double Gosu::offsetX(double angle, double radius)
 {
-    return +std::sin(angle / 180 * pi) * radius;
+    double x, y;
+    offsetXY(angle, radius, x, y);
+    return x;
 }
 
 double Gosu::offsetY(double angle, double radius)
 {
-    return -std::cos(angle / 180 * pi) * radius;
+    double x, y;
+    offsetXY(angle, radius, x, y);
+    return y;
+}
+
+void Gosu::offsetXY(double angle, double radius, double& x, double& y)
+{
+    double sine, cosine;
+    sinCos(angle, sine, cosine);
+    x = +sine * radius;
+    y = -cosine * radius;
 }
 
 double Gosu::angle(double fromX, double fromY, double toX, double toY,
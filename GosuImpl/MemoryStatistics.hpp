@@ -0,0 +1,87 @@
+#ifndef GOSUIMPL_MEMORYSTATISTICS_HPP
+#define GOSUIMPL_MEMORYSTATISTICS_HPP
+
+// Counters behind Gosu::memoryStatistics (see Inspection.hpp). Subsystems
+// own a MemoryCount for each piece of memory that they want reported and
+// keep it up to date as the memory grows and shrinks.
+
+namespace Gosu
+{
+    // One per member of MemoryStatistics.
+    enum MemoryCategory
+    {
+        mcAtlasTextures,
+        mcDedicatedTextures,
+        mcFontGlyphs,
+        mcLargeImageParts,
+        mcStreamedImages,
+        mcSamples,
+        mcSongs,
+        mcMacros,
+        mcSockets,
+        mcCount
+    };
+
+    // Adds to the counter of a category, or subtracts from it if negative.
+    // Thread-safe.
+    void countMemory(MemoryCategory category, long bytes);
+
+    // Counts a number of bytes in a category for as long as it exists.
+    // Copies count the same bytes again, like copying the memory would.
+    class MemoryCount
+    {
+        MemoryCategory cat;
+        unsigned long bytes;
+
+    public:
+        explicit MemoryCount(MemoryCategory category, unsigned long bytes = 0)
+        : cat(category), bytes(bytes)
+        {
+            countMemory(cat, bytes);
+        }
+
+        MemoryCount(const MemoryCount& other)
+        : cat(other.cat), bytes(other.bytes)
+        {
+            countMemory(cat, bytes);
+        }
+
+        MemoryCount& operator=(const MemoryCount& other)
+        {
+            setCategory(other.cat);
+            set(other.bytes);
+            return *this;
+        }
+
+        ~MemoryCount()
+        {
+            countMemory(cat, -static_cast<long>(bytes));
+        }
+
+        unsigned long get() const
+        {
+            return bytes;
+        }
+
+        void set(unsigned long newBytes)
+        {
+            countMemory(cat, static_cast<long>(newBytes) - static_cast<long>(bytes));
+            bytes = newBytes;
+        }
+
+        MemoryCategory category() const
+        {
+            return cat;
+        }
+
+        // Moves the bytes to another category.
+        void setCategory(MemoryCategory category)
+        {
+            countMemory(cat, -static_cast<long>(bytes));
+            cat = category;
+            countMemory(cat, bytes);
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef GOSUIMPL_PREFIXWIDTHS_HPP
+#define GOSUIMPL_PREFIXWIDTHS_HPP
+
+#include <Gosu/Font.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace Gosu
+{
+    // Widths of all prefixes of a TextInput's text, as drawn by one font,
+    // so that the caret and selection can be found every frame without
+    // measuring the text again. Edits only invalidate the widths from the
+    // first character they touch, and these are measured again lazily.
+    class PrefixWidths
+    {
+        const Font* font;
+        // widths[i] is the width of the first i characters.
+        std::vector<double> widths;
+        // How many entries of widths are up to date, at least 1.
+        std::size_t valid;
+
+    public:
+        PrefixWidths()
+        : font(0), widths(1, 0.0), valid(1)
+        {
+        }
+
+        // Call before changing the text from the given index on.
+        void invalidate(std::size_t from)
+        {
+            valid = std::min(valid, from + 1);
+        }
+
+        double at(const Font& font, const std::wstring& text, std::size_t pos)
+        {
+            if (&font != this->font)
+            {
+                this->font = &font;
+                valid = 1;
+            }
+            pos = std::min(pos, text.length());
+
+            widths.resize(text.length() + 1);
+            valid = std::min(valid, widths.size());
+            for (; valid <= pos; ++valid)
+                widths[valid] = widths[valid - 1] +
+                    font.textWidth(std::wstring(1, text[valid - 1]));
+            return widths[pos];
+        }
+    };
+}
+
+#endif
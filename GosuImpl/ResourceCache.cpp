@@ -0,0 +1,201 @@
+#include <Gosu/ResourceCache.hpp>
+#include <GosuImpl/ResourceCache.hpp>
+#include <algorithm>
+#include <functional>
+
+namespace Gosu
+{
+    namespace
+    {
+        bool enabled = false;
+        // Not local statics, which might be constructed by two threads at
+        // once.
+        ResourceCache images, samples;
+        TextImageCache textImages;
+    }
+}
+
+bool Gosu::ResourceCache::Key::operator<(const Key& other) const
+{
+    if (filename != other.filename)
+        return filename < other.filename;
+    if (owner != other.owner)
+        return std::less<const void*>()(owner, other.owner);
+    return std::lexicographical_compare(args, args + 5, other.args, other.args + 5);
+}
+
+std::tr1::shared_ptr<void> Gosu::ResourceCache::find(const Key& key)
+{
+    if (!enabled)
+        return std::tr1::shared_ptr<void>();
+    
+    Lock lock(mutex);
+    Entries::iterator iter = entries.find(key);
+    std::tr1::shared_ptr<void> data;
+    if (iter != entries.end())
+        data = iter->second.lock();
+    if (data)
+        ++hits_;
+    else
+        ++misses_;
+    return data;
+}
+
+void Gosu::ResourceCache::insert(const Key& key, const std::tr1::shared_ptr<void>& data)
+{
+    if (!enabled)
+        return;
+    
+    Lock lock(mutex);
+    entries[key] = data;
+    
+    // Forget what has been freed whenever the cache has doubled in size,
+    // so that the keys do not pile up.
+    static const std::size_t MIN_PRUNED_SIZE = 64;
+    if (entries.size() >= MIN_PRUNED_SIZE && (entries.size() & (entries.size() - 1)) == 0)
+    {
+        for (Entries::iterator iter = entries.begin(); iter != entries.end(); )
+        {
+            if (iter->second.expired())
+                entries.erase(iter++);
+            else
+                ++iter;
+        }
+    }
+}
+
+unsigned long Gosu::ResourceCache::hits() const
+{
+    Lock lock(mutex);
+    return hits_;
+}
+
+unsigned long Gosu::ResourceCache::misses() const
+{
+    Lock lock(mutex);
+    return misses_;
+}
+
+Gosu::ResourceCache& Gosu::imageCache()
+{
+    return images;
+}
+
+Gosu::ResourceCache& Gosu::sampleCache()
+{
+    return samples;
+}
+
+bool Gosu::TextImageCache::Key::operator<(const Key& other) const
+{
+    if (text != other.text)
+        return text < other.text;
+    if (fontName != other.fontName)
+        return fontName < other.fontName;
+    if (owner != other.owner)
+        return std::less<const void*>()(owner, other.owner);
+    return std::lexicographical_compare(args, args + 6, other.args, other.args + 6);
+}
+
+void Gosu::TextImageCache::shrink()
+{
+    while (used_ > capacity_)
+    {
+        used_ -= entries.back().bytes;
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+}
+
+void Gosu::TextImageCache::setCapacity(std::size_t bytes)
+{
+    Lock lock(mutex);
+    capacity_ = bytes;
+    shrink();
+}
+
+std::tr1::shared_ptr<void> Gosu::TextImageCache::find(const Key& key)
+{
+    Lock lock(mutex);
+    if (capacity_ == 0)
+        return std::tr1::shared_ptr<void>();
+    
+    std::map<Key, Entries::iterator>::iterator iter = index.find(key);
+    if (iter == index.end())
+    {
+        ++misses_;
+        return std::tr1::shared_ptr<void>();
+    }
+    ++hits_;
+    entries.splice(entries.begin(), entries, iter->second);
+    return iter->second->data;
+}
+
+void Gosu::TextImageCache::insert(const Key& key, const std::tr1::shared_ptr<void>& data,
+    std::size_t bytes)
+{
+    Lock lock(mutex);
+    if (bytes > capacity_)
+        return;
+    
+    // Another thread may have rendered the same text in the meantime.
+    std::map<Key, Entries::iterator>::iterator iter = index.find(key);
+    if (iter != index.end())
+    {
+        used_ -= iter->second->bytes;
+        entries.erase(iter->second);
+        index.erase(iter);
+    }
+    
+    Entry entry = { key, data, bytes };
+    entries.push_front(entry);
+    index.insert(std::make_pair(key, entries.begin()));
+    used_ += bytes;
+    shrink();
+}
+
+unsigned long Gosu::TextImageCache::hits() const
+{
+    Lock lock(mutex);
+    return hits_;
+}
+
+unsigned long Gosu::TextImageCache::misses() const
+{
+    Lock lock(mutex);
+    return misses_;
+}
+
+std::size_t Gosu::TextImageCache::used() const
+{
+    Lock lock(mutex);
+    return used_;
+}
+
+Gosu::TextImageCache& Gosu::textImageCache()
+{
+    return textImages;
+}
+
+void Gosu::enableResourceCache(bool enabled)
+{
+    Gosu::enabled = enabled;
+}
+
+void Gosu::setTextImageCacheSize(std::size_t bytes)
+{
+    textImageCache().setCapacity(bytes);
+}
+
+Gosu::ResourceCacheStatistics Gosu::resourceCacheStatistics()
+{
+    ResourceCacheStatistics statistics;
+    statistics.imageHits = imageCache().hits();
+    statistics.imageMisses = imageCache().misses();
+    statistics.sampleHits = sampleCache().hits();
+    statistics.sampleMisses = sampleCache().misses();
+    statistics.textImageHits = textImageCache().hits();
+    statistics.textImageMisses = textImageCache().misses();
+    statistics.textImageBytes = textImageCache().used();
+    return statistics;
+}
@@ -0,0 +1,140 @@
+#ifndef GOSUIMPL_RESOURCECACHE_HPP
+#define GOSUIMPL_RESOURCECACHE_HPP
+
+#include <Gosu/TR1.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+
+namespace Gosu
+{
+    // Weak references to the data of loaded images or samples, by filename
+    // and constructor arguments. Data is kept as void, so that private
+    // types such as Sample::SampleData can be stored; each user casts it
+    // back. Images and samples may be loaded on background threads (see
+    // Async.hpp), hence the mutex.
+    class ResourceCache
+    {
+        ResourceCache(const ResourceCache&);
+        ResourceCache& operator=(const ResourceCache&);
+        
+    public:
+        struct Key
+        {
+            std::wstring filename;
+            // Object that the data belongs to, such as a Graphics, or 0.
+            const void* owner;
+            unsigned args[5];
+            
+            Key(const std::wstring& filename, const void* owner, unsigned flags,
+                unsigned srcX = 0, unsigned srcY = 0,
+                unsigned srcWidth = 0, unsigned srcHeight = 0)
+            : filename(filename), owner(owner)
+            {
+                args[0] = flags;
+                args[1] = srcX;
+                args[2] = srcY;
+                args[3] = srcWidth;
+                args[4] = srcHeight;
+            }
+            
+            bool operator<(const Key& other) const;
+        };
+        
+    private:
+        typedef std::map<Key, std::tr1::weak_ptr<void> > Entries;
+        Entries entries;
+        unsigned long hits_, misses_;
+        mutable Mutex mutex;
+        
+    public:
+        ResourceCache() : hits_(0), misses_(0) {}
+        
+        // Returns null if the data has to be loaded, and always if the
+        // cache is disabled.
+        std::tr1::shared_ptr<void> find(const Key& key);
+        // Remembers data that was loaded after find returned null.
+        void insert(const Key& key, const std::tr1::shared_ptr<void>& data);
+        
+        unsigned long hits() const;
+        unsigned long misses() const;
+    };
+    
+    ResourceCache& imageCache();
+    ResourceCache& sampleCache();
+    
+    // Strong references to the data of text images, by their text and
+    // arguments, with the least recently used ones dropped when they take
+    // more than a given size.
+    class TextImageCache
+    {
+        TextImageCache(const TextImageCache&);
+        TextImageCache& operator=(const TextImageCache&);
+        
+    public:
+        struct Key
+        {
+            std::wstring text, fontName;
+            const void* owner;
+            // Whether the text is wrapped, then height, flags, spacing,
+            // width and alignment.
+            int args[6];
+            
+            Key(const std::wstring& text, const std::wstring& fontName,
+                const void* owner, bool wrapped, unsigned fontHeight,
+                unsigned fontFlags, int lineSpacing = 0, unsigned width = 0,
+                int align = 0)
+            : text(text), fontName(fontName), owner(owner)
+            {
+                args[0] = wrapped;
+                args[1] = fontHeight;
+                args[2] = fontFlags;
+                args[3] = lineSpacing;
+                args[4] = width;
+                args[5] = align;
+            }
+            
+            bool operator<(const Key& other) const;
+        };
+        
+    private:
+        struct Entry
+        {
+            Key key;
+            std::tr1::shared_ptr<void> data;
+            std::size_t bytes;
+        };
+        // Most recently used first.
+        typedef std::list<Entry> Entries;
+        Entries entries;
+        std::map<Key, Entries::iterator> index;
+        std::size_t capacity_, used_;
+        unsigned long hits_, misses_;
+        mutable Mutex mutex;
+        
+        void shrink();
+        
+    public:
+        TextImageCache() : capacity_(0), used_(0), hits_(0), misses_(0) {}
+        
+        void setCapacity(std::size_t bytes);
+        
+        // Returns null if the text has to be rendered, and always if the
+        // cache is disabled.
+        std::tr1::shared_ptr<void> find(const Key& key);
+        // Remembers data that takes the given number of bytes after find
+        // returned null.
+        void insert(const Key& key, const std::tr1::shared_ptr<void>& data,
+            std::size_t bytes);
+        
+        unsigned long hits() const;
+        unsigned long misses() const;
+        std::size_t used() const;
+    };
+    
+    TextImageCache& textImageCache();
+}
+
+#endif
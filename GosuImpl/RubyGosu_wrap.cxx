@@ -2697,12 +2697,12 @@ SWIGINTERN Gosu::GLTexInfo *Gosu_Image_glTexInfo(Gosu::Image const *self){
             return 0;
     }
 SWIGINTERN Gosu::Image *Gosu_Image_fromText4(Gosu::Window &window,std::wstring const &text,std::wstring const &fontName,unsigned int fontHeight){
-        Gosu::Bitmap bmp = Gosu::createText(text, fontName, fontHeight);
-        return new Gosu::Image(window.graphics(), bmp);
+        return new Gosu::Image(Gosu::Image::fromText(window.graphics(), text,
+            fontName, fontHeight));
     }
 SWIGINTERN Gosu::Image *Gosu_Image_fromText7(Gosu::Window &window,std::wstring const &text,std::wstring const &fontName,unsigned int fontHeight,int lineSpacing,unsigned int width,Gosu::TextAlign align){
-        Gosu::Bitmap bmp = Gosu::createText(text, fontName, fontHeight, lineSpacing, width, align);
-        return new Gosu::Image(window.graphics(), bmp);
+        return new Gosu::Image(Gosu::Image::fromText(window.graphics(), text,
+            fontName, fontHeight, lineSpacing, width, align));
     }
 SWIGINTERN std::vector< Gosu::Image * > Gosu_Image_loadTiles(Gosu::Window &window,VALUE source,int tileWidth,int tileHeight,bool tileable){
         std::vector<Gosu::Image*> vec;
@@ -0,0 +1,164 @@
+#include <Gosu/Sockets.hpp>
+#include <Gosu/Async.hpp>
+#include <Gosu/Timing.hpp>
+#include <GosuImpl/Sockets/Sockets.hpp>
+#include <map>
+#include <vector>
+
+namespace
+{
+    // Hosts that are remembered at most. When there are more, those that
+    // have expired are dropped, or all of them if none have.
+    const std::size_t MAX_CACHED = 256;
+
+    void lookUp(std::string host, std::tr1::shared_ptr<Gosu::SocketAddress> address)
+    {
+        *address = Gosu::stringToAddress(host);
+    }
+}
+
+struct Gosu::AddressResolver::Impl
+{
+    AsyncPool pool;
+
+    struct Entry
+    {
+        SocketAddress address;
+        unsigned long time;
+    };
+    typedef std::map<std::string, Entry> Cache;
+    Cache cache;
+    unsigned cacheDuration;
+
+    // Callbacks of the hosts that are being looked up.
+    typedef std::map<std::string, std::vector<Callback> > Lookups;
+    Lookups lookups;
+    // Callbacks of cached hosts, for the next update().
+    std::vector<std::tr1::function<void ()> > answered;
+
+    explicit Impl(unsigned threads)
+    : pool(threads), cacheDuration(5 * 60 * 1000)
+    {
+    }
+
+    const Entry* find(const std::string& host) const
+    {
+        Cache::const_iterator iter = cache.find(host);
+        if (iter == cache.end() || milliseconds() - iter->second.time >= cacheDuration)
+            return 0;
+        return &iter->second;
+    }
+
+    void remember(const std::string& host, SocketAddress address)
+    {
+        if (cacheDuration == 0 || address == 0)
+            return;
+
+        if (cache.size() >= MAX_CACHED && !cache.count(host))
+        {
+            for (Cache::iterator iter = cache.begin(); iter != cache.end(); )
+            {
+                if (milliseconds() - iter->second.time >= cacheDuration)
+                    cache.erase(iter++);
+                else
+                    ++iter;
+            }
+            if (cache.size() >= MAX_CACHED)
+                cache.clear();
+        }
+
+        Entry& entry = cache[host];
+        entry.address = address;
+        entry.time = milliseconds();
+    }
+
+    void done(const std::string& host, std::tr1::shared_ptr<SocketAddress> address)
+    {
+        remember(host, *address);
+
+        // Callbacks may resolve the same host again, so they are taken out
+        // of the map first.
+        std::vector<Callback> callbacks;
+        Lookups::iterator iter = lookups.find(host);
+        if (iter == lookups.end())
+            return;
+        callbacks.swap(iter->second);
+        lookups.erase(iter);
+
+        for (std::size_t i = 0; i < callbacks.size(); ++i)
+            if (callbacks[i])
+                callbacks[i](host, *address);
+    }
+};
+
+Gosu::AddressResolver::AddressResolver(unsigned threads)
+: pimpl(new Impl(threads))
+{
+    // Must not happen on the workers for the first time.
+    needsSockLib();
+}
+
+Gosu::AddressResolver::~AddressResolver()
+{
+}
+
+void Gosu::AddressResolver::resolve(const std::string& host, const Callback& callback)
+{
+    if (const Impl::Entry* entry = pimpl->find(host))
+    {
+        if (callback)
+            pimpl->answered.push_back(std::tr1::bind(callback, host, entry->address));
+        return;
+    }
+
+    Impl::Lookups::iterator iter = pimpl->lookups.find(host);
+    if (iter != pimpl->lookups.end())
+    {
+        iter->second.push_back(callback);
+        return;
+    }
+
+    pimpl->lookups[host].push_back(callback);
+    std::tr1::shared_ptr<SocketAddress> address(new SocketAddress(0));
+    pimpl->pool.enqueue(std::tr1::bind(lookUp, host, address),
+        std::tr1::bind(&Impl::done, pimpl.get(), host, address));
+}
+
+bool Gosu::AddressResolver::cached(const std::string& host, SocketAddress& address) const
+{
+    const Impl::Entry* entry = pimpl->find(host);
+    if (!entry)
+        return false;
+    address = entry->address;
+    return true;
+}
+
+std::size_t Gosu::AddressResolver::pending() const
+{
+    return pimpl->lookups.size();
+}
+
+void Gosu::AddressResolver::update()
+{
+    std::vector<std::tr1::function<void ()> > answered;
+    answered.swap(pimpl->answered);
+    for (std::size_t i = 0; i < answered.size(); ++i)
+        answered[i]();
+
+    pimpl->pool.deliver();
+}
+
+unsigned Gosu::AddressResolver::cacheDuration() const
+{
+    return pimpl->cacheDuration;
+}
+
+void Gosu::AddressResolver::setCacheDuration(unsigned milliseconds)
+{
+    pimpl->cacheDuration = milliseconds;
+}
+
+void Gosu::AddressResolver::clearCache()
+{
+    pimpl->cache.clear();
+}
@@ -1,10 +1,19 @@
 #include <Gosu/Sockets.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
 #include <Gosu/TR1.hpp>
 #include <GosuImpl/Sockets/Sockets.hpp>
+#include <GosuImpl/MemoryStatistics.hpp>
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <deque>
 #include <stdexcept>
 #include <vector>
+#ifndef GOSU_IS_WIN
+#include <poll.h>
+#include <sys/uio.h>
+#endif
 
 struct Gosu::CommSocket::Impl
 {
@@ -12,16 +21,243 @@ struct Gosu::CommSocket::Impl
     CommMode mode;
 
     typedef std::vector<char> Buffer;
-    Buffer inbox, outbox;
+    Buffer inbox, outbox, urgentOutbox;
+    // Bytes at the front of the inbox that belong to messages that have
+    // been delivered already. They are only erased once they make up half
+    // of the inbox, so that bursts of small messages do not move the rest
+    // of the inbox again and again.
+    std::size_t inboxStart;
+    // Like inboxStart, for bytes that have been sent.
+    std::size_t outboxStart, urgentStart;
+    // The sizes of the messages in the outbox, the first one only counting
+    // what is left of it. Urgent messages can only go ahead of a message
+    // that has not been started, or the other side could not tell them
+    // apart. Urgent messages never wait for others, so they need no sizes.
+    std::deque<std::size_t> outboxSizes;
+    bool outboxStarted;
+    // Token bucket for the outbox, unless the rate limit is 0. Tokens are
+    // bytes; urgent messages may take more than there are.
+    std::size_t rateLimit, burst;
+    double tokens;
+    unsigned long lastRefill;
+    // Grows with the amount of data that is waiting, up to a limit.
+    Buffer receiveBuffer;
+    std::size_t maxBytesPerUpdate;
+    SocketCounters counters;
+    MemoryCount memory;
+    // Set while a non-blocking connect is in progress. The deadline is in
+    // milliseconds(), and 0 if there is none.
+    bool connecting;
+    unsigned long connectDeadline;
+
+    Impl()
+    : inboxStart(0), outboxStart(0), urgentStart(0), outboxStarted(false),
+      rateLimit(0), burst(0), tokens(0), lastRefill(0),
+      maxBytesPerUpdate(1024 * 1024), memory(mcSockets),
+      connecting(false), connectDeadline(0)
+    {
+    }
+    
+    // Whether the socket has become writable, which is when a non-blocking
+    // connect has either succeeded or failed. Does not wait.
+    bool writable()
+    {
+        #ifdef GOSU_IS_WIN
+        // Windows reports failed connects through the exception set.
+        fd_set writeSet, exceptSet;
+        FD_ZERO(&writeSet);
+        FD_ZERO(&exceptSet);
+        FD_SET(socket.handle(), &writeSet);
+        FD_SET(socket.handle(), &exceptSet);
+        timeval noWait = { 0, 0 };
+        return socketCheck(::select(0, 0, &writeSet, &exceptSet, &noWait)) > 0;
+        #else
+        pollfd entry;
+        entry.fd = socket.handle();
+        entry.events = POLLOUT;
+        entry.revents = 0;
+        return socketCheck(::poll(&entry, 1, 0)) > 0;
+        #endif
+    }
+    
+    // Buffers keep their capacity when they are cleared, so this only has
+    // to be called when they may have grown.
+    void updateMemory()
+    {
+        memory.set(inbox.capacity() + outbox.capacity() + urgentOutbox.capacity() +
+            receiveBuffer.capacity());
+    }
+    
+    std::size_t urgentBytes() const
+    {
+        return urgentOutbox.size() - urgentStart;
+    }
+    
+    std::size_t outboxBytes() const
+    {
+        return outbox.size() - outboxStart;
+    }
+    
+    // How many bytes the rate limit lets through the outbox right now.
+    std::size_t allowance()
+    {
+        if (rateLimit == 0)
+            return static_cast<std::size_t>(-1);
+        
+        unsigned long now = milliseconds();
+        tokens = std::min<double>(burst, tokens + (now - lastRefill) * (rateLimit / 1000.0));
+        lastRefill = now;
+        return tokens > 0 ? static_cast<std::size_t>(tokens) : 0;
+    }
+    
+    // Counts bytes that have been handed to the system.
+    void sent(std::size_t bytes, std::size_t attempted)
+    {
+        counters.values.bytesSent += bytes;
+        if (bytes < attempted)
+            ++counters.values.partialSends;
+        if (rateLimit != 0)
+            tokens -= bytes;
+    }
+    
+    // Skips sent data, and only erases it once it makes up half of the
+    // buffer.
+    static void skip(Buffer& buffer, std::size_t& start, std::size_t bytes)
+    {
+        start += bytes;
+        if (start == buffer.size())
+        {
+            buffer.clear();
+            start = 0;
+        }
+        else if (start > buffer.size() / 2)
+        {
+            buffer.erase(buffer.begin(), buffer.begin() + start);
+            start = 0;
+        }
+    }
+    
+    void skipOutbox(std::size_t bytes)
+    {
+        skip(outbox, outboxStart, bytes);
+        outboxStarted = bytes > 0 || outboxStarted;
+        while (bytes > 0)
+        {
+            if (bytes < outboxSizes.front())
+            {
+                outboxSizes.front() -= bytes;
+                return;
+            }
+            bytes -= outboxSizes.front();
+            outboxSizes.pop_front();
+            outboxStarted = false;
+        }
+    }
+    
+    // Sends two pieces of memory with one call, like ::send.
+    int sendTwo(const char* first, std::size_t firstSize,
+        const char* second, std::size_t secondSize)
+    {
+        #ifdef GOSU_IS_WIN
+        WSABUF buffers[2];
+        buffers[0].buf = const_cast<char*>(first);
+        buffers[0].len = firstSize;
+        buffers[1].buf = const_cast<char*>(second);
+        buffers[1].len = secondSize;
+        DWORD sent;
+        if (WSASend(socket.handle(), buffers, 2, &sent, 0, 0, 0) != 0)
+            return SOCKET_ERROR;
+        return sent;
+        #else
+        iovec buffers[2];
+        buffers[0].iov_base = const_cast<char*>(first);
+        buffers[0].iov_len = firstSize;
+        buffers[1].iov_base = const_cast<char*>(second);
+        buffers[1].iov_len = secondSize;
+        return ::writev(socket.handle(), buffers, 2);
+        #endif
+    }
+
+    // How much to receive at once: what is waiting, within limits.
+    std::size_t receiveSize(std::size_t budget)
+    {
+        const std::size_t MIN_RECEIVE = 4096, MAX_RECEIVE = 65536;
+        
+        #ifdef GOSU_IS_WIN
+        u_long available = 0;
+        #else
+        int available = 0;
+        #endif
+        if (ioctlsocket(socket.handle(), FIONREAD, &available) != 0)
+            available = 0;
+        
+        std::size_t size = std::max<std::size_t>(available, MIN_RECEIVE);
+        size = std::min(std::min(size, MAX_RECEIVE), budget);
+        if (receiveBuffer.size() < size)
+        {
+            receiveBuffer.resize(size);
+            updateMemory();
+        }
+        return size;
+    }
+
+    // Calls the event for each complete message in data, which the event
+    // sees in place. Returns how many bytes these messages took.
+    std::size_t deliverMessages(const char* data, std::size_t size,
+        std::tr1::function<void (const void*, std::size_t)>& event)
+    {
+        const std::size_t sizeSize = 4;
+        std::size_t pos = 0;
+        for (;;)
+        {
+            // Not even enough bytes there to determine the size of the
+            // incoming message.
+            if (size - pos < sizeSize)
+                break;
+
+            // Message size is already here, convert it. It may not be
+            // aligned.
+            std::tr1::uint32_t msgSize;
+            std::memcpy(&msgSize, data + pos, sizeSize);
+            msgSize = ntohl(msgSize);
+
+            // Can't really handle zero-size messages. IMPR?!
+            if (msgSize == 0)
+                throw std::logic_error("Cannot handle empty messages");
+
+            // Has the current message arrived completely?
+            if (size - pos - sizeSize < msgSize)
+                break;
+
+            // Current message is here: Call event...
+            ++counters.values.packetsReceived;
+            if (event)
+                event(data + pos + sizeSize, msgSize);
+
+            // ...and skip it.
+            pos += sizeSize + msgSize;
+        }
+        return pos;
+    }
+
+    void updateOutbox()
+    {
+        SocketStatistics& values = counters.values;
+        values.outboxBytes = outboxBytes() + urgentBytes();
+        values.outboxHighWater = std::max(values.outboxHighWater, values.outboxBytes);
+        updateMemory();
+    }
 
     void appendBuffer(const char* buffer, std::size_t size,
         std::tr1::function<void (const void*, std::size_t)>& event)
     {
+        counters.values.bytesReceived += size;
         switch (mode)
         {
             case cmRaw:
             {
                 // Raw = simple! Yay.
+                ++counters.values.packetsReceived;
                 if (event)
                     event(buffer, size);
 
@@ -30,42 +266,39 @@ struct Gosu::CommSocket::Impl
 
             case cmManaged:
             {
+                // Messages that arrive in one piece are delivered straight
+                // from the buffer; only the incomplete rest is kept.
+                if (inboxStart == inbox.size())
+                {
+                    inbox.clear();
+                    inboxStart = 0;
+                    std::size_t delivered = deliverMessages(buffer, size, event);
+                    inbox.insert(inbox.end(), buffer + delivered, buffer + size);
+                    counters.values.inboxBytes = inbox.size();
+                    break;
+                }
+
                 // Append new data to inbox.
                 inbox.insert(inbox.end(), buffer, buffer + size);
+                inboxStart += deliverMessages(&inbox[inboxStart],
+                    inbox.size() - inboxStart, event);
 
-                for (;;) // IMPR.
+                if (inboxStart == inbox.size())
                 {
-                    const size_t sizeSize = 4;
-
-                    // Not even enough bytes there to determine the size of the
-                    // incoming message.
-                    if (inbox.size() < sizeSize)
-                        break;
-
-                    // Message size is already here, convert it.
-                    std::tr1::uint32_t msgSize = *reinterpret_cast<std::tr1::uint32_t*>(&inbox[0]);
-                    msgSize = ntohl(msgSize);
-
-                    // Can't really handle zero-size messages. IMPR?!
-                    if (msgSize == 0)
-                        throw std::logic_error("Cannot handle empty messages");
-
-                    // Has the current message arrived completely?
-                    if (inbox.size() < sizeSize + msgSize)
-                        break;
-
-                    // Current message is here: Call event...
-                    if (event)
-                        event(&inbox[sizeSize], msgSize);
-
-                    // ...and delete it from the inbox.
-                    inbox.erase(inbox.begin(),
-                        inbox.begin() + sizeSize + msgSize);
+                    inbox.clear();
+                    inboxStart = 0;
                 }
+                else if (inboxStart > inbox.size() / 2)
+                {
+                    inbox.erase(inbox.begin(), inbox.begin() + inboxStart);
+                    inboxStart = 0;
+                }
+                counters.values.inboxBytes = inbox.size() - inboxStart;
 
                 break;
             }
         }
+        updateMemory();
     }
 };
 
@@ -88,6 +321,35 @@ Gosu::CommSocket::CommSocket(CommMode mode, SocketAddress targetAddress,
     pimpl->socket.setBlocking(false);
 }
 
+Gosu::CommSocket::CommSocket(CommMode mode, SocketAddress targetAddress,
+    SocketPort targetPort, unsigned connectTimeout)
+: pimpl(new Impl)
+{
+    pimpl->mode = mode;
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(targetAddress);
+    addr.sin_port = htons(targetPort);
+
+    pimpl->socket.setHandle(socketCheck(::socket(AF_INET, SOCK_STREAM, 0)));
+    pimpl->socket.setBlocking(false);
+    // Even when connecting succeeds right away (e.g. on localhost),
+    // onConnected is called by the first update(), once it has been set.
+    pimpl->connecting = true;
+    if (connectTimeout != 0)
+        pimpl->connectDeadline = std::max(milliseconds() + connectTimeout, 1ul);
+    if (::connect(pimpl->socket.handle(), reinterpret_cast<sockaddr*>(&addr),
+            sizeof addr) == SOCKET_ERROR)
+    {
+        int error = lastSocketError();
+        // Windows reports connects in progress as WSAEWOULDBLOCK.
+        if (error != GOSU_SOCK_ERR(EINPROGRESS) && error != GOSU_SOCK_ERR(EWOULDBLOCK))
+            throwLastSocketError();
+    }
+}
+
 Gosu::CommSocket::CommSocket(CommMode mode, Socket& socket)
 : pimpl(new Impl)
 {
@@ -101,6 +363,11 @@ Gosu::CommSocket::~CommSocket()
 {
 }
 
+const Gosu::Socket& Gosu::CommSocket::socket() const
+{
+    return pimpl->socket;
+}
+
 Gosu::SocketAddress Gosu::CommSocket::address() const
 {
     return pimpl->socket.address();
@@ -143,16 +410,58 @@ Gosu::CommMode Gosu::CommSocket::mode() const
 
 bool Gosu::CommSocket::connected() const
 {
-    return pimpl->socket.handle() != INVALID_SOCKET;
+    return pimpl->socket.handle() != INVALID_SOCKET && !pimpl->connecting;
+}
+
+bool Gosu::CommSocket::connecting() const
+{
+    return pimpl->connecting;
+}
+
+bool Gosu::CommSocket::finishConnecting()
+{
+    if (!pimpl->writable())
+    {
+        // Wrapping of milliseconds() is not an issue for timeouts this short.
+        if (pimpl->connectDeadline != 0 &&
+                static_cast<long>(milliseconds() - pimpl->connectDeadline) >= 0)
+            disconnect();
+        return false;
+    }
+    
+    int error;
+    int size = sizeof error;
+    socketCheck(::getsockopt(pimpl->socket.handle(), SOL_SOCKET, SO_ERROR,
+        reinterpret_cast<char*>(&error),
+        reinterpret_cast<socklen_t*>(&size)));
+    if (error != 0)
+    {
+        disconnect();
+        return false;
+    }
+    
+    pimpl->connecting = false;
+    if (onConnected)
+        onConnected();
+    return connected();
 }
 
 void Gosu::CommSocket::disconnect()
 {
     pimpl->socket.setHandle(INVALID_SOCKET);
+    pimpl->connecting = false;
     // IMPR: Mmmmh. A full-blown sockets library should probably try to send
     // the remaining contents of the outbox. This is annoying to implement,
     // though...
     pimpl->outbox.clear();
+    pimpl->outboxStart = 0;
+    pimpl->outboxSizes.clear();
+    pimpl->outboxStarted = false;
+    pimpl->urgentOutbox.clear();
+    pimpl->urgentStart = 0;
+    pimpl->inbox.clear();
+    pimpl->inboxStart = 0;
+    pimpl->counters.values.outboxBytes = pimpl->counters.values.inboxBytes = 0;
     if (onDisconnection)
         onDisconnection();
 }
@@ -174,21 +483,63 @@ void Gosu::CommSocket::setKeepAlive(bool value)
         reinterpret_cast<char*>(&buf), sizeof buf));
 }
 
+bool Gosu::CommSocket::lowLatency() const
+{
+    int buf;
+    int size = sizeof buf;
+    socketCheck(::getsockopt(pimpl->socket.handle(), IPPROTO_TCP, TCP_NODELAY,
+        reinterpret_cast<char*>(&buf),
+        reinterpret_cast<socklen_t*>(&size)));
+    return buf != 0;
+}
+
+void Gosu::CommSocket::setLowLatency(bool value)
+{
+    int buf = value;
+    socketCheck(::setsockopt(pimpl->socket.handle(), IPPROTO_TCP, TCP_NODELAY,
+        reinterpret_cast<char*>(&buf), sizeof buf));
+}
+
+std::size_t Gosu::CommSocket::sendBufferSize() const
+{
+    int buf;
+    int size = sizeof buf;
+    socketCheck(::getsockopt(pimpl->socket.handle(), SOL_SOCKET, SO_SNDBUF,
+        reinterpret_cast<char*>(&buf),
+        reinterpret_cast<socklen_t*>(&size)));
+    return buf;
+}
+
+void Gosu::CommSocket::setSendBufferSize(std::size_t bytes)
+{
+    int buf = static_cast<int>(bytes);
+    socketCheck(::setsockopt(pimpl->socket.handle(), SOL_SOCKET, SO_SNDBUF,
+        reinterpret_cast<char*>(&buf), sizeof buf));
+}
+
 void Gosu::CommSocket::update()
 {
+    GOSU_TRACE("CommSocket::update");
+    if (pimpl->connecting && !finishConnecting())
+        return;
     sendPendingData();
 
     if (!connected())
         return;
 
-    for (;;)
+    std::size_t budget = pimpl->maxBytesPerUpdate;
+    if (budget == 0)
+        budget = static_cast<std::size_t>(-1);
+    while (budget > 0)
     {
-        char buffer[1024];
-        int received = ::recv(pimpl->socket.handle(), buffer, sizeof buffer, 0);
+        std::size_t size = pimpl->receiveSize(budget);
+        char* buffer = &pimpl->receiveBuffer[0];
+        int received = ::recv(pimpl->socket.handle(), buffer, size, 0);
 
-        if (received > 0 && received <= static_cast<int>(sizeof buffer))
+        if (received > 0 && received <= static_cast<int>(size))
         {
             // Data arrived and fit into the buffer.
+            budget -= received;
             pimpl->appendBuffer(buffer, received, onReceive);
         }
         else if (received == 0)
@@ -203,7 +554,8 @@ void Gosu::CommSocket::update()
             {
                 // Arriving data didn't fit into the buffer.
                 case GOSU_SOCK_ERR(EMSGSIZE):
-                    pimpl->appendBuffer(buffer, sizeof buffer, onReceive);
+                    budget -= size;
+                    pimpl->appendBuffer(buffer, size, onReceive);
                     break;
 
                 // There simply was no data.
@@ -233,22 +585,72 @@ void Gosu::CommSocket::update()
     }
 }
 
-void Gosu::CommSocket::send(const void* buffer, std::size_t size)
+void Gosu::CommSocket::send(const void* buffer, std::size_t size, bool urgent)
 {
-    if (!connected())
+    if (!connected() && !connecting())
         return;
 
     // In managed mode, also send the length of the buffer.
-    if (mode() == cmManaged)
+    std::tr1::uint32_t netSize = htonl(size);
+    const char* sizeBuf = reinterpret_cast<const char*>(&netSize);
+    std::size_t sizeSize = mode() == cmManaged ? sizeof netSize : 0;
+    const char* charBuf = reinterpret_cast<const char*>(buffer);
+
+    // With nothing waiting before it, the message can be sent right away
+    // from where it is. Only what the socket does not take is copied.
+    // Urgent messages only have to wait for other urgent ones and for the
+    // rest of a message that has been started.
+    ++pimpl->counters.values.packetsSent;
+    std::size_t sent = 0;
+    if (!connecting() && pimpl->urgentBytes() == 0 && !pimpl->outboxStarted &&
+            (urgent || pimpl->outboxBytes() == 0))
     {
-        std::tr1::uint32_t netSize = htonl(size);
-        const char* charBuf = reinterpret_cast<const char*>(&netSize);
-        pimpl->outbox.insert(pimpl->outbox.end(), charBuf,
-            charBuf + sizeof netSize);
+        std::size_t allowed = sizeSize + size;
+        if (!urgent)
+            allowed = std::min(allowed, pimpl->allowance());
+        if (allowed > 0)
+        {
+            std::size_t first = std::min(sizeSize, allowed);
+            int result = pimpl->sendTwo(sizeBuf, first, charBuf, allowed - first);
+            if (result >= 0)
+            {
+                sent = result;
+                pimpl->sent(sent, allowed);
+            }
+            else if (handleSendError())
+                return;
+        }
+        if (pimpl->urgentBytes() == 0)
+        {
+            pimpl->urgentOutbox.clear();
+            pimpl->urgentStart = 0;
+        }
+        if (pimpl->outboxBytes() == 0)
+        {
+            pimpl->outbox.clear();
+            pimpl->outboxStart = 0;
+        }
+    }
+    if (sent == sizeSize + size)
+    {
+        pimpl->updateOutbox();
+        return;
     }
 
-    const char* charBuf = reinterpret_cast<const char*>(buffer);
-    pimpl->outbox.insert(pimpl->outbox.end(), charBuf, charBuf + size);
+    // A partly sent message has to be finished before anything else, so
+    // the remainder of one always goes first, wherever it is queued.
+    Impl::Buffer& box = urgent ? pimpl->urgentOutbox : pimpl->outbox;
+    if (sent < sizeSize)
+        box.insert(box.end(), sizeBuf + sent, sizeBuf + sizeSize);
+    std::size_t payloadSent = sent > sizeSize ? sent - sizeSize : 0;
+    box.insert(box.end(), charBuf + payloadSent, charBuf + size);
+    if (!urgent)
+    {
+        pimpl->outboxSizes.push_back(sizeSize + size - sent);
+        if (sent > 0)
+            pimpl->outboxStarted = true;
+    }
+    pimpl->updateOutbox();
 }
 
 void Gosu::CommSocket::sendPendingData()
@@ -256,50 +658,119 @@ void Gosu::CommSocket::sendPendingData()
     if (pendingBytes() == 0 || !connected())
         return;
 
-    int sent = ::send(pimpl->socket.handle(), &pimpl->outbox.front(),
-        pendingBytes(), 0);
-
-    if (sent >= 0)
+    for (;;)
     {
-        // Remove sent data from the outbox.
-        if (sent >= static_cast<int>(pendingBytes()))
-            pimpl->outbox.clear();
+        // Order: the rest of a started message, urgent messages, and then
+        // as much of the outbox as the rate limit allows. The rest of a
+        // started message ignores the limit while urgent ones are waiting.
+        bool urgent = pimpl->urgentBytes() > 0 && !pimpl->outboxStarted;
+        std::size_t size;
+        if (urgent)
+            size = pimpl->urgentBytes();
+        else if (pimpl->outboxStarted && pimpl->urgentBytes() > 0)
+            size = pimpl->outboxSizes.front();
         else
-            pimpl->outbox.erase(pimpl->outbox.begin(),
-                pimpl->outbox.begin() + sent);
+            size = std::min(pimpl->outboxBytes(), pimpl->allowance());
+        if (size == 0)
+            break;
+
+        Impl::Buffer& box = urgent ? pimpl->urgentOutbox : pimpl->outbox;
+        std::size_t start = urgent ? pimpl->urgentStart : pimpl->outboxStart;
+        int sent = ::send(pimpl->socket.handle(), &box[start], size, 0);
+        if (sent < 0)
+        {
+            if (handleSendError())
+                return;
+            break;
+        }
+
+        pimpl->sent(sent, size);
+        if (urgent)
+            Impl::skip(box, pimpl->urgentStart, sent);
+        else
+            pimpl->skipOutbox(sent);
+        // The system does not take more right now.
+        if (static_cast<std::size_t>(sent) < size)
+            break;
     }
-    else
+    pimpl->updateOutbox();
+}
+
+void Gosu::CommSocket::flush()
+{
+    // Send until everything is gone or the system does not take more.
+    std::size_t pending = pendingBytes();
+    while (pending != 0)
     {
-        switch (lastSocketError())
-        {
-            // These error codes basically mean "try again later".
-            case GOSU_SOCK_ERR(ENOBUFS):
-            case GOSU_SOCK_ERR(EWOULDBLOCK):
-            case GOSU_SOCK_ERR(EHOSTUNREACH):
-                break;
+        sendPendingData();
+        std::size_t left = pendingBytes();
+        if (left == pending)
+            break;
+        pending = left;
+    }
+}
 
-            // And these tell us we're disconnected.
-            case GOSU_SOCK_ERR(ENETDOWN):
-            case GOSU_SOCK_ERR(ENETRESET):
-            case GOSU_SOCK_ERR(ENOTCONN):
-            case GOSU_SOCK_ERR(ECONNABORTED):
-            case GOSU_SOCK_ERR(ECONNRESET):
-            case GOSU_SOCK_ERR(ETIMEDOUT):
-			#ifndef GOSU_IS_WIN
-			// UNIX-specific, rare error
-            case GOSU_SOCK_ERR(EPIPE):
-			#endif
-                disconnect();
-                break;
+bool Gosu::CommSocket::handleSendError()
+{
+    int error = lastSocketError();
+    switch (error)
+    {
+        // These error codes basically mean "try again later".
+        case GOSU_SOCK_ERR(ENOBUFS):
+        case GOSU_SOCK_ERR(EWOULDBLOCK):
+        case GOSU_SOCK_ERR(EHOSTUNREACH):
+            pimpl->counters.countSendError(error);
+            return false;
+
+        // And these tell us we're disconnected.
+        case GOSU_SOCK_ERR(ENETDOWN):
+        case GOSU_SOCK_ERR(ENETRESET):
+        case GOSU_SOCK_ERR(ENOTCONN):
+        case GOSU_SOCK_ERR(ECONNABORTED):
+        case GOSU_SOCK_ERR(ECONNRESET):
+        case GOSU_SOCK_ERR(ETIMEDOUT):
+		#ifndef GOSU_IS_WIN
+		// UNIX-specific, rare error
+        case GOSU_SOCK_ERR(EPIPE):
+		#endif
+            disconnect();
+            return true;
 
-            // Everything else is unexpected.
-            default:
-                throwLastSocketError();
-        }
+        // Everything else is unexpected.
+        default:
+            throwLastSocketError();
     }
 }
 
 std::size_t Gosu::CommSocket::pendingBytes() const
 {
-    return pimpl->outbox.size();
+    return pimpl->outboxBytes() + pimpl->urgentBytes();
+}
+
+std::size_t Gosu::CommSocket::rateLimit() const
+{
+    return pimpl->rateLimit;
+}
+
+void Gosu::CommSocket::setRateLimit(std::size_t bytesPerSecond, std::size_t burst)
+{
+    pimpl->rateLimit = bytesPerSecond;
+    pimpl->burst = burst != 0 ? burst : std::max<std::size_t>(bytesPerSecond / 10, 1);
+    pimpl->tokens = pimpl->burst;
+    pimpl->lastRefill = milliseconds();
+}
+
+std::size_t Gosu::CommSocket::maxBytesPerUpdate() const
+{
+    return pimpl->maxBytesPerUpdate;
+}
+
+void Gosu::CommSocket::setMaxBytesPerUpdate(std::size_t bytes)
+{
+    pimpl->maxBytesPerUpdate = bytes;
+}
+
+Gosu::SocketStatistics Gosu::CommSocket::statistics() const
+{
+    return pimpl->counters.values;
 }
@@ -1,59 +1,119 @@
-#include <Gosu/Sockets.hpp>
-#include <GosuImpl/Sockets/Sockets.hpp>
-#include <cassert>
-#include <cstring>
-
-struct Gosu::ListenerSocket::Impl
-{
-    Socket socket;
-};
-
-Gosu::ListenerSocket::ListenerSocket(SocketPort port)
-: pimpl(new Impl)
-{
-    pimpl->socket.setHandle(socketCheck(::socket(AF_INET, SOCK_STREAM, 0)));
-    pimpl->socket.setBlocking(false);
-
-    int enable = 1;
-    socketCheck(::setsockopt(pimpl->socket.handle(), SOL_SOCKET, SO_REUSEADDR,
-        reinterpret_cast<char*>(&enable), sizeof enable));
-
-    sockaddr_in addr;
-    std::memset(&addr, 0, sizeof addr);
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port);
-    socketCheck(::bind(pimpl->socket.handle(),
-        reinterpret_cast<sockaddr*>(&addr), sizeof addr));
-    socketCheck(::listen(pimpl->socket.handle(), 10));
-}
-
-Gosu::ListenerSocket::~ListenerSocket()
-{
-}
-
-Gosu::SocketAddress Gosu::ListenerSocket::address() const
-{
-    return pimpl->socket.address();
-}
-
-Gosu::SocketPort Gosu::ListenerSocket::port() const
-{
-    return pimpl->socket.port();
-}
-
-void Gosu::ListenerSocket::update()
-{
-    while (onConnection)
-    {
-        SocketHandle newHandle =
-            socketCheck(::accept(pimpl->socket.handle(), 0, 0));
-
-        if (newHandle == INVALID_SOCKET)
-            break;
-
-        Socket newSocket;
-        newSocket.setHandle(newHandle);
-        onConnection(newSocket);
-    }
-}
+#include <Gosu/Sockets.hpp>
+#include <GosuImpl/Sockets/Sockets.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
+#include <cassert>
+#include <cstring>
+
+struct Gosu::ListenerSocket::Impl
+{
+    Socket socket;
+    std::size_t maxConnectionsPerUpdate;
+    ListenerStatistics statistics;
+
+    Impl() : maxConnectionsPerUpdate(64), statistics() {}
+
+    // Returns INVALID_SOCKET if nobody is waiting.
+    SocketHandle accept(bool& nonBlocking)
+    {
+        #ifdef SOCK_NONBLOCK
+        // Saves making the new socket non-blocking with another call.
+        SocketHandle handle = ::accept4(socket.handle(), 0, 0, SOCK_NONBLOCK);
+        if (handle != INVALID_SOCKET || errno != ENOSYS)
+        {
+            nonBlocking = true;
+            return socketCheck(handle);
+        }
+        #endif
+        nonBlocking = false;
+        return socketCheck(::accept(socket.handle(), 0, 0));
+    }
+};
+
+Gosu::ListenerSocket::ListenerSocket(SocketPort port)
+: pimpl(new Impl)
+{
+    pimpl->socket.setHandle(socketCheck(::socket(AF_INET, SOCK_STREAM, 0)));
+    pimpl->socket.setBlocking(false);
+
+    int enable = 1;
+    socketCheck(::setsockopt(pimpl->socket.handle(), SOL_SOCKET, SO_REUSEADDR,
+        reinterpret_cast<char*>(&enable), sizeof enable));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    socketCheck(::bind(pimpl->socket.handle(),
+        reinterpret_cast<sockaddr*>(&addr), sizeof addr));
+    // Lots of clients may try to reconnect at once after a hiccup.
+    socketCheck(::listen(pimpl->socket.handle(), SOMAXCONN));
+}
+
+Gosu::ListenerSocket::~ListenerSocket()
+{
+}
+
+const Gosu::Socket& Gosu::ListenerSocket::socket() const
+{
+    return pimpl->socket;
+}
+
+Gosu::SocketAddress Gosu::ListenerSocket::address() const
+{
+    return pimpl->socket.address();
+}
+
+Gosu::SocketPort Gosu::ListenerSocket::port() const
+{
+    return pimpl->socket.port();
+}
+
+void Gosu::ListenerSocket::update()
+{
+    GOSU_TRACE("ListenerSocket::update");
+    if (!onConnection)
+        return;
+
+    std::tr1::uint64_t start = microseconds();
+    std::size_t limit = pimpl->maxConnectionsPerUpdate;
+    std::size_t accepted = 0;
+    while (onConnection && (limit == 0 || accepted < limit))
+    {
+        bool nonBlocking;
+        SocketHandle newHandle = pimpl->accept(nonBlocking);
+
+        if (newHandle == INVALID_SOCKET)
+            break;
+
+        ++accepted;
+        Socket newSocket;
+        newSocket.setHandle(newHandle, nonBlocking);
+        onConnection(newSocket);
+    }
+
+    ListenerStatistics& stats = pimpl->statistics;
+    stats.accepted += accepted;
+    stats.acceptedLastUpdate = accepted;
+    stats.lastUpdateTime = microseconds() - start;
+    if (accepted > stats.mostPerUpdate)
+        stats.mostPerUpdate = accepted;
+    if (limit != 0 && accepted == limit)
+        ++stats.limitReached;
+}
+
+std::size_t Gosu::ListenerSocket::maxConnectionsPerUpdate() const
+{
+    return pimpl->maxConnectionsPerUpdate;
+}
+
+void Gosu::ListenerSocket::setMaxConnectionsPerUpdate(std::size_t connections)
+{
+    pimpl->maxConnectionsPerUpdate = connections;
+}
+
+Gosu::ListenerStatistics Gosu::ListenerSocket::statistics() const
+{
+    return pimpl->statistics;
+}
@@ -0,0 +1,405 @@
+#include <Gosu/Sockets.hpp>
+#include <Gosu/Timing.hpp>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    // Packets consist of records that start with one of these bytes:
+    //   UNRELIABLE, 16-bit size, data
+    //   RELIABLE, 32-bit sequence number, 16-bit size, data
+    //   ACK, 32-bit number of reliable messages that have arrived in order
+    // All numbers are big-endian.
+    enum Record { UNRELIABLE = 1, RELIABLE = 2, ACK = 3 };
+    enum { MAX_SIZE = 65535 };
+
+    typedef std::tr1::uint32_t Sequence;
+    typedef std::vector<char> Bytes;
+
+    void put16(Bytes& buffer, unsigned value)
+    {
+        buffer.push_back(static_cast<char>(value >> 8));
+        buffer.push_back(static_cast<char>(value & 0xff));
+    }
+
+    void put32(Bytes& buffer, Sequence value)
+    {
+        put16(buffer, value >> 16);
+        put16(buffer, value & 0xffff);
+    }
+
+    // Reads from a received packet, and stops at its end.
+    class RecordReader
+    {
+        const unsigned char* pos;
+        std::size_t left;
+
+    public:
+        RecordReader(const void* data, std::size_t size)
+        : pos(static_cast<const unsigned char*>(data)), left(size)
+        {
+        }
+
+        std::size_t remaining() const
+        {
+            return left;
+        }
+
+        const char* skip(std::size_t size)
+        {
+            const char* result = reinterpret_cast<const char*>(pos);
+            pos += size;
+            left -= size;
+            return result;
+        }
+
+        bool get16(unsigned& value)
+        {
+            if (left < 2)
+                return false;
+            value = pos[0] << 8 | pos[1];
+            skip(2);
+            return true;
+        }
+
+        bool get32(Sequence& value)
+        {
+            unsigned high, low;
+            if (!get16(high) || !get16(low))
+                return false;
+            value = static_cast<Sequence>(high) << 16 | low;
+            return true;
+        }
+    };
+
+    struct Unacknowledged
+    {
+        Bytes record;
+        // In microseconds; 0 if it has not been sent yet.
+        std::tr1::uint64_t lastSent;
+    };
+
+    struct Peer
+    {
+        Bytes unreliable;
+        std::map<Sequence, Unacknowledged> reliable;
+        Sequence nextSequence, nextExpected;
+        // Reliable messages that have arrived before one that was sent
+        // earlier, by sequence number.
+        std::map<Sequence, Bytes> early;
+        bool ackDue;
+        Gosu::ChannelStatistics statistics;
+
+        Peer()
+        : nextSequence(0), nextExpected(0), ackDue(false), statistics()
+        {
+        }
+    };
+
+    void add(Gosu::ChannelStatistics& sum, const Gosu::ChannelStatistics& stats)
+    {
+        sum.messagesSent += stats.messagesSent;
+        sum.messagesReceived += stats.messagesReceived;
+        sum.packetsSent += stats.packetsSent;
+        sum.packetsReceived += stats.packetsReceived;
+        sum.bytesSent += stats.bytesSent;
+        sum.bytesReceived += stats.bytesReceived;
+        sum.resends += stats.resends;
+        sum.duplicates += stats.duplicates;
+        sum.unacknowledged += stats.unacknowledged;
+    }
+}
+
+struct Gosu::MessageChannel::Impl
+{
+    MessageChannel& channel;
+    MessageSocket& socket;
+    std::size_t mtu;
+    unsigned resendInterval;
+
+    typedef std::pair<SocketAddress, SocketPort> Address;
+    typedef std::map<Address, Peer> Peers;
+    Peers peers;
+
+    // Packets built by flush(), kept to reuse their memory.
+    std::vector<Bytes> packets;
+    std::size_t packetsUsed;
+
+    Impl(MessageChannel& channel, MessageSocket& socket)
+    : channel(channel), socket(socket), mtu(1200), resendInterval(200),
+      packetsUsed(0)
+    {
+    }
+
+    void deliver(const Address& address, const char* data, std::size_t size)
+    {
+        ++peers[address].statistics.messagesReceived;
+        if (channel.onReceive)
+            channel.onReceive(address.first, address.second, data, size);
+    }
+
+    void receiveReliable(const Address& address, Sequence sequence,
+        const char* data, std::size_t size)
+    {
+        Peer& peer = peers[address];
+        peer.ackDue = true;
+
+        if (sequence - peer.nextExpected >= 0x80000000u || peer.early.count(sequence))
+        {
+            // Already passed on; the acknowledgement must have been lost.
+            ++peer.statistics.duplicates;
+            return;
+        }
+        if (sequence != peer.nextExpected)
+        {
+            peer.early[sequence].assign(data, data + size);
+            return;
+        }
+
+        // Callbacks may call forget(), so the peer is looked up again.
+        ++peer.nextExpected;
+        deliver(address, data, size);
+        while (true)
+        {
+            Peers::iterator iter = peers.find(address);
+            if (iter == peers.end())
+                return;
+            std::map<Sequence, Bytes>::iterator next =
+                iter->second.early.find(iter->second.nextExpected);
+            if (next == iter->second.early.end())
+                return;
+            Bytes message;
+            message.swap(next->second);
+            iter->second.early.erase(next);
+            ++iter->second.nextExpected;
+            deliver(address, message.empty() ? 0 : &message.front(), message.size());
+        }
+    }
+
+    void acknowledge(const Address& address, Sequence upTo)
+    {
+        Peers::iterator iter = peers.find(address);
+        if (iter == peers.end())
+            return;
+        std::map<Sequence, Unacknowledged>& reliable = iter->second.reliable;
+        reliable.erase(reliable.begin(), reliable.lower_bound(upTo));
+        iter->second.statistics.unacknowledged = reliable.size();
+    }
+
+    void received(SocketAddress address, SocketPort port, const void* data,
+        std::size_t size)
+    {
+        Address from(address, port);
+        Peer& peer = peers[from];
+        ++peer.statistics.packetsReceived;
+        peer.statistics.bytesReceived += size;
+
+        // Everything after a broken record is dropped, like a lost packet.
+        RecordReader reader(data, size);
+        while (reader.remaining() > 0)
+        {
+            char type = *reader.skip(1);
+            Sequence sequence = 0;
+            unsigned length = 0;
+            if (type == ACK)
+            {
+                if (!reader.get32(sequence))
+                    return;
+                acknowledge(from, sequence);
+                continue;
+            }
+            if ((type == RELIABLE && !reader.get32(sequence)) ||
+                    (type != RELIABLE && type != UNRELIABLE) ||
+                    !reader.get16(length) || length > reader.remaining())
+                return;
+
+            const char* message = reader.skip(length);
+            if (type == RELIABLE)
+                receiveReliable(from, sequence, message, length);
+            else
+                deliver(from, message, length);
+        }
+    }
+
+    // Appends a record to the packets for one peer, starting a new packet
+    // if it does not fit into the last one.
+    void pack(std::size_t firstPacket, const Bytes& record)
+    {
+        if (packetsUsed == firstPacket ||
+                packets[packetsUsed - 1].size() + record.size() > mtu)
+        {
+            if (packetsUsed == packets.size())
+                packets.push_back(Bytes());
+            packets[packetsUsed].clear();
+            ++packetsUsed;
+        }
+        Bytes& packet = packets[packetsUsed - 1];
+        packet.insert(packet.end(), record.begin(), record.end());
+    }
+
+    void packUnreliable(std::size_t firstPacket, Peer& peer)
+    {
+        RecordReader reader(peer.unreliable.empty() ? 0 : &peer.unreliable.front(),
+            peer.unreliable.size());
+        Bytes record;
+        while (reader.remaining() > 0)
+        {
+            const char* start = reader.skip(1);
+            unsigned length;
+            reader.get16(length);
+            reader.skip(length);
+            record.assign(start, start + 3 + length);
+            pack(firstPacket, record);
+        }
+        peer.unreliable.clear();
+    }
+};
+
+Gosu::MessageChannel::MessageChannel(MessageSocket& socket)
+: pimpl(new Impl(*this, socket))
+{
+    using namespace std::tr1::placeholders;
+    socket.onReceive = std::tr1::bind(&Impl::received, pimpl.get(), _1, _2, _3, _4);
+}
+
+Gosu::MessageChannel::~MessageChannel()
+{
+    pimpl->socket.onReceive = 0;
+}
+
+std::size_t Gosu::MessageChannel::mtu() const
+{
+    return pimpl->mtu;
+}
+
+void Gosu::MessageChannel::setMtu(std::size_t bytes)
+{
+    pimpl->mtu = bytes;
+}
+
+unsigned Gosu::MessageChannel::resendInterval() const
+{
+    return pimpl->resendInterval;
+}
+
+void Gosu::MessageChannel::setResendInterval(unsigned milliseconds)
+{
+    pimpl->resendInterval = milliseconds;
+}
+
+void Gosu::MessageChannel::send(SocketAddress address, SocketPort port,
+    const void* buffer, std::size_t size, bool reliable)
+{
+    if (size > MAX_SIZE)
+        throw std::length_error("Message too large for MessageChannel");
+
+    Peer& peer = pimpl->peers[Impl::Address(address, port)];
+    ++peer.statistics.messagesSent;
+    const char* charBuf = static_cast<const char*>(buffer);
+
+    if (!reliable)
+    {
+        peer.unreliable.push_back(UNRELIABLE);
+        put16(peer.unreliable, size);
+        peer.unreliable.insert(peer.unreliable.end(), charBuf, charBuf + size);
+        return;
+    }
+
+    Unacknowledged& message = peer.reliable[peer.nextSequence];
+    message.lastSent = 0;
+    message.record.push_back(RELIABLE);
+    put32(message.record, peer.nextSequence);
+    put16(message.record, size);
+    message.record.insert(message.record.end(), charBuf, charBuf + size);
+    ++peer.nextSequence;
+}
+
+void Gosu::MessageChannel::flush()
+{
+    std::tr1::uint64_t now = microseconds();
+    std::tr1::uint64_t interval =
+        static_cast<std::tr1::uint64_t>(pimpl->resendInterval) * 1000;
+    pimpl->packetsUsed = 0;
+    // Which packets go to which peer. Pointers into the packets are only
+    // taken once all of them have been built.
+    std::vector<std::pair<Impl::Address, std::size_t> > ends;
+
+    for (Impl::Peers::iterator iter = pimpl->peers.begin();
+        iter != pimpl->peers.end(); ++iter)
+    {
+        Peer& peer = iter->second;
+        std::size_t first = pimpl->packetsUsed;
+
+        if (peer.ackDue)
+        {
+            Bytes record;
+            record.push_back(ACK);
+            put32(record, peer.nextExpected);
+            pimpl->pack(first, record);
+            peer.ackDue = false;
+        }
+
+        for (std::map<Sequence, Unacknowledged>::iterator message = peer.reliable.begin();
+            message != peer.reliable.end(); ++message)
+        {
+            if (message->second.lastSent != 0)
+            {
+                if (now - message->second.lastSent < interval)
+                    continue;
+                ++peer.statistics.resends;
+            }
+            message->second.lastSent = now;
+            pimpl->pack(first, message->second.record);
+        }
+
+        pimpl->packUnreliable(first, peer);
+        peer.statistics.unacknowledged = peer.reliable.size();
+
+        for (std::size_t i = first; i < pimpl->packetsUsed; ++i)
+        {
+            ++peer.statistics.packetsSent;
+            peer.statistics.bytesSent += pimpl->packets[i].size();
+        }
+        ends.push_back(std::make_pair(iter->first, pimpl->packetsUsed));
+    }
+
+    std::vector<OutgoingMessage> outgoing;
+    std::size_t packet = 0;
+    for (std::size_t i = 0; i < ends.size(); ++i)
+    {
+        for (; packet < ends[i].second; ++packet)
+        {
+            OutgoingMessage message = { ends[i].first.first, ends[i].first.second,
+                &pimpl->packets[packet].front(), pimpl->packets[packet].size() };
+            outgoing.push_back(message);
+        }
+    }
+
+    if (!outgoing.empty())
+        pimpl->socket.send(&outgoing.front(), outgoing.size());
+}
+
+void Gosu::MessageChannel::forget(SocketAddress address, SocketPort port)
+{
+    pimpl->peers.erase(Impl::Address(address, port));
+}
+
+Gosu::ChannelStatistics Gosu::MessageChannel::statistics(SocketAddress address,
+    SocketPort port) const
+{
+    Impl::Peers::const_iterator iter = pimpl->peers.find(Impl::Address(address, port));
+    if (iter == pimpl->peers.end())
+        return ChannelStatistics();
+    return iter->second.statistics;
+}
+
+Gosu::ChannelStatistics Gosu::MessageChannel::statistics() const
+{
+    ChannelStatistics sum = ChannelStatistics();
+    for (Impl::Peers::const_iterator iter = pimpl->peers.begin();
+        iter != pimpl->peers.end(); ++iter)
+        add(sum, iter->second.statistics);
+    return sum;
+}
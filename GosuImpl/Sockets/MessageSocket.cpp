@@ -1,128 +1,419 @@
-#include <Gosu/Sockets.hpp>
-#include <GosuImpl/Sockets/Sockets.hpp>
-#include <cassert>
-#include <cstring>
-#include <vector>
-
-struct Gosu::MessageSocket::Impl
-{
-    Socket socket;
-    std::size_t maxMessageSize;
-};
-
-Gosu::MessageSocket::MessageSocket(SocketPort port)
-: pimpl(new Impl)
-{
-    pimpl->socket.setHandle(socketCheck(::socket(AF_INET, SOCK_DGRAM, 0)));
-    pimpl->socket.setBlocking(false);
-    sockaddr_in addr;
-    std::memset(&addr, 0, sizeof addr);
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port);
-    socketCheck(::bind(pimpl->socket.handle(),
-        reinterpret_cast<sockaddr*>(&addr), sizeof addr));
-
-    unsigned maxMessageSize;
-    socklen_t size = sizeof maxMessageSize;
-    #ifdef GOSU_IS_WIN
-    socketCheck(::getsockopt(pimpl->socket.handle(), SOL_SOCKET, SO_MAX_MSG_SIZE,
-        reinterpret_cast<char*>(&maxMessageSize), &size));
-    #else
-    socketCheck(::getsockopt(pimpl->socket.handle(), SOL_SOCKET, SO_SNDBUF,
-        reinterpret_cast<char*>(&maxMessageSize), &size));
-    #endif
-    pimpl->maxMessageSize = maxMessageSize;
-}
-
-Gosu::MessageSocket::~MessageSocket()
-{
-}
-
-Gosu::SocketAddress Gosu::MessageSocket::address() const
-{
-    return pimpl->socket.address();
-}
-
-Gosu::SocketPort Gosu::MessageSocket::port() const
-{
-    return pimpl->socket.port();
-}
-
-std::size_t Gosu::MessageSocket::maxMessageSize() const
-{
-    return pimpl->maxMessageSize;
-}
-
-void Gosu::MessageSocket::update()
-{
-    std::vector<char> buffer(maxMessageSize());
-
-    sockaddr_in addr;
-    socklen_t size = sizeof addr;
-
-    for (;;)
-    {
-        int received = ::recvfrom(pimpl->socket.handle(), &buffer.front(),
-            buffer.size(), 0, reinterpret_cast<sockaddr*>(&addr),
-            &size);
-
-        if (received != SOCKET_ERROR && onReceive)
-        {
-            onReceive(ntohl(addr.sin_addr.s_addr),
-                ntohs(addr.sin_port), &buffer.front(), received);
-        }
-        else switch (lastSocketError())
-        {
-            // Ignore some of the errors.
-            case GOSU_SOCK_ERR(EWOULDBLOCK):
-            case GOSU_SOCK_ERR(ENETDOWN):
-            case GOSU_SOCK_ERR(ENETRESET):
-            case GOSU_SOCK_ERR(ETIMEDOUT):
-            case GOSU_SOCK_ERR(ECONNRESET):
-                return;
-
-            // Everything else is unexpected.
-            default:
-                throwLastSocketError();
-        }
-    }
-}
-
-void Gosu::MessageSocket::send(SocketAddress address, SocketPort port,
-    const void* buffer, std::size_t size)
-{
-    sockaddr_in addr;
-    std::memset(&addr, 0, sizeof addr);
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(address);
-    addr.sin_port = htons(port);
-
-    int sent = ::sendto(pimpl->socket.handle(),
-        reinterpret_cast<const char*>(buffer), size, 0,
-        reinterpret_cast<sockaddr*>(&addr), sizeof addr);
-
-    if (sent == static_cast<int>(size))
-        return; // Yay, did it!
-
-    assert(sent == SOCKET_ERROR); // Don't expect partial sends.
-
-    switch (lastSocketError())
-    {
-        // Just ignore a lot of errors... this is UDP, right?
-        case GOSU_SOCK_ERR(ENETDOWN):
-        case GOSU_SOCK_ERR(ENETRESET):
-        case GOSU_SOCK_ERR(ENOBUFS):
-        case GOSU_SOCK_ERR(EWOULDBLOCK):
-        case GOSU_SOCK_ERR(EHOSTUNREACH):
-        case GOSU_SOCK_ERR(ECONNABORTED):
-        case GOSU_SOCK_ERR(ECONNRESET):
-        case GOSU_SOCK_ERR(ENETUNREACH):
-        case GOSU_SOCK_ERR(ETIMEDOUT):
-            break;
-
-        // Everything else means more than just another lost packet, though.
-        default:
-            throwLastSocketError();
-    }
-}
+#include <Gosu/Sockets.hpp>
+#include <Gosu/Trace.hpp>
+#include <GosuImpl/Sockets/Sockets.hpp>
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    typedef std::tr1::function<void (Gosu::SocketAddress, Gosu::SocketPort,
+        const void*, std::size_t)> ReceiveCallback;
+
+    // Coalesced packets consist of messages that each start with their
+    // size as a big-endian 16-bit number.
+    enum { RECORD_HEADER = 2, MAX_RECORD = 65535 };
+
+    void deliver(const ReceiveCallback& onReceive, bool coalesced,
+        Gosu::SocketAddress address, Gosu::SocketPort port,
+        const char* data, std::size_t size)
+    {
+        if (!onReceive)
+            return;
+        if (!coalesced)
+        {
+            onReceive(address, port, data, size);
+            return;
+        }
+
+        // Everything after a broken record is dropped, like a lost packet.
+        while (size >= RECORD_HEADER)
+        {
+            const unsigned char* header = reinterpret_cast<const unsigned char*>(data);
+            std::size_t length = header[0] << 8 | header[1];
+            if (length > size - RECORD_HEADER)
+                break;
+            onReceive(address, port, data + RECORD_HEADER, length);
+            data += RECORD_HEADER + length;
+            size -= RECORD_HEADER + length;
+        }
+    }
+    
+    sockaddr_in makeAddress(Gosu::SocketAddress address, Gosu::SocketPort port)
+    {
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(address);
+        addr.sin_port = htons(port);
+        return addr;
+    }
+}
+
+struct Gosu::MessageSocket::Impl
+{
+    Socket socket;
+    std::size_t maxMessageSize;
+
+    // Datagrams fetched by one call to recvmmsg.
+    enum { BATCH_SIZE = 8 };
+    // Kept between updates; holds BATCH_SIZE slots of slotSize bytes
+    // where recvmmsg is available, one otherwise.
+    std::vector<char> buffer;
+    std::size_t slotSize;
+    
+    bool coalescing;
+    std::size_t coalescingLimit;
+    // Packets that are being filled by coalescing, by destination.
+    typedef std::map<std::pair<SocketAddress, SocketPort>, std::vector<char> > Pending;
+    Pending pending;
+    SocketCounters counters;
+    
+    Impl() : slotSize(0), coalescing(false), coalescingLimit(1200) {}
+
+    char* slot(std::size_t index)
+    {
+        return &buffer[index * slotSize];
+    }
+    
+    // Returns true if the error just means there is nothing left to do.
+    bool ignorableReceiveError()
+    {
+        switch (lastSocketError())
+        {
+            // There simply was no data.
+            case GOSU_SOCK_ERR(EWOULDBLOCK):
+                return true;
+
+            // Ignore some of the errors.
+            case GOSU_SOCK_ERR(ENETDOWN):
+            case GOSU_SOCK_ERR(ENETRESET):
+            case GOSU_SOCK_ERR(ETIMEDOUT):
+            case GOSU_SOCK_ERR(ECONNRESET):
+                ++counters.values.receiveErrors;
+                return true;
+
+            // Everything else is unexpected.
+            default:
+                return false;
+        }
+    }
+    
+    // Same for sending.
+    bool ignorableSendError()
+    {
+        int error = lastSocketError();
+        switch (error)
+        {
+            // Just ignore a lot of errors... this is UDP, right?
+            case GOSU_SOCK_ERR(ENETDOWN):
+            case GOSU_SOCK_ERR(ENETRESET):
+            case GOSU_SOCK_ERR(ENOBUFS):
+            case GOSU_SOCK_ERR(EWOULDBLOCK):
+            case GOSU_SOCK_ERR(EHOSTUNREACH):
+            case GOSU_SOCK_ERR(ECONNABORTED):
+            case GOSU_SOCK_ERR(ECONNRESET):
+            case GOSU_SOCK_ERR(ENETUNREACH):
+            case GOSU_SOCK_ERR(ETIMEDOUT):
+                counters.countSendError(error);
+                return true;
+
+            // Everything else means more than just another lost packet, though.
+            default:
+                return false;
+        }
+    }
+
+    // Sends each message as one packet.
+    void sendPackets(const OutgoingMessage* messages, std::size_t count)
+    {
+        #ifdef __linux__
+        // Up to this many packets per call to sendmmsg.
+        enum { CHUNK = 64 };
+        mmsghdr headers[CHUNK];
+        iovec vectors[CHUNK];
+        sockaddr_in addrs[CHUNK];
+
+        while (count > 0)
+        {
+            unsigned chunk = std::min<std::size_t>(count, CHUNK);
+            std::memset(headers, 0, sizeof headers);
+            for (unsigned i = 0; i < chunk; ++i)
+            {
+                addrs[i] = makeAddress(messages[i].address, messages[i].port);
+                vectors[i].iov_base = const_cast<void*>(messages[i].buffer);
+                vectors[i].iov_len = messages[i].size;
+                headers[i].msg_hdr.msg_iov = &vectors[i];
+                headers[i].msg_hdr.msg_iovlen = 1;
+                headers[i].msg_hdr.msg_name = &addrs[i];
+                headers[i].msg_hdr.msg_namelen = sizeof addrs[i];
+            }
+
+            int sent = ::sendmmsg(socket.handle(), headers, chunk, 0);
+            if (sent == SOCKET_ERROR)
+            {
+                // The first message failed; drop it and go on with the rest.
+                if (!ignorableSendError())
+                    throwLastSocketError();
+                sent = 1;
+            }
+            else
+            {
+                counters.values.packetsSent += sent;
+                for (int i = 0; i < sent; ++i)
+                    counters.values.bytesSent += headers[i].msg_len;
+            }
+            messages += sent;
+            count -= sent;
+        }
+        #else
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            sockaddr_in addr = makeAddress(messages[i].address, messages[i].port);
+            int sent = ::sendto(socket.handle(),
+                reinterpret_cast<const char*>(messages[i].buffer),
+                messages[i].size, 0, reinterpret_cast<sockaddr*>(&addr),
+                sizeof addr);
+
+            if (sent == static_cast<int>(messages[i].size))
+            {
+                // Yay, did it!
+                ++counters.values.packetsSent;
+                counters.values.bytesSent += sent;
+                continue;
+            }
+
+            assert(sent == SOCKET_ERROR); // Don't expect partial sends.
+
+            if (!ignorableSendError())
+                throwLastSocketError();
+        }
+        #endif
+    }
+
+    void sendPending(Pending::iterator iter)
+    {
+        OutgoingMessage message = { iter->first.first, iter->first.second,
+            &iter->second.front(), iter->second.size() };
+        sendPackets(&message, 1);
+        iter->second.clear();
+    }
+    
+    void coalesce(const OutgoingMessage& message)
+    {
+        if (message.size > MAX_RECORD)
+            throw std::length_error("Message too large to be coalesced");
+
+        Pending::iterator iter = pending.insert(Pending::value_type(
+            std::make_pair(message.address, message.port), std::vector<char>())).first;
+        std::vector<char>& packet = iter->second;
+        if (!packet.empty() && packet.size() + RECORD_HEADER + message.size > coalescingLimit)
+            sendPending(iter);
+
+        packet.push_back(static_cast<char>(message.size >> 8));
+        packet.push_back(static_cast<char>(message.size & 0xff));
+        const char* charBuf = reinterpret_cast<const char*>(message.buffer);
+        packet.insert(packet.end(), charBuf, charBuf + message.size);
+
+        // Too large to share a packet with anything else.
+        if (packet.size() >= coalescingLimit)
+            sendPending(iter);
+    }
+};
+
+Gosu::MessageSocket::MessageSocket(SocketPort port)
+: pimpl(new Impl)
+{
+    pimpl->socket.setHandle(socketCheck(::socket(AF_INET, SOCK_DGRAM, 0)));
+    pimpl->socket.setBlocking(false);
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    socketCheck(::bind(pimpl->socket.handle(),
+        reinterpret_cast<sockaddr*>(&addr), sizeof addr));
+
+    unsigned maxMessageSize;
+    socklen_t size = sizeof maxMessageSize;
+    #ifdef GOSU_IS_WIN
+    socketCheck(::getsockopt(pimpl->socket.handle(), SOL_SOCKET, SO_MAX_MSG_SIZE,
+        reinterpret_cast<char*>(&maxMessageSize), &size));
+    #else
+    socketCheck(::getsockopt(pimpl->socket.handle(), SOL_SOCKET, SO_SNDBUF,
+        reinterpret_cast<char*>(&maxMessageSize), &size));
+    #endif
+    pimpl->maxMessageSize = maxMessageSize;
+}
+
+Gosu::MessageSocket::~MessageSocket()
+{
+}
+
+const Gosu::Socket& Gosu::MessageSocket::socket() const
+{
+    return pimpl->socket;
+}
+
+Gosu::SocketAddress Gosu::MessageSocket::address() const
+{
+    return pimpl->socket.address();
+}
+
+Gosu::SocketPort Gosu::MessageSocket::port() const
+{
+    return pimpl->socket.port();
+}
+
+std::size_t Gosu::MessageSocket::maxMessageSize() const
+{
+    return pimpl->maxMessageSize;
+}
+
+Gosu::SocketStatistics Gosu::MessageSocket::statistics() const
+{
+    return pimpl->counters.values;
+}
+
+void Gosu::MessageSocket::update()
+{
+    GOSU_TRACE("MessageSocket::update");
+    flush();
+
+    if (pimpl->buffer.empty())
+    {
+        // No IPv4 datagram is larger than 64 KiB.
+        pimpl->slotSize = std::min<std::size_t>(maxMessageSize(), 65536);
+        #ifdef __linux__
+        pimpl->buffer.resize(pimpl->slotSize * Impl::BATCH_SIZE);
+        #else
+        pimpl->buffer.resize(pimpl->slotSize);
+        #endif
+    }
+
+    #ifdef __linux__
+    mmsghdr messages[Impl::BATCH_SIZE];
+    iovec vectors[Impl::BATCH_SIZE];
+    sockaddr_in addrs[Impl::BATCH_SIZE];
+
+    for (;;)
+    {
+        std::memset(messages, 0, sizeof messages);
+        for (unsigned i = 0; i < Impl::BATCH_SIZE; ++i)
+        {
+            vectors[i].iov_base = pimpl->slot(i);
+            vectors[i].iov_len = pimpl->slotSize;
+            messages[i].msg_hdr.msg_iov = &vectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            messages[i].msg_hdr.msg_name = &addrs[i];
+            messages[i].msg_hdr.msg_namelen = sizeof addrs[i];
+        }
+
+        int received = ::recvmmsg(pimpl->socket.handle(), messages,
+            Impl::BATCH_SIZE, 0, 0);
+
+        if (received == SOCKET_ERROR)
+        {
+            if (pimpl->ignorableReceiveError())
+                return;
+            throwLastSocketError();
+        }
+
+        for (int i = 0; i < received; ++i)
+        {
+            ++pimpl->counters.values.packetsReceived;
+            pimpl->counters.values.bytesReceived += messages[i].msg_len;
+            deliver(onReceive, pimpl->coalescing, ntohl(addrs[i].sin_addr.s_addr),
+                ntohs(addrs[i].sin_port), pimpl->slot(i), messages[i].msg_len);
+        }
+
+        // A partial batch means that the socket has been drained.
+        if (received < Impl::BATCH_SIZE)
+            return;
+    }
+    #else
+    sockaddr_in addr;
+
+    for (;;)
+    {
+        socklen_t size = sizeof addr;
+        int received = ::recvfrom(pimpl->socket.handle(), pimpl->slot(0),
+            pimpl->slotSize, 0, reinterpret_cast<sockaddr*>(&addr),
+            &size);
+
+        if (received == SOCKET_ERROR)
+        {
+            if (pimpl->ignorableReceiveError())
+                return;
+            throwLastSocketError();
+        }
+
+        ++pimpl->counters.values.packetsReceived;
+        pimpl->counters.values.bytesReceived += received;
+        deliver(onReceive, pimpl->coalescing, ntohl(addr.sin_addr.s_addr),
+            ntohs(addr.sin_port), pimpl->slot(0), received);
+    }
+    #endif
+}
+
+void Gosu::MessageSocket::send(SocketAddress address, SocketPort port,
+    const void* buffer, std::size_t size)
+{
+    OutgoingMessage message = { address, port, buffer, size };
+    send(&message, 1);
+}
+
+void Gosu::MessageSocket::send(const OutgoingMessage* messages, std::size_t count)
+{
+    if (!pimpl->coalescing)
+    {
+        pimpl->sendPackets(messages, count);
+        return;
+    }
+
+    for (std::size_t i = 0; i < count; ++i)
+        pimpl->coalesce(messages[i]);
+}
+
+void Gosu::MessageSocket::setCoalescing(bool enabled)
+{
+    flush();
+    pimpl->coalescing = enabled;
+}
+
+bool Gosu::MessageSocket::coalescing() const
+{
+    return pimpl->coalescing;
+}
+
+std::size_t Gosu::MessageSocket::coalescingLimit() const
+{
+    return pimpl->coalescingLimit;
+}
+
+void Gosu::MessageSocket::setCoalescingLimit(std::size_t bytes)
+{
+    pimpl->coalescingLimit = bytes;
+}
+
+void Gosu::MessageSocket::flush()
+{
+    std::vector<OutgoingMessage> packets;
+    for (Impl::Pending::iterator iter = pimpl->pending.begin();
+        iter != pimpl->pending.end(); ++iter)
+    {
+        if (iter->second.empty())
+            continue;
+        OutgoingMessage packet = { iter->first.first, iter->first.second,
+            &iter->second.front(), iter->second.size() };
+        packets.push_back(packet);
+    }
+
+    if (!packets.empty())
+        pimpl->sendPackets(&packets.front(), packets.size());
+    pimpl->pending.clear();
+}
@@ -0,0 +1,422 @@
+#include <Gosu/Sockets.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
+#include <GosuImpl/Sockets/Sockets.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    using Gosu::NetworkThread;
+
+    enum Kind
+    {
+        // From the game to the network thread.
+        SEND, SEND_TO, CLOSE,
+        // And back.
+        RECEIVED, CONNECTED, DISCONNECTED
+    };
+
+    struct Message
+    {
+        Kind kind;
+        NetworkThread::Connection connection, other;
+        Gosu::SocketAddress address;
+        Gosu::SocketPort port;
+        std::size_t offset, size;
+        std::tr1::uint64_t time;
+    };
+
+    // Messages with their data in one buffer, so that queueing one does not
+    // allocate memory after the first few frames.
+    struct Queue
+    {
+        std::vector<Message> messages;
+        std::vector<char> data;
+
+        void push(Message message, const void* buffer, std::size_t size)
+        {
+            const char* charBuf = static_cast<const char*>(buffer);
+            message.offset = data.size();
+            message.size = size;
+            data.insert(data.end(), charBuf, charBuf + size);
+            messages.push_back(message);
+        }
+
+        const void* dataOf(const Message& message) const
+        {
+            return message.size ? &data[message.offset] : 0;
+        }
+
+        bool empty() const
+        {
+            return messages.empty();
+        }
+
+        void clear()
+        {
+            messages.clear();
+            data.clear();
+        }
+
+        void swap(Queue& other)
+        {
+            messages.swap(other.messages);
+            data.swap(other.data);
+        }
+    };
+
+    // A socket that has been handed over to, or belongs to, the thread.
+    // Exactly one of the pointers is set.
+    struct Owned
+    {
+        std::tr1::shared_ptr<Gosu::CommSocket> comm;
+        std::tr1::shared_ptr<Gosu::ListenerSocket> listener;
+        std::tr1::shared_ptr<Gosu::MessageSocket> message;
+        Gosu::CommMode mode;
+    };
+
+    // Listens on the loopback interface.
+    const Gosu::SocketAddress LOOPBACK = 0x7f000001;
+}
+
+struct Gosu::NetworkThread::Impl
+{
+    // Everything in this block is guarded by the mutex.
+    Mutex mutex;
+    Queue commands, events;
+    std::map<Connection, Owned> added;
+    Connection lastConnection;
+    std::string error;
+    bool quitting;
+
+    // Only used by the network thread.
+    std::map<Connection, Owned> sockets;
+    SocketPoller poller;
+    Queue pendingEvents;
+    std::vector<Connection> dead;
+
+    // Only used by the game thread.
+    Queue spare;
+    std::map<Connection, SocketPort> localPorts;
+
+    // Receives a datagram whenever the game thread has queued something, so
+    // that the network thread does not wait until its timeout first.
+    MessageSocket waker;
+
+    // Last member, so that the thread is joined before anything else goes.
+    std::auto_ptr<Thread> thread;
+
+    Impl()
+    : lastConnection(0), quitting(false), waker(anyPort)
+    {
+        poller.add(waker);
+    }
+
+    Connection newConnection()
+    {
+        Lock lock(mutex);
+        return ++lastConnection;
+    }
+
+    void wake()
+    {
+        char dummy = 0;
+        waker.send(LOOPBACK, waker.port(), &dummy, 1);
+    }
+
+    // Called by the game thread.
+    void handOver(Connection connection, const Owned& owned)
+    {
+        {
+            Lock lock(mutex);
+            added[connection] = owned;
+        }
+        wake();
+    }
+
+    void queueCommand(const Message& message, const void* buffer, std::size_t size)
+    {
+        bool wasEmpty;
+        {
+            Lock lock(mutex);
+            wasEmpty = commands.empty();
+            commands.push(message, buffer, size);
+        }
+        // The thread has already been woken up for the earlier commands.
+        if (wasEmpty)
+            wake();
+    }
+
+    // The socket callbacks on the network thread.
+    void received(Connection connection, SocketAddress address, SocketPort port,
+        const void* buffer, std::size_t size)
+    {
+        Message message = { RECEIVED, connection, 0, address, port, 0, 0, microseconds() };
+        pendingEvents.push(message, buffer, size);
+    }
+
+    void commReceived(Connection connection, const void* buffer, std::size_t size)
+    {
+        const CommSocket& socket = *sockets[connection].comm;
+        received(connection, socket.remoteAddress(), socket.remotePort(), buffer, size);
+    }
+
+    void connected(Connection listener, Socket& socket)
+    {
+        Owned owned;
+        owned.mode = sockets[listener].mode;
+        owned.comm.reset(new CommSocket(owned.mode, socket));
+        Connection connection = newConnection();
+        adopt(connection, owned);
+
+        Message message = { CONNECTED, listener, connection,
+            owned.comm->remoteAddress(), owned.comm->remotePort(), 0, 0, microseconds() };
+        pendingEvents.push(message, 0, 0);
+    }
+
+    void disconnected(Connection connection)
+    {
+        // The socket is still in use, so it is only removed later.
+        dead.push_back(connection);
+        Message message = { DISCONNECTED, connection, 0, 0, 0, 0, 0, microseconds() };
+        pendingEvents.push(message, 0, 0);
+    }
+
+    void adopt(Connection connection, const Owned& owned)
+    {
+        using namespace std::tr1::placeholders;
+
+        sockets[connection] = owned;
+        if (owned.comm)
+        {
+            owned.comm->onReceive =
+                std::tr1::bind(&Impl::commReceived, this, connection, _1, _2);
+            owned.comm->onDisconnection =
+                std::tr1::bind(&Impl::disconnected, this, connection);
+            poller.add(*owned.comm);
+        }
+        else if (owned.listener)
+        {
+            owned.listener->onConnection =
+                std::tr1::bind(&Impl::connected, this, connection, _1);
+            poller.add(*owned.listener);
+        }
+        else
+        {
+            owned.message->onReceive =
+                std::tr1::bind(&Impl::received, this, connection, _1, _2, _3, _4);
+            poller.add(*owned.message);
+        }
+    }
+
+    void forget(Connection connection)
+    {
+        std::map<Connection, Owned>::iterator iter = sockets.find(connection);
+        if (iter == sockets.end())
+            return;
+        if (iter->second.comm)
+            poller.remove(*iter->second.comm);
+        else if (iter->second.listener)
+            poller.remove(*iter->second.listener);
+        else
+            poller.remove(*iter->second.message);
+        sockets.erase(iter);
+    }
+
+    void perform(const Queue& queue)
+    {
+        for (std::size_t i = 0; i < queue.messages.size(); ++i)
+        {
+            const Message& message = queue.messages[i];
+            std::map<Connection, Owned>::iterator iter = sockets.find(message.connection);
+            if (iter == sockets.end())
+                continue;
+
+            switch (message.kind)
+            {
+            case SEND:
+                if (iter->second.comm)
+                    iter->second.comm->send(queue.dataOf(message), message.size);
+                break;
+            case SEND_TO:
+                if (iter->second.message)
+                    iter->second.message->send(message.address, message.port,
+                        queue.dataOf(message), message.size);
+                break;
+            default:
+                forget(message.connection);
+                break;
+            }
+        }
+    }
+
+    void run()
+    {
+        Queue work;
+        std::map<Connection, Owned> newSockets;
+        while (true)
+        {
+            {
+                Lock lock(mutex);
+                if (quitting)
+                    break;
+                work.swap(commands);
+                newSockets.swap(added);
+            }
+
+            try
+            {
+                for (std::map<Connection, Owned>::iterator iter = newSockets.begin();
+                    iter != newSockets.end(); ++iter)
+                    adopt(iter->first, iter->second);
+                newSockets.clear();
+                perform(work);
+                work.clear();
+
+                poller.update(100);
+
+                for (std::size_t i = 0; i < dead.size(); ++i)
+                    forget(dead[i]);
+                dead.clear();
+            }
+            catch (const std::exception& e)
+            {
+                Lock lock(mutex);
+                error = e.what();
+            }
+
+            if (!pendingEvents.empty())
+            {
+                Lock lock(mutex);
+                for (std::size_t i = 0; i < pendingEvents.messages.size(); ++i)
+                {
+                    const Message& message = pendingEvents.messages[i];
+                    events.push(message, pendingEvents.dataOf(message), message.size);
+                }
+                pendingEvents.clear();
+            }
+        }
+    }
+};
+
+Gosu::NetworkThread::NetworkThread()
+: pimpl(new Impl)
+{
+    pimpl->thread.reset(new Thread(std::tr1::bind(&Impl::run, pimpl.get())));
+}
+
+Gosu::NetworkThread::~NetworkThread()
+{
+    {
+        Lock lock(pimpl->mutex);
+        pimpl->quitting = true;
+    }
+    pimpl->wake();
+    pimpl->thread.reset();
+}
+
+Gosu::NetworkThread::Connection Gosu::NetworkThread::connect(CommMode mode,
+    SocketAddress address, SocketPort port)
+{
+    Owned owned;
+    owned.mode = mode;
+    owned.comm.reset(new CommSocket(mode, address, port));
+    Connection connection = pimpl->newConnection();
+    pimpl->handOver(connection, owned);
+    return connection;
+}
+
+Gosu::NetworkThread::Connection Gosu::NetworkThread::listen(CommMode mode,
+    SocketPort port)
+{
+    Owned owned;
+    owned.mode = mode;
+    owned.listener.reset(new ListenerSocket(port));
+    Connection connection = pimpl->newConnection();
+    pimpl->localPorts[connection] = owned.listener->port();
+    pimpl->handOver(connection, owned);
+    return connection;
+}
+
+Gosu::NetworkThread::Connection Gosu::NetworkThread::openMessageSocket(SocketPort port)
+{
+    Owned owned;
+    owned.mode = cmRaw;
+    owned.message.reset(new MessageSocket(port));
+    Connection connection = pimpl->newConnection();
+    pimpl->localPorts[connection] = owned.message->port();
+    pimpl->handOver(connection, owned);
+    return connection;
+}
+
+Gosu::SocketPort Gosu::NetworkThread::localPort(Connection connection) const
+{
+    std::map<Connection, SocketPort>::const_iterator iter =
+        pimpl->localPorts.find(connection);
+    return iter == pimpl->localPorts.end() ? 0 : iter->second;
+}
+
+void Gosu::NetworkThread::send(Connection connection, const void* buffer,
+    std::size_t size)
+{
+    Message message = { SEND, connection, 0, 0, 0, 0, 0, 0 };
+    pimpl->queueCommand(message, buffer, size);
+}
+
+void Gosu::NetworkThread::send(Connection connection, SocketAddress address,
+    SocketPort port, const void* buffer, std::size_t size)
+{
+    Message message = { SEND_TO, connection, 0, address, port, 0, 0, 0 };
+    pimpl->queueCommand(message, buffer, size);
+}
+
+void Gosu::NetworkThread::close(Connection connection)
+{
+    pimpl->localPorts.erase(connection);
+    Message message = { CLOSE, connection, 0, 0, 0, 0, 0, 0 };
+    pimpl->queueCommand(message, 0, 0);
+}
+
+void Gosu::NetworkThread::update()
+{
+    GOSU_TRACE("NetworkThread::update");
+    Queue& events = pimpl->spare;
+    std::string error;
+    {
+        Lock lock(pimpl->mutex);
+        // Both queues keep their memory, so the next frames do not have to
+        // allocate any.
+        events.swap(pimpl->events);
+        pimpl->events.clear();
+        error.swap(pimpl->error);
+    }
+
+    for (std::size_t i = 0; i < events.messages.size(); ++i)
+    {
+        const Message& message = events.messages[i];
+        switch (message.kind)
+        {
+        case RECEIVED:
+            if (onReceive)
+                onReceive(message.connection, message.address, message.port,
+                    events.dataOf(message), message.size, message.time);
+            break;
+        case CONNECTED:
+            if (onConnection)
+                onConnection(message.connection, message.other);
+            break;
+        default:
+            pimpl->localPorts.erase(message.connection);
+            if (onDisconnection)
+                onDisconnection(message.connection);
+            break;
+        }
+    }
+    events.clear();
+
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
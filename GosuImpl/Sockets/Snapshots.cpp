@@ -0,0 +1,231 @@
+#include <Gosu/Sockets.hpp>
+#include <GosuImpl/LZ4.hpp>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    // Encoded snapshots consist of a header, followed by the state XORed
+    // with the baseline's, compressed as one LZ4 block (see LZ4.hpp):
+    //   32-bit number, 32-bit number of the baseline or 0, 32-bit size
+    // All numbers are big-endian. Where the baseline is shorter than the
+    // state, it counts as zeros.
+    enum { HEADER_SIZE = 12 };
+
+    typedef std::vector<char> Bytes;
+
+    void put32(Bytes& buffer, std::tr1::uint32_t value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            buffer.push_back(static_cast<char>(value >> shift & 0xff));
+    }
+
+    std::tr1::uint32_t get32(const unsigned char* p)
+    {
+        return static_cast<std::tr1::uint32_t>(p[0]) << 24 | p[1] << 16 | p[2] << 8 | p[3];
+    }
+
+    void applyXOR(Bytes& state, const Bytes& baseline)
+    {
+        std::size_t size = std::min(state.size(), baseline.size());
+        for (std::size_t i = 0; i < size; ++i)
+            state[i] ^= baseline[i];
+    }
+
+    // The last snapshots of one peer, each in the slot of its number
+    // modulo the length of the history. Reuses the memory of the
+    // snapshots it replaces.
+    class History
+    {
+        struct Snapshot
+        {
+            Gosu::SnapshotNumber number;
+            Bytes state;
+        };
+        std::vector<Snapshot> snapshots;
+
+    public:
+        explicit History(unsigned length)
+        : snapshots(std::max(length, 1u))
+        {
+            for (std::size_t i = 0; i < snapshots.size(); ++i)
+                snapshots[i].number = 0;
+        }
+
+        const Bytes* find(Gosu::SnapshotNumber number) const
+        {
+            const Snapshot& snapshot = snapshots[number % snapshots.size()];
+            return number != 0 && snapshot.number == number ? &snapshot.state : 0;
+        }
+
+        Bytes& store(Gosu::SnapshotNumber number)
+        {
+            Snapshot& snapshot = snapshots[number % snapshots.size()];
+            snapshot.number = number;
+            return snapshot.state;
+        }
+    };
+
+    struct Peer
+    {
+        History history;
+        Gosu::SnapshotNumber last, acknowledged;
+
+        explicit Peer(unsigned length)
+        : history(length), last(0), acknowledged(0)
+        {
+        }
+    };
+}
+
+struct Gosu::SnapshotEncoder::Impl
+{
+    unsigned historyLength;
+
+    typedef std::pair<SocketAddress, SocketPort> Address;
+    typedef std::map<Address, Peer> Peers;
+    Peers peers;
+
+    // Scratch space for the XORed state.
+    Bytes delta;
+
+    Peer& peer(const Address& address)
+    {
+        Peers::iterator iter = peers.find(address);
+        if (iter == peers.end())
+            iter = peers.insert(std::make_pair(address, Peer(historyLength))).first;
+        return iter->second;
+    }
+};
+
+Gosu::SnapshotEncoder::SnapshotEncoder(unsigned history)
+: pimpl(new Impl)
+{
+    pimpl->historyLength = history;
+}
+
+Gosu::SnapshotEncoder::~SnapshotEncoder()
+{
+}
+
+Gosu::SnapshotNumber Gosu::SnapshotEncoder::encode(SocketAddress address, SocketPort port,
+    const void* state, std::size_t size, std::vector<char>& out)
+{
+    Peer& peer = pimpl->peer(Impl::Address(address, port));
+    // Skips 0 when the numbers wrap.
+    SnapshotNumber number = ++peer.last != 0 ? peer.last : ++peer.last;
+
+    const char* begin = static_cast<const char*>(state);
+    Bytes& stored = peer.history.store(number);
+    stored.assign(begin, begin + size);
+
+    // Newer snapshots may have taken the place of the baseline.
+    const Bytes* baseline = peer.history.find(peer.acknowledged);
+    if (!baseline)
+        peer.acknowledged = 0;
+
+    out.clear();
+    put32(out, number);
+    put32(out, peer.acknowledged);
+    put32(out, static_cast<std::tr1::uint32_t>(size));
+    if (size == 0)
+        return number;
+    if (baseline)
+    {
+        pimpl->delta = stored;
+        applyXOR(pimpl->delta, *baseline);
+        LZ4::compress(&pimpl->delta[0], size, out);
+    }
+    else
+        LZ4::compress(begin, size, out);
+    return number;
+}
+
+void Gosu::SnapshotEncoder::acknowledge(SocketAddress address, SocketPort port,
+    SnapshotNumber number)
+{
+    Impl::Peers::iterator iter = pimpl->peers.find(Impl::Address(address, port));
+    if (iter == pimpl->peers.end())
+        return;
+
+    // Acknowledgements can arrive out of order, and numbers wrap.
+    Peer& peer = iter->second;
+    if (peer.history.find(number) && (peer.acknowledged == 0 ||
+            static_cast<std::tr1::int32_t>(number - peer.acknowledged) > 0))
+        peer.acknowledged = number;
+}
+
+void Gosu::SnapshotEncoder::forget(SocketAddress address, SocketPort port)
+{
+    pimpl->peers.erase(Impl::Address(address, port));
+}
+
+struct Gosu::SnapshotDecoder::Impl
+{
+    History history;
+    SnapshotNumber last;
+    // Takes the place of the snapshot that the next one replaces.
+    Bytes scratch;
+
+    explicit Impl(unsigned length)
+    : history(length), last(0)
+    {
+    }
+};
+
+Gosu::SnapshotDecoder::SnapshotDecoder(unsigned history)
+: pimpl(new Impl(history))
+{
+}
+
+Gosu::SnapshotDecoder::~SnapshotDecoder()
+{
+}
+
+bool Gosu::SnapshotDecoder::decode(const void* data, std::size_t size,
+    std::vector<char>& state, SnapshotNumber& number)
+{
+    if (size < HEADER_SIZE)
+        return false;
+
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    SnapshotNumber newNumber = get32(bytes), baselineNumber = get32(bytes + 4);
+    std::size_t stateSize = get32(bytes + 8);
+    // LZ4 cannot expand data more than 255 times.
+    if (stateSize / 255 > size)
+        return false;
+    if (newNumber == 0 || (pimpl->last != 0 &&
+            static_cast<std::tr1::int32_t>(newNumber - pimpl->last) <= 0))
+        return false;
+
+    const Bytes* baseline = 0;
+    if (baselineNumber != 0 && !(baseline = pimpl->history.find(baselineNumber)))
+        return false;
+
+    // Decompressed next to the baseline, which may be in the slot that the
+    // new snapshot goes to.
+    Bytes& result = pimpl->scratch;
+    result.resize(stateSize);
+    if (stateSize != 0)
+    {
+        try
+        {
+            LZ4::decompress(bytes + HEADER_SIZE, size - HEADER_SIZE, &result[0], stateSize);
+        }
+        catch (const std::runtime_error&)
+        {
+            return false;
+        }
+    }
+    if (baseline)
+        applyXOR(result, *baseline);
+
+    pimpl->history.store(newNumber).swap(result);
+    pimpl->last = newNumber;
+    state = *pimpl->history.find(newNumber);
+    number = newNumber;
+    return true;
+}
@@ -1,11 +1,13 @@
 #include <Gosu/Sockets.hpp>
 #include <GosuImpl/Sockets/Sockets.hpp>
+#include <GosuImpl/Threading.hpp>
 #ifdef GOSU_IS_WIN
 #include <Gosu/WinUtility.hpp>
 #endif
 #include <cstdlib>
 #include <cstring>
 #include <algorithm>
+#include <set>
 #include <stdexcept>
 
 namespace Gosu
@@ -19,25 +21,48 @@ namespace Gosu
 #endif
         }
 
-        void needsSockLib()
+        // All SocketCounters that exist, and the sum of those that are gone.
+        Mutex countersMutex;
+        std::set<const SocketCounters*> liveCounters;
+        SocketStatistics retiredCounters = SocketStatistics();
+
+        void add(SocketStatistics& sum, const SocketStatistics& values, bool live)
         {
-#ifdef GOSU_IS_WIN
-            static bool initialized = false;
-            if (!initialized)
+            sum.bytesSent += values.bytesSent;
+            sum.bytesReceived += values.bytesReceived;
+            sum.packetsSent += values.packetsSent;
+            sum.packetsReceived += values.packetsReceived;
+            sum.sendErrors += values.sendErrors;
+            sum.receiveErrors += values.receiveErrors;
+            sum.sendsBlocked += values.sendsBlocked;
+            sum.partialSends += values.partialSends;
+            if (live)
             {
-                WSADATA data;
-                if (::WSAStartup(0x0202, &data) != 0)
-                    throw std::runtime_error("Could not initialize "
-                        "Windows sockets");
-
-                initialized = true;
-                std::atexit(cleanup);
+                sum.outboxBytes += values.outboxBytes;
+                sum.inboxBytes += values.inboxBytes;
             }
-#endif
+            sum.outboxHighWater = std::max(sum.outboxHighWater, values.outboxHighWater);
         }
     }
 }
 
+void Gosu::needsSockLib()
+{
+#ifdef GOSU_IS_WIN
+    static bool initialized = false;
+    if (!initialized)
+    {
+        WSADATA data;
+        if (::WSAStartup(0x0202, &data) != 0)
+            throw std::runtime_error("Could not initialize "
+                "Windows sockets");
+
+        initialized = true;
+        std::atexit(cleanup);
+    }
+#endif
+}
+
 int Gosu::lastSocketError()
 {
 #ifdef GOSU_IS_WIN
@@ -68,12 +93,18 @@ Gosu::SocketAddress Gosu::stringToAddress(const std::string& s)
     if (address != INADDR_NONE)
         return address;
 
-    // This didn't work: Resolve host name via DNS.
-    hostent* host = ::gethostbyname(s.c_str());
-    if (!host)
+    // This didn't work: Resolve host name via DNS. Unlike gethostbyname,
+    // getaddrinfo can be used on several threads at once (AddressResolver).
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* results;
+    if (::getaddrinfo(s.c_str(), 0, &hints, &results) != 0)
         return 0;
-    in_addr addr = *reinterpret_cast<in_addr*>(host->h_addr_list[0]);
-    return ntohl(addr.s_addr);
+    address = ntohl(reinterpret_cast<sockaddr_in*>(results->ai_addr)->sin_addr.s_addr);
+    ::freeaddrinfo(results);
+    return address;
 }
 
 std::string Gosu::addressToString(SocketAddress address)
@@ -85,8 +116,32 @@ std::string Gosu::addressToString(SocketAddress address)
     return ::inet_ntoa(addr);
 }
 
+Gosu::SocketCounters::SocketCounters()
+: values()
+{
+    Lock lock(countersMutex);
+    liveCounters.insert(this);
+}
+
+Gosu::SocketCounters::~SocketCounters()
+{
+    Lock lock(countersMutex);
+    liveCounters.erase(this);
+    add(retiredCounters, values, false);
+}
+
+Gosu::SocketStatistics Gosu::socketStatistics()
+{
+    Lock lock(countersMutex);
+    SocketStatistics sum = retiredCounters;
+    for (std::set<const SocketCounters*>::const_iterator iter = liveCounters.begin();
+        iter != liveCounters.end(); ++iter)
+        add(sum, (*iter)->values, true);
+    return sum;
+}
+
 Gosu::Socket::Socket()
-: handle_(INVALID_SOCKET)
+: handle_(INVALID_SOCKET), nonBlocking_(false)
 {
     needsSockLib();
 }
@@ -101,7 +156,7 @@ Gosu::SocketHandle Gosu::Socket::handle() const
     return handle_;
 }
 
-void Gosu::Socket::setHandle(SocketHandle value)
+void Gosu::Socket::setHandle(SocketHandle value, bool nonBlocking)
 {
     if (handle() != INVALID_SOCKET)
     {
@@ -109,12 +164,16 @@ void Gosu::Socket::setHandle(SocketHandle value)
     }
 
     handle_ = value;
+    nonBlocking_ = nonBlocking;
 }
 
 void Gosu::Socket::setBlocking(bool value)
 {
+    if (nonBlocking_ && !value)
+        return;
     unsigned long enable = !value;
     socketCheck(::ioctlsocket(handle(), FIONBIO, &enable));
+    nonBlocking_ = !value;
 }
 
 Gosu::SocketAddress Gosu::Socket::address() const
@@ -142,4 +201,5 @@ Gosu::SocketPort Gosu::Socket::port() const
 void Gosu::Socket::swap(Socket& other)
 {
     std::swap(handle_, other.handle_);
+    std::swap(nonBlocking_, other.nonBlocking_);
 }
@@ -0,0 +1,320 @@
+#include <Gosu/Platform.hpp>
+#ifdef GOSU_IS_WIN
+// The default of 64 sockets is not much for a server.
+#define FD_SETSIZE 1024
+#endif
+#include <Gosu/Sockets.hpp>
+#include <GosuImpl/Sockets/Sockets.hpp>
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__linux__)
+#define GOSU_POLL_EPOLL
+#include <sys/epoll.h>
+#elif defined(GOSU_IS_MAC) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__NetBSD__)
+#define GOSU_POLL_KQUEUE
+#include <sys/types.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#ifndef GOSU_IS_WIN
+#include <sys/select.h>
+#endif
+#endif
+
+namespace
+{
+    enum Kind { MESSAGE, COMM, LISTENER };
+
+    struct Entry
+    {
+        Kind kind;
+        void* object;
+    };
+
+    // Events fetched by one call to epoll_wait or kevent.
+    enum { MAX_EVENTS = 256 };
+}
+
+struct Gosu::SocketPoller::Impl
+{
+    typedef std::map<SocketHandle, Entry> Entries;
+    Entries entries;
+
+    #if defined(GOSU_POLL_EPOLL) || defined(GOSU_POLL_KQUEUE)
+    int queue;
+    #endif
+
+    static const Socket& socketOf(const Entry& entry)
+    {
+        switch (entry.kind)
+        {
+        case MESSAGE:
+            return static_cast<MessageSocket*>(entry.object)->socket();
+        case COMM:
+            return static_cast<CommSocket*>(entry.object)->socket();
+        default:
+            return static_cast<ListenerSocket*>(entry.object)->socket();
+        }
+    }
+
+    // Returns the entry for the handle, or 0 if the socket behind it is
+    // gone, e.g. because a callback has removed it or a CommSocket has been
+    // disconnected.
+    const Entry* find(SocketHandle handle) const
+    {
+        Entries::const_iterator iter = entries.find(handle);
+        if (iter == entries.end() || socketOf(iter->second).handle() != handle)
+            return 0;
+        return &iter->second;
+    }
+
+    void add(Kind kind, void* object, SocketHandle handle)
+    {
+        if (handle == INVALID_SOCKET)
+            throw std::invalid_argument("Cannot poll a disconnected socket");
+
+        bool known = entries.count(handle) != 0;
+        Entry entry = { kind, object };
+        entries[handle] = entry;
+        // Already watched by the system, e.g. if it belonged to a socket
+        // that has been disconnected and the handle is being reused.
+        if (known)
+            unwatch(handle);
+        watch(handle);
+    }
+
+    void remove(void* object)
+    {
+        for (Entries::iterator iter = entries.begin(); iter != entries.end(); ++iter)
+        {
+            if (iter->second.object == object)
+            {
+                unwatch(iter->first);
+                entries.erase(iter);
+                return;
+            }
+        }
+    }
+
+    #ifdef GOSU_POLL_EPOLL
+    void watch(SocketHandle handle)
+    {
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = handle;
+        // ::epoll_ctl fails if the handle is already being watched.
+        if (::epoll_ctl(queue, EPOLL_CTL_ADD, handle, &event) == SOCKET_ERROR &&
+                errno != EEXIST)
+            throwLastSocketError();
+    }
+
+    void unwatch(SocketHandle handle)
+    {
+        // Closed handles are forgotten by the system on their own, so
+        // errors can be ignored.
+        epoll_event event = {};
+        ::epoll_ctl(queue, EPOLL_CTL_DEL, handle, &event);
+    }
+
+    void wait(unsigned timeout, std::vector<SocketHandle>& ready)
+    {
+        epoll_event events[MAX_EVENTS];
+        int count = ::epoll_wait(queue, events, MAX_EVENTS, timeout);
+        if (count == SOCKET_ERROR && errno != EINTR)
+            throwLastSocketError();
+        for (int i = 0; i < count; ++i)
+            ready.push_back(events[i].data.fd);
+    }
+    #elif defined(GOSU_POLL_KQUEUE)
+    void change(SocketHandle handle, unsigned short flags)
+    {
+        struct kevent event;
+        EV_SET(&event, handle, EVFILT_READ, flags, 0, 0, 0);
+        ::kevent(queue, &event, 1, 0, 0, 0);
+    }
+
+    void watch(SocketHandle handle)
+    {
+        change(handle, EV_ADD);
+    }
+
+    void unwatch(SocketHandle handle)
+    {
+        change(handle, EV_DELETE);
+    }
+
+    void wait(unsigned timeout, std::vector<SocketHandle>& ready)
+    {
+        struct kevent events[MAX_EVENTS];
+        timespec limit;
+        limit.tv_sec = timeout / 1000;
+        limit.tv_nsec = timeout % 1000 * 1000000;
+        int count = ::kevent(queue, 0, 0, events, MAX_EVENTS, &limit);
+        if (count == SOCKET_ERROR && errno != EINTR)
+            throwLastSocketError();
+        for (int i = 0; i < count; ++i)
+            ready.push_back(static_cast<SocketHandle>(events[i].ident));
+    }
+    #else
+    // select() rebuilds its set on every call, so there is nothing to do.
+    void watch(SocketHandle) {}
+    void unwatch(SocketHandle) {}
+
+    void wait(unsigned timeout, std::vector<SocketHandle>& ready)
+    {
+        fd_set set;
+        FD_ZERO(&set);
+        SocketHandle highest = 0;
+        for (Entries::const_iterator iter = entries.begin(); iter != entries.end(); ++iter)
+        {
+            if (!find(iter->first))
+                continue;
+            FD_SET(iter->first, &set);
+            highest = std::max(highest, iter->first);
+        }
+
+        timeval limit;
+        limit.tv_sec = timeout / 1000;
+        limit.tv_usec = timeout % 1000 * 1000;
+        // Windows does not allow to wait on an empty set.
+        #ifdef GOSU_IS_WIN
+        if (set.fd_count == 0)
+        {
+            Sleep(timeout);
+            return;
+        }
+        #endif
+        if (::select(static_cast<int>(highest) + 1, &set, 0, 0, &limit) == SOCKET_ERROR)
+            throwLastSocketError();
+
+        for (Entries::const_iterator iter = entries.begin(); iter != entries.end(); ++iter)
+            if (FD_ISSET(iter->first, &set))
+                ready.push_back(iter->first);
+    }
+    #endif
+};
+
+Gosu::SocketPoller::SocketPoller()
+: pimpl(new Impl)
+{
+    #if defined(GOSU_POLL_EPOLL)
+    pimpl->queue = socketCheck(::epoll_create(MAX_EVENTS));
+    #elif defined(GOSU_POLL_KQUEUE)
+    pimpl->queue = socketCheck(::kqueue());
+    #endif
+}
+
+Gosu::SocketPoller::~SocketPoller()
+{
+    #if defined(GOSU_POLL_EPOLL) || defined(GOSU_POLL_KQUEUE)
+    ::close(pimpl->queue);
+    #endif
+}
+
+void Gosu::SocketPoller::add(MessageSocket& socket)
+{
+    pimpl->add(MESSAGE, &socket, socket.socket().handle());
+}
+
+void Gosu::SocketPoller::add(CommSocket& socket)
+{
+    pimpl->add(COMM, &socket, socket.socket().handle());
+}
+
+void Gosu::SocketPoller::add(ListenerSocket& socket)
+{
+    pimpl->add(LISTENER, &socket, socket.socket().handle());
+}
+
+void Gosu::SocketPoller::remove(MessageSocket& socket)
+{
+    pimpl->remove(&socket);
+}
+
+void Gosu::SocketPoller::remove(CommSocket& socket)
+{
+    pimpl->remove(&socket);
+}
+
+void Gosu::SocketPoller::remove(ListenerSocket& socket)
+{
+    pimpl->remove(&socket);
+}
+
+std::size_t Gosu::SocketPoller::size() const
+{
+    return pimpl->entries.size();
+}
+
+std::size_t Gosu::SocketPoller::update(unsigned timeout)
+{
+    // Callbacks may add and remove sockets, so everything that is
+    // collected first is looked up again before it is used.
+    std::vector<SocketHandle> sending, connecting;
+    for (Impl::Entries::const_iterator iter = pimpl->entries.begin();
+        iter != pimpl->entries.end(); ++iter)
+    {
+        // Sockets only become readable once they are connected, so those
+        // that are connecting are asked directly.
+        if (iter->second.kind == COMM &&
+                static_cast<CommSocket*>(iter->second.object)->connecting())
+            connecting.push_back(iter->first);
+        else if (iter->second.kind == MESSAGE ||
+                (iter->second.kind == COMM &&
+                static_cast<CommSocket*>(iter->second.object)->pendingBytes() > 0))
+            sending.push_back(iter->first);
+    }
+    bool commPending = false;
+    for (std::size_t i = 0; i < sending.size(); ++i)
+    {
+        const Entry* entry = pimpl->find(sending[i]);
+        if (!entry)
+            continue;
+        if (entry->kind == MESSAGE)
+            static_cast<MessageSocket*>(entry->object)->flush();
+        else
+        {
+            static_cast<CommSocket*>(entry->object)->sendPendingData();
+            commPending = true;
+        }
+    }
+
+    std::size_t updated = 0;
+    for (std::size_t i = 0; i < connecting.size(); ++i)
+    {
+        const Entry* entry = pimpl->find(connecting[i]);
+        if (!entry || entry->kind != COMM)
+            continue;
+        static_cast<CommSocket*>(entry->object)->update();
+        ++updated;
+    }
+
+    // Do not wait for incoming data while there is data to send.
+    std::vector<SocketHandle> ready;
+    pimpl->wait(commPending ? 0 : timeout, ready);
+
+    for (std::size_t i = 0; i < ready.size(); ++i)
+    {
+        const Entry* entry = pimpl->find(ready[i]);
+        if (!entry)
+            continue;
+
+        switch (entry->kind)
+        {
+        case MESSAGE:
+            static_cast<MessageSocket*>(entry->object)->update();
+            break;
+        case COMM:
+            static_cast<CommSocket*>(entry->object)->update();
+            break;
+        case LISTENER:
+            static_cast<ListenerSocket*>(entry->object)->update();
+            break;
+        }
+        ++updated;
+    }
+    return updated;
+}
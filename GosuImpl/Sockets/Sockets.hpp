@@ -1,66 +1,97 @@
-#ifndef GOSUIMPL_SOCKETS_HPP
-#define GOSUIMPL_SOCKETS_HPP
-
-#include <Gosu/Platform.hpp>
-
-#ifdef GOSU_IS_WIN
-    #include "winsock2.h"
-    #define GOSU_SOCK_ERR(code) WSA##code
-    namespace Gosu { typedef SOCKET SocketHandle; }
-    typedef int socklen_t;
-#else
-    #include <unistd.h>
-    #include <sys/errno.h>
-    #include <sys/socket.h>
-    #include <netinet/in.h>
-    #include <arpa/inet.h>
-    #include <netdb.h>
-    #include <sys/ioctl.h> 
-    #define GOSU_SOCK_ERR(code) code
-    #define INVALID_SOCKET -1
-    #define SOCKET_ERROR -1
-    #define closesocket close
-    #define ioctlsocket ioctl
-    namespace Gosu { typedef int SocketHandle; }
-#endif
-
-namespace Gosu
-{
-    // Owns a socket and manages library initialization.
-    class Socket    {
-        Socket(const Socket&);
-        Socket& operator=(const Socket&);
-        
-        SocketHandle handle_;
-    public:
-        Socket();
-        ~Socket();
-
-        SocketHandle handle() const;
-        void setHandle(SocketHandle value);
-        void setBlocking(bool value);
-
-        SocketAddress address() const;
-        SocketPort port() const;
-
-        void swap(Socket& other);
-    };
-
-    int lastSocketError();
-    
-    GOSU_NORETURN void throwLastSocketError();
-    
-    template<typename T>
-    T socketCheck(T retVal)
-    {
-        if (retVal == SOCKET_ERROR &&
-            lastSocketError() != GOSU_SOCK_ERR(EWOULDBLOCK))
-        {
-            throwLastSocketError();
-        }
-        
-        return retVal;
-    }
-}
-
-#endif
+#ifndef GOSUIMPL_SOCKETS_HPP
+#define GOSUIMPL_SOCKETS_HPP
+
+#include <Gosu/Platform.hpp>
+
+#ifdef GOSU_IS_WIN
+    #include "winsock2.h"
+    #include <ws2tcpip.h>
+    #define GOSU_SOCK_ERR(code) WSA##code
+    namespace Gosu { typedef SOCKET SocketHandle; }
+    typedef int socklen_t;
+#else
+    #include <unistd.h>
+    #include <sys/errno.h>
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
+    #include <netdb.h>
+    #include <sys/ioctl.h> 
+    #define GOSU_SOCK_ERR(code) code
+    #define INVALID_SOCKET -1
+    #define SOCKET_ERROR -1
+    #define closesocket close
+    #define ioctlsocket ioctl
+    namespace Gosu { typedef int SocketHandle; }
+#endif
+
+namespace Gosu
+{
+    // Owns a socket and manages library initialization.
+    class Socket    {
+        Socket(const Socket&);
+        Socket& operator=(const Socket&);
+        
+        SocketHandle handle_;
+        // Whether the socket is known to be non-blocking, so that
+        // setBlocking(false) can be skipped.
+        bool nonBlocking_;
+    public:
+        Socket();
+        ~Socket();
+
+        SocketHandle handle() const;
+        // Sockets are assumed to be blocking unless told otherwise.
+        void setHandle(SocketHandle value, bool nonBlocking = false);
+        void setBlocking(bool value);
+
+        SocketAddress address() const;
+        SocketPort port() const;
+
+        void swap(Socket& other);
+    };
+
+    // Statistics of one socket, which socketStatistics() knows about for
+    // as long as they exist.
+    class SocketCounters
+    {
+        SocketCounters(const SocketCounters&);
+        SocketCounters& operator=(const SocketCounters&);
+
+    public:
+        SocketStatistics values;
+
+        SocketCounters();
+        ~SocketCounters();
+
+        void countSendError(int error)
+        {
+            ++values.sendErrors;
+            if (error == GOSU_SOCK_ERR(ENOBUFS) || error == GOSU_SOCK_ERR(EWOULDBLOCK))
+                ++values.sendsBlocked;
+        }
+    };
+
+    // Initializes the system's socket library if necessary. Must be called
+    // on the main thread before sockets are used on other threads.
+    void needsSockLib();
+    
+    int lastSocketError();
+    
+    GOSU_NORETURN void throwLastSocketError();
+    
+    template<typename T>
+    T socketCheck(T retVal)
+    {
+        if (retVal == SOCKET_ERROR &&
+            lastSocketError() != GOSU_SOCK_ERR(EWOULDBLOCK))
+        {
+            throwLastSocketError();
+        }
+        
+        return retVal;
+    }
+}
+
+#endif
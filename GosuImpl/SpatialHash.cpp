@@ -0,0 +1,304 @@
+#include <Gosu/SpatialHash.hpp>
+#include <Gosu/TR1.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+struct Gosu::SpatialHash::Impl
+{
+    double cellSize;
+
+    // Objects are kept in one dense array, so that queries that have to
+    // look at all of them (see objectsNotCells) run over contiguous memory.
+    // The buckets hold indices into it.
+    struct Object
+    {
+        unsigned id;
+        double left, top, right, bottom;
+        int cellLeft, cellTop, cellRight, cellBottom;
+        // Equal to Impl::stamp if the current query has seen the object.
+        unsigned stamp;
+    };
+
+    // Boxes that only touch count as overlapping, so that objects without
+    // an extent can be found.
+    struct OverlapsRect
+    {
+        double left, top, right, bottom;
+
+        bool operator()(const Object& o) const
+        {
+            return o.left <= right && left <= o.right && o.top <= bottom && top <= o.bottom;
+        }
+    };
+
+    struct OverlapsCircle
+    {
+        double x, y, radius;
+
+        bool operator()(const Object& o) const
+        {
+            double distX = std::max(std::max(o.left - x, x - o.right), 0.0);
+            double distY = std::max(std::max(o.top - y, y - o.bottom), 0.0);
+            return distX * distX + distY * distY <= radius * radius;
+        }
+    };
+
+    std::vector<Object> objects;
+    std::tr1::unordered_map<unsigned, std::size_t> indices;
+
+    // Cells are hashed into a power-of-two number of buckets, so any two
+    // cells (or the same object twice) may share one. Queries skip objects
+    // they have already seen and compare the boxes anyway.
+    std::vector<std::vector<std::size_t> > buckets;
+    unsigned stamp;
+
+    int cell(double coordinate) const
+    {
+        // Clamped so that the cell numbers and their ranges fit into int.
+        double c = std::floor(coordinate / cellSize);
+        return static_cast<int>(std::max(-1e8, std::min(c, 1e8)));
+    }
+
+    std::vector<std::size_t>& bucket(int cx, int cy)
+    {
+        unsigned hash = unsigned(cx) * 73856093u ^ unsigned(cy) * 19349663u;
+        return buckets[hash & (buckets.size() - 1)];
+    }
+
+    void addToCells(std::size_t index)
+    {
+        const Object& o = objects[index];
+        for (int cy = o.cellTop; cy <= o.cellBottom; ++cy)
+            for (int cx = o.cellLeft; cx <= o.cellRight; ++cx)
+                bucket(cx, cy).push_back(index);
+    }
+
+    // Replaces one occurrence of index per cell, or removes it if
+    // replacement is npos.
+    void replaceInCells(std::size_t index, std::size_t replacement)
+    {
+        const Object& o = objects[index];
+        for (int cy = o.cellTop; cy <= o.cellBottom; ++cy)
+            for (int cx = o.cellLeft; cx <= o.cellRight; ++cx)
+            {
+                std::vector<std::size_t>& b = bucket(cx, cy);
+                std::vector<std::size_t>::iterator it = std::find(b.begin(), b.end(), index);
+                if (replacement != npos())
+                    *it = replacement;
+                else
+                {
+                    *it = b.back();
+                    b.pop_back();
+                }
+            }
+    }
+
+    static std::size_t npos()
+    {
+        return static_cast<std::size_t>(-1);
+    }
+
+    void rehash(std::size_t bucketCount)
+    {
+        buckets.assign(bucketCount, std::vector<std::size_t>());
+        for (std::size_t i = 0; i < objects.size(); ++i)
+            addToCells(i);
+    }
+
+    // Starts a new query.
+    unsigned nextStamp()
+    {
+        if (++stamp == 0)
+        {
+            for (std::size_t i = 0; i < objects.size(); ++i)
+                objects[i].stamp = 0;
+            stamp = 1;
+        }
+        return stamp;
+    }
+
+    // A query that covers more cells than there are objects is faster
+    // when it compares all of the objects.
+    bool objectsNotCells(int cellLeft, int cellTop, int cellRight, int cellBottom) const
+    {
+        return (cellRight - cellLeft + 1.0) * (cellBottom - cellTop + 1.0) > objects.size();
+    }
+
+    template<typename Overlaps>
+    void query(double left, double top, double right, double bottom,
+        Overlaps overlaps, std::vector<unsigned>& ids)
+    {
+        if (objects.empty())
+            return;
+
+        int cellLeft = cell(left), cellTop = cell(top);
+        int cellRight = cell(right), cellBottom = cell(bottom);
+        if (objectsNotCells(cellLeft, cellTop, cellRight, cellBottom))
+        {
+            for (std::size_t i = 0; i < objects.size(); ++i)
+                if (overlaps(objects[i]))
+                    ids.push_back(objects[i].id);
+            return;
+        }
+
+        unsigned current = nextStamp();
+        for (int cy = cellTop; cy <= cellBottom; ++cy)
+            for (int cx = cellLeft; cx <= cellRight; ++cx)
+            {
+                const std::vector<std::size_t>& b = bucket(cx, cy);
+                for (std::size_t i = 0; i < b.size(); ++i)
+                {
+                    Object& o = objects[b[i]];
+                    if (o.stamp == current)
+                        continue;
+                    o.stamp = current;
+                    if (overlaps(o))
+                        ids.push_back(o.id);
+                }
+            }
+    }
+};
+
+Gosu::SpatialHash::SpatialHash(double cellSize)
+: pimpl(new Impl)
+{
+    if (!(cellSize > 0))
+        throw std::invalid_argument("SpatialHash needs a positive cell size");
+
+    pimpl->cellSize = cellSize;
+    pimpl->stamp = 0;
+    pimpl->buckets.resize(256);
+}
+
+Gosu::SpatialHash::~SpatialHash()
+{
+}
+
+double Gosu::SpatialHash::cellSize() const
+{
+    return pimpl->cellSize;
+}
+
+std::size_t Gosu::SpatialHash::size() const
+{
+    return pimpl->objects.size();
+}
+
+bool Gosu::SpatialHash::contains(unsigned id) const
+{
+    return pimpl->indices.count(id) != 0;
+}
+
+void Gosu::SpatialHash::clear()
+{
+    pimpl->objects.clear();
+    pimpl->indices.clear();
+    for (std::size_t i = 0; i < pimpl->buckets.size(); ++i)
+        pimpl->buckets[i].clear();
+}
+
+void Gosu::SpatialHash::insert(unsigned id, double left, double top, double right, double bottom)
+{
+    update(id, left, top, right, bottom);
+}
+
+void Gosu::SpatialHash::update(unsigned id, double left, double top, double right, double bottom)
+{
+    Impl::Object o;
+    o.id = id;
+    o.left = std::min(left, right), o.right = std::max(left, right);
+    o.top = std::min(top, bottom), o.bottom = std::max(top, bottom);
+    o.cellLeft = pimpl->cell(o.left), o.cellRight = pimpl->cell(o.right);
+    o.cellTop = pimpl->cell(o.top), o.cellBottom = pimpl->cell(o.bottom);
+    o.stamp = 0;
+
+    std::tr1::unordered_map<unsigned, std::size_t>::iterator it = pimpl->indices.find(id);
+    if (it != pimpl->indices.end())
+    {
+        Impl::Object& old = pimpl->objects[it->second];
+        o.stamp = old.stamp;
+        bool sameCells = o.cellLeft == old.cellLeft && o.cellTop == old.cellTop &&
+            o.cellRight == old.cellRight && o.cellBottom == old.cellBottom;
+        if (!sameCells)
+            pimpl->replaceInCells(it->second, Impl::npos());
+        old = o;
+        if (!sameCells)
+            pimpl->addToCells(it->second);
+        return;
+    }
+
+    std::size_t index = pimpl->objects.size();
+    pimpl->objects.push_back(o);
+    pimpl->indices[id] = index;
+    // About one object per bucket.
+    if (pimpl->objects.size() > pimpl->buckets.size())
+        pimpl->rehash(pimpl->buckets.size() * 2);
+    else
+        pimpl->addToCells(index);
+}
+
+void Gosu::SpatialHash::remove(unsigned id)
+{
+    std::tr1::unordered_map<unsigned, std::size_t>::iterator it = pimpl->indices.find(id);
+    if (it == pimpl->indices.end())
+        return;
+
+    // The last object takes the place of the removed one.
+    std::size_t index = it->second, last = pimpl->objects.size() - 1;
+    pimpl->indices.erase(it);
+    pimpl->replaceInCells(index, Impl::npos());
+    if (index != last)
+    {
+        pimpl->replaceInCells(last, index);
+        pimpl->objects[index] = pimpl->objects[last];
+        pimpl->indices[pimpl->objects[index].id] = index;
+    }
+    pimpl->objects.pop_back();
+}
+
+void Gosu::SpatialHash::queryRect(double left, double top, double right, double bottom,
+    std::vector<unsigned>& ids) const
+{
+    Impl::OverlapsRect overlaps = { std::min(left, right), std::min(top, bottom),
+        std::max(left, right), std::max(top, bottom) };
+    pimpl->query(overlaps.left, overlaps.top, overlaps.right, overlaps.bottom,
+        overlaps, ids);
+}
+
+void Gosu::SpatialHash::queryRadius(double x, double y, double radius,
+    std::vector<unsigned>& ids) const
+{
+    Impl::OverlapsCircle overlaps = { x, y, std::fabs(radius) };
+    pimpl->query(x - overlaps.radius, y - overlaps.radius,
+        x + overlaps.radius, y + overlaps.radius, overlaps, ids);
+}
+
+void Gosu::SpatialHash::overlappingPairs(std::vector<unsigned>& ids) const
+{
+    // Each object is compared to those with a higher index in its cells.
+    // The stamps keep it from being compared to one twice.
+    std::vector<Impl::Object>& objects = pimpl->objects;
+    for (std::size_t a = 0; a < objects.size(); ++a)
+    {
+        const Impl::Object& o = objects[a];
+        Impl::OverlapsRect overlaps = { o.left, o.top, o.right, o.bottom };
+        unsigned current = pimpl->nextStamp();
+        for (int cy = o.cellTop; cy <= o.cellBottom; ++cy)
+            for (int cx = o.cellLeft; cx <= o.cellRight; ++cx)
+            {
+                const std::vector<std::size_t>& b = pimpl->bucket(cx, cy);
+                for (std::size_t i = 0; i < b.size(); ++i)
+                {
+                    if (b[i] <= a || objects[b[i]].stamp == current)
+                        continue;
+                    objects[b[i]].stamp = current;
+                    if (overlaps(objects[b[i]]))
+                    {
+                        ids.push_back(o.id);
+                        ids.push_back(objects[b[i]].id);
+                    }
+                }
+            }
+    }
+}
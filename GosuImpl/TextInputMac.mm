@@ -1,6 +1,7 @@
 #include <Gosu/TextInput.hpp>
 #include <Gosu/ButtonsMac.hpp>
 #include <GosuImpl/MacUtility.hpp>
+#include <GosuImpl/PrefixWidths.hpp>
 #include <algorithm>
 #include <vector>
 #include <wctype.h>
@@ -22,11 +23,15 @@
     std::wstring* _text;
     unsigned* _caretPos;
     unsigned* _selectionStart;
+    Gosu::PrefixWidths* _widths;
 }
 @end
 @implementation GosuTextInput
 - (void)insertText:(id)insertString
 {
+    // All edits, including deletion, go through here.
+    _widths->invalidate(std::min(CARET_POS, SEL_START));
+    
     // Delete (overwrite) previous selection.
     if (CARET_POS != SEL_START)
     {
@@ -149,11 +154,13 @@ IMPL_WITH_SEL_RESET(moveToEndOfDocument)
 
 - (void)setFilter:(Gosu::TextInput&)filter andText:(std::wstring&)text
     andCaretPos:(unsigned&)caretPos andSelectionStart:(unsigned&)selectionStart
+    andWidths:(Gosu::PrefixWidths&)widths
 {
     _filter = &filter;
     _text = &text;
     _caretPos = &caretPos;
     _selectionStart = &selectionStart;
+    _widths = &widths;
 }
 @end
 
@@ -162,6 +169,7 @@ struct Gosu::TextInput::Impl
     ObjRef<GosuTextInput> responder;
     std::wstring text;
     unsigned caretPos, selectionStart;
+    Gosu::PrefixWidths widths;
     Impl() : caretPos(0), selectionStart(0) {}
 };
 
@@ -170,7 +178,8 @@ Gosu::TextInput::TextInput()
 {
     pimpl->responder.reset([[GosuTextInput alloc] init]);
     [pimpl->responder.get() setFilter: *this andText: pimpl->text
-        andCaretPos: pimpl->caretPos andSelectionStart: pimpl->selectionStart];
+        andCaretPos: pimpl->caretPos andSelectionStart: pimpl->selectionStart
+        andWidths: pimpl->widths];
 }
 
 Gosu::TextInput::~TextInput()
@@ -184,6 +193,7 @@ std::wstring Gosu::TextInput::text() const
 
 void Gosu::TextInput::setText(const std::wstring& text)
 {
+	pimpl->widths.invalidate(0);
 	pimpl->text = text;
 	pimpl->caretPos = pimpl->selectionStart = text.length();
 }
@@ -208,6 +218,21 @@ void Gosu::TextInput::setSelectionStart(unsigned pos)
     pimpl->selectionStart = pos;
 }
 
+double Gosu::TextInput::caretX(const Font& font) const
+{
+    return pimpl->widths.at(font, pimpl->text, pimpl->caretPos);
+}
+
+double Gosu::TextInput::selectionStartX(const Font& font) const
+{
+    return pimpl->widths.at(font, pimpl->text, pimpl->selectionStart);
+}
+
+double Gosu::TextInput::textWidth(const Font& font) const
+{
+    return pimpl->widths.at(font, pimpl->text, pimpl->text.length());
+}
+
 bool Gosu::TextInput::feedNSEvent(void* event)
 {
 	NSEvent* nsEvent = (NSEvent*)event;
@@ -1,5 +1,6 @@
 #include <Gosu/TextInput.hpp>
 #include <Gosu/ButtonsWin.hpp>
+#include <GosuImpl/PrefixWidths.hpp>
 #include <algorithm>
 #include <vector>
 #include <wctype.h>
@@ -14,6 +15,7 @@ struct Gosu::TextInput::Impl
 {
     std::wstring text;
     unsigned caretPos, selectionStart;
+    PrefixWidths widths;
     Impl() : caretPos(0), selectionStart(0) {}
 };
 
@@ -33,6 +35,7 @@ std::wstring Gosu::TextInput::text() const
 
 void Gosu::TextInput::setText(const std::wstring& text)
 {
+  pimpl->widths.invalidate(0);
   pimpl->text = text;
   pimpl->caretPos = pimpl->selectionStart = text.length();
 }
@@ -57,6 +60,21 @@ void Gosu::TextInput::setSelectionStart(unsigned pos)
     pimpl->selectionStart = pos;
 }
 
+double Gosu::TextInput::caretX(const Font& font) const
+{
+    return pimpl->widths.at(font, pimpl->text, pimpl->caretPos);
+}
+
+double Gosu::TextInput::selectionStartX(const Font& font) const
+{
+    return pimpl->widths.at(font, pimpl->text, pimpl->selectionStart);
+}
+
+double Gosu::TextInput::textWidth(const Font& font) const
+{
+    return pimpl->widths.at(font, pimpl->text, pimpl->text.length());
+}
+
 #define CARET_POS (pimpl->caretPos)
 #define SEL_START (pimpl->selectionStart)
 
@@ -69,12 +87,14 @@ bool Gosu::TextInput::feedMessage(unsigned long message, unsigned long wparam, u
         {
             unsigned min = std::min(CARET_POS, SEL_START);
             unsigned max = std::max(CARET_POS, SEL_START);
+            pimpl->widths.invalidate(min);
             pimpl->text.erase(pimpl->text.begin() + min, pimpl->text.begin() + max);
             CARET_POS = SEL_START = min;
         }
         
         wchar_t text[] = { static_cast<wchar_t>(wparam), 0 };
         std::wstring filteredText = filter(text);
+        pimpl->widths.invalidate(CARET_POS);
         pimpl->text.insert(pimpl->text.begin() + CARET_POS, filteredText.begin(), filteredText.end());
         CARET_POS += filteredText.length();
         SEL_START = CARET_POS;
@@ -171,6 +191,7 @@ bool Gosu::TextInput::feedMessage(unsigned long message, unsigned long wparam, u
         {
             unsigned min = std::min(CARET_POS, SEL_START);
             unsigned max = std::max(CARET_POS, SEL_START);
+            pimpl->widths.invalidate(min);
             pimpl->text.erase(pimpl->text.begin() + min, pimpl->text.begin() + max);
             SEL_START = CARET_POS = min;
         }
@@ -179,6 +200,7 @@ bool Gosu::TextInput::feedMessage(unsigned long message, unsigned long wparam, u
             unsigned oldCaret = CARET_POS;
             // Move left - either char or word
             feedMessage(WM_KEYDOWN, VK_LEFT, lparam);
+            pimpl->widths.invalidate(CARET_POS);
             pimpl->text.erase(pimpl->text.begin() + CARET_POS, pimpl->text.begin() + oldCaret);
             SEL_START = CARET_POS;
         }
@@ -194,6 +216,7 @@ bool Gosu::TextInput::feedMessage(unsigned long message, unsigned long wparam, u
         {
             unsigned min = std::min(CARET_POS, SEL_START);
             unsigned max = std::max(CARET_POS, SEL_START);
+            pimpl->widths.invalidate(min);
             pimpl->text.erase(pimpl->text.begin() + min, pimpl->text.begin() + max);
             SEL_START = CARET_POS = min;
         }
@@ -202,6 +225,7 @@ bool Gosu::TextInput::feedMessage(unsigned long message, unsigned long wparam, u
             unsigned oldCaret = CARET_POS;
             // Move right - either char or word
             feedMessage(WM_KEYDOWN, VK_RIGHT, lparam);
+            pimpl->widths.invalidate(oldCaret);
             pimpl->text.erase(pimpl->text.begin() + oldCaret, pimpl->text.begin() + CARET_POS);
             SEL_START = CARET_POS = oldCaret;
         }
@@ -1,5 +1,6 @@
 #include <Gosu/TextInput.hpp>
 #include <Gosu/Input.hpp>
+#include <GosuImpl/PrefixWidths.hpp>
 #include <algorithm>
 #include <vector>
 #include <wctype.h>
@@ -8,6 +9,7 @@ struct Gosu::TextInput::Impl
 {
     std::wstring text;
     unsigned caretPos, selectionStart;
+    PrefixWidths widths;
     Impl() : caretPos(0), selectionStart(0) {}
 };
 
@@ -27,6 +29,7 @@ std::wstring Gosu::TextInput::text() const
 
 void Gosu::TextInput::setText(const std::wstring& text)
 {
+	pimpl->widths.invalidate(0);
 	pimpl->text = text;
 	pimpl->caretPos = pimpl->selectionStart = text.length();
 }
@@ -51,6 +54,21 @@ void Gosu::TextInput::setSelectionStart(unsigned pos)
     pimpl->selectionStart = pos;
 }
 
+double Gosu::TextInput::caretX(const Font& font) const
+{
+    return pimpl->widths.at(font, pimpl->text, pimpl->caretPos);
+}
+
+double Gosu::TextInput::selectionStartX(const Font& font) const
+{
+    return pimpl->widths.at(font, pimpl->text, pimpl->selectionStart);
+}
+
+double Gosu::TextInput::textWidth(const Font& font) const
+{
+    return pimpl->widths.at(font, pimpl->text, pimpl->text.length());
+}
+
 #define CARET_POS (pimpl->caretPos)
 #define SEL_START (pimpl->selectionStart)
 
@@ -76,12 +94,14 @@ bool Gosu::TextInput::feedXEvent(void* display, void* event)
         {
             unsigned min = std::min(CARET_POS, SEL_START);
             unsigned max = std::max(CARET_POS, SEL_START);
+            pimpl->widths.invalidate(min);
             pimpl->text.erase(pimpl->text.begin() + min, pimpl->text.begin() + max);
             CARET_POS = SEL_START = min;
         }
         
         wchar_t text[] = { ch, 0 };
         std::wstring filteredText = filter(text);
+        pimpl->widths.invalidate(CARET_POS);
         pimpl->text.insert(pimpl->text.begin() + CARET_POS, filteredText.begin(), filteredText.end());
         CARET_POS += filteredText.length();
         SEL_START = CARET_POS;
@@ -174,6 +194,7 @@ bool Gosu::TextInput::feedXEvent(void* display, void* event)
         {
             unsigned min = std::min(CARET_POS, SEL_START);
             unsigned max = std::max(CARET_POS, SEL_START);
+            pimpl->widths.invalidate(min);
             pimpl->text.erase(pimpl->text.begin() + min, pimpl->text.begin() + max);
             SEL_START = CARET_POS = min;
         }
@@ -181,6 +202,7 @@ bool Gosu::TextInput::feedXEvent(void* display, void* event)
         {
             unsigned oldCaret = CARET_POS;
             CARET_POS -= 1;
+            pimpl->widths.invalidate(CARET_POS);
             pimpl->text.erase(pimpl->text.begin() + CARET_POS, pimpl->text.begin() + oldCaret);
             SEL_START = CARET_POS;
         }
@@ -195,6 +217,7 @@ bool Gosu::TextInput::feedXEvent(void* display, void* event)
         {
             unsigned min = std::min(CARET_POS, SEL_START);
             unsigned max = std::max(CARET_POS, SEL_START);
+            pimpl->widths.invalidate(min);
             pimpl->text.erase(pimpl->text.begin() + min, pimpl->text.begin() + max);
             SEL_START = CARET_POS = min;
         }
@@ -202,6 +225,7 @@ bool Gosu::TextInput::feedXEvent(void* display, void* event)
         {
             unsigned oldCaret = CARET_POS;
             CARET_POS += 1;
+            pimpl->widths.invalidate(oldCaret);
             pimpl->text.erase(pimpl->text.begin() + oldCaret, pimpl->text.begin() + CARET_POS);
             SEL_START = CARET_POS = oldCaret;
         }
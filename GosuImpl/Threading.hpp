@@ -0,0 +1,201 @@
+#ifndef GOSUIMPL_THREADING_HPP
+#define GOSUIMPL_THREADING_HPP
+
+// Minimal threading primitives until TR1/C++11 threads are available on all
+// compilers Gosu supports. POSIX threads everywhere but on Windows.
+
+#include <Gosu/Platform.hpp>
+#include <Gosu/TR1.hpp>
+#include <memory>
+#include <stdexcept>
+
+#ifdef GOSU_IS_WIN
+#include <climits>
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Thread-local storage of plain values that start out zeroed, e.g. for
+// threads that draw or render next to the main one.
+#if defined(_MSC_VER)
+#define GOSU_THREAD_LOCAL __declspec(thread)
+#else
+#define GOSU_THREAD_LOCAL __thread
+#endif
+
+namespace Gosu
+{
+    class Mutex
+    {
+        Mutex(const Mutex&);
+        Mutex& operator=(const Mutex&);
+
+    #ifdef GOSU_IS_WIN
+        CRITICAL_SECTION section;
+
+    public:
+        Mutex() { InitializeCriticalSection(&section); }
+        ~Mutex() { DeleteCriticalSection(&section); }
+        void lock() { EnterCriticalSection(&section); }
+        void unlock() { LeaveCriticalSection(&section); }
+    #else
+        pthread_mutex_t mutex;
+        friend class Semaphore;
+
+    public:
+        Mutex() { pthread_mutex_init(&mutex, 0); }
+        ~Mutex() { pthread_mutex_destroy(&mutex); }
+        void lock() { pthread_mutex_lock(&mutex); }
+        void unlock() { pthread_mutex_unlock(&mutex); }
+    #endif
+    };
+
+    class Lock
+    {
+        Lock(const Lock&);
+        Lock& operator=(const Lock&);
+
+        Mutex& mutex;
+
+    public:
+        explicit Lock(Mutex& mutex)
+        : mutex(mutex)
+        {
+            mutex.lock();
+        }
+
+        ~Lock()
+        {
+            mutex.unlock();
+        }
+    };
+
+    // Counting semaphore. Used instead of condition variables since those
+    // only exist from Windows Vista on.
+    class Semaphore
+    {
+        Semaphore(const Semaphore&);
+        Semaphore& operator=(const Semaphore&);
+
+    #ifdef GOSU_IS_WIN
+        HANDLE handle;
+
+    public:
+        Semaphore()
+        {
+            handle = CreateSemaphore(0, 0, LONG_MAX, 0);
+            if (!handle)
+                throw std::runtime_error("Could not create semaphore");
+        }
+        ~Semaphore() { CloseHandle(handle); }
+        void post() { ReleaseSemaphore(handle, 1, 0); }
+        void wait() { WaitForSingleObject(handle, INFINITE); }
+    #else
+        // Unnamed POSIX semaphores are not implemented on OS X.
+        Mutex mutex;
+        pthread_cond_t condition;
+        unsigned long count;
+
+    public:
+        Semaphore()
+        : count(0)
+        {
+            pthread_cond_init(&condition, 0);
+        }
+
+        ~Semaphore()
+        {
+            pthread_cond_destroy(&condition);
+        }
+
+        void post()
+        {
+            Lock lock(mutex);
+            ++count;
+            pthread_cond_signal(&condition);
+        }
+
+        void wait()
+        {
+            Lock lock(mutex);
+            while (count == 0)
+                pthread_cond_wait(&condition, &mutex.mutex);
+            --count;
+        }
+    #endif
+    };
+
+    // Runs a function on a new thread. The destructor waits for it to return.
+    class Thread
+    {
+        Thread(const Thread&);
+        Thread& operator=(const Thread&);
+
+        typedef std::tr1::function<void()> Body;
+        Body body;
+
+    #ifdef GOSU_IS_WIN
+        HANDLE handle;
+
+        static unsigned __stdcall run(void* self)
+        {
+            static_cast<Thread*>(self)->body();
+            return 0;
+        }
+
+    public:
+        explicit Thread(const Body& body)
+        : body(body)
+        {
+            handle = reinterpret_cast<HANDLE>(_beginthreadex(0, 0, run, this, 0, 0));
+            if (!handle)
+                throw std::runtime_error("Could not create thread");
+        }
+
+        ~Thread()
+        {
+            WaitForSingleObject(handle, INFINITE);
+            CloseHandle(handle);
+        }
+    #else
+        pthread_t thread;
+
+        static void* run(void* self)
+        {
+            static_cast<Thread*>(self)->body();
+            return 0;
+        }
+
+    public:
+        explicit Thread(const Body& body)
+        : body(body)
+        {
+            if (pthread_create(&thread, 0, run, this) != 0)
+                throw std::runtime_error("Could not create thread");
+        }
+
+        ~Thread()
+        {
+            pthread_join(thread, 0);
+        }
+    #endif
+    };
+
+    // Returns the number of CPU cores, or 1 if unknown.
+    inline unsigned hardwareThreads()
+    {
+    #ifdef GOSU_IS_WIN
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+    #else
+        long result = sysconf(_SC_NPROCESSORS_ONLN);
+        return result > 0 ? result : 1;
+    #endif
+    }
+}
+
+#endif
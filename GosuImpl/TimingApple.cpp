@@ -25,3 +25,12 @@ unsigned long Gosu::milliseconds()
     uint64_t runtime = mach_absolute_time() - firstTick;
 	return runtime * info.numer / info.denom / 1000000.0;
 }
+
+std::tr1::uint64_t Gosu::microseconds()
+{
+    static mach_timebase_info_data_t info;
+    if (info.denom == 0)
+        mach_timebase_info(&info);
+    
+    return mach_absolute_time() * (static_cast<double>(info.numer) / info.denom) / 1000;
+}
@@ -1,6 +1,6 @@
 #include <Gosu/Timing.hpp>
 #include <unistd.h>
-#include <sys/time.h>
+#include <time.h>
 
 void Gosu::sleep(unsigned milliseconds)
 {
@@ -9,16 +9,18 @@ void Gosu::sleep(unsigned milliseconds)
 
 unsigned long Gosu::milliseconds()
 {
-		static unsigned long start = 0;
-
-    timeval tp;
-    gettimeofday(&tp, NULL);
-
-		if (!start)
-			start = tp.tv_usec / 1000UL + tp.tv_sec * 1000UL;
-		
+    static std::tr1::uint64_t start = microseconds() / 1000;
+    
     // Truncate to 2^30, C++ users shouldn't mind and Ruby users will
     // have a happy GC on 32-bit systems.
     // No, don't ask why this is an unsigned long then :)
-    return (tp.tv_usec / 1000UL + tp.tv_sec * 1000UL - start) & 0x1fffffff;
+    return (microseconds() / 1000 - start) & 0x1fffffff;
+}
+
+std::tr1::uint64_t Gosu::microseconds()
+{
+    // Unlike gettimeofday, this does not jump when the system time is set.
+    timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec * static_cast<std::tr1::uint64_t>(1000000) + tp.tv_nsec / 1000;
 }
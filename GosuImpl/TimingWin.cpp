@@ -30,3 +30,16 @@ unsigned long Gosu::milliseconds()
     // No, don't ask why this is an unsigned long then :)
     return (::timeGetTime() - start) & 0x1fffffff;
 }
+
+std::tr1::uint64_t Gosu::microseconds()
+{
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0)
+        ::QueryPerformanceFrequency(&frequency);
+    
+    LARGE_INTEGER counter;
+    ::QueryPerformanceCounter(&counter);
+    // Split up to avoid overflowing 64 bits with high frequencies.
+    std::tr1::uint64_t ticks = counter.QuadPart, perSecond = frequency.QuadPart;
+    return ticks / perSecond * 1000000 + ticks % perSecond * 1000000 / perSecond;
+}
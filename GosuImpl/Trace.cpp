@@ -0,0 +1,259 @@
+#include <Gosu/Trace.hpp>
+#include <Gosu/IO.hpp>
+#include <Gosu/Timing.hpp>
+#include <GosuImpl/Threading.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <vector>
+#ifdef GOSU_IS_MAC
+#include <mach/mach.h>
+#endif
+
+namespace Gosu
+{
+    namespace
+    {
+        struct Span
+        {
+            const char* name;
+            std::tr1::uint64_t start, duration;
+            unsigned long thread;
+        };
+
+        // Checked without locking, so that spans cost next to nothing
+        // while tracing is off.
+        volatile bool enabled = false;
+
+        Mutex& traceMutex()
+        {
+            static Mutex mutex;
+            return mutex;
+        }
+
+        // Ring buffer of the most recent spans. next is where the next one
+        // will be stored, wrapped tells whether the buffer is full.
+        std::vector<Span> spans;
+        std::size_t next = 0;
+        bool wrapped = false;
+
+        // Names of spans from traceSpan, which have to outlive the trace.
+        std::set<std::string> names;
+
+        // Phases of the startup report, also guarded by traceMutex. Scopes
+        // with the same name add up to one phase.
+        struct Phase
+        {
+            const char* name;
+            std::tr1::uint64_t start, duration;
+            unsigned count;
+        };
+        std::vector<Phase> phases;
+        volatile bool startupFinished = false;
+        // From the first phase to the end of the first frame.
+        std::tr1::uint64_t startupDuration = 0;
+
+        bool startedEarlier(const Phase& lhs, const Phase& rhs)
+        {
+            return lhs.start < rhs.start;
+        }
+
+        void recordPhase(const char* name, std::tr1::uint64_t start,
+            std::tr1::uint64_t duration)
+        {
+            Lock lock(traceMutex());
+            if (startupFinished)
+                return;
+            for (std::size_t i = 0; i < phases.size(); ++i)
+                if (std::strcmp(phases[i].name, name) == 0)
+                {
+                    phases[i].duration += duration;
+                    ++phases[i].count;
+                    return;
+                }
+            Phase phase = { name, start, duration, 1 };
+            phases.push_back(phase);
+        }
+
+        unsigned long currentThread()
+        {
+        #if defined(GOSU_IS_WIN)
+            return GetCurrentThreadId();
+        #elif defined(GOSU_IS_MAC)
+            return pthread_mach_thread_np(pthread_self());
+        #else
+            return static_cast<unsigned long>(pthread_self());
+        #endif
+        }
+
+        void record(const char* name, std::tr1::uint64_t start,
+            std::tr1::uint64_t duration)
+        {
+            Span span = { name, start, duration, currentThread() };
+            Lock lock(traceMutex());
+            if (spans.empty())
+                return;
+            spans[next] = span;
+            if (++next == spans.size())
+                next = 0, wrapped = true;
+        }
+
+        void appendEscaped(std::string& json, const char* text)
+        {
+            for (; *text; ++text)
+            {
+                unsigned char c = *text;
+                if (c == '"' || c == '\\')
+                    json += '\\', json += c;
+                else if (c < 0x20)
+                {
+                    char escape[7];
+                    std::sprintf(escape, "\\u%04x", c);
+                    json += escape;
+                }
+                else
+                    json += c;
+            }
+        }
+    }
+}
+
+void Gosu::startTracing(std::size_t capacity)
+{
+    Lock lock(traceMutex());
+    spans.assign(capacity, Span());
+    next = 0;
+    wrapped = false;
+    enabled = capacity > 0;
+}
+
+void Gosu::stopTracing()
+{
+    enabled = false;
+}
+
+bool Gosu::tracing()
+{
+    return enabled;
+}
+
+void Gosu::saveTrace(const std::wstring& filename)
+{
+    std::string json = "{\"traceEvents\":[";
+    {
+        Lock lock(traceMutex());
+        std::size_t count = wrapped ? spans.size() : next;
+        std::size_t first = wrapped ? next : 0;
+        json.reserve(json.size() + count * 96);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const Span& span = spans[(first + i) % spans.size()];
+            json += i == 0 ? "\n{\"name\":\"" : ",\n{\"name\":\"";
+            appendEscaped(json, span.name);
+            char rest[128];
+            std::sprintf(rest, "\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.0f,\"dur\":%.0f}",
+                span.thread, double(span.start), double(span.duration));
+            json += rest;
+        }
+    }
+    json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+
+    Buffer buffer;
+    buffer.resize(json.size());
+    std::memcpy(buffer.data(), json.data(), json.size());
+    saveFile(buffer, filename);
+}
+
+void Gosu::traceSpan(const std::string& name, std::tr1::uint64_t start,
+    std::tr1::uint64_t duration)
+{
+    if (!enabled)
+        return;
+    const char* stableName;
+    {
+        Lock lock(traceMutex());
+        stableName = names.insert(name).first->c_str();
+    }
+    record(stableName, start, duration);
+}
+
+Gosu::TraceScope::TraceScope(const char* name)
+: name(enabled ? name : 0), start(enabled ? microseconds() : 0)
+{
+}
+
+Gosu::TraceScope::~TraceScope()
+{
+    // Spans that began before tracing stopped are still recorded.
+    if (name)
+        record(name, start, microseconds() - start);
+}
+
+std::string Gosu::startupReport()
+{
+    std::vector<Phase> sorted;
+    bool finished;
+    std::tr1::uint64_t total;
+    {
+        Lock lock(traceMutex());
+        sorted = phases;
+        finished = startupFinished;
+        total = startupDuration;
+    }
+    // Outer phases end, and are recorded, after the ones nested in them.
+    std::stable_sort(sorted.begin(), sorted.end(), startedEarlier);
+
+    std::string report = "   start ms  duration ms  count  phase\n";
+    for (std::size_t i = 0; i < sorted.size(); ++i)
+    {
+        char line[64];
+        std::sprintf(line, "%11.1f  %11.1f  %5u  ",
+            (sorted[i].start - sorted[0].start) / 1000.0,
+            sorted[i].duration / 1000.0, sorted[i].count);
+        report += line;
+        report += sorted[i].name;
+        report += '\n';
+    }
+    if (finished)
+    {
+        char line[64];
+        std::sprintf(line, "%11.1f  %11.1f  %5u  Until first frame\n",
+            0.0, total / 1000.0, 1u);
+        report += line;
+    }
+    return report;
+}
+
+void Gosu::finishStartup()
+{
+    if (startupFinished)
+        return;
+    {
+        Lock lock(traceMutex());
+        if (startupFinished)
+            return;
+        std::tr1::uint64_t now = microseconds(), first = now;
+        for (std::size_t i = 0; i < phases.size(); ++i)
+            first = std::min(first, phases[i].start);
+        startupDuration = now - first;
+        startupFinished = true;
+    }
+
+    const char* print = std::getenv("GOSU_STARTUP_REPORT");
+    if (print && *print && std::strcmp(print, "0") != 0)
+        std::fputs(startupReport().c_str(), stderr);
+}
+
+Gosu::StartupScope::StartupScope(const char* name)
+: trace(name), name(startupFinished ? 0 : name),
+  start(startupFinished ? 0 : microseconds())
+{
+}
+
+Gosu::StartupScope::~StartupScope()
+{
+    if (name)
+        recordPhase(name, start, microseconds() - start);
+}
@@ -10,28 +10,135 @@
 
 #ifndef GOSU_IS_IPHONE
 
-#ifndef GOSU_IS_WIN
+#ifdef GOSU_IS_MAC
 #include <GosuImpl/Iconv.hpp>
 #endif
 using namespace std;
 
 #ifndef GOSU_IS_WIN
-namespace {
-    extern const char UTF_8[] = "UTF-8";
-#ifdef __BIG_ENDIAN__
-    extern const char UCS_4_INTERNAL[] = "UCS-4BE";
-#else
-    extern const char UCS_4_INTERNAL[] = "UCS-4LE";
-#endif
+namespace
+{
+    // Number of bytes that the UTF-8 sequence starting with the given byte
+    // has, or 0 if it cannot start one. Overlong and too large encodings
+    // are ruled out here where the first byte suffices.
+    unsigned sequenceLength(unsigned char lead)
+    {
+        if (lead < 0x80)
+            return 1;
+        if (lead < 0xc2)
+            return 0;
+        if (lead < 0xe0)
+            return 2;
+        if (lead < 0xf0)
+            return 3;
+        if (lead < 0xf5)
+            return 4;
+        return 0;
+    }
+    
+    bool isContinuation(unsigned char byte)
+    {
+        return (byte & 0xc0) == 0x80;
+    }
+    
+    // Bytes that encoding the character takes, or 0 if it is not one.
+    unsigned encodedLength(unsigned long c)
+    {
+        if (c < 0x80)
+            return 1;
+        if (c < 0x800)
+            return 2;
+        if (c >= 0xd800 && c < 0xe000)
+            return 0;
+        if (c < 0x10000)
+            return 3;
+        if (c < 0x110000)
+            return 4;
+        return 0;
+    }
 }
 
+// Hand-written instead of iconv, which needs a shared conversion state and
+// is called for every string that passes the Ruby bindings. Like Gosu used
+// to with iconv, invalid bytes and characters are skipped.
 wstring Gosu::utf8ToWstring(const string& s)
 {
-    return iconvert<wstring, UCS_4_INTERNAL, UTF_8>(s);
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(s.data());
+    size_t size = s.size();
+    
+    // Every character starts with a byte that is not a continuation byte.
+    size_t maxLength = 0;
+    for (size_t i = 0; i < size; ++i)
+        maxLength += !isContinuation(in[i]);
+    
+    wstring result(maxLength, 0);
+    size_t used = 0;
+    for (size_t i = 0; i < size; )
+    {
+        // Most text is ASCII, which is simply copied.
+        while (i < size && in[i] < 0x80)
+            result[used++] = in[i++];
+        if (i == size)
+            break;
+        
+        unsigned length = sequenceLength(in[i]);
+        if (length == 0 || length > size - i)
+        {
+            ++i;
+            continue;
+        }
+        
+        unsigned long c = in[i] & (0x7f >> length);
+        unsigned j = 1;
+        for (; j < length && isContinuation(in[i + j]); ++j)
+            c = c << 6 | (in[i + j] & 0x3f);
+        
+        if (j < length || encodedLength(c) != length)
+        {
+            ++i;
+            continue;
+        }
+        result[used++] = static_cast<wchar_t>(c);
+        i += length;
+    }
+    result.resize(used);
+    return result;
 }
+
 string Gosu::wstringToUTF8(const std::wstring& ws)
 {
-    return iconvert<string, UTF_8, UCS_4_INTERNAL>(ws);
+    size_t size = 0;
+    for (size_t i = 0; i < ws.size(); ++i)
+        size += encodedLength(static_cast<unsigned long>(ws[i]));
+    
+    string result(size, 0);
+    size_t pos = 0;
+    for (size_t i = 0; i < ws.size(); ++i)
+    {
+        unsigned long c = static_cast<unsigned long>(ws[i]);
+        switch (encodedLength(c))
+        {
+        case 1:
+            result[pos++] = static_cast<char>(c);
+            break;
+        case 2:
+            result[pos++] = static_cast<char>(0xc0 | c >> 6);
+            result[pos++] = static_cast<char>(0x80 | (c & 0x3f));
+            break;
+        case 3:
+            result[pos++] = static_cast<char>(0xe0 | c >> 12);
+            result[pos++] = static_cast<char>(0x80 | (c >> 6 & 0x3f));
+            result[pos++] = static_cast<char>(0x80 | (c & 0x3f));
+            break;
+        case 4:
+            result[pos++] = static_cast<char>(0xf0 | c >> 18);
+            result[pos++] = static_cast<char>(0x80 | (c >> 12 & 0x3f));
+            result[pos++] = static_cast<char>(0x80 | (c >> 6 & 0x3f));
+            result[pos++] = static_cast<char>(0x80 | (c & 0x3f));
+            break;
+        }
+    }
+    return result;
 }
 
 #ifdef GOSU_IS_MAC
@@ -40,6 +147,11 @@ string Gosu::wstringToUTF8(const std::wstring& ws)
 // from this file.
 
 namespace {
+#ifdef __BIG_ENDIAN__
+    extern const char UCS_4_INTERNAL[] = "UCS-4BE";
+#else
+    extern const char UCS_4_INTERNAL[] = "UCS-4LE";
+#endif
     extern const char MACROMAN[] = "MacRoman";
     extern const char UCS_2_INTERNAL[] = "UCS-2-INTERNAL";
 }
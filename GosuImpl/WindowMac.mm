@@ -4,8 +4,11 @@
 #include <Gosu/Input.hpp>
 #include <GosuImpl/MacUtility.hpp>
 #include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
 #include <Gosu/TR1.hpp>
 #include <Gosu/Utility.hpp>
+#include <GosuImpl/FramePacer.hpp>
+#include <GosuImpl/Graphics/FrameLimiter.hpp>
 #include <OpenGL/OpenGL.h>
 #include <OpenGL/gl.h>
 #include <memory>
@@ -20,7 +23,8 @@ namespace Gosu
 {
     namespace FPS
     {
-        void registerFrame();
+        void registerUpdate(unsigned long updateTime);
+        void registerFrame(unsigned long drawTime, unsigned long swapTime);
     }
     
     NSRect screenRect = [[[NSScreen screens] objectAtIndex: 0] frame];
@@ -197,6 +201,25 @@ struct Gosu::Window::Impl
     std::auto_ptr<Input> input;
     double interval;
     bool mouseViz;
+    FramePacer pacer;
+    FrameLimiter limiter;
+    bool fixedTimestep, lateInput;
+    // NSOpenGLCPSwapInterval knows no adaptive vsync.
+    GLint swapInterval;
+    // Only exists while the window is shown.
+    NSTimer* timer;
+    
+    void scheduleTimer()
+    {
+        [timer invalidate];
+        // With precise pacing or a fixed timestep, the timer only polls the
+        // pacer, which decides when to tick. Otherwise, it fires once per
+        // update.
+        NSTimeInterval seconds = pacer.isPrecise() || fixedTimestep ? 0.001 : interval / 1000.0;
+        timer = [NSTimer scheduledTimerWithTimeInterval: seconds
+                            target:forwarder.obj() selector:@selector(doTick:)
+                            userInfo:nil repeats:YES];
+    }
     
     void createWindow(unsigned width, unsigned height)
     {
@@ -222,6 +245,7 @@ Gosu::Window::Window(unsigned width, unsigned height, bool fullscreen,
                      double updateInterval)
 : pimpl(new Impl)
 {
+    GOSU_TRACE_STARTUP("Window construction");
     pimpl->pool.reset([[NSAutoreleasePool alloc] init]); // <- necessary...?
     
     // Create NSApp global variable
@@ -253,13 +277,16 @@ Gosu::Window::Window(unsigned width, unsigned height, bool fullscreen,
     NSOpenGLPixelFormatAttribute* attrs = fullscreen ? fullscreenAttrs : windowedAttrs;
     
     // Create pixel format and OpenGL context
-    ObjRef<NSOpenGLPixelFormat> fmt([[NSOpenGLPixelFormat alloc] initWithAttributes:attrs]);
-    if (not fmt.get())
-        throw std::runtime_error("Could not find a suitable OpenGL pixel format");
-    ::context = [[NSOpenGLContext alloc] initWithFormat: fmt.obj() shareContext:nil];
-    pimpl->context.reset(context);
-    if (not pimpl->context.get())
-        throw std::runtime_error("Unable to create an OpenGL context with the supplied pixel format");
+    {
+        GOSU_TRACE_STARTUP("GL context setup");
+        ObjRef<NSOpenGLPixelFormat> fmt([[NSOpenGLPixelFormat alloc] initWithAttributes:attrs]);
+        if (not fmt.get())
+            throw std::runtime_error("Could not find a suitable OpenGL pixel format");
+        ::context = [[NSOpenGLContext alloc] initWithFormat: fmt.obj() shareContext:nil];
+        pimpl->context.reset(context);
+        if (not pimpl->context.get())
+            throw std::runtime_error("Unable to create an OpenGL context with the supplied pixel format");
+    }
     
     unsigned realWidth = width, realHeight = height;
     
@@ -324,6 +351,11 @@ Gosu::Window::Window(unsigned width, unsigned height, bool fullscreen,
     
     pimpl->interval = updateInterval;
     pimpl->mouseViz = true;
+    pimpl->pacer.setInterval(updateInterval);
+    pimpl->fixedTimestep = false;
+    pimpl->lateInput = false;
+    pimpl->swapInterval = 1;
+    pimpl->timer = nil;
     
     // Clear gl error flag if it should accidentally be set. (Huh?)
     while (glGetError() != GL_NO_ERROR);
@@ -366,6 +398,58 @@ double Gosu::Window::updateInterval() const
     return pimpl->interval;
 }
 
+void Gosu::Window::setPrecisePacing(bool precisePacing)
+{
+    pimpl->pacer.setPrecise(precisePacing);
+    if (pimpl->timer)
+        pimpl->scheduleTimer();
+}
+
+void Gosu::Window::setFixedTimestep(bool fixedTimestep)
+{
+    if (fixedTimestep && !pimpl->fixedTimestep)
+        pimpl->pacer.restartSteps();
+    pimpl->fixedTimestep = fixedTimestep;
+    if (pimpl->timer)
+        pimpl->scheduleTimer();
+}
+
+void Gosu::Window::setPipelinedRendering(bool pipelinedRendering)
+{
+}
+
+void Gosu::Window::setVSync(VSyncMode mode)
+{
+    pimpl->swapInterval = mode == vsOff ? 0 : 1;
+}
+
+void Gosu::Window::setMaxFramesInFlight(unsigned frames)
+{
+    pimpl->limiter.setFrames(frames);
+}
+
+void Gosu::Window::setIdleMode(bool idleMode)
+{
+}
+
+void Gosu::Window::setLateInputSampling(bool lateInputSampling)
+{
+    pimpl->lateInput = lateInputSampling;
+}
+
+void Gosu::Window::wakeUp()
+{
+}
+
+void Gosu::Window::wakeUpAfter(unsigned long milliseconds)
+{
+}
+
+double Gosu::Window::interpolation() const
+{
+    return pimpl->fixedTimestep ? pimpl->pacer.stepAlpha() : 0;
+}
+
 void Gosu::Window::show()
 {
 	// This is for Ruby/Gosu and misc. hackery:
@@ -390,11 +474,10 @@ void Gosu::Window::show()
     else
         [pimpl->window.obj() makeKeyAndOrderFront:nil];
 
-    NSTimer* timer = [NSTimer scheduledTimerWithTimeInterval: pimpl->interval / 1000.0
-                            target:pimpl->forwarder.obj() selector:@selector(doTick:)
-                            userInfo:nil repeats:YES];
+    pimpl->scheduleTimer();
     [NSApp run];
-    [timer invalidate];
+    [pimpl->timer invalidate];
+    pimpl->timer = nil;
     
     if (graphics().fullscreen())
     {
@@ -503,9 +586,16 @@ namespace GosusDarkSide
 
 void Gosu::Window::Impl::doTick(Window& window)
 {
-    // Enable vsync.
-    GLint value = 1;
-    [window.pimpl->context.obj() setValues: &value forParameter: NSOpenGLCPSwapInterval];
+    // With a fixed timestep, every tick draws a frame, which flushBuffer
+    // keeps in sync with the screen's refresh unless vsync is off.
+    unsigned updates = 1;
+    if (window.pimpl->fixedTimestep)
+        updates = window.pimpl->pacer.stepsDue();
+    else if (window.pimpl->pacer.isPrecise() && !window.pimpl->pacer.due())
+        return;
+    
+    [window.pimpl->context.obj() setValues: &window.pimpl->swapInterval
+        forParameter: NSOpenGLCPSwapInterval];
     
     if ((window.graphics().fullscreen() ||
         NSPointInRect([window.pimpl->window.obj() mouseLocationOutsideOfEventStream],
@@ -523,16 +613,40 @@ void Gosu::Window::Impl::doTick(Window& window)
         window.pimpl->mouseViz = true;
     }
     
-    Gosu::Song::update();
-    window.input().update();
-    window.update();
+    window.pimpl->limiter.wait();
+    for (unsigned i = 0; i < updates; ++i)
+    {
+        std::tr1::uint64_t updateStart = microseconds();
+        Gosu::Song::update();
+        window.input().update();
+        {
+            GOSU_TRACE("Window::update");
+            window.update();
+        }
+        FPS::registerUpdate(microseconds() - updateStart);
+    }
 
-    if (window.needsRedraw() and window.graphics().begin())
+    // Events are only delivered between ticks, but the mouse position
+    // and gamepads can still be sampled once more.
+    bool redraw = window.needsRedraw();
+    if (redraw && window.pimpl->lateInput)
+        window.input().update();
+    
+    if (redraw and window.graphics().begin())
     {
-        FPS::registerFrame();
-        window.draw();
+        std::tr1::uint64_t drawStart = microseconds();
+        {
+            GOSU_TRACE("Window::draw");
+            window.draw();
+        }
         window.graphics().end();
-        [window.pimpl->context.obj() flushBuffer];
+        std::tr1::uint64_t swapStart = microseconds();
+        {
+            GOSU_TRACE("Swap buffers");
+            [window.pimpl->context.obj() flushBuffer];
+        }
+        window.pimpl->limiter.frameSwapped();
+        FPS::registerFrame(swapStart - drawStart, microseconds() - swapStart);
     }
     
     if (GosusDarkSide::oncePerTick) GosusDarkSide::oncePerTick();
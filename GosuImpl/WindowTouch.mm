@@ -2,6 +2,7 @@
 #include <Gosu/Graphics.hpp>
 #include <Gosu/Audio.hpp>
 #include <Gosu/Input.hpp>
+#include <Gosu/Timing.hpp>
 #include <GosuImpl/MacUtility.hpp>   
 #include <GosuImpl/Graphics/GosuView.hpp>
 
@@ -13,6 +14,11 @@ using namespace std::tr1::placeholders;
 
 namespace Gosu
 {
+    namespace FPS
+    {
+        void registerUpdate(unsigned long updateTime);
+    }
+    
     static CGRect &screenRect()
     {
         static CGRect screenRect = [[UIScreen mainScreen] bounds];
@@ -115,11 +121,15 @@ namespace
 }
 
 - (void)doTick:(NSTimer*)timer {
+    std::tr1::uint64_t updateStart = Gosu::microseconds();
     if (!paused)
         windowInstance().update();
+    Gosu::FPS::registerUpdate(Gosu::microseconds() - updateStart);
     [gosuView drawView];
+    updateStart = Gosu::microseconds();
     Gosu::Song::update();
     windowInstance().input().update();
+    Gosu::FPS::registerUpdate(Gosu::microseconds() - updateStart);
 }
 @end
 
@@ -162,6 +172,50 @@ double Gosu::Window::updateInterval() const
     return pimpl->interval;
 }
 
+void Gosu::Window::setPrecisePacing(bool precisePacing)
+{
+    // The timer on iOS is already as exact as it gets.
+}
+
+void Gosu::Window::setFixedTimestep(bool fixedTimestep)
+{
+    // Not supported yet; update and draw are driven by the same timer.
+}
+
+void Gosu::Window::setVSync(VSyncMode mode)
+{
+    // iOS always waits for the screen's refresh.
+}
+
+void Gosu::Window::setMaxFramesInFlight(unsigned frames)
+{
+}
+
+void Gosu::Window::setPipelinedRendering(bool pipelinedRendering)
+{
+}
+
+void Gosu::Window::setIdleMode(bool idleMode)
+{
+}
+
+void Gosu::Window::setLateInputSampling(bool lateInputSampling)
+{
+}
+
+void Gosu::Window::wakeUp()
+{
+}
+
+void Gosu::Window::wakeUpAfter(unsigned long milliseconds)
+{
+}
+
+double Gosu::Window::interpolation() const
+{
+    return 0;
+}
+
 const Gosu::Graphics& Gosu::Window::graphics() const
 {
     return *pimpl->graphics;
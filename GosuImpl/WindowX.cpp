@@ -1,463 +1,946 @@
-// While (re)writing this file, I have been looking at many other libraries since all the
-// "official" documentation was horrible, at least those parts that I was able to find.
-// Kudos to the Pyglet folks (http://www.pyglet.org/) who wrote code that was much easier to
-// understand than that! --jlnr
-
-#include <Gosu/Window.hpp>
-#include <Gosu/Audio.hpp>
-#include <Gosu/Input.hpp>
-#include <Gosu/Graphics.hpp>
-#include <Gosu/Timing.hpp>
-#include <Gosu/TR1.hpp>
-#include <Gosu/Utility.hpp>
-#include <cstdio>
-#include <algorithm>
-#include <memory>
-#include <sstream>
-#include <stdexcept>
-#include <vector>
-
-#include <GL/glx.h>
-#include <X11/Xlib.h>
-#include <X11/Xutil.h>
-#include "X11vroot.h"
-
-#include <X11/extensions/Xinerama.h>
-
-using namespace std::tr1::placeholders;
-
-namespace Gosu
-{
-    namespace FPS
-    {
-        void registerFrame();
-    }
-
-    void screenMetrics(int *x_org, int *y_org, int *width, int *height){
-        // Open the X Display; passing NULL returns the default display.
-        Display* display = XOpenDisplay(NULL);
-        
-        // Raw screen information from the X server.
-        Screen* screen = XScreenOfDisplay(display, DefaultScreen(display));
-        
-        // Xinerama screen information; if available, this info is more accurate.
-        // This is especially important for multi-monitor configurations.
-        int screen_count = 0;
-        XineramaScreenInfo *screen_info = XineramaQueryScreens(display, &screen_count);
-    
-        // If screen_info is not NULL, we got preferred measurements from Xinerama,
-        // otherwise we use the measurements from the X server.
-        if(screen_info != NULL){
-            // screen_info is an array of length screen_count
-            // Index zero should hold the "default" or "primary"
-            // screen as configured by the user.
-            *x_org = screen_info[0].x_org;
-            *y_org = screen_info[0].y_org;
-            *width = screen_info[0].width;
-            *height = screen_info[0].height;
-        }else{
-            // screen is a reference to the default X Server screen
-            // Since we know Xinerama isn't running, this screen
-            // should correspond to exactly one physical display.
-            *x_org = 0;
-            *y_org = 0;
-            *width = screen->width;
-            *height = screen->height;
-        }
-    
-        // Release the Xinerama screen info, if we have it.
-        if(screen_info != NULL){
-            XFree(screen_info);
-        }
-        
-        // Release the connection to the X Display
-        XCloseDisplay(display);
-        
-        return;
-    }
-
-    unsigned screenWidth()
-    {
-        int x_org, y_org, width, height;
-        screenMetrics(&x_org, &y_org, &width, &height);
-        return width;
-    }
-    
-    unsigned screenHeight()
-    {
-        int x_org, y_org, width, height;
-        screenMetrics(&x_org, &y_org, &width, &height);
-        return height;
-    }
-}
-
-struct Gosu::Window::Impl
-{
-    std::auto_ptr<Graphics> graphics;
-    std::auto_ptr<Input> input;
-
-    ::Display* display;
-    
-    bool mapped, showing, active;
-    
-    Cursor emptyCursor;
-    bool showingCursor;
-    
-    ::GLXContext context;
-    ::Window window;
-    ::XVisualInfo* visual;
-    
-    // Last set title
-    std::wstring title;
-    // Last known position
-    int x, y;
-    // Last known size
-    int width, height;
-
-    double updateInterval;
-    bool fullscreen;
-
-    Impl(unsigned width, unsigned height, unsigned fullscreen, double updateInterval)
-    :   mapped(false), showing(false), active(true),
-        x(0), y(0), width(width), height(height),
-        updateInterval(updateInterval), fullscreen(fullscreen)
-    {
-        
-    }
-    
-    void executeAndWait(std::tr1::function<void(Display*, ::Window)> function, int forMessage)
-    {
-        XSelectInput(display, window, StructureNotifyMask);
-        function(display, window);
-        while (true)
-        {
-            ::XEvent event;
-            XNextEvent(display, &event);
-            if (event.type == forMessage)
-                break;
-        }
-        XSelectInput(display, window, 0x1ffffff & ~PointerMotionHintMask & ~ResizeRedirectMask);
-    }
-
-    void doTick(Window* window)
-    {
-        for (int i = XPending(display); i > 0; --i)
-        {
-            XEvent event;
-            XNextEvent(display, &event);
-
-            // Override redirect fix (thanks go to the Pyglet folks again):
-            if (event.type == ButtonPress && fullscreen && !active)
-                XSetInputFocus(display, this->window, RevertToParent, CurrentTime);
-            
-            if (!window->input().feedXEvent(event))
-            {
-                if (event.type == ConfigureNotify)
-                {
-                    // Only boring stuff to do? Let's do something random:
-                    glXMakeCurrent(display, this->window, context);
-                }
-                else if (event.type == ClientMessage)
-                {
-                    if (static_cast<unsigned>(event.xclient.data.l[0]) ==
-                            XInternAtom(display, "WM_DELETE_WINDOW", false))
-                        window->close();
-                }
-                else if (event.type == FocusIn)
-                    active = true;
-                else if (event.type == FocusOut)
-                    active = false;
-            }
-            if (event.type == Expose && event.xexpose.count == 0 &&
-                        window->graphics().begin(Colors::black)) {
-                FPS::registerFrame();
-                window->draw();
-                window->graphics().end();
-                glXSwapBuffers(display, this->window);
-            }
-        }
-        
-        if (showingCursor && !window->needsCursor())
-        {
-            XDefineCursor(display, this->window, emptyCursor);
-            showingCursor = false;
-        }
-        else if (!showingCursor && window->needsCursor())
-        {
-            XUndefineCursor(display, this->window);
-            showingCursor = true;
-        }
-        
-        Song::update();
-        window->input().update();
-        window->update();
-
-        if (window->needsRedraw() && window->graphics().begin(Colors::black))
-        {
-            FPS::registerFrame();
-            window->draw();
-            window->graphics().end();
-            glXSwapBuffers(display, this->window);
-        }
-    }
-};
-
-Gosu::Window::Window(unsigned width, unsigned height, bool fullscreen,
-        double updateInterval)
-:   pimpl(new Impl(width, height, fullscreen, updateInterval))
-{
-    pimpl->display = XOpenDisplay(NULL);
-    if (!pimpl->display)
-        throw std::runtime_error("Cannot find display");
-    
-    ::Window root = DefaultRootWindow(pimpl->display);
-
-    // Setup GLX visual
-    static int glxAttributes[] =
-    {
-        GLX_RGBA,
-        GLX_DOUBLEBUFFER,
-        GLX_RED_SIZE, 1,
-        GLX_GREEN_SIZE, 1,
-        GLX_BLUE_SIZE, 1,
-        GLX_DEPTH_SIZE, 1,
-        None
-    };
-    pimpl->visual = glXChooseVisual(pimpl->display, DefaultScreen(pimpl->display), glxAttributes);
-
-    // Create GLX context    
-    pimpl->context = glXCreateContext(pimpl->display, pimpl->visual, 0, GL_TRUE);
-
-    // Set up window attributes (& mask)
-    XSetWindowAttributes windowAttributes;
-    windowAttributes.colormap = XCreateColormap(pimpl->display, root, pimpl->visual->visual, AllocNone);
-    windowAttributes.bit_gravity = NorthWestGravity;
-    windowAttributes.background_pixel = 0;
-    unsigned mask = CWColormap | CWBitGravity | CWBackPixel;
-
-    // Create window
-    pimpl->window = XCreateWindow(pimpl->display, root, 0, 0, width, height, 0,
-        pimpl->visual->depth, InputOutput, pimpl->visual->visual,
-        mask, &windowAttributes);    
-
-    // Request a close button for the window
-    Atom atoms[] = { XInternAtom(pimpl->display, "WM_DELETE_WINDOW", false) };
-    XSetWMProtocols(pimpl->display, pimpl->window, atoms, 1);
-
-
-    // Get reference to X Screen
-    Screen* screen = XScreenOfDisplay(pimpl->display,
-                     DefaultScreen(pimpl->display));
-
-    if (fullscreen){
-        // If we're going fullscreen, replace the window
-        // position and size with our screen metrics.
-        int screen_x_org, screen_y_org, screen_width, screen_height;
-        Gosu::screenMetrics(&screen_x_org, &screen_y_org, &screen_width, &screen_height);
-        pimpl->width = screen_width;
-        pimpl->height = screen_height;
-        pimpl->x = screen_x_org;
-        pimpl->y = screen_y_org;
-
-        // Override Redirect (JohnColburn says: I don't actually know what this is for.)
-        XSetWindowAttributes windowAttributes;
-        windowAttributes.override_redirect = true;
-        unsigned mask = CWOverrideRedirect;
-        XChangeWindowAttributes(pimpl->display, pimpl->window, mask, &windowAttributes);
-    }
-    
-    // Move and resize the window to its current position and size.
-    XMoveResizeWindow(pimpl->display, pimpl->window, pimpl->x, pimpl->y, pimpl->width, pimpl->height);
-
-    // Set window to be non-resizable
-    XSizeHints *sizeHints = XAllocSizeHints();
-    sizeHints->flags = PMinSize | PMaxSize;
-    sizeHints->min_width = sizeHints->max_width = pimpl->width;
-    sizeHints->min_height = sizeHints->max_height = pimpl->height;
-    XSetWMNormalHints(pimpl->display, pimpl->window, sizeHints);
-    XFree(sizeHints);
-
-    // TODO: Window style (_MOTIF_WM_HINTS)?        
-
-    XColor black, dummy;
-    XAllocNamedColor(pimpl->display, screen->cmap, "black", &black, &dummy);    
-    char emptyData[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
-    Pixmap emptyBitmap =
-        XCreateBitmapFromData(pimpl->display, pimpl->window, emptyData, 8, 8);
-    pimpl->emptyCursor = XCreatePixmapCursor(pimpl->display, emptyBitmap,
-        emptyBitmap, &black, &black, 0, 0);
-    pimpl->showingCursor = true; // Empty cursor not yet installed
-
-    // Must be current already so that Graphics' constructor can set up things
-    glXMakeCurrent(pimpl->display, pimpl->window, pimpl->context);
-
-    // Now set up major Gosu components
-    pimpl->graphics.reset(new Graphics(pimpl->width, pimpl->height, fullscreen));
-    pimpl->input.reset(new Input(pimpl->display, pimpl->window));    
-    input().onButtonDown = std::tr1::bind(&Window::buttonDown, this, _1);
-    input().onButtonUp = std::tr1::bind(&Window::buttonUp, this, _1);
-    
-    // Fix coordinates for fullscreen screen-scaling
-    if (fullscreen)
-    {
-        graphics().setResolution(width, height);
-        input().setMouseFactors(1.0 * width / pimpl->width,
-                  1.0 * height / pimpl->height);
-    }
-}
-
-Gosu::Window::~Window()
-{
-    XFreeCursor(pimpl->display, pimpl->emptyCursor);
-    XDestroyWindow(pimpl->display, pimpl->window);
-    XSync(pimpl->display, false);
-}
-
-std::wstring Gosu::Window::caption() const
-{
-    return pimpl->title;
-}
-
-double Gosu::Window::updateInterval() const
-{
-    return pimpl->updateInterval;
-}
-
-void Gosu::Window::setCaption(const std::wstring& caption)
-{
-    // TODO: Update to _NET_WM_NAME to support Unicode
-
-    pimpl->title = caption;
-
-    std::string tmpString(pimpl->title.begin(), pimpl->title.end());
-    std::vector<char> title(pimpl->title.size() + 1);
-    std::copy(tmpString.begin(), tmpString.end(), title.begin());
-    title.back() = 0;
-
-    XTextProperty titleprop;
-    char* titlePtr = &title[0];
-    XStringListToTextProperty(&titlePtr, 1, &titleprop);
-
-    XSetWMName(pimpl->display, pimpl->window, &titleprop);
-    XFree(titleprop.value);
-    XSync(pimpl->display, false);
-}
-
-namespace GosusDarkSide
-{
-    // TODO: Find a way for this to fit into Gosu's design.
-    // This can point to a function that wants to be called every
-    // frame, e.g. rb_thread_schedule.
-    typedef void (*HookOfHorror)();
-    HookOfHorror oncePerTick = 0;
-}
-
-// TODO: Some exception safety
-
-void Gosu::Window::show()
-{
-    // Map window
-    pimpl->executeAndWait(XMapRaised, MapNotify);
-    pimpl->mapped = true;
-    
-    // Make glx current
-    glXMakeCurrent(pimpl->display, pimpl->window, pimpl->context);
-    
-    if (pimpl->fullscreen){
-        XSetInputFocus(pimpl->display, pimpl->window, RevertToParent, CurrentTime);
-        XGrabPointer(pimpl->display, pimpl->window, true, 0, GrabModeAsync, GrabModeAsync, pimpl->window, None, CurrentTime);
-    }
-    
-    setCaption(pimpl->title);
-
-    unsigned startTime, endTime;
-
-    pimpl->showing = true;
-    while (pimpl->showing)
-    {
-        startTime = milliseconds();
-        pimpl->doTick(this);
-        if (GosusDarkSide::oncePerTick) GosusDarkSide::oncePerTick();
-        endTime = milliseconds();
-
-        if (startTime <= endTime && (endTime - startTime) < pimpl->updateInterval)
-            sleep(pimpl->updateInterval - (endTime - startTime));
-    }
-
-    glXMakeCurrent(pimpl->display, 0, 0);
-    pimpl->executeAndWait(XUnmapWindow, UnmapNotify);
-    pimpl->mapped = false;
-}
-
-void Gosu::Window::close()
-{
-    pimpl->showing = false;
-}
-
-void Gosu::Window::panic(const std::exception& e)
-{
-    throw e;
-}
-
-const Gosu::Graphics& Gosu::Window::graphics() const
-{
-    return *pimpl->graphics;
-}
-
-Gosu::Graphics& Gosu::Window::graphics()
-{
-    return *pimpl->graphics;
-}
-
-const Gosu::Input& Gosu::Window::input() const
-{
-    return *pimpl->input;
-}
-
-Gosu::Input& Gosu::Window::input()
-{
-    return *pimpl->input;
-}
-
-namespace
-{
-    void makeCurrentContext(Display* dpy, GLXDrawable drawable, GLXContext context) {
-        if (!glXMakeCurrent(dpy, drawable, context))
-            std::printf("glXMakeCurrent failed\n");
-    }
-
-    void releaseContext(Display* dpy, GLXContext context) {
-        glXDestroyContext(dpy, context);
-    }
-}
-
-Gosu::Window::SharedContext Gosu::Window::createSharedContext() {
-    const char* displayName = DisplayString( pimpl->display );
-    Display* dpy2 = XOpenDisplay( displayName );
-    if (!dpy2)
-        throw std::runtime_error("Could not duplicate X display");
-    
-    GLXContext ctx = glXCreateContext(dpy2, pimpl->visual, pimpl->context, True);
-    if (!ctx)
-        throw std::runtime_error("Could not create shared GLX context");
-    
-    return SharedContext(
-        new std::tr1::function<void()>(std::tr1::bind(makeCurrentContext, dpy2, pimpl->window, ctx)),
-            std::tr1::bind(releaseContext, dpy2, ctx));
-}
-
-// Deprecated.
-
-class Gosu::Audio {};
-namespace { Gosu::Audio dummyAudio; }
-
-const Gosu::Audio& Gosu::Window::audio() const
-{
-    return dummyAudio;
-}
- 
-Gosu::Audio& Gosu::Window::audio()
-{
-    return dummyAudio;
-}
-
+// While (re)writing this file, I have been looking at many other libraries since all the
+// "official" documentation was horrible, at least those parts that I was able to find.
+// Kudos to the Pyglet folks (http://www.pyglet.org/) who wrote code that was much easier to
+// understand than that! --jlnr
+
+#include <Gosu/Window.hpp>
+#include <Gosu/Audio.hpp>
+#include <Gosu/Input.hpp>
+#include <Gosu/Graphics.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/Trace.hpp>
+#include <Gosu/TR1.hpp>
+#include <Gosu/Utility.hpp>
+#include <GosuImpl/FramePacer.hpp>
+#include <GosuImpl/Graphics/FrameLimiter.hpp>
+#include <GosuImpl/Graphics/GLExtensions.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <GL/glx.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include "X11vroot.h"
+
+#include <X11/extensions/Xinerama.h>
+
+#ifdef HAVE_EGL_EGL_H
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+using namespace std::tr1::placeholders;
+
+namespace Gosu
+{
+    namespace FPS
+    {
+        void registerUpdate(unsigned long updateTime);
+        void registerFrame(unsigned long drawTime, unsigned long swapTime);
+    }
+
+    void screenMetrics(int *x_org, int *y_org, int *width, int *height){
+        // Open the X Display; passing NULL returns the default display.
+        Display* display = XOpenDisplay(NULL);
+        
+        // Raw screen information from the X server.
+        Screen* screen = XScreenOfDisplay(display, DefaultScreen(display));
+        
+        // Xinerama screen information; if available, this info is more accurate.
+        // This is especially important for multi-monitor configurations.
+        int screen_count = 0;
+        XineramaScreenInfo *screen_info = XineramaQueryScreens(display, &screen_count);
+    
+        // If screen_info is not NULL, we got preferred measurements from Xinerama,
+        // otherwise we use the measurements from the X server.
+        if(screen_info != NULL){
+            // screen_info is an array of length screen_count
+            // Index zero should hold the "default" or "primary"
+            // screen as configured by the user.
+            *x_org = screen_info[0].x_org;
+            *y_org = screen_info[0].y_org;
+            *width = screen_info[0].width;
+            *height = screen_info[0].height;
+        }else{
+            // screen is a reference to the default X Server screen
+            // Since we know Xinerama isn't running, this screen
+            // should correspond to exactly one physical display.
+            *x_org = 0;
+            *y_org = 0;
+            *width = screen->width;
+            *height = screen->height;
+        }
+    
+        // Release the Xinerama screen info, if we have it.
+        if(screen_info != NULL){
+            XFree(screen_info);
+        }
+        
+        // Release the connection to the X Display
+        XCloseDisplay(display);
+        
+        return;
+    }
+
+    unsigned screenWidth()
+    {
+        int x_org, y_org, width, height;
+        screenMetrics(&x_org, &y_org, &width, &height);
+        return width;
+    }
+    
+    unsigned screenHeight()
+    {
+        int x_org, y_org, width, height;
+        screenMetrics(&x_org, &y_org, &width, &height);
+        return height;
+    }
+}
+
+namespace
+{
+    // Swap interval that leaves vsync to the driver.
+    const int DRIVER_INTERVAL = -2;
+    
+    // Sets how many refreshes swapping buffers in the current context waits
+    // for. -1 is adaptive vsync, which falls back to 1 without
+    // GLX_EXT_swap_control_tear. Only GLX_EXT_swap_control and
+    // GLX_MESA_swap_control can turn vsync off; GLX_SGI_swap_control is the
+    // last resort.
+    void setSwapInterval(Display* dpy, ::Window drawable, int interval)
+    {
+        const char* extensions = glXQueryExtensionsString(dpy, DefaultScreen(dpy));
+        if (interval < 0 && !Gosu::hasExtension(extensions, "GLX_EXT_swap_control_tear"))
+            interval = 1;
+        
+        typedef void (*SwapIntervalEXT)(Display* dpy, GLXDrawable drawable, int interval);
+        typedef int (*SwapInterval)(int interval);
+        if (Gosu::hasExtension(extensions, "GLX_EXT_swap_control"))
+        {
+            if (SwapIntervalEXT swapInterval = reinterpret_cast<SwapIntervalEXT>(
+                    glXGetProcAddressARB(reinterpret_cast<const GLubyte*>("glXSwapIntervalEXT"))))
+            {
+                swapInterval(dpy, drawable, interval);
+                return;
+            }
+        }
+        if (interval < 0)
+            interval = 1;
+        const char* fallback = interval == 0 ? "glXSwapIntervalMESA" : "glXSwapIntervalSGI";
+        if (SwapInterval swapInterval = reinterpret_cast<SwapInterval>(
+                glXGetProcAddressARB(reinterpret_cast<const GLubyte*>(fallback))))
+            swapInterval(interval);
+    }
+    
+    void closeRenderContext(Display* dpy, GLXContext context)
+    {
+        glXMakeCurrent(dpy, None, 0);
+        glXDestroyContext(dpy, context);
+        XCloseDisplay(dpy);
+    }
+    
+    #ifdef HAVE_EGL_EGL_H
+    // Headless rendering needs no X server: Mesa's surfaceless platform
+    // renders into pbuffers on the GPU or in software.
+    EGLDisplay headlessDisplay()
+    {
+        #ifdef EGL_PLATFORM_SURFACELESS_MESA
+        typedef EGLDisplay (*GetPlatformDisplay)(EGLenum platform, void* nativeDisplay,
+            const EGLint* attributes);
+        GetPlatformDisplay getPlatformDisplay = reinterpret_cast<GetPlatformDisplay>(
+            eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (getPlatformDisplay)
+        {
+            EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                EGL_DEFAULT_DISPLAY, 0);
+            if (display != EGL_NO_DISPLAY && eglInitialize(display, 0, 0))
+                return display;
+        }
+        #endif
+        EGLDisplay display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, 0, 0))
+            throw std::runtime_error("Cannot initialize EGL for headless rendering");
+        return display;
+    }
+    
+    void makeCurrentEGLContext(EGLDisplay display, EGLSurface surface, EGLContext context)
+    {
+        if (!eglMakeCurrent(display, surface, surface, context))
+            std::printf("eglMakeCurrent failed\n");
+    }
+    
+    void releaseEGLContext(EGLDisplay display, EGLSurface surface, EGLContext context)
+    {
+        eglDestroyContext(display, context);
+        eglDestroySurface(display, surface);
+    }
+    #endif
+}
+
+struct Gosu::Window::Impl
+{
+    std::auto_ptr<Graphics> graphics;
+    std::auto_ptr<Input> input;
+
+    ::Display* display;
+    
+    bool mapped, showing, active;
+    
+    Cursor emptyCursor;
+    bool showingCursor;
+    
+    ::GLXContext context;
+    ::Window window;
+    ::XVisualInfo* visual;
+    
+    // Last set title
+    std::wstring title;
+    // Last known position
+    int x, y;
+    // Last known size
+    int width, height;
+
+    double updateInterval;
+    bool fullscreen;
+    FramePacer pacer;
+    FrameLimiter limiter;
+    bool fixedTimestep;
+    VSyncMode vsyncMode;
+    // The swap intervals that the main and render thread's contexts have
+    // been set up with.
+    int swapInterval, renderSwapInterval;
+    bool pipelined;
+    // wakeUp() writes into the pipe to interrupt waiting in idle mode.
+    bool idle;
+    int wakeUpPipe[2];
+    // In microseconds, 0 if not set.
+    std::tr1::uint64_t wakeUpTime;
+    bool lateInput;
+    
+    // Set by GOSU_HEADLESS, see Window.hpp. There is no X connection then.
+    bool headless;
+    // Frames that show() still draws in headless mode, 0 for no limit.
+    unsigned long framesLeft;
+    #ifdef HAVE_EGL_EGL_H
+    EGLDisplay eglDisplay;
+    EGLConfig eglConfig;
+    EGLSurface eglSurface;
+    EGLContext eglContext;
+    #endif
+
+    Impl(unsigned width, unsigned height, unsigned fullscreen, double updateInterval)
+    :   mapped(false), showing(false), active(true),
+        x(0), y(0), width(width), height(height),
+        updateInterval(updateInterval), fullscreen(fullscreen),
+        fixedTimestep(false), vsyncMode(vsDefault),
+        swapInterval(DRIVER_INTERVAL), renderSwapInterval(DRIVER_INTERVAL), pipelined(false),
+        idle(false), wakeUpTime(0), lateInput(false), headless(false), framesLeft(0)
+    {
+        pacer.setInterval(updateInterval);
+    }
+    
+    // Creates an offscreen context with a pbuffer of the window's size and
+    // makes it current.
+    void createHeadlessContext()
+    {
+        GOSU_TRACE_STARTUP("GL context setup");
+        #ifdef HAVE_EGL_EGL_H
+        eglDisplay = headlessDisplay();
+        static const EGLint configAttributes[] =
+        {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_ALPHA_SIZE, 8,
+            // For Graphics::markOpaque.
+            EGL_DEPTH_SIZE, 24,
+            EGL_NONE
+        };
+        EGLint configs;
+        if (!eglChooseConfig(eglDisplay, configAttributes, &eglConfig, 1, &configs) || configs == 0)
+            throw std::runtime_error("No EGL configuration for headless rendering");
+        
+        eglSurface = createPbuffer(width, height);
+        eglBindAPI(EGL_OPENGL_API);
+        eglContext = eglCreateContext(eglDisplay, eglConfig, EGL_NO_CONTEXT, 0);
+        if (eglContext == EGL_NO_CONTEXT)
+            throw std::runtime_error("Could not create EGL context");
+        eglMakeCurrent(eglDisplay, eglSurface, eglSurface, eglContext);
+        #else
+        throw std::runtime_error("Gosu was built without EGL, so it cannot render headless");
+        #endif
+    }
+    
+    #ifdef HAVE_EGL_EGL_H
+    EGLSurface createPbuffer(EGLint width, EGLint height)
+    {
+        EGLint attributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        EGLSurface surface = eglCreatePbufferSurface(eglDisplay, eglConfig, attributes);
+        if (surface == EGL_NO_SURFACE)
+            throw std::runtime_error("Could not create EGL pbuffer");
+        return surface;
+    }
+    #endif
+    
+    void destroyHeadlessContext()
+    {
+        #ifdef HAVE_EGL_EGL_H
+        eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(eglDisplay, eglContext);
+        eglDestroySurface(eglDisplay, eglSurface);
+        eglTerminate(eglDisplay);
+        #endif
+    }
+    
+    void executeAndWait(std::tr1::function<void(Display*, ::Window)> function, int forMessage)
+    {
+        XSelectInput(display, window, StructureNotifyMask);
+        function(display, window);
+        while (true)
+        {
+            ::XEvent event;
+            XNextEvent(display, &event);
+            if (event.type == forMessage)
+                break;
+        }
+        XSelectInput(display, window, 0x1ffffff & ~PointerMotionHintMask & ~ResizeRedirectMask);
+    }
+    
+    // Graphics::begin must have succeeded.
+    void drawFrame(Window* window)
+    {
+        std::tr1::uint64_t start = microseconds();
+        {
+            GOSU_TRACE("Window::draw");
+            window->draw();
+        }
+        window->graphics().end();
+        std::tr1::uint64_t drawn = microseconds();
+        if (headless)
+        {
+            // Waiting for the GPU makes the frame time include its work.
+            GOSU_TRACE("Swap buffers");
+            glFinish();
+        }
+        else if (!window->graphics().rendersOnThread())
+        {
+            GOSU_TRACE("Swap buffers");
+            glXSwapBuffers(display, this->window);
+            limiter.frameSwapped();
+        }
+        FPS::registerFrame(drawn - start, microseconds() - drawn);
+    }
+
+    // Called before each tick. Drawing as often as possible with a fixed
+    // timestep only makes sense if swapping waits for the screen's refresh,
+    // unless vsync was turned off explicitly.
+    void updateSwapInterval()
+    {
+        int interval = swapInterval;
+        switch (vsyncMode)
+        {
+        case vsOff: interval = 0; break;
+        case vsOn: interval = 1; break;
+        case vsAdaptive: interval = -1; break;
+        default:
+            if (fixedTimestep)
+                interval = 1;
+        }
+        if (interval == swapInterval)
+            return;
+        setSwapInterval(display, window, interval);
+        swapInterval = interval;
+    }
+    
+    // Pipelined rendering uses a second connection to the display, since
+    // Xlib connections must not be used by two threads at once.
+    void startRenderThread(Window* window)
+    {
+        Display* renderDisplay = XOpenDisplay(DisplayString(display));
+        if (!renderDisplay)
+            throw std::runtime_error("Could not duplicate X display");
+        GLXContext renderContext = glXCreateContext(renderDisplay, visual, context, True);
+        if (!renderContext)
+        {
+            XCloseDisplay(renderDisplay);
+            throw std::runtime_error("Could not create shared GLX context");
+        }
+        
+        renderSwapInterval = DRIVER_INTERVAL;
+        window->graphics().startRenderThread(
+            std::tr1::bind(glXMakeCurrent, renderDisplay, this->window, renderContext),
+            std::tr1::bind(&Impl::presentFrame, this, renderDisplay),
+            std::tr1::bind(closeRenderContext, renderDisplay, renderContext));
+    }
+    
+    // Called on the render thread. swapInterval is only changed before a
+    // frame is handed off to it.
+    void presentFrame(Display* renderDisplay)
+    {
+        if (renderSwapInterval != swapInterval)
+        {
+            setSwapInterval(renderDisplay, window, swapInterval);
+            renderSwapInterval = swapInterval;
+        }
+        glXSwapBuffers(renderDisplay, window);
+    }
+
+    // Blocks until an X event arrives, wakeUp() is called or the wake-up
+    // time has come. Songs are streamed on a thread of their own.
+    void waitForWakeUp()
+    {
+        XFlush(display);
+        if (XPending(display) == 0)
+        {
+            std::tr1::uint64_t until = wakeUpTime;
+            timeval timeout, *timeoutPtr = 0;
+            if (until != 0)
+            {
+                std::tr1::uint64_t now = microseconds();
+                std::tr1::uint64_t remaining = until > now ? until - now : 0;
+                timeout.tv_sec = remaining / 1000000;
+                timeout.tv_usec = remaining % 1000000;
+                timeoutPtr = &timeout;
+            }
+            
+            int connection = ConnectionNumber(display);
+            fd_set fds;
+            FD_ZERO(&fds);
+            FD_SET(connection, &fds);
+            FD_SET(wakeUpPipe[0], &fds);
+            select(std::max(connection, wakeUpPipe[0]) + 1, &fds, 0, 0, timeoutPtr);
+        }
+        
+        char buffer[64];
+        while (read(wakeUpPipe[0], buffer, sizeof buffer) > 0);
+        if (wakeUpTime != 0 && wakeUpTime <= microseconds())
+            wakeUpTime = 0;
+        // The time spent waiting does not need to be caught up with.
+        pacer.restartSteps();
+    }
+
+    // Returns true if the window has been exposed.
+    bool processEvents(Window* window)
+    {
+        bool exposed = false;
+        for (int i = XPending(display); i > 0; --i)
+        {
+            XEvent event;
+            XNextEvent(display, &event);
+
+            // Override redirect fix (thanks go to the Pyglet folks again):
+            if (event.type == ButtonPress && fullscreen && !active)
+                XSetInputFocus(display, this->window, RevertToParent, CurrentTime);
+            
+            if (!window->input().feedXEvent(event))
+            {
+                if (event.type == ConfigureNotify)
+                {
+                    // Only boring stuff to do? Let's do something random:
+                    glXMakeCurrent(display, this->window, context);
+                }
+                else if (event.type == ClientMessage)
+                {
+                    if (static_cast<unsigned>(event.xclient.data.l[0]) ==
+                            XInternAtom(display, "WM_DELETE_WINDOW", false))
+                        window->close();
+                }
+                else if (event.type == FocusIn)
+                    active = true;
+                else if (event.type == FocusOut)
+                    active = false;
+            }
+            if (event.type == Expose && event.xexpose.count == 0)
+                exposed = true;
+        }
+        return exposed;
+    }
+
+    // Returns true if the window was drawn.
+    bool doTick(Window* window, unsigned updates)
+    {
+        limiter.wait();
+        if (processEvents(window) && window->graphics().begin(Colors::black))
+            drawFrame(window);
+        
+        if (showingCursor && !window->needsCursor())
+        {
+            XDefineCursor(display, this->window, emptyCursor);
+            showingCursor = false;
+        }
+        else if (!showingCursor && window->needsCursor())
+        {
+            XUndefineCursor(display, this->window);
+            showingCursor = true;
+        }
+        
+        for (unsigned i = 0; i < updates; ++i)
+        {
+            std::tr1::uint64_t updateStart = microseconds();
+            Song::update();
+            window->input().update();
+            {
+                GOSU_TRACE("Window::update");
+                window->update();
+            }
+            FPS::registerUpdate(microseconds() - updateStart);
+        }
+
+        if (!window->needsRedraw())
+            return false;
+        // Events that arrived while updating still make it into this
+        // frame. The frame is drawn anyway, so exposing can be ignored.
+        if (lateInput)
+        {
+            processEvents(window);
+            window->input().update();
+        }
+        if (!window->graphics().begin(Colors::black))
+            return false;
+        drawFrame(window);
+        return true;
+    }
+    
+    // Headless windows update and draw once per tick, as fast as they can,
+    // so that runs of the same script do the same work.
+    void doHeadlessTick(Window* window)
+    {
+        std::tr1::uint64_t updateStart = microseconds();
+        Song::update();
+        window->input().update();
+        {
+            GOSU_TRACE("Window::update");
+            window->update();
+        }
+        FPS::registerUpdate(microseconds() - updateStart);
+        
+        if (!window->needsRedraw() || !window->graphics().begin(Colors::black))
+            return;
+        drawFrame(window);
+        if (framesLeft != 0 && --framesLeft == 0)
+            window->close();
+    }
+};
+
+Gosu::Window::Window(unsigned width, unsigned height, bool fullscreen,
+        double updateInterval)
+:   pimpl(new Impl(width, height, fullscreen, updateInterval))
+{
+    GOSU_TRACE_STARTUP("Window construction");
+    const char* headless = std::getenv("GOSU_HEADLESS");
+    if (headless && *headless && std::strcmp(headless, "0") != 0)
+    {
+        pimpl->headless = true;
+        pimpl->display = 0;
+        if (const char* frames = std::getenv("GOSU_HEADLESS_FRAMES"))
+            pimpl->framesLeft = std::strtoul(frames, 0, 10);
+        pimpl->createHeadlessContext();
+    }
+    else
+    {
+        pimpl->display = XOpenDisplay(NULL);
+        if (!pimpl->display)
+            throw std::runtime_error("Cannot find display");
+    }
+    
+    if (pipe(pimpl->wakeUpPipe) != 0)
+        throw std::runtime_error("Cannot create pipe");
+    fcntl(pimpl->wakeUpPipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(pimpl->wakeUpPipe[1], F_SETFL, O_NONBLOCK);
+    
+    if (pimpl->headless)
+    {
+        pimpl->graphics.reset(new Graphics(width, height, false));
+        pimpl->input.reset(new Input(0, 0));
+        input().onButtonDown = std::tr1::bind(&Window::buttonDown, this, _1);
+        input().onButtonUp = std::tr1::bind(&Window::buttonUp, this, _1);
+        return;
+    }
+    
+    ::Window root = DefaultRootWindow(pimpl->display);
+
+    // Setup GLX visual
+    static int glxAttributes[] =
+    {
+        GLX_RGBA,
+        GLX_DOUBLEBUFFER,
+        GLX_RED_SIZE, 1,
+        GLX_GREEN_SIZE, 1,
+        GLX_BLUE_SIZE, 1,
+        GLX_DEPTH_SIZE, 1,
+        None
+    };
+    {
+        GOSU_TRACE_STARTUP("GL context setup");
+        pimpl->visual = glXChooseVisual(pimpl->display, DefaultScreen(pimpl->display), glxAttributes);
+
+        // Create GLX context
+        pimpl->context = glXCreateContext(pimpl->display, pimpl->visual, 0, GL_TRUE);
+    }
+
+    // Set up window attributes (& mask)
+    XSetWindowAttributes windowAttributes;
+    windowAttributes.colormap = XCreateColormap(pimpl->display, root, pimpl->visual->visual, AllocNone);
+    windowAttributes.bit_gravity = NorthWestGravity;
+    windowAttributes.background_pixel = 0;
+    unsigned mask = CWColormap | CWBitGravity | CWBackPixel;
+
+    // Create window
+    pimpl->window = XCreateWindow(pimpl->display, root, 0, 0, width, height, 0,
+        pimpl->visual->depth, InputOutput, pimpl->visual->visual,
+        mask, &windowAttributes);    
+
+    // Request a close button for the window
+    Atom atoms[] = { XInternAtom(pimpl->display, "WM_DELETE_WINDOW", false) };
+    XSetWMProtocols(pimpl->display, pimpl->window, atoms, 1);
+
+
+    // Get reference to X Screen
+    Screen* screen = XScreenOfDisplay(pimpl->display,
+                     DefaultScreen(pimpl->display));
+
+    if (fullscreen){
+        // If we're going fullscreen, replace the window
+        // position and size with our screen metrics.
+        int screen_x_org, screen_y_org, screen_width, screen_height;
+        Gosu::screenMetrics(&screen_x_org, &screen_y_org, &screen_width, &screen_height);
+        pimpl->width = screen_width;
+        pimpl->height = screen_height;
+        pimpl->x = screen_x_org;
+        pimpl->y = screen_y_org;
+
+        // Override Redirect (JohnColburn says: I don't actually know what this is for.)
+        XSetWindowAttributes windowAttributes;
+        windowAttributes.override_redirect = true;
+        unsigned mask = CWOverrideRedirect;
+        XChangeWindowAttributes(pimpl->display, pimpl->window, mask, &windowAttributes);
+    }
+    
+    // Move and resize the window to its current position and size.
+    XMoveResizeWindow(pimpl->display, pimpl->window, pimpl->x, pimpl->y, pimpl->width, pimpl->height);
+
+    // Set window to be non-resizable
+    XSizeHints *sizeHints = XAllocSizeHints();
+    sizeHints->flags = PMinSize | PMaxSize;
+    sizeHints->min_width = sizeHints->max_width = pimpl->width;
+    sizeHints->min_height = sizeHints->max_height = pimpl->height;
+    XSetWMNormalHints(pimpl->display, pimpl->window, sizeHints);
+    XFree(sizeHints);
+
+    // TODO: Window style (_MOTIF_WM_HINTS)?        
+
+    XColor black, dummy;
+    XAllocNamedColor(pimpl->display, screen->cmap, "black", &black, &dummy);    
+    char emptyData[] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    Pixmap emptyBitmap =
+        XCreateBitmapFromData(pimpl->display, pimpl->window, emptyData, 8, 8);
+    pimpl->emptyCursor = XCreatePixmapCursor(pimpl->display, emptyBitmap,
+        emptyBitmap, &black, &black, 0, 0);
+    pimpl->showingCursor = true; // Empty cursor not yet installed
+
+    // Must be current already so that Graphics' constructor can set up things
+    {
+        GOSU_TRACE_STARTUP("GL context setup");
+        glXMakeCurrent(pimpl->display, pimpl->window, pimpl->context);
+    }
+
+    // Now set up major Gosu components
+    pimpl->graphics.reset(new Graphics(pimpl->width, pimpl->height, fullscreen));
+    pimpl->input.reset(new Input(pimpl->display, pimpl->window));    
+    input().onButtonDown = std::tr1::bind(&Window::buttonDown, this, _1);
+    input().onButtonUp = std::tr1::bind(&Window::buttonUp, this, _1);
+    
+    // Fix coordinates for fullscreen screen-scaling
+    if (fullscreen)
+    {
+        graphics().setResolution(width, height);
+        input().setMouseFactors(1.0 * width / pimpl->width,
+                  1.0 * height / pimpl->height);
+    }
+}
+
+Gosu::Window::~Window()
+{
+    graphics().stopRenderThread();
+    ::close(pimpl->wakeUpPipe[0]);
+    ::close(pimpl->wakeUpPipe[1]);
+    if (pimpl->headless)
+    {
+        // Textures and buffers must go while the context still exists.
+        pimpl->input.reset();
+        pimpl->graphics.reset();
+        pimpl->destroyHeadlessContext();
+        return;
+    }
+    XFreeCursor(pimpl->display, pimpl->emptyCursor);
+    XDestroyWindow(pimpl->display, pimpl->window);
+    XSync(pimpl->display, false);
+}
+
+std::wstring Gosu::Window::caption() const
+{
+    return pimpl->title;
+}
+
+double Gosu::Window::updateInterval() const
+{
+    return pimpl->updateInterval;
+}
+
+void Gosu::Window::setPrecisePacing(bool precisePacing)
+{
+    pimpl->pacer.setPrecise(precisePacing);
+}
+
+void Gosu::Window::setFixedTimestep(bool fixedTimestep)
+{
+    if (fixedTimestep && !pimpl->fixedTimestep)
+        pimpl->pacer.restartSteps();
+    pimpl->fixedTimestep = fixedTimestep;
+}
+
+void Gosu::Window::setVSync(VSyncMode mode)
+{
+    pimpl->vsyncMode = mode;
+}
+
+void Gosu::Window::setMaxFramesInFlight(unsigned frames)
+{
+    pimpl->limiter.setFrames(frames);
+}
+
+void Gosu::Window::setPipelinedRendering(bool pipelinedRendering)
+{
+    pimpl->pipelined = pipelinedRendering;
+    // Headless frames are timed with glFinish, which needs them on this thread.
+    if (!pimpl->showing || pimpl->headless)
+        return;
+    if (!pipelinedRendering)
+        graphics().stopRenderThread();
+    else if (!graphics().rendersOnThread())
+        pimpl->startRenderThread(this);
+}
+
+void Gosu::Window::setIdleMode(bool idleMode)
+{
+    pimpl->idle = idleMode;
+}
+
+void Gosu::Window::setLateInputSampling(bool lateInputSampling)
+{
+    pimpl->lateInput = lateInputSampling;
+}
+
+void Gosu::Window::wakeUp()
+{
+    // If the pipe is full, the window is going to wake up anyway.
+    char wake = 0;
+    ssize_t written = write(pimpl->wakeUpPipe[1], &wake, 1);
+    (void)written;
+}
+
+void Gosu::Window::wakeUpAfter(unsigned long milliseconds)
+{
+    std::tr1::uint64_t time = microseconds() +
+        static_cast<std::tr1::uint64_t>(milliseconds) * 1000;
+    if (pimpl->wakeUpTime == 0 || time < pimpl->wakeUpTime)
+        pimpl->wakeUpTime = time;
+}
+
+double Gosu::Window::interpolation() const
+{
+    return pimpl->fixedTimestep ? pimpl->pacer.stepAlpha() : 0;
+}
+
+void Gosu::Window::setCaption(const std::wstring& caption)
+{
+    // TODO: Update to _NET_WM_NAME to support Unicode
+
+    pimpl->title = caption;
+    if (pimpl->headless)
+        return;
+
+    std::string tmpString(pimpl->title.begin(), pimpl->title.end());
+    std::vector<char> title(pimpl->title.size() + 1);
+    std::copy(tmpString.begin(), tmpString.end(), title.begin());
+    title.back() = 0;
+
+    XTextProperty titleprop;
+    char* titlePtr = &title[0];
+    XStringListToTextProperty(&titlePtr, 1, &titleprop);
+
+    XSetWMName(pimpl->display, pimpl->window, &titleprop);
+    XFree(titleprop.value);
+    XSync(pimpl->display, false);
+}
+
+namespace GosusDarkSide
+{
+    // TODO: Find a way for this to fit into Gosu's design.
+    // This can point to a function that wants to be called every
+    // frame, e.g. rb_thread_schedule.
+    typedef void (*HookOfHorror)();
+    HookOfHorror oncePerTick = 0;
+}
+
+// TODO: Some exception safety
+
+void Gosu::Window::show()
+{
+    if (pimpl->headless)
+    {
+        pimpl->showing = true;
+        while (pimpl->showing)
+        {
+            pimpl->doHeadlessTick(this);
+            if (GosusDarkSide::oncePerTick) GosusDarkSide::oncePerTick();
+        }
+        return;
+    }
+    
+    // Map window
+    pimpl->executeAndWait(XMapRaised, MapNotify);
+    pimpl->mapped = true;
+    
+    // Make glx current
+    glXMakeCurrent(pimpl->display, pimpl->window, pimpl->context);
+    
+    if (pimpl->fullscreen){
+        XSetInputFocus(pimpl->display, pimpl->window, RevertToParent, CurrentTime);
+        XGrabPointer(pimpl->display, pimpl->window, true, 0, GrabModeAsync, GrabModeAsync, pimpl->window, None, CurrentTime);
+    }
+    
+    setCaption(pimpl->title);
+
+    pimpl->showing = true;
+    if (pimpl->pipelined)
+        pimpl->startRenderThread(this);
+    while (pimpl->showing)
+    {
+        bool drawn;
+        pimpl->updateSwapInterval();
+        if (!pimpl->fixedTimestep)
+        {
+            pimpl->pacer.wait();
+            drawn = pimpl->doTick(this, 1);
+        }
+        else
+        {
+            drawn = pimpl->doTick(this, pimpl->pacer.stepsDue());
+            // Only wait if there was nothing to draw.
+            if (!drawn && !pimpl->idle)
+                sleep(pimpl->pacer.untilNextStep() / 1000);
+        }
+        if (!drawn && pimpl->idle && pimpl->showing)
+            pimpl->waitForWakeUp();
+        if (GosusDarkSide::oncePerTick) GosusDarkSide::oncePerTick();
+    }
+
+    graphics().stopRenderThread();
+    pimpl->limiter.reset();
+    glXMakeCurrent(pimpl->display, 0, 0);
+    pimpl->executeAndWait(XUnmapWindow, UnmapNotify);
+    pimpl->mapped = false;
+}
+
+void Gosu::Window::close()
+{
+    pimpl->showing = false;
+}
+
+void Gosu::Window::panic(const std::exception& e)
+{
+    throw e;
+}
+
+const Gosu::Graphics& Gosu::Window::graphics() const
+{
+    return *pimpl->graphics;
+}
+
+Gosu::Graphics& Gosu::Window::graphics()
+{
+    return *pimpl->graphics;
+}
+
+const Gosu::Input& Gosu::Window::input() const
+{
+    return *pimpl->input;
+}
+
+Gosu::Input& Gosu::Window::input()
+{
+    return *pimpl->input;
+}
+
+namespace
+{
+    void makeCurrentContext(Display* dpy, GLXDrawable drawable, GLXContext context) {
+        if (!glXMakeCurrent(dpy, drawable, context))
+            std::printf("glXMakeCurrent failed\n");
+    }
+
+    void releaseContext(Display* dpy, GLXContext context) {
+        glXDestroyContext(dpy, context);
+    }
+}
+
+Gosu::Window::SharedContext Gosu::Window::createSharedContext() {
+    #ifdef HAVE_EGL_EGL_H
+    if (pimpl->headless)
+    {
+        EGLSurface surface = pimpl->createPbuffer(1, 1);
+        EGLContext context = eglCreateContext(pimpl->eglDisplay, pimpl->eglConfig,
+            pimpl->eglContext, 0);
+        if (context == EGL_NO_CONTEXT)
+        {
+            eglDestroySurface(pimpl->eglDisplay, surface);
+            throw std::runtime_error("Could not create shared EGL context");
+        }
+        return SharedContext(
+            new std::tr1::function<void()>(std::tr1::bind(makeCurrentEGLContext,
+                pimpl->eglDisplay, surface, context)),
+            std::tr1::bind(releaseEGLContext, pimpl->eglDisplay, surface, context));
+    }
+    #endif
+    
+    const char* displayName = DisplayString( pimpl->display );
+    Display* dpy2 = XOpenDisplay( displayName );
+    if (!dpy2)
+        throw std::runtime_error("Could not duplicate X display");
+    
+    GLXContext ctx = glXCreateContext(dpy2, pimpl->visual, pimpl->context, True);
+    if (!ctx)
+        throw std::runtime_error("Could not create shared GLX context");
+    
+    return SharedContext(
+        new std::tr1::function<void()>(std::tr1::bind(makeCurrentContext, dpy2, pimpl->window, ctx)),
+            std::tr1::bind(releaseContext, dpy2, ctx));
+}
+
+// Deprecated.
+
+class Gosu::Audio {};
+namespace { Gosu::Audio dummyAudio; }
+
+const Gosu::Audio& Gosu::Window::audio() const
+{
+    return dummyAudio;
+}
+ 
+Gosu::Audio& Gosu::Window::audio()
+{
+    return dummyAudio;
+}
+
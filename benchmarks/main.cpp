@@ -0,0 +1,380 @@
+// Measures the code that most games run through every frame or for every
+// resource, to catch performance regressions between releases. Unlike the
+// examples, this uses Gosu's internal headers, so it is built along with
+// the library (see BUILD_BENCHMARKS in cmake/GosuImpl.cmake).
+// Prints CSV: benchmark name, problem size, nanoseconds per operation and
+// operations per second. Nothing here needs a window or an OpenGL context.
+
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/Graphics.hpp>
+#include <Gosu/GraphicsBase.hpp>
+#include <Gosu/Sockets.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/TR1.hpp>
+#include <Gosu/Utility.hpp>
+#include <GosuImpl/Graphics/BlockAllocator.hpp>
+#include <GosuImpl/Graphics/DrawOpQueue.hpp>
+#include <GosuImpl/Graphics/FormattedString.hpp>
+#include <GosuImpl/Graphics/TransformStack.hpp>
+
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Repeats each measurement until it has taken at least this long, in
+    // microseconds.
+    const std::tr1::uint64_t minDuration = 200000;
+
+    // Deterministic, so that every run measures the same work.
+    unsigned nextRandom(unsigned& state)
+    {
+        state = state * 1103515245u + 12345u;
+        return state >> 16;
+    }
+
+    // Runs the measurement repeatedly and prints one line of CSV for it.
+    // opsPerRun is how many operations one call of the measurement does.
+    template<typename Measurement>
+    void measure(const char* name, unsigned long size, Measurement& measurement,
+        unsigned long opsPerRun)
+    {
+        unsigned long runs = 0;
+        std::tr1::uint64_t start = Gosu::microseconds(), elapsed;
+        do
+        {
+            measurement();
+            ++runs;
+            elapsed = Gosu::microseconds() - start;
+        }
+        while (elapsed < minDuration);
+
+        double ops = double(runs) * opsPerRun;
+        std::printf("%s,%lu,%.2f,%.0f\n", name, size,
+            elapsed * 1000.0 / ops, ops * 1000000.0 / elapsed);
+        std::fflush(stdout);
+    }
+
+    // Fills a texture-sized allocator with blocks of mixed sizes, like
+    // images and font glyphs, then frees them again.
+    struct AllocFree
+    {
+        std::vector<Gosu::BlockAllocator::Block> blocks;
+        void operator()()
+        {
+            Gosu::BlockAllocator allocator(1024, 1024);
+            unsigned state = 1;
+            blocks.clear();
+            Gosu::BlockAllocator::Block block;
+            while (allocator.alloc(8 + nextRandom(state) % 57, 8 + nextRandom(state) % 57, block))
+                blocks.push_back(block);
+            for (std::size_t i = 0; i < blocks.size(); ++i)
+                allocator.free(blocks[i].left, blocks[i].top);
+        }
+    };
+
+    // Frees and allocates blocks in a full allocator, like a glyph cache
+    // that has to make room.
+    struct AllocChurn
+    {
+        std::auto_ptr<Gosu::BlockAllocator> allocator;
+        std::vector<Gosu::BlockAllocator::Block> blocks;
+        unsigned state;
+
+        AllocChurn()
+        : allocator(new Gosu::BlockAllocator(1024, 1024)), state(1)
+        {
+            Gosu::BlockAllocator::Block block;
+            while (allocator->alloc(32, 32, block))
+                blocks.push_back(block);
+        }
+
+        void operator()()
+        {
+            for (unsigned i = 0; i < 100; ++i)
+            {
+                Gosu::BlockAllocator::Block& block = blocks[nextRandom(state) % blocks.size()];
+                allocator->free(block.left, block.top);
+                allocator->alloc(32, 32, block);
+            }
+        }
+    };
+
+    // Schedules ops at a handful of z values, as typical games use, and
+    // sorts them. Nothing is drawn.
+    struct ScheduleSort
+    {
+        Gosu::DrawOpQueue queue;
+        std::vector<Gosu::DrawOp> ops;
+
+        explicit ScheduleSort(unsigned count)
+        {
+            unsigned state = 1;
+            ops.resize(count);
+            for (unsigned i = 0; i < count; ++i)
+            {
+                Gosu::DrawOp& op = ops[i];
+                float x = nextRandom(state) % 800, y = nextRandom(state) % 600;
+                op.verticesOrBlockIndex = 4;
+                op.vertices[0] = Gosu::ArrayVertex(x, y, Gosu::Color::WHITE);
+                op.vertices[1] = Gosu::ArrayVertex(x + 32, y, Gosu::Color::WHITE);
+                op.vertices[2] = Gosu::ArrayVertex(x + 32, y + 32, Gosu::Color::WHITE);
+                op.vertices[3] = Gosu::ArrayVertex(x, y + 32, Gosu::Color::WHITE);
+                op.z = nextRandom(state) % 8;
+            }
+        }
+
+        void operator()()
+        {
+            for (std::size_t i = 0; i < ops.size(); ++i)
+                queue.scheduleDrawOp(ops[i], Gosu::amDefault);
+            queue.prepareForMerging();
+            queue.clearQueue();
+        }
+    };
+
+    // The pattern of drawing a rotated sprite inside a scrolled layer.
+    struct PushPop
+    {
+        Gosu::TransformStack stack;
+        std::vector<Gosu::Transform> translations, rotations;
+
+        PushPop()
+        {
+            for (unsigned i = 0; i < 64; ++i)
+            {
+                translations.push_back(Gosu::translate(i * 10, i * 5));
+                rotations.push_back(Gosu::rotate(i * 5.625, 16, 16));
+            }
+        }
+
+        void operator()()
+        {
+            for (std::size_t i = 0; i < translations.size(); ++i)
+            {
+                stack.push(translations[i]);
+                stack.push(rotations[i]);
+                stack.pop();
+                stack.pop();
+            }
+        }
+    };
+
+    Gosu::Bitmap pattern(unsigned width, unsigned height)
+    {
+        Gosu::Bitmap result(width, height);
+        for (unsigned y = 0; y < height; ++y)
+            for (unsigned x = 0; x < width; ++x)
+                result.setPixel(x, y, Gosu::Color(255, x & 0xff, y & 0xff, (x ^ y) & 0xff));
+        return result;
+    }
+
+    struct Insert
+    {
+        Gosu::Bitmap source, dest;
+        void operator()() { dest.insert(source, 1, 1); }
+    };
+
+    struct BorderFlags
+    {
+        Gosu::Bitmap source, dest;
+        void operator()()
+        {
+            Gosu::applyBorderFlags(dest, source, 0, 0, source.width(), source.height(),
+                Gosu::bfSmooth);
+        }
+    };
+
+    struct ColorKey
+    {
+        Gosu::Bitmap source, copy;
+        // Includes copying the source each time.
+        void operator()()
+        {
+            copy = source;
+            Gosu::applyColorKey(copy, Gosu::Color::FUCHSIA);
+        }
+    };
+
+    struct ParseFormatting
+    {
+        std::wstring html;
+        void operator()()
+        {
+            Gosu::FormattedString fs(html.c_str(), 0);
+            if (fs.length() == 0)
+                throw std::logic_error("Formatted string came out empty");
+        }
+    };
+
+    // Walks through the parts of each line, like Text.cpp does.
+    struct WalkParts
+    {
+        Gosu::FormattedString text;
+        void operator()()
+        {
+            unsigned parts = 0;
+            for (unsigned begin = 0; begin < text.length(); ++parts)
+                begin = text.endOfPart(begin);
+            if (parts == 0)
+                throw std::logic_error("Formatted string has no parts");
+        }
+    };
+
+    struct DecodeUTF8
+    {
+        std::string utf8;
+        void operator()()
+        {
+            if (Gosu::utf8ToWstring(utf8).empty())
+                throw std::logic_error("UTF-8 text came out empty");
+        }
+    };
+
+    // Sends managed messages from one end of a loopback connection to the
+    // other, so that both the length prefixes and their parsing are measured.
+    struct Framing
+    {
+        std::auto_ptr<Gosu::CommSocket> client, server;
+        std::vector<char> message;
+        unsigned received;
+
+        explicit Framing(unsigned size)
+        : message(size, 'x'), received(0)
+        {
+            Gosu::ListenerSocket listener(Gosu::anyPort);
+            listener.onConnection = std::tr1::bind(&Framing::accept, this,
+                std::tr1::placeholders::_1);
+            client.reset(new Gosu::CommSocket(Gosu::cmManaged, 0x7f000001, listener.port()));
+            std::tr1::uint64_t start = Gosu::microseconds();
+            while (!server.get())
+            {
+                listener.update();
+                if (Gosu::microseconds() - start > 5000000)
+                    throw std::runtime_error("Could not connect over loopback");
+            }
+            server->onReceive = std::tr1::bind(&Framing::receive, this,
+                std::tr1::placeholders::_1, std::tr1::placeholders::_2);
+        }
+
+        void accept(Gosu::Socket& socket)
+        {
+            server.reset(new Gosu::CommSocket(Gosu::cmManaged, socket));
+        }
+
+        void receive(const void*, std::size_t)
+        {
+            ++received;
+        }
+
+        void operator()()
+        {
+            received = 0;
+            for (unsigned i = 0; i < 100; ++i)
+                client->send(&message[0], message.size());
+            while (received < 100)
+            {
+                client->update();
+                server->update();
+            }
+        }
+    };
+
+    void measureBitmaps()
+    {
+        const unsigned sizes[] = { 64, 256, 1024 };
+        for (unsigned i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+        {
+            unsigned size = sizes[i], pixels = size * size;
+
+            Insert insert = { pattern(size, size), Gosu::Bitmap(size, size) };
+            measure("Bitmap::insert (pixels)", size, insert, pixels);
+
+            BorderFlags borderFlags = { pattern(size, size), Gosu::Bitmap() };
+            measure("applyBorderFlags (pixels)", size, borderFlags, pixels);
+
+            // Every third pixel is the color key.
+            ColorKey colorKey = { pattern(size, size), Gosu::Bitmap() };
+            for (unsigned y = 0; y < size; ++y)
+                for (unsigned x = y % 3; x < size; x += 3)
+                    colorKey.source.setPixel(x, y, Gosu::Color::FUCHSIA);
+            measure("applyColorKey (pixels)", size, colorKey, pixels);
+        }
+    }
+
+    void measureText()
+    {
+        ParseFormatting plain = { L"The quick brown fox jumps over the lazy dog. " };
+        measure("FormattedString plain (strings)", plain.html.size(), plain, 1);
+        ParseFormatting tagged = { L"The <b>quick</b> <c=ff8000>brown</c> fox "
+            L"<i>jumps</i> over the <u>lazy</u> dog &amp; <b><i>cat</i></b>." };
+        measure("FormattedString tagged (strings)", tagged.html.size(), tagged, 1);
+        WalkParts walkParts = { Gosu::FormattedString(tagged.html.c_str(), 0) };
+        measure("FormattedString parts (strings)", tagged.html.size(), walkParts, 1);
+
+        DecodeUTF8 ascii = { std::string() }, mixed = { std::string() };
+        for (unsigned i = 0; i < 32; ++i)
+        {
+            ascii.utf8 += "Hello, world! 0123456789 abcdef ";
+            mixed.utf8 += "Gr\xc3\xbc\xc3\x9f" "e, \xe4\xb8\x96\xe7\x95\x8c! caf\xc3\xa9 \xe2\x82\xac 12 ";
+        }
+        measure("utf8ToWstring ASCII (bytes)", ascii.utf8.size(), ascii, ascii.utf8.size());
+        measure("utf8ToWstring mixed (bytes)", mixed.utf8.size(), mixed, mixed.utf8.size());
+    }
+
+    void measureSockets()
+    {
+        const unsigned sizes[] = { 16, 256, 4096 };
+        for (unsigned i = 0; i < sizeof sizes / sizeof *sizes; ++i)
+        {
+            Framing framing(sizes[i]);
+            measure("CommSocket framing (messages)", sizes[i], framing, 100);
+        }
+    }
+}
+
+int main()
+{
+    std::printf("benchmark,size,ns_per_op,ops_per_second\n");
+    try
+    {
+        AllocFree allocFree;
+        allocFree();
+        measure("BlockAllocator fill and free (blocks)", allocFree.blocks.size(),
+            allocFree, allocFree.blocks.size());
+        AllocChurn allocChurn;
+        measure("BlockAllocator churn (free+alloc)", allocChurn.blocks.size(), allocChurn, 100);
+
+        const unsigned opCounts[] = { 1000, 10000, 100000 };
+        for (unsigned i = 0; i < sizeof opCounts / sizeof *opCounts; ++i)
+        {
+            ScheduleSort scheduleSort(opCounts[i]);
+            measure("DrawOpQueue schedule+sort (ops)", opCounts[i], scheduleSort, opCounts[i]);
+        }
+
+        PushPop pushPop;
+        measure("TransformStack push+pop (pairs)", pushPop.translations.size(), pushPop, 2 * pushPop.translations.size());
+
+        measureBitmaps();
+        measureText();
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    // Loopback networking can be unavailable, e.g. in sandboxes.
+    try
+    {
+        measureSockets();
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "Skipping sockets: %s\n", e.what());
+    }
+}
@@ -0,0 +1,131 @@
+// Renders a frame that Graphics::captureFrame has saved over and over, to
+// time changes to the renderer (batching, vertex buffers, shaders...) with
+// the frames of a real game, but without running the game itself. Built
+// along with the benchmarks (see BUILD_BENCHMARKS in cmake/GosuImpl.cmake).
+// Usage: GosuReplay capture [frames]
+// Prints CSV: capture, number of ops, frames measured, then the average
+// time spent submitting the ops on the CPU, the average time per frame
+// and, where OpenGL supports timer queries, the average time on the GPU,
+// all in milliseconds, followed by batches and texture binds per frame.
+// Set GOSU_HEADLESS=1 to replay without a display (see Window.hpp).
+// Textures are replayed with undefined contents, and custom OpenGL code
+// in the captured frame is left out.
+
+#include <Gosu/Graphics.hpp>
+#include <Gosu/Inspection.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/TR1.hpp>
+#include <Gosu/Utility.hpp>
+#include <Gosu/Window.hpp>
+#include <GosuImpl/Graphics/DrawOpQueue.hpp>
+#include <GosuImpl/Graphics/FrameCapture.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <string>
+
+namespace
+{
+    // Frames that are rendered before measuring, so that textures and
+    // driver caches have been set up.
+    const unsigned long warmUpFrames = 10;
+
+    class Replay : public Gosu::Window
+    {
+        // Destroyed before the window, so that the textures are deleted
+        // while the context still exists.
+        std::auto_ptr<Gosu::CapturedFrame> frame;
+        Gosu::DrawOpQueue queue;
+
+        unsigned long frames, drawn;
+        std::tr1::uint64_t start, elapsed, submitTime, gpuTime;
+        unsigned long batches, textureBinds;
+
+        bool measuring() const
+        {
+            return drawn > warmUpFrames;
+        }
+
+    public:
+        Replay(std::auto_ptr<Gosu::CapturedFrame> captured, unsigned long frames)
+        : Window(captured->width, captured->height, false, 1),
+          frame(captured), frames(frames), drawn(0),
+          start(0), elapsed(0), submitTime(0), gpuTime(0), batches(0), textureBinds(0)
+        {
+            graphics().setPremultipliedAlpha(frame->premultiplied);
+            graphics().setGPUTiming(true);
+            frame->createTextures();
+        }
+
+        void update()
+        {
+            // Statistics are available once the frame has ended.
+            if (measuring())
+            {
+                Gosu::RendererStatistics stats = Gosu::rendererStatistics();
+                gpuTime += stats.gpuTime;
+                batches += stats.batches;
+                textureBinds += stats.textureBinds;
+            }
+            if (drawn == warmUpFrames)
+                start = Gosu::microseconds();
+            else if (drawn == warmUpFrames + frames)
+            {
+                elapsed = Gosu::microseconds() - start;
+                close();
+            }
+        }
+
+        void draw()
+        {
+            ++drawn;
+            queue.replay(*frame);
+            std::tr1::uint64_t submitStart = Gosu::microseconds();
+            queue.performDrawOpsAndCode();
+            if (measuring())
+                submitTime += Gosu::microseconds() - submitStart;
+            queue.clearQueue();
+        }
+
+        void report(const std::string& capture) const
+        {
+            double n = frames;
+            std::printf("capture,ops,frames,submit_ms,frame_ms,gpu_ms,batches,texture_binds\n");
+            std::printf("%s,%lu,%lu,%.3f,%.3f,%.3f,%.1f,%.1f\n", capture.c_str(),
+                static_cast<unsigned long>(frame->ops.size()), frames,
+                submitTime / n / 1000, elapsed / n / 1000, gpuTime / n / 1000,
+                batches / n, textureBinds / n);
+        }
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        std::fprintf(stderr, "Usage: %s capture [frames]\n", argv[0]);
+        return 2;
+    }
+    unsigned long frames = argc == 3 ? std::strtoul(argv[2], 0, 10) : 600;
+    if (frames == 0)
+    {
+        std::fprintf(stderr, "Need at least one frame\n");
+        return 2;
+    }
+
+    try
+    {
+        std::auto_ptr<Gosu::CapturedFrame> frame(
+            new Gosu::CapturedFrame(Gosu::utf8ToWstring(argv[1])));
+        Replay replay(frame, frames);
+        replay.show();
+        replay.report(argv[1]);
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
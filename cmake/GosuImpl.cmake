@@ -58,29 +58,51 @@ endif()
 
 #Projects source files
 SET(CORE_SRC_FILES
-    #Async.cpp
+    Archive.cpp
+    Async.cpp
     Inspection.cpp
     IO.cpp
     Math.cpp
+    ResourceCache.cpp
+    SpatialHash.cpp
+    Trace.cpp
+    Graphics/Atlas.cpp
     Graphics/BitmapBMP.cpp
     Graphics/BitmapColorKey.cpp
     Graphics/Bitmap.cpp
     Graphics/BitmapFreeImage.cpp
+    Graphics/BitmapResample.cpp
     Graphics/BitmapUtils.cpp
     Graphics/BlockAllocator.cpp
+    Graphics/FrameCapture.cpp
     Graphics/Color.cpp
+    Graphics/CompressedTexture.cpp
     Graphics/Font.cpp
     Graphics/Graphics.cpp
     Graphics/Image.cpp
     Graphics/LargeImageData.cpp
+    Graphics/Particles.cpp
+    Graphics/RenderTarget.cpp
+    Graphics/Shader.cpp
     Graphics/TexChunk.cpp
     Graphics/Texture.cpp
+    Graphics/TileLayer.cpp
+    Graphics/SpriteLayer.cpp
+    Graphics/Animation.cpp
+    Graphics/Camera.cpp
+    Graphics/CollisionMask.cpp
     Graphics/Transform.cpp
+    Sockets/AddressResolver.cpp
     Sockets/CommSocket.cpp
     Sockets/ListenerSocket.cpp
+    Sockets/MessageChannel.cpp
     Sockets/MessageSocket.cpp
+    Sockets/NetworkThread.cpp
+    Sockets/Snapshots.cpp
     Sockets/Socket.cpp
+    Sockets/SocketPoller.cpp
     Audio/AudioOpenAL.cpp
+    Audio/SoundScape.cpp
 )
 
 if(WIN32)
@@ -130,6 +152,8 @@ endforeach()
 
 #Projects headers files
 SET(CORE_INC_FILES
+    ../Gosu/Archive.hpp
+    ../Gosu/Atlas.hpp
     ../Gosu/Async.hpp
     ../Gosu/Directories.hpp
     ../Gosu/Input.hpp
@@ -147,14 +171,26 @@ SET(CORE_INC_FILES
     ../Gosu/Version.hpp
     ../Gosu/GraphicsBase.hpp
     ../Gosu/Platform.hpp
+    ../Gosu/ResourceCache.hpp
     ../Gosu/Window.hpp
     ../Gosu/Graphics.hpp
     ../Gosu/Sockets.hpp
+    ../Gosu/SoundScape.hpp
+    ../Gosu/SpatialHash.hpp
     ../Gosu/ImageData.hpp
     ../Gosu/Text.hpp
     ../Gosu/Color.hpp
     ../Gosu/Image.hpp
     ../Gosu/TextInput.hpp
+    ../Gosu/Particles.hpp
+    ../Gosu/RenderTarget.hpp
+    ../Gosu/Shader.hpp
+    ../Gosu/Animation.hpp
+    ../Gosu/Camera.hpp
+    ../Gosu/CollisionMask.hpp
+    ../Gosu/SpriteLayer.hpp
+    ../Gosu/TileLayer.hpp
+    ../Gosu/Trace.hpp
 )
 
 if(WIN32)
@@ -196,6 +232,11 @@ include(${CMAKE_CURRENT_BINARY_DIR}/GosuConfig.cmake)
 configure_file(${CMAKE_CURRENT_SOURCE_DIR}/gosu.pc.in ${CMAKE_CURRENT_BINARY_DIR}/gosu.pc @ONLY)
 install(FILES ${CMAKE_CURRENT_BINARY_DIR}/gosu.pc DESTINATION ${INSTALL_PKGCONFIG_DIR} COMPONENT development)
 
+#Headless windows (GOSU_HEADLESS, see Window.hpp) render into EGL pbuffers.
+IF(UNIX AND NOT APPLE AND EGL_INCLUDE_DIR AND EGL_LIBRARY)
+	ADD_DEFINITIONS(-DHAVE_EGL_EGL_H)
+ENDIF()
+
 #Tell CMake the paths
 INCLUDE_DIRECTORIES(
     ${CMAKE_CURRENT_SOURCE_DIR}/..
@@ -239,10 +280,42 @@ IF(BUILD_DYNAMIC_LIBRARIES)
 	ENDIF(MSVC)
 	# out of SOME reason, we cannot link to gl in the executable
     find_package(OpenGL REQUIRED)
-	target_link_libraries(GosuDynamic ${OPENGL_LIBRARY})
+	find_package(Threads REQUIRED)
+	target_link_libraries(GosuDynamic ${OPENGL_LIBRARY} ${CMAKE_THREAD_LIBS_INIT})
+	IF(EGL_LIBRARY)
+		target_link_libraries(GosuDynamic ${EGL_LIBRARY})
+	ENDIF()
+	IF(UNIX AND NOT APPLE)
+		# clock_gettime is only part of libc itself since glibc 2.17.
+		find_library(RT_LIBRARY rt)
+		IF(RT_LIBRARY)
+			target_link_libraries(GosuDynamic ${RT_LIBRARY})
+		ENDIF()
+	ENDIF()
 	SET(Gosu_LIBRARY "GosuDynamic")
 ENDIF()
 
+#Benchmarks
+#They use internal headers, so unlike the examples they are built along with the library.
+#Run GosuBenchmarks to get CSV that can be compared between releases.
+OPTION(BUILD_BENCHMARKS "Build the benchmarks of Gosu's core code paths" OFF)
+IF(BUILD_BENCHMARKS)
+	#GosuReplay renders frames saved by Graphics::captureFrame, see benchmarks/replay.cpp.
+	ADD_EXECUTABLE(GosuBenchmarks ${CMAKE_CURRENT_SOURCE_DIR}/../benchmarks/main.cpp)
+	ADD_EXECUTABLE(GosuReplay ${CMAKE_CURRENT_SOURCE_DIR}/../benchmarks/replay.cpp)
+	find_package(Threads REQUIRED)
+	find_package(OpenGL REQUIRED)
+	TARGET_LINK_LIBRARIES(GosuBenchmarks ${Gosu_LIBRARY} ${LINK_LIBRARIES} ${CMAKE_THREAD_LIBS_INIT})
+	TARGET_LINK_LIBRARIES(GosuReplay ${Gosu_LIBRARY} ${LINK_LIBRARIES} ${OPENGL_LIBRARY} ${CMAKE_THREAD_LIBS_INIT})
+	IF(UNIX AND NOT APPLE)
+		find_library(RT_LIBRARY rt)
+		IF(RT_LIBRARY)
+			TARGET_LINK_LIBRARIES(GosuBenchmarks ${RT_LIBRARY})
+			TARGET_LINK_LIBRARIES(GosuReplay ${RT_LIBRARY})
+		ENDIF()
+	ENDIF()
+ENDIF()
+
 #Install
 IF(WIN32)
 	IF(BUILD_STATIC_LIBRARIES)
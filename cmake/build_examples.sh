@@ -22,3 +22,11 @@ mkdir build
 cd build
 cmake ..
 make
+
+cd ../..
+
+cd SocketBenchmark
+mkdir build
+cd build
+cmake ..
+make
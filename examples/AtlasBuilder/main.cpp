@@ -0,0 +1,47 @@
+// Packs images into an atlas file that Gosu::Atlas loads, e.g.:
+//   AtlasBuilder media.atlas media Star.png Ship.png Beep.png
+// Names are stored relative to the directory and are what Atlas::image
+// is called with later.
+
+#include <Gosu/Atlas.hpp>
+#include <Gosu/Utility.hpp>
+#include <Gosu/AutoLink.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <vector>
+
+int main(int argc, char* argv[])
+{
+    unsigned pageSize = Gosu::MAX_TEXTURE_SIZE;
+    int first = 1;
+    if (argc > 2 && std::strcmp(argv[1], "--page-size") == 0)
+    {
+        pageSize = std::atoi(argv[2]);
+        first = 3;
+    }
+    if (argc - first < 3)
+    {
+        std::fprintf(stderr, "Usage: %s [--page-size size] atlas directory image...\n",
+            argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        std::vector<std::wstring> names;
+        for (int i = first + 2; i < argc; ++i)
+            names.push_back(Gosu::widen(argv[i]));
+        Gosu::createAtlas(Gosu::widen(argv[first]), names,
+            Gosu::widen(argv[first + 1]), pageSize);
+        std::printf("Packed %u images into %s\n", unsigned(names.size()), argv[first]);
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -0,0 +1,155 @@
+// Measures the Bitmap operations that almost every image goes through on
+// its way to a texture: copying with insert, growing with resize, adding
+// borders with applyBorderFlags, cutting a tileset into tiles, which is
+// what loadTiles and LargeImageData do, applyColorKey, which every BMP
+// goes through, and resample, which scales down images with
+// Graphics::setImageScale.
+// Prints megapixels per second for several sizes.
+
+#include <Gosu/Bitmap.hpp>
+#include <Gosu/GraphicsBase.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/TR1.hpp>
+#include <Gosu/AutoLink.hpp>
+
+#include <cstdio>
+#include <exception>
+
+namespace
+{
+    const unsigned sizes[] = { 16, 64, 256, 1024, 4096 };
+    const unsigned numSizes = sizeof sizes / sizeof *sizes;
+
+    // Repeats each measurement until it has taken at least this long, in
+    // microseconds.
+    const std::tr1::uint64_t minDuration = 200000;
+
+    Gosu::Bitmap pattern(unsigned width, unsigned height)
+    {
+        Gosu::Bitmap result(width, height);
+        for (unsigned y = 0; y < height; ++y)
+            for (unsigned x = 0; x < width; ++x)
+                result.setPixel(x, y, Gosu::Color(255, x & 0xff, y & 0xff, (x ^ y) & 0xff));
+        return result;
+    }
+
+    // Like pattern, but every third pixel is the color key.
+    Gosu::Bitmap keyedPattern(unsigned width, unsigned height)
+    {
+        Gosu::Bitmap result = pattern(width, height);
+        for (unsigned y = 0; y < height; ++y)
+            for (unsigned x = (y % 3); x < width; x += 3)
+                result.setPixel(x, y, Gosu::Color::FUCHSIA);
+        return result;
+    }
+
+    // Runs the measurement repeatedly and returns megapixels per second.
+    template<typename Measurement>
+    double megapixelsPerSecond(Measurement& measurement, unsigned pixels)
+    {
+        unsigned runs = 0;
+        std::tr1::uint64_t start = Gosu::microseconds(), elapsed;
+        do
+        {
+            measurement();
+            ++runs;
+            elapsed = Gosu::microseconds() - start;
+        }
+        while (elapsed < minDuration);
+        return double(pixels) * runs / elapsed;
+    }
+
+    struct Insert
+    {
+        Gosu::Bitmap source, dest;
+        // Inserted one pixel off, so that the right and bottom edges are
+        // clipped like they often are.
+        void operator()() { dest.insert(source, 1, 1); }
+    };
+
+    struct Resize
+    {
+        Gosu::Bitmap source;
+        unsigned size;
+        void operator()()
+        {
+            Gosu::Bitmap copy = source;
+            copy.resize(size * 2, size * 2);
+        }
+    };
+
+    struct BorderFlags
+    {
+        Gosu::Bitmap source, dest;
+        void operator()()
+        {
+            Gosu::applyBorderFlags(dest, source, 0, 0, source.width(), source.height(),
+                Gosu::bfSmooth);
+        }
+    };
+
+    struct Tiles
+    {
+        Gosu::Bitmap source, tile;
+        void operator()()
+        {
+            for (unsigned y = 0; y < source.height(); y += tile.height())
+                for (unsigned x = 0; x < source.width(); x += tile.width())
+                    tile.insert(source, 0, 0, x, y, tile.width(), tile.height());
+        }
+    };
+
+    struct Resample
+    {
+        Gosu::Bitmap source, dest;
+        void operator()()
+        {
+            Gosu::resample(dest, source, source.width() / 2, source.height() / 2);
+        }
+    };
+
+    struct ColorKey
+    {
+        Gosu::Bitmap source;
+        // Includes copying the source each time.
+        void operator()()
+        {
+            Gosu::Bitmap copy = source;
+            Gosu::applyColorKey(copy, Gosu::Color::FUCHSIA);
+        }
+    };
+}
+
+int main()
+{
+    try
+    {
+        std::printf("%10s %12s %12s %14s %12s %12s %12s\n", "size", "insert", "resize",
+            "borderFlags", "16px tiles", "colorKey", "resample");
+        for (unsigned i = 0; i < numSizes; ++i)
+        {
+            unsigned size = sizes[i], pixels = size * size;
+
+            Insert insert = { pattern(size, size), Gosu::Bitmap(size, size) };
+            Resize resize = { pattern(size, size), size };
+            BorderFlags borderFlags = { pattern(size, size), Gosu::Bitmap() };
+            Tiles tiles = { pattern(size, size), Gosu::Bitmap(16, 16) };
+            ColorKey colorKey = { keyedPattern(size, size) };
+            Resample resample = { pattern(size, size), Gosu::Bitmap() };
+
+            std::printf("%10u %12.1f %12.1f %14.1f %12.1f %12.1f %12.1f\n", size,
+                megapixelsPerSecond(insert, pixels),
+                megapixelsPerSecond(resize, pixels),
+                megapixelsPerSecond(borderFlags, pixels),
+                megapixelsPerSecond(tiles, pixels),
+                megapixelsPerSecond(colorKey, pixels),
+                megapixelsPerSecond(resample, pixels));
+        }
+        std::printf("(megapixels per second)\n");
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
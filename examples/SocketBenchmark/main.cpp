@@ -0,0 +1,299 @@
+// Measures Gosu's sockets over the loopback interface: how many managed
+// messages per second CommSockets pass on and how long a round trip takes,
+// for every way to update them (one by one, SocketPoller, NetworkThread),
+// and how many packets per second MessageSockets get through.
+// Prints one table per measurement; CPU time is that of the whole process.
+
+#include <Gosu/Sockets.hpp>
+#include <Gosu/Timing.hpp>
+#include <Gosu/TR1.hpp>
+#include <Gosu/AutoLink.hpp>
+
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace
+{
+    const Gosu::SocketAddress loopback = 0x7f000001;
+    const unsigned messageSizes[] = { 16, 256, 4096, 65536 };
+    const unsigned numMessageSizes = sizeof messageSizes / sizeof *messageSizes;
+
+    // Gives up on measurements that take longer than this, in microseconds.
+    const std::tr1::uint64_t timeLimit = 10000000;
+
+    double cpuMilliseconds()
+    {
+        return std::clock() * 1000.0 / CLOCKS_PER_SEC;
+    }
+
+    void count(unsigned& counter, const void*, std::size_t)
+    {
+        ++counter;
+    }
+
+    // A client CommSocket connected to a server CommSocket.
+    struct Connection
+    {
+        std::auto_ptr<Gosu::CommSocket> client, server;
+
+        Connection()
+        {
+            Gosu::ListenerSocket listener(Gosu::anyPort);
+            listener.onConnection = std::tr1::bind(&Connection::accept, this,
+                std::tr1::placeholders::_1);
+            client.reset(new Gosu::CommSocket(Gosu::cmManaged, loopback, listener.port()));
+            while (!server.get())
+                listener.update();
+            client->setLowLatency(true);
+            server->setLowLatency(true);
+        }
+
+        void accept(Gosu::Socket& socket)
+        {
+            server.reset(new Gosu::CommSocket(Gosu::cmManaged, socket));
+        }
+    };
+
+    // Updates both ends of a connection in one of the ways Gosu offers.
+    class Pump
+    {
+    public:
+        virtual ~Pump() {}
+        virtual void update() = 0;
+    };
+
+    class PlainPump : public Pump
+    {
+        Connection& connection;
+
+    public:
+        explicit PlainPump(Connection& connection) : connection(connection) {}
+
+        void update()
+        {
+            connection.client->update();
+            connection.server->update();
+        }
+    };
+
+    class PollerPump : public Pump
+    {
+        Gosu::SocketPoller poller;
+        Connection& connection;
+
+    public:
+        explicit PollerPump(Connection& connection)
+        : connection(connection)
+        {
+            poller.add(*connection.client);
+            poller.add(*connection.server);
+        }
+
+        ~PollerPump()
+        {
+            poller.remove(*connection.client);
+            poller.remove(*connection.server);
+        }
+
+        void update()
+        {
+            poller.update(1);
+        }
+    };
+
+    void measureCommSockets(const char* name, bool usePoller)
+    {
+        std::printf("CommSocket, %s\n", name);
+        std::printf("%10s %14s %16s %18s\n", "bytes", "messages/s", "round trip (us)", "CPU ms/1k msgs");
+
+        for (unsigned i = 0; i < numMessageSizes; ++i)
+        {
+            Connection connection;
+            std::auto_ptr<Pump> pump;
+            if (usePoller)
+                pump.reset(new PollerPump(connection));
+            else
+                pump.reset(new PlainPump(connection));
+
+            std::vector<char> message(messageSizes[i], 'x');
+            unsigned received = 0, echoed = 0;
+            connection.server->onReceive = std::tr1::bind(count, std::tr1::ref(received),
+                std::tr1::placeholders::_1, std::tr1::placeholders::_2);
+            connection.client->onReceive = std::tr1::bind(count, std::tr1::ref(echoed),
+                std::tr1::placeholders::_1, std::tr1::placeholders::_2);
+
+            // Throughput: As many messages as possible in one direction.
+            const unsigned streamed = messageSizes[i] > 4096 ? 2000 : 20000;
+            double cpu = cpuMilliseconds();
+            std::tr1::uint64_t start = Gosu::microseconds();
+            for (unsigned j = 0; j < streamed; ++j)
+            {
+                connection.client->send(&message[0], message.size());
+                if (j % 64 == 0)
+                    pump->update();
+            }
+            while (received < streamed && Gosu::microseconds() - start < timeLimit)
+                pump->update();
+            double seconds = (Gosu::microseconds() - start) / 1000000.0;
+            cpu = cpuMilliseconds() - cpu;
+
+            // Latency: One message at a time, echoed by the server.
+            connection.server->onReceive = std::tr1::bind(
+                static_cast<void (Gosu::CommSocket::*)(const void*, std::size_t)>(&Gosu::CommSocket::send),
+                connection.server.get(), std::tr1::placeholders::_1, std::tr1::placeholders::_2);
+            const unsigned roundTrips = 1000;
+            std::tr1::uint64_t latencyStart = Gosu::microseconds();
+            for (unsigned j = 0; j < roundTrips; ++j)
+            {
+                connection.client->send(&message[0], message.size());
+                while (echoed <= j && Gosu::microseconds() - latencyStart < timeLimit)
+                    pump->update();
+            }
+            double roundTrip = double(Gosu::microseconds() - latencyStart) / roundTrips;
+
+            std::printf("%10u %14.0f %16.1f %18.2f\n", messageSizes[i],
+                received / seconds, roundTrip, cpu * 1000 / streamed);
+        }
+        std::printf("\n");
+    }
+
+    struct ThreadedCounter
+    {
+        unsigned received;
+        Gosu::NetworkThread* network;
+        bool echo;
+
+        void receive(Gosu::NetworkThread::Connection connection, Gosu::SocketAddress,
+            Gosu::SocketPort, const void* buffer, std::size_t size, std::tr1::uint64_t)
+        {
+            ++received;
+            if (echo)
+                network->send(connection, buffer, size);
+        }
+    };
+
+    void measureNetworkThread()
+    {
+        using namespace std::tr1::placeholders;
+
+        std::printf("CommSocket, NetworkThread\n");
+        std::printf("%10s %14s %16s %18s\n", "bytes", "messages/s", "round trip (us)", "CPU ms/1k msgs");
+
+        for (unsigned i = 0; i < numMessageSizes; ++i)
+        {
+            Gosu::NetworkThread serverThread, clientThread;
+            ThreadedCounter server = { 0, &serverThread, false };
+            ThreadedCounter client = { 0, &clientThread, false };
+            serverThread.onReceive = std::tr1::bind(&ThreadedCounter::receive, &server, _1, _2, _3, _4, _5, _6);
+            clientThread.onReceive = std::tr1::bind(&ThreadedCounter::receive, &client, _1, _2, _3, _4, _5, _6);
+
+            Gosu::NetworkThread::Connection listener = serverThread.listen(Gosu::cmManaged, Gosu::anyPort);
+            Gosu::NetworkThread::Connection connection =
+                clientThread.connect(Gosu::cmManaged, loopback, serverThread.localPort(listener));
+
+            std::vector<char> message(messageSizes[i], 'x');
+            const unsigned streamed = messageSizes[i] > 4096 ? 2000 : 20000;
+            double cpu = cpuMilliseconds();
+            std::tr1::uint64_t start = Gosu::microseconds();
+            for (unsigned j = 0; j < streamed; ++j)
+                clientThread.send(connection, &message[0], message.size());
+            while (server.received < streamed && Gosu::microseconds() - start < timeLimit)
+            {
+                serverThread.update();
+                Gosu::sleep(1);
+            }
+            double seconds = (Gosu::microseconds() - start) / 1000000.0;
+            cpu = cpuMilliseconds() - cpu;
+
+            server.echo = true;
+            const unsigned roundTrips = 200;
+            std::tr1::uint64_t latencyStart = Gosu::microseconds();
+            for (unsigned j = 0; j < roundTrips; ++j)
+            {
+                clientThread.send(connection, &message[0], message.size());
+                while (client.received <= j && Gosu::microseconds() - latencyStart < timeLimit)
+                {
+                    serverThread.update();
+                    clientThread.update();
+                }
+            }
+            double roundTrip = double(Gosu::microseconds() - latencyStart) / roundTrips;
+
+            std::printf("%10u %14.0f %16.1f %18.2f\n", messageSizes[i],
+                server.received / seconds, roundTrip, cpu * 1000 / streamed);
+        }
+        std::printf("\n");
+    }
+
+    void countPacket(unsigned& counter, Gosu::SocketAddress, Gosu::SocketPort,
+        const void*, std::size_t)
+    {
+        ++counter;
+    }
+
+    void measureMessageSockets()
+    {
+        std::printf("MessageSocket\n");
+        std::printf("%10s %10s %14s %10s %18s\n", "bytes", "batched", "packets/s", "lost", "CPU ms/1k packets");
+
+        for (unsigned batched = 0; batched < 2; ++batched)
+        {
+            for (unsigned i = 0; i < 3; ++i)
+            {
+                Gosu::MessageSocket sender(Gosu::anyPort), receiver(Gosu::anyPort);
+                unsigned received = 0;
+                receiver.onReceive = std::tr1::bind(countPacket, std::tr1::ref(received),
+                    std::tr1::placeholders::_1, std::tr1::placeholders::_2,
+                    std::tr1::placeholders::_3, std::tr1::placeholders::_4);
+
+                std::vector<char> message(messageSizes[i], 'x');
+                Gosu::OutgoingMessage outgoing = { loopback, receiver.port(),
+                    &message[0], message.size() };
+                std::vector<Gosu::OutgoingMessage> batch(32, outgoing);
+
+                // Sends in small bursts, so that the receiving buffer of the
+                // system does not simply overflow.
+                const unsigned packets = 50000;
+                unsigned sent = 0;
+                double cpu = cpuMilliseconds();
+                std::tr1::uint64_t start = Gosu::microseconds();
+                for (; sent < packets; sent += batch.size())
+                {
+                    if (batched)
+                        sender.send(&batch[0], batch.size());
+                    else
+                        for (unsigned j = 0; j < batch.size(); ++j)
+                            sender.send(loopback, receiver.port(), &message[0], message.size());
+                    receiver.update();
+                }
+                receiver.update();
+                double seconds = (Gosu::microseconds() - start) / 1000000.0;
+                cpu = cpuMilliseconds() - cpu;
+
+                std::printf("%10u %10s %14.0f %10u %18.2f\n", messageSizes[i],
+                    batched ? "yes" : "no", received / seconds, sent - received,
+                    cpu * 1000 / sent);
+            }
+        }
+        std::printf("\n");
+    }
+}
+
+int main()
+{
+    try
+    {
+        measureCommSockets("update() on each socket", false);
+        measureCommSockets("SocketPoller", true);
+        measureNetworkThread();
+        measureMessageSockets();
+    }
+    catch (const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+}
@@ -61,8 +61,8 @@ class TextField < Gosu::TextInput
                       x + width + PADDING, y + height + PADDING, background_color, 0)
     
     # Calculate the position of the caret and the selection start.
-    pos_x = x + @font.text_width(self.text[0...self.caret_pos])
-    sel_x = x + @font.text_width(self.text[0...self.selection_start])
+    pos_x = x + caret_x(@font)
+    sel_x = x + selection_start_x(@font)
     
     # Draw the selection background, if any; if not, sel_x and pos_x will be
     # the same value, making this quad empty.
@@ -84,7 +84,7 @@ class TextField < Gosu::TextInput
   # This text field grows with the text that's being entered.
   # (Usually one would use clip_to and scroll around on the text field.)
   def width
-    @font.text_width(self.text)
+    text_width(@font)
   end
   
   def height
@@ -80,8 +80,8 @@ public:
                                    x + width() + PADDING, y + height() + PADDING, backgroundColor, 0);
     
         // Calculate the position of the caret and the selection start.
-        double posX = x + font.textWidth(text().substr(0, caretPos()));
-        double selX = x + font.textWidth(text().substr(0, selectionStart()));
+        double posX = x + caretX(font);
+        double selX = x + selectionStartX(font);
 
         // Draw the selection background, if any; if not, sel_x and pos_x will be
         // the same value, making this quad empty.
@@ -103,7 +103,7 @@ public:
     // (Usually one would use beginClipping/endClipping and scroll around on the text field.)
     double width() const
     {
-        return font.textWidth(text());
+        return textWidth(font);
     }
     
     double height() const
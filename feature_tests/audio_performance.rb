@@ -0,0 +1,65 @@
+# Measures the hot paths of Gosu's audio system: loading samples, playing
+# them while many others are busy, streaming songs, and how songs cope
+# with a main thread that stalls. Prints one table per measurement; run it
+# before and after changes to the audio code to compare.
+
+# Require cutting-edge development Gosu for testing.
+$LOAD_PATH << '../lib'
+require 'gosu'
+
+def milliseconds_for(repeats = 1)
+  start = Time.now
+  repeats.times { yield }
+  (Time.now - start) * 1000 / repeats
+end
+
+def cpu_seconds
+  times = Process.times
+  times.utime + times.stime
+end
+
+puts 'Sample load time per format (ms)'
+Dir['audio_formats/*'].sort.each do |filename|
+  begin
+    time = milliseconds_for(5) { Gosu::Sample.new(filename) }
+    puts '%32s %8.2f' % [File.basename(filename), time]
+  rescue
+    puts '%32s %8s' % [File.basename(filename), 'n/a']
+  end
+end
+puts
+
+puts 'Sample#play latency with busy channels (microseconds)'
+sample = Gosu::Sample.new('media/Sample.wav')
+loop_sample = Gosu::Sample.new('media/Loop.wav')
+[0, 50, 250].each do |busy|
+  Gosu::Sample.max_channels = busy + 100
+  voices = (1..busy).map { loop_sample.play(0, 1, true) }
+  Gosu::Song.update
+  time = milliseconds_for(100) { sample.play(0).stop } * 1000
+  puts '%8d voices %10.1f (%d active)' % [busy, time, Gosu::Sample.active_channels]
+  voices.each { |voice| voice.stop }
+  Gosu::Song.update
+end
+puts
+
+puts 'Song streaming CPU time'
+song = Gosu::Song.new('media/JingleBells.ogg')
+song.volume = 0
+song.play
+cpu = cpu_seconds
+sleep 5
+puts '%.1f ms of CPU time per second of playback' % ((cpu_seconds - cpu) * 1000 / 5)
+puts
+
+puts 'Song underruns with a stalling main thread'
+[0, 100, 250, 500].each do |stall|
+  underruns = Gosu::Song.underruns
+  start = Time.now
+  while Time.now - start < 3
+    Gosu::Song.update
+    sleep stall / 1000.0
+  end
+  puts '%6d ms stalls: %d underruns' % [stall, Gosu::Song.underruns - underruns]
+end
+song.stop
@@ -0,0 +1,43 @@
+# Measures how long it takes to pack thousands of mixed-size images into
+# Gosu's texture atlases, and shows the result.
+
+$LOAD_PATH << '../lib'
+require 'gosu'
+
+Blob = Struct.new(:columns, :rows, :to_blob)
+
+class TexturePackingPerformance < Gosu::Window
+  COUNT = 4000
+  
+  def initialize
+    super 1024, 768, false
+    
+    srand 1
+    blobs = (1..COUNT).map do
+      # Mostly glyph- and tile-sized images, with a few larger ones mixed in.
+      w, h = rand(60) + 2, rand(60) + 2
+      w = rand(200) + 100 if rand(20) == 0
+      color = [rand(256), rand(256), rand(256), 255].pack('C*')
+      Blob.new(w, h, color * (w * h))
+    end
+    
+    start = Gosu::milliseconds
+    @images = blobs.map { |blob| Gosu::Image.new(self, blob, false) }
+    self.caption = "Packed #{COUNT} images in #{Gosu::milliseconds - start} ms"
+  end
+  
+  def draw
+    x = y = 0
+    @images.each do |image|
+      image.draw x, y, 0
+      x += image.width
+      x, y = 0, y + 60 if x > width
+    end
+  end
+  
+  def button_down(id)
+    close if id == Gosu::KbEscape
+  end
+end
+
+TexturePackingPerformance.new.show
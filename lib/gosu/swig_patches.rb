@@ -32,6 +32,31 @@ class Gosu::Window
     unsafe_gl(*args, &block)
   end
   
+  alias record_internal record
+  def record(width, height, &block)
+    outer_gl_blocks, $gosu_gl_blocks = $gosu_gl_blocks, nil
+    image = record_internal(width, height, &block)
+    # gl blocks in the macro run whenever it is drawn, so they have to live
+    # as long as the image.
+    image.instance_variable_set :@_gl_blocks, $gosu_gl_blocks if $gosu_gl_blocks
+    image
+  ensure
+    $gosu_gl_blocks = outer_gl_blocks
+  end
+  
+  # Calls the block after every frame with a Hash of CPU times and the
+  # Gosu methods called during that frame, see the reference.
+  def on_frame(&block)
+    self.frame_callback = block && proc do |report|
+      begin
+        block.call report unless defined? @_exception
+      rescue Exception => e
+        @_exception = e
+        close
+      end
+    end
+  end
+  
   alias show_internal show
   def show
     show_internal
@@ -46,6 +71,19 @@ class Gosu::Window
   end
 end
 
+# Spans of Ruby code, measured here so that tracing costs nothing while it is off.
+module Gosu
+  def self.trace(name)
+    return yield unless tracing?
+    start = microseconds
+    begin
+      yield
+    ensure
+      trace_span(name.to_s, start, microseconds - start)
+    end
+  end
+end
+
 # SWIG doesn't understand the C++ overloading, so we need this simple check in Ruby.
 class Gosu::Image
   def self.from_text(*args)
@@ -14,24 +14,42 @@ puts 'https://github.com/jlnr/gosu/wiki/Getting-Started-on-Linux'
 puts
 
 BASE_FILES = %w(
+  Archive.cpp
+  Async.cpp
+  Audio/SoundScape.cpp
   DirectoriesUnix.cpp
   FileUnix.cpp
+  Graphics/Atlas.cpp
   Graphics/Bitmap.cpp
   Graphics/BitmapColorKey.cpp
+  Graphics/BitmapResample.cpp
   Graphics/BitmapUtils.cpp
   Graphics/BlockAllocator.cpp
+  Graphics/FrameCapture.cpp
   Graphics/Color.cpp
+  Graphics/CompressedTexture.cpp
   Graphics/Font.cpp
   Graphics/Graphics.cpp
   Graphics/Image.cpp
   Graphics/LargeImageData.cpp
+  Graphics/Particles.cpp
+  Graphics/RenderTarget.cpp
+  Graphics/Shader.cpp
   Graphics/TexChunk.cpp
   Graphics/Text.cpp
   Graphics/Texture.cpp
+  Graphics/Animation.cpp
+  Graphics/Camera.cpp
+  Graphics/CollisionMask.cpp
+  Graphics/SpriteLayer.cpp
+  Graphics/TileLayer.cpp
   Graphics/Transform.cpp
   Inspection.cpp
   IO.cpp
   Math.cpp
+  ResourceCache.cpp
+  SpatialHash.cpp
+  Trace.cpp
   RubyGosu_wrap.cxx
   Utility.cpp
 )
@@ -110,8 +128,19 @@ else
   have_header('SDL_ttf.h')   if have_library('SDL_ttf', 'TTF_RenderUTF8_Blended')
   have_header('FreeImage.h') if have_library('freeimage', 'FreeImage_ConvertFromRawBits')
   have_header('AL/al.h')     if have_library('openal')
+  have_library('pthread')
+  # Headless windows (GOSU_HEADLESS) render into EGL pbuffers.
+  have_header('EGL/egl.h') if have_library('EGL', 'eglGetDisplay')
+  # clock_gettime is only part of libc itself since glibc 2.17.
+  have_library('rt', 'clock_gettime')
 end
 
+# Lets loading release the interpreter lock (Ruby 2.0+, or 1.9).
+have_header('ruby/thread.h')
+have_func('rb_thread_call_without_gvl', 'ruby/thread.h') or have_func('rb_thread_blocking_region')
+# Lets textures and sounds count towards the GC's allocations (Ruby 2.4+).
+have_func('rb_gc_adjust_memory_usage')
+
 # Copy all relevant C++ files into the current directory
 # FIXME Could be done by gem task instead.
 SOURCE_FILES.each do |file|
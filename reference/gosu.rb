@@ -162,6 +162,27 @@ module Gosu
     # v:: Float from 0..1.
     def self.from_ahsv(a, h, s, v); end
     
+    # Converts many HSV triples into colors at once, without creating a Color
+    # object for each.
+    # hsv:: String of native floats, e.g. [h, s, v, h, s, v].pack('f*').
+    # a:: Integer from 0..255, the alpha value of all colors.
+    #
+    # @return [String] 0xaarrggbb values as native 32-bit integers, to be
+    #   read with unpack('L*').
+    def self.from_hsv_packed(hsv, a=255); end
+    
+    # Interpolates two strings of colors in the format of from_hsv_packed,
+    # color by color. The weight is rounded to 1/256.
+    #
+    # @return [String]
+    def self.interpolate_packed(a, b, weight=0.5); end
+    
+    # Multiplies two strings of colors in the format of from_hsv_packed,
+    # color by color.
+    #
+    # @return [String]
+    def self.multiply_packed(a, b); end
+    
     # 32-bit unsigned value for use with OpenGL ('RGBA' octet in memory).
     def gl; end
     
@@ -215,6 +236,9 @@ module Gosu
     # Returns the width, in pixels, the given text would occupy if drawn.
     def text_width(text, factor_x=1); end
     
+    # Bytes of video memory on the textures that the font caches its characters on.
+    def memory_usage(); end
+    
     # Analogous to draw, but rotates the text by a given angle.
     # @deprecated Use a combination of Window#rotate and Font#draw instead.
     def draw_rot(text, x, y, z, angle, factor_x=1, factor_y=1, color=0xffffffff, mode=:default); end
@@ -228,6 +252,9 @@ module Gosu
     # given window. See the Gosu wiki for a list of supported formats.
     #
     # A color key of #ff00ff is automatically applied to BMP type images.
+    #
+    # DDS (DXT1/3/5) and KTX files are kept compressed on the graphics card,
+    # which saves a lot of video memory for large backgrounds.
     def initialize(window, filename_or_rmagick_image, tileable); end
     
     # Loads an image from a given filename that can be drawn onto the
@@ -272,6 +299,14 @@ module Gosu
     # align:: One of :left, :right, :center or :justify.
     def self.from_text(window, text, font_name, font_height, line_spacing, max_width, align); end
     
+    # Creates an Image from raw pixels, without the detour through RMagick or another object that
+    # responds to to_blob.
+    #
+    # blob:: A String of width * height pixels, row by row, each as red, green, blue and alpha.
+    #   These are either bytes (as from [...].pack('C*')) or native floats from 0 to 1
+    #   (as from [...].pack('f*')), which is told apart by the length of the string.
+    def self.from_blob(window, blob, width, height, tileable=false); end
+    
     # Convenience function that splits an image file into an array of small rectangles and
     # creates images from these. Returns the Array containing Image instances.
     #
@@ -281,6 +316,35 @@ module Gosu
     # tile_height:: See tile_width.
     def self.load_tiles(window, filename_or_rmagick_image, tile_width, tile_height, tileable); end
     
+    # Loads many image files at once. The files are decoded in parallel on all
+    # CPU cores, which makes this much faster than creating the images one by
+    # one at startup.
+    #
+    # @return [Array<Image>] the images, in the same order as the filenames.
+    def self.load_images(window, filenames, tileable=false); end
+    
+    # Draws many copies of the image at once, which is much faster than calling draw_rot for each
+    # of them, e.g. for bullets or particles. Each copy is rotated and scaled around its center.
+    #
+    # @param instances [Array, String] x, y, scale, angle and color of the first copy, then of the
+    #   second copy, and so on, all in one flat array. The same array packed as native doubles
+    #   (instances.pack('d*')) is read faster still, and can be kept and updated between frames.
+    def draw_many(instances, z, mode=:default); end
+    
+    # Draws triangles textured with parts of the image, e.g. to bend or ripple it, which is much
+    # faster than drawing it as a grid of subimages. Not supported for images that are too large
+    # for a single texture.
+    #
+    # @param vertices [Array] x, y, u, v and color of each vertex, all in one flat array. u and v
+    #   are the position on the image, from 0 at its left or top border to 1 at the opposite one.
+    # @param indices [Array<Integer>] three indices into the vertices for each triangle.
+    def draw_mesh(vertices, indices, z, mode=:default); end
+    
+    # Lets go of the image's texture memory right away, instead of when the image is garbage
+    # collected. Other images that share the texture, e.g. subimages, keep it alive. The image
+    # must not be used afterwards, and must not have been drawn during the current frame.
+    def dispose; end
+    
     # See examples/OpenGLIntegration.rb.
     def gl_tex_info; end
     
@@ -298,20 +362,262 @@ module Gosu
     # The file format is determined from the file extension. See the Gosu
     # wiki for a list of portably supported formats.
     def save(filename); end
+    
+    # Large images are uploaded to the graphics card in the background where
+    # supported. Drawing an image before it is ready is fine, but may cause
+    # a short hitch.
+    #
+    # @return [true, false] whether the image's pixels have arrived.
+    def ready?; end
+  end
+  
+  # Describes how a ParticleEmitter creates and moves its particles. Ranges (min_..., max_...)
+  # are sampled randomly for each new particle; scale and color change linearly over a
+  # particle's lifetime. Directions are in degrees with 0 being up, speeds in pixels per second.
+  class ParticleSettings
+    attr_accessor :rate, :min_lifetime, :max_lifetime, :direction, :spread
+    attr_accessor :min_speed, :max_speed, :acceleration_x, :acceleration_y
+    attr_accessor :min_spin, :max_spin, :start_scale, :end_scale, :start_color, :end_color
+  end
+  
+  # Simulates and draws many copies of one image in native code, e.g. for smoke, sparks or rain.
+  class ParticleEmitter
+    def initialize(image, settings=ParticleSettings.new, max_particles=1000); end
+    
+    # Changing the settings only affects particles that are emitted afterwards.
+    attr_accessor :settings
+    
+    attr_reader :x, :y
+    
+    # Sets where new particles appear.
+    def set_position(x, y); end
+    
+    # Number of living particles.
+    def particles; end
+    
+    # Emits a number of particles right away, e.g. for explosions.
+    def emit(count); end
+    
+    # Advances the simulation, usually called once per Window#update.
+    def update(seconds); end
+    
+    # Draws all particles with a single batch per emitter.
+    def draw(z, mode=:default); end
+  end
+  
+  # An image that can be drawn into, e.g. to put together UI panels or minimaps. Unlike with
+  # Window#record, the drawing is rendered onto a texture once, so the result can be tinted,
+  # saved and drawn as cheaply as any other image. It is only rendered again when you ask for it.
+  class RenderTarget
+    def initialize(window, width, height); end
+    
+    attr_reader :width
+    attr_reader :height
+    
+    # True until the target has been rendered for the first time, and again after mark_dirty.
+    def dirty; end
+    
+    def mark_dirty; end
+    
+    # Renders everything drawn within the block into the target, with (0, 0) being the target's
+    # upper left corner. Clipping and unsafe_gl are not available within the block.
+    def render(clear_with_color=0x00000000, &rendering_code); end
+    
+    # @return [Gosu::Image] the contents of the target. It keeps showing the latest contents.
+    def image; end
+  end
+  
+  # A GLSL program that replaces OpenGL's fixed-function processing for everything drawn within
+  # Window#shader. Requires OpenGL 2.0. Fragment shaders receive the vertex color in gl_Color and
+  # the texture coordinates in gl_TexCoord[0]; the texture is bound to texture unit 0.
+  class Shader
+    # Raises a RuntimeError with the driver's log if the shader cannot be compiled or linked.
+    #
+    # @param vertex_source [String] an empty string uses a default vertex shader.
+    def initialize(fragment_source, vertex_source=""); end
+    
+    # Sets a uniform variable to one, two or four floats, or to an integer (pass 1.0 instead of
+    # 1 for float uniforms). Drawing happens at the end of the frame, so the last value set in a
+    # frame counts for everything drawn with the shader in it.
+    def set_uniform(name, *values); end
+  end
+  
+  # Which pixels of an image are solid, one bit per pixel, for pixel-perfect collisions. Load it
+  # from the same source as the image instead of calling Image#to_blob, which has to read the
+  # pixels back from the graphics card.
+  class CollisionMask
+    # @param source [String, Magick::Image] like for Image.new.
+    # @param alpha_threshold [Integer] pixels with at least this alpha value are solid.
+    def initialize(source, alpha_threshold=128); end
+    
+    # Splits the source into masks the way Image.load_tiles splits it into images.
+    #
+    # @return [Array<CollisionMask>]
+    def self.load_tiles(source, tile_width, tile_height, alpha_threshold=128); end
+    
+    attr_reader :width, :height
+    def solid?(x, y); end
+    
+    # Returns true if any solid pixels of both masks meet when other is offset by (offset_x,
+    # offset_y) pixels from this mask. Tests 32 pixels at once.
+    def overlaps?(other, offset_x, offset_y); end
+    
+    # @return [CollisionMask] a copy for a sprite drawn with these factors; worth keeping around.
+    def scaled(factor_x, factor_y); end
+  end
+  
+  # Looks at a point of a scrolling world, optionally zoomed and rotated, and shows it in the
+  # middle of its viewport. The world is drawn in parallax layers, each under one transformation.
+  # Tile layers and large images only look at what the camera can see.
+  class Camera
+    def initialize(window); end
+    
+    attr_reader :x, :y
+    def set_position(x, y); end
+    attr_accessor :zoom
+    # In degrees.
+    attr_accessor :angle
+    # The part of the screen to draw to, e.g. for split screens. Layers are clipped to it.
+    def set_viewport(left, top, width, height); end
+    
+    # @return [Array<Float>] [left, top, right, bottom] of the part of a layer the camera sees.
+    def visible_rect(parallax=1); end
+    # @return [Array<Float>] [x, y] in the layer for a point on the screen, e.g. the mouse.
+    def to_world(screen_x, screen_y, parallax=1); end
+    # @return [Array<Float>] [screen_x, screen_y] for a point in the layer.
+    def to_screen(x, y, parallax=1); end
+    
+    # Draws the block into a parallax layer. Layers with a parallax of 1 move with the camera,
+    # smaller values appear farther away, and 0 keeps the layer in place.
+    def layer(parallax=1, &rendering_code); end
+  end
+  
+  # A grid of tiles that rarely changes, such as one layer of a map. It is split into chunks that
+  # are each recorded once and then drawn in one go, and only visible chunks are drawn. Changing
+  # a tile only records its chunk again. Much faster than drawing each tile every frame.
+  class TileLayer
+    # Index of an empty cell.
+    NO_TILE = -1
+    
+    # Creates an empty layer. Cells are as large as the first tile.
+    #
+    # @param tiles [Array<Image>] usually from Image.load_tiles.
+    # @param chunk_size [Integer] width and height of a chunk, in tiles.
+    def initialize(window, tiles, columns, rows, chunk_size=16); end
+    
+    attr_reader :columns
+    attr_reader :rows
+    
+    # @return [Integer] an index into tiles, or NO_TILE.
+    def tile(column, row); end
+    
+    def set_tile(column, row, tile); end
+    
+    # Draws the layer with its upper left corner at (x, y).
+    def draw(x, y, z, color=0xffffffff, mode=:default); end
+  end
+  
+  # Sprites that are kept between frames. Sprites with the same z are recorded into
+  # macros in buckets, and changing a sprite only re-records its bucket when the layer
+  # is drawn next. Best for many sprites of which few change each frame.
+  class SpriteLayer
+    # @param bucket_size [Integer] most sprites per recorded bucket.
+    def initialize(window, bucket_size=256); end
+    
+    # Adds a sprite that is drawn like Image#draw_rot around its center.
+    #
+    # @return [Integer] a handle to the sprite, which stays invalid once it is removed.
+    def add(image, x, y, z, angle=0, factor_x=1, factor_y=1, color=0xffffffff); end
+    def remove(handle); end
+    def clear; end
+    def contains?(handle); end
+    def size; end
+    
+    def set_image(handle, image); end
+    def set_position(handle, x, y); end
+    def set_transform(handle, angle, factor_x=1, factor_y=1); end
+    def set_color(handle, color); end
+    def set_z(handle, z); end
+    
+    def x(handle); end
+    def y(handle); end
+    def z(handle); end
+    
+    # Draws every sprite at its own z.
+    def draw(mode=:default); end
+  end
+  
+  # Frames, usually from Image.load_tiles, that are each shown for a number of milliseconds.
+  class Animation
+    # @param durations [Integer, Array<Integer>] one duration for all frames, or one per frame.
+    def initialize(frames, durations); end
+    
+    attr_reader :frame_count
+    # Sum of all durations, in milliseconds.
+    attr_reader :duration
+    
+    def frame(index); end
+    # @return [Image] the frame to show after time milliseconds. Without looping, the last
+    # frame stays.
+    def frame_at(time, looping=true); end
+    def frame_index_at(time, looping=true); end
+  end
+  
+  # Plays animations on the sprites of a SpriteLayer. Calling update once per Window#update
+  # advances all of them at once, and only touches the sprites whose frame changes.
+  class Animator
+    def initialize(sprite_layer); end
+    
+    # Starts playing an animation on a sprite, replacing its previous one.
+    def play(sprite, animation, looping=true, speed=1); end
+    # Leaves the sprite on its current frame.
+    def stop(sprite); end
+    # false once an animation without looping shows its last frame.
+    def playing?(sprite); end
+    def size; end
+    
+    # Time does not pass for the animations while paused.
+    def paused?; end
+    def paused=(value); end
+    
+    def update; end
+  end
+  
+  # Counters of what the renderer did in one frame, as returned by Gosu.renderer_statistics.
+  # sort_time is in microseconds; texture_binds, transform_changes, clip_changes and
+  # blend_changes count how often the render state changed between draw calls.
+  class RendererStatistics
+    attr_reader :scheduled_ops, :culled_ops, :sort_time, :batches, :vertices
+    attr_reader :texture_binds, :transform_changes, :clip_changes, :blend_changes, :gl_blocks
+    # Operations drawn with a depth test instead of being sorted.
+    attr_reader :opaque_ops
+    # Microseconds spent between the start and the end of the frame on the CPU and GPU.
+    attr_reader :cpu_time, :gpu_time, :gl_block_gpu_time
+    # Microseconds of cpu_time spent handing everything to OpenGL at the end of the frame.
+    attr_reader :flush_time
+  end
+  
+  # Bytes of memory held by each of Gosu's subsystems, as returned by Gosu.memory_statistics.
+  # large_image_parts are included in atlas_textures and dedicated_textures as well.
+  class MemoryStatistics
+    attr_reader :atlas_textures, :dedicated_textures, :font_glyphs, :large_image_parts
+    attr_reader :streamed_images, :samples, :songs, :macros, :sockets
   end
   
   # A sample is a short sound that is completely loaded in memory, can be
   # played multiple times at once and offers very flexible playback
   # parameters. Use samples for everything that's not music.
   class Sample
-    def initialize(window, filename); end
+    # compressed:: If true and the file is in the Ogg Vorbis format, it is kept compressed in memory and decoded while playing. Takes much less memory and a little more CPU time; suits long sounds like ambient loops.
+    def initialize(window, filename, compressed=false); end
     
     # Plays the sample without panning.
     #
     # Returns a SampleInstance.
     # volume:: Can be anything from 0.0 (silence) to 1.0 (full volume).
     # speed:: Playback speed is only limited by the underlying audio library, and can accept very high or low values. Use 1.0 for normal playback speed.
-    def play(vol=1, speed=1, looping=false); end
+    # priority:: Decides which sounds may be stopped to make room for this one when all channels are busy (see Sample.stealing_policy=).
+    def play(vol=1, speed=1, looping=false, priority=0); end
     
     # Plays the sample with panning. Even if pan is 0.0, the sample will
     # not be as loud as if it were played by calling play() due to the
@@ -320,7 +626,121 @@ module Gosu
     # Returns a SampleInstance.
     # volume:: Can be anything from 0.0 (silence) to 1.0 (full volume).
     # speed:: Playback speed is only limited by the underlying audio library, and can accept very high or low values. Use 1.0 for normal playback speed.
-    def play_pan(pan=0, vol=1, speed=1, looping=false); end
+    def play_pan(pan=0, vol=1, speed=1, looping=false, priority=0); end
+    
+    # Frees the decoded sound data right away, instead of when the sample is garbage collected.
+    # The sample must not be used afterwards, and should not be playing anymore.
+    def dispose; end
+    
+    # Limits how many instances of this sample can play at once (0, the default, means no limit).
+    # Samples loaded from the same file share this setting.
+    # policy:: What to do with more: Gosu::IlStealOldest (the default) stops the oldest instance,
+    # Gosu::IlIgnoreNew does not play the new one, and Gosu::IlMerge makes the newest instance
+    # louder instead.
+    def set_max_instances(instances, policy=Gosu::IlStealOldest); end
+    
+    # @return [Integer]
+    def max_instances; end
+    
+    # Plays that come within this many milliseconds of the previous one are merged into it, like
+    # with Gosu::IlMerge. 0 (the default) never merges.
+    attr_accessor :min_retrigger_interval
+    
+    # Limits how many samples can play at the same time. Channels are only created when all
+    # existing ones are busy. The default is 254 (31 on iOS).
+    def self.max_channels=(channels); end
+    
+    # Returns how many channels have been created so far.
+    def self.allocated_channels; end
+    
+    # Returns how many samples are playing or paused, as of the last tick.
+    def self.active_channels; end
+    
+    # Decides which sound to stop when a sample is played while all channels are busy:
+    # Gosu::SpNone (the default) does not play the new sound, Gosu::SpOldest,
+    # Gosu::SpQuietest and Gosu::SpLowestPriority stop the sound that was started first, has the
+    # lowest volume or has the lowest priority. Only sounds with the same or a lower priority than
+    # the new one are ever stopped.
+    def self.stealing_policy=(policy); end
+    
+    # If true, what happens to samples during a tick (playing them, changing their volume...) takes
+    # effect all at once at the end of the tick. Saves driver work when many sounds start together.
+    def self.batching=(batching); end
+    
+    # Converts samples loaded afterwards to the device's mixing rate and/or to mono, so that OpenAL
+    # has less work per playing voice. Only mono samples can be panned.
+    def self.set_load_conversion(to_device_rate, to_mono); end
+    
+    # Keeps the decoded data of samples loaded from files in the given directory (which must exist
+    # and end in a separator), so that later runs do not have to decode them again.
+    def self.decoded_cache_directory=(directory); end
+    
+    # Asks for the audio device to mix at the given rate in Hz and the given number of times per
+    # second, and to make room for the given numbers of mono and stereo sounds. Zero leaves a value
+    # up to the driver. More updates per second mean lower latency. Must be called before the
+    # first sample or song is loaded, which opens the device.
+    def self.set_device_configuration(frequency, refresh_rate, mono_sources=0, stereo_sources=0); end
+    
+    # The mixing rate and updates per second that the device was opened with, or 0 before that.
+    def self.device_frequency; end
+    def self.device_refresh_rate; end
+    
+    # How long it can take, in seconds, from playing a sample to hearing it: one mixing period,
+    # plus the device's own latency if the driver reports it. Rhythm games can compensate for it.
+    def self.device_latency; end
+  end
+  
+  # Plays samples at positions in a 2D world, with volume and panning adjusted to where they are
+  # relative to a listener. Sounds too far away to be heard do not take a channel.
+  class SoundScape
+    # range:: Distance from the listener at which sounds fade to silence.
+    # threshold:: Sounds quieter than this (0 to 1) are not played.
+    def initialize(range, threshold=0.02); end
+    
+    attr_reader :listener_x, :listener_y
+    def set_listener(x, y); end
+    
+    # Plays a sample at the given point and returns an id for move and stop. Looping sounds that
+    # cannot be heard are kept as virtual sounds, which start playing once they can be heard.
+    def play(sample, x, y, vol=1, speed=1, looping=false, priority=0); end
+    def move(sound, x, y); end
+    def stop(sound); end
+    def stop_all; end
+    
+    # Updates the volume and panning of all sounds, usually once per Window#update.
+    def update; end
+    
+    def audible_sounds; end
+    def virtual_sounds; end
+  end
+  
+  # Finds objects near a point or inside an area without comparing every pair of them, e.g.
+  # as the broad phase of collision checks. Objects are boxes with integer ids of your choice,
+  # sorted into a grid of square cells.
+  class SpatialHash
+    # cell_size:: Width and height of a cell, best about the size of a typical object.
+    def initialize(cell_size); end
+    
+    attr_reader :cell_size
+    # Number of objects.
+    def size; end
+    def include?(id); end
+    def clear; end
+    
+    # Adds an object, or moves it if the id is already used. Same as update.
+    def insert(id, left, top, right, bottom); end
+    def update(id, left, top, right, bottom); end
+    # @param objects [Array] id, left, top, right and bottom of the first object, then of
+    #   the second one, and so on, all in one flat array.
+    def update_many(objects); end
+    def remove(id); end
+    
+    # @return [Array<Integer>] the ids of the objects that overlap the area, in no particular order.
+    def query_rect(left, top, right, bottom); end
+    # @return [Array<Integer>] the ids of the objects that overlap the circle, in no particular order.
+    def query_radius(x, y, radius); end
+    # @return [Array<Integer>] the ids of every two overlapping objects, one pair after the other.
+    def overlapping_pairs; end
   end
   
   # An instance of a Sample playing. Can be used to stop sounds dynamically,
@@ -358,6 +778,13 @@ module Gosu
     # songs and set the current song to this object.
     def play(looping=false); end
     
+    # Decodes the beginning of the song in the background, so that play does not have to. Call it a
+    # few ticks before switching songs, e.g. at a level transition.
+    def preload; end
+    
+    # Returns false while preload has not finished.
+    def preloaded?; end
+    
     # Pauses playback of the song. It is not considered being played.
     # current_song will stay the same.
     def pause; end
@@ -372,6 +799,14 @@ module Gosu
     
     # Returns true if the song is currently playing.
     def playing?; end
+    
+    # Songs are decoded and streamed on a thread of their own, in the given number of buffers of
+    # the given size in bytes. Applies to songs created afterwards. The default is 4 buffers of
+    # 32 KiB.
+    def self.set_stream_buffers(count, size); end
+    
+    # Returns how often a song ran out of data because its buffers were not refilled in time.
+    def self.underruns; end
   end
   
   # TextInput instances are invisible objects that build a text string from input,
@@ -397,6 +832,18 @@ module Gosu
     def filter text_in
       text_in
     end
+    
+    # Returns the horizontal distance from the start of the text to the caret
+    # when the text is drawn with the given font. The measurements are kept
+    # and only updated where the text changes, so this is cheap enough to call
+    # every frame. Assumes that the text contains no markup.
+    def caret_x(font); end
+    
+    # Like caret_x, but for selection_start.
+    def selection_start_x(font); end
+    
+    # Like caret_x, but for the end of the text.
+    def text_width(font); end
   end
   
   # Main class that serves as the foundation of a standard
@@ -422,6 +869,10 @@ module Gosu
     # update_interval:: Interval in milliseconds between two calls
     # to the update member function. The default means the game will run
     # at 60 FPS, which is ideal on standard 60 Hz TFT screens.
+    #
+    # On Linux, setting the environment variable GOSU_HEADLESS to 1 renders into an offscreen
+    # buffer without opening a window, e.g. for GPU benchmarks on build machines. Frames then
+    # run as fast as possible, and GOSU_HEADLESS_FRAMES can end show after that many of them.
     def initialize(width, height, fullscreen, update_interval=16.666666); end
     
     # Enters a modal loop where the Window is visible on screen and receives calls to draw, update etc.
@@ -460,6 +911,17 @@ module Gosu
     # Returns true if a button is currently pressed. Updated every tick.
     def button_down?(id); end
     
+    # Returns an array with the result of button_down? for each id in the given array, which is
+    # faster than asking for each button separately.
+    def buttons_down(ids); end
+    
+    # Returns true if the button went down during the last tick, even if it has already been
+    # released again.
+    def button_pressed?(id); end
+    
+    # Returns true if the button went up during the last tick.
+    def button_released?(id); end
+    
     # Draws a line from one point to another (last pixel exclusive).
     # Note: OpenGL lines are not reliable at all and may have a missing pixel at the start
     # or end point. Please only use this for debugging purposes. Otherwise, use a quad or
@@ -473,6 +935,37 @@ module Gosu
     # The points can be in clockwise order, or in a Z shape.
     def draw_quad(x1, y1, c1, x2, y2, c2, x3, y3, c3, x4, y4, c4, z=0, mode=:default); end
     
+    # Draws many rectangles at once, which is much faster than calling draw_quad for each of them.
+    # With a thickness of 0, they are filled; otherwise only their outlines are drawn, inside of
+    # them.
+    #
+    # @param rects [Array] x, y, width, height and color of the first rectangle, then of the second
+    #   one, and so on, all in one flat array like for Image#draw_many.
+    def draw_rects(rects, thickness=0, z=0, mode=:default); end
+    
+    # Draws many circles at once, filled or as outlines like draw_rects. Larger circles get more
+    # segments.
+    #
+    # @param circles [Array] x, y, radius and color of each circle, all in one flat array.
+    def draw_circles(circles, thickness=0, z=0, mode=:default); end
+    
+    # Draws a line of the given thickness through the points, with mitered corners. If closed, the
+    # last point is connected to the first one.
+    #
+    # @param points [Array] x and y of each point, all in one flat array.
+    def draw_polyline(points, thickness, color, z=0, mode=:default, closed=false); end
+    
+    # Draws a graph of the most recent frames, one bar per frame: time spent updating (blue),
+    # drawing (green), swapping buffers (gray) and waiting. Bars are full at 33 ms, and a line
+    # marks 16.7 ms. Best called at the end of draw with a high z.
+    def draw_frame_time_graph(x, y, width, height, z, frames=120); end
+    
+    # Calls the block after every frame with a Hash: :update, :draw, :flush (the part of :draw
+    # spent handing the frame to OpenGL), :swap and :total hold CPU times in milliseconds, and
+    # :calls maps the names of the Gosu methods that were called during the frame to how often
+    # they were called. Exceptions end show like those in update. Call without a block to stop.
+    def on_frame(&block); end
+    
     # Flushes all drawing operations to OpenGL so that Z-ordering can start anew. This
     # is useful when drawing several parts of code on top of each other that use conflicting
     # z positions.
@@ -492,17 +985,187 @@ module Gosu
     # Limits the drawing area to a given rectangle while evaluating the code inside of the block.
     def clip_to(x, y, w, h, &rendering_code); end
     
+    # Draws everything within the block with the given Gosu::Shader. Shaders do not apply to
+    # macros that are being recorded, and macros keep the shaders they were recorded with.
+    def shader(shader, &rendering_code); end
+    
+    # Draws everything within the block at the screen's full resolution, after the rest of the
+    # frame has been stretched over the screen (see set_dynamic_resolution). Meant for text and
+    # interface elements, which should lie above everything else.
+    def hud(&rendering_code); end
+    
     # Returns a Gosu::Image that containes everything rendered within the given block. It can be
-    # used to optimize rendering of many static images, e.g. the map. There are still several
-    # restrictions that you will be informed about via exceptions.
+    # used to optimize rendering of many static images, e.g. the map.
+    #
+    # Blocks passed to gl(z) while recording become part of the result. They are called each
+    # time it is drawn, in the order of their z among the recorded images.
     #
     # The returned Gosu::Image will have the width and height you pass as arguments, regardless
     # of how the area you draw on. It is important to pass accurate values if you plan on using
     # Gosu::Image#draw_as_quad or Gosu::Image#draw_rot with the result later.
     #
+    # Like any other image, the result can be drawn with a color to tint it or fade it out.
+    #
     # @return [Gosu::Image]
     def record(width, height, &rendering_code); end
     
+    # Returns a Gosu::Image of what has been drawn so far. Call it at the end of Window#draw to
+    # capture a whole frame, e.g. to compare a headless benchmark run (see initialize) against
+    # a reference image with Image#to_blob.
+    #
+    # @return [Gosu::Image]
+    def screenshot; end
+    
+    # Saves the current frame to an image file once it has been drawn. Unlike screenshot, this
+    # does not stall the GPU, and the file is written in the background, so it can be used
+    # while the game is running. Not available on iOS.
+    def save_screenshot(filename); end
+    
+    # Writes every frame to a file from now on, until end_video_capture. Frames are stored as
+    # raw RGBA pixels at the window's physical size, top row first, e.g. for
+    # "ffmpeg -f rawvideo -pix_fmt rgba -s WIDTHxHEIGHT -i FILE". A named pipe to an encoder
+    # works as well. Not available on iOS.
+    def begin_video_capture(filename); end
+    
+    # Stops writing frames to the file passed to begin_video_capture.
+    def end_video_capture; end
+    
+    # Saves what is drawn in the current frame to a file once it has been sorted for rendering.
+    # The GosuReplay tool that is built with Gosu's benchmarks renders such files repeatedly, to
+    # time changes to Gosu's renderer with real frames. Only texture sizes are saved, not pixels,
+    # and blocks passed to gl are left out.
+    def capture_frame(filename); end
+    
+    # Moves images off textures that are less than half full and releases every texture that
+    # becomes empty this way. This is slow, so call it during loading screens or idle frames.
+    # Note that the gl_tex_info of moved images changes.
+    #
+    # @return [Integer] the number of released textures.
+    def compact_textures; end
+    
+    # Textures that no images live on anymore are released after a couple of
+    # frames. This sets how many of them are kept around anyway, to be reused
+    # by new images. The default is 1.
+    attr_writer :spare_textures
+    
+    # Images and shapes that are completely off screen are discarded before they are queued for
+    # drawing, and Gosu.culled_draw_ops tells how many were skipped in the last frame. Setting
+    # this to false turns that off for debugging.
+    attr_writer :culling
+    
+    # If true, transformations (Window#translate, Window#rotate etc.) are applied to vertices on
+    # the CPU, so that images drawn with different transformations can still be drawn in one
+    # batch. This helps if cameras or UI layers split a frame into many small batches. The
+    # default is false.
+    attr_writer :pretransforming
+    
+    # If true, images within Window#clip_to are clipped on the CPU where possible, i.e. if they
+    # are completely inside of the clipping area, or single-colored and not rotated. They can
+    # then be drawn in one batch with unclipped images, which helps scrolling lists with many
+    # clipped rows. The default is false.
+    attr_writer :geometric_clipping
+    
+    # If true, the time that the GPU needs for each frame is measured and reported in
+    # Gosu.renderer_statistics, a few frames late. Requires OpenGL 3.3. The default is false.
+    attr_writer :gpu_timing
+    
+    # Renders frames at a lower resolution and stretches them over the screen while they take
+    # longer than the given number of milliseconds, and back towards full resolution when they
+    # take less. The resolution never drops below min_scale of the screen's. 0 turns this off,
+    # which is the default. Has no effect with pipelined rendering.
+    def set_dynamic_resolution(milliseconds, min_scale=0.5); end
+    
+    # The fraction of the screen's resolution that the current frame is rendered at.
+    def resolution_scale; end
+    
+    # If true, frames are kept in a texture and only the parts marked with invalidate since the
+    # last frame are drawn again; everything else drawn in that frame is skipped. Meant for
+    # editors and tools, usually together with needs_redraw?. Drawing in hud is not limited.
+    # Has no effect with dynamic resolution or pipelined rendering. The default is false.
+    def partial_redraw=(value); end
+    def partial_redraw?; end
+    
+    # Marks a rectangle to be drawn again in the next frame when partial_redraw is on.
+    def invalidate(x, y, width, height); end
+    # Makes the next frame draw everything again.
+    def invalidate_all; end
+    
+    # If true, the window sleeps until shortly before the next update is due and yields the CPU
+    # until the exact time, instead of sleeping in whole milliseconds. This costs some CPU time
+    # but avoids judder. The default is false.
+    attr_writer :precise_pacing
+    
+    # If true, update is called once per update_interval on average, while draw is called as often
+    # as the screen refreshes. Before each frame, update is called as many times as needed to catch
+    # up, but at most five times. The default is false.
+    attr_writer :fixed_timestep
+    
+    # Whether presenting frames waits for the screen's refresh: :default, :off, :on or :adaptive.
+    # :off is meant for benchmarking. :adaptive waits unless the frame is late already, which tears
+    # a little instead of halving the frame rate, and is the same as :on where the driver does not
+    # support it. :default leaves vsync on on Windows and OS X, and to the driver on Linux unless
+    # fixed_timestep is true. No effect on iOS.
+    attr_writer :vsync
+    
+    # Keeps the driver from queueing up more than this many frames (1 to 3), which otherwise adds
+    # up to 50 ms between reading input and showing its effect. Before each update, the window waits
+    # until the GPU is done with the frame that many frames ago. Requires OpenGL 3.2 or ARB_sync, and
+    # has no effect on iOS or with pipelined rendering. The default is 0, which leaves it to the
+    # driver.
+    attr_writer :max_frames_in_flight
+    
+    # With a fixed timestep, how far the time has advanced from the last update towards the next
+    # one during draw, from 0 to 1. Useful for drawing objects between their previous and current
+    # positions. Always 0 otherwise.
+    def interpolation; end
+    
+    # If true, each frame is rendered and shown on a separate thread while the next one is already
+    # being updated and drawn, which adds one frame of latency. gl, flush and gpu_timing= are
+    # not available then. Only supported on Linux. The default is false.
+    attr_writer :pipelined_rendering
+    
+    # If true, the window waits without using the CPU after each update in which needs_redraw?
+    # returned false, until input arrives, wake_up is called or the time given to wake_up_after has
+    # come. Other Ruby threads do not run while the window waits. Only supported on Linux. The
+    # default is false.
+    attr_writer :idle_mode
+    
+    # Makes a waiting window call update again.
+    def wake_up; end
+    
+    # Makes a waiting window call update again after the given number of milliseconds at the
+    # latest.
+    def wake_up_after(milliseconds); end
+    
+    # If true, input is collected once more right before draw, and button_down and button_up are
+    # called for what happened during update, so that each frame shows it one update earlier. On
+    # OS X, only the mouse position and gamepads are sampled again. The default is false.
+    attr_writer :late_input_sampling
+    
+    # While button_down or button_up is being called, returns when the button was pressed or
+    # released, in the time of Gosu.microseconds. Uses the timestamps of the system's events where
+    # available.
+    def event_time; end
+    
+    # Limits the video memory used by textures, in bytes. At the end of each frame, textures whose
+    # images have not been drawn for the longest time are moved to main memory until the budget is
+    # met; their images are uploaded again when they are next drawn. Gosu.texture_evictions and
+    # Gosu.texture_reloads tell how often this happened. The default, 0, means no limit.
+    attr_writer :texture_budget
+    
+    # Size of the textures that images created from now on are packed onto. Larger ones mean fewer
+    # texture changes and fewer parts for large images, but take size * size * 4 bytes of video
+    # memory each. Rounded down to a power of two of at least 256 and limited to what the graphics
+    # card supports. The default is 1024.
+    attr_writer :atlas_size
+    
+    # Number of layers of the OpenGL texture arrays that the textures of images created from now on
+    # are packed into, so that images on different textures can be drawn in one batch. Each array
+    # takes all of its video memory right away. Needs OpenGL 3.0. Images on arrays cannot be drawn
+    # with a custom shader, and their gl_tex_info is of no use to OpenGL code. 0, the default,
+    # disables texture arrays.
+    attr_writer :texture_arrays
+    
     # Rotates everything drawn in the block around (around_x, around_y).
     def rotate(angle, around_x=0, around_y=0, &rendering_code); end
     
@@ -515,6 +1178,10 @@ module Gosu
     # Moves everything drawn in the block by an offset in each dimension.
     def translate(x, y, &rendering_code); end
     
+    # @return [Array<Float>, nil] [left, top, right, bottom] of what can be seen under the current
+    # transformations, or nil if culling is off or the transformation is not affine.
+    def visible_area; end
+    
     # Applies a free-form matrix rotation to everything drawn in the block.
     def transform(m0, m1, m2, m3, m4, m5, m6, m7, m8, m9, m10, m11, m12, m13, m14, m15, &rendering_code); end
     
@@ -539,8 +1206,22 @@ module Gosu
   end
   
   # Returns a random double between min (inclusive) and max (exclusive).
+  # Every thread has a generator of its own, seeded differently unless seed_random is called.
   def random(min, max); end
   
+  # Returns a random integer between min (inclusive) and max (exclusive), or min if max <= min.
+  def random_int(min, max); end
+  
+  # Seeds the calling thread's generator, so that random and random_int repeat the same
+  # sequence for the same seed.
+  def seed_random(seed); end
+  
+  # Returns count random doubles between min (inclusive) and max (exclusive), faster than
+  # calling random count times.
+  #
+  # @return [String] native doubles, to be read with unpack('d*').
+  def random_packed(count, min, max); end
+  
   # Returns the horizontal distance between the origin and the point to which you would get if you moved radius pixels in the direction specified by angle.
   def offset_x(angle, dist); end 
   
@@ -559,6 +1240,60 @@ module Gosu
   # Incrementing, possibly wrapping millisecond timer.
   def milliseconds(); end
   
+  # Monotonic microsecond timer that does not wrap. Better suited than milliseconds for
+  # measuring short intervals.
+  def microseconds(); end
+  
+  # Starts recording where Gosu spends its time: Window#update and #draw, input, songs, sorting
+  # and submitting draw calls, image creation, font glyphs and sockets. Only the given number of
+  # most recent spans are kept, so tracing can stay on while playing and be saved after a hitch.
+  def start_tracing(capacity=100000); end
+  
+  def stop_tracing(); end
+  
+  def tracing?(); end
+  
+  # Writes the recorded spans as Chrome trace_event JSON, which chrome://tracing and Perfetto
+  # can open.
+  def save_trace(filename); end
+  
+  # Records the time the block takes under the given name while tracing is on, and returns the
+  # value of the block.
+  def trace(name); end
+  
+  # Returns a text table of how long each phase of Gosu's startup took (creating the window, the
+  # OpenGL context, graphics and audio, setting up fonts and rendering the first glyphs), recorded
+  # until the first frame has been drawn. Setting the GOSU_STARTUP_REPORT environment variable
+  # prints it to stderr right after the first frame.
+  def startup_report(); end
+  
+  # Returns a Gosu::RendererStatistics object that describes the work done by the renderer in the
+  # last frame, including macros and render targets.
+  def renderer_statistics(); end
+  
+  # Returns a Gosu::MemoryStatistics object that tells how many bytes textures, fonts, large
+  # images, samples, songs, macros and sockets currently hold.
+  def memory_statistics(); end
+  
+  # Returns a Gosu::FrameTimeStatistics object with the minimum, average, p50, p95, p99 and
+  # maximum time in milliseconds of one phase (Gosu::FpUpdate, FpDraw, FpSwap or FpTotal) over
+  # the given number of recent frames. Percentiles show hitches that the framerate hides.
+  def frame_time_statistics(phase, frames=120); end
+  
+  # Returns a Gosu::FrameTimeStatistics object that describes the time in milliseconds from recent
+  # button presses until the end of the first frame drawn after they were handled; frames holds the
+  # number of presses. This estimates the input latency that players notice, minus what the display
+  # and the input device add.
+  def input_latency_statistics(events=120); end
+  
+  # If enabled, Image.new and Sample.new share the data of an image or sample that was loaded from
+  # the same filename with the same arguments before and still exists. Disabled by default.
+  def enable_resource_cache(enabled); end
+  
+  # Returns a Gosu::ResourceCacheStatistics object with image_hits, image_misses, sample_hits and
+  # sample_misses: how often loading found its data in the cache, or had to load the file.
+  def resource_cache_statistics; end
+  
   # Returns the name of a neutral font that is available on the current
   # platform.
   def default_font_name(); end